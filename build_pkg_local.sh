@@ -21,6 +21,7 @@ docker exec ${RUN_NAME} ./configure --libav-static --extra-cxxflags="-I./AviSynt
 docker exec ${RUN_NAME} make -j${NPROC}
 docker exec ${RUN_NAME} ./${TARGET_EXE} --version
 docker exec ${RUN_NAME} ./check_options.py
+docker exec ${RUN_NAME} make -j${NPROC} check
 docker exec ${RUN_NAME} ./build_${PKG_TYPE}.sh
 docker exec ${RUN_NAME} sh -c "cp -v ./*.${PKG_TYPE} /output/"
 
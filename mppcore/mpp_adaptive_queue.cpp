@@ -0,0 +1,189 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include "rgy_util.h"
+#include "mpp_adaptive_queue.h"
+
+static const double ADAPTIVE_QUEUE_WAIT_GROW_MS = 0.5;  // 1フレームあたりこれ以上待っていたら増やす
+static const double ADAPTIVE_QUEUE_WAIT_IDLE_MS = 0.05; // 1フレームあたりこれ未満なら待ちなしとみなす
+static const int    ADAPTIVE_QUEUE_IDLE_COUNT = 4;      // 待ちなしがこの回数続いたら減らす
+static const int    ADAPTIVE_QUEUE_POOL_STEP = 2;       // 一度に追加するフレーム数
+static const int    ADAPTIVE_QUEUE_ENC_DEPTH_MAX = 8;   // エンコーダの入力バッファ(PipelineTaskMPPEncode::BUF_COUNT)の半分まで
+
+MPPAdaptiveQueue::MPPAdaptiveQueue(const MPPParamAdaptiveQueue& prm, std::shared_ptr<RGYLog> log) :
+    m_prm(prm),
+    m_log(log),
+    m_tasks(),
+    m_lastCheck(0) {
+}
+
+MPPAdaptiveQueue::~MPPAdaptiveQueue() {
+    m_tasks.clear();
+}
+
+void MPPAdaptiveQueue::PrintMes(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log.get() == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_CORE)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    vector<TCHAR> buffer(len, 0);
+    _vstprintf_s(buffer.data(), len, format, args);
+    va_end(args);
+
+    m_log->write(log_level, RGY_LOGT_CORE, (tstring(_T("adaptive-queue: ")) + buffer.data()).c_str());
+}
+
+void MPPAdaptiveQueue::init(std::vector<std::unique_ptr<PipelineTask>>& tasks) {
+    m_tasks.clear();
+    for (auto& t : tasks) {
+        TaskState state = { 0 };
+        state.task = t.get();
+        state.depthInit = t->outputMaxQueueSize();
+        state.poolInit = t->workSurfacesCount();
+        // 出力キューを持たないtask(入力、trim、checkpts等)は深さを変更しない
+        if (state.depthInit <= 0) {
+            state.depthCap = state.depthInit;
+        } else if (t->taskType() == PipelineTaskType::MPPENC) {
+            state.depthCap = std::min(m_prm.maxDepth, ADAPTIVE_QUEUE_ENC_DEPTH_MAX);
+        } else if (state.poolInit > 0 && !t->workSurfacesResizable()) {
+            // 後段のフレームを使うなど、プールを増やせない場合は初期値より深くしない
+            state.depthCap = std::min(m_prm.maxDepth, state.depthInit);
+        } else {
+            state.depthCap = m_prm.maxDepth;
+        }
+        t->setMeasureWait(true);
+        PrintMes(RGY_LOG_INFO, _T("%s: depth %d (max %d), pool %d%s.\n"),
+            getPipelineTaskTypeName(t->taskType()).c_str(), state.depthInit, state.depthCap, (int)state.poolInit,
+            t->workSurfacesResizable() ? _T(" (resizable)") : _T(""));
+        m_tasks.push_back(state);
+    }
+    //対象外のバッファは固定サイズのまま
+    PrintMes(RGY_LOG_INFO, _T("MPP decoder/encoder buffers, encoder input buffers and demux/mux queues are not adjusted.\n"));
+    m_lastCheck = 0;
+}
+
+void MPPAdaptiveQueue::check(const int64_t framesOut) {
+    if (framesOut - m_lastCheck < m_prm.interval) {
+        return;
+    }
+    m_lastCheck = framesOut;
+    for (auto& state : m_tasks) {
+        adjust(state);
+    }
+}
+
+void MPPAdaptiveQueue::adjust(TaskState& state) {
+    auto task = state.task;
+    const auto stat = task->popWaitStat();
+    if (stat.frames <= 0) {
+        return;
+    }
+    const double syncMs = stat.syncWaitMs / stat.frames;
+    const double surfMs = stat.surfWaitMs / stat.frames;
+    const auto name = getPipelineTaskTypeName(task->taskType());
+
+    // フレームプール
+    if (task->workSurfacesResizable()) {
+        // キューを深くした分として追加したフレームは、キューを浅くするまで解放しない
+        const size_t poolMin = state.poolInit + ((state.depthInit > 0) ? std::max(0, task->outputMaxQueueSize() - state.depthInit) : 0);
+        if (surfMs > ADAPTIVE_QUEUE_WAIT_GROW_MS && state.poolAdded < m_prm.poolMax) {
+            const int add = std::min(ADAPTIVE_QUEUE_POOL_STEP, m_prm.poolMax - state.poolAdded);
+            if (task->workSurfacesGrowCL(add) == RGY_ERR_NONE) {
+                state.poolAdded += add;
+                state.grow++;
+                PrintMes(RGY_LOG_INFO, _T("%s: surface wait %.3f ms/frame, pool %d -> %d.\n"),
+                    name.c_str(), surfMs, (int)task->workSurfacesCount() - add, (int)task->workSurfacesCount());
+            } else {
+                state.poolAdded = m_prm.poolMax; // 確保できないので以降は増やさない
+                PrintMes(RGY_LOG_INFO, _T("%s: failed to add surfaces, pool fixed to %d.\n"), name.c_str(), (int)task->workSurfacesCount());
+            }
+            state.idlePool = 0;
+        } else if (surfMs < ADAPTIVE_QUEUE_WAIT_IDLE_MS && state.poolAdded > 0) {
+            if (++state.idlePool >= ADAPTIVE_QUEUE_IDLE_COUNT
+                && task->workSurfacesFreeCount() > 1) { // 1枚は空きを残す
+                const int released = task->workSurfacesShrinkCL(1, poolMin);
+                if (released > 0) {
+                    state.poolAdded -= released;
+                    state.shrink++;
+                    PrintMes(RGY_LOG_INFO, _T("%s: no surface wait, pool %d -> %d.\n"),
+                        name.c_str(), (int)task->workSurfacesCount() + released, (int)task->workSurfacesCount());
+                }
+                state.idlePool = 0;
+            }
+        } else {
+            state.idlePool = 0;
+        }
+    }
+
+    // キューの深さ
+    if (state.depthInit <= 0) {
+        return;
+    }
+    const int depth = task->outputMaxQueueSize();
+    if (syncMs > ADAPTIVE_QUEUE_WAIT_GROW_MS && depth < state.depthCap) {
+        if (task->workSurfacesResizable()) {
+            // 深くした分だけ使用中のフレームが増えるので、先にプールを増やしておく
+            if (state.poolAdded >= m_prm.poolMax || task->workSurfacesGrowCL(1) != RGY_ERR_NONE) {
+                return;
+            }
+            state.poolAdded++;
+        }
+        task->setOutputMaxQueueSize(depth + 1);
+        state.grow++;
+        state.idleDepth = 0;
+        PrintMes(RGY_LOG_INFO, _T("%s: sync wait %.3f ms/frame, depth %d -> %d%s.\n"), name.c_str(), syncMs, depth, depth + 1,
+            task->workSurfacesResizable() ? strsprintf(_T(", pool %d"), (int)task->workSurfacesCount()).c_str() : _T(""));
+    } else if (syncMs < ADAPTIVE_QUEUE_WAIT_IDLE_MS && surfMs < ADAPTIVE_QUEUE_WAIT_IDLE_MS) {
+        if (++state.idleDepth >= ADAPTIVE_QUEUE_IDLE_COUNT && depth > std::max(m_prm.minDepth, 1)) {
+            task->setOutputMaxQueueSize(depth - 1);
+            state.shrink++;
+            state.idleDepth = 0;
+            PrintMes(RGY_LOG_INFO, _T("%s: no wait, depth %d -> %d.\n"), name.c_str(), depth, depth - 1);
+        }
+    } else {
+        state.idleDepth = 0;
+    }
+}
+
+void MPPAdaptiveQueue::printResult() {
+    for (const auto& state : m_tasks) {
+        if (state.grow == 0 && state.shrink == 0) {
+            continue;
+        }
+        PrintMes(RGY_LOG_INFO, _T("%s: depth %d -> %d, pool %d -> %d (grow %d, shrink %d).\n"),
+            getPipelineTaskTypeName(state.task->taskType()).c_str(),
+            state.depthInit, state.task->outputMaxQueueSize(),
+            (int)state.poolInit, (int)state.task->workSurfacesCount(),
+            state.grow, state.shrink);
+    }
+}
@@ -0,0 +1,74 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __MPP_ADAPTIVE_QUEUE_H__
+#define __MPP_ADAPTIVE_QUEUE_H__
+
+#include <vector>
+#include <memory>
+#include "rgy_log.h"
+#include "mpp_param.h"
+#include "mpp_pipeline.h"
+
+// --adaptive-queue
+// 各taskの待ち時間を一定フレームごとに確認し、キューの深さとフレームプールを増減する
+//   出力の完了待ちが多い -> キューが浅くハードウェアが待たされているので、キューを深くする
+//   空きフレームの待ちが多い -> フレームプールが足りないので、フレームを追加する
+//   待ちがほとんどない状態が続く -> キューを浅くし、追加したフレームを解放する (遅延とメモリの削減)
+// run2のスレッドからのみ呼ぶこと
+class MPPAdaptiveQueue {
+public:
+    MPPAdaptiveQueue(const MPPParamAdaptiveQueue& prm, std::shared_ptr<RGYLog> log);
+    ~MPPAdaptiveQueue();
+
+    void init(std::vector<std::unique_ptr<PipelineTask>>& tasks);
+    void check(const int64_t framesOut);
+    void printResult();
+protected:
+    struct TaskState {
+        PipelineTask *task;
+        int depthInit;   // 初期のキューの深さ
+        int depthCap;    // キューの深さの上限
+        size_t poolInit; // 初期のフレームプールのサイズ
+        int poolAdded;   // 追加したフレーム数
+        int idleDepth;   // 待ちのない判定が連続した回数 (キュー)
+        int idlePool;    // 待ちのない判定が連続した回数 (プール)
+        int grow;
+        int shrink;
+    };
+    void adjust(TaskState& state);
+    void PrintMes(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    MPPParamAdaptiveQueue m_prm;
+    std::shared_ptr<RGYLog> m_log;
+    std::vector<TaskState> m_tasks;
+    int64_t m_lastCheck;
+};
+
+#endif //__MPP_ADAPTIVE_QUEUE_H__
@@ -182,11 +182,76 @@ tstring encoder_help() {
     str += PrintMultipleListOptions(_T("--tier <string>"), _T("set codec tier"),
         { { _T("HEVC"),  list_hevc_tier, 0 },
         });
+    str += strsprintf(_T("\n")
+        _T("   --lookahead <int>            set lookahead depth for scene change and\n")
+        _T("                                 complexity analysis (0 - %d, default: 0 = off)\n")
+        _T("   --lookahead-params <param1>=<value>[,<param2>=<value>]...\n")
+        _T("     params for lookahead analysis.\n")
+        _T("    params\n")
+        _T("      scenecut=<bool>           insert IDR at scene change (default: on)\n")
+        _T("      threshold=<float>         threshold of scene change (default: %.1f)\n")
+        _T("      qp_offset=<int>           max qp offset for static scenes (0 - %d, default: %d)\n"),
+        LOOKAHEAD_DEPTH_MAX, RGYLookaheadParam().scenecutThreshold, LOOKAHEAD_QP_OFFSET_MAX, RGYLookaheadParam().qpOffset
+    );
 
     str += strsprintf(_T("\n")
         _T("   --sar <int>:<int>            set Sample Aspect Ratio\n")
         _T("   --dar <int>:<int>            set Display Aspect Ratio\n")
     );
+    str += strsprintf(_T("\n")
+        _T("   --mpp-stub [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("     use software stub instead of MPP hw decoder/encoder.\n")
+        _T("     decodes with libavcodec and outputs dummy bitstream.\n")
+        _T("    params\n")
+        _T("      latency=<int>             latency per frame in ms (default: %d)\n")
+        _T("      fps=<float>               max throughput, 0 = unlimited (default: %.1f)\n")
+        _T("      size=<int>                output packet size in bytes (default: %d)\n")
+        _T("   --pipeline-benchmark         report pipeline overhead per frame\n")
+        _T("                                 separately from hw (stub) time.\n"),
+        MPPParamStub().latency, MPPParamStub().fps, MPPParamStub().size
+    );
+    str += strsprintf(_T("")
+        _T("   --adaptive-queue [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("     adjust output queue depth of each pipeline stage and\n")
+        _T("     OpenCL frame pools based on the measured wait time.\n")
+        _T("     MPP buffers and demux/mux queues are not adjusted.\n")
+        _T("    params\n")
+        _T("      min=<int>                 min queue depth (default: %d)\n")
+        _T("      max=<int>                 max queue depth (default: %d)\n")
+        _T("      pool-max=<int>            max frames added to a frame pool (default: %d)\n")
+        _T("      interval=<int>            frames between adjustments (default: %d)\n"),
+        MPPParamAdaptiveQueue().minDepth, MPPParamAdaptiveQueue().maxDepth, MPPParamAdaptiveQueue().poolMax, MPPParamAdaptiveQueue().interval
+    );
+    str += strsprintf(_T("")
+        _T("   --fast-remux [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("     copy input video without decode/encode, when input already\n")
+        _T("     matches the output settings. falls back to encoding otherwise.\n")
+        _T("     requires avhw reader.\n")
+        _T("    params\n")
+        _T("      max-bitrate=<int>         max video bitrate of input in kbps\n")
+        _T("                                 (default: %d = no check)\n")
+        _T("      max-gop=<int>             max keyframe interval of input in frames\n")
+        _T("                                 (default: %d = no check)\n")
+        _T("      smart-trim=<bool>         allow --trim at any frame, by re-encoding\n")
+        _T("                                 only the GOPs at the trim boundaries.\n")
+        _T("                                 H.264/HEVC only. (default: %s)\n"),
+        MPPParamFastRemux().maxBitrate, MPPParamFastRemux().maxGop, MPPParamFastRemux().smartTrim ? _T("on") : _T("off")
+    );
+    str += strsprintf(_T("")
+        _T("   --quality-metric [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("     calculate VMAF features of the encoded video on cpu.\n")
+        _T("     all features are enabled if no feature is specified.\n")
+        _T("     could be used with --ssim / --psnr.\n")
+        _T("    params\n")
+        _T("      vif=<bool>                calc VIF (4 scales)\n")
+        _T("      adm=<bool>                calc ADM\n")
+        _T("      motion=<bool>             calc motion\n")
+        _T("   --metric-threads <int>       threads for --ssim/--psnr/--quality-metric\n")
+        _T("                                 (default: %d = auto)\n")
+        _T("   --metric-log <string>        output per frame results of\n")
+        _T("                                 --ssim/--psnr/--quality-metric to csv file.\n"),
+        MPPParamQualityMetric().threads
+    );
     str += _T("\n");
     str += gen_cmd_help_common();
     str += _T("\n");
@@ -468,6 +533,314 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
         pParams->deblockBeta = beta;
         return 0;
     }
+    if (IS_OPTION("lookahead")) {
+        i++;
+        int value = 0;
+        if (1 != _stscanf_s(strInput[i], _T("%d"), &value)) {
+            print_cmd_error_invalid_value(option_name, strInput[i]);
+            return 1;
+        } else if (value < 0 || value > LOOKAHEAD_DEPTH_MAX) {
+            print_cmd_error_invalid_value(option_name, strInput[i], strsprintf(_T("lookahead should be 0 - %d."), LOOKAHEAD_DEPTH_MAX));
+            return 1;
+        }
+        pParams->lookahead.depth = value;
+        return 0;
+    }
+    if (IS_OPTION("lookahead-params")) {
+        i++;
+        const auto paramList = std::vector<std::string>{ "scenecut", "threshold", "qp_offset" };
+
+        for (const auto& param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("scenecut")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        pParams->lookahead.scenecut = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("threshold")) {
+                    try {
+                        pParams->lookahead.scenecutThreshold = std::stof(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (pParams->lookahead.scenecutThreshold <= 0.0f) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("threshold should be positive value."));
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("qp_offset")) {
+                    try {
+                        pParams->lookahead.qpOffset = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (pParams->lookahead.qpOffset < 0 || pParams->lookahead.qpOffset > LOOKAHEAD_QP_OFFSET_MAX) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, strsprintf(_T("qp_offset should be 0 - %d."), LOOKAHEAD_QP_OFFSET_MAX));
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (IS_OPTION("mpp-stub")) {
+        pParams->stub.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "latency", "fps", "size" };
+
+        for (const auto& param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("latency")) {
+                    try {
+                        pParams->stub.latency = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (pParams->stub.latency < 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("latency should be 0 or positive value."));
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("fps")) {
+                    try {
+                        pParams->stub.fps = std::stod(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (pParams->stub.fps < 0.0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("fps should be 0 or positive value."));
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("size")) {
+                    try {
+                        pParams->stub.size = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (pParams->stub.size <= 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("size should be positive value."));
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (IS_OPTION("pipeline-benchmark")) {
+        pParams->pipelineBenchmark = true;
+        return 0;
+    }
+    if (IS_OPTION("adaptive-queue")) {
+        pParams->adaptiveQueue.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "min", "max", "pool-max", "interval" };
+
+        for (const auto& param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                int *target = nullptr;
+                int valueMin = 0;
+                if (param_arg == _T("min")) {
+                    target = &pParams->adaptiveQueue.minDepth;
+                } else if (param_arg == _T("max")) {
+                    target = &pParams->adaptiveQueue.maxDepth;
+                    valueMin = 1;
+                } else if (param_arg == _T("pool-max")) {
+                    target = &pParams->adaptiveQueue.poolMax;
+                } else if (param_arg == _T("interval")) {
+                    target = &pParams->adaptiveQueue.interval;
+                    valueMin = 1;
+                } else {
+                    print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                    return 1;
+                }
+                try {
+                    *target = std::stoi(param_val);
+                } catch (...) {
+                    print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                    return 1;
+                }
+                if (*target < valueMin) {
+                    print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, strsprintf(_T("value should be %d or larger."), valueMin));
+                    return 1;
+                }
+                continue;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        if (pParams->adaptiveQueue.minDepth > pParams->adaptiveQueue.maxDepth) {
+            print_cmd_error_invalid_value(option_name, strInput[i], _T("min should be max or smaller."));
+            return 1;
+        }
+        return 0;
+    }
+    if (IS_OPTION("fast-remux")) {
+        pParams->fastRemux.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "max-bitrate", "max-gop", "smart-trim" };
+
+        for (const auto& param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("smart-trim")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        pParams->fastRemux.smartTrim = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                int *target = nullptr;
+                if (param_arg == _T("max-bitrate")) {
+                    target = &pParams->fastRemux.maxBitrate;
+                } else if (param_arg == _T("max-gop")) {
+                    target = &pParams->fastRemux.maxGop;
+                } else {
+                    print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                    return 1;
+                }
+                try {
+                    *target = std::stoi(param_val);
+                } catch (...) {
+                    print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                    return 1;
+                }
+                if (*target < 0) {
+                    print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("value should be 0 or larger."));
+                    return 1;
+                }
+                continue;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (IS_OPTION("quality-metric")) {
+        pParams->qualityMetric.vif = true;
+        pParams->qualityMetric.adm = true;
+        pParams->qualityMetric.motion = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "vif", "adm", "motion" };
+
+        bool featureSpecified = false;
+        for (const auto& param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                bool *target = nullptr;
+                if (param_arg == _T("vif")) {
+                    target = &pParams->qualityMetric.vif;
+                } else if (param_arg == _T("adm")) {
+                    target = &pParams->qualityMetric.adm;
+                } else if (param_arg == _T("motion")) {
+                    target = &pParams->qualityMetric.motion;
+                }
+                if (target) {
+                    if (!featureSpecified) {
+                        // 個別に指定された場合は、指定されたもののみ有効にする
+                        pParams->qualityMetric.vif = false;
+                        pParams->qualityMetric.adm = false;
+                        pParams->qualityMetric.motion = false;
+                        featureSpecified = true;
+                    }
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        *target = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    // --ssim/--psnr/--quality-metric共通
+    if (IS_OPTION("metric-threads")) {
+        i++;
+        int value = 0;
+        if (1 != _stscanf_s(strInput[i], _T("%d"), &value)) {
+            print_cmd_error_invalid_value(option_name, strInput[i]);
+            return 1;
+        }
+        if (value < 0) {
+            print_cmd_error_invalid_value(option_name, strInput[i], _T("value should be 0 or larger."));
+            return 1;
+        }
+        pParams->qualityMetric.threads = value;
+        return 0;
+    }
+    if (IS_OPTION("metric-log")) {
+        i++;
+        pParams->qualityMetric.log = strInput[i];
+        return 0;
+    }
     if (IS_OPTION("avhw-params")) {
         if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
             return 0;
@@ -863,6 +1236,60 @@ tstring gen_cmd(const MPPParam *pParams, bool save_disabled_prm) {
     if (!pParams->disableDeblock && (pParams->deblockAlpha != encPrmDefault.deblockAlpha || pParams->deblockBeta != encPrmDefault.deblockBeta)) {
         cmd << _T(" --deblock ") << pParams->deblockAlpha << _T(":") << pParams->deblockBeta;
     }
+    OPT_NUM(_T("--lookahead"), lookahead.depth);
+    if (pParams->lookahead.enable() || save_disabled_prm) {
+        tmp.str(tstring());
+        ADD_BOOL(_T("scenecut"), lookahead.scenecut);
+        ADD_FLOAT(_T("threshold"), lookahead.scenecutThreshold, 3);
+        ADD_NUM(_T("qp_offset"), lookahead.qpOffset);
+        if (!tmp.str().empty()) {
+            cmd << _T(" --lookahead-params ") << tmp.str().substr(1);
+        }
+    }
+    if (pParams->stub.enable) {
+        tmp.str(tstring());
+        ADD_NUM(_T("latency"), stub.latency);
+        ADD_FLOAT(_T("fps"), stub.fps, 3);
+        ADD_NUM(_T("size"), stub.size);
+        cmd << _T(" --mpp-stub");
+        if (!tmp.str().empty()) {
+            cmd << _T(" ") << tmp.str().substr(1);
+        }
+    }
+    OPT_BOOL(_T("--pipeline-benchmark"), _T(""), pipelineBenchmark);
+    if (pParams->adaptiveQueue.enable) {
+        tmp.str(tstring());
+        ADD_NUM(_T("min"), adaptiveQueue.minDepth);
+        ADD_NUM(_T("max"), adaptiveQueue.maxDepth);
+        ADD_NUM(_T("pool-max"), adaptiveQueue.poolMax);
+        ADD_NUM(_T("interval"), adaptiveQueue.interval);
+        cmd << _T(" --adaptive-queue");
+        if (!tmp.str().empty()) {
+            cmd << _T(" ") << tmp.str().substr(1);
+        }
+    }
+    if (pParams->fastRemux.enable) {
+        tmp.str(tstring());
+        ADD_NUM(_T("max-bitrate"), fastRemux.maxBitrate);
+        ADD_NUM(_T("max-gop"), fastRemux.maxGop);
+        ADD_BOOL(_T("smart-trim"), fastRemux.smartTrim);
+        cmd << _T(" --fast-remux");
+        if (!tmp.str().empty()) {
+            cmd << _T(" ") << tmp.str().substr(1);
+        }
+    }
+    if (pParams->qualityMetric.enabled()) {
+        tmp.str(tstring());
+        ADD_BOOL(_T("vif"), qualityMetric.vif);
+        ADD_BOOL(_T("adm"), qualityMetric.adm);
+        ADD_BOOL(_T("motion"), qualityMetric.motion);
+        cmd << _T(" --quality-metric");
+        if (!tmp.str().empty()) {
+            cmd << _T(" ") << tmp.str().substr(1);
+        }
+    }
+    OPT_NUM(_T("--metric-threads"), qualityMetric.threads);
+    OPT_STR_PATH(_T("--metric-log"), qualityMetric.log);
 
     cmd << gen_cmd(&pParams->common, &encPrmDefault.common, save_disabled_prm);
 
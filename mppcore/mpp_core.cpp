@@ -26,6 +26,7 @@
 // ------------------------------------------------------------------------------------------
 
 #include <cmath>
+#include <chrono>
 #include <numeric>
 #include "rgy_version.h"
 #include "rgy_osdep.h"
@@ -43,6 +44,7 @@
 #include "mpp_core.h"
 #include "mpp_util.h"
 #include "mpp_param.h"
+#include "mpp_vpp_placement.h"
 #include "rgy_filter.h"
 #include "rgy_filter_colorspace.h"
 #include "rgy_filter_afs.h"
@@ -94,11 +96,16 @@ MPPCfg::MPPCfg() :
 
 MPPContext::MPPContext() :
     ctx(nullptr),
-    mpi(nullptr) {
+    mpi(nullptr),
+    stub() {
 
 }
 
 MPPContext::~MPPContext() {
+    if (stub) {
+        stub.reset();
+        return;
+    }
     mpi->reset(ctx);
     mpp_destroy(ctx);
 }
@@ -111,7 +118,17 @@ RGY_ERR MPPContext::create() {
     return RGY_ERR_NONE;
 }
 
+RGY_ERR MPPContext::createStub(const MPPParamStub& prm, std::shared_ptr<RGYLog> log) {
+    stub = std::make_unique<MPPStub>(prm, log);
+    ctx = stub.get();
+    mpi = stub->api();
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR MPPContext::init(MppCtxType type, MppCodingType codectype) {
+    if (stub) {
+        return stub->init(type, codectype);
+    }
     auto ret = err_to_rgy(mpp_init(ctx, type, codectype));
     if (ret != RGY_ERR_NONE) {
         return ret;
@@ -146,6 +163,7 @@ MPPCore::MPPCore() :
     m_pStatus(),
     m_pPerfMonitor(),
     m_pipelineDepth(2),
+    m_pipelineBenchmark(false),
     m_nProcSpeedLimit(0),
     m_nAVSyncMode(RGY_AVSYNC_AUTO),
     m_timestampPassThrough(false),
@@ -158,6 +176,9 @@ MPPCore::MPPCore() :
     m_picStruct(RGY_PICSTRUCT_UNKNOWN),
     m_encVUI(),
     m_cl(),
+    m_clShared(),
+    m_drainCallback(),
+    m_deviceInitWait(),
     m_enccfg(),
     m_encoder(),
     m_decoder(),
@@ -169,6 +190,10 @@ MPPCore::MPPCore() :
     m_thDecoder(),
     m_thOutput(),
     m_pipelineTasks(),
+    m_adaptiveQueue(),
+    m_fastRemux(false),
+    m_fastRemuxVideoDelay(0),
+    m_smartTrim(false),
     m_pAbortByUser(nullptr) {
 }
 
@@ -191,7 +216,8 @@ void MPPCore::Terminate() {
 
     m_pTrimParam = nullptr;
 
-    m_pipelineTasks.clear();
+    m_adaptiveQueue.reset(); // taskへのポインタを持っているので先に解放
+    clearPipelineTasks();
 
     m_vpFilters.clear();
     m_pLastFilterParam.reset();
@@ -213,6 +239,8 @@ void MPPCore::Terminate() {
     PrintMes(RGY_LOG_DEBUG, _T("Closing logger...\n"));
     m_pLog.reset();
     m_encCodec = RGY_CODEC_UNKNOWN;
+    m_fastRemux = false;
+    m_smartTrim = false;
     m_pAbortByUser = nullptr;
 }
 
@@ -354,10 +382,11 @@ RGY_ERR MPPCore::initPerfMonitor(MPPParam *prm) {
         perfMonLog = prm->common.outputFilename + _T("_perf.csv");
     }
     CPerfMonitorPrm perfMonitorPrm;
+    perfMonitorPrm.metricsListen = prm->ctrl.metricsListen;
 #if ENABLE_NVML
     perfMonitorPrm.pciBusId = selectedGpu->pciBusId.c_str();
 #endif
-    if (m_pPerfMonitor->init(perfMonLog.c_str(), _T(""), (bLogOutput) ? prm->ctrl.perfMonitorInterval : 1000,
+    if (m_pPerfMonitor->init(perfMonLog.c_str(), _T(""), (bLogOutput || prm->ctrl.metricsListen.length() > 0) ? prm->ctrl.perfMonitorInterval : 1000,
         (int)prm->ctrl.perfMonitorSelect, (int)prm->ctrl.perfMonitorSelectMatplot,
 #if defined(_WIN32) || defined(_WIN64)
         std::unique_ptr<void, handle_deleter>(OpenThread(SYNCHRONIZE | THREAD_QUERY_INFORMATION, false, GetCurrentThreadId()), handle_deleter()),
@@ -368,6 +397,19 @@ RGY_ERR MPPCore::initPerfMonitor(MPPParam *prm) {
         m_pLog, &perfMonitorPrm)) {
         PrintMes(RGY_LOG_WARN, _T("Failed to initialize performance monitor, disabled.\n"));
         m_pPerfMonitor.reset();
+    } else {
+        //--vpp-perf-monitorの結果をmetricsに出力する
+        std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>> filterPerf;
+        for (auto& block : m_vpFilters) {
+            if (block.type == VppFilterType::FILTER_OPENCL) {
+                for (auto& filter : block.vppcl) {
+                    if (auto perf = filter->GetPerf(); perf) {
+                        filterPerf.push_back({ filter->name(), perf });
+                    }
+                }
+            }
+        }
+        m_pPerfMonitor->SetFilterPerf(filterPerf);
     }
     return RGY_ERR_NONE;
 }
@@ -652,7 +694,7 @@ RGY_ERR MPPCore::initOutput(MPPParam *inputParams) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to parse HEVC HDR10 metadata.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
-    const auto outputVideoInfo = videooutputinfo(
+    const auto outputVideoInfo = (m_fastRemux) ? fastRemuxOutputInfo(inputParams) : videooutputinfo(
         m_enccfg,
         m_sar,
         m_picStruct,
@@ -661,7 +703,7 @@ RGY_ERR MPPCore::initOutput(MPPParam *inputParams) {
 
     auto err = initWriters(m_pFileWriter, m_pFileWriterListAudio, m_pFileReader, m_AudioReaders,
         &inputParams->common, &inputParams->input, &inputParams->ctrl, outputVideoInfo,
-        m_trimParam, m_outputTimebase, m_Chapters, m_hdrsei.get(), m_dovirpu.get(), m_encTimestamp.get(), false, false, false, 0,
+        m_trimParam, m_outputTimebase, m_Chapters, m_hdrsei.get(), m_dovirpu.get(), m_encTimestamp.get(), false, inputParams->pipelineBenchmark, false, 0, m_smartTrim,
         m_poolPkt.get(), m_poolFrame.get(), m_pStatus, m_pPerfMonitor, m_pLog);
     if (err != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("failed to initialize file reader(s).\n"));
@@ -687,18 +729,38 @@ RGY_ERR MPPCore::initDecoder(MPPParam *prm) {
         PrintMes(RGY_LOG_DEBUG, _T("decoder not required.\n"));
         return RGY_ERR_NONE;
     }
-    auto ret = err_to_rgy(mpp_check_support_format(MPP_CTX_DEC, codec_rgy_to_dec(inputCodec)));
+    // スタブはlibavcodecでデコードするので、MPPの対応状況は確認しない
+    auto ret = (prm->stub.enable) ? RGY_ERR_NONE : err_to_rgy(mpp_check_support_format(MPP_CTX_DEC, codec_rgy_to_dec(inputCodec)));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Codec type (%s) unsupported by MPP decoder\n"), CodecToStr(inputCodec).c_str());
         return ret;
     }
 
     m_decoder = std::make_unique<MPPContext>();
-    ret = m_decoder->create();
+    ret = (prm->stub.enable) ? m_decoder->createStub(prm->stub, m_pLog) : m_decoder->create();
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to create decoder: %s.\n"), get_err_mes(ret));
         return ret;
     }
+    if (m_decoder->stub) {
+        RGYBitstream header = RGYBitstreamInit();
+        if (m_pFileReader->GetHeader(&header) == RGY_ERR_NONE && header.size() > 0) {
+            m_decoder->stub->setExtraData(header.data(), header.size());
+        }
+        header.clear();
+#if ENABLE_AVSW_READER
+        // スタブのデコーダは8bit 4:2:0のみ対応なので、デコードを始める前に確認する
+        if (auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(m_pFileReader); pAVCodecReader && pAVCodecReader->GetInputVideoStream()) {
+            const auto pixfmt = (AVPixelFormat)pAVCodecReader->GetInputVideoStream()->codecpar->format;
+            if (pixfmt != AV_PIX_FMT_NONE && !MPPStub::decFormatSupported(pixfmt)) {
+                PrintMes(RGY_LOG_ERROR, _T("--mpp-stub: unsupported input pixel format %s, only 8-bit 4:2:0 (yuv420p/nv12) is supported.\n"),
+                    char_to_tstring(av_get_pix_fmt_name(pixfmt)).c_str());
+                return RGY_ERR_UNSUPPORTED;
+            }
+        }
+#endif //#if ENABLE_AVSW_READER
+        PrintMes(RGY_LOG_DEBUG, _T("Using stub decoder.\n"));
+    }
 
     ret = m_decoder->init(MPP_CTX_DEC, codec_rgy_to_dec(inputCodec));
     if (ret != RGY_ERR_NONE) {
@@ -836,29 +898,6 @@ RGY_ERR MPPCore::initDecoder(MPPParam *prm) {
 }
 #pragma warning(pop)
 
-RGY_ERR MPPCore::createOpenCLCopyFilterForPreVideoMetric(const MPPParam *prm) {
-    std::unique_ptr<RGYFilter> filterCrop(new RGYFilterCspCrop(m_cl));
-    std::shared_ptr<RGYFilterParamCrop> param(new RGYFilterParamCrop());
-    param->frameOut = RGYFrameInfo(m_encWidth, m_encHeight, GetEncoderCSP(prm), GetEncoderBitdepth(prm), m_picStruct, RGY_MEM_TYPE_GPU_IMAGE);
-    param->frameIn = param->frameOut;
-    param->frameIn.bitdepth = RGY_CSP_BIT_DEPTH[param->frameIn.csp];
-    param->baseFps = m_encFps;
-    param->bOutOverwrite = false;
-    auto sts = filterCrop->init(param, m_pLog);
-    if (sts != RGY_ERR_NONE) {
-        return sts;
-    }
-    //登録
-    std::vector<std::unique_ptr<RGYFilter>> filters;
-    filters.push_back(std::move(filterCrop));
-    if (m_vpFilters.size() > 0) {
-        PrintMes(RGY_LOG_ERROR, _T("Unknown error, not expected that m_vpFilters has size.\n"));
-        return RGY_ERR_UNDEFINED_BEHAVIOR;
-    }
-    m_vpFilters.push_back(VppVilterBlock(filters));
-    return RGY_ERR_NONE;
-}
-
 RGY_ERR MPPCore::initFilters(MPPParam *inputParam) {
     //hwデコーダの場合、cropを入力時に行っていない
     const bool cropRequired = cropEnabled(inputParam->input.crop)
@@ -1105,6 +1144,7 @@ RGY_ERR MPPCore::initFilters(MPPParam *inputParam) {
             return RGY_ERR_UNSUPPORTED;
         }
     }
+    InitFiltersFuseRGA();
 
     if (inputParam->vpp.checkPerformance) {
         for (auto& block : m_vpFilters) {
@@ -1122,6 +1162,53 @@ RGY_ERR MPPCore::initFilters(MPPParam *inputParam) {
     return RGY_ERR_NONE;
 }
 
+// 連続するRGAのcrop/cspconv/resizeを、可能なら1回のRGA処理にまとめる
+// まとめられない場合は、そのまま個別に処理する
+void MPPCore::InitFiltersFuseRGA() {
+    auto copyParam = [](const RGYFilterParam *prm) -> std::shared_ptr<RGYFilterParam> {
+        if (auto p = dynamic_cast<const RGYFilterParamResize *>(prm); p != nullptr) return std::make_shared<RGYFilterParamResize>(*p);
+        if (auto p = dynamic_cast<const RGYFilterParamCrop *>(prm); p != nullptr) return std::make_shared<RGYFilterParamCrop>(*p);
+        return nullptr;
+    };
+    std::vector<VppVilterBlock> filters;
+    for (size_t i = 0; i < m_vpFilters.size();) {
+        size_t iend = i;
+        while (iend < m_vpFilters.size() && m_vpFilters[iend].type == VppFilterType::FILTER_RGA) {
+            iend++;
+        }
+        if (iend - i < 2) {
+            filters.push_back(std::move(m_vpFilters[i]));
+            i++;
+            continue;
+        }
+        auto prmFused = std::make_shared<RGYFilterParamRGAFused>();
+        bool copied = true;
+        for (size_t j = i; j < iend && copied; j++) {
+            for (const auto& f : m_vpFilters[j].vpprga) {
+                auto prm = copyParam(f->GetFilterParam());
+                if (!prm) {
+                    copied = false;
+                    break;
+                }
+                prmFused->stages.push_back(prm);
+            }
+        }
+        std::unique_ptr<RGAFilter> filterFused = std::make_unique<RGAFilterFused>();
+        if (copied && filterFused->init(prmFused, m_pLog) == RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_DEBUG, _T("Fused %d rga filters into one: %s\n"), (int)prmFused->stages.size(), filterFused->GetInputMessage().c_str());
+            std::vector<std::unique_ptr<RGAFilter>> vppFilters;
+            vppFilters.push_back(std::move(filterFused));
+            filters.push_back(VppVilterBlock(vppFilters, VppFilterType::FILTER_RGA));
+        } else {
+            for (size_t j = i; j < iend; j++) {
+                filters.push_back(std::move(m_vpFilters[j]));
+            }
+        }
+        i = iend;
+    }
+    m_vpFilters = std::move(filters);
+}
+
 std::vector<VppType> MPPCore::InitFiltersCreateVppList(const MPPParam *inputParam, const bool cspConvRequired, const bool cropRequired, const RGY_VPP_RESIZE_TYPE resizeRequired) {
     std::vector<VppType> filterPipeline;
     filterPipeline.reserve((size_t)VppType::CL_MAX);
@@ -1218,20 +1305,208 @@ std::vector<VppType> MPPCore::InitFiltersCreateVppList(const MPPParam *inputPara
         filterPipeline = newPipeline;
     }
 
-    // cropとresizeはmfxとopencl両方ともあるので、前後のフィルタがどちらもOpenCLだったら、そちらに合わせる
-    for (size_t i = 0; i < filterPipeline.size(); i++) {
-        const VppFilterType prev = (i >= 1)                        ? getVppFilterType(filterPipeline[i - 1]) : VppFilterType::FILTER_NONE;
-        const VppFilterType next = (i + 1 < filterPipeline.size()) ? getVppFilterType(filterPipeline[i + 1]) : VppFilterType::FILTER_NONE;
-        if (filterPipeline[i] == VppType::RGA_RESIZE) {
-            if (resizeRequired == RGY_VPP_RESIZE_TYPE_AUTO // 自動以外の指定があれば、それに従うので、自動の場合のみ変更
-                && m_cl
-                && prev == VppFilterType::FILTER_OPENCL
-                && next == VppFilterType::FILTER_OPENCL) {
-                filterPipeline[i] = VppType::CL_RESIZE; // OpenCLに挟まれていたら、OpenCLのresizeを優先する
+    // crop/色空間変換とresizeはRGAとOpenCL両方ともあるので、推定処理時間が最小となる配置を選択する
+    if (m_cl) {
+        filterPipeline = InitFiltersPlaceRGAOpenCL(inputParam, filterPipeline, cropRequired, resizeRequired);
+    }
+    return filterPipeline;
+}
+
+std::vector<VppType> MPPCore::InitFiltersPlaceRGAOpenCL(const MPPParam *inputParam, const std::vector<VppType>& filterPipeline, const bool cropRequired, const RGY_VPP_RESIZE_TYPE resizeRequired) {
+    // 入力段のcrop/色空間変換 (RGA_CROP, RGA_CSPCONV) は、CL_CROPでまとめて置き換え可能
+    size_t inputStageCount = 0;
+    while (inputStageCount < filterPipeline.size()
+        && (filterPipeline[inputStageCount] == VppType::RGA_CROP || filterPipeline[inputStageCount] == VppType::RGA_CSPCONV)) {
+        inputStageCount++;
+    }
+    // 自動以外の指定があれば、それに従うので、自動の場合のみ変更
+    const auto itrResize = std::find(filterPipeline.begin(), filterPipeline.end(), VppType::RGA_RESIZE);
+    const bool resizeMovable = resizeRequired == RGY_VPP_RESIZE_TYPE_AUTO && itrResize != filterPipeline.end();
+
+    std::vector<VppPlacementCandidate> candidates;
+    for (int inputStageCL = 0; inputStageCL <= ((inputStageCount > 0) ? 1 : 0); inputStageCL++) {
+        for (int resizeCL = 0; resizeCL <= ((resizeMovable) ? 1 : 0); resizeCL++) {
+            std::vector<VppType> pipeline;
+            if (inputStageCL) {
+                pipeline.push_back(VppType::CL_CROP);
+            }
+            for (size_t i = (inputStageCL) ? inputStageCount : 0; i < filterPipeline.size(); i++) {
+                pipeline.push_back((resizeCL && filterPipeline[i] == VppType::RGA_RESIZE) ? VppType::CL_RESIZE : filterPipeline[i]);
             }
+            candidates.push_back(VppPlacementCandidate(pipeline));
         }
     }
-    return filterPipeline;
+    if (candidates.size() <= 1) {
+        return filterPipeline;
+    }
+
+    // initFiltersと同じ入力フレーム、リサイズ後の解像度
+    const int croppedWidth  = inputParam->input.srcWidth  - inputParam->input.crop.e.left   - inputParam->input.crop.e.right;
+    const int croppedHeight = inputParam->input.srcHeight - inputParam->input.crop.e.bottom - inputParam->input.crop.e.up;
+    RGYFrameInfo inputFrame;
+    inputFrame.width  = (cropRequired) ? inputParam->input.srcWidth  : croppedWidth;
+    inputFrame.height = (cropRequired) ? inputParam->input.srcHeight : croppedHeight;
+    inputFrame.csp = inputParam->input.csp;
+    inputFrame.picstruct = inputParam->input.picstruct;
+    inputFrame.mem_type = RGY_MEM_TYPE_MPP;
+    auto resize = std::make_pair(croppedWidth, croppedHeight);
+    if (inputParam->input.dstWidth > 0 && inputParam->input.dstHeight > 0) {
+        resize = std::make_pair(inputParam->input.dstWidth, inputParam->input.dstHeight);
+        if (inputParam->vpp.pad.enable) {
+            resize.first  -= inputParam->vpp.pad.right + inputParam->vpp.pad.left;
+            resize.second -= inputParam->vpp.pad.bottom + inputParam->vpp.pad.top;
+        }
+    }
+
+    // 計測結果はSoC/OpenCLデバイスと解像度ごとにキャッシュし、なければ実際の解像度で各処理を計測する
+    VppPlacementCost cost;
+    const auto cachePath = vppPlacementCostCachePath();
+    const auto cacheKey = vppPlacementCostKey(RGYOpenCLDevice(m_cl->queue().devid()).info().name, inputFrame.csp,
+        inputFrame.width, inputFrame.height, resize.first, resize.second);
+    if (cachePath.length() > 0 && cost.load(cachePath, cacheKey)) {
+        PrintMes(RGY_LOG_DEBUG, _T("vpp placement: loaded cost for %s from %s.\n"), char_to_tstring(cacheKey).c_str(), char_to_tstring(cachePath).c_str());
+    } else {
+        const bool measured = InitFiltersMeasurePlacementCost(cost, inputParam, candidates, inputFrame, (cropRequired) ? &inputParam->input.crop : nullptr, resize);
+        PrintMes(RGY_LOG_DEBUG, _T("vpp placement: measured %s.\n"), cost.print().c_str());
+        // 計測に失敗した処理があれば、次回も計測し直す
+        if (measured && cachePath.length() > 0 && !cost.save(cachePath, cacheKey)) {
+            PrintMes(RGY_LOG_DEBUG, _T("vpp placement: failed to save cost to %s.\n"), char_to_tstring(cachePath).c_str());
+        }
+    }
+    const int inPixels = croppedWidth * croppedHeight;
+    const int outPixels = resize.first * resize.second;
+    tstring log;
+    const int selected = vppPlacementSelect(candidates, cost, inPixels, outPixels, log);
+    PrintMes(RGY_LOG_DEBUG, _T("vpp placement: %d pixels in, %d pixels out\n%s"), inPixels, outPixels, log.c_str());
+    return (selected >= 0) ? candidates[selected].pipeline : filterPipeline;
+}
+
+// 候補に含まれるRGA/OpenCLの各処理を、実際の解像度のフレームで数回実行して1画素あたりの処理時間を計測する
+// すべて計測できた場合にtrueを返す
+bool MPPCore::InitFiltersMeasurePlacementCost(VppPlacementCost& cost, const MPPParam *inputParam, const std::vector<VppPlacementCandidate>& candidates,
+    const RGYFrameInfo& inputFrame, const sInputCrop *crop, const std::pair<int, int> resize) {
+    std::vector<VppType> types;
+    bool hasCSPConv = false;
+    for (const auto& cand : candidates) {
+        for (const auto type : cand.pipeline) {
+            hasCSPConv |= type == VppType::RGA_CSPCONV;
+            if (cost.get(type) < 0.0 && std::find(types.begin(), types.end(), type) == types.end()
+                && (type == VppType::RGA_CROP || type == VppType::RGA_CSPCONV || type == VppType::RGA_RESIZE
+                 || type == VppType::CL_CROP || type == VppType::CL_RESIZE)) {
+                types.push_back(type);
+            }
+        }
+    }
+    const int croppedWidth  = inputFrame.width  - ((crop) ? crop->e.left + crop->e.right : 0);
+    const int croppedHeight = inputFrame.height - ((crop) ? crop->e.up + crop->e.bottom : 0);
+    cost.transfer = vppPlacementMeasureTransfer(croppedWidth, croppedHeight);
+
+    // 計測用のフィルタの作成でm_encFps, m_pLastFilterParamが更新されるので、元に戻す
+    const auto encFps = m_encFps;
+    const auto lastFilterParam = m_pLastFilterParam;
+    MppBufferGroup frameGrp = nullptr;
+    bool measuredAll = true;
+    for (const auto type : types) {
+        double value = -1.0;
+        if (getVppFilterType(type) == VppFilterType::FILTER_RGA) {
+            if (!frameGrp && err_to_rgy(mpp_buffer_group_get_internal(&frameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM))) != RGY_ERR_NONE) {
+                frameGrp = nullptr;
+                measuredAll = false;
+                continue;
+            }
+            // RGAの処理順はcrop -> cspconv -> resize
+            auto frameIn = inputFrame;
+            if (type != VppType::RGA_CROP) {
+                frameIn.width = croppedWidth;
+                frameIn.height = croppedHeight;
+            }
+            if (type == VppType::RGA_RESIZE && hasCSPConv) {
+                frameIn.csp = GetEncoderCSP(inputParam);
+            }
+            auto vui = inputParam->input.vui;
+            std::vector<std::unique_ptr<RGAFilter>> filters;
+            if (AddFilterRGAIEP(filters, frameIn, type, inputParam, (type == VppType::RGA_CROP) ? crop : nullptr, resize, vui) == RGY_ERR_NONE) {
+                const auto prm = filters.front()->GetFilterParam();
+                auto surfIn  = std::make_unique<RGYFrameMpp>(prm->frameIn, frameGrp);
+                auto surfOut = std::make_unique<RGYFrameMpp>(prm->frameOut, frameGrp);
+                if (!surfIn->isempty() && !surfOut->isempty()) {
+                    value = vppPlacementMeasure((type == VppType::RGA_CROP) ? croppedWidth * croppedHeight : prm->frameIn.width * prm->frameIn.height, [&]() {
+                        RGYFrameMpp *outFrames[1] = { surfOut.get() };
+                        int outFrameNum = 0;
+                        int sync = 0;
+                        auto sts = filters.front()->filter_rga(surfIn.get(), outFrames, &outFrameNum, &sync);
+                        if (sync > 0) {
+                            imsync(sync);
+                        }
+                        return sts;
+                    });
+                }
+            }
+        } else {
+            // OpenCLのフィルタの内部形式 (CL_CROPで変換する)
+            auto frameIn = inputFrame;
+            frameIn.mem_type = RGY_MEM_TYPE_GPU;
+            auto clCsp = frameIn.csp;
+            switch (clCsp) {
+            case RGY_CSP_NV12: clCsp = RGY_CSP_YV12; break;
+            case RGY_CSP_P010: clCsp = RGY_CSP_YV12_16; break;
+            default: break;
+            }
+            std::vector<std::unique_ptr<RGYFilter>> filters;
+            if (type == VppType::CL_CROP) {
+                auto filterCrop = std::make_unique<RGYFilterCspCrop>(m_cl);
+                auto param = std::make_shared<RGYFilterParamCrop>();
+                param->frameIn = frameIn;
+                param->frameOut = frameIn;
+                param->frameOut.csp = clCsp;
+                param->frameOut.bitdepth = RGY_CSP_BIT_DEPTH[clCsp];
+                if (crop) {
+                    param->crop = *crop;
+                }
+                param->baseFps = m_encFps;
+                param->bOutOverwrite = false;
+                if (filterCrop->init(param, m_pLog) == RGY_ERR_NONE) {
+                    filters.push_back(std::move(filterCrop));
+                }
+            } else {
+                frameIn.width = croppedWidth;
+                frameIn.height = croppedHeight;
+                frameIn.csp = clCsp;
+                frameIn.bitdepth = RGY_CSP_BIT_DEPTH[clCsp];
+                auto vui = inputParam->input.vui;
+                if (AddFilterOpenCL(filters, frameIn, type, inputParam, nullptr, resize, vui) != RGY_ERR_NONE) {
+                    filters.clear();
+                }
+            }
+            if (filters.size() > 0) {
+                const auto prm = filters.front()->GetFilterParam();
+                auto surfIn  = m_cl->createFrameBuffer(prm->frameIn);
+                auto surfOut = m_cl->createFrameBuffer(prm->frameOut);
+                if (surfIn && surfOut) {
+                    value = vppPlacementMeasure((type == VppType::CL_CROP) ? croppedWidth * croppedHeight : prm->frameIn.width * prm->frameIn.height, [&]() {
+                        RGYFrameInfo *outFrames[1] = { &surfOut->frame };
+                        int outFrameNum = 0;
+                        auto sts = filters.front()->filter(&surfIn->frame, outFrames, &outFrameNum, m_cl->queue());
+                        if (sts == RGY_ERR_NONE) {
+                            sts = m_cl->queue().finish();
+                        }
+                        return sts;
+                    });
+                }
+            }
+        }
+        if (value <= 0.0) {
+            PrintMes(RGY_LOG_DEBUG, _T("vpp placement: failed to measure %s.\n"), vppfilter_type_to_str(type).c_str());
+            measuredAll = false;
+        }
+        cost.set(type, value);
+    }
+    if (frameGrp) {
+        mpp_buffer_group_put(frameGrp);
+    }
+    m_encFps = encFps;
+    m_pLastFilterParam = lastFilterParam;
+    return measuredAll;
 }
 
 RGY_ERR MPPCore::AddFilterRGAIEP(std::vector<std::unique_ptr<RGAFilter>>&filters,
@@ -1386,6 +1661,7 @@ RGY_ERR MPPCore::AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilte
         if (inputParam->common.timecode && param->afs.timecode) {
             param->afs.timecode = 2;
         }
+        param->historyStage = (clfilters.size() > 0) ? clfilters.back().get() : nullptr;
         param->frameIn = inputFrame;
         param->frameOut = inputFrame;
         param->inFps = m_inputFps;
@@ -1435,6 +1711,7 @@ RGY_ERR MPPCore::AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilte
         unique_ptr<RGYFilter> filter(new RGYFilterYadif(m_cl));
         shared_ptr<RGYFilterParamYadif> param(new RGYFilterParamYadif());
         param->yadif = inputParam->vpp.yadif;
+        param->historyStage = (clfilters.size() > 0) ? clfilters.back().get() : nullptr;
         param->frameIn = inputFrame;
         param->frameOut = inputFrame;
         param->baseFps = m_encFps;
@@ -1481,6 +1758,7 @@ RGY_ERR MPPCore::AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilte
         unique_ptr<RGYFilter> filter(new RGYFilterDecimate(m_cl));
         shared_ptr<RGYFilterParamDecimate> param(new RGYFilterParamDecimate());
         param->decimate = inputParam->vpp.decimate;
+        param->historyStage = (clfilters.size() > 0) ? clfilters.back().get() : nullptr;
         param->useSeparateQueue = false; // やはりuseSeparateQueueはバグっているかもしれない
         param->outfilename = inputParam->common.outputFilename;
         param->frameIn = inputFrame;
@@ -1551,6 +1829,7 @@ RGY_ERR MPPCore::AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilte
         unique_ptr<RGYFilter> filter(new RGYFilterConvolution3D(m_cl));
         shared_ptr<RGYFilterParamConvolution3D> param(new RGYFilterParamConvolution3D());
         param->convolution3d = inputParam->vpp.convolution3d;
+        param->historyStage = (clfilters.size() > 0) ? clfilters.back().get() : nullptr;
         param->frameIn = inputFrame;
         param->frameOut = inputFrame;
         param->baseFps = m_encFps;
@@ -1767,6 +2046,7 @@ RGY_ERR MPPCore::AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilte
         unique_ptr<RGYFilter> filterResize(new RGYFilterResize(m_cl));
         shared_ptr<RGYFilterParamResize> param(new RGYFilterParamResize());
         param->interp = (inputParam->vpp.resize_algo != RGY_VPP_RESIZE_AUTO) ? inputParam->vpp.resize_algo : RGY_VPP_RESIZE_SPLINE36;
+        param->mode = inputParam->vpp.resize_mode;
         param->frameIn = inputFrame;
         param->frameOut = inputFrame;
         param->frameOut.width = resize.first;
@@ -2124,18 +2404,21 @@ RGY_ERR MPPCore::initEncoderCodec(const MPPParam *prm) {
 }
 
 RGY_ERR MPPCore::initEncoder(MPPParam *prm) {
-    auto ret = err_to_rgy(mpp_check_support_format(MPP_CTX_ENC, codec_rgy_to_enc(prm->codec)));
+    auto ret = (prm->stub.enable) ? RGY_ERR_NONE : err_to_rgy(mpp_check_support_format(MPP_CTX_ENC, codec_rgy_to_enc(prm->codec)));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Codec type (%s) unsupported by MPP\n"), CodecToStr(prm->codec).c_str());
         return ret;
     }
     m_encoder = std::make_unique<MPPContext>();
 
-    ret = m_encoder->create();
+    ret = (prm->stub.enable) ? m_encoder->createStub(prm->stub, m_pLog) : m_encoder->create();
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to create encoder: %s.\n"), get_err_mes(ret));
         return ret;
     }
+    if (m_encoder->stub) {
+        PrintMes(RGY_LOG_DEBUG, _T("Using stub encoder.\n"));
+    }
 
     auto par = std::make_pair(prm->par[0], prm->par[1]);
     if ((!prm->par[0] || !prm->par[1]) //SAR比の指定がない
@@ -2211,6 +2494,17 @@ RGY_ERR MPPCore::initDevice(const bool enableOpenCL, const bool checkVppPerforma
         return RGY_ERR_NONE;
     }
 
+    if (m_clShared) {
+        //プロファイルの有無が一致する場合のみ共有する
+        const bool sharedProfiling = (m_clShared->queue().getProperties() & CL_QUEUE_PROFILING_ENABLE) != 0;
+        if (sharedProfiling == checkVppPerformance) {
+            m_cl = m_clShared;
+            PrintMes(RGY_LOG_DEBUG, _T("Use OpenCL context shared with the previous job.\n"));
+            return RGY_ERR_NONE;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("Could not share OpenCL context with the previous job, creating new one.\n"));
+    }
+
     RGYOpenCL cl(m_pLog);
     if (!RGYOpenCL::openCLloaded()) {
         PrintMes(RGY_LOG_WARN, _T("Skip OpenCL init as OpenCL is not supported on this platform.\n"));
@@ -2256,38 +2550,27 @@ RGY_ERR MPPCore::initDevice(const bool enableOpenCL, const bool checkVppPerforma
 }
 
 RGY_ERR MPPCore::initSSIMCalc(MPPParam *prm) {
-    if (prm->common.metric.enabled()) {
-        if (!m_cl) {
-            PrintMes(RGY_LOG_ERROR, _T("OpenCL disabled, %s calculation not supported!\n"), prm->common.metric.enabled_metric().c_str());
-            return RGY_ERR_UNSUPPORTED;
-        }
-        const auto formatOut = csp_rgy_to_enc(GetEncoderCSP(prm));
-        unique_ptr<RGYFilterSsim> filterSsim(new RGYFilterSsim(m_cl));
-        shared_ptr<RGYFilterParamSsim> param(new RGYFilterParamSsim());
-        param->input = videooutputinfo(
-            m_enccfg,
-            m_sar,
-            m_picStruct,
-            m_encVUI
-        );
-        param->input.srcWidth = m_encWidth;
-        param->input.srcHeight = m_encHeight;
-        param->bitDepth = prm->outputDepth;
-        param->frameIn = (m_pLastFilterParam) ? m_pLastFilterParam->frameOut : RGYFrameInfo(m_encWidth, m_encHeight, GetEncoderCSP(prm), GetEncoderBitdepth(prm), m_picStruct, RGY_MEM_TYPE_GPU_IMAGE);
-        param->frameOut = param->frameIn;
-        param->frameOut.csp = param->input.csp;
-        param->frameIn.mem_type = RGY_MEM_TYPE_GPU;
-        param->frameOut.mem_type = RGY_MEM_TYPE_GPU;
-        param->baseFps = m_encFps;
-        param->bOutOverwrite = false;
-        param->threadParam = prm->ctrl.threadParams.get(RGYThreadType::VIDEO_QUALITY);;
-        param->metric = prm->common.metric;
-        auto sts = filterSsim->init(param, m_pLog);
-        if (sts != RGY_ERR_NONE) {
-            return sts;
-        }
-        m_videoQualityMetric = std::move(filterSsim);
+    RGYVideoMetricCPUParam param;
+    param.metric = prm->common.metric;
+    param.vif = prm->qualityMetric.vif;
+    param.adm = prm->qualityMetric.adm;
+    param.motion = prm->qualityMetric.motion;
+    if (!param.enabled()) {
+        return RGY_ERR_NONE;
+    }
+    //CPUでデコードして比較するので、OpenCLは不要
+    param.threads = prm->qualityMetric.threads;
+    param.logFile = prm->qualityMetric.log;
+    param.codec = m_encCodec;
+    param.frameInfo = (m_pLastFilterParam) ? m_pLastFilterParam->frameOut : RGYFrameInfo(m_encWidth, m_encHeight, GetEncoderCSP(prm), GetEncoderBitdepth(prm), m_picStruct, RGY_MEM_TYPE_CPU);
+    param.bitDepth = prm->outputDepth;
+    param.threadParam = prm->ctrl.threadParams.get(RGYThreadType::VIDEO_QUALITY);
+    auto metric = std::make_unique<RGYVideoMetricCPU>();
+    auto sts = metric->init(param, m_pLog);
+    if (sts != RGY_ERR_NONE) {
+        return sts;
     }
+    m_videoQualityMetric = std::move(metric);
     return RGY_ERR_NONE;
 }
 
@@ -2308,19 +2591,310 @@ bool MPPCore::VppAfsRffAware() const {
     return vpp_afs_rff_aware;
 }
 
+// --fast-remux: 入力の映像をそのまま出力できるか確認し、できない場合はその理由を返す
+tstring MPPCore::checkFastRemux(const MPPParam *prm) {
+#if ENABLE_AVSW_READER
+    auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(m_pFileReader);
+    if (!pAVCodecReader || m_pFileReader->getInputCodec() == RGY_CODEC_UNKNOWN) {
+        return _T("input is not read by avhw reader");
+    }
+    const auto inputCodec = m_pFileReader->getInputCodec();
+    if (inputCodec != prm->codec) {
+        return strsprintf(_T("input codec %s differs from output codec %s"), CodecToStr(inputCodec).c_str(), CodecToStr(prm->codec).c_str());
+    }
+    const auto stream = pAVCodecReader->GetInputVideoStream();
+    const auto codecDesc = [](const CX_DESC *list, int value) {
+        const auto desc = get_cx_desc(list, value);
+        return (desc) ? tstring(desc) : strsprintf(_T("%d"), value);
+    };
+
+    //プロファイル: H.264は constrained baseline < main < high の順に上位のプロファイルでデコードできる
+    //baselineはFMO/ASOなどmainにないツールを含みうるので、constraint_set1_flagのないものはbaselineとしてのみ扱う
+    const int inProfile = stream->codecpar->profile;
+    const int outProfile = prm->codecParam[prm->codec].profile;
+    bool profileCompatible = inProfile == outProfile;
+    if (prm->codec == RGY_CODEC_H264) {
+        const auto avcProfileRank = [](int profile) {
+            switch (profile & ~(1 << 9) /*FF_PROFILE_H264_CONSTRAINED*/) {
+            case 66:  return 0; // baseline
+            case 77:  return 1; // main
+            case 100: return 2; // high
+            default:  return -1;
+            }
+        };
+        const bool inConstrainedBaseline = inProfile == (66 | (1 << 9)) /*FF_PROFILE_H264_CONSTRAINED_BASELINE*/;
+        const int inRank = avcProfileRank(inProfile);
+        const int outRank = avcProfileRank(outProfile);
+        profileCompatible = inRank >= 0 && (inRank == outRank || (inRank < outRank && (inRank > 0 || inConstrainedBaseline)));
+    }
+    if (!profileCompatible) {
+        const auto inProfileName = avcodec_profile_name(stream->codecpar->codec_id, inProfile);
+        return strsprintf(_T("input profile %s does not fit output profile %s"),
+            (inProfileName) ? char_to_tstring(inProfileName).c_str() : strsprintf(_T("%d"), inProfile).c_str(),
+            codecDesc(get_profile_list(prm->codec), outProfile).c_str());
+    }
+    //レベル: autoなら判定しない
+    const int inLevel = stream->codecpar->level;
+    const int outLevel = prm->codecParam[prm->codec].level;
+    if (outLevel > 0 && (inLevel <= 0 || inLevel > outLevel)) {
+        return strsprintf(_T("input level %s exceeds output level %s"),
+            codecDesc(get_level_list(prm->codec), inLevel).c_str(), codecDesc(get_level_list(prm->codec), outLevel).c_str());
+    }
+    if (RGY_CSP_BIT_DEPTH[prm->input.csp] != GetEncoderBitdepth(prm)) {
+        return strsprintf(_T("input bitdepth %d differs from output bitdepth %d"), RGY_CSP_BIT_DEPTH[prm->input.csp], GetEncoderBitdepth(prm));
+    }
+    if (RGY_CSP_CHROMA_FORMAT[prm->input.csp] != RGY_CSP_CHROMA_FORMAT[GetEncoderCSP(prm)]) {
+        return strsprintf(_T("input colorspace %s is not supported for output"), RGY_CSP_NAMES[prm->input.csp]);
+    }
+    if (prm->input.picstruct & RGY_PICSTRUCT_INTERLACED) {
+        return _T("input is interlaced");
+    }
+
+    //映像に手を加える設定
+    if (cropEnabled(prm->input.crop)) {
+        return _T("crop is requested");
+    }
+    if ((prm->input.dstWidth > 0 && prm->input.dstWidth != prm->input.srcWidth)
+        || (prm->input.dstHeight > 0 && prm->input.dstHeight != prm->input.srcHeight)) {
+        return _T("resize is requested");
+    }
+    if (InitFiltersCreateVppList(prm, false, false, RGY_VPP_RESIZE_TYPE_NONE).size() > 0) {
+        return _T("vpp filters are requested");
+    }
+    if (prm->par[0] != 0 || prm->par[1] != 0) {
+        return _T("sar/dar is specified");
+    }
+    if (prm->common.out_vui != VideoVUIInfo()) {
+        return _T("output vui is specified");
+    }
+    if (prm->common.doviProfile != RGY_DOVI_PROFILE_UNSET && prm->common.doviProfile != RGY_DOVI_PROFILE_COPY) {
+        return _T("dolby vision profile conversion is requested");
+    }
+    if (prm->common.metric.enabled()) {
+        return strsprintf(_T("%s calculation is requested"), prm->common.metric.enabled_metric().c_str());
+    }
+    if (prm->qualityMetric.enabled()) {
+        return _T("quality metric calculation is requested");
+    }
+    if (prm->common.keyOnChapter || prm->common.keyFile.length() > 0) {
+        return _T("keyframe insertion is requested");
+    }
+
+    //timestamp関連
+    if ((pAVCodecReader->GetFramePosList()->getStreamPtsStatus() & (~RGY_PTS_NORMAL)) != 0) {
+        return _T("timestamps of input are not reliable");
+    }
+    if (m_nAVSyncMode & RGY_AVSYNC_FORCE_CFR) {
+        return _T("avsync forcecfr is requested");
+    }
+    if (prm->common.tcfileIn.length() > 0 || prm->common.timecode) {
+        return _T("timecode input/output is requested");
+    }
+    if (prm->common.seekToSec > 0.0f) {
+        return _T("seekto is requested");
+    }
+
+    //ビットレートの上限
+    if (prm->fastRemux.maxBitrate > 0) {
+        const int64_t bitrate = stream->codecpar->bit_rate;
+        if (bitrate <= 0) {
+            return _T("input bitrate is unknown");
+        }
+        if (bitrate > (int64_t)prm->fastRemux.maxBitrate * 1000) {
+            return strsprintf(_T("input bitrate %lld kbps exceeds max-bitrate %d kbps"), (lls)(bitrate / 1000), prm->fastRemux.maxBitrate);
+        }
+    }
+
+    //解析済みのフレームから、キーフレームの位置とBフレームによる遅延を取得する
+    const auto streamTimebase = to_rgy(stream->time_base);
+    const int64_t frameDuration = std::max<int64_t>(1, rational_rescale(1, m_inputFps.inv(), streamTimebase));
+    auto framePosList = pAVCodecReader->GetFramePosList();
+    const int analyzedFrames = framePosList->fixedNum();
+    std::vector<int> keyframes;
+    int64_t ptsDtsDiffMin = std::numeric_limits<int64_t>::max();
+    int64_t ptsDtsDiffMax = std::numeric_limits<int64_t>::min();
+    uint32_t framePosIdx = std::numeric_limits<uint32_t>::max();
+    for (int i = 0; i < analyzedFrames; i++) {
+        const auto pos = framePosList->copy(i, &framePosIdx);
+        if (pos.poc == FRAMEPOS_POC_INVALID) {
+            break;
+        }
+        if (pos.flags & AV_PKT_FLAG_KEY) {
+            keyframes.push_back(i);
+        }
+        if (pos.pts != AV_NOPTS_VALUE && pos.dts != AV_NOPTS_VALUE) {
+            ptsDtsDiffMin = std::min(ptsDtsDiffMin, pos.pts - pos.dts);
+            ptsDtsDiffMax = std::max(ptsDtsDiffMax, pos.pts - pos.dts);
+        }
+    }
+    if (keyframes.size() == 0) {
+        return _T("no keyframe found in analyzed frames");
+    }
+    m_fastRemuxVideoDelay = stream->codecpar->video_delay;
+    if (ptsDtsDiffMin <= ptsDtsDiffMax) {
+        m_fastRemuxVideoDelay = std::max(m_fastRemuxVideoDelay, (int)((ptsDtsDiffMax - ptsDtsDiffMin + frameDuration - 1) / frameDuration));
+    }
+
+    //キーフレーム間隔の上限 (最後のGOPは解析済みの範囲までの下限値)
+    if (prm->fastRemux.maxGop > 0) {
+        int gopMax = analyzedFrames - keyframes.back();
+        for (size_t i = 1; i < keyframes.size(); i++) {
+            gopMax = std::max(gopMax, keyframes[i] - keyframes[i - 1]);
+        }
+        if (gopMax > prm->fastRemux.maxGop) {
+            return strsprintf(_T("keyframe interval %d exceeds max-gop %d"), gopMax, prm->fastRemux.maxGop);
+        }
+        if (keyframes.size() < 2) {
+            return strsprintf(_T("keyframe interval could not be determined from %d analyzed frames"), analyzedFrames);
+        }
+    }
+
+    //smart-trimでは境界のGOPを再エンコードするので、trimの位置は問わない
+    if (fastRemuxSmartTrimSupported(prm)) {
+        return tstring();
+    }
+    //trimはGOP単位でのみ可能 (開始はキーフレーム、終了は次のキーフレームの直前)
+    const auto isKeyframe = [&keyframes](int frame) { return std::binary_search(keyframes.begin(), keyframes.end(), frame); };
+    const auto nearKeyframes = [&keyframes](int frame) {
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), frame);
+        const int next = (it != keyframes.end()) ? *it : -1;
+        const int prev = (it != keyframes.begin()) ? *(it - 1) : -1;
+        return strsprintf(_T("nearest keyframes: %d, %d"), prev, next);
+    };
+    for (const auto& trim : m_trimParam.list) {
+        if (trim.start >= analyzedFrames) {
+            return strsprintf(_T("trim start %d is beyond analyzed frames"), trim.start);
+        }
+        if (!isKeyframe(trim.start)) {
+            return strsprintf(_T("trim start %d is not a keyframe (%s)"), trim.start, nearKeyframes(trim.start).c_str());
+        }
+        if (trim.fin == TRIM_MAX || (prm->input.frames > 0 && trim.fin + 1 >= prm->input.frames)) {
+            continue;
+        }
+        if (trim.fin + 1 >= analyzedFrames) {
+            return strsprintf(_T("trim end %d is beyond analyzed frames"), trim.fin);
+        }
+        if (!isKeyframe(trim.fin + 1)) {
+            return strsprintf(_T("trim end %d is not followed by a keyframe (%s)"), trim.fin, nearKeyframes(trim.fin + 1).c_str());
+        }
+    }
+    return tstring();
+#else
+    return _T("avhw reader is not available");
+#endif
+}
+
+// smart-trimはパラメータセットの差し替えに対応したH.264/HEVCのみ
+bool MPPCore::fastRemuxSmartTrimSupported(const MPPParam *prm) const {
+    return prm->fastRemux.smartTrim && m_trimParam.list.size() > 0
+        && (prm->codec == RGY_CODEC_H264 || prm->codec == RGY_CODEC_HEVC);
+}
+
+RGY_ERR MPPCore::initFastRemux(const MPPParam *prm) {
+#if ENABLE_AVSW_READER
+    auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(m_pFileReader);
+    m_encCodec = prm->codec;
+    m_encWidth = prm->input.srcWidth;
+    m_encHeight = prm->input.srcHeight;
+    m_encFps = m_inputFps;
+    m_sar = rgy_rational<int>(prm->input.sar[0], prm->input.sar[1]);
+    m_picStruct = prm->input.picstruct;
+    m_encVUI = prm->input.vui;
+    //入力のtimestampをそのまま使用する
+    m_outputTimebase = to_rgy(pAVCodecReader->GetInputVideoStream()->time_base);
+    PrintMes(RGY_LOG_DEBUG, _T("fast-remux: %s %dx%d, timebase %d/%d, video delay %d.\n"),
+        CodecToStr(m_encCodec).c_str(), m_encWidth, m_encHeight, m_outputTimebase.n(), m_outputTimebase.d(), m_fastRemuxVideoDelay);
+    return RGY_ERR_NONE;
+#else
+    return RGY_ERR_UNSUPPORTED;
+#endif
+}
+
+// --fast-remux smart-trim: trimの境界のGOPを再エンコードするデコーダとエンコーダを初期化する
+// そのまま出力するGOPとつなげるよう、プロファイル/レベルは入力に合わせ、IDRごとにヘッダを出力する
+// 入力のパラメータは変更せず、コピーに対して設定する
+RGY_ERR MPPCore::initSmartTrim(const MPPParam *inputParam) {
+#if ENABLE_AVSW_READER
+    auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(m_pFileReader);
+    const auto codecpar = pAVCodecReader->GetInputVideoStream()->codecpar;
+    auto prm = std::make_unique<MPPParam>(*inputParam);
+    auto& codecParam = prm->codecParam[prm->codec];
+    codecParam.profile = (prm->codec == RGY_CODEC_H264) ? (codecpar->profile & ~(1 << 9) /*FF_PROFILE_H264_CONSTRAINED*/) : codecpar->profile;
+    if (codecpar->level > 0) {
+        codecParam.level = codecpar->level;
+    }
+    prm->repeatHeaders = true;
+
+    auto ret = initDecoder(prm.get());
+    if (ret != RGY_ERR_NONE) {
+        return ret;
+    }
+    ret = initEncoder(prm.get());
+    if (ret != RGY_ERR_NONE) {
+        return ret;
+    }
+    m_sar = rgy_rational<int>(prm->input.sar[0], prm->input.sar[1]); // initEncoderで上書きされるので戻す
+    PrintMes(RGY_LOG_DEBUG, _T("smart-trim: initialized decoder/encoder for boundary GOPs, profile %s, level %s.\n"),
+        get_cx_desc(get_profile_list(prm->codec), codecParam.profile), get_cx_desc(get_level_list(prm->codec), codecParam.level));
+    return RGY_ERR_NONE;
+#else
+    return RGY_ERR_UNSUPPORTED;
+#endif
+}
+
+VideoInfo MPPCore::fastRemuxOutputInfo(const MPPParam *prm) const {
+    VideoInfo info;
+#if ENABLE_AVSW_READER
+    auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(m_pFileReader);
+    const auto codecpar = pAVCodecReader->GetInputVideoStream()->codecpar;
+    info.codec = m_encCodec;
+    info.codecProfile = codecpar->profile;
+    info.codecLevel = codecpar->level;
+    info.videoDelay = m_fastRemuxVideoDelay;
+    info.dstWidth = m_encWidth;
+    info.dstHeight = m_encHeight;
+    info.fpsN = m_encFps.n();
+    info.fpsD = m_encFps.d();
+    info.sar[0] = m_sar.n();
+    info.sar[1] = m_sar.d();
+    info.picstruct = m_picStruct;
+    info.csp = prm->input.csp;
+    info.bitdepth = RGY_CSP_BIT_DEPTH[prm->input.csp];
+    info.vui = m_encVUI;
+#endif
+    return info;
+}
+
 RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
     m_pipelineTasks.clear();
 
-    if (m_decoder) {
+    if (m_fastRemux) {
+        auto pReader = dynamic_cast<RGYInputAvcodec *>(m_pFileReader.get());
+        const auto streamTimebase = to_rgy(pReader->GetInputVideoStream()->time_base);
+        const int64_t frameDuration = std::max<int64_t>(1, rational_rescale(1, m_inputFps.inv(), streamTimebase));
+        auto hdr10plus = (m_encCodec == RGY_CODEC_HEVC) ? m_hdr10plus.get() : nullptr;
+        if (m_smartTrim) {
+            // 境界のGOPの再エンコード用のデコーダ/エンコーダは、smart-trimのtask内で直接呼び出す
+            auto taskDec = std::make_unique<PipelineTaskMPPDecodePacket>(m_decoder.get(), m_pFileReader.get(), m_pLog);
+            auto taskEnc = std::make_unique<PipelineTaskMPPEncode>(m_encoder.get(), m_encCodec, m_enccfg, 0,
+                nullptr, m_encTimestamp.get(), m_outputTimebase, hdr10plus, false,
+                prm->ctrl.threadCsp, prm->ctrl.threadParams.get(RGYThreadType::CSP), m_pLog);
+            m_pipelineTasks.push_back(std::make_unique<PipelineTaskSmartTrim>(pReader, std::move(taskDec), std::move(taskEnc), m_encCodec,
+                m_encTimestamp.get(), hdr10plus, m_trimParam, frameDuration, m_timestampPassThrough, prm->fastRemux.maxGop, 1, m_pLog));
+        } else {
+            m_pipelineTasks.push_back(std::make_unique<PipelineTaskRemux>(pReader, m_encTimestamp.get(), hdr10plus, m_trimParam,
+                frameDuration, m_timestampPassThrough, prm->fastRemux.maxGop, 1, m_pLog));
+        }
+    } else if (m_decoder) {
         m_pipelineTasks.push_back(std::make_unique<PipelineTaskMPPDecode>(m_decoder.get(), 1, m_pFileReader.get(),
             m_pFileReader->getInputCodec() == RGY_CODEC_MPEG2, m_pLog));
     } else {
         m_pipelineTasks.push_back(std::make_unique<PipelineTaskInput>(0, m_pFileReader.get(), m_cl, m_pLog));
     }
     if (m_pFileWriterListAudio.size() > 0) {
-        m_pipelineTasks.push_back(std::make_unique<PipelineTaskAudio>(m_pFileReader.get(), m_AudioReaders, m_pFileWriterListAudio, m_vpFilters, 0, m_pLog));
+        m_pipelineTasks.push_back(std::make_unique<PipelineTaskAudio>(m_pFileReader.get(), m_AudioReaders, m_pFileWriterListAudio, m_vpFilters, m_poolPkt.get(), 0, m_pLog));
     }
-    { // checkpts
+    if (!m_fastRemux) { // checkpts
         RGYInputAvcodec *pReader = dynamic_cast<RGYInputAvcodec *>(m_pFileReader.get());
         const int64_t outFrameDuration = std::max<int64_t>(1, rational_rescale(1, m_inputFps.inv(), m_outputTimebase)); //固定fpsを仮定した時の1フレームのduration (スケール: m_outputTimebase)
         const auto inputFrameInfo = m_pFileReader->GetInputFrameInfo();
@@ -2344,7 +2918,7 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
                 PrintMes(RGY_LOG_ERROR, _T("OpenCL not enabled, OpenCL filters cannot be used.\n"));
                 return RGY_ERR_UNSUPPORTED;
             }
-            m_pipelineTasks.push_back(std::make_unique<PipelineTaskOpenCL>(filterBlock.vppcl, nullptr, m_cl, 3, m_pLog));
+            m_pipelineTasks.push_back(std::make_unique<PipelineTaskOpenCL>(filterBlock.vppcl, m_cl, 3, m_pLog));
         } else {
             PrintMes(RGY_LOG_ERROR, _T("Unknown filter type.\n"));
             return RGY_ERR_UNSUPPORTED;
@@ -2352,37 +2926,38 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
     }
 
     if (m_videoQualityMetric) {
-        int prevtask = -1;
-        for (int itask = (int)m_pipelineTasks.size() - 1; itask >= 0; itask--) {
-            if (!m_pipelineTasks[itask]->isPassThrough()) {
-                prevtask = itask;
-                break;
+        //エンコーダの直前でフレームをCPUに取り込み、比較用に保持する
+        m_pipelineTasks.push_back(std::make_unique<PipelineTaskVideoQualityMetric>(m_videoQualityMetric.get(), m_cl, 0, m_pLog));
+    }
+    if (m_encoder && !m_fastRemux && prm->lookahead.enable()) {
+        auto lookaheadPrm = prm->lookahead;
+        //先読み中のフレームは前段のmppのバッファグループから確保されたままになるので、
+        //デコーダの参照フレームとエンコーダへの投入分を除いて上限を超えないよう、先読み数を制限する
+        const auto prevTask = std::find_if(m_pipelineTasks.rbegin(), m_pipelineTasks.rend(), [](const std::unique_ptr<PipelineTask>& task) { return !task->isPassThrough(); });
+        if (prevTask != m_pipelineTasks.rend()) {
+            int reserved = -1;
+            switch ((*prevTask)->taskType()) {
+            case PipelineTaskType::MPPDEC: reserved = MPP_DEC_REF_FRAMES_MAX; break;
+            case PipelineTaskType::MPPVPP:
+            case PipelineTaskType::MPPIEP: reserved = 0; break;
+            default: break;
             }
-        }
-        if (m_pipelineTasks[prevtask]->taskType() == PipelineTaskType::INPUT) {
-            //inputと直接つながる場合はうまく処理できなくなる(うまく同期がとれない)
-            //そこで、CopyのOpenCLフィルタを挟んでその中で処理する
-            auto err = createOpenCLCopyFilterForPreVideoMetric(prm);
-            if (err != RGY_ERR_NONE) {
-                PrintMes(RGY_LOG_ERROR, _T("Failed to join mfx vpp session: %s.\n"), get_err_mes(err));
-                return err;
-            } else if (m_vpFilters.size() != 1) {
-                PrintMes(RGY_LOG_ERROR, _T("m_vpFilters.size() != 1.\n"));
-                return RGY_ERR_UNDEFINED_BEHAVIOR;
-            }
-            m_pipelineTasks.push_back(std::make_unique<PipelineTaskOpenCL>(m_vpFilters.front().vppcl, m_videoQualityMetric.get(), m_cl, 3, m_pLog));
-        } else if (m_pipelineTasks[prevtask]->taskType() == PipelineTaskType::OPENCL) {
-            auto taskOpenCL = dynamic_cast<PipelineTaskOpenCL*>(m_pipelineTasks[prevtask].get());
-            if (taskOpenCL == nullptr) {
-                PrintMes(RGY_LOG_ERROR, _T("taskOpenCL == nullptr.\n"));
-                return RGY_ERR_UNDEFINED_BEHAVIOR;
+            if (reserved >= 0) {
+                const int depthMax = std::max(1, MPP_FRAME_GROUP_BUF_MAX - reserved - PipelineTaskMPPEncode::ENC_IN_FRAMES - 1);
+                if (lookaheadPrm.depth > depthMax) {
+                    PrintMes(RGY_LOG_WARN, _T("lookahead depth limited to %d, as frames are held in the buffer pool of %s (max %d frames).\n"),
+                        depthMax, getPipelineTaskTypeName((*prevTask)->taskType()), MPP_FRAME_GROUP_BUF_MAX);
+                    lookaheadPrm.depth = depthMax;
+                }
             }
-            taskOpenCL->setVideoQualityMetricFilter(m_videoQualityMetric.get());
-        } else {
-            m_pipelineTasks.push_back(std::make_unique<PipelineTaskVideoQualityMetric>(m_videoQualityMetric.get(), m_cl, 0, m_pLog));
         }
+        auto taskLookahead = std::make_unique<PipelineTaskLookahead>(lookaheadPrm, m_enccfg.frameinfo(), m_pLog);
+        if (auto err = taskLookahead->init(); err != RGY_ERR_NONE) {
+            return err;
+        }
+        m_pipelineTasks.push_back(std::move(taskLookahead));
     }
-    if (m_encoder) {
+    if (m_encoder && !m_fastRemux) {
         m_pipelineTasks.push_back(std::make_unique<PipelineTaskMPPEncode>(m_encoder.get(), m_encCodec, m_enccfg, 1,
             m_timecode.get(), m_encTimestamp.get(), m_outputTimebase, m_hdr10plus.get(), m_hdr10plusMetadataCopy,
             prm->ctrl.threadCsp, prm->ctrl.threadParams.get(RGYThreadType::CSP), m_pLog));
@@ -2401,6 +2976,26 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
     return RGY_ERR_NONE;
 }
 
+void MPPCore::clearPipelineTasks() {
+    // 後段のtaskが前段のtaskのフレームへの参照を保持している場合があるので、先に参照を破棄する
+    for (auto it = m_pipelineTasks.rbegin(); it != m_pipelineTasks.rend(); it++) {
+        (*it)->releaseFrameRefs();
+    }
+    // OpenCLからエンコーダに直接出力する場合、OpenCLのフレームはエンコーダの入力用バッファを参照しているので、
+    // エンコーダの破棄でバッファが解放される前にOpenCLのフレームを解放する
+    for (auto& task : m_pipelineTasks) {
+        task->workSurfacesReleaseExternal();
+    }
+    // バッチ処理では、確保したOpenCLのフレームを後続のジョブで使いまわせるようcontextに返却する
+    for (auto& task : m_pipelineTasks) {
+        task->workSurfacesReturnCL();
+    }
+    // 後ろから解放する
+    while (!m_pipelineTasks.empty()) {
+        m_pipelineTasks.pop_back();
+    }
+}
+
 RGY_ERR MPPCore::allocatePiplelineFrames() {
     if (m_pipelineTasks.size() == 0) {
         PrintMes(RGY_LOG_ERROR, _T("allocFrames: pipeline not defined!\n"));
@@ -2418,11 +3013,15 @@ RGY_ERR MPPCore::allocatePiplelineFrames() {
         }
         // 次のtaskを見つける
         PipelineTask *t1 = nullptr;
+        int passThroughRequestNumFrame = 0; // lookaheadなど、フレームを保持するpassthroughなtaskの分
         for (; ip < m_pipelineTasks.size(); ip++) {
             if (!m_pipelineTasks[ip]->isPassThrough()) { // isPassThroughがtrueなtaskはスキップ
                 t1 = m_pipelineTasks[ip].get();
                 break;
             }
+            if (const auto passThroughAlloc = m_pipelineTasks[ip]->requiredSurfIn(); passThroughAlloc.has_value()) {
+                passThroughRequestNumFrame += passThroughAlloc.value().second;
+            }
         }
         if (t1 == nullptr) {
             PrintMes(RGY_LOG_ERROR, _T("AllocFrames: invalid pipeline, t1 not found!\n"));
@@ -2466,17 +3065,38 @@ RGY_ERR MPPCore::allocatePiplelineFrames() {
         if (t0->taskType() == PipelineTaskType::OPENCL) {
             t0RequestNumFrame += 4; // 内部でフレームが増える場合に備えて
         }
+        t1RequestNumFrame += passThroughRequestNumFrame;
         if (allocateOpenCLFrame) {
             const int requestNumFrames = std::max(1, t0RequestNumFrame + t1RequestNumFrame + asyncdepth + 1);
             PrintMes(RGY_LOG_DEBUG, _T("AllocFrames: %s-%s, type: CL, %s %dx%d, request %d frames (%d+%d+%d+1)\n"),
                 t0->print().c_str(), t1->print().c_str(), RGY_CSP_NAMES[allocateFrameInfo.csp],
                 allocateFrameInfo.width, allocateFrameInfo.height, requestNumFrames,
                 t0RequestNumFrame, t1RequestNumFrame, asyncdepth, 1);
+            // openclとencoderがつながっている場合、エンコーダの入力用バッファに直接書き込むようにする
+            if (auto tEnc = dynamic_cast<PipelineTaskMPPEncode *>(t1); tEnc != nullptr && t0->taskType() == PipelineTaskType::OPENCL) {
+                std::vector<std::unique_ptr<RGYFrame>> frames;
+                if (tEnc->allocateCLFramesDirect(m_cl.get(), allocateFrameInfo, requestNumFrames, frames) == RGY_ERR_NONE) {
+                    auto sts = t0->workSurfacesSet(frames);
+                    if (sts != RGY_ERR_NONE) {
+                        PrintMes(RGY_LOG_ERROR, _T("AllocFrames:   Failed to set frames for %s-%s: %s."), t0->print().c_str(), t1->print().c_str(), get_err_mes(sts));
+                        return sts;
+                    }
+                    PrintMes(RGY_LOG_DEBUG, _T("AllocFrames: %s-%s, OpenCL writes directly to encoder input buffers.\n"), t0->print().c_str(), t1->print().c_str());
+                    t0 = t1;
+                    continue;
+                }
+                frames.clear();
+                tEnc->releaseCLFramesDirect();
+                PrintMes(RGY_LOG_DEBUG, _T("AllocFrames: %s-%s, direct output to encoder input buffers not available, fallback to copy.\n"), t0->print().c_str(), t1->print().c_str());
+            }
             auto sts = t0->workSurfacesAllocCL(requestNumFrames, allocateFrameInfo, m_cl.get());
             if (sts != RGY_ERR_NONE) {
                 PrintMes(RGY_LOG_ERROR, _T("AllocFrames:   Failed to allocate frames for %s-%s: %s."), t0->print().c_str(), t1->print().c_str(), get_err_mes(sts));
                 return sts;
             }
+        } else if (t0->taskType() == PipelineTaskType::INPUT && dynamic_cast<PipelineTaskMPPEncode *>(t1) != nullptr) {
+            // 入力とencoderがつながっている場合、readerの色空間変換はエンコーダ入力用のDRMバッファ(RGYFrameMpp)に直接書き込む
+            PrintMes(RGY_LOG_DEBUG, _T("AllocFrames: %s-%s, input converts directly into encoder input buffers.\n"), t0->print().c_str(), t1->print().c_str());
         }
 #if 0
         else {
@@ -2521,6 +3141,11 @@ RGY_ERR MPPCore::init(MPPParam *prm) {
         m_pipelineDepth = 1;
         PrintMes(RGY_LOG_DEBUG, _T("lowlatency mode.\n"));
     }
+    m_pipelineBenchmark = prm->pipelineBenchmark;
+    mppStubSetEnabled(prm->stub.enable);
+    if (prm->stub.enable) {
+        PrintMes(RGY_LOG_DEBUG, _T("mpp stub: latency %d ms, fps %.3f, size %d.\n"), prm->stub.latency, prm->stub.fps, prm->stub.size);
+    }
 
     if (!m_pStatus) {
         m_pStatus = std::make_shared<EncodeStatus>();
@@ -2536,23 +3161,62 @@ RGY_ERR MPPCore::init(MPPParam *prm) {
         return ret;
     }
 
-    if (RGY_ERR_NONE != (ret = initDevice(prm->ctrl.enableOpenCL, prm->vpp.checkPerformance))) {
-        return ret;
+    //共有するOpenCLのcontext(ビルド済みのプログラムのカーネル等)は複数のジョブから同時に使用できないので、
+    //前のジョブが終了するまで待機する
+    if (m_deviceInitWait) {
+        PrintMes(RGY_LOG_DEBUG, _T("Waiting for the previous job to finish.\n"));
+        m_deviceInitWait();
     }
 
-    if (RGY_ERR_NONE != (ret = initDecoder(prm))) {
+    if (RGY_ERR_NONE != (ret = initDevice(prm->ctrl.enableOpenCL, prm->vpp.checkPerformance))) {
         return ret;
     }
+    if (m_cl) {
+        m_cl->frameHistory()->setLimit((size_t)prm->ctrl.clFrameHistoryMB * 1024 * 1024);
+    }
+    if (m_cl && prm->ctrl.inputList.length() > 0) {
+        //バッチ処理では後続のジョブでcontextを共有するので、ビルドしたプログラムとフレームを使いまわせるようにする
+        m_cl->setProgramCache(true);
+        m_cl->setFrameCache(true);
+    }
 
-    if (RGY_ERR_NONE != (ret = initFilters(prm))) {
-        return ret;
+    //OpenCLの有無でvppフィルタの構成が変わるので、initDeviceの後で判定する
+    if (prm->fastRemux.enable) {
+        const auto reason = checkFastRemux(prm);
+        if (reason.length() == 0) {
+            m_fastRemux = true;
+            m_smartTrim = fastRemuxSmartTrimSupported(prm);
+            PrintMes(RGY_LOG_INFO, _T("fast-remux: input matches output settings, video will be copied without re-encoding%s.\n"),
+                (m_smartTrim) ? _T(" except GOPs at trim boundaries") : _T(""));
+        } else {
+            PrintMes(RGY_LOG_INFO, _T("fast-remux: %s, video will be encoded.\n"), reason.c_str());
+        }
     }
 
-    if (RGY_ERR_NONE != (ret = initEncoder(prm))) {
-        return ret;
+    if (m_fastRemux) {
+        if (RGY_ERR_NONE != (ret = initFastRemux(prm))) {
+            return ret;
+        }
+        if (m_smartTrim && RGY_ERR_NONE != (ret = initSmartTrim(prm))) {
+            return ret;
+        }
+    } else {
+        if (RGY_ERR_NONE != (ret = initDecoder(prm))) {
+            return ret;
+        }
+
+        if (RGY_ERR_NONE != (ret = initFilters(prm))) {
+            return ret;
+        }
+
+        if (RGY_ERR_NONE != (ret = initEncoder(prm))) {
+            return ret;
+        }
     }
 
-    m_encTimestamp = std::make_unique<RGYTimestamp>(prm->common.timestampPassThrough);
+    // 出力スレッドのキューに滞留しうるフレームがすべて収まるようにする
+    m_encTimestamp = std::make_unique<RGYTimestamp>(prm->common.timestampPassThrough, rgy_output_video_queue_max(m_encFps));
+    PrintMes(RGY_LOG_DEBUG, _T("timestamp ring size: %lld.\n"), (long long)m_encTimestamp->size());
 
     if (RGY_ERR_NONE != (ret = initPowerThrottoling(prm))) {
         return ret;
@@ -2582,6 +3246,13 @@ RGY_ERR MPPCore::init(MPPParam *prm) {
         return ret;
     }
 
+    if (prm->adaptiveQueue.enable) {
+        m_adaptiveQueue = std::make_unique<MPPAdaptiveQueue>(prm->adaptiveQueue, m_pLog);
+        m_adaptiveQueue->init(m_pipelineTasks);
+        PrintMes(RGY_LOG_DEBUG, _T("Enabled adaptive queue: depth %d-%d, pool-max %d, interval %d.\n"),
+            prm->adaptiveQueue.minDepth, prm->adaptiveQueue.maxDepth, prm->adaptiveQueue.poolMax, prm->adaptiveQueue.interval);
+    }
+
     {
         const auto& threadParam = prm->ctrl.threadParams.get(RGYThreadType::MAIN);
         threadParam.apply(GetCurrentThread());
@@ -2607,6 +3278,7 @@ RGY_ERR MPPCore::run2() {
     auto checkAbort = [pabort = m_pAbortByUser]() { return  (pabort != nullptr && *pabort); };
 #endif
     m_pStatus->SetStart();
+    const auto benchmarkStart = std::chrono::steady_clock::now();
 
     CProcSpeedControl speedCtrl(m_nProcSpeedLimit);
 
@@ -2659,6 +3331,9 @@ RGY_ERR MPPCore::run2() {
                 }
             }
             if (dataqueue.empty()) {
+                if (m_adaptiveQueue) {
+                    m_adaptiveQueue->check(m_pipelineTasks.front()->outputFrames());
+                }
                 speedCtrl.wait(m_pipelineTasks.front()->outputFrames());
                 dataqueue.push_back(PipelineTaskData(0)); // デコード実行用
             }
@@ -2715,6 +3390,9 @@ RGY_ERR MPPCore::run2() {
     // flush
     if (err == RGY_ERR_MORE_BITSTREAM) { // 読み込みの完了を示すフラグ
         err = RGY_ERR_NONE;
+        if (m_drainCallback) {
+            m_drainCallback();
+        }
         for (auto& task : m_pipelineTasks) {
             task->setOutputMaxQueueSize(0); //flushのため
         }
@@ -2782,13 +3460,22 @@ RGY_ERR MPPCore::run2() {
     }
 
     //vpp-perf-monitor
-    std::vector<std::pair<tstring, double>> filter_result;
+    //計測結果はバックグラウンドで回収しているので、すべて回収してから集計する
+    if (m_cl && m_cl->profileCollector()) {
+        if (!m_cl->profileCollector()->flush()) {
+            PrintMes(RGY_LOG_WARN, _T("vpp-perf-monitor: timeout waiting for profiling events, results may be incomplete.\n"));
+        }
+        if (m_cl->profileCollector()->dropped() > 0) {
+            PrintMes(RGY_LOG_DEBUG, _T("vpp-perf-monitor: dropped %lld events.\n"), (long long)m_cl->profileCollector()->dropped());
+        }
+    }
+    std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>> filter_result;
     for (auto& block : m_vpFilters) {
         if (block.type == VppFilterType::FILTER_OPENCL) {
             for (auto& filter : block.vppcl) {
-                auto avgtime = filter->GetAvgTimeElapsed();
-                if (avgtime > 0.0) {
-                    filter_result.push_back({ filter->name(), avgtime });
+                auto perf = filter->GetPerf();
+                if (perf && perf->GetAvgTimeElapsed() > 0.0) {
+                    filter_result.push_back({ filter->name(), perf });
                 }
             }
         }
@@ -2811,7 +3498,7 @@ RGY_ERR MPPCore::run2() {
     }
     //この中でフレームの解放がなされる
     PrintMes(RGY_LOG_DEBUG, _T("Clear pipeline tasks and allocated frames...\n"));
-    m_pipelineTasks.clear();
+    clearPipelineTasks();
     PrintMes(RGY_LOG_DEBUG, _T("Waiting for writer to finish...\n"));
     m_pFileWriter->WaitFin();
     PrintMes(RGY_LOG_DEBUG, _T("Write results...\n"));
@@ -2820,9 +3507,10 @@ RGY_ERR MPPCore::run2() {
         m_videoQualityMetric->showResult();
     }
     m_pStatus->WriteResults();
+    printPoolStatistics();
     if (filter_result.size()) {
         PrintMes(RGY_LOG_INFO, _T("\nVpp Filter Performance\n"));
-        const auto max_len = std::accumulate(filter_result.begin(), filter_result.end(), 0u, [](uint32_t max_length, std::pair<tstring, double> info) {
+        const auto max_len = std::accumulate(filter_result.begin(), filter_result.end(), 0u, [](uint32_t max_length, const std::pair<tstring, std::shared_ptr<RGYFilterPerf>>& info) {
             return std::max(max_length, (uint32_t)info.first.length());
             });
         for (const auto& info : filter_result) {
@@ -2830,13 +3518,97 @@ RGY_ERR MPPCore::run2() {
             for (uint32_t i = (uint32_t)info.first.length(); i < max_len; i++) {
                 str += _T(" ");
             }
-            PrintMes(RGY_LOG_INFO, _T("%s %8.1f us\n"), str.c_str(), info.second * 1000.0);
+            const auto stat = info.second->GetStat();
+            PrintMes(RGY_LOG_INFO, _T("%s %8.1f us (p50 %8.1f us, p95 %8.1f us, p99 %8.1f us, max %8.1f us)\n"), str.c_str(),
+                info.second->GetAvgTimeElapsed() * 1000.0, stat.percentileMs(0.50) * 1000.0, stat.percentileMs(0.95) * 1000.0, stat.percentileMs(0.99) * 1000.0, stat.maxMs * 1000.0);
+            for (const auto& [kernel, kstat] : info.second->GetKernelStat()) {
+                PrintMes(RGY_LOG_INFO, _T("  %s: %8.1f us x %.2f/frame (max %8.1f us)\n"),
+                    char_to_tstring(kernel).c_str(), kstat.avgMs() * 1000.0,
+                    (info.second->GetRunCount() > 0) ? kstat.count / (double)info.second->GetRunCount() : 0.0, kstat.maxMs * 1000.0);
+            }
         }
     }
+    if (m_adaptiveQueue) {
+        m_adaptiveQueue->printResult();
+    }
+    if (m_pipelineBenchmark) {
+        printPipelineBenchmark(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - benchmarkStart).count());
+    }
     PrintMes(RGY_LOG_DEBUG, _T("RunEncode2: finished.\n"));
     return (err == RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE || err == RGY_ERR_MORE_BITSTREAM || err > RGY_ERR_NONE) ? RGY_ERR_NONE : err;
 }
 
+// AVPacket/AVFrameとpayload用のpoolのヒット率 (再利用できた割合) を表示する
+void MPPCore::printPoolStatistics() {
+    std::vector<std::tuple<tstring, uint64_t, uint64_t, uint64_t>> stats; // 名前, 確保, 再利用, 破棄したpool数
+    if (m_poolPkt) {
+        stats.push_back({ _T("AVPacket"), m_poolPkt->allocatedCount(), m_poolPkt->reusedCount(), 0 });
+    }
+    if (m_poolFrame) {
+        stats.push_back({ _T("AVFrame"), m_poolFrame->allocatedCount(), m_poolFrame->reusedCount(), 0 });
+    }
+#if ENABLE_AVSW_READER
+    if (auto pReader = dynamic_cast<RGYInputAvcodec *>(m_pFileReader.get()); pReader && pReader->GetPacketBufferPool()) {
+        const auto pool = pReader->GetPacketBufferPool();
+        stats.push_back({ _T("input payload"), pool->allocatedCount(), pool->reusedCount(), pool->trimmedCount() });
+    }
+    if (auto pWriter = dynamic_cast<RGYOutputAvcodec *>(m_pFileWriter.get()); pWriter && pWriter->GetVideoPacketBufferPool()) {
+        const auto pool = pWriter->GetVideoPacketBufferPool();
+        stats.push_back({ _T("output payload"), pool->allocatedCount(), pool->reusedCount(), pool->trimmedCount() });
+    }
+#endif //#if ENABLE_AVSW_READER
+    bool header = false;
+    for (const auto& [name, allocated, reused, trimmed] : stats) {
+        const auto requested = allocated + reused;
+        if (requested == 0) {
+            continue;
+        }
+        if (!header) {
+            PrintMes(RGY_LOG_INFO, _T("\nBuffer Pool\n"));
+            header = true;
+        }
+        tstring str = strsprintf(_T("%-15s hit %5.1f%% (reused %llu, allocated %llu)"), (name + _T(":")).c_str(),
+            reused * 100.0 / requested, (unsigned long long)reused, (unsigned long long)allocated);
+        if (trimmed > 0) {
+            str += strsprintf(_T(", trimmed %llu pools"), (unsigned long long)trimmed);
+        }
+        PrintMes(RGY_LOG_INFO, _T("%s\n"), str.c_str());
+    }
+}
+
+void MPPCore::printPipelineBenchmark(const double elapsedMs) {
+    const auto frames = m_pStatus->GetEncodeData().frameOut;
+    if (frames == 0) {
+        return;
+    }
+    const double totalPerFrame = elapsedMs / frames;
+    PrintMes(RGY_LOG_INFO, _T("\nPipeline Benchmark\n"));
+    PrintMes(RGY_LOG_INFO, _T("frames:            %8u\n"), frames);
+    PrintMes(RGY_LOG_INFO, _T("total:             %8.3f ms/frame (%.2f fps)\n"), totalPerFrame, 1000.0 / totalPerFrame);
+    // スタブ使用時のみ、ハードウェア処理時間相当を分離できる
+    double hwPerFrame = 0.0;
+    bool hwKnown = false;
+    const std::pair<const TCHAR *, MPPContext *> hwList[] = {
+        { _T("decoder (stub):    "), m_decoder.get() },
+        { _T("encoder (stub):    "), m_encoder.get() }
+    };
+    for (const auto& [name, ctx] : hwList) {
+        if (ctx && ctx->stub) {
+            const auto stats = ctx->stub->stats();
+            const double perFrame = (stats.frames > 0) ? stats.busyMs / stats.frames : 0.0;
+            PrintMes(RGY_LOG_INFO, _T("%s%8.3f ms/frame\n"), name, perFrame);
+            hwPerFrame = std::max(hwPerFrame, perFrame);
+            hwKnown = true;
+        }
+    }
+    if (hwKnown) {
+        // デコーダとエンコーダは並列に動作するので、遅いほうとの差をオーバーヘッドとみなす
+        PrintMes(RGY_LOG_INFO, _T("pipeline overhead: %8.3f ms/frame\n"), std::max(totalPerFrame - hwPerFrame, 0.0));
+    } else {
+        PrintMes(RGY_LOG_INFO, _T("hw time is available only with --mpp-stub.\n"));
+    }
+}
+
 void MPPCore::PrintEncoderParam() {
     PrintMes(RGY_LOG_INFO, GetEncoderParam().c_str());
 }
@@ -2901,11 +3673,20 @@ tstring MPPCore::GetEncoderParam() {
             mes += strsprintf(_T("%s%s\n"), m, m_videoQualityMetric->GetInputMessage().c_str());
         }
     }
-    mes += strsprintf(_T("Output:        %s  %s @ Level %s%s\n"),
-        CodecToStr(m_encCodec).c_str(),
-        get_cx_desc(get_profile_list(m_encCodec), m_enccfg.codec_profile()),
-        get_cx_desc(get_level_list(m_encCodec), m_enccfg.codec_level()),
-        (m_encCodec == RGY_CODEC_HEVC) ? (tstring(_T(" (")) + get_cx_desc(get_tier_list(m_encCodec), m_enccfg.codec_tier()) + _T(" tier)")).c_str() : _T(""));
+    if (m_smartTrim) {
+        mes += strsprintf(_T("Output:        %s (fast-remux, trim boundaries re-encoded as %s @ Level %s)\n"),
+            CodecToStr(m_encCodec).c_str(),
+            get_cx_desc(get_profile_list(m_encCodec), m_enccfg.codec_profile()),
+            get_cx_desc(get_level_list(m_encCodec), m_enccfg.codec_level()));
+    } else if (m_fastRemux) {
+        mes += strsprintf(_T("Output:        %s (fast-remux, copied without re-encoding)\n"), CodecToStr(m_encCodec).c_str());
+    } else {
+        mes += strsprintf(_T("Output:        %s  %s @ Level %s%s\n"),
+            CodecToStr(m_encCodec).c_str(),
+            get_cx_desc(get_profile_list(m_encCodec), m_enccfg.codec_profile()),
+            get_cx_desc(get_level_list(m_encCodec), m_enccfg.codec_level()),
+            (m_encCodec == RGY_CODEC_HEVC) ? (tstring(_T(" (")) + get_cx_desc(get_tier_list(m_encCodec), m_enccfg.codec_tier()) + _T(" tier)")).c_str() : _T(""));
+    }
     mes += strsprintf(_T("               %dx%d%s %d:%d %0.3ffps (%d/%dfps)\n"),
         (int)m_encWidth, (int)m_encHeight,
         _T("p"),
@@ -2929,7 +3710,9 @@ tstring MPPCore::GetEncoderParam() {
             }
         }
     }
-    if (m_enccfg.rc.rc_mode == MPP_ENC_RC_MODE_FIXQP) {
+    if (m_fastRemux && !m_smartTrim) {
+        //エンコードしないので、レート制御の情報はない
+    } else if (m_enccfg.rc.rc_mode == MPP_ENC_RC_MODE_FIXQP) {
         mes += strsprintf(_T("CQP:           %d:%d\n"), m_enccfg.rc.qp_init, m_enccfg.rc.qp_init + m_enccfg.rc.qp_delta_ip);
     } else {
         mes += strsprintf(_T("Quality:       %s\n"), get_cx_desc(list_mpp_quality_preset, m_enccfg.rc.quality));
@@ -2941,7 +3724,14 @@ tstring MPPCore::GetEncoderParam() {
         mes += strsprintf(_T("QP:            Min: %d, Max: %d\n"),
             m_enccfg.rc.qp_min, m_enccfg.rc.qp_max);
     }
-    mes += strsprintf(_T("GOP Len:       %d frames\n"), m_enccfg.rc.gop);
+    if (!m_fastRemux) {
+        mes += strsprintf(_T("GOP Len:       %d frames\n"), m_enccfg.rc.gop);
+    }
+    for (const auto& task : m_pipelineTasks) {
+        if (const auto taskLookahead = dynamic_cast<const PipelineTaskLookahead *>(task.get()); taskLookahead != nullptr) {
+            mes += strsprintf(_T("Lookahead:     %s\n"), taskLookahead->param().print().c_str());
+        }
+    }
     { const auto &vui_str = m_encVUI.print_all();
     if (vui_str.length() > 0) {
         mes += strsprintf(_T("VUI:              %s\n"), vui_str.c_str());
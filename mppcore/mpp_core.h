@@ -29,6 +29,7 @@
 
 #include <thread>
 #include <future>
+#include <functional>
 
 #include "rgy_version.h"
 #include "rgy_err.h"
@@ -42,8 +43,10 @@
 #include "mpp_param.h"
 #include "mpp_filter.h"
 #include "mpp_pipeline.h"
+#include "mpp_adaptive_queue.h"
+#include "mpp_vpp_placement.h"
 #include "rgy_filter.h"
-#include "rgy_filter_ssim.h"
+#include "rgy_metric_cpu.h"
 #include "rk_mpi.h"
 
 #pragma warning(pop)
@@ -98,6 +101,14 @@ public:
     void PrintMes(RGYLogLevel log_level, const TCHAR *format, ...);
 
     void SetAbortFlagPointer(bool *abortFlag);
+    //バッチ処理用: OpenCLのcontextを前のジョブと共有する (init前に設定)
+    void SetSharedCL(std::shared_ptr<RGYOpenCLContext> cl) { m_clShared = cl; }
+    std::shared_ptr<RGYOpenCLContext> GetCL() const { return m_cl; }
+    //入力が終了し、flushを開始する際に呼ばれる (run2のスレッドから)
+    void SetDrainCallback(std::function<void()> callback) { m_drainCallback = callback; }
+    //バッチ処理用: init中、OpenCLのcontextを使用する初期化の直前に呼ばれる
+    //  共有するcontextを前のジョブが使い終わるまで待機するのに使用する
+    void SetDeviceInitWait(std::function<void()> wait) { m_deviceInitWait = wait; }
 protected:
     virtual RGY_ERR readChapterFile(tstring chapfile);
 
@@ -109,22 +120,34 @@ protected:
     virtual RGY_ERR initFilters(MPPParam *prm);
     virtual std::vector<VppType> InitFiltersCreateVppList(const MPPParam *inputParam,
         const bool cspConvRequired, const bool cropRequired, const RGY_VPP_RESIZE_TYPE resizeRequired);
+    virtual std::vector<VppType> InitFiltersPlaceRGAOpenCL(const MPPParam *inputParam,
+        const std::vector<VppType>& filterPipeline, const bool cropRequired, const RGY_VPP_RESIZE_TYPE resizeRequired);
+    virtual bool InitFiltersMeasurePlacementCost(VppPlacementCost& cost, const MPPParam *inputParam, const std::vector<VppPlacementCandidate>& candidates,
+        const RGYFrameInfo& inputFrame, const sInputCrop *crop, const std::pair<int, int> resize);
+    virtual void InitFiltersFuseRGA();
     virtual RGY_ERR AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilters,
         RGYFrameInfo & inputFrame, const VppType vppType, const MPPParam *prm, const sInputCrop * crop, const std::pair<int, int> resize, VideoVUIInfo& vuiInfo);
     virtual RGY_ERR AddFilterRGAIEP(std::vector<std::unique_ptr<RGAFilter>>&filters,
         RGYFrameInfo & inputFrame, const VppType vppType, const MPPParam *prm, const sInputCrop * crop, const std::pair<int, int> resize, VideoVUIInfo& vuiInfo);
-    virtual RGY_ERR createOpenCLCopyFilterForPreVideoMetric(const MPPParam *inputParam);
     virtual RGY_ERR initChapters(MPPParam *prm);
     virtual RGY_ERR initEncoderPrep(const MPPParam *prm);
     virtual RGY_ERR initEncoderRC(const MPPParam *prm);
     virtual RGY_ERR initEncoderCodec(const MPPParam *prm);
     virtual RGY_ERR initEncoder(MPPParam *prm);
+    void printPipelineBenchmark(const double elapsedMs);
+    void printPoolStatistics();
     virtual RGY_ERR initPowerThrottoling(MPPParam *prm);
     virtual RGY_ERR initSSIMCalc(MPPParam *prm);
     virtual RGY_ERR initPipeline(MPPParam *prm);
+    virtual tstring checkFastRemux(const MPPParam *prm);
+    virtual RGY_ERR initFastRemux(const MPPParam *prm);
+    virtual RGY_ERR initSmartTrim(const MPPParam *prm);
+    VideoInfo fastRemuxOutputInfo(const MPPParam *prm) const;
+    bool fastRemuxSmartTrimSupported(const MPPParam *prm) const;
 
     bool VppAfsRffAware() const;
     virtual RGY_ERR allocatePiplelineFrames();
+    void clearPipelineTasks();
 
     std::shared_ptr<RGYLog> m_pLog;
     RGY_CODEC          m_encCodec;
@@ -154,6 +177,7 @@ protected:
     shared_ptr<CPerfMonitor> m_pPerfMonitor;
 
     int                m_pipelineDepth;
+    bool               m_pipelineBenchmark;     //パイプラインのオーバーヘッドを計測する
     int                m_nProcSpeedLimit;       //処理速度制限 (0で制限なし)
     RGYAVSync          m_nAVSyncMode;           //映像音声同期設定
     bool               m_timestampPassThrough;  //timestampをそのまま転送する
@@ -167,6 +191,9 @@ protected:
     VideoVUIInfo       m_encVUI;
 
     std::shared_ptr<RGYOpenCLContext> m_cl;
+    std::shared_ptr<RGYOpenCLContext> m_clShared;
+    std::function<void()> m_drainCallback;
+    std::function<void()> m_deviceInitWait;
 
     MPPCfg             m_enccfg;
     std::unique_ptr<MPPContext> m_encoder;
@@ -174,7 +201,7 @@ protected:
 
     vector<VppVilterBlock>        m_vpFilters;
     shared_ptr<RGYFilterParam>    m_pLastFilterParam;
-    unique_ptr<RGYFilterSsim>     m_videoQualityMetric;
+    unique_ptr<RGYVideoMetricCPU> m_videoQualityMetric;
 
     RGYRunState m_state;
 
@@ -188,6 +215,10 @@ protected:
     std::future<RGY_ERR> m_thOutput;
 
     std::vector<std::unique_ptr<PipelineTask>> m_pipelineTasks;
+    std::unique_ptr<MPPAdaptiveQueue> m_adaptiveQueue; // --adaptive-queue
+    bool m_fastRemux;            // --fast-remux: デコード/エンコードせずに映像を出力する
+    int m_fastRemuxVideoDelay;   // 入力のBフレームによる遅延 (フレーム数)
+    bool m_smartTrim;            // --fast-remux smart-trim: trimの境界のGOPのみ再エンコードする
 
     bool *m_pAbortByUser;
 };
@@ -121,6 +121,255 @@ rga_buffer_handle_t RGAFilter::getRGABufferHandle(RGYFrameMpp *frame) {
     return importbuffer_fd(fd, mpp_buffer_get_size(buffer));
 }
 
+int rga_cvt_mode(const RGY_CSP cspIn, const RGY_CSP cspOut, const CspMatrix matrix) {
+    int cvt_mode = IM_COLOR_SPACE_DEFAULT;
+    if (rgy_chromafmt_is_rgb(RGY_CSP_CHROMA_FORMAT[cspIn]) != rgy_chromafmt_is_rgb(RGY_CSP_CHROMA_FORMAT[cspOut])) {
+        if (rgy_chromafmt_is_rgb(RGY_CSP_CHROMA_FORMAT[cspIn])) {
+            switch (matrix) {
+            case RGY_MATRIX_BT470_BG:
+            case RGY_MATRIX_ST170_M:
+                cvt_mode = IM_RGB_TO_YUV_BT601_LIMIT;
+                break;
+            default:
+                cvt_mode = IM_RGB_TO_YUV_BT709_LIMIT;
+                break;
+            }
+        } else {
+            switch (matrix) {
+            case RGY_MATRIX_BT470_BG:
+            case RGY_MATRIX_ST170_M:
+                cvt_mode = IM_YUV_TO_RGB_BT601_LIMIT;
+                break;
+            default:
+                cvt_mode = IM_YUV_TO_RGB_BT709_LIMIT;
+                break;
+            }
+        }
+    }
+    return cvt_mode;
+}
+
+// RGAの拡大縮小率の制限 (RGA3は1/8～8倍、RGA2は1/16～16倍なので、狭いほうに合わせる)
+static const int RGA_FUSED_SCALE_MAX = 8;
+
+RGY_ERR rga_fused_plan(RGAFusedJob& job, const std::vector<std::shared_ptr<RGYFilterParam>>& stages, tstring& reason) {
+    job = RGAFusedJob();
+    reason.clear();
+    if (stages.size() < 2) {
+        reason = _T("nothing to fuse");
+        return RGY_ERR_UNSUPPORTED;
+    }
+    job.frameIn = stages.front()->frameIn;
+    job.frameOut = stages.back()->frameOut;
+    int cropCount = 0, cspCount = 0;
+    for (const auto& stage : stages) {
+        if (stage->frameIn.mem_type != RGY_MEM_TYPE_MPP || stage->frameOut.mem_type != RGY_MEM_TYPE_MPP) {
+            reason = _T("not mpp frame");
+            return RGY_ERR_UNSUPPORTED;
+        }
+        if (auto prmResize = dynamic_cast<const RGYFilterParamResize *>(stage.get()); prmResize != nullptr) {
+            if (job.resize) {
+                reason = _T("multiple resize");
+                return RGY_ERR_UNSUPPORTED;
+            }
+            job.resize = true;
+            job.interp = (prmResize->interp == RGY_VPP_RESIZE_AUTO) ? RGY_VPP_RESIZE_RGA_BICUBIC : prmResize->interp;
+        } else if (auto prmCrop = dynamic_cast<const RGYFilterParamCrop *>(stage.get()); prmCrop != nullptr) {
+            if (prmCrop->frameIn.csp != prmCrop->frameOut.csp) { // cspconv
+                if (cspCount++ > 0) {
+                    reason = _T("multiple cspconv");
+                    return RGY_ERR_UNSUPPORTED;
+                }
+                job.cvtMode = rga_cvt_mode(prmCrop->frameIn.csp, prmCrop->frameOut.csp, prmCrop->matrix);
+            } else if (cropEnabled(prmCrop->crop)) { // crop
+                if (cropCount++ > 0) {
+                    reason = _T("multiple crop");
+                    return RGY_ERR_UNSUPPORTED;
+                }
+                if (job.resize) { // resize後のcropは入力側の座標に戻せないことがあるので、まとめない
+                    reason = _T("crop after resize");
+                    return RGY_ERR_UNSUPPORTED;
+                }
+                job.crop = prmCrop->crop;
+            }
+        } else {
+            reason = _T("unsupported filter");
+            return RGY_ERR_UNSUPPORTED;
+        }
+        job.stageCount++;
+    }
+    // YUV420/422の場合、cropの位置とサイズは偶数である必要がある
+    if (RGY_CSP_CHROMA_FORMAT[job.frameIn.csp] == RGY_CHROMAFMT_YUV420 || RGY_CSP_CHROMA_FORMAT[job.frameIn.csp] == RGY_CHROMAFMT_YUV422) {
+        if ((job.crop.e.left | job.crop.e.right) & 1) {
+            reason = _T("crop not aligned");
+            return RGY_ERR_UNSUPPORTED;
+        }
+        if (RGY_CSP_CHROMA_FORMAT[job.frameIn.csp] == RGY_CHROMAFMT_YUV420 && ((job.crop.e.up | job.crop.e.bottom) & 1)) {
+            reason = _T("crop not aligned");
+            return RGY_ERR_UNSUPPORTED;
+        }
+    }
+    const int srcWidth  = job.frameIn.width  - job.crop.e.left - job.crop.e.right;
+    const int srcHeight = job.frameIn.height - job.crop.e.up   - job.crop.e.bottom;
+    if (srcWidth <= 0 || srcHeight <= 0 || job.frameOut.width <= 0 || job.frameOut.height <= 0) {
+        reason = _T("invalid size");
+        return RGY_ERR_INVALID_PARAM;
+    }
+    if (job.frameOut.width  > srcWidth  * RGA_FUSED_SCALE_MAX || job.frameOut.width  * RGA_FUSED_SCALE_MAX < srcWidth
+     || job.frameOut.height > srcHeight * RGA_FUSED_SCALE_MAX || job.frameOut.height * RGA_FUSED_SCALE_MAX < srcHeight) {
+        reason = _T("scale ratio out of range");
+        return RGY_ERR_UNSUPPORTED;
+    }
+    if (!job.resize && (job.frameOut.width != srcWidth || job.frameOut.height != srcHeight)) {
+        reason = _T("size mismatch");
+        return RGY_ERR_INVALID_PARAM;
+    }
+    return RGY_ERR_NONE;
+}
+
+IM_STATUS RGABackendIm2d::check(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect) {
+    return imcheck(src, dst, srect, drect);
+}
+
+IM_STATUS RGABackendIm2d::process(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect,
+    int acquire_fence_fd, int *release_fence_fd, im_opt_t *opt, int usage) {
+    rga_buffer_t pat;
+    im_rect prect;
+    memset(&pat, 0, sizeof(pat));
+    memset(&prect, 0, sizeof(prect));
+    return improcess(src, dst, pat, srect, drect, prect, acquire_fence_fd, release_fence_fd, opt, usage);
+}
+
+RGY_ERR rga_fused_submit(RGABackend *backend, const RGAFusedJob& job, rga_buffer_t src, rga_buffer_t dst, int *sync) {
+    dst.color_space_mode = job.cvtMode;
+
+    im_rect srect;
+    srect.x = job.crop.e.left;
+    srect.y = job.crop.e.up;
+    srect.width = src.width - job.crop.e.left - job.crop.e.right;
+    srect.height = src.height - job.crop.e.up - job.crop.e.bottom;
+    im_rect drect;
+    drect.x = 0;
+    drect.y = 0;
+    drect.width = dst.width;
+    drect.height = dst.height;
+
+    auto sts = err_to_rgy(backend->check(src, dst, srect, drect));
+    if (sts != RGY_ERR_NONE) {
+        return sts;
+    }
+
+    im_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    if (job.resize) {
+        opt.interp = interp_rgy_to_rga(job.interp);
+    }
+    // crop + 色空間変換 + resize を1回の処理で行う
+    const int acquire_fence_fd = (*sync > 0) ? *sync : -1;
+    *sync = -1;
+    return err_to_rgy(backend->process(src, dst, srect, drect, acquire_fence_fd, sync, &opt, IM_ASYNC));
+}
+
+RGAFilterFused::RGAFilterFused(std::shared_ptr<RGABackend> backend) :
+    RGAFilter(),
+    m_job(),
+    m_backend(backend ? backend : std::make_shared<RGABackendIm2d>()) {
+    m_name = _T("rga(fused)");
+}
+
+RGAFilterFused::~RGAFilterFused() {
+    close();
+}
+
+void RGAFilterFused::close() {
+
+}
+
+RGY_ERR RGAFilterFused::init(shared_ptr<RGYFilterParam> param, shared_ptr<RGYLog> pPrintMes) {
+    m_pLog = pPrintMes;
+
+    auto prm = std::dynamic_pointer_cast<RGYFilterParamRGAFused>(param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    tstring reason;
+    auto err = rga_fused_plan(m_job, prm->stages, reason);
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_DEBUG, _T("Cannot fuse filters: %s.\n"), reason.c_str());
+        return err;
+    }
+    prm->frameIn = m_job.frameIn;
+    prm->frameOut = m_job.frameOut;
+
+    tstring str = strsprintf(_T("rga(fused %d filters):"), m_job.stageCount);
+    if (cropEnabled(m_job.crop)) {
+        str += strsprintf(_T(" crop %d,%d,%d,%d"), m_job.crop.e.left, m_job.crop.e.up, m_job.crop.e.right, m_job.crop.e.bottom);
+    }
+    if (m_job.frameIn.csp != m_job.frameOut.csp) {
+        str += strsprintf(_T(" %s -> %s"), RGY_CSP_NAMES[m_job.frameIn.csp], RGY_CSP_NAMES[m_job.frameOut.csp]);
+    }
+    if (m_job.resize) {
+        str += strsprintf(_T(" resize(%s) %dx%d -> %dx%d"), get_chr_from_value(list_vpp_resize, m_job.interp),
+            m_job.frameIn.width - m_job.crop.e.left - m_job.crop.e.right, m_job.frameIn.height - m_job.crop.e.up - m_job.crop.e.bottom,
+            m_job.frameOut.width, m_job.frameOut.height);
+    }
+    setFilterInfo(str);
+
+    //コピーを保存
+    m_param = param;
+    return err;
+}
+
+RGY_ERR RGAFilterFused::run_filter_rga(RGYFrameMpp *pInputFrame, RGYFrameMpp **ppOutputFrames, int *pOutputFrameNum, int *sync) {
+    RGY_ERR sts = RGY_ERR_NONE;
+    if (pInputFrame == nullptr) {
+        return sts;
+    }
+
+    *pOutputFrameNum = 1;
+    RGYFrameMpp *const pOutFrame = ppOutputFrames[0];
+
+    if (csp_rgy_to_rkrga(pInputFrame->csp()) == RK_FORMAT_UNKNOWN) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid input memory format: %s.\n"), RGY_CSP_NAMES[pInputFrame->csp()]);
+        return RGY_ERR_INVALID_FORMAT;
+    }
+
+    if (csp_rgy_to_rkrga(pOutFrame->csp()) == RK_FORMAT_UNKNOWN) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid output memory format: %s.\n"), RGY_CSP_NAMES[pOutFrame->csp()]);
+        return RGY_ERR_INVALID_FORMAT;
+    }
+
+    rga_buffer_handle_t src_handle = getRGABufferHandle(pInputFrame);
+    rga_buffer_handle_t dst_handle = getRGABufferHandle(pOutFrame);
+
+    rga_buffer_t src = RGY_CSP_CHROMA_FORMAT[pInputFrame->csp()] == RGY_CHROMAFMT_RGB_PACKED
+        ? wrapbuffer_handle(src_handle, pInputFrame->width(), pInputFrame->height(), csp_rgy_to_rkrga(pInputFrame->csp())) //rgb packedの場合はこちらを使用する必要がある
+        : wrapbuffer_handle_t(src_handle, pInputFrame->width(), pInputFrame->height(),
+            pInputFrame->pitch(RGY_PLANE_Y), mpp_frame_get_ver_stride(pInputFrame->mpp()), csp_rgy_to_rkrga(pInputFrame->csp()));
+    rga_buffer_t dst = RGY_CSP_CHROMA_FORMAT[pOutFrame->csp()] == RGY_CHROMAFMT_RGB_PACKED
+        ? wrapbuffer_handle(dst_handle, pOutFrame->width(), pOutFrame->height(), csp_rgy_to_rkrga(pOutFrame->csp())) //rgb packedの場合はこちらを使用する必要がある
+        : wrapbuffer_handle_t(dst_handle, pOutFrame->width(), pOutFrame->height(),
+            pOutFrame->pitch(RGY_PLANE_Y), mpp_frame_get_ver_stride(pOutFrame->mpp()), csp_rgy_to_rkrga(pOutFrame->csp()));
+    if (src.width == 0 || dst.width == 0) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid in/out memory.\n"));
+        return RGY_ERR_INVALID_FORMAT;
+    }
+
+    sts = rga_fused_submit(m_backend.get(), m_job, src, dst, sync);
+    if (sts != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to run rga: %s"), get_err_mes(sts));
+        return sts;
+    }
+    if (src_handle) {
+        releasebuffer_handle(src_handle);
+    }
+    if (dst_handle) {
+        releasebuffer_handle(dst_handle);
+    }
+    return sts;
+}
+
 RGAFilterCrop::RGAFilterCrop() :
     RGAFilter() {
     m_name = _T("Crop(rga)");
@@ -282,29 +531,7 @@ RGY_ERR RGAFilterCspConv::init(shared_ptr<RGYFilterParam> param, shared_ptr<RGYL
         AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
-    if (rgy_chromafmt_is_rgb(RGY_CSP_CHROMA_FORMAT[param->frameIn.csp]) != rgy_chromafmt_is_rgb(RGY_CSP_CHROMA_FORMAT[param->frameOut.csp])) {
-        if (rgy_chromafmt_is_rgb(RGY_CSP_CHROMA_FORMAT[param->frameIn.csp])) {
-            switch (prm->matrix) {
-            case RGY_MATRIX_BT470_BG:
-            case RGY_MATRIX_ST170_M:
-                m_cvt_mode = IM_RGB_TO_YUV_BT601_LIMIT;
-                break;
-            default:
-                m_cvt_mode = IM_RGB_TO_YUV_BT709_LIMIT;
-                break;
-            }
-        } else {
-            switch (prm->matrix) {
-            case RGY_MATRIX_BT470_BG:
-            case RGY_MATRIX_ST170_M:
-                m_cvt_mode = IM_YUV_TO_RGB_BT601_LIMIT;
-                break;
-            default:
-                m_cvt_mode = IM_YUV_TO_RGB_BT709_LIMIT;
-                break;
-            }
-        }
-    }
+    m_cvt_mode = rga_cvt_mode(param->frameIn.csp, param->frameOut.csp, prm->matrix);
 
     setFilterInfo(strsprintf(_T("cspconv(rga): %s -> %s"),
         RGY_CSP_NAMES[param->frameIn.csp], RGY_CSP_NAMES[param->frameOut.csp]));
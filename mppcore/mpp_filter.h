@@ -139,6 +139,66 @@ protected:
     virtual void close() override;
 };
 
+class RGYFilterParamRGAFused : public RGYFilterParam {
+public:
+    std::vector<std::shared_ptr<RGYFilterParam>> stages; // まとめる前の各フィルタ(crop/cspconv/resize)のパラメータ
+    RGYFilterParamRGAFused() : stages() {};
+    virtual ~RGYFilterParamRGAFused() {};
+};
+
+// 連続するcrop/cspconv/resizeを、1回のRGA処理にまとめた処理内容
+struct RGAFusedJob {
+    RGYFrameInfo frameIn;
+    RGYFrameInfo frameOut;
+    sInputCrop crop;            // 入力に対するcrop
+    int cvtMode;                // 色空間変換のモード (0 = IM_COLOR_SPACE_DEFAULT: 変換なし)
+    bool resize;
+    RGY_VPP_RESIZE_ALGO interp;
+    int stageCount;             // まとめたフィルタの数
+
+    RGAFusedJob() : frameIn(), frameOut(), crop(), cvtMode(0), resize(false), interp(RGY_VPP_RESIZE_AUTO), stageCount(0) {};
+};
+
+// RGAの色空間変換のモードを返す
+int rga_cvt_mode(const RGY_CSP cspIn, const RGY_CSP cspOut, const CspMatrix matrix);
+// 各フィルタのパラメータから、RGAの1回の処理でまとめて実行できるか判定し、処理内容を作成する
+// RGAは呼び出さないので、パラメータのみで判定結果を確認できる
+RGY_ERR rga_fused_plan(RGAFusedJob& job, const std::vector<std::shared_ptr<RGYFilterParam>>& stages, tstring& reason);
+
+// RGAの処理の投入先 (単体テストではハードウェアを使用しないモックに差し替える)
+class RGABackend {
+public:
+    virtual ~RGABackend() {};
+    virtual IM_STATUS check(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect) = 0;
+    virtual IM_STATUS process(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect,
+        int acquire_fence_fd, int *release_fence_fd, im_opt_t *opt, int usage) = 0;
+};
+
+// im2dを使用してRGAで処理する
+class RGABackendIm2d : public RGABackend {
+public:
+    virtual IM_STATUS check(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect) override;
+    virtual IM_STATUS process(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect,
+        int acquire_fence_fd, int *release_fence_fd, im_opt_t *opt, int usage) override;
+};
+
+// まとめた処理を1回の非同期処理として投入する
+// *syncで受け取ったfenceの完了後に処理を開始し、完了は*syncに返すrelease fenceで後段に通知する (ここでは待機しない)
+RGY_ERR rga_fused_submit(RGABackend *backend, const RGAFusedJob& job, rga_buffer_t src, rga_buffer_t dst, int *sync);
+
+class RGAFilterFused : public RGAFilter {
+public:
+    RGAFilterFused(std::shared_ptr<RGABackend> backend = nullptr);
+    virtual ~RGAFilterFused();
+    virtual RGY_ERR init(shared_ptr<RGYFilterParam> param, shared_ptr<RGYLog> pPrintMes) override;
+protected:
+    virtual RGY_ERR run_filter_rga(RGYFrameMpp *pInputFrame, RGYFrameMpp **ppOutputFrames, int *pOutputFrameNum, int *sync) override;
+    virtual void close() override;
+
+    RGAFusedJob m_job;
+    std::shared_ptr<RGABackend> m_backend;
+};
+
 class RGYFilterParamDeinterlaceIEP : public RGYFilterParam {
 public:
     RGY_PICSTRUCT picstruct;
@@ -40,6 +40,44 @@ MPPParamDec::MPPParamDec() :
 
 }
 
+MPPParamStub::MPPParamStub() :
+    enable(false),
+    latency(0),
+    fps(0.0),
+    size(16384) {
+
+}
+
+MPPParamAdaptiveQueue::MPPParamAdaptiveQueue() :
+    enable(false),
+    minDepth(1),
+    maxDepth(8),
+    poolMax(8),
+    interval(30) {
+
+}
+
+MPPParamFastRemux::MPPParamFastRemux() :
+    enable(false),
+    maxBitrate(0),
+    maxGop(0),
+    smartTrim(false) {
+
+}
+
+MPPParamQualityMetric::MPPParamQualityMetric() :
+    vif(false),
+    adm(false),
+    motion(false),
+    threads(0),
+    log() {
+
+}
+
+bool MPPParamQualityMetric::enabled() const {
+    return vif || adm || motion;
+}
+
 MPPParam::MPPParam() :
     input(),
     inprm(),
@@ -47,6 +85,11 @@ MPPParam::MPPParam() :
     ctrl(),
     vpp(),
     hwdec(),
+    stub(),
+    pipelineBenchmark(false),
+    adaptiveQueue(),
+    fastRemux(),
+    qualityMetric(),
     deint(IEPDeinterlaceMode::DISABLED),
     codec(RGY_CODEC_H264),
     codecParam(),
@@ -62,6 +105,7 @@ MPPParam::MPPParam() :
     gopLen(MPP_DEFAULT_GOP_LEN),
     chromaQPOffset(0),
     repeatHeaders(false),
+    lookahead(),
     par(),
     disableDeblock(false),
     deblockAlpha(0),
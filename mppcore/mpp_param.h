@@ -30,6 +30,7 @@
 #include "rgy_util.h"
 #include "rgy_caption.h"
 #include "rgy_prm.h"
+#include "rgy_lookahead.h"
 
 #include "mpp_rc_api.h"
 #include "rk_type.h"
@@ -255,6 +256,49 @@ struct MPPParamDec {
     MPPParamDec();
 };
 
+// --mpp-stub: ハードウェアの代わりにソフトウェアのスタブを使用する
+struct MPPParamStub {
+    bool enable;
+    int latency;  // 1フレームあたりの遅延 (ms)
+    double fps;   // 処理速度の上限 (0で無制限)
+    int size;     // エンコーダの出力パケットサイズ (byte)
+
+    MPPParamStub();
+};
+
+// --adaptive-queue: 各taskの待ち時間に応じて、キューの深さとフレームプールを増減する
+struct MPPParamAdaptiveQueue {
+    bool enable;
+    int minDepth;  // キューの深さの下限
+    int maxDepth;  // キューの深さの上限
+    int poolMax;   // フレームプールに追加するフレーム数の上限
+    int interval;  // 判定間隔 (フレーム数)
+
+    MPPParamAdaptiveQueue();
+};
+
+// --fast-remux: 入力が出力の条件を満たす場合、デコード/エンコードせずに映像をそのまま出力する
+struct MPPParamFastRemux {
+    bool enable;
+    int maxBitrate; // 入力の映像ビットレートの上限 (kbps, 0で判定しない)
+    int maxGop;     // 入力のキーフレーム間隔の上限 (フレーム数, 0で判定しない)
+    bool smartTrim; // trimの境界のGOPのみ再エンコードし、キーフレームに合わない位置でのtrimを可能にする
+
+    MPPParamFastRemux();
+};
+
+// --quality-metric: CPUで映像品質の指標(VMAFの特徴量)を計算する
+struct MPPParamQualityMetric {
+    bool vif;      // VIF (4 scale)
+    bool adm;      // ADM
+    bool motion;   // motion
+    int threads;   // 計算に使用するスレッド数 (0で自動)
+    tstring log;   // フレームごとの結果の出力先
+
+    MPPParamQualityMetric();
+    bool enabled() const;
+};
+
 struct MPPParam {
     VideoInfo input;              //入力する動画の情報
     RGYParamInput inprm;
@@ -263,6 +307,11 @@ struct MPPParam {
     RGYParamVpp vpp;
 
     MPPParamDec hwdec;
+    MPPParamStub stub;
+    bool pipelineBenchmark;
+    MPPParamAdaptiveQueue adaptiveQueue;
+    MPPParamFastRemux fastRemux;
+    MPPParamQualityMetric qualityMetric;
     IEPDeinterlaceMode deint;
 
     RGY_CODEC codec;
@@ -282,6 +331,8 @@ struct MPPParam {
     int     chromaQPOffset;
     bool    repeatHeaders;
 
+    RGYLookaheadParam lookahead;
+
     int     par[2];
 
     // H.264
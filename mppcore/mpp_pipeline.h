@@ -32,6 +32,7 @@
 #include <thread>
 #include <future>
 #include <atomic>
+#include <chrono>
 #include <deque>
 #include <set>
 #include <unordered_map>
@@ -47,24 +48,32 @@
 #include "rgy_output_avcodec.h"
 #include "rgy_opencl.h"
 #include "rgy_filter.h"
-#include "rgy_filter_ssim.h"
+#include "rgy_metric_cpu.h"
+#include "rgy_queue.h"
 #include "rgy_thread.h"
 #include "rgy_timecode.h"
+#include "rgy_lookahead.h"
 #include "rgy_device.h"
 #include "mpp_device.h"
 #include "mpp_param.h"
 #include "mpp_filter.h"
+#include "mpp_stub.h"
+#include "mpp_smart_trim.h"
 #include "rk_mpi.h"
 
 static const int RGY_WAIT_INTERVAL = 60000;
+static const int MPP_FRAME_GROUP_BUF_MAX = 32; // mppのフレーム用バッファグループに確保するバッファ数の上限
+static const int MPP_DEC_REF_FRAMES_MAX = 16;  // デコーダが参照用に保持するフレーム数の上限
 
 struct MPPContext {
     MppCtx ctx;
     MppApi *mpi;
+    std::unique_ptr<MPPStub> stub; // --mpp-stub時のみ
 
     MPPContext();
     ~MPPContext();
     RGY_ERR create();
+    RGY_ERR createStub(const MPPParamStub& prm, std::shared_ptr<RGYLog> log);
     RGY_ERR init(MppCtxType type, MppCodingType codectype);
 };
 
@@ -144,6 +153,7 @@ private:
         PipelineTaskSurface getRef() { return PipelineTaskSurface(surf_.get(), &ref); };
         const RGYFrame *surf() const { return surf_.get(); }
         RGYFrame *surf() { return surf_.get(); }
+        std::unique_ptr<RGYFrame> take() { return std::move(surf_); }
         PipelineTaskSurfaceType type() const {
             if (!surf_) return PipelineTaskSurfaceType::UNKNOWN;
             if (dynamic_cast<const RGYCLFrame*>(surf_.get())) return PipelineTaskSurfaceType::CL;
@@ -176,6 +186,38 @@ public:
         m_surfaces.push_back(std::move(std::unique_ptr<PipelineTaskSurfacesPair>(new PipelineTaskSurfacesPair(std::move(surf)))));
         return m_surfaces.back()->getRef();
     }
+    // 既存のフレームを残したまま追加する
+    void appendSurface(std::unique_ptr<RGYFrame> surf) {
+        m_surfaces.push_back(std::make_unique<PipelineTaskSurfacesPair>(std::move(surf)));
+    }
+    // 使用されていないフレームを後ろから最大n個解放し、解放した数を返す (minCountより少なくはしない)
+    // getFreeSurfと同じスレッドから呼ぶこと
+    int releaseFreeSurfaces(int n, size_t minCount) {
+        int released = 0;
+        for (size_t i = m_surfaces.size(); i > 0 && released < n && m_surfaces.size() > minCount; i--) {
+            if (m_surfaces[i - 1]->isFree()) {
+                m_surfaces.erase(m_surfaces.begin() + (i - 1));
+                released++;
+            }
+        }
+        return released;
+    }
+    size_t freeCount() const {
+        return std::count_if(m_surfaces.begin(), m_surfaces.end(), [](const auto& s) { return s->isFree(); });
+    }
+    // 使用されていないフレームを取り出す (使用中のフレームは残す)
+    std::vector<std::unique_ptr<RGYFrame>> takeFreeSurfaces() {
+        std::vector<std::unique_ptr<RGYFrame>> surfs;
+        for (auto it = m_surfaces.begin(); it != m_surfaces.end();) {
+            if ((*it)->isFree()) {
+                surfs.push_back((*it)->take());
+                it = m_surfaces.erase(it);
+            } else {
+                it++;
+            }
+        }
+        return surfs;
+    }
 
     PipelineTaskSurface getFreeSurf() {
         for (auto& s : m_surfaces) {
@@ -244,6 +286,34 @@ public:
     int64_t timestampOverride() const { return timestamp; }
 };
 
+class PipelineTaskOutputDataLookahead : public PipelineTaskOutputDataCustom {
+private:
+    bool idr;
+    int qp;
+    //lookaheadで保持している間に、同じsurfaceが別のtimestampで再度キューに入る場合があるので(checkptsによる水増し)、
+    //surfaceとは別にtimestamp等を保持し、エンコーダへの投入時に反映する
+    bool hasFrameProp;
+    int64_t timestamp;
+    int64_t duration;
+    int inputFrameId;
+public:
+    PipelineTaskOutputDataLookahead() : PipelineTaskOutputDataCustom(), idr(false), qp(0), hasFrameProp(false), timestamp(0), duration(0), inputFrameId(0) {};
+    PipelineTaskOutputDataLookahead(bool forceIDR_, int qpOffset_) : PipelineTaskOutputDataCustom(), idr(forceIDR_), qp(qpOffset_), hasFrameProp(false), timestamp(0), duration(0), inputFrameId(0) {};
+    PipelineTaskOutputDataLookahead(bool forceIDR_, int qpOffset_, int64_t timestamp_, int64_t duration_, int inputFrameId_) :
+        PipelineTaskOutputDataCustom(), idr(forceIDR_), qp(qpOffset_), hasFrameProp(true), timestamp(timestamp_), duration(duration_), inputFrameId(inputFrameId_) {};
+    virtual ~PipelineTaskOutputDataLookahead() {};
+    bool forceIDR() const { return idr; }
+    int qpOffset() const { return qp; }
+    // 保持していたtimestamp等をフレームに反映する
+    void applyFrameProp(RGYFrame *frame) const {
+        if (hasFrameProp && frame) {
+            frame->setTimestamp(timestamp);
+            frame->setDuration(duration);
+            frame->setInputFrameId(inputFrameId);
+        }
+    }
+};
+
 class PipelineTaskOutput {
 protected:
     PipelineTaskOutputType m_type;
@@ -258,7 +328,7 @@ public:
     virtual void depend_clear() {};
     PipelineTaskOutputType type() const { return m_type; }
     const PipelineTaskOutputDataCustom *customdata() const { return m_customData.get(); }
-    virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYFilterSsim *videoQualityMetric) {
+    virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYVideoMetricCPU *videoQualityMetric) {
         return RGY_ERR_UNSUPPORTED;
     }
     virtual ~PipelineTaskOutput() {};
@@ -340,7 +410,7 @@ public:
         return err;
     }
 
-    virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYFilterSsim *videoQualityMetric) override {
+    virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYVideoMetricCPU *videoQualityMetric) override {
         if (!writer || writer->getOutType() == OUT_TYPE_NONE) {
             return RGY_ERR_NOT_INITIALIZED;
         }
@@ -361,7 +431,7 @@ public:
 
     std::shared_ptr<RGYBitstream>& bitstream() { return m_bs; }
 
-    virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYFilterSsim *videoQualityMetric) override {
+    virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYVideoMetricCPU *videoQualityMetric) override {
         if (!writer || writer->getOutType() == OUT_TYPE_NONE) {
             return RGY_ERR_NOT_INITIALIZED;
         }
@@ -369,10 +439,10 @@ public:
             return RGY_ERR_INVALID_OPERATION;
         }
         if (videoQualityMetric) {
-            if (!videoQualityMetric->decodeStarted()) {
-                videoQualityMetric->initDecode(m_bs.get());
+            auto err = videoQualityMetric->addBitstream(m_bs.get());
+            if (err != RGY_ERR_NONE) {
+                return err;
             }
-            videoQualityMetric->addBitstream(m_bs.get());
         }
         return writer->WriteNextFrame(m_bs.get());
     }
@@ -392,6 +462,9 @@ enum class PipelineTaskType {
     OUTPUTRAW,
     OPENCL,
     VIDEOMETRIC,
+    LOOKAHEAD,
+    REMUX,
+    SMART_TRIM,
 };
 
 static const TCHAR *getPipelineTaskTypeName(PipelineTaskType type) {
@@ -407,7 +480,10 @@ static const TCHAR *getPipelineTaskTypeName(PipelineTaskType type) {
     case PipelineTaskType::OPENCL:      return _T("OPENCL");
     case PipelineTaskType::AUDIO:       return _T("AUDIO");
     case PipelineTaskType::VIDEOMETRIC: return _T("VIDEOMETRIC");
+    case PipelineTaskType::LOOKAHEAD:   return _T("LOOKAHEAD");
     case PipelineTaskType::OUTPUTRAW:   return _T("OUTRAW");
+    case PipelineTaskType::REMUX:       return _T("REMUX");
+    case PipelineTaskType::SMART_TRIM:  return _T("SMART_TRIM");
     default: return _T("UNKNOWN");
     }
 }
@@ -427,10 +503,22 @@ static const int getPipelineTaskAllocPriority(PipelineTaskType type) {
     case PipelineTaskType::AUDIO:
     case PipelineTaskType::OUTPUTRAW:
     case PipelineTaskType::VIDEOMETRIC:
+    case PipelineTaskType::LOOKAHEAD:
+    case PipelineTaskType::REMUX:
+    case PipelineTaskType::SMART_TRIM:
     default: return 0;
     }
 }
 
+// --adaptive-queue用の待ち時間の計測値
+struct PipelineTaskWaitStat {
+    int64_t frames;     // 出力したフレーム数
+    double syncWaitMs;  // 出力の完了待ちの時間 (キューが浅いと増える)
+    double surfWaitMs;  // 空きフレームの待ち時間 (プールが足りないと増える)
+
+    PipelineTaskWaitStat() : frames(0), syncWaitMs(0.0), surfWaitMs(0.0) {};
+};
+
 class PipelineTask {
 protected:
     PipelineTaskType m_type;
@@ -441,10 +529,17 @@ protected:
     int m_outMaxQueueSize;
     MppBufferGroup m_frameGrp;
     std::shared_ptr<RGYLog> m_log;
+    RGYOpenCLContext *m_workSurfsCL;   // workSurfacesAllocCLで確保した場合のみ、プールの増減が可能
+    RGYFrameInfo m_workSurfsCLInfo;
+    bool m_workSurfsExternal;          // workSurfacesSetで後段のtaskのバッファを使用している
+    bool m_measureWait;
+    PipelineTaskWaitStat m_waitStat;
 public:
-    PipelineTask() : m_type(PipelineTaskType::UNKNOWN), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(0), m_log() {};
+    PipelineTask() : m_type(PipelineTaskType::UNKNOWN), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(0), m_log(),
+        m_workSurfsCL(nullptr), m_workSurfsCLInfo(), m_workSurfsExternal(false), m_measureWait(false), m_waitStat() {};
     PipelineTask(PipelineTaskType type, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
-        m_type(type), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(outMaxQueueSize), m_frameGrp(nullptr), m_log(log) {
+        m_type(type), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(outMaxQueueSize), m_frameGrp(nullptr), m_log(log),
+        m_workSurfsCL(nullptr), m_workSurfsCLInfo(), m_workSurfsExternal(false), m_measureWait(false), m_waitStat() {
     };
     virtual ~PipelineTask() {
         m_outQeueue.clear();
@@ -456,6 +551,10 @@ public:
     }
     virtual bool isPassThrough() const { return false; }
     virtual tstring print() const { return getPipelineTaskTypeName(m_type); }
+    // 保持している他のtaskのフレームへの参照を破棄する (終了時にtaskを破棄する前に呼ぶ)
+    virtual void releaseFrameRefs() {
+        m_outQeueue.clear();
+    }
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() = 0;
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() = 0;
     virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) = 0;
@@ -466,10 +565,15 @@ public:
         while ((int)m_outQeueue.size() > m_outMaxQueueSize) {
             auto out = std::move(m_outQeueue.front());
             m_outQeueue.pop_front();
+            const auto timeStart = (m_measureWait) ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
             if (sync) {
                 out->waitsync();
             }
             out->depend_clear();
+            if (m_measureWait) {
+                m_waitStat.syncWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timeStart).count();
+                m_waitStat.frames++;
+            }
             m_outFrames++;
             output.push_back(std::move(out));
         }
@@ -488,7 +592,8 @@ public:
     int workSurfacesAllocPriority() const {
         return getPipelineTaskAllocPriority(m_type);
     }
-    size_t workSurfacesCount() const {
+    // プールの操作はMPPAdaptiveQueueのテストで差し替えられるようvirtualとする
+    virtual size_t workSurfacesCount() const {
         return m_workSurfs.bufCount();
     }
 
@@ -545,8 +650,77 @@ public:
         }
         PrintMes(RGY_LOG_DEBUG, _T("allocWorkSurfaces:   allocated %d frames.\n"), numFrames);
         m_workSurfs.setSurfaces(frames);
+        m_workSurfsCL = cl;
+        m_workSurfsCLInfo = frame;
+        m_workSurfsExternal = false;
+        return RGY_ERR_NONE;
+    }
+    virtual bool workSurfacesResizable() const { return m_workSurfsCL != nullptr; }
+    // 実行中にOpenCLフレームのプールを増やす
+    virtual RGY_ERR workSurfacesGrowCL(const int numFrames) {
+        if (!m_workSurfsCL) {
+            return RGY_ERR_UNSUPPORTED;
+        }
+        for (int i = 0; i < numFrames; i++) {
+            auto frame = m_workSurfsCL->createFrameBuffer(m_workSurfsCLInfo, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+            if (!frame) {
+                return RGY_ERR_MEMORY_ALLOC;
+            }
+            m_workSurfs.appendSurface(std::move(frame));
+        }
+        return RGY_ERR_NONE;
+    }
+    // 実行中にOpenCLフレームのプールを減らす (使用中のフレームは解放しない)
+    virtual int workSurfacesShrinkCL(const int numFrames, const size_t minCount) {
+        if (!m_workSurfsCL) {
+            return 0;
+        }
+        return m_workSurfs.releaseFreeSurfaces(numFrames, minCount);
+    }
+    virtual size_t workSurfacesFreeCount() const {
+        return m_workSurfs.freeCount();
+    }
+    // workSurfacesAllocCLで確保したフレームをcontextに返却し、後続のジョブで使いまわせるようにする
+    void workSurfacesReturnCL() {
+        if (!m_workSurfsCL) {
+            return;
+        }
+        m_outQeueue.clear();
+        for (auto& surf : m_workSurfs.takeFreeSurfaces()) {
+            if (dynamic_cast<RGYCLFrame *>(surf.get())) {
+                m_workSurfsCL->returnFrameBuffer(std::unique_ptr<RGYCLFrame>(dynamic_cast<RGYCLFrame *>(surf.release())));
+            }
+        }
+        m_workSurfsCL = nullptr;
+    }
+    void setMeasureWait(const bool measure) { m_measureWait = measure; }
+    // 前回の呼び出し以降の計測値を返す
+    PipelineTaskWaitStat popWaitStat() {
+        auto stat = m_waitStat;
+        m_waitStat = PipelineTaskWaitStat();
+        return stat;
+    }
+    // 後段のtaskで確保したフレームをそのまま出力先として使用する
+    RGY_ERR workSurfacesSet(std::vector<std::unique_ptr<RGYFrame>>& frames) {
+        auto sts = workSurfacesClear();
+        if (sts != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("allocWorkSurfaces:   Failed to clear old surfaces: %s.\n"), get_err_mes(sts));
+            return sts;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("allocWorkSurfaces:   set %d frames.\n"), (int)frames.size());
+        m_workSurfs.setSurfaces(frames);
+        m_workSurfsCL = nullptr; // 後段のtaskのフレームなので増減できない
+        m_workSurfsExternal = true;
         return RGY_ERR_NONE;
     }
+    // workSurfacesSetで設定したフレームは後段のtaskのバッファを参照しているので、後段のtaskより先に解放する
+    void workSurfacesReleaseExternal() {
+        if (m_workSurfsExternal) {
+            m_outQeueue.clear();
+            m_workSurfs.clear();
+            m_workSurfsExternal = false;
+        }
+    }
 #if 0
     RGY_ERR workSurfacesAllocMpp(const int numFrames, const RGYFrameInfo &frame) {
         auto sts = workSurfacesClear();
@@ -557,7 +731,7 @@ public:
         PrintMes(RGY_LOG_DEBUG, _T("allocWorkSurfaces:   cleared old surfaces: %s.\n"), get_err_mes(sts));
 
         if (!m_frameGrp) {
-            sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_DRM));
+            sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM)));
             if (sts != RGY_ERR_NONE) {
                 PrintMes(RGY_LOG_ERROR, _T("failed to get mpp buffer group : %s\n"), get_err_mes(sts));
                 return sts;
@@ -588,9 +762,13 @@ public:
             PrintMes(RGY_LOG_ERROR, _T("getWorkSurf:   No buffer allocated!\n"));
             return PipelineTaskSurface();
         }
+        const auto timeStart = (m_measureWait) ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
         for (int i = 0; i < RGY_WAIT_INTERVAL; i++) {
             PipelineTaskSurface s = m_workSurfs.getFreeSurf();
             if (s != nullptr) {
+                if (m_measureWait && i > 0) {
+                    m_waitStat.surfWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timeStart).count();
+                }
                 return s;
             }
             sleep_hybrid(i);
@@ -601,12 +779,12 @@ public:
 
     std::unique_ptr<RGYFrameMpp> getNewWorkSurfMpp(const RGYFrameInfo &frame, const int x_stride = 0, const int y_stride = 0) {
         if (!m_frameGrp) {
-            auto sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_DRM));
+            auto sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM)));
             if (sts != RGY_ERR_NONE) {
                 PrintMes(RGY_LOG_ERROR, _T("failed to get mpp buffer group : %s\n"), get_err_mes(sts));
                 return std::make_unique<RGYFrameMpp>();
             }
-            mpp_buffer_group_limit_config(m_frameGrp, mpp_frame_size(frame, x_stride, y_stride), 32);
+            mpp_buffer_group_limit_config(m_frameGrp, mpp_frame_size(frame, x_stride, y_stride), MPP_FRAME_GROUP_BUF_MAX);
         }
         return std::make_unique<RGYFrameMpp>(frame, m_frameGrp, x_stride, y_stride);
     }
@@ -709,6 +887,123 @@ public:
     }
 };
 
+// --fast-remux: 入力のパケットをデコード/エンコードせずにそのまま出力する
+// trimはGOP単位で適用し、timestampは最初のptsとtrimで削除した区間を詰める
+class PipelineTaskRemux : public PipelineTask {
+protected:
+    RGYInputAvcodec *m_input;
+    RGYTimestamp *m_encTimestamp;
+    RGYHDR10Plus *m_hdr10plus;
+    const sTrimParam &m_trimParam;
+    RGYListRef<RGYBitstream> m_bitStreamOut;
+    int64_t m_frameDuration; // 固定fpsを仮定した時の1フレームのduration (streamのtimebase)
+    bool m_timestampPassThrough;
+    int m_maxGop;
+    uint32_t m_framePosIdx;
+    bool m_gopKeep;      // 現在のGOPを出力するか
+    int m_gopFrames;     // 現在のGOPのフレーム数
+    bool m_gopWarned;
+    int64_t m_tsOffset;  // ptsから差し引く値
+    int64_t m_tsOutEnd;  // 出力済みのフレームの終了時刻
+    int m_pocOffset;     // 入力のフレーム番号から出力のフレーム番号への補正
+    int m_remuxFrames;   // 出力したフレーム数
+    bool m_abort;
+public:
+    PipelineTaskRemux(RGYInputAvcodec *input, RGYTimestamp *encTimestamp, RGYHDR10Plus *hdr10plus, const sTrimParam &trimParam,
+        int64_t frameDuration, bool timestampPassThrough, int maxGop, int outMaxQueueSize, std::shared_ptr<RGYLog> log)
+        : PipelineTask(PipelineTaskType::REMUX, outMaxQueueSize, log), m_input(input), m_encTimestamp(encTimestamp), m_hdr10plus(hdr10plus),
+        m_trimParam(trimParam), m_bitStreamOut(), m_frameDuration(frameDuration), m_timestampPassThrough(timestampPassThrough), m_maxGop(maxGop),
+        m_framePosIdx(std::numeric_limits<decltype(m_framePosIdx)>::max()), m_gopKeep(false), m_gopFrames(0), m_gopWarned(false),
+        m_tsOffset(0), m_tsOutEnd(0), m_pocOffset(0), m_remuxFrames(0), m_abort(false) {
+    };
+    virtual ~PipelineTaskRemux() {
+        m_outQeueue.clear();
+        m_bitStreamOut.clear();
+    };
+    virtual bool abort() { m_abort = true; return true; }; // 中断指示を受け取ったらtrueを返す
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
+
+    virtual RGY_ERR sendFrame([[maybe_unused]] std::unique_ptr<PipelineTaskOutput>& frame) override {
+        if (m_abort) {
+            return RGY_ERR_MORE_BITSTREAM; // EOF を PipelineTaskMPPDecode のreturnコードに合わせる
+        }
+        auto ret = m_input->LoadNextFrame(nullptr);
+        if (ret != RGY_ERR_NONE && ret != RGY_ERR_MORE_DATA && ret != RGY_ERR_MORE_BITSTREAM) {
+            PrintMes(RGY_LOG_ERROR, _T("Error in reader: %s.\n"), get_err_mes(ret));
+            return ret;
+        }
+        auto bs = m_bitStreamOut.get([](RGYBitstream *bs) {
+            *bs = RGYBitstreamInit();
+            return 0;
+        });
+        if (!bs) {
+            return RGY_ERR_NULL_PTR;
+        }
+        ret = m_input->GetNextBitstream(bs.get());
+        if (ret == RGY_ERR_MORE_BITSTREAM) { //入力ビットストリームは終了
+            return ret;
+        } else if (ret != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Error on getting video bitstream: %s.\n"), get_err_mes(ret));
+            return ret;
+        }
+        // 入力のHDR10+/DoVi RPUはbitstreamに含まれたまま出力されるので、ここでは不要
+        bs->clearFrameDataList();
+
+        const auto framePos = m_input->GetFramePosList()->findpts(bs->pts(), &m_framePosIdx);
+        const bool posFound = framePos.poc != FRAMEPOS_POC_INVALID && framePos.pts == bs->pts();
+        const int poc = (posFound) ? framePos.poc : m_inFrames;
+        const bool isKey = (posFound) ? (framePos.flags & AV_PKT_FLAG_KEY) != 0 : m_inFrames == 0;
+        m_inFrames++;
+
+        // trimはGOP単位で判定する (キーフレームの位置が範囲内ならGOP全体を出力)
+        if (isKey) {
+            if (m_maxGop > 0 && m_gopFrames > m_maxGop && !m_gopWarned) {
+                PrintMes(RGY_LOG_WARN, _T("keyframe interval %d exceeds max-gop %d at frame %d.\n"), m_gopFrames, m_maxGop, poc);
+                m_gopWarned = true;
+            }
+            m_gopFrames = 0;
+            const bool keep = frame_inside_range(poc, m_trimParam.list).first;
+            if (keep && !m_gopKeep) {
+                // 出力する区間の開始、削除した区間を詰める
+                if (!m_timestampPassThrough) {
+                    m_tsOffset = bs->pts() - m_tsOutEnd;
+                }
+                m_pocOffset = poc - m_remuxFrames;
+                PrintMes(RGY_LOG_DEBUG, _T("remux: start of range at frame %d, pts %lld, offset %lld.\n"), poc, (lls)bs->pts(), (lls)m_tsOffset);
+            }
+            m_gopKeep = keep;
+        }
+        m_gopFrames++;
+        if (!m_gopKeep) {
+            return RGY_ERR_NONE;
+        }
+
+        const int64_t duration = (posFound && framePos.duration > 0) ? framePos.duration : m_frameDuration;
+        const int64_t pts = bs->pts() - m_tsOffset;
+        bs->setPts(pts);
+        bs->setDts(bs->dts() - m_tsOffset);
+        bs->setDuration(duration);
+        m_tsOutEnd = std::max(m_tsOutEnd, pts + duration);
+
+        const int outFrameId = poc - m_pocOffset;
+        std::vector<std::shared_ptr<RGYFrameData>> metadatalist;
+        if (m_hdr10plus) {
+            if (const auto data = m_hdr10plus->getData(outFrameId); data.size() > 0) {
+                metadatalist.push_back(std::make_shared<RGYFrameDataHDR10plus>(data.data(), data.size(), pts));
+            }
+        }
+        // writerはptsからフレーム番号とmetadataを取得する (dovi rpuの挿入はinputFrameIdを参照)
+        if (auto err = m_encTimestamp->add(pts, poc, outFrameId, duration, metadatalist); err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Timestamp buffer overflow: %d frames pending output.\n"), (int)m_encTimestamp->size());
+            return err;
+        }
+        m_remuxFrames++;
+        m_outQeueue.push_back(std::make_unique<PipelineTaskOutputBitstream>(bs));
+        return RGY_ERR_NONE;
+    }
+};
+
 class PipelineTaskMPPDecode : public PipelineTask {
 protected:
     struct FrameData {
@@ -845,7 +1140,7 @@ public:
         const int buf_size = mpp_frame_get_buf_size(mppframe);
         if (mpp_frame_get_info_change(mppframe)) {
             if (m_frameGrp == nullptr) {
-                ret = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_ION));
+                ret = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, mppBufferType(MPP_BUFFER_TYPE_ION)));
                 if (ret != RGY_ERR_NONE) {
                     PrintMes(RGY_LOG_ERROR, _T("Get mpp buffer group failed : %s\n"), get_err_mes(ret));
                     return ret;
@@ -867,7 +1162,7 @@ public:
             }
 
             // Use limit config to limit buffer count to 32 with buf_size
-            ret = err_to_rgy(mpp_buffer_group_limit_config(m_frameGrp, buf_size, 32));
+            ret = err_to_rgy(mpp_buffer_group_limit_config(m_frameGrp, buf_size, MPP_FRAME_GROUP_BUF_MAX));
             if (ret != RGY_ERR_NONE) {
                 PrintMes(RGY_LOG_ERROR, _T("Limit buffer group failed : %s\n"), get_err_mes(ret));
                 return ret;
@@ -902,19 +1197,44 @@ public:
         return ret;
     }
 
-    virtual RGY_ERR sendFrame([[maybe_unused]] std::unique_ptr<PipelineTaskOutput>& frame) override {
+    // デコーダに入力するbitstreamを取得する
+    virtual RGY_ERR getNextBitstream(RGYBitstream *bitstream) {
         auto ret = m_input->LoadNextFrame(nullptr);
         if (ret != RGY_ERR_NONE && ret != RGY_ERR_MORE_DATA && ret != RGY_ERR_MORE_BITSTREAM) {
             PrintMes(RGY_LOG_ERROR, _T("Error in reader: %s.\n"), get_err_mes(ret));
             return ret;
         }
+        //この関数がMFX_ERR_NONE以外を返せば、入力ビットストリームは終了
+        return m_input->GetNextBitstream(bitstream);
+    }
+
+    // EOSまで処理したデコーダを、新たなbitstreamを受け付けられる状態に戻す
+    RGY_ERR reset() {
+        auto ret = err_to_rgy(m_dec->mpi->reset(m_dec->ctx));
+        if (ret != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to reset decoder: %s.\n"), get_err_mes(ret));
+            return ret;
+        }
+        m_decInputBitstream.setSize(0);
+        m_decInputBitstream.setOffset(0);
+        m_firstBitstreamTimestamp = -1;
+        m_firstFrameTimestamp = -1;
+        m_queueTimestamp.clear();
+        m_queueTimestampWrap.clear();
+        m_dataFlag.clear();
+        m_decInBitStreamEOS = false;
+        m_decOutFrameEOS = false;
+        return RGY_ERR_NONE;
+    }
+
+    virtual RGY_ERR sendFrame([[maybe_unused]] std::unique_ptr<PipelineTaskOutput>& frame) override {
+        auto ret = RGY_ERR_NONE;
         if (m_abort) {
             ret = RGY_ERR_MORE_BITSTREAM;
             m_decInputBitstream.setSize(0);
             m_decInputBitstream.setOffset(0);
         } else {
-            //この関数がMFX_ERR_NONE以外を返せば、入力ビットストリームは終了
-            ret = m_input->GetNextBitstream(&m_decInputBitstream);
+            ret = getNextBitstream(&m_decInputBitstream);
         }
         if (ret == RGY_ERR_MORE_BITSTREAM) { //入力ビットストリームは終了
             if (m_decInBitStreamEOS) { // すでにeosを送信していた場合
@@ -1112,6 +1432,32 @@ protected:
     };
 };
 
+// --fast-remux smart-trim: readerからではなく、addPacketで渡されたパケットをデコードする
+// 渡されたパケットがなくなるとEOSを送り、すべてのフレームを出力する (再度使用する場合はreset()すること)
+class PipelineTaskMPPDecodePacket : public PipelineTaskMPPDecode {
+protected:
+    std::deque<std::shared_ptr<RGYBitstream>> m_packets;
+public:
+    PipelineTaskMPPDecodePacket(MPPContext *dec, RGYInput *input, std::shared_ptr<RGYLog> log)
+        : PipelineTaskMPPDecode(dec, 0, input, false, log), m_packets() {
+    };
+    virtual ~PipelineTaskMPPDecodePacket() {
+        m_packets.clear();
+    };
+    void addPacket(std::shared_ptr<RGYBitstream> bs) { m_packets.push_back(bs); }
+
+    virtual RGY_ERR getNextBitstream(RGYBitstream *bitstream) override {
+        if (m_packets.empty()) {
+            return RGY_ERR_MORE_BITSTREAM;
+        }
+        auto bs = std::move(m_packets.front());
+        m_packets.pop_front();
+        auto ret = bitstream->copy(bs->data(), bs->size(), bs->pts(), bs->dts(), bs->duration());
+        bitstream->setDataflag(bs->dataflag());
+        return ret;
+    }
+};
+
 class PipelineTaskCheckPTS : public PipelineTask {
 protected:
     rgy_rational<int> m_srcTimebase;
@@ -1362,10 +1708,11 @@ protected:
     std::map<int, std::shared_ptr<RGYOutputAvcodec>> m_pWriterForAudioStreams;
     std::map<int, RGYFilter *> m_filterForStreams;
     std::vector<std::shared_ptr<RGYInput>> m_audioReaders;
+    RGYPoolAVPacket *m_poolPkt;
 public:
-    PipelineTaskAudio(RGYInput *input, std::vector<std::shared_ptr<RGYInput>>& audioReaders, std::vector<std::shared_ptr<RGYOutput>>& fileWriterListAudio, std::vector<VppVilterBlock>& vpFilters, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
+    PipelineTaskAudio(RGYInput *input, std::vector<std::shared_ptr<RGYInput>>& audioReaders, std::vector<std::shared_ptr<RGYOutput>>& fileWriterListAudio, std::vector<VppVilterBlock>& vpFilters, RGYPoolAVPacket *poolPkt, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
         PipelineTask(PipelineTaskType::AUDIO, outMaxQueueSize, log),
-        m_input(input), m_audioReaders(audioReaders) {
+        m_input(input), m_audioReaders(audioReaders), m_poolPkt(poolPkt) {
         //streamのindexから必要なwriteへのポインタを返すテーブルを作成
         for (auto writer : fileWriterListAudio) {
             auto pAVCodecWriter = std::dynamic_pointer_cast<RGYOutputAvcodec>(writer);
@@ -1436,7 +1783,10 @@ public:
                 if (sendToFilter) {
                     AVPacket *pktToFilter = nullptr;
                     if (sendToWriter) {
-                        pktToFilter = av_packet_clone(pkt);
+                        // payloadは参照のみ、AVPacket自体もpoolから取得する
+                        auto pktRef = m_poolPkt->getFree();
+                        av_packet_ref(pktRef.get(), pkt);
+                        pktToFilter = pktRef.release();
                     } else {
                         std::swap(pktToFilter, pkt);
                     }
@@ -1478,6 +1828,10 @@ public:
             return RGY_ERR_MORE_DATA;
         }
         PipelineTaskOutputSurf *taskSurf = dynamic_cast<PipelineTaskOutputSurf *>(frame.get());
+        if (taskSurf == nullptr) { // --fast-remux ではbitstreamが流れてくるので、そのまま渡す
+            m_outQeueue.push_back(std::move(frame));
+            return RGY_ERR_NONE;
+        }
         m_outQeueue.push_back(std::make_unique<PipelineTaskOutputSurf>(taskSurf->surf()));
         return RGY_ERR_NONE;
     }
@@ -1486,9 +1840,9 @@ public:
 class PipelineTaskVideoQualityMetric : public PipelineTask {
 private:
     std::shared_ptr<RGYOpenCLContext> m_cl;
-    RGYFilterSsim *m_videoMetric;
+    RGYVideoMetricCPU *m_videoMetric;
 public:
-    PipelineTaskVideoQualityMetric(RGYFilterSsim *videoMetric, std::shared_ptr<RGYOpenCLContext> cl, int outMaxQueueSize, std::shared_ptr<RGYLog> log)
+    PipelineTaskVideoQualityMetric(RGYVideoMetricCPU *videoMetric, std::shared_ptr<RGYOpenCLContext> cl, int outMaxQueueSize, std::shared_ptr<RGYLog> log)
         : PipelineTask(PipelineTaskType::VIDEOMETRIC, outMaxQueueSize, log), m_cl(cl), m_videoMetric(videoMetric) {
     };
 
@@ -1496,69 +1850,148 @@ public:
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
     virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override {
-#if 0
         if (!frame) {
             return RGY_ERR_MORE_DATA;
         }
+        PipelineTaskOutputSurf *taskSurf = dynamic_cast<PipelineTaskOutputSurf *>(frame.get());
+        if (taskSurf == nullptr) {
+            PrintMes(RGY_LOG_ERROR, _T("Invalid frame type: failed to cast to PipelineTaskOutputSurf.\n"));
+            return RGY_ERR_UNSUPPORTED;
+        }
         //明示的に待機が必要
         frame->depend_clear();
 
+        RGYFrameInfo frameInfo;
+        if (auto mppframe = taskSurf->surf().mpp(); mppframe != nullptr) {
+            frameInfo = mppframe->getInfoCopy();
+        } else if (auto clframe = taskSurf->surf().cl(); clframe != nullptr) {
+            // OpenCLのフレームはエンコーダに渡すためにmapされているはず
+            if (!clframe->isMapped()) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to get mapped buffer.\n"));
+                return RGY_ERR_UNKNOWN;
+            }
+            frameInfo = clframe->mappedHost()->frameInfo();
+        } else if (auto sysframe = taskSurf->surf().frame(); sysframe != nullptr) {
+            frameInfo = sysframe->getInfo();
+        } else {
+            PrintMes(RGY_LOG_ERROR, _T("Unknown frame type!\n"));
+            return RGY_ERR_UNSUPPORTED;
+        }
+        //CPU側のバッファにコピーし、比較用に保持する
+        auto err = m_videoMetric->addFrame(&frameInfo);
+        if (err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to send frame for video metric calcualtion: %s.\n"), get_err_mes(err));
+            return err;
+        }
+        m_outQeueue.push_back(std::move(frame));
+        return RGY_ERR_NONE;
+    }
+};
+
+class PipelineTaskLookahead : public PipelineTask {
+protected:
+    struct LookaheadFrame {
+        PipelineTaskSurface surf;
+        int64_t timestamp;
+        int64_t duration;
+        int inputFrameId;
+    };
+    RGYLookaheadParam m_prm;
+    RGYFrameInfo m_frameInfo;
+    RGYLookahead m_analyzer;
+    std::deque<LookaheadFrame> m_frames;
+public:
+    PipelineTaskLookahead(const RGYLookaheadParam& prm, const RGYFrameInfo& frameInfo, std::shared_ptr<RGYLog> log)
+        : PipelineTask(PipelineTaskType::LOOKAHEAD, /*outMaxQueueSize = */ 0, log), m_prm(prm), m_frameInfo(frameInfo), m_analyzer(), m_frames() {
+    };
+    virtual ~PipelineTaskLookahead() {
+        m_frames.clear();
+    };
+    virtual void releaseFrameRefs() override {
+        m_frames.clear();
+        PipelineTask::releaseFrameRefs();
+    }
+    RGY_ERR init() {
+        auto err = m_analyzer.init(m_prm);
+        if (err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Invalid lookahead param: %s.\n"), m_prm.print().c_str());
+            return err;
+        }
+        return RGY_ERR_NONE;
+    }
+    const RGYLookaheadParam& param() const { return m_prm; }
+    int64_t sceneChangeCount() const { return m_analyzer.sceneChangeCount(); }
+
+    // フレームはそのまま後段に渡すのでpassthroughだが、先読み分のフレームを保持するので、
+    // 前段で確保するフレーム数に加算してもらう
+    virtual bool isPassThrough() const override { return true; }
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::make_pair(m_frameInfo, m_prm.depth + 1); };
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
+
+    virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override {
+        if (!frame) {
+            //残りのフレームをすべて出力する
+            outputFrames(true);
+            return (m_outQeueue.size() > 0) ? RGY_ERR_MORE_SURFACE : RGY_ERR_MORE_DATA;
+        }
         PipelineTaskOutputSurf *taskSurf = dynamic_cast<PipelineTaskOutputSurf *>(frame.get());
         if (taskSurf == nullptr) {
-            PrintMes(RGY_LOG_ERROR, _T("Invalid task surface.\n"));
-            return RGY_ERR_NULL_PTR;
+            PrintMes(RGY_LOG_ERROR, _T("Invalid frame type: failed to cast to PipelineTaskOutputSurf.\n"));
+            return RGY_ERR_UNSUPPORTED;
         }
-        RGYFrameInfo inputFrame;
-        if (auto surfVppIn = taskSurf->surf().mppsurf(); surfVppIn != nullptr) {
-            if (taskSurf->surf().frame()->getInfo().mem_type != RGY_MEM_TYPE_CPU
-                && surfVppIn->GetMemoryType() != mpp::AMF_MEMORY_OPENCL) {
-                mpp::AMFContext::AMFOpenCLLocker locker(m_context);
-#if 0
-                auto ar = inAmf->Interop(mpp::AMF_MEMORY_OPENCL);
-#else
-#if 0
-                //dummyのCPUへのメモリコピーを行う
-                //こうしないとデコーダからの出力をOpenCLに渡したときに、フレームが壊れる(フレーム順序が入れ替わってガクガクする)
-                mpp::AMFDataPtr data;
-                surfVppIn->Duplicate(mpp::AMF_MEMORY_HOST, &data);
-#endif
-                auto ar = surfVppIn->Convert(mpp::AMF_MEMORY_OPENCL);
-#endif
-                if (ar != AMF_OK) {
-                    PrintMes(RGY_LOG_ERROR, _T("Failed to convert plane: %s.\n"), get_err_mes(err_to_rgy(ar)));
-                    return err_to_rgy(ar);
-                }
-            }
-            inputFrame = taskSurf->surf().frame()->getInfo();
-        } else if (taskSurf->surf().clframe() != nullptr) {
-            //OpenCLフレームが出てきた時の場合
-            auto clframe = taskSurf->surf().clframe();
-            if (clframe == nullptr) {
-                PrintMes(RGY_LOG_ERROR, _T("Invalid cl frame.\n"));
-                return RGY_ERR_NULL_PTR;
+        //明示的に待機が必要
+        frame->depend_clear();
+
+        RGYFrameInfo frameInfo;
+        if (auto mppframe = taskSurf->surf().mpp(); mppframe != nullptr) {
+            frameInfo = mppframe->getInfoCopy();
+        } else if (auto clframe = taskSurf->surf().cl(); clframe != nullptr) {
+            // OpenCLのフレームはエンコーダに渡すためにmapされているはず
+            if (!clframe->isMapped()) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to get mapped buffer.\n"));
+                return RGY_ERR_UNKNOWN;
             }
-            inputFrame = clframe->frameInfo();
+            frameInfo = clframe->mappedHost()->frameInfo();
         } else {
-            PrintMes(RGY_LOG_ERROR, _T("Invalid input frame.\n"));
-            return RGY_ERR_NULL_PTR;
+            PrintMes(RGY_LOG_ERROR, _T("Unknown frame type!\n"));
+            return RGY_ERR_UNSUPPORTED;
         }
-        //フレームを転送
-        RGYOpenCLEvent inputReleaseEvent;
-        int dummy = 0;
-        auto err = m_videoMetric->filter(&inputFrame, nullptr, &dummy, m_cl->queue(), &inputReleaseEvent);
+        auto err = m_analyzer.add(&frameInfo);
         if (err != RGY_ERR_NONE) {
-            PrintMes(RGY_LOG_ERROR, _T("Failed to send frame for video metric calcualtion: %s.\n"), get_err_mes(err));
+            PrintMes(RGY_LOG_ERROR, _T("Failed to analyze frame %s: %s.\n"), RGY_CSP_NAMES[frameInfo.csp], get_err_mes(err));
             return err;
         }
-        //eventを入力フレームを使用し終わったことの合図として登録する
-        taskSurf->addClEvent(inputReleaseEvent);
-        m_outQeueue.push_back(std::move(frame));
-#endif
+        // 同じsurfaceが別のtimestampで複数回渡される場合があるので(checkptsによる水増し)、ここで値を保存しておく
+        LookaheadFrame lookaheadFrame;
+        lookaheadFrame.surf = taskSurf->surf();
+        lookaheadFrame.timestamp = taskSurf->surf().frame()->timestamp();
+        lookaheadFrame.duration = taskSurf->surf().frame()->duration();
+        lookaheadFrame.inputFrameId = taskSurf->surf().frame()->inputFrameId();
+        m_frames.push_back(lookaheadFrame);
+        m_inFrames++;
+        outputFrames(false);
         return RGY_ERR_NONE;
     }
+protected:
+    void outputFrames(const bool flush) {
+        while (m_analyzer.ready(flush) && m_frames.size() > 0) {
+            const auto result = m_analyzer.pop();
+            auto lookaheadFrame = std::move(m_frames.front());
+            m_frames.pop_front();
+            PrintMes((result.forceIDR) ? RGY_LOG_DEBUG : RGY_LOG_TRACE, _T("frame %lld: intra %.2f, inter %.2f, score %.2f%s, qp offset %d.\n"),
+                result.frameIdx, result.intraCost, result.interCost, result.sceneScore, (result.forceIDR) ? _T(" (scene change)") : _T(""), result.qpOffset);
+            //同じsurfaceが続けてキューに入る場合があるので、ここではsurfaceのtimestampを書き換えず、
+            //出力ごとに値を持たせてエンコーダへの投入時に反映する
+            std::unique_ptr<PipelineTaskOutputDataCustom> lookaheadData(new PipelineTaskOutputDataLookahead(result.forceIDR, result.qpOffset,
+                lookaheadFrame.timestamp, lookaheadFrame.duration, lookaheadFrame.inputFrameId));
+            m_outQeueue.push_back(std::make_unique<PipelineTaskOutputSurf>(lookaheadFrame.surf, lookaheadData));
+        }
+    }
 };
 
 class PipelineTaskMPPEncode : public PipelineTask {
+public:
+    static const int ENC_IN_FRAMES = 8; // エンコーダの入力として前段に要求するフレーム数
 protected:
     static const int BUF_COUNT = 16;
     MPPContext *m_encoder;
@@ -1579,6 +2012,18 @@ protected:
     RGYHDR10Plus *m_hdr10plus;
     bool m_hdr10plusMetadataCopy;
     std::unique_ptr<RGYConvertCSP> m_convert;
+    struct MPPROIData {
+        MppEncROIRegion region;
+        MppEncROICfg cfg;
+    };
+    // エンコーダが非同期に参照するので、投入中のフレームより多めに確保して使いまわす
+    std::array<MPPROIData, BUF_COUNT * 4> m_roi;
+    size_t m_roiIdx;
+    // OpenCLの出力を直接書き込むための、エンコーダ入力用バッファ
+    MppBufferGroup m_clFrameGrp;
+    std::vector<MppBuffer> m_clFrameBuffers;
+    std::unordered_map<const RGYFrame *, MppBuffer> m_clFrameMap; // OpenCLフレーム -> 対応するエンコーダ入力用バッファ
+    std::deque<std::pair<MppBuffer, PipelineTaskSurface>> m_clFrameEncoding; // エンコーダが参照中のフレーム (KEY_INPUT_FRAMEで返却されるまで保持する)
 public:
     PipelineTaskMPPEncode(
         MPPContext *enc, RGY_CODEC encCodec, MPPCfg& encParams, int outMaxQueueSize,
@@ -1587,7 +2032,8 @@ public:
         : PipelineTask(PipelineTaskType::MPPENC, outMaxQueueSize, log),
         m_encoder(enc), m_encCodec(encCodec), m_encParams(encParams), m_timecode(timecode), m_encTimestamp(encTimestamp), m_outputTimebase(outputTimebase),
         m_sentEOSFrame(false), m_frameGrp(nullptr), m_buffer(), m_queueFrameList(),
-        m_bitStreamOut(), m_hdr10plus(hdr10plus), m_hdr10plusMetadataCopy(hdr10plusMetadataCopy), m_convert(std::make_unique<RGYConvertCSP>(threadCsp, threadParamCsp)) {
+        m_bitStreamOut(), m_hdr10plus(hdr10plus), m_hdr10plusMetadataCopy(hdr10plusMetadataCopy), m_convert(std::make_unique<RGYConvertCSP>(threadCsp, threadParamCsp)),
+        m_roi(), m_roiIdx(0), m_clFrameGrp(nullptr), m_clFrameBuffers(), m_clFrameMap(), m_clFrameEncoding() {
         for (auto& buf : m_buffer) {
             buf.frame = nullptr;
             buf.pkt = nullptr;
@@ -1611,11 +2057,40 @@ public:
             mpp_buffer_group_put(m_frameGrp);
             m_frameGrp = nullptr;
         }
+        m_clFrameEncoding.clear();
+        m_clFrameMap.clear();
+        for (auto& buf : m_clFrameBuffers) {
+            mpp_buffer_put(buf);
+        }
+        m_clFrameBuffers.clear();
+        if (m_clFrameGrp) {
+            mpp_buffer_group_put(m_clFrameGrp);
+            m_clFrameGrp = nullptr;
+        }
     };
+    virtual void releaseFrameRefs() override {
+        // OpenCLのフレームはm_clFrameBuffersを参照しているので、ここではフレームへの参照のみ破棄し、バッファはデストラクタで解放する
+        m_clFrameEncoding.clear();
+        m_clFrameMap.clear();
+        PipelineTask::releaseFrameRefs();
+    }
     void setEnc(MPPContext *encode) { m_encoder = encode; };
+    // 次に入力するフレームの出力フレーム番号を設定する (HDR10+のmetadataの取得などに使用)
+    void setNextFrameId(int frameId) { m_inFrames = frameId; }
+
+    // EOSまで処理したエンコーダを、新たなフレームを受け付けられる状態に戻す
+    RGY_ERR reset() {
+        auto ret = err_to_rgy(m_encoder->mpi->reset(m_encoder->ctx));
+        if (ret != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to reset encoder: %s.\n"), get_err_mes(ret));
+            return ret;
+        }
+        m_sentEOSFrame = false;
+        return RGY_ERR_NONE;
+    }
 
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override {
-        return std::make_pair(m_encParams.frameinfo(), 8);
+        return std::make_pair(m_encParams.frameinfo(), ENC_IN_FRAMES);
     }
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
 
@@ -1632,7 +2107,7 @@ public:
                 return RGY_ERR_UNSUPPORTED;
         }
 
-        auto ret = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_DRM));
+        auto ret = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM)));
         if (ret != RGY_ERR_NONE) {
             PrintMes(RGY_LOG_ERROR, _T("failed to get mpp buffer group : %s\n"), get_err_mes(ret));
             return ret;
@@ -1654,6 +2129,66 @@ public:
         return RGY_ERR_NONE;
     }
 
+    // 前段のOpenCLの出力先として、エンコーダ入力用のバッファをそのままOpenCLのフレームとして確保する
+    // OpenCL側で直接エンコーダの入力形式に書き込むことで、host側へのmapと色空間変換のコピーを省略する
+    // dma-bufのimport(cl_arm_import_memory)が使えればそれを使い、使えなければhostのアドレスを渡す(CL_MEM_USE_HOST_PTR)
+    RGY_ERR allocateCLFramesDirect(RGYOpenCLContext *cl, const RGYFrameInfo& frameInfo, const int numFrames, std::vector<std::unique_ptr<RGYFrame>>& frames) {
+        frames.clear();
+        const auto encFrameInfo = m_encParams.frameinfo();
+        if ((m_encParams.prep.format & MPP_FRAME_FMT_MASK) != MPP_FMT_YUV420SP
+            || frameInfo.csp != RGY_CSP_NV12 || encFrameInfo.csp != RGY_CSP_NV12
+            || frameInfo.width != m_encParams.prep.width || frameInfo.height != m_encParams.prep.height) {
+            return RGY_ERR_UNSUPPORTED;
+        }
+        if (!m_clFrameGrp) {
+            auto ret = err_to_rgy(mpp_buffer_group_get_internal(&m_clFrameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM)));
+            if (ret != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_DEBUG, _T("failed to get mpp buffer group : %s\n"), get_err_mes(ret));
+                return ret;
+            }
+        }
+        const int x_stride = m_encParams.prep.hor_stride;
+        const int y_stride = m_encParams.prep.ver_stride;
+        const int frameSize = x_stride * y_stride * 3 / 2;
+        int importDmaBuf = 0;
+        for (int i = 0; i < numFrames; i++) {
+            MppBuffer buf = nullptr;
+            auto ret = err_to_rgy(mpp_buffer_get(m_clFrameGrp, &buf, frameSize));
+            if (ret != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_DEBUG, _T("failed to get buffer for input frame : %s\n"), get_err_mes(ret));
+                return ret;
+            }
+            m_clFrameBuffers.push_back(buf);
+            auto hostInfo = setMPPBufferInfo(RGY_CSP_NV12, m_encParams.prep.width, m_encParams.prep.height, x_stride, y_stride, buf);
+            hostInfo.picstruct = frameInfo.picstruct;
+            auto clframe = cl->createFrameFromDmaBuf(hostInfo, mpp_buffer_get_fd(buf), mpp_buffer_get_size(buf), CL_MEM_READ_WRITE);
+            if (clframe) {
+                importDmaBuf++;
+            } else {
+                clframe = cl->createFrameFromHostPtr(hostInfo, CL_MEM_READ_WRITE);
+            }
+            if (!clframe) {
+                return RGY_ERR_NULL_PTR;
+            }
+            std::unique_ptr<RGYFrame> f = std::move(clframe);
+            m_clFrameMap[f.get()] = buf;
+            frames.push_back(std::move(f));
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("Allocated %d encoder input frames for OpenCL direct output: %dx%d [%d:%d], %s.\n"),
+            numFrames, m_encParams.prep.width, m_encParams.prep.height, x_stride, y_stride,
+            (importDmaBuf == numFrames) ? _T("dma-buf import") : ((importDmaBuf > 0) ? _T("dma-buf import/host ptr") : _T("host ptr")));
+        return RGY_ERR_NONE;
+    }
+    // allocateCLFramesDirectで確保したものを解放 (失敗時に通常の方法に戻す場合)
+    void releaseCLFramesDirect() {
+        m_clFrameEncoding.clear();
+        m_clFrameMap.clear();
+        for (auto& buf : m_clFrameBuffers) {
+            mpp_buffer_put(buf);
+        }
+        m_clFrameBuffers.clear();
+    }
+
     std::tuple<RGY_ERR, std::shared_ptr<RGYBitstream>> getOutputBitstream() {
         MppPacket packet = nullptr;
         auto err = err_to_rgy(m_encoder->mpi->encode_get_packet(m_encoder->ctx, &packet));
@@ -1682,7 +2217,7 @@ public:
             return { eos ? RGY_ERR_MORE_DATA : RGY_ERR_NONE, nullptr };
         }
         const auto pts = mpp_packet_get_pts(packet);
-        const auto pktval = m_encTimestamp->get(pts);
+        const auto pktval = m_encTimestamp->peek(pts); // metadataは出力時に取り出すので、ここでは時刻情報のみ
         output->copy((uint8_t *)mpp_packet_get_pos(packet), pktLength, pts, 0, pktval.duration);
 
         if (mpp_packet_has_meta(packet)) {
@@ -1694,8 +2229,11 @@ public:
             
             MppFrame frm = nullptr;
             if (mpp_meta_get_frame(meta, KEY_INPUT_FRAME, &frm) == MPP_OK) {
-                if (m_frameGrp) { // ここで管理しているメモリなら、解放せずキューに戻す
-                    MppBuffer frm_buf = mpp_frame_get_buffer(frm);
+                MppBuffer frm_buf = mpp_frame_get_buffer(frm);
+                auto it_cl = std::find_if(m_clFrameEncoding.begin(), m_clFrameEncoding.end(), [frm_buf](const auto& e) { return e.first == frm_buf; });
+                if (frm_buf && it_cl != m_clFrameEncoding.end()) {
+                    m_clFrameEncoding.erase(it_cl); // エンコードが終わったので、OpenCL側で再利用できるようにする
+                } else if (m_frameGrp) { // ここで管理しているメモリなら、解放せずキューに戻す
                     if (frm_buf) {
                         m_queueFrameList.push_back(frm_buf);
                     }
@@ -1707,11 +2245,55 @@ public:
         return { eos ? RGY_ERR_MORE_DATA : RGY_ERR_NONE, output };
     }
 
+    // lookaheadの解析結果をフレームのmetaに設定する
+    RGY_ERR setLookaheadResult(MppFrame mppframe, const PipelineTaskOutputDataLookahead *lookahead) {
+        auto meta = mpp_frame_get_meta(mppframe);
+        if (!meta) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to get meta of frame.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        if (lookahead->forceIDR()) {
+            auto err = err_to_rgy(mpp_meta_set_s32(meta, KEY_INPUT_IDR_REQ, 1));
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to set idr request: %s.\n"), get_err_mes(err));
+                return err;
+            }
+        }
+        if (lookahead->qpOffset() != 0) {
+            // フレーム全体を1つのROIとし、相対QPを指定する
+            auto& roi = m_roi[m_roiIdx];
+            m_roiIdx = (m_roiIdx + 1) % m_roi.size();
+            roi.region.x = 0;
+            roi.region.y = 0;
+            roi.region.w = (RK_U16)ALIGN(m_encParams.prep.width, 16);
+            roi.region.h = (RK_U16)ALIGN(m_encParams.prep.height, 16);
+            roi.region.intra = 0;
+            roi.region.quality = (RK_S16)lookahead->qpOffset();
+            roi.region.qp_area_idx = 0;
+            roi.region.area_map_en = 1;
+            roi.region.abs_qp_en = 0;
+            roi.cfg.number = 1;
+            roi.cfg.regions = &roi.region;
+            auto err = err_to_rgy(mpp_meta_set_ptr(meta, KEY_ROI_DATA, &roi.cfg));
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to set roi data: %s.\n"), get_err_mes(err));
+                return err;
+            }
+        }
+        return RGY_ERR_NONE;
+    }
+
     virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override {
         if (frame && frame->type() != PipelineTaskOutputType::SURFACE) {
             PrintMes(RGY_LOG_ERROR, _T("Invalid frame type.\n"));
             return RGY_ERR_UNSUPPORTED;
         }
+        if (frame) {
+            //lookaheadを経由した場合は、保持していたtimestamp等をここで反映する
+            if (auto lookahead = dynamic_cast<const PipelineTaskOutputDataLookahead *>(frame->customdata()); lookahead != nullptr) {
+                lookahead->applyFrameProp(dynamic_cast<PipelineTaskOutputSurf *>(frame.get())->surf().frame());
+            }
+        }
 
         std::vector<std::shared_ptr<RGYFrameData>> metadatalist;
         if (m_encCodec == RGY_CODEC_HEVC || m_encCodec == RGY_CODEC_AV1) {
@@ -1770,7 +2352,10 @@ public:
             if (m_timecode) {
                 m_timecode->write(surfInFrame->timestamp(), m_outputTimebase);
             }
-            m_encTimestamp->add(surfInFrame->timestamp(), surfInFrame->inputFrameId(), m_inFrames, surfInFrame->duration(), surfInFrame->dataList());
+            if (auto err = m_encTimestamp->add(surfInFrame->timestamp(), surfInFrame->inputFrameId(), m_inFrames, surfInFrame->duration(), surfInFrame->dataList()); err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Timestamp buffer overflow: %d frames pending output.\n"), (int)m_encTimestamp->size());
+                return err;
+            }
             //エンコーダまでたどり着いたフレームについてはdataListを解放
             surfInFrame->clearDataList();
 
@@ -1800,6 +2385,28 @@ public:
                         m_encParams.prep.width, m_encParams.prep.height, RGY_CSP_NAMES[csp_enc_to_rgy(m_encParams.prep.format)],
                         m_encParams.prep.hor_stride, m_encParams.prep.ver_stride);
                 }
+            } else if (auto it_cl = m_clFrameMap.find(surfInFrame); it_cl != m_clFrameMap.end()) {
+                // OpenCLでエンコーダ入力用のバッファに直接書き込み済みなので、そのまま使用する
+                auto err = err_to_rgy(mpp_frame_init(&mppframe));
+                if (err != RGY_ERR_NONE) {
+                    PrintMes(RGY_LOG_ERROR, _T("Failed to allocate mpp frame: %s\n"), get_err_mes(err));
+                    return err;
+                }
+                mpp_frame_set_width(mppframe, m_encParams.prep.width);
+                mpp_frame_set_height(mppframe, m_encParams.prep.height);
+                mpp_frame_set_hor_stride(mppframe, m_encParams.prep.hor_stride);
+                mpp_frame_set_ver_stride(mppframe, m_encParams.prep.ver_stride);
+                mpp_frame_set_fmt(mppframe, m_encParams.prep.format);
+                mpp_frame_set_buffer(mppframe, it_cl->second);
+                //明示的に待機が必要 (mapの完了でhost側から参照できるようになる)
+                frame->depend_clear();
+                if (auto clframe = surfIn.cl(); clframe != nullptr && clframe->isMapped()) {
+                    clframe->unmapBuffer();
+                    clframe->resetMappedFrame();
+                }
+                mpp_frame_set_pts(mppframe, surfInFrame->timestamp());
+                // エンコーダから返却されるまで、OpenCL側で上書きされないよう参照を保持する
+                m_clFrameEncoding.emplace_back(it_cl->second, surfIn);
             } else {
                 auto err = err_to_rgy(mpp_frame_init(&mppframe));
                 if (err != RGY_ERR_NONE) {
@@ -1863,6 +2470,12 @@ public:
                 }
                 mpp_frame_set_pts(mppframe, surfEncInInfo.timestamp);
             }
+            if (auto lookahead = dynamic_cast<const PipelineTaskOutputDataLookahead *>(frame->customdata()); lookahead != nullptr) {
+                auto err = setLookaheadResult(mppframe, lookahead);
+                if (err != RGY_ERR_NONE) {
+                    return err;
+                }
+            }
             mpp_frame_set_poc(mppframe, m_inFrames);
             m_inFrames++;
             PrintMes(RGY_LOG_TRACE, _T("m_inFrames %d.\n"), m_inFrames);
@@ -1912,6 +2525,380 @@ public:
     }
 };
 
+// --fast-remux smart-trim: trimの境界を含むGOPのみデコード/再エンコードし、それ以外のGOPはそのまま出力する
+// GOPごとの処理方法はMPPSmartTrimで決め、timestampはPipelineTaskRemuxと同様にtrimで削除した区間を詰める
+class PipelineTaskSmartTrim : public PipelineTask {
+protected:
+    struct Packet {
+        std::shared_ptr<RGYBitstream> bs; // 入力のパケット (デコーダに渡すため、内容は変更しない)
+        int64_t pts;
+        int64_t dts;
+        int64_t duration;
+        int poc;   // 入力のフレーム番号 (未確定ならFRAMEPOS_POC_INVALID)
+        bool key;
+    };
+    RGYInputAvcodec *m_input;
+    std::unique_ptr<PipelineTaskMPPDecodePacket> m_dec;
+    std::unique_ptr<PipelineTaskMPPEncode> m_enc;
+    RGY_CODEC m_codec;
+    RGYTimestamp *m_encTimestamp;
+    RGYHDR10Plus *m_hdr10plus;
+    MPPSmartTrim m_splicer;
+    RGYListRef<RGYBitstream> m_bitStreamOut;
+    std::vector<uint8_t> m_header;   // 入力のヘッダ (VPS/SPS/PPS)
+    decltype(parse_nal_unit_h264_c)* m_parse_nal_h264;
+    decltype(parse_nal_unit_hevc_c)* m_parse_nal_hevc;
+    int64_t m_frameDuration; // 固定fpsを仮定した時の1フレームのduration (streamのtimebase)
+    bool m_timestampPassThrough;
+    int m_maxGop;
+    uint32_t m_framePosIdx;
+    std::deque<Packet> m_packets;    // 読み込み済みで未処理のパケット (デコード順)
+    std::vector<Packet> m_gopPrev;   // 直前のGOPのパケット (open GOPのleadingフレームのデコード用)
+    int m_gopPrevKeyPoc;
+    int m_lastPoc;                   // 処理済みのフレーム番号の最大値
+    bool m_decUsed;                  // デコーダを使用したか (再度使用する前にリセットが必要)
+    bool m_lastOutputEncoded;        // 最後に出力したのが再エンコードしたフレームか
+    bool m_gopWarned;
+    int64_t m_tsOffset;  // ptsから差し引く値
+    int64_t m_tsOutEnd;  // 出力済みのフレームの終了時刻
+    bool m_eof;
+    bool m_abort;
+public:
+    PipelineTaskSmartTrim(RGYInputAvcodec *input, std::unique_ptr<PipelineTaskMPPDecodePacket> dec, std::unique_ptr<PipelineTaskMPPEncode> enc, RGY_CODEC codec,
+        RGYTimestamp *encTimestamp, RGYHDR10Plus *hdr10plus, const sTrimParam &trimParam,
+        int64_t frameDuration, bool timestampPassThrough, int maxGop, int outMaxQueueSize, std::shared_ptr<RGYLog> log)
+        : PipelineTask(PipelineTaskType::SMART_TRIM, outMaxQueueSize, log), m_input(input), m_dec(std::move(dec)), m_enc(std::move(enc)), m_codec(codec),
+        m_encTimestamp(encTimestamp), m_hdr10plus(hdr10plus), m_splicer(trimParam.list), m_bitStreamOut(), m_header(),
+        m_parse_nal_h264(get_parse_nal_unit_h264_func()), m_parse_nal_hevc(get_parse_nal_unit_hevc_func()),
+        m_frameDuration(frameDuration), m_timestampPassThrough(timestampPassThrough), m_maxGop(maxGop),
+        m_framePosIdx(std::numeric_limits<decltype(m_framePosIdx)>::max()), m_packets(), m_gopPrev(), m_gopPrevKeyPoc(0), m_lastPoc(-1),
+        m_decUsed(false), m_lastOutputEncoded(false), m_gopWarned(false), m_tsOffset(0), m_tsOutEnd(0), m_eof(false), m_abort(false) {
+        RGYBitstream header = RGYBitstreamInit();
+        if (m_input->GetHeader(&header) == RGY_ERR_NONE && header.size() > 0) {
+            m_header = std::vector<uint8_t>(header.data(), header.data() + header.size());
+        }
+        header.clear();
+    };
+    virtual ~PipelineTaskSmartTrim() {
+        m_outQeueue.clear();
+        m_packets.clear();
+        m_gopPrev.clear();
+        m_enc.reset();
+        m_dec.reset();
+        m_bitStreamOut.clear();
+    };
+    virtual bool abort() { m_abort = true; return true; }; // 中断指示を受け取ったらtrueを返す
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
+
+    virtual RGY_ERR sendFrame([[maybe_unused]] std::unique_ptr<PipelineTaskOutput>& frame) override {
+        if (m_abort || m_eof) {
+            return RGY_ERR_MORE_BITSTREAM; // EOF を PipelineTaskMPPDecode のreturnコードに合わせる
+        }
+        auto ret = m_input->LoadNextFrame(nullptr);
+        if (ret != RGY_ERR_NONE && ret != RGY_ERR_MORE_DATA && ret != RGY_ERR_MORE_BITSTREAM) {
+            PrintMes(RGY_LOG_ERROR, _T("Error in reader: %s.\n"), get_err_mes(ret));
+            return ret;
+        }
+        auto bs = m_bitStreamOut.get([](RGYBitstream *bs) {
+            *bs = RGYBitstreamInit();
+            return 0;
+        });
+        if (!bs) {
+            return RGY_ERR_NULL_PTR;
+        }
+        ret = m_input->GetNextBitstream(bs.get());
+        if (ret == RGY_ERR_MORE_BITSTREAM) { //入力ビットストリームは終了、残りのGOPをすべて処理する
+            m_eof = true;
+            ret = processGops(true);
+            if (ret == RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_INFO, _T("smart-trim: %s.\n"), m_splicer.print().c_str());
+            }
+            return ret;
+        } else if (ret != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Error on getting video bitstream: %s.\n"), get_err_mes(ret));
+            return ret;
+        }
+        // 入力のHDR10+/DoVi RPUはbitstreamに含まれたまま出力されるので、ここでは不要
+        bs->clearFrameDataList();
+
+        // フレーム番号はBフレームの並べ替えのため、後続のパケットを読むまで確定しない場合がある
+        const auto framePos = m_input->GetFramePosList()->findpts(bs->pts(), &m_framePosIdx);
+        const bool posFound = framePos.pts == bs->pts();
+        Packet pkt;
+        pkt.bs = bs;
+        pkt.pts = bs->pts();
+        pkt.dts = bs->dts();
+        pkt.duration = (posFound && framePos.duration > 0) ? framePos.duration : m_frameDuration;
+        pkt.poc = (posFound) ? framePos.poc : FRAMEPOS_POC_INVALID;
+        pkt.key = (posFound) ? (framePos.flags & AV_PKT_FLAG_KEY) != 0 : m_inFrames == 0;
+        m_inFrames++;
+        m_packets.push_back(pkt);
+        return processGops(false);
+    }
+protected:
+    // 処理できるGOP (次のキーフレームまで読み込み済みで、フレーム番号が確定したもの) を処理する
+    RGY_ERR processGops(const bool flush) {
+        while (!m_packets.empty()) {
+            size_t gopEnd = 1;
+            while (gopEnd < m_packets.size() && !m_packets[gopEnd].key) {
+                gopEnd++;
+            }
+            if (gopEnd == m_packets.size() && !flush) {
+                break;
+            }
+            if (!resolvePoc(gopEnd, flush)) {
+                break;
+            }
+            std::vector<Packet> gop(m_packets.begin(), m_packets.begin() + gopEnd);
+            m_packets.erase(m_packets.begin(), m_packets.begin() + gopEnd);
+            auto err = processGop(gop);
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+        }
+        return RGY_ERR_NONE;
+    }
+
+    bool resolvePoc(const size_t count, const bool flush) {
+        bool resolved = true;
+        for (size_t i = 0; i < count; i++) {
+            auto& pkt = m_packets[i];
+            if (pkt.poc != FRAMEPOS_POC_INVALID) {
+                continue;
+            }
+            uint32_t idx = m_framePosIdx;
+            const auto framePos = m_input->GetFramePosList()->findpts(pkt.pts, &idx);
+            if (framePos.pts == pkt.pts && framePos.poc != FRAMEPOS_POC_INVALID) {
+                pkt.poc = framePos.poc;
+                if (framePos.duration > 0) {
+                    pkt.duration = framePos.duration;
+                }
+            } else {
+                resolved = false;
+            }
+        }
+        if (resolved || !flush) {
+            return resolved;
+        }
+        // 入力の終端でもフレーム番号が確定しない場合は、ptsの順に割り当てる
+        std::vector<Packet *> sorted;
+        for (size_t i = 0; i < count; i++) {
+            sorted.push_back(&m_packets[i]);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const Packet *a, const Packet *b) { return a->pts < b->pts; });
+        for (size_t i = 0; i < sorted.size(); i++) {
+            sorted[i]->poc = m_lastPoc + 1 + (int)i;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("frame number not found for GOP at pts %lld, assigned in pts order from %d.\n"), (lls)m_packets[0].pts, m_lastPoc + 1);
+        return true;
+    }
+
+    RGY_ERR processGop(const std::vector<Packet>& gop) {
+        MPPSmartTrimGop range(gop.front().poc, gop.front().poc, gop.front().poc);
+        for (const auto& pkt : gop) {
+            range.firstFrame = std::min(range.firstFrame, pkt.poc);
+            range.lastFrame = std::max(range.lastFrame, pkt.poc);
+        }
+        if (m_maxGop > 0 && (int)gop.size() > m_maxGop && !m_gopWarned) {
+            PrintMes(RGY_LOG_WARN, _T("keyframe interval %d exceeds max-gop %d at frame %d.\n"), (int)gop.size(), m_maxGop, range.keyFrame);
+            m_gopWarned = true;
+        }
+        const auto plan = m_splicer.plan(range);
+        PrintMes(RGY_LOG_DEBUG, _T("GOP %d-%d (key %d, %d frames): %s.\n"),
+            range.firstFrame, range.lastFrame, range.keyFrame, (int)gop.size(), get_smart_trim_action_name(plan.action));
+        int copiedFrames = 0;
+        int encodedFrames = 0;
+        // 再エンコードするフレーム(leadingフレーム)を先に出力してから、残りをそのまま出力する
+        auto err = encodeFrames(gop, range, plan, encodedFrames);
+        if (err == RGY_ERR_NONE) {
+            err = copyPackets(gop, plan, copiedFrames);
+        }
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+        m_splicer.addResult(plan.action, copiedFrames, encodedFrames);
+        m_gopPrev = gop;
+        m_gopPrevKeyPoc = range.keyFrame;
+        m_lastPoc = std::max(m_lastPoc, range.lastFrame);
+        return RGY_ERR_NONE;
+    }
+
+    bool hasParameterSets(const RGYBitstream *bs) const {
+        if (m_codec == RGY_CODEC_HEVC) {
+            const auto nal_list = m_parse_nal_hevc(bs->data(), bs->size());
+            return std::any_of(nal_list.begin(), nal_list.end(), [](const nal_info& info) { return info.type == NALU_HEVC_SPS; });
+        }
+        const auto nal_list = m_parse_nal_h264(bs->data(), bs->size());
+        return std::any_of(nal_list.begin(), nal_list.end(), [](const nal_info& info) { return info.type == NALU_H264_SPS; });
+    }
+
+    // planでそのまま出力するとしたパケットを出力する
+    RGY_ERR copyPackets(const std::vector<Packet>& gop, const MPPSmartTrimPlan& plan, int& copiedFrames) {
+        // trimの範囲の先頭を含む場合は、削除した区間を詰める
+        const Packet *blockStart = nullptr;
+        for (const auto& pkt : gop) {
+            if (plan.copy(pkt.poc) && m_splicer.isBlockStart(pkt.poc) && (!blockStart || pkt.poc < blockStart->poc)) {
+                blockStart = &pkt;
+            }
+        }
+        if (blockStart && !m_timestampPassThrough) {
+            m_tsOffset = blockStart->pts - m_tsOutEnd;
+            PrintMes(RGY_LOG_DEBUG, _T("start of range at frame %d, pts %lld, offset %lld.\n"), blockStart->poc, (lls)blockStart->pts, (lls)m_tsOffset);
+        }
+        for (const auto& pkt : gop) {
+            if (!plan.copy(pkt.poc)) {
+                continue;
+            }
+            auto bs = m_bitStreamOut.get([](RGYBitstream *bs) {
+                *bs = RGYBitstreamInit();
+                return 0;
+            });
+            if (!bs) {
+                return RGY_ERR_NULL_PTR;
+            }
+            // 再エンコードしたフレームの後は、エンコーダのヘッダが有効になっているので、入力のヘッダを付加する
+            if (pkt.key && m_lastOutputEncoded && m_header.size() > 0 && !hasParameterSets(pkt.bs.get())) {
+                bs->copy(m_header.data(), m_header.size());
+                bs->append(pkt.bs->data(), pkt.bs->size());
+            } else {
+                bs->copy(pkt.bs->data(), pkt.bs->size());
+            }
+            const int64_t pts = pkt.pts - m_tsOffset;
+            bs->setPts(pts);
+            bs->setDts(pkt.dts - m_tsOffset);
+            bs->setDuration(pkt.duration);
+            bs->setDataflag(pkt.bs->dataflag());
+            m_tsOutEnd = std::max(m_tsOutEnd, pts + pkt.duration);
+
+            const int outFrameId = m_splicer.outputFrame(pkt.poc);
+            std::vector<std::shared_ptr<RGYFrameData>> metadatalist;
+            if (m_hdr10plus) {
+                if (const auto data = m_hdr10plus->getData(outFrameId); data.size() > 0) {
+                    metadatalist.push_back(std::make_shared<RGYFrameDataHDR10plus>(data.data(), data.size(), pts));
+                }
+            }
+            if (auto err = m_encTimestamp->add(pts, pkt.poc, outFrameId, pkt.duration, metadatalist); err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Timestamp buffer overflow: %d frames pending output.\n"), (int)m_encTimestamp->size());
+                return err;
+            }
+            m_outQeueue.push_back(std::make_unique<PipelineTaskOutputBitstream>(bs));
+            m_lastOutputEncoded = false;
+            copiedFrames++;
+        }
+        return RGY_ERR_NONE;
+    }
+
+    void getEncoderOutput() {
+        for (auto& out : m_enc->getOutput(true)) {
+            m_outQeueue.push_back(std::move(out));
+        }
+    }
+
+    // planで再エンコードするとしたフレームをデコードして再エンコードする
+    RGY_ERR encodeFrames(const std::vector<Packet>& gop, const MPPSmartTrimGop& range, const MPPSmartTrimPlan& plan, int& encodedFrames) {
+        const int plannedFrames = m_splicer.keptFrames(plan.encodeFirst, plan.encodeLast);
+        if (plannedFrames == 0) {
+            return RGY_ERR_NONE;
+        }
+        if (m_decUsed) {
+            auto err = m_dec->reset();
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+        }
+        m_decUsed = true;
+        // open GOPのleadingフレームは直前のGOPを参照するので、直前のGOPのキーフレーム以降も入力する
+        if (range.openGop()) {
+            for (const auto& pkt : m_gopPrev) {
+                if (pkt.poc >= m_gopPrevKeyPoc) {
+                    m_dec->addPacket(pkt.bs);
+                }
+            }
+        }
+        // leadingフレームのみなら、最後のleadingフレームまで入力すればよい
+        size_t packetCount = gop.size();
+        if (plan.encodeLast < range.keyFrame) {
+            for (packetCount = gop.size(); packetCount > 1 && gop[packetCount - 1].poc >= range.keyFrame; packetCount--) {
+                ;
+            }
+        }
+        std::unordered_map<int64_t, const Packet *> ptsToPacket;
+        for (size_t i = 0; i < packetCount; i++) {
+            m_dec->addPacket(gop[i].bs);
+            ptsToPacket[gop[i].pts] = &gop[i];
+        }
+
+        for (auto decRet = RGY_ERR_NONE; decRet != RGY_ERR_MORE_BITSTREAM; ) {
+            std::unique_ptr<PipelineTaskOutput> dummy;
+            decRet = m_dec->sendFrame(dummy);
+            if (decRet != RGY_ERR_NONE && decRet != RGY_ERR_MORE_BITSTREAM) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to decode frames at frame %d: %s.\n"), range.keyFrame, get_err_mes(decRet));
+                return decRet;
+            }
+            for (auto& out : m_dec->getOutput(true)) {
+                auto taskSurf = dynamic_cast<PipelineTaskOutputSurf *>(out.get());
+                if (taskSurf == nullptr) {
+                    continue;
+                }
+                auto surf = taskSurf->surf().frame();
+                auto it = ptsToPacket.find(surf->timestamp());
+                if (it == ptsToPacket.end()) {
+                    continue; // 参照のためにデコードした直前のGOPのフレーム
+                }
+                const auto pkt = it->second;
+                if (!m_splicer.encode(plan, pkt->poc)) {
+                    continue;
+                }
+                if (m_splicer.isBlockStart(pkt->poc) && !m_timestampPassThrough) {
+                    m_tsOffset = pkt->pts - m_tsOutEnd;
+                    PrintMes(RGY_LOG_DEBUG, _T("start of range at frame %d, pts %lld, offset %lld.\n"), pkt->poc, (lls)pkt->pts, (lls)m_tsOffset);
+                }
+                const int64_t pts = pkt->pts - m_tsOffset;
+                surf->setTimestamp(pts);
+                surf->setDuration(pkt->duration);
+                surf->setInputFrameId(pkt->poc);
+                m_tsOutEnd = std::max(m_tsOutEnd, pts + pkt->duration);
+
+                std::unique_ptr<PipelineTaskOutput> encIn;
+                if (encodedFrames == 0) { // 単独でデコードできるよう、最初のフレームはIDRにする
+                    std::unique_ptr<PipelineTaskOutputDataCustom> idr = std::make_unique<PipelineTaskOutputDataLookahead>(true, 0);
+                    encIn = std::make_unique<PipelineTaskOutputSurf>(taskSurf->surf(), idr);
+                } else {
+                    encIn = std::move(out);
+                }
+                m_enc->setNextFrameId(m_splicer.outputFrame(pkt->poc));
+                auto err = m_enc->sendFrame(encIn);
+                if (err != RGY_ERR_NONE && err != RGY_ERR_MORE_SURFACE) {
+                    PrintMes(RGY_LOG_ERROR, _T("Failed to encode frame %d: %s.\n"), pkt->poc, get_err_mes(err));
+                    return err;
+                }
+                getEncoderOutput();
+                encodedFrames++;
+            }
+        }
+        // 次のGOPとは独立させるため、エンコーダからすべて出力させる
+        for (auto err = RGY_ERR_NONE; err != RGY_ERR_MORE_DATA; ) {
+            std::unique_ptr<PipelineTaskOutput> eos;
+            err = m_enc->sendFrame(eos);
+            if (err != RGY_ERR_NONE && err != RGY_ERR_MORE_SURFACE && err != RGY_ERR_MORE_DATA) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to flush encoder: %s.\n"), get_err_mes(err));
+                return err;
+            }
+            getEncoderOutput();
+        }
+        auto err = m_enc->reset();
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+        if (encodedFrames != plannedFrames) {
+            PrintMes(RGY_LOG_WARN, _T("re-encoded %d frames in GOP at frame %d, expected %d frames.\n"), encodedFrames, range.keyFrame, plannedFrames);
+        }
+        m_lastOutputEncoded = encodedFrames > 0;
+        return RGY_ERR_NONE;
+    }
+};
+
 class PipelineTaskRGA : public PipelineTask {
 protected:
     std::vector<std::unique_ptr<RGAFilter>>& m_vpFilters;
@@ -1967,7 +2954,7 @@ public:
                 if (!m_inputFrameTmp) {
                     m_inputFrameTmp = std::make_unique<RGYFrameMpp>();
                     if (!m_frameGrp) {
-                        auto sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_DRM));
+                        auto sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM)));
                         if (sts != RGY_ERR_NONE) {
                             PrintMes(RGY_LOG_ERROR, _T("failed to get mpp buffer group : %s\n"), get_err_mes(sts));
                             return sts;
@@ -2140,7 +3127,7 @@ public:
                 }
                 const auto mappedHost = surfVppInCL->mappedHost()->frameInfo();
                 if (!m_frameGrp) {
-                    auto sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_DRM));
+                    auto sts = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, mppBufferType(MPP_BUFFER_TYPE_DRM)));
                     if (sts != RGY_ERR_NONE) {
                         PrintMes(RGY_LOG_ERROR, _T("failed to get mpp buffer group : %s\n"), get_err_mes(sts));
                         return sts;
@@ -2225,12 +3212,11 @@ protected:
     std::shared_ptr<RGYOpenCLContext> m_cl;
     std::vector<std::unique_ptr<RGYFilter>>& m_vpFilters;
     std::deque<std::unique_ptr<PipelineTaskOutput>> m_prevInputFrame; //前回投入されたフレーム、完了通知を待ってから解放するため、参照を保持する
-    RGYFilterSsim *m_videoMetric;
     std::unique_ptr<RGYCLFrame> m_clFrameInput;
     std::unique_ptr<RGYCLFrame> m_clFrameOutput;
 public:
-    PipelineTaskOpenCL(std::vector<std::unique_ptr<RGYFilter>>& vppfilters, RGYFilterSsim *videoMetric, std::shared_ptr<RGYOpenCLContext> cl, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
-        PipelineTask(PipelineTaskType::OPENCL, outMaxQueueSize, log), m_cl(cl), m_vpFilters(vppfilters), m_prevInputFrame(), m_videoMetric(videoMetric), m_clFrameInput(), m_clFrameOutput() {
+    PipelineTaskOpenCL(std::vector<std::unique_ptr<RGYFilter>>& vppfilters, std::shared_ptr<RGYOpenCLContext> cl, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
+        PipelineTask(PipelineTaskType::OPENCL, outMaxQueueSize, log), m_cl(cl), m_vpFilters(vppfilters), m_prevInputFrame(), m_clFrameInput(), m_clFrameOutput() {
 
     };
     virtual ~PipelineTaskOpenCL() {
@@ -2240,10 +3226,6 @@ public:
         m_cl.reset();
     };
 
-    void setVideoQualityMetricFilter(RGYFilterSsim *videoMetric) {
-        m_videoMetric = videoMetric;
-    }
-
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
     virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override {
@@ -2352,15 +3334,6 @@ public:
                 PrintMes(RGY_LOG_ERROR, _T("Error while running filter \"%s\".\n"), lastFilter->name().c_str());
                 return sts_filter;
             }
-            if (m_videoMetric) {
-                //フレームを転送
-                int dummy = 0;
-                auto err = m_videoMetric->filter(&filterframes.front().first, nullptr, &dummy, m_cl->queue());
-                if (err != RGY_ERR_NONE) {
-                    PrintMes(RGY_LOG_ERROR, _T("Failed to send frame for video metric calcualtion: %s.\n"), get_err_mes(err));
-                    return err;
-                }
-            }
             filterframes.pop_front();
 
             if (true) { // surfVppOutInfo に設定された情報をqueueMapBufferを呼ぶ前に設定する必要がある
@@ -0,0 +1,154 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include "rgy_util.h"
+#include "mpp_smart_trim.h"
+
+const TCHAR *get_smart_trim_action_name(MPPSmartTrimAction action) {
+    switch (action) {
+    case MPPSmartTrimAction::DROP:           return _T("drop");
+    case MPPSmartTrimAction::COPY:           return _T("copy");
+    case MPPSmartTrimAction::ENCODE_LEADING: return _T("encode-leading");
+    case MPPSmartTrimAction::ENCODE:         return _T("encode");
+    default:                                 return _T("unknown");
+    }
+}
+
+MPPSmartTrim::MPPSmartTrim(const std::vector<sTrim>& trimList) :
+    m_trimList(trimList),
+    m_keptBefore(),
+    m_prevAction(MPPSmartTrimAction::COPY), // 最初のGOPの前には参照先がないので、そのまま出力できる
+    m_gops(),
+    m_copiedFrames(0),
+    m_encodedFrames(0) {
+    int64_t kept = 0;
+    for (const auto& trim : m_trimList) {
+        m_keptBefore.push_back(kept);
+        kept += (int64_t)trim.fin - trim.start + 1;
+    }
+    std::fill(m_gops, m_gops + _countof(m_gops), 0);
+}
+
+MPPSmartTrim::~MPPSmartTrim() {
+    m_trimList.clear();
+    m_keptBefore.clear();
+}
+
+bool MPPSmartTrim::inside(int frame) const {
+    return frame_inside_range(frame, m_trimList).first;
+}
+
+int MPPSmartTrim::outputFrame(int frame) const {
+    if (m_trimList.size() == 0) {
+        return frame;
+    }
+    const auto [inside, index] = frame_inside_range(frame, m_trimList);
+    if (!inside) {
+        return -1;
+    }
+    return (int)(m_keptBefore[index] + frame - m_trimList[index].start);
+}
+
+bool MPPSmartTrim::isBlockStart(int frame) const {
+    if (m_trimList.size() == 0) {
+        return frame == 0;
+    }
+    const auto [inside, index] = frame_inside_range(frame, m_trimList);
+    return inside && frame == m_trimList[index].start;
+}
+
+int MPPSmartTrim::keptFrames(int first, int last) const {
+    if (last < first) {
+        return 0;
+    }
+    if (m_trimList.size() == 0) {
+        return last - first + 1;
+    }
+    int64_t kept = 0;
+    for (const auto& trim : m_trimList) {
+        const int64_t start = std::max(trim.start, first);
+        const int64_t fin = std::min(trim.fin, last);
+        if (start <= fin) {
+            kept += fin - start + 1;
+        }
+    }
+    return (int)kept;
+}
+
+MPPSmartTrimAction MPPSmartTrim::decide(const MPPSmartTrimGop& gop) {
+    auto action = MPPSmartTrimAction::ENCODE;
+    if (keptFrames(gop.firstFrame, gop.lastFrame) == 0) {
+        action = MPPSmartTrimAction::DROP;
+    } else if (keptFrames(gop.keyFrame, gop.lastFrame) == gop.lastFrame - gop.keyFrame + 1) {
+        // キーフレーム以降はすべて出力する
+        // leadingフレームは、すべて出力し、かつ参照先の直前のGOPの後半もそのまま出力している場合のみそのまま出力できる
+        const bool leadingKept = keptFrames(gop.firstFrame, gop.keyFrame - 1) == gop.keyFrame - gop.firstFrame;
+        const bool prevCopied = m_prevAction == MPPSmartTrimAction::COPY || m_prevAction == MPPSmartTrimAction::ENCODE_LEADING;
+        action = (!gop.openGop() || (leadingKept && prevCopied)) ? MPPSmartTrimAction::COPY : MPPSmartTrimAction::ENCODE_LEADING;
+    }
+    m_prevAction = action;
+    return action;
+}
+
+MPPSmartTrimPlan MPPSmartTrim::plan(const MPPSmartTrimGop& gop) {
+    MPPSmartTrimPlan plan;
+    plan.action = decide(gop);
+    plan.copyFirst = INT_MAX;
+    plan.encodeFirst = gop.firstFrame;
+    plan.encodeLast = gop.firstFrame - 1;
+    switch (plan.action) {
+    case MPPSmartTrimAction::COPY:
+        plan.copyFirst = gop.firstFrame;
+        break;
+    case MPPSmartTrimAction::ENCODE_LEADING:
+        plan.copyFirst = gop.keyFrame;
+        plan.encodeLast = gop.keyFrame - 1;
+        break;
+    case MPPSmartTrimAction::ENCODE:
+        plan.encodeLast = gop.lastFrame;
+        break;
+    case MPPSmartTrimAction::DROP:
+    default:
+        break;
+    }
+    return plan;
+}
+
+void MPPSmartTrim::addResult(MPPSmartTrimAction action, int copiedFrames, int encodedFrames) {
+    m_gops[(int)action]++;
+    m_copiedFrames += copiedFrames;
+    m_encodedFrames += encodedFrames;
+}
+
+tstring MPPSmartTrim::print() const {
+    return strsprintf(_T("copied %d frames, re-encoded %d frames (GOPs: copy %d, encode-leading %d, encode %d, drop %d)"),
+        m_copiedFrames, m_encodedFrames,
+        m_gops[(int)MPPSmartTrimAction::COPY], m_gops[(int)MPPSmartTrimAction::ENCODE_LEADING],
+        m_gops[(int)MPPSmartTrimAction::ENCODE], m_gops[(int)MPPSmartTrimAction::DROP]);
+}
@@ -0,0 +1,112 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __MPP_SMART_TRIM_H__
+#define __MPP_SMART_TRIM_H__
+
+#include <vector>
+#include <climits>
+#include "rgy_tchar.h"
+#include "rgy_prm.h"
+
+// --fast-remux smart-trim: GOPごとに、そのまま出力するか、再エンコードするかを決める
+//   COPY          ... GOPのフレームがすべてtrimの範囲内で、参照先もそのまま出力している
+//   ENCODE_LEADING... キーフレーム以降はすべて範囲内で、キーフレームより前に表示される
+//                     leadingフレーム(open GOP)のみ参照先を失う、またはtrimされる
+//                     -> leadingフレームのうち範囲内のものだけ再エンコードし、残りはそのまま出力する
+//   ENCODE        ... GOPの途中にtrimの境界がある -> 範囲内のフレームを再エンコードする
+//   DROP          ... GOPのフレームがすべて範囲外
+enum class MPPSmartTrimAction {
+    DROP,
+    COPY,
+    ENCODE_LEADING,
+    ENCODE,
+};
+
+const TCHAR *get_smart_trim_action_name(MPPSmartTrimAction action);
+
+// GOPの範囲 (入力のフレーム番号 = 表示順)
+struct MPPSmartTrimGop {
+    int keyFrame;   // キーフレームのフレーム番号
+    int firstFrame; // GOPに含まれるフレームの最小のフレーム番号 (open GOPではkeyFrameより小さい)
+    int lastFrame;  // GOPに含まれるフレームの最大のフレーム番号
+
+    MPPSmartTrimGop() : keyFrame(0), firstFrame(0), lastFrame(0) {};
+    MPPSmartTrimGop(int key, int first, int last) : keyFrame(key), firstFrame(first), lastFrame(last) {};
+    bool openGop() const { return firstFrame < keyFrame; }
+};
+
+// GOPの処理方法と、そのまま出力するフレーム/再エンコードするフレームの範囲
+struct MPPSmartTrimPlan {
+    MPPSmartTrimAction action;
+    int copyFirst;   // このフレーム番号以降をそのまま出力する (出力しない場合はINT_MAX)
+    int encodeFirst; // [encodeFirst, encodeLast]のうち、trimの範囲内のフレームを再エンコードする
+    int encodeLast;  // (再エンコードしない場合はencodeLast < encodeFirst)
+
+    bool copy(int frame) const { return frame >= copyFirst; }
+};
+
+class MPPSmartTrim {
+public:
+    MPPSmartTrim(const std::vector<sTrim>& trimList);
+    ~MPPSmartTrim();
+
+    // 入力順にGOPを渡して、処理方法を決める (直前のGOPの処理方法に依存する)
+    MPPSmartTrimAction decide(const MPPSmartTrimGop& gop);
+    // decideした結果から、GOPの各フレームの処理を決める
+    MPPSmartTrimPlan plan(const MPPSmartTrimGop& gop);
+    // 再エンコードして出力するフレームか
+    bool encode(const MPPSmartTrimPlan& plan, int frame) const {
+        return plan.encodeFirst <= frame && frame <= plan.encodeLast && inside(frame);
+    }
+    // 実際に出力したフレーム数を記録する (統計用)
+    void addResult(MPPSmartTrimAction action, int copiedFrames, int encodedFrames);
+
+    bool inside(int frame) const;
+    // 出力時のフレーム番号 (範囲外なら-1)
+    int outputFrame(int frame) const;
+    // trimの範囲の先頭のフレームか (timestampを詰める位置)
+    bool isBlockStart(int frame) const;
+    // [first, last]の範囲内で出力するフレーム数
+    int keptFrames(int first, int last) const;
+
+    int gops(MPPSmartTrimAction action) const { return m_gops[(int)action]; }
+    int copiedFrames() const { return m_copiedFrames; }
+    int encodedFrames() const { return m_encodedFrames; }
+    tstring print() const;
+protected:
+    std::vector<sTrim> m_trimList;
+    std::vector<int64_t> m_keptBefore; // m_keptBefore[i] = m_trimList[i].startより前に出力するフレーム数
+    MPPSmartTrimAction m_prevAction;
+    int m_gops[4];
+    int m_copiedFrames;
+    int m_encodedFrames;
+};
+
+#endif //__MPP_SMART_TRIM_H__
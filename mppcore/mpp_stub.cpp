@@ -0,0 +1,536 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdarg>
+#include <cstring>
+#include "rgy_util.h"
+#include "mpp_util.h"
+#include "mpp_stub.h"
+
+static const size_t MPP_STUB_QUEUE_DEPTH = 4; // 同時に処理中にできるフレーム数
+static const int MPP_STUB_AVG_QP = 30;        // 出力パケットに設定する平均QP
+
+static std::atomic<bool> g_mppStubEnabled(false);
+
+void mppStubSetEnabled(bool enable) {
+    g_mppStubEnabled = enable;
+}
+
+bool mppStubEnabled() {
+    return g_mppStubEnabled;
+}
+
+MppBufferType mppBufferType(MppBufferType type) {
+    return (g_mppStubEnabled) ? MPP_BUFFER_TYPE_NORMAL : type;
+}
+
+// 決定的な疑似乱数でペイロードを埋める (start codeにならないよう0を避ける)
+static void mppStubFillPayload(uint8_t *ptr, size_t size, uint32_t seed) {
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++) {
+        x = x * 1664525u + 1013904223u;
+        ptr[i] = (uint8_t)((x >> 24) | 0x80);
+    }
+}
+
+#if ENABLE_AVSW_READER
+bool MPPStub::decFormatSupported(const AVPixelFormat pixfmt) {
+    return pixfmt == AV_PIX_FMT_YUV420P || pixfmt == AV_PIX_FMT_YUVJ420P || pixfmt == AV_PIX_FMT_NV12;
+}
+#endif //#if ENABLE_AVSW_READER
+
+MPPStub::MPPStub(const MPPParamStub& prm, std::shared_ptr<RGYLog> log) :
+    m_prm(prm),
+    m_log(log),
+    m_api(),
+    m_type(MPP_CTX_BUTT),
+    m_codec(MPP_VIDEO_CodingUnused),
+    m_mtx(),
+    m_queue(),
+    m_nextFree(),
+    m_stats(),
+    m_eosIn(false),
+    m_eosOut(false),
+    m_outFrames(0),
+    m_pktBuf(),
+    m_extradata(),
+#if ENABLE_AVSW_READER
+    m_avctx(),
+    m_avpkt(),
+    m_avframe(),
+    m_pending(),
+#endif //#if ENABLE_AVSW_READER
+    m_infoWidth(0),
+    m_infoHeight(0),
+    m_infoWaiting(false),
+    m_frameGrp(nullptr),
+    m_extGrp(nullptr) {
+    memset(&m_api, 0, sizeof(m_api));
+    m_api.size              = sizeof(m_api);
+    m_api.decode_put_packet = stubDecPutPacket;
+    m_api.decode_get_frame  = stubDecGetFrame;
+    m_api.encode_put_frame  = stubEncPutFrame;
+    m_api.encode_get_packet = stubEncGetPacket;
+    m_api.reset             = stubReset;
+    m_api.control           = stubControl;
+}
+
+MPPStub::~MPPStub() {
+    reset();
+#if ENABLE_AVSW_READER
+    m_avframe.reset();
+    m_avpkt.reset();
+    m_avctx.reset();
+#endif //#if ENABLE_AVSW_READER
+    if (m_frameGrp) {
+        mpp_buffer_group_put(m_frameGrp);
+        m_frameGrp = nullptr;
+    }
+}
+
+void MPPStub::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    const auto logType = (m_type == MPP_CTX_DEC) ? RGY_LOGT_DEC : RGY_LOGT_CORE;
+    if (m_log == nullptr || log_level < m_log->getLogLevel(logType)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    tstring buffer;
+    buffer.resize(len, _T('\0'));
+    _vstprintf_s(&buffer[0], len, format, args);
+    va_end(args);
+    m_log->write(log_level, logType, (tstring(_T("mpp-stub: ")) + buffer).c_str());
+}
+
+void MPPStub::setExtraData(const uint8_t *data, size_t size) {
+    m_extradata.assign(data, data + size);
+}
+
+MPPStubStats MPPStub::stats() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_stats;
+}
+
+RGY_ERR MPPStub::init(MppCtxType type, MppCodingType codec) {
+    m_type = type;
+    m_codec = codec;
+    if (type == MPP_CTX_DEC) {
+#if ENABLE_AVSW_READER
+        const auto codecId = getAVCodecId(codec_dec_to_rgy(codec));
+        auto avcodec = avcodec_find_decoder(codecId);
+        if (!avcodec) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to find decoder for %s.\n"), char_to_tstring(avcodec_get_name(codecId)).c_str());
+            return RGY_ERR_NOT_FOUND;
+        }
+        m_avctx = std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>>(avcodec_alloc_context3(avcodec), RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+        if (!m_avctx) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate decoder.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        if (m_extradata.size() > 0) {
+            m_avctx->extradata = (uint8_t *)av_mallocz(m_extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!m_avctx->extradata) {
+                return RGY_ERR_NULL_PTR;
+            }
+            memcpy(m_avctx->extradata, m_extradata.data(), m_extradata.size());
+            m_avctx->extradata_size = (int)m_extradata.size();
+        }
+        int ret = 0;
+        if (0 > (ret = avcodec_open2(m_avctx.get(), avcodec, nullptr))) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to open decoder for %s: %s\n"), char_to_tstring(avcodec_get_name(codecId)).c_str(), qsv_av_err2str(ret).c_str());
+            return RGY_ERR_UNSUPPORTED;
+        }
+        if (m_avctx->pix_fmt != AV_PIX_FMT_NONE && !decFormatSupported(m_avctx->pix_fmt)) {
+            AddMessage(RGY_LOG_ERROR, _T("Unsupported pixel format %s: only 8-bit 4:2:0 (yuv420p/nv12) is supported.\n"),
+                char_to_tstring(av_get_pix_fmt_name(m_avctx->pix_fmt)).c_str());
+            return RGY_ERR_UNSUPPORTED;
+        }
+        m_avpkt = std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(av_packet_alloc(), RGYAVDeleter<AVPacket>(av_packet_free));
+        m_avframe = std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+        if (!m_avpkt || !m_avframe) {
+            return RGY_ERR_NULL_PTR;
+        }
+        auto err = err_to_rgy(mpp_buffer_group_get_internal(&m_frameGrp, MPP_BUFFER_TYPE_NORMAL));
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to get buffer group: %s.\n"), get_err_mes(err));
+            return err;
+        }
+#else
+        AddMessage(RGY_LOG_ERROR, _T("decoder requires libavcodec.\n"));
+        return RGY_ERR_UNSUPPORTED;
+#endif //#if ENABLE_AVSW_READER
+    } else if (type != MPP_CTX_ENC) {
+        AddMessage(RGY_LOG_ERROR, _T("Unsupported context type %d.\n"), (int)type);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("initialized %s %s: latency %d ms, fps %.1f, size %d.\n"),
+        (type == MPP_CTX_DEC) ? _T("decoder") : _T("encoder"), CodecToStr(codec_dec_to_rgy(codec)).c_str(),
+        m_prm.latency, m_prm.fps, m_prm.size);
+    return RGY_ERR_NONE;
+}
+
+MPPStub::clock::time_point MPPStub::schedule(clock::time_point submit, clock::time_point done) {
+    const auto interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((m_prm.fps > 0.0) ? 1.0 / m_prm.fps : 0.0));
+    const auto start = std::max(submit, m_nextFree);
+    const auto finish = std::max(start + interval, done);
+    m_nextFree = finish;
+    m_stats.frames++;
+    m_stats.busyMs += std::chrono::duration<double, std::milli>(finish - start).count();
+    return finish + std::chrono::milliseconds(m_prm.latency);
+}
+
+MPP_RET MPPStub::decPutPacket(MppPacket packet) {
+#if ENABLE_AVSW_READER
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (!m_avctx) {
+        return MPP_ERR_INIT;
+    }
+    if (m_eosIn) {
+        return MPP_OK;
+    }
+    if (m_queue.size() + m_pending.size() >= MPP_STUB_QUEUE_DEPTH) {
+        return MPP_ERR_BUFFER_FULL;
+    }
+    const auto submit = clock::now();
+    const auto length = mpp_packet_get_length(packet);
+    if (length > 0) {
+        m_avpkt->data = (uint8_t *)mpp_packet_get_pos(packet);
+        m_avpkt->size = (int)length;
+        m_avpkt->pts = mpp_packet_get_pts(packet);
+        int ret = avcodec_send_packet(m_avctx.get(), m_avpkt.get()); // 参照カウントのないパケットはコピーされる
+        av_packet_unref(m_avpkt.get());
+        if (ret < 0 && ret != AVERROR(EAGAIN)) {
+            AddMessage(RGY_LOG_WARN, _T("Failed to decode packet: %s.\n"), qsv_av_err2str(ret).c_str());
+        }
+    }
+    if (mpp_packet_get_eos(packet)) {
+        avcodec_send_packet(m_avctx.get(), nullptr);
+        m_eosIn = true;
+    }
+    return decReceiveFrames(submit);
+#else
+    UNREFERENCED_PARAMETER(packet);
+    return MPP_ERR_INIT;
+#endif //#if ENABLE_AVSW_READER
+}
+
+MPP_RET MPPStub::decReceiveFrames(clock::time_point submit) {
+#if ENABLE_AVSW_READER
+    for (;;) {
+        int ret = avcodec_receive_frame(m_avctx.get(), m_avframe.get());
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        } else if (ret < 0) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to receive frame: %s.\n"), qsv_av_err2str(ret).c_str());
+            return MPP_NOK;
+        }
+        const auto pixfmt = (AVPixelFormat)m_avframe->format;
+        if (!decFormatSupported(pixfmt)) {
+            AddMessage(RGY_LOG_ERROR, _T("Unsupported pixel format %s: only 8-bit 4:2:0 (yuv420p/nv12) is supported.\n"),
+                char_to_tstring(av_get_pix_fmt_name(pixfmt)).c_str());
+            av_frame_unref(m_avframe.get());
+            return MPP_ERR_VALUE;
+        }
+        auto pending = std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+        if (!pending) {
+            av_frame_unref(m_avframe.get());
+            return MPP_ERR_MALLOC;
+        }
+        av_frame_move_ref(pending.get(), m_avframe.get());
+        m_pending.push_back(std::move(pending));
+    }
+    return decFlushPending(submit);
+#else
+    UNREFERENCED_PARAMETER(submit);
+    return MPP_ERR_INIT;
+#endif //#if ENABLE_AVSW_READER
+}
+
+// デコードしたフレームを順にMppFrameに変換する
+// 解像度が変わる場合はinfo_changeのフレームを返し、MPP_DEC_SET_INFO_CHANGE_READYを受け取るまで以降を保留する
+MPP_RET MPPStub::decFlushPending(clock::time_point submit) {
+#if ENABLE_AVSW_READER
+    while (!m_pending.empty() && !m_infoWaiting) {
+        const auto src = m_pending.front().get();
+        if (src->width != m_infoWidth || src->height != m_infoHeight) {
+            m_infoWidth = src->width;
+            m_infoHeight = src->height;
+            m_infoWaiting = true;
+            const int hor_stride = ALIGN(m_infoWidth, 16);
+            const int ver_stride = ALIGN(m_infoHeight, 16);
+            MppFrame info = nullptr;
+            mpp_frame_init(&info);
+            mpp_frame_set_width(info, m_infoWidth);
+            mpp_frame_set_height(info, m_infoHeight);
+            mpp_frame_set_hor_stride(info, hor_stride);
+            mpp_frame_set_ver_stride(info, ver_stride);
+            mpp_frame_set_fmt(info, MPP_FMT_YUV420SP);
+            mpp_frame_set_buf_size(info, (size_t)hor_stride * ver_stride * 3 / 2);
+            mpp_frame_set_info_change(info, 1);
+            m_queue.push_back({ info, clock::now() });
+            AddMessage(RGY_LOG_DEBUG, _T("info change: %dx%d.\n"), m_infoWidth, m_infoHeight);
+            break;
+        }
+        MppFrame frame = nullptr;
+        auto ret = decConvertFrame(src, &frame);
+        if (ret != MPP_OK) {
+            return ret;
+        }
+        m_pending.pop_front();
+        m_queue.push_back({ frame, schedule(submit, clock::now()) });
+    }
+    return MPP_OK;
+#else
+    UNREFERENCED_PARAMETER(submit);
+    return MPP_ERR_INIT;
+#endif //#if ENABLE_AVSW_READER
+}
+
+#if ENABLE_AVSW_READER
+MPP_RET MPPStub::decConvertFrame(const AVFrame *src, MppFrame *frame) {
+    // MPPのデコーダと同じく、NV12で16の倍数にアラインしたバッファを返す
+    const auto pixfmt = (AVPixelFormat)src->format;
+    const int width = src->width;
+    const int height = src->height;
+    const int hor_stride = ALIGN(width, 16);
+    const int ver_stride = ALIGN(height, 16);
+    const size_t bufSize = (size_t)hor_stride * ver_stride * 3 / 2;
+    MppBuffer buf = nullptr;
+    // info_changeで外部のbuffer groupが設定されていれば、そこから確保する
+    auto mret = mpp_buffer_get((m_extGrp) ? m_extGrp : m_frameGrp, &buf, bufSize);
+    if (mret != MPP_OK || !buf) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to get frame buffer (%d bytes).\n"), (int)bufSize);
+        return (mret != MPP_OK) ? mret : MPP_ERR_MALLOC;
+    }
+    auto dstY = (uint8_t *)mpp_buffer_get_ptr(buf);
+    auto dstC = dstY + (size_t)hor_stride * ver_stride;
+    for (int y = 0; y < height; y++) {
+        memcpy(dstY + (size_t)y * hor_stride, src->data[0] + (size_t)y * src->linesize[0], width);
+    }
+    const int widthC = (width + 1) >> 1;
+    const int heightC = (height + 1) >> 1;
+    if (pixfmt == AV_PIX_FMT_NV12) {
+        for (int y = 0; y < heightC; y++) {
+            memcpy(dstC + (size_t)y * hor_stride, src->data[1] + (size_t)y * src->linesize[1], widthC * 2);
+        }
+    } else {
+        for (int y = 0; y < heightC; y++) {
+            auto dst = dstC + (size_t)y * hor_stride;
+            auto srcU = src->data[1] + (size_t)y * src->linesize[1];
+            auto srcV = src->data[2] + (size_t)y * src->linesize[2];
+            for (int x = 0; x < widthC; x++) {
+                dst[2 * x + 0] = srcU[x];
+                dst[2 * x + 1] = srcV[x];
+            }
+        }
+    }
+    mpp_frame_init(frame);
+    mpp_frame_set_width(*frame, width);
+    mpp_frame_set_height(*frame, height);
+    mpp_frame_set_hor_stride(*frame, hor_stride);
+    mpp_frame_set_ver_stride(*frame, ver_stride);
+    mpp_frame_set_fmt(*frame, MPP_FMT_YUV420SP);
+    mpp_frame_set_pts(*frame, src->pts);
+    mpp_frame_set_buffer(*frame, buf);
+    mpp_frame_set_buf_size(*frame, bufSize);
+    mpp_buffer_put(buf); // 参照はframeが保持する
+    return MPP_OK;
+}
+#endif //#if ENABLE_AVSW_READER
+
+MPP_RET MPPStub::decGetFrame(MppFrame *frame) {
+    *frame = nullptr;
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_queue.empty()) {
+        if (m_eosIn && !m_eosOut && !m_infoWaiting) {
+            mpp_frame_init(frame);
+            mpp_frame_set_eos(*frame, 1);
+            m_eosOut = true;
+        }
+        return MPP_OK;
+    }
+    const auto ready = m_queue.front().ready;
+    if (ready > clock::now()) {
+        if (!m_eosIn) {
+            return MPP_OK; // まだ出力できない
+        }
+        // EOS後はパイプライン側が空回りするので、ここで待機する
+        std::this_thread::sleep_until(ready);
+    }
+    *frame = m_queue.front().frame;
+    m_queue.pop_front();
+    return MPP_OK;
+}
+
+MPP_RET MPPStub::encPutFrame(MppFrame frame) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (mpp_frame_get_eos(frame) && !mpp_frame_get_buffer(frame)) {
+        m_eosIn = true;
+        mpp_frame_deinit(&frame);
+        return MPP_OK;
+    }
+    if (m_queue.size() >= MPP_STUB_QUEUE_DEPTH) {
+        return MPP_ERR_BUFFER_FULL;
+    }
+    const auto submit = clock::now();
+    m_queue.push_back({ frame, schedule(submit, submit) });
+    if (mpp_frame_get_eos(frame)) {
+        m_eosIn = true;
+    }
+    return MPP_OK;
+}
+
+MPP_RET MPPStub::encGetPacket(MppPacket *packet) {
+    *packet = nullptr;
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_queue.empty()) {
+        if (m_eosIn && !m_eosOut) {
+            mpp_packet_init(packet, nullptr, 0);
+            mpp_packet_set_length(*packet, 0);
+            mpp_packet_set_eos(*packet);
+            m_eosOut = true;
+        }
+        return MPP_OK;
+    }
+    if (m_queue.front().ready > clock::now()) {
+        return MPP_OK; // まだ出力できない
+    }
+    auto frame = m_queue.front().frame;
+    m_queue.pop_front();
+
+    bool idr = m_outFrames == 0;
+    if (!idr && mpp_frame_has_meta(frame)) {
+        RK_S32 idr_req = 0;
+        idr = mpp_meta_get_s32(mpp_frame_get_meta(frame), KEY_INPUT_IDR_REQ, &idr_req) == MPP_OK && idr_req != 0;
+    }
+    // 中身は復号できないが、NALU/OBUの区切りだけは正しいパケットを生成する
+    const size_t payloadSize = (size_t)std::max(m_prm.size, 16) * (idr ? 4 : 1);
+    m_pktBuf.clear();
+    switch (m_codec) {
+    case MPP_VIDEO_CodingAVC:
+        m_pktBuf = { 0x00, 0x00, 0x00, 0x01, (uint8_t)(idr ? 0x65 : 0x41) };
+        break;
+    case MPP_VIDEO_CodingHEVC:
+        m_pktBuf = { 0x00, 0x00, 0x00, 0x01, (uint8_t)((idr ? 19 /*IDR_W_RADL*/ : 1 /*TRAIL_R*/) << 1), 0x01 };
+        break;
+    case MPP_VIDEO_CodingAV1:
+        m_pktBuf = { 0x12, 0x00, 0x32 }; // temporal delimiter + OBU_FRAME (has_size_field)
+        for (size_t size = payloadSize; ; ) { // leb128
+            const uint8_t byte = size & 0x7f;
+            size >>= 7;
+            m_pktBuf.push_back(byte | ((size) ? 0x80 : 0x00));
+            if (!size) break;
+        }
+        break;
+    default:
+        break;
+    }
+    const auto headerSize = m_pktBuf.size();
+    m_pktBuf.resize(headerSize + payloadSize);
+    mppStubFillPayload(m_pktBuf.data() + headerSize, payloadSize, (uint32_t)m_outFrames);
+    m_outFrames++;
+
+    mpp_packet_init(packet, m_pktBuf.data(), m_pktBuf.size());
+    mpp_packet_set_pts(*packet, mpp_frame_get_pts(frame));
+    auto meta = mpp_packet_get_meta(*packet);
+    mpp_meta_set_s32(meta, KEY_ENC_AVERAGE_QP, MPP_STUB_AVG_QP);
+    mpp_meta_set_frame(meta, KEY_INPUT_FRAME, frame); // 呼び出し側で解放される
+    return MPP_OK;
+}
+
+MPP_RET MPPStub::reset() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto& f : m_queue) {
+        mpp_frame_deinit(&f.frame);
+    }
+    m_queue.clear();
+    m_eosIn = false;
+    m_eosOut = false;
+    m_infoWaiting = false;
+#if ENABLE_AVSW_READER
+    m_pending.clear();
+    if (m_avctx) {
+        avcodec_flush_buffers(m_avctx.get());
+    }
+#endif //#if ENABLE_AVSW_READER
+    return MPP_OK;
+}
+
+MPP_RET MPPStub::control(MpiCmd cmd, MppParam param) {
+    switch (cmd) {
+    case MPP_DEC_SET_EXT_BUF_GROUP: {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_extGrp = (MppBufferGroup)param;
+        break;
+    }
+    case MPP_DEC_SET_INFO_CHANGE_READY: {
+        // 保留していたフレームの出力を再開する
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_infoWaiting = false;
+        return decFlushPending(clock::now());
+    }
+    case MPP_ENC_GET_HDR_SYNC:
+        // ヘッダは出力しない
+        if (param) {
+            mpp_packet_set_length((MppPacket)param, 0);
+        }
+        break;
+    default:
+        // 設定系はすべて受け付ける
+        break;
+    }
+    return MPP_OK;
+}
+
+MPP_RET MPPStub::stubDecPutPacket(MppCtx ctx, MppPacket packet) {
+    return ((MPPStub *)ctx)->decPutPacket(packet);
+}
+
+MPP_RET MPPStub::stubDecGetFrame(MppCtx ctx, MppFrame *frame) {
+    return ((MPPStub *)ctx)->decGetFrame(frame);
+}
+
+MPP_RET MPPStub::stubEncPutFrame(MppCtx ctx, MppFrame frame) {
+    return ((MPPStub *)ctx)->encPutFrame(frame);
+}
+
+MPP_RET MPPStub::stubEncGetPacket(MppCtx ctx, MppPacket *packet) {
+    return ((MPPStub *)ctx)->encGetPacket(packet);
+}
+
+MPP_RET MPPStub::stubReset(MppCtx ctx) {
+    return ((MPPStub *)ctx)->reset();
+}
+
+MPP_RET MPPStub::stubControl(MppCtx ctx, MpiCmd cmd, MppParam param) {
+    return ((MPPStub *)ctx)->control(cmd, param);
+}
@@ -0,0 +1,135 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __MPP_STUB_H__
+#define __MPP_STUB_H__
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_avutil.h"
+#include "rk_mpi.h"
+#include "mpp_param.h"
+
+// ハードウェアなしでパイプラインを動かすための、MppApi互換のソフトウェア実装
+// デコーダはlibavcodecでデコードしてNV12のMppFrameを返し (8bit 4:2:0のみ対応)、
+// MPPのデコーダと同じく、最初のフレームと解像度の変更時にはinfo_changeを通知する
+// エンコーダは入力フレームに対して決定的な内容のパケットを返す
+// 処理遅延と処理速度の上限を設定でき、パイプライン自体のオーバーヘッドを計測するのに使用する
+
+// --mpp-stub指定時は、DRM/IONのバッファの代わりに通常のメモリを使用する
+void mppStubSetEnabled(bool enable);
+bool mppStubEnabled();
+MppBufferType mppBufferType(MppBufferType type);
+
+struct MPPStubStats {
+    int frames;    // 処理したフレーム数
+    double busyMs; // ハードウェア処理時間相当 (ms)
+
+    MPPStubStats() : frames(0), busyMs(0.0) {};
+};
+
+class MPPStub {
+public:
+    using clock = std::chrono::steady_clock;
+
+    MPPStub(const MPPParamStub& prm, std::shared_ptr<RGYLog> log);
+    ~MPPStub();
+
+    MppApi *api() { return &m_api; }
+    RGY_ERR init(MppCtxType type, MppCodingType codec);
+    void setExtraData(const uint8_t *data, size_t size);
+    MPPStubStats stats();
+#if ENABLE_AVSW_READER
+    // MPPのデコーダの出力に合わせ、8bit 4:2:0のみ受け付ける
+    static bool decFormatSupported(const AVPixelFormat pixfmt);
+#endif //#if ENABLE_AVSW_READER
+protected:
+    struct StubFrame {
+        MppFrame frame;
+        clock::time_point ready;
+    };
+
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+    // 処理開始・終了時刻から、出力可能になる時刻を決める
+    clock::time_point schedule(clock::time_point submit, clock::time_point done);
+
+    MPP_RET decPutPacket(MppPacket packet);
+    MPP_RET decGetFrame(MppFrame *frame);
+    MPP_RET decReceiveFrames(clock::time_point submit);
+    MPP_RET decFlushPending(clock::time_point submit);
+#if ENABLE_AVSW_READER
+    MPP_RET decConvertFrame(const AVFrame *src, MppFrame *frame);
+#endif //#if ENABLE_AVSW_READER
+    MPP_RET encPutFrame(MppFrame frame);
+    MPP_RET encGetPacket(MppPacket *packet);
+    MPP_RET reset();
+    MPP_RET control(MpiCmd cmd, MppParam param);
+
+    static MPP_RET stubDecPutPacket(MppCtx ctx, MppPacket packet);
+    static MPP_RET stubDecGetFrame(MppCtx ctx, MppFrame *frame);
+    static MPP_RET stubEncPutFrame(MppCtx ctx, MppFrame frame);
+    static MPP_RET stubEncGetPacket(MppCtx ctx, MppPacket *packet);
+    static MPP_RET stubReset(MppCtx ctx);
+    static MPP_RET stubControl(MppCtx ctx, MpiCmd cmd, MppParam param);
+
+    MPPParamStub m_prm;
+    std::shared_ptr<RGYLog> m_log;
+    MppApi m_api;
+    MppCtxType m_type;
+    MppCodingType m_codec;
+    std::mutex m_mtx;
+    std::deque<StubFrame> m_queue;   // 出力待ちのフレーム
+    clock::time_point m_nextFree;    // 次のフレームの処理を開始できる時刻
+    MPPStubStats m_stats;
+    bool m_eosIn;                    // EOSを受け取った
+    bool m_eosOut;                   // EOSを返した
+    int m_outFrames;                 // 出力したフレーム数
+    // エンコーダ
+    std::vector<uint8_t> m_pktBuf;
+    // デコーダ
+    std::vector<uint8_t> m_extradata;
+#if ENABLE_AVSW_READER
+    std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>> m_avctx;
+    std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> m_avpkt;
+    std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>> m_avframe;
+    std::deque<std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>> m_pending; // MppFrameへの変換待ちのフレーム
+#endif //#if ENABLE_AVSW_READER
+    int m_infoWidth;                 // info_changeで通知した解像度
+    int m_infoHeight;
+    bool m_infoWaiting;              // MPP_DEC_SET_INFO_CHANGE_READYを待っている
+    MppBufferGroup m_frameGrp;
+    MppBufferGroup m_extGrp;         // MPP_DEC_SET_EXT_BUF_GROUPで設定されたbuffer group
+};
+
+#endif //__MPP_STUB_H__
@@ -0,0 +1,281 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "rgy_util.h"
+#include "rgy_filesystem.h"
+#include "mpp_vpp_placement.h"
+
+VppPlacementCost::VppPlacementCost() :
+    rga{ -1.0, -1.0, -1.0 },
+    cl{ -1.0, -1.0, -1.0 },
+    transfer(-1.0) {
+}
+
+static const char *VPP_PLACEMENT_OP_NAME[] = { "crop", "cspconv", "resize" };
+static_assert(_countof(VPP_PLACEMENT_OP_NAME) == (int)VppPlacementOp::COUNT, "VPP_PLACEMENT_OP_NAME");
+
+static int vppPlacementOpIndex(const VppType type) {
+    switch (type) {
+    case VppType::RGA_CROP:
+    case VppType::CL_CROP:     return (int)VppPlacementOp::CROP;
+    case VppType::RGA_CSPCONV: return (int)VppPlacementOp::CSPCONV;
+    case VppType::RGA_RESIZE:
+    case VppType::CL_RESIZE:   return (int)VppPlacementOp::RESIZE;
+    default: return -1;
+    }
+}
+
+double VppPlacementCost::get(const VppType type) const {
+    const int op = vppPlacementOpIndex(type);
+    if (op < 0) {
+        return -1.0;
+    }
+    return (getVppFilterType(type) == VppFilterType::FILTER_OPENCL) ? cl[op] : rga[op];
+}
+
+void VppPlacementCost::set(const VppType type, const double value) {
+    const int op = vppPlacementOpIndex(type);
+    if (op < 0) {
+        return;
+    }
+    ((getVppFilterType(type) == VppFilterType::FILTER_OPENCL) ? cl[op] : rga[op]) = value;
+}
+
+bool VppPlacementCost::load(const std::string& path, const std::string& key) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        std::string lineKey;
+        if (!(iss >> lineKey) || lineKey != key) continue;
+        *this = VppPlacementCost();
+        std::string item;
+        while (iss >> item) {
+            const auto pos = item.find('=');
+            if (pos == std::string::npos) continue;
+            const auto name = item.substr(0, pos);
+            double value = 0.0;
+            try {
+                value = std::stod(item.substr(pos + 1));
+            } catch (...) {
+                continue;
+            }
+            if (value <= 0.0) continue;
+            if (name == "transfer") {
+                transfer = value;
+                continue;
+            }
+            for (int i = 0; i < (int)VppPlacementOp::COUNT; i++) {
+                if (name == std::string("rga_") + VPP_PLACEMENT_OP_NAME[i]) rga[i] = value;
+                if (name == std::string("cl_")  + VPP_PLACEMENT_OP_NAME[i]) cl[i]  = value;
+            }
+        }
+        return transfer > 0.0;
+    }
+    return false;
+}
+
+bool VppPlacementCost::save(const std::string& path, const std::string& key) const {
+    const auto dir = PathRemoveFileSpecFixed(path).second;
+    if (!rgy_directory_exists(dir) && !CreateDirectoryRecursive(dir.c_str())) {
+        return false;
+    }
+    std::vector<std::string> lines;
+    {
+        std::ifstream ifs(path);
+        std::string line;
+        while (ifs && std::getline(ifs, line)) {
+            std::istringstream iss(line);
+            std::string lineKey;
+            if ((iss >> lineKey) && lineKey != key) {
+                lines.push_back(line);
+            }
+        }
+    }
+    std::ostringstream oss;
+    oss << key << " transfer=" << transfer;
+    for (int i = 0; i < (int)VppPlacementOp::COUNT; i++) {
+        if (rga[i] > 0.0) oss << " rga_" << VPP_PLACEMENT_OP_NAME[i] << "=" << rga[i];
+        if (cl[i]  > 0.0) oss << " cl_"  << VPP_PLACEMENT_OP_NAME[i] << "=" << cl[i];
+    }
+    lines.push_back(oss.str());
+
+    std::ofstream ofs(path);
+    if (!ofs) {
+        return false;
+    }
+    for (const auto& line : lines) {
+        ofs << line << std::endl;
+    }
+    return ofs.good();
+}
+
+tstring VppPlacementCost::print() const {
+    tstring str = strsprintf(_T("transfer %.3f"), transfer);
+    for (int i = 0; i < (int)VppPlacementOp::COUNT; i++) {
+        str += strsprintf(_T(", rga_%s %.3f, cl_%s %.3f"),
+            char_to_tstring(VPP_PLACEMENT_OP_NAME[i]).c_str(), rga[i], char_to_tstring(VPP_PLACEMENT_OP_NAME[i]).c_str(), cl[i]);
+    }
+    return str + _T(" ns/pixel");
+}
+
+std::string vppPlacementCostCachePath() {
+    std::filesystem::path dir;
+    if (const char *cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && cache[0] != '\0') {
+        dir = cache;
+    } else if (const char *home = std::getenv("HOME"); home != nullptr && home[0] != '\0') {
+        dir = std::filesystem::path(home) / ".cache";
+    } else {
+        return "";
+    }
+    return (dir / "rkmppenc" / "vpp_placement_cost.txt").string();
+}
+
+// SoCの名前 (device-treeのcompatibleの最後の要素、例: rockchip,rk3588)
+static std::string vppPlacementSocName() {
+    std::ifstream ifs("/proc/device-tree/compatible", std::ios::binary);
+    if (!ifs) {
+        return "unknown";
+    }
+    std::string soc, item;
+    while (std::getline(ifs, item, '\0')) {
+        if (item.length() > 0) soc = item;
+    }
+    return (soc.length() > 0) ? soc : "unknown";
+}
+
+std::string vppPlacementCostKey(const std::string& clDeviceName, const RGY_CSP csp, const int inWidth, const int inHeight, const int outWidth, const int outHeight) {
+    auto key = vppPlacementSocName() + "/" + clDeviceName + "/" + tchar_to_string(RGY_CSP_NAMES[csp])
+        + strsprintf("/%dx%d->%dx%d", inWidth, inHeight, outWidth, outHeight);
+    // 空白区切りで保存するので、空白は置き換える
+    std::replace_if(key.begin(), key.end(), [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }, '_');
+    return key;
+}
+
+double vppPlacementMeasureTransfer(const int width, const int height) {
+    // OpenCLのフレームをmapして、CPUで色空間変換しながらMppBufferにコピーするのとほぼ同じ、
+    // NV12 1フレーム分の読み書きを計測する
+    const size_t frameSize = (size_t)width * height * 3 / 2;
+    std::vector<uint8_t> src(frameSize, 16), dst(frameSize);
+    const int loops = 8;
+    memcpy(dst.data(), src.data(), frameSize); // warm up
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        src[i] = (uint8_t)i;
+        memcpy(dst.data(), src.data(), frameSize);
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    // map/unmapでのキャッシュ操作分を含め、コピー2回分とする
+    return std::max(0.01, 2.0 * (double)elapsed / loops / ((double)width * height));
+}
+
+double vppPlacementMeasure(const int pixels, std::function<RGY_ERR()> func) {
+    if (pixels <= 0 || func() != RGY_ERR_NONE) { // warm up
+        return -1.0;
+    }
+    const int loops = 8;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        if (func() != RGY_ERR_NONE) {
+            return -1.0;
+        }
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return std::max(0.001, (double)elapsed / loops / pixels);
+}
+
+static bool vppPlacementIsResize(const VppType type) {
+    return type == VppType::RGA_RESIZE || type == VppType::CL_RESIZE;
+}
+
+int vppPlacementSelect(std::vector<VppPlacementCandidate>& candidates, const VppPlacementCost& cost, const int inPixels, const int outPixels, tstring& log) {
+    log.clear();
+    // 未計測の処理が含まれる場合は推定できないので、配置を変更しない
+    if (cost.transfer <= 0.0) {
+        log += _T("  no measurement for transfer, keep default placement.\n");
+        return -1;
+    }
+    for (const auto& cand : candidates) {
+        for (const auto type : cand.pipeline) {
+            if (vppPlacementOpIndex(type) >= 0 && cost.get(type) <= 0.0) {
+                log += strsprintf(_T("  no measurement for %s, keep default placement.\n"), vppfilter_type_to_str(type).c_str());
+                return -1;
+            }
+        }
+    }
+    int selected = -1;
+    for (int icand = 0; icand < (int)candidates.size(); icand++) {
+        auto& cand = candidates[icand];
+        cand.cost = 0.0;
+        cand.transitions = 0;
+        bool onCL = false; // 入力はMppBuffer
+        int pixels = inPixels;
+        tstring desc;
+        for (const auto type : cand.pipeline) {
+            const bool filterCL = getVppFilterType(type) == VppFilterType::FILTER_OPENCL;
+            if (filterCL != onCL) {
+                cand.transitions++;
+                cand.cost += cost.transfer * pixels;
+                onCL = filterCL;
+            }
+            if (vppPlacementOpIndex(type) >= 0) {
+                // CL_CROPはcropと色空間変換を同時に行うので、cropのコストとする
+                cand.cost += cost.get(type) * pixels;
+            }
+            if (vppPlacementIsResize(type)) {
+                pixels = outPixels;
+            }
+            if (desc.length() > 0) desc += _T(",");
+            desc += vppfilter_type_to_str(type);
+        }
+        if (onCL) { // エンコーダへの入力はMppBuffer
+            cand.transitions++;
+            cand.cost += cost.transfer * pixels;
+        }
+        cand.cost *= 1e-6; // ns -> ms
+        log += strsprintf(_T("  candidate %d: %.3f ms/frame, %d transitions: %s\n"), icand, cand.cost, cand.transitions, desc.c_str());
+        if (selected < 0
+            || cand.cost < candidates[selected].cost
+            || (cand.cost == candidates[selected].cost && cand.transitions < candidates[selected].transitions)) {
+            selected = icand;
+        }
+    }
+    if (selected >= 0) {
+        log += strsprintf(_T("  selected candidate %d.\n"), selected);
+    }
+    return selected;
+}
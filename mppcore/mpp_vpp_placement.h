@@ -0,0 +1,88 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __MPP_VPP_PLACEMENT_H__
+#define __MPP_VPP_PLACEMENT_H__
+
+#include <vector>
+#include <string>
+#include <functional>
+#include "rgy_tchar.h"
+#include "rgy_err.h"
+#include "rgy_prm.h"
+
+// RGA/OpenCLのどちらでも実行できる処理
+enum class VppPlacementOp : int {
+    CROP,
+    CSPCONV,
+    RESIZE,
+    COUNT
+};
+
+// フィルタの配置を決めるための1画素あたりのコスト [ns/pixel]
+// 負の値は未計測を表す (既定値は持たず、計測結果がない場合は配置を変更しない)
+struct VppPlacementCost {
+    double rga[(int)VppPlacementOp::COUNT];
+    double cl[(int)VppPlacementOp::COUNT];
+    double transfer; // MppBuffer <-> OpenCL間の受け渡し (map + CPUでのコピー)
+
+    VppPlacementCost();
+    // typeのコスト、未計測またはRGA/OpenCLで実行しない処理の場合は負の値を返す
+    double get(const VppType type) const;
+    void set(const VppType type, const double value);
+    // キャッシュのうち、keyに一致する行を読み込む
+    bool load(const std::string& path, const std::string& key);
+    // キャッシュのkeyに一致する行を置き換える (なければ追加する)
+    bool save(const std::string& path, const std::string& key) const;
+    tstring print() const;
+};
+
+// 計測結果のキャッシュの保存先
+std::string vppPlacementCostCachePath();
+// キャッシュのkey、計測結果はSoC/OpenCLデバイスと解像度ごとに異なるので、それらを含める
+std::string vppPlacementCostKey(const std::string& clDeviceName, const RGY_CSP csp, const int inWidth, const int inHeight, const int outWidth, const int outHeight);
+// MppBuffer <-> OpenCL間の受け渡しのコストを簡易計測する [ns/pixel]
+double vppPlacementMeasureTransfer(const int width, const int height);
+// funcを数回実行して1回あたりの処理時間を計測し、pixelsで割った値[ns/pixel]を返す
+// funcが失敗した場合は負の値を返す
+double vppPlacementMeasure(const int pixels, std::function<RGY_ERR()> func);
+
+struct VppPlacementCandidate {
+    std::vector<VppType> pipeline;
+    double cost;     // 推定処理時間 [ms/frame]
+    int transitions; // RGA(MppBuffer) <-> OpenCLの切り替え回数
+
+    VppPlacementCandidate(const std::vector<VppType>& pipeline_) : pipeline(pipeline_), cost(0.0), transitions(0) {};
+};
+
+// 各候補の推定処理時間と切り替え回数を計算し、推定処理時間が最小(同じなら切り替えの少ない)候補のindexを返す
+// いずれかの候補に未計測の処理が含まれる場合は-1を返す (配置を変更しない)
+// 判断の過程はlogに出力する
+int vppPlacementSelect(std::vector<VppPlacementCandidate>& candidates, const VppPlacementCost& cost, const int inPixels, const int outPixels, tstring& log);
+
+#endif //__MPP_VPP_PLACEMENT_H__
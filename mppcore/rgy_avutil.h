@@ -34,7 +34,10 @@
 
 #if ENABLE_AVSW_READER
 #include <algorithm>
+#include <array>
 #include <vector>
+#include <mutex>
+#include <atomic>
 
 #pragma warning (push)
 #pragma warning (disable: 4244)
@@ -122,46 +125,38 @@ struct StreamInfoOptDeleter {
 };
 
 #define RGYPOOLAV_DEBUG 0
-#define RGYPOOLAV_COUNT 0
+#define RGYPOOLAV_COUNT 0 // 1にすると終了時に統計情報をstderrに出力する
 
 template<typename T, T *Talloc(), void Tunref(T* ptr), void Tfree(T** ptr)>
 class RGYPoolAV {
 private:
     RGYQueueMPMP<T*> queue;
-#if RGYPOOLAV_COUNT
-    std::atomic<uint64_t> allocated, reused;
-#endif
+    std::atomic<uint64_t> allocated, reused; // 統計情報
 public:
-    RGYPoolAV() : queue()
-#if RGYPOOLAV_COUNT
-        , allocated(0), reused(0)
-#endif
-    { queue.init(); }
+    RGYPoolAV() : queue(), allocated(0), reused(0) { queue.init(); }
     ~RGYPoolAV() {
 #if RGYPOOLAV_COUNT
-        fprintf(stderr, "RGYPoolAV: allocated %lld, reused %lld\n", allocated, reused);
+        fprintf(stderr, "RGYPoolAV: allocated %llu, reused %llu\n", (unsigned long long)allocated, (unsigned long long)reused);
 #endif
         queue.close([](T **ptr) { Tfree(ptr); });
     }
+    uint64_t allocatedCount() const { return allocated.load(std::memory_order_relaxed); }
+    uint64_t reusedCount() const { return reused.load(std::memory_order_relaxed); }
     std::unique_ptr<T, RGYAVDeleter<T>> getUnique(T *ptr) {
         return std::unique_ptr<T, RGYAVDeleter<T>>(ptr, RGYAVDeleter<T>([this](T **ptr) { returnFree(ptr); }));
     }
     std::unique_ptr<T, RGYAVDeleter<T>> getFree() {
 #if RGYPOOLAV_DEBUG
         T *ptr = Talloc();
+        allocated.fetch_add(1, std::memory_order_relaxed);
 #else
         T *ptr = nullptr;
         if (!queue.front_copy_and_pop_no_lock(&ptr) || ptr == nullptr) {
             ptr = Talloc();
-#if RGYPOOLAV_COUNT
-            allocated++;
-#endif
-        }
-#if RGYPOOLAV_COUNT
-        else {
-            reused++;
+            allocated.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            reused.fetch_add(1, std::memory_order_relaxed);
         }
-#endif
 #endif
         return getUnique(ptr);
     }
@@ -180,6 +175,119 @@ public:
 using RGYPoolAVPacket = RGYPoolAV<AVPacket, av_packet_alloc, av_packet_unref, av_packet_free>;
 using RGYPoolAVFrame = RGYPoolAV<AVFrame, av_frame_alloc, av_frame_unref, av_frame_free>;
 
+// AVPacketのpayload用のバッファのpool
+// AVBufferPoolは固定サイズなので、2のべき乗のサイズごとにpoolを用意し、
+// 要求サイズ以上で最小のpoolから取得する (取得したバッファはav_buffer_unrefでpoolに戻る)
+// AVBufferPoolは空きバッファを縮小しないので、一定回数の要求の間使われなかったサイズのpoolは破棄する
+// (使用中のバッファは返却時に解放される)
+class RGYPoolAVBuffer {
+public:
+    static const int SIZE_MIN_LOG2 = 12; // 4KB
+    static const int SIZE_MAX_LOG2 = 24; // 16MB, これより大きいものはpoolしない
+    static const uint64_t TRIM_CHECK_INTERVAL = 1024; // 要求この回数ごとに未使用のpoolを確認する
+    static const uint64_t TRIM_IDLE_REQUESTS = 8192;  // この回数の要求の間使われなかったpoolを破棄する
+private:
+    using alloc_size_t = RGYArgN<1U, std::remove_pointer<RGYArgN<2U, decltype(av_buffer_pool_init2)>::type>::type>::type;
+    struct SizeClass {
+        std::mutex mtx;
+        AVBufferPool *pool;
+        uint64_t lastUsed; // 最後に使用した時点のrequestedの値
+    };
+    std::array<SizeClass, SIZE_MAX_LOG2 - SIZE_MIN_LOG2 + 1> classes;
+    std::atomic<uint64_t> allocated, requested, trimmed; // 統計情報
+
+    static AVBufferRef *allocBuffer(void *opaque, alloc_size_t size) {
+        ((RGYPoolAVBuffer *)opaque)->allocated.fetch_add(1, std::memory_order_relaxed);
+        return av_buffer_alloc(size);
+    }
+public:
+    RGYPoolAVBuffer() : classes(), allocated(0), requested(0), trimmed(0) {
+        for (auto& c : classes) {
+            c.pool = nullptr;
+            c.lastUsed = 0;
+        }
+    }
+    ~RGYPoolAVBuffer() {
+        // 使用中のバッファは、すべて返却された時点で解放される
+        for (auto& c : classes) {
+            std::lock_guard<std::mutex> lock(c.mtx);
+            if (c.pool) {
+                av_buffer_pool_uninit(&c.pool);
+            }
+        }
+    }
+    AVBufferRef *get(const size_t size) {
+        const auto req = requested.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (req % TRIM_CHECK_INTERVAL == 0) {
+            trim(TRIM_IDLE_REQUESTS);
+        }
+        int idx = 0;
+        while (idx + SIZE_MIN_LOG2 <= SIZE_MAX_LOG2 && ((size_t)1 << (idx + SIZE_MIN_LOG2)) < size) {
+            idx++;
+        }
+        if (idx + SIZE_MIN_LOG2 > SIZE_MAX_LOG2) {
+            allocated.fetch_add(1, std::memory_order_relaxed);
+            return av_buffer_alloc((alloc_size_t)size);
+        }
+        auto& c = classes[idx];
+        std::lock_guard<std::mutex> lock(c.mtx); // trimとの競合を避ける
+        if (c.pool == nullptr) {
+            c.pool = av_buffer_pool_init2((alloc_size_t)((size_t)1 << (idx + SIZE_MIN_LOG2)), this, allocBuffer, nullptr);
+            if (c.pool == nullptr) {
+                return nullptr;
+            }
+        }
+        c.lastUsed = req;
+        return av_buffer_pool_get(c.pool);
+    }
+    // idleRequests回以上の要求の間使われなかったpoolを破棄し、空きバッファを解放する
+    int trim(const uint64_t idleRequests) {
+        const auto req = requested.load(std::memory_order_relaxed);
+        int count = 0;
+        for (auto& c : classes) {
+            std::lock_guard<std::mutex> lock(c.mtx);
+            if (c.pool && req - c.lastUsed >= idleRequests) {
+                av_buffer_pool_uninit(&c.pool);
+                count++;
+            }
+        }
+        trimmed.fetch_add(count, std::memory_order_relaxed);
+        return count;
+    }
+    // av_new_packetの代わり
+    int newPacket(AVPacket *pkt, const int size) {
+        if (size < 0 || size >= INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) {
+            return AVERROR(EINVAL);
+        }
+        auto buf = get((size_t)size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (buf == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        av_packet_unref(pkt);
+        pkt->buf = buf;
+        pkt->data = buf->data;
+        pkt->size = size;
+        memset(pkt->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        return 0;
+    }
+    int activePoolCount() {
+        int count = 0;
+        for (auto& c : classes) {
+            std::lock_guard<std::mutex> lock(c.mtx);
+            count += (c.pool) ? 1 : 0;
+        }
+        return count;
+    }
+    uint64_t requestedCount() const { return requested.load(std::memory_order_relaxed); }
+    uint64_t allocatedCount() const { return allocated.load(std::memory_order_relaxed); }
+    uint64_t reusedCount() const {
+        const auto req = requested.load(std::memory_order_relaxed);
+        const auto alloc = allocated.load(std::memory_order_relaxed);
+        return (req > alloc) ? req - alloc : 0;
+    }
+    uint64_t trimmedCount() const { return trimmed.load(std::memory_order_relaxed); }
+};
+
 typedef struct CodecMap {
     AVCodecID avcodec_id;   //avcodecのコーデックID
     RGY_CODEC rgy_codec; //QSVのfourcc
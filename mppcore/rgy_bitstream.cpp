@@ -45,8 +45,35 @@ std::vector<uint8_t> unnal(const uint8_t *ptr, size_t len) {
     return data;
 }
 
+// emulation prevention byteを取り除き、取り除いた後のサイズを返す
+size_t unnal_inplace(uint8_t *ptr, size_t len) {
+    if (len <= 2) {
+        return len;
+    }
+    // 書き込みで上書きされるので、直前の2byteは元の値を保持しておく
+    uint8_t prev2 = ptr[0], prev1 = ptr[1];
+    size_t j = 2;
+    for (size_t i = 2; i < len; i++) {
+        const uint8_t cur = ptr[i];
+        if (!(prev2 == 0x00 && prev1 == 0x00 && cur == 0x03)) {
+            ptr[j++] = cur;
+        }
+        prev2 = prev1;
+        prev1 = cur;
+    }
+    return j;
+}
+
 void to_nal(std::vector<uint8_t>& data) {
-    for (auto it = data.begin(); it < data.end() - 2; it++) {
+    to_nal(data, 0);
+}
+
+// data[offset]以降にemulation prevention byteを挿入する
+void to_nal(std::vector<uint8_t>& data, const size_t offset) {
+    if (data.size() < offset + 3) {
+        return;
+    }
+    for (auto it = data.begin() + offset; it < data.end() - 2; it++) {
         if (*it == 0
             && *(it + 1) == 0
             && (*(it + 2) & (~(0x03))) == 0) {
@@ -130,21 +157,36 @@ std::vector<uint8_t> get_av1_uleb_size_data(uint64_t value) {
 }
 
 std::vector<uint8_t> gen_av1_obu_metadata(const uint8_t metadata_type, const std::vector<uint8_t>& metadata) {
-    if (metadata.size() == 0) {
-        return metadata;
-    }
     std::vector<uint8_t> metadata_buf;
-    metadata_buf.reserve(128);
-    const uint8_t obu_header = gen_obu_header(OBU_METADATA);
-    const size_t payload_size = sizeof(metadata_type) + metadata.size() + 1 /*last 0x80*/;
-    metadata_buf.push_back(obu_header);
-    vector_cat(metadata_buf, get_av1_uleb_size_data(payload_size));
-    metadata_buf.push_back(metadata_type);
-    vector_cat(metadata_buf, metadata);
-    metadata_buf.push_back(0x80);
+    if (metadata.size() > 0) {
+        metadata_buf.reserve(128);
+        add_av1_obu_metadata(metadata_buf, metadata_type, nullptr, 0, metadata.data(), metadata.size());
+    }
     return metadata_buf;
 }
 
+// bufの末尾にprefix + metadataを中身とするmetadata OBUを追加する
+void add_av1_obu_metadata(std::vector<uint8_t>& buf, const uint8_t metadata_type, const uint8_t *prefix, const size_t prefix_size, const uint8_t *metadata, const size_t metadata_size) {
+    if (prefix_size + metadata_size == 0) {
+        return;
+    }
+    const uint8_t obu_header = gen_obu_header(OBU_METADATA);
+    uint64_t payload_size = sizeof(metadata_type) + prefix_size + metadata_size + 1 /*last 0x80*/;
+    buf.push_back(obu_header);
+    do {
+        uint8_t byte = payload_size & 0x7f;
+        payload_size >>= 7;
+        if (payload_size != 0) {
+            byte |= 0x80; // 続きがある
+        }
+        buf.push_back(byte);
+    } while (payload_size != 0);
+    buf.push_back(metadata_type);
+    buf.insert(buf.end(), prefix, prefix + prefix_size);
+    buf.insert(buf.end(), metadata, metadata + metadata_size);
+    buf.push_back(0x80);
+}
+
 RGYHDRMetadataPrm::RGYHDRMetadataPrm() : maxcll(-1), maxfall(-1), contentlight_set(false), masterdisplay(), masterdisplay_set(false), atcSei(RGY_TRANSFER_UNKNOWN) {
     memset(&masterdisplay, 0, sizeof(masterdisplay));
 }
@@ -527,68 +569,68 @@ int DOVIRpu::get_next_rpu(std::vector<uint8_t>& bytes) {
         return 1;
     }
 
-    bytes.resize(next_size);
+    // bytesの末尾に追加する
     const auto dataptr = m_buffer.data() + m_dataoffset;
-    memcpy(bytes.data(), dataptr, next_size);
+    bytes.insert(bytes.end(), dataptr, dataptr + next_size);
     m_dataoffset += next_size;
     m_datasize -= next_size;
     return 0;
 }
 
+// idのrpuをbytesの末尾に追加する
 int DOVIRpu::get_next_rpu(std::vector<uint8_t>& bytes, const int64_t id) {
-    bytes.clear();
-    for (; m_count <= id; m_count++) {
+    if (auto it = m_rpus.find(id); it != m_rpus.end()) {
+        vector_cat(bytes, it->second);
+        m_rpus.erase(it);
+        return 0;
+    }
+    if (m_count > id) {
+        return 1;
+    }
+    // 順番に要求される場合は一時領域を経由せず、直接bytesに読み込む
+    for (; m_count < id; m_count++) {
         std::vector<uint8_t> rpu;
         if (int ret = get_next_rpu(rpu); ret != 0) {
             return ret;
         }
-        m_rpus[m_count] = rpu;
+        m_rpus[m_count] = std::move(rpu);
     }
-    if (auto it = m_rpus.find(id); it != m_rpus.end()) {
-        bytes = std::move(it->second);
-        m_rpus.erase(it);
-    } else {
-        return 1;
+    if (int ret = get_next_rpu(bytes); ret != 0) {
+        return ret;
     }
+    m_count++;
     return 0;
 }
 
 int DOVIRpu::get_next_rpu_nal(std::vector<uint8_t>& bytes, const int64_t id) {
-    std::vector<uint8_t> rpu;
-    if (int ret = get_next_rpu(rpu, id); ret != 0) {
-        return ret;
-    }
-    //to_nal(rpu); // get_next_rpuはすでにこの処理を実施済みのものを返す
-    if (rpu.back() == 0x00) { // 最後が0x00の場合
-        rpu.push_back(0x03);
-    }
-
     bytes.resize(sizeof(DOVIRpu::rpu_header));
     memcpy(bytes.data(), &DOVIRpu::rpu_header, sizeof(DOVIRpu::rpu_header));
 
     uint16_t u16 = 0x00;
     u16 |= (NALU_HEVC_UNSPECIFIED << 9) | 1;
     add_u16(bytes, u16);
-    vector_cat(bytes, rpu);
+    if (int ret = get_next_rpu(bytes, id); ret != 0) {
+        bytes.clear();
+        return ret;
+    }
+    //to_nal(rpu); // get_next_rpuはすでにこの処理を実施済みのものを返す
+    if (bytes.back() == 0x00) { // 最後が0x00の場合
+        bytes.push_back(0x03);
+    }
     return 0;
 }
 
 int DOVIRpu::get_next_rpu_obu(std::vector<uint8_t>& bytes, const int64_t id) {
-    std::vector<uint8_t> tmp;
-    if (int ret = get_next_rpu(tmp, id); ret != 0) {
+    bytes.clear();
+    m_rpuTmp.clear();
+    if (int ret = get_next_rpu(m_rpuTmp, id); ret != 0) {
         return ret;
     }
-
-    auto rpu = unnal(tmp.data(), tmp.size());
-
-    std::vector<uint8_t> buf;
-    if (rpu.size() > sizeof(av1_itut_t35_header_dovirpu) && memcmp(rpu.data(), av1_itut_t35_header_dovirpu, sizeof(av1_itut_t35_header_dovirpu)) == 0) {
-        buf = rpu;
-    } else {
-        buf = make_vector<uint8_t>(av1_itut_t35_header_dovirpu);
-        vector_cat(buf, rpu);
-    }
-    bytes = gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, buf);
+    const auto rpu_size = unnal_inplace(m_rpuTmp.data(), m_rpuTmp.size());
+    const bool has_t35_header = rpu_size > sizeof(av1_itut_t35_header_dovirpu) && memcmp(m_rpuTmp.data(), av1_itut_t35_header_dovirpu, sizeof(av1_itut_t35_header_dovirpu)) == 0;
+    add_av1_obu_metadata(bytes, AV1_METADATA_TYPE_ITUT_T35,
+        (has_t35_header) ? nullptr : av1_itut_t35_header_dovirpu, (has_t35_header) ? 0 : sizeof(av1_itut_t35_header_dovirpu),
+        m_rpuTmp.data(), rpu_size);
     return 0;
 }
 
@@ -709,6 +751,17 @@ std::vector<nal_info> parse_nal_unit_vvc_c(const uint8_t *data, size_t size) {
     return nal_list;
 }
 
+bool nal_list_has_idr(const std::vector<nal_info>& nal_list, const RGY_CODEC codec) {
+    return std::any_of(nal_list.begin(), nal_list.end(), [codec](const nal_info& info) {
+        if (codec == RGY_CODEC_H264) {
+            return info.type == NALU_H264_IDR;
+        } else if (codec == RGY_CODEC_HEVC) {
+            return info.nuh_layer_id == 0 && (info.type == NALU_HEVC_IDR_W_RADL || info.type == NALU_HEVC_IDR_N_LP);
+        }
+        return false;
+    });
+}
+
 size_t find_header_c(const uint8_t *data, size_t size) {
     return rgy_memmem_c(data, size, DOVIRpu::rpu_header, sizeof(DOVIRpu::rpu_header));
 }
@@ -722,6 +775,8 @@ decltype(parse_nal_unit_h264_c)* get_parse_nal_unit_h264_func() {
     if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return parse_nal_unit_h264_avx512bw;
 #endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return parse_nal_unit_h264_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return parse_nal_unit_h264_neon;
 #endif
     return parse_nal_unit_h264_c;
 }
@@ -732,6 +787,8 @@ decltype(parse_nal_unit_hevc_c)* get_parse_nal_unit_hevc_func() {
     if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return parse_nal_unit_hevc_avx512bw;
 #endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return parse_nal_unit_hevc_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return parse_nal_unit_hevc_neon;
 #endif
     return parse_nal_unit_hevc_c;
 }
@@ -743,6 +800,8 @@ decltype(find_header_c)* get_find_header_func() {
     if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return find_header_avx512bw;
 #endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return find_header_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return find_header_neon;
 #endif
     return find_header_c;
 }
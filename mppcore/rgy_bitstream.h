@@ -72,6 +72,8 @@ enum : uint8_t {
     NALU_H264_SUBSPS   = 15,
 
     NALU_HEVC_UNDEF    = 0,
+    NALU_HEVC_IDR_W_RADL = 19,
+    NALU_HEVC_IDR_N_LP   = 20,
     NALU_HEVC_VPS      = 32,
     NALU_HEVC_SPS      = 33,
     NALU_HEVC_PPS      = 34,
@@ -207,7 +209,9 @@ enum PayloadType {
 };
 
 std::vector<uint8_t> unnal(const uint8_t *ptr, size_t len);
+size_t unnal_inplace(uint8_t *ptr, size_t len);
 void to_nal(std::vector<uint8_t>& data);
+void to_nal(std::vector<uint8_t>& data, const size_t offset);
 void add_u16(std::vector<uint8_t>& data, uint16_t u16);
 void add_u32(std::vector<uint8_t>& data, uint32_t u32);
 
@@ -217,13 +221,19 @@ std::vector<nal_info> parse_nal_unit_h264_avx2(const uint8_t *data, size_t size)
 std::vector<nal_info> parse_nal_unit_hevc_avx2(const uint8_t *data, size_t size);
 std::vector<nal_info> parse_nal_unit_h264_avx512bw(const uint8_t *data, size_t size);
 std::vector<nal_info> parse_nal_unit_hevc_avx512bw(const uint8_t *data, size_t size);
+std::vector<nal_info> parse_nal_unit_h264_neon(const uint8_t *data, size_t size);
+std::vector<nal_info> parse_nal_unit_hevc_neon(const uint8_t *data, size_t size);
 
 decltype(parse_nal_unit_h264_c)* get_parse_nal_unit_h264_func();
 decltype(parse_nal_unit_hevc_c)* get_parse_nal_unit_hevc_func();
 
+// nal unitのリストにIDRのスライスが含まれるか (H.264: IDR, HEVC: IDR_W_RADL/IDR_N_LP (base layer))
+bool nal_list_has_idr(const std::vector<nal_info>& nal_list, const RGY_CODEC codec);
+
 size_t find_header_c(const uint8_t *data, size_t size);
 size_t find_header_avx2(const uint8_t *data, size_t size);
 size_t find_header_avx512bw(const uint8_t *data, size_t size);
+size_t find_header_neon(const uint8_t *data, size_t size);
 
 decltype(find_header_c)* get_find_header_func();
 
@@ -233,6 +243,7 @@ uint8_t gen_obu_header(const uint8_t obu_type);
 size_t get_av1_uleb_size_bytes(uint64_t value);
 std::vector<uint8_t> get_av1_uleb_size_data(uint64_t value);
 std::vector<uint8_t> gen_av1_obu_metadata(const uint8_t metadata_type, const std::vector<uint8_t>& metadata);
+void add_av1_obu_metadata(std::vector<uint8_t>& buf, const uint8_t metadata_type, const uint8_t *prefix, const size_t prefix_size, const uint8_t *metadata, const size_t metadata_size);
 int get_hevc_sei_size(size_t& size, const uint8_t *ptr);
 std::vector<uint8_t> gen_hevc_alpha_channel_info_sei(const int mode);
 
@@ -346,6 +357,7 @@ protected:
     int64_t m_count;
 
     std::unordered_map<int64_t, std::vector<uint8_t>> m_rpus;
+    std::vector<uint8_t> m_rpuTmp; // AV1用の作業領域 (フレームごとに確保しないよう使いまわす)
 };
 
 #endif //__RGY_BITSTREAM_H__
@@ -245,6 +245,59 @@ void print_cmd_error_invalid_value(tstring strOptionName, tstring strErrorValue,
     }
 }
 
+//空白区切り、""で囲んだ部分は空白を含めてひとつの引数とする
+static std::vector<tstring> cmd_from_input_list_line(const std::string& line) {
+    std::vector<tstring> args;
+    std::string arg;
+    bool inQuote = false;
+    bool hasArg = false;
+    for (const auto c : line) {
+        if (c == '"') {
+            inQuote = !inQuote;
+            hasArg = true;
+        } else if (!inQuote && (c == ' ' || c == '\t')) {
+            if (hasArg) {
+                args.push_back(char_to_tstring(arg, CP_UTF8));
+                arg.clear();
+                hasArg = false;
+            }
+        } else {
+            arg += c;
+            hasArg = true;
+        }
+    }
+    if (hasArg) {
+        args.push_back(char_to_tstring(arg, CP_UTF8));
+    }
+    return args;
+}
+
+std::vector<std::vector<tstring>> cmd_from_input_list(const tstring& filename) {
+    std::vector<std::vector<tstring>> jobs;
+    std::ifstream ifs(filename);
+    if (ifs.fail()) {
+        _ftprintf(stderr, _T("Failed to open input list \"%s\"!\n"), filename.c_str());
+        return jobs;
+    }
+    std::string str;
+    while (getline(ifs, str)) {
+        //BOMは除く
+        if (jobs.size() == 0 && str.length() >= 3 && (uint8_t)str[0] == 0xEF && (uint8_t)str[1] == 0xBB && (uint8_t)str[2] == 0xBF) {
+            str = str.substr(3);
+        }
+        //trimは空白のみの行をそのまま返すので、空白のみの行 (CRLFの空行を含む) は別途判定する
+        if (str.find_first_not_of(" \t\v\r\n") == std::string::npos) continue;
+        str = trim(str);
+        //行頭が"#"の場合はコメントとする
+        if (str[0] == '#') continue;
+        auto args = cmd_from_input_list_line(str);
+        if (args.size() > 0) {
+            jobs.push_back(args);
+        }
+    }
+    return jobs;
+}
+
 std::vector<tstring> cmd_from_config_file(const tstring& filename) {
 #if defined(_WIN32) || defined(_WIN64)
     std::ifstream ifs(filename);
@@ -528,7 +581,7 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
         }
         return 0;
     }
-    if (IS_OPTION("vpp-resize-mode") && ENCODER_QSV) {
+    if (IS_OPTION("vpp-resize-mode") && (ENCODER_QSV || ENCODER_MPP)) {
         i++;
         int value;
         if (PARSE_ERROR_FLAG == (value = get_value_from_chr(list_vpp_resize_mode, strInput[i]))) {
@@ -4162,7 +4215,7 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
         const auto paramList = std::vector<std::string>{
             "pos", "posx", "posy",
             "size", "width", "height",
-            "alpha", "alpha_mode", "loop", "file",
+            "alpha", "alpha_mode", "loop", "cache", "file",
             "lumakey_threshold", "lumakey_tolerance", "lumakey_softness"};
 
         for (const auto& param : param_list) {
@@ -4301,6 +4354,15 @@ int parse_one_vpp_option(const TCHAR *option_name, const TCHAR *strInput[], int
                     }
                     continue;
                 }
+                if (param_arg == _T("cache")) {
+                    try {
+                        overlay.cache = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
                 print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
                 return 1;
             } else {
@@ -6013,6 +6075,80 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         }
         return 0;
     }
+    if (IS_OPTION("segment")) {
+        common->segment.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+
+        const auto paramList = std::vector<std::string>{ "format", "type", "duration", "list-size" };
+
+        for (const auto &param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("format")) {
+                    int value = 0;
+                    if (get_list_value(list_segment_format, param_val.c_str(), &value)) {
+                        common->segment.format = (RGYSegmentFormat)value;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, list_segment_format);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("type")) {
+                    int value = 0;
+                    if (get_list_value(list_segment_type, param_val.c_str(), &value)) {
+                        common->segment.type = (RGYSegmentType)value;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, list_segment_type);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("duration")) {
+                    try {
+                        common->segment.duration = std::stod(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (common->segment.duration <= 0.0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("duration should be positive value."));
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("list-size")) {
+                    try {
+                        common->segment.listSize = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (common->segment.listSize < 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("list-size should be 0 or larger."));
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        if (common->segment.format == RGYSegmentFormat::DASH && common->segment.type == RGYSegmentType::TS) {
+            print_cmd_error_invalid_value(option_name, strInput[i], _T("type=ts is not supported with format=dash."));
+            return 1;
+        }
+        return 0;
+    }
     if (IS_OPTION("metadata")) {
         if (i + 1 < nArgNum && strInput[i + 1][0] != _T('-')) {
             i++;
@@ -6213,7 +6349,6 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         }
         return 0;
     }
-#if !ENCODER_MPP
     if (IS_OPTION("ssim")) {
         common->metric.ssim = true;
         return 0;
@@ -6230,7 +6365,6 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         common->metric.psnr = false;
         return 0;
     }
-#endif
 #if ENABLE_VMAF
     if (IS_OPTION("no-vmaf")) {
         common->metric.vmaf.enable = false;
@@ -6846,6 +6980,11 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->perfMonitorInterval = std::max(50, v);
         return 0;
     }
+    if (IS_OPTION("metrics-listen")) {
+        i++;
+        ctrl->metricsListen = strInput[i];
+        return 0;
+    }
     if (IS_OPTION("parent-pid")) {
         i++;
         try {
@@ -6931,6 +7070,11 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         i++;
         return 0;
     }
+    if (IS_OPTION("input-list")) {
+        i++;
+        ctrl->inputList = strInput[i];
+        return 0;
+    }
 #if defined(_WIN32) || defined(_WIN64)
     if (IS_OPTION("process-codepage")) {
         i++;
@@ -6950,6 +7094,20 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->enableOpenCL = true;
         return 0;
     }
+    if (IS_OPTION("opencl-frame-history")) {
+        i++;
+        int value = 0;
+        if (1 != _stscanf_s(strInput[i], _T("%d"), &value)) {
+            print_cmd_error_invalid_value(option_name, strInput[i]);
+            return 1;
+        }
+        if (value < 0) {
+            print_cmd_error_invalid_value(option_name, strInput[i], _T("--opencl-frame-history should be set in positive value."));
+            return 1;
+        }
+        ctrl->clFrameHistoryMB = value;
+        return 0;
+    }
 #endif
     if (IS_OPTION("disable-vulkan")) {
         ctrl->enableVulkan = false;
@@ -7081,7 +7239,7 @@ tstring gen_cmd(const RGYParamVpp *param, const RGYParamVpp *defaultPrm, bool sa
             OPT_LST(_T("--vpp-resize"), resize_algo, list_vpp_resize);
         }
     }
-#if ENCODER_QSV
+#if ENCODER_QSV || ENCODER_MPP
     OPT_LST(_T("--vpp-resize-mode"), resize_mode, list_vpp_resize_mode);
 #endif
 
@@ -7790,6 +7948,7 @@ tstring gen_cmd(const RGYParamVpp *param, const RGYParamVpp *defaultPrm, bool sa
                 ADD_FLOAT2(_T("lumakey_tolerance"), param->overlay[i], overlayDefault, lumaKey.tolerance, 3);
                 ADD_FLOAT2(_T("lumakey_shoftness"), param->overlay[i], overlayDefault, lumaKey.shoftness, 3);
                 ADD_BOOL2(_T("loop"), param->overlay[i], overlayDefault, loop);
+                ADD_NUM2(_T("cache"), param->overlay[i], overlayDefault, cache);
             }
             if (!tmp.str().empty()) {
                 cmd << _T(" --vpp-overlay ") << tmp.str().substr(1);
@@ -7856,6 +8015,17 @@ tstring gen_cmd(const RGYParamCommon *param, const RGYParamCommon *defaultPrm, b
     for (uint32_t i = 0; i < param->muxOpt.size(); i++) {
         cmd << _T(" -m ") << param->muxOpt.at(i).first << _T(":") << param->muxOpt.at(i).second;
     }
+    if (param->segment.enable) {
+        tmp.str(tstring());
+        ADD_LST(_T("format"), segment.format, list_segment_format);
+        ADD_LST(_T("type"), segment.type, list_segment_type);
+        ADD_FLOAT(_T("duration"), segment.duration, 3);
+        ADD_NUM(_T("list-size"), segment.listSize);
+        cmd << _T(" --segment");
+        if (!tmp.str().empty()) {
+            cmd << _T(" ") << tmp.str().substr(1);
+        }
+    }
     tmp.str(tstring());
     for (int i = 0; i < param->nAudioSelectCount; i++) {
         const AudioSelect *pAudioSelect = param->ppAudioSelectList[i];
@@ -8318,6 +8488,7 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
         }
     }
     OPT_NUM(_T("--perf-monitor-interval"), perfMonitorInterval);
+    OPT_TSTR(_T("--metrics-listen"), metricsListen);
     OPT_NUM(_T("--parent-pid"), parentProcessID);
     if (param->gpuSelect != defaultPrm->gpuSelect) {
         std::basic_stringstream<TCHAR> tmp;
@@ -8332,6 +8503,7 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
     }
 #if ENCODER_QSV || ENCODER_VCEENC || ENCODER_MPP
     OPT_BOOL(_T("--enable-opencl"), _T("--disable-opencl"), enableOpenCL);
+    OPT_NUM(_T("--opencl-frame-history"), clFrameHistoryMB);
 #endif
     OPT_BOOL(_T("--enable-vulkan"), _T("--disable-vulkan"), enableVulkan);
     return cmd.str();
@@ -8609,6 +8781,14 @@ tstring gen_cmd_help_common() {
         _T("                                set muxer option name and value.\n")
         _T("                                 these could be only used with\n")
         _T("                                 avhw/avsw reader and avcodec muxer.\n")
+        _T("   --segment [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("                                write segmented output (HLS/DASH),\n")
+        _T("                                 segments are cut at IDR frames.\n")
+        _T("    params\n")
+        _T("      format=<string>           auto, hls, dash (default: auto)\n")
+        _T("      type=<string>             segment type: auto, ts, fmp4 (default: auto)\n")
+        _T("      duration=<float>          target segment duration in sec (default: 6)\n")
+        _T("      list-size=<int>           segments kept in playlist, 0 = all (default: 0)\n")
         _T("   --metadata <string>          set metadata for output file.\n")
         _T("                                 - copy ... copy metadata from input (default)\n")
         _T("                                 - clear ... do not set metadata\n")
@@ -8626,12 +8806,10 @@ tstring gen_cmd_help_common() {
         _T("   --allow-other-negative-pts  for debug\n")
         _T("\n");
 #endif
-#if !ENCODER_MPP
     str += _T("\n")
         _T("   --ssim                       calc ssim\n")
         _T("   --psnr                       calc psnr\n")
         _T("\n");
-#endif //#if !ENCODER_MPP
 #if ENABLE_VMAF
     str += strsprintf(_T("")
         _T("   --vmaf [<param1>=<value>][,<param2>=<value>][...]\n")
@@ -9015,7 +9193,7 @@ tstring gen_cmd_help_vpp() {
 #else
     str += print_list_options(_T("--vpp-resize <string>"), list_vpp_resize_help, 0);
 #endif
-#if ENCODER_QSV
+#if ENCODER_QSV || ENCODER_MPP
     str += print_list_options(_T("--vpp-resize-mode <string>"), list_vpp_resize_mode, 0);
 #endif
 #if ENABLE_VPP_FILTER_CONVOLUTION3D
@@ -9337,6 +9515,10 @@ tstring gen_cmd_help_vpp() {
         _T("                                  default: 0.1 (0.0 - 1.0)\n")
         _T("      lumakey_threshold=<float> set the range of softness for lumakey\n")
         _T("      loop=<bool>\n")
+        _T("      cache=<int>               max device memory (MB) to cache decoded frames\n")
+        _T("                                  for looped/still overlay. 0 to disable.\n")
+        _T("                                  default: %d\n"),
+        FILTER_DEFAULT_OVERLAY_CACHE
     );
 #endif
 #if ENABLE_VPP_FILTER_FRUC
@@ -9367,7 +9549,10 @@ tstring gen_cmd_help_ctrl() {
         _T("   --log-mux-ts [<string>]      output debug info for avsw/avhw reader.\n"));
 
     str += strsprintf(_T("\n")
-        _T("   --option-file <string>       read commanline options written in file.\n"));
+        _T("   --option-file <string>       read commanline options written in file.\n")
+        _T("   --input-list <string>        encode jobs listed in file back-to-back.\n")
+        _T("                                 each line has options of a job (-i, -o, ...),\n")
+        _T("                                 added to the options of the command line.\n"));
     str += strsprintf(_T("")
         _T("   --max-procfps <int>          limit encoding speed for lower utilization.\n")
         _T("                                 default:0 (no limit)\n")
@@ -9477,6 +9662,9 @@ tstring gen_cmd_help_ctrl() {
 #if ENCODER_QSV || ENCODER_VCEENC || ENCODER_MPP
     str += strsprintf(_T("\n")
         _T("   --disable-opencl             disable opencl features.\n"));
+    str += strsprintf(_T("\n")
+        _T("   --opencl-frame-history <int> limit memory for past frames kept by\n")
+        _T("                                temporal opencl filters in MB. (default: 0 = no limit)\n"));
 #endif
     str += strsprintf(_T("\n")
         _T("   --disable-vulkan             disable vulkan features.\n"));
@@ -9489,19 +9677,22 @@ tstring gen_cmd_help_ctrl() {
         _T("                                 all          ... monitor all info\n")
         _T("                                 cpu_total    ... cpu total usage (%%)\n")
         _T("                                 cpu_kernel   ... cpu kernel usage (%%)\n")
-#if defined(_WIN32) || defined(_WIN64)
         _T("                                 cpu_main     ... cpu main thread usage (%%)\n")
+#if defined(_WIN32) || defined(_WIN64)
         _T("                                 cpu_enc      ... cpu encode thread usage (%%)\n")
+#endif //#if defined(_WIN32) || defined(_WIN64)
         _T("                                 cpu_in       ... cpu input thread usage (%%)\n")
         _T("                                 cpu_out      ... cpu output thread usage (%%)\n")
         _T("                                 cpu_aud_proc ... cpu aud proc thread usage (%%)\n")
         _T("                                 cpu_aud_enc  ... cpu aud enc thread usage (%%)\n")
-#endif //#if defined(_WIN32) || defined(_WIN64)
         _T("                                 cpu          ... monitor all cpu info\n")
         _T("                                 gpu_load    ... gpu usage (%%)\n")
         _T("                                 gpu_clock   ... gpu avg clock\n")
         _T("                                 vee_load    ... gpu video encoder usage (%%)\n")
         _T("                                 ved_load    ... gpu video decoder usage (%%)\n")
+#if !(defined(_WIN32) || defined(_WIN64))
+        _T("                                 rga_load    ... rga usage (%%)\n")
+#endif
 #if ENABLE_NVML
         _T("                                 ve_clock    ... gpu video engine clock\n")
 #endif
@@ -9520,6 +9711,9 @@ tstring gen_cmd_help_ctrl() {
         _T("                                 frame_out   ... written_frames\n")
         _T("                                 \n")
         _T("   --perf-monitor-interval <int> set perf monitor check interval (millisec)\n")
-        _T("                                 default 500, must be 50 or more\n"));
+        _T("                                 default 500, must be 50 or more\n")
+        _T("   --metrics-listen [<host>:]<port> or unix:<path>\n")
+        _T("                                 serve live metrics in OpenMetrics text format\n")
+        _T("                                 over http (GET /metrics), host defaults to 127.0.0.1.\n"));
     return str;
 }
@@ -59,6 +59,8 @@ int cmd_string_to_bool(bool *b, const tstring &str);
 int parse_qp(int a[3], const TCHAR *str);
 
 std::vector<tstring> cmd_from_config_file(const tstring& filename);
+//1行ごとに1ジョブのオプションを記載したファイルを読み込む
+std::vector<std::vector<tstring>> cmd_from_input_list(const tstring& filename);
 std::vector<std::pair<std::string, std::string>> createOptionList();
 
 void print_cmd_error_unknown_opt(tstring strErrorValue);
@@ -41,6 +41,8 @@ decltype(rgy_memmem_fawstart1_c)* get_memmem_fawstart1_func() {
     if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_memmem_fawstart1_avx512bw;
 #endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_memmem_fawstart1_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return rgy_memmem_fawstart1_neon;
 #endif
     return rgy_memmem_fawstart1_c;
 }
@@ -87,6 +89,8 @@ decltype(rgy_convert_audio_16to8)* get_convert_audio_16to8_func() {
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
     const auto simd = get_availableSIMD();
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_convert_audio_16to8_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return rgy_convert_audio_16to8_neon;
 #endif
     return rgy_convert_audio_16to8;
 }
@@ -95,6 +99,8 @@ decltype(rgy_split_audio_16to8x2)* get_split_audio_16to8x2_func() {
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
     const auto simd = get_availableSIMD();
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_split_audio_16to8x2_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return rgy_split_audio_16to8x2_neon;
 #endif
     return rgy_split_audio_16to8x2;
 }
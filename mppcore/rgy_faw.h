@@ -54,12 +54,18 @@ static const std::array<uint8_t, 24> fawfin2 = {
 size_t rgy_memmem_fawstart1_c(const void *data_, const size_t data_size);
 size_t rgy_memmem_fawstart1_avx2(const void *data_, const size_t data_size);
 size_t rgy_memmem_fawstart1_avx512bw(const void *data_, const size_t data_size);
+size_t rgy_memmem_fawstart1_neon(const void *data_, const size_t data_size);
+decltype(rgy_memmem_fawstart1_c)* get_memmem_fawstart1_func();
 
 void rgy_convert_audio_16to8(uint8_t *dst, const short *src, const size_t n);
 void rgy_convert_audio_16to8_avx2(uint8_t *dst, const short *src, const size_t n);
+void rgy_convert_audio_16to8_neon(uint8_t *dst, const short *src, const size_t n);
+decltype(rgy_convert_audio_16to8)* get_convert_audio_16to8_func();
 
 void rgy_split_audio_16to8x2(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n);
 void rgy_split_audio_16to8x2_avx2(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n);
+void rgy_split_audio_16to8x2_neon(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n);
+decltype(rgy_split_audio_16to8x2)* get_split_audio_16to8x2_func();
 
 using RGYFAWDecoderOutput = std::array<std::vector<uint8_t>, 2>;
 
@@ -0,0 +1,71 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#define RGY_MEMMEM_NEON
+#include "rgy_faw.h"
+
+#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+
+size_t rgy_memmem_fawstart1_neon(const void *data_, const size_t data_size) {
+    return rgy_memmem_neon_imp(data_, data_size, fawstart1.data(), fawstart1.size());
+}
+
+void rgy_convert_audio_16to8_neon(uint8_t *dst, const short *src, const size_t n) {
+    const uint8_t *sh = (const uint8_t *)src;
+    uint8_t * const fin = dst + n;
+    uint8_t * const loop_fin = dst + (n & ~(size_t)15);
+    const uint8x16_t vConst = vdupq_n_u8(0x80);
+    //メインループ
+    //  vld2q_u8で下位8bit(val[0])と上位8bit(val[1])に分離し、
+    //  (x >> 8) + 128 は上位8bitの最上位bitの反転に等しい
+    for (; dst < loop_fin; sh += 32, dst += 16) {
+        const uint8x16x2_t v = vld2q_u8(sh);
+        vst1q_u8(dst, veorq_u8(v.val[1], vConst));
+    }
+    //残り
+    const short *sh_remain = (const short *)sh;
+    for (; dst < fin; dst++, sh_remain++) {
+        *dst = (*sh_remain >> 8) + 128;
+    }
+}
+
+void rgy_split_audio_16to8x2_neon(uint8_t *dst0, uint8_t *dst1, const short *src, const size_t n) {
+    const short *sh = src;
+    const short *sh_fin = src + (n & ~(size_t)15);
+    const uint8x16_t vConst = vdupq_n_u8(0x80);
+    for (; sh < sh_fin; sh += 16, dst0 += 16, dst1 += 16) {
+        const uint8x16x2_t v = vld2q_u8((const uint8_t *)sh);
+        vst1q_u8(dst0, veorq_u8(v.val[1], vConst)); //Upper8bit
+        vst1q_u8(dst1, veorq_u8(v.val[0], vConst)); //Lower8bit
+    }
+    sh_fin = sh + (n & 15);
+    for (; sh < sh_fin; sh++, dst0++, dst1++) {
+        *dst0 = (*sh >> 8) + 128;
+        *dst1 = (*sh & 0xff) + 128;
+    }
+}
+#endif
@@ -30,6 +30,10 @@
 #define __RGY_FILTER_H__
 
 #include <cstdint>
+#include <cmath>
+#include <array>
+#include <map>
+#include <mutex>
 #include "rgy_util.h"
 #include "rgy_log.h"
 #include "rgy_frame_info.h"
@@ -44,8 +48,9 @@ public:
     RGYFrameInfo frameOut;
     rgy_rational<int> baseFps;
     bool bOutOverwrite;
+    const void *historyStage; //入力フレームを出力した直前のフィルタ (時間方向の参照フレームの共有用、nullptrなら共有しない)
 
-    RGYFilterParam() : frameIn(), frameOut(), baseFps(), bOutOverwrite(false) {};
+    RGYFilterParam() : frameIn(), frameOut(), baseFps(), bOutOverwrite(false), historyStage(nullptr) {};
     virtual ~RGYFilterParam() {};
     virtual tstring print() const { return _T(""); };
 };
@@ -83,22 +88,97 @@ static FILTER_PATHTHROUGH_FRAMEINFO operator~(FILTER_PATHTHROUGH_FRAMEINFO a) {
     return (FILTER_PATHTHROUGH_FRAMEINFO)(~((uint32_t)a));
 }
 
+//GPU時間の集計
+//  histは2倍刻みの各区間をさらにSUB_BUCKETS等分したバケット (上限 bucketUpperMs(i))、最後のバケットは上限なし
+//  バケット0は MIN_MS 以下、バケット1～は MIN_MS * 2^OCTAVES (=約65秒) まで
+//  percentileMsはバケットの上限を返すので、MIN_MS以上では真の値に対し最大 1/SUB_BUCKETS (12.5%) 大きくなりうる
+struct RGYFilterPerfStat {
+    static constexpr double MIN_MS = 0.0625;
+    static constexpr int OCTAVES = 20;
+    static constexpr int SUB_BUCKETS = 8;
+    static constexpr int BUCKETS = 1 + OCTAVES * SUB_BUCKETS;
+    static double bucketUpperMs(int i) {
+        if (i <= 0) return MIN_MS;
+        const int octave = (i - 1) / SUB_BUCKETS;
+        const int sub = (i - 1) % SUB_BUCKETS;
+        return MIN_MS * std::ldexp(1.0 + (sub + 1) / (double)SUB_BUCKETS, octave);
+    }
+    //2倍刻みの境界にあたるバケットか (OpenMetricsへの出力用)
+    static bool isOctaveBoundary(int i) { return i % SUB_BUCKETS == 0; }
+    static int bucketIndex(double timeMs) {
+        if (!(timeMs > MIN_MS)) return 0;
+        int exp = 0;
+        const double frac = std::frexp(timeMs / MIN_MS, &exp) * 2.0; // [1, 2)
+        const int octave = exp - 1;
+        //上限ちょうどの値は下のバケットに入れる
+        if (frac == 1.0) return std::min(octave * SUB_BUCKETS, BUCKETS);
+        if (octave >= OCTAVES) return BUCKETS;
+        const int sub = (int)std::ceil((frac - 1.0) * SUB_BUCKETS) - 1;
+        return 1 + octave * SUB_BUCKETS + sub;
+    }
+
+    int64_t count;
+    double totalMs;
+    double maxMs;
+    std::array<int64_t, BUCKETS + 1> hist;
+
+    RGYFilterPerfStat() : count(0), totalMs(0.0), maxMs(0.0), hist() {};
+    void add(double timeMs) {
+        hist[bucketIndex(timeMs)]++;
+        count++;
+        totalMs += timeMs;
+        maxMs = std::max(maxMs, timeMs);
+    }
+    double avgMs() const { return (count > 0) ? totalMs / (double)count : 0.0; }
+    //ヒストグラムからの推定値 (該当バケットの上限を返す)
+    double percentileMs(double ratio) const {
+        const int64_t target = (int64_t)std::ceil(count * ratio);
+        int64_t sum = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            sum += hist[i];
+            if (sum >= target) return std::min(bucketUpperMs(i), maxMs);
+        }
+        return maxMs;
+    }
+};
+
 class RGYFilterPerf {
 public:
-    RGYFilterPerf() : m_filterTimeMs(0.0), m_runCount(0) {};
+    RGYFilterPerf() : m_filterTimeMs(0.0), m_runCount(0), m_mtxStat(), m_stat(), m_kernelStat() {};
     virtual ~RGYFilterPerf() { };
 
     double GetAvgTimeElapsed() const {
-        return (m_runCount > 0) ? m_filterTimeMs / (double)m_runCount : 0.0;
+        const auto runCount = GetRunCount();
+        return (runCount > 0) ? GetTotalTimeMs() / (double)runCount : 0.0;
+    }
+    double GetTotalTimeMs() const { return m_filterTimeMs.load(std::memory_order_relaxed); }
+    int64_t GetRunCount() const { return m_runCount.load(std::memory_order_relaxed); }
+    RGYFilterPerfStat GetStat() const {
+        std::lock_guard<std::mutex> lock(m_mtxStat);
+        return m_stat;
+    }
+    std::map<std::string, RGYFilterPerfStat> GetKernelStat() const {
+        std::lock_guard<std::mutex> lock(m_mtxStat);
+        return m_kernelStat;
     }
     virtual RGY_ERR checkPerformace(void *event_start, void *event_fin) = 0;
 protected:
+    //perf monitorのスレッドからも参照されるのでatomicとする (更新は計測結果を回収するスレッドのみ)
     void setTime(double time) {
-        m_filterTimeMs += time;
-        m_runCount++;
+        m_filterTimeMs.store(m_filterTimeMs.load(std::memory_order_relaxed) + time, std::memory_order_relaxed);
+        m_runCount.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(m_mtxStat);
+        m_stat.add(time);
+    }
+    void setKernelTime(const std::string& kernel, double time) {
+        std::lock_guard<std::mutex> lock(m_mtxStat);
+        m_kernelStat[kernel].add(time);
     }
-    double m_filterTimeMs;
-    int64_t m_runCount;
+    std::atomic<double> m_filterTimeMs;
+    std::atomic<int64_t> m_runCount;
+    mutable std::mutex m_mtxStat;
+    RGYFilterPerfStat m_stat;
+    std::map<std::string, RGYFilterPerfStat> m_kernelStat;
 };
 
 class RGYFilterBase {
@@ -120,6 +200,7 @@ public:
     virtual int targetTrackIdx() { return 0; };
     virtual void setCheckPerformance(const bool check) = 0;
     double GetAvgTimeElapsed() { return (m_perfMonitor) ? m_perfMonitor->GetAvgTimeElapsed() : 0.0; }
+    std::shared_ptr<RGYFilterPerf> GetPerf() const { return m_perfMonitor; }
 protected:
     virtual RGY_ERR AllocFrameBuf(const RGYFrameInfo &frame, int frames) = 0;
     virtual void close() = 0;
@@ -159,7 +240,7 @@ protected:
     shared_ptr<RGYLog> m_pLog;  //ログ出力
     std::shared_ptr<RGYFilterParam> m_param;
     FILTER_PATHTHROUGH_FRAMEINFO m_pathThrough;
-    std::unique_ptr<RGYFilterPerf> m_perfMonitor;
+    std::shared_ptr<RGYFilterPerf> m_perfMonitor;
 };
 
 #endif //__RGY_FILTER_H__
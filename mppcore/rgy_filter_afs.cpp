@@ -56,14 +56,17 @@ afsSourceCache::afsSourceCache(shared_ptr<RGYOpenCLContext> cl) :
     m_cl(cl),
     m_sourceArray(),
     m_csp(RGY_CSP_NA),
+    m_frameY(),
+    m_stage(this),
     m_nFramesInput(0) {
 }
 
 RGY_ERR afsSourceCache::alloc(const RGYFrameInfo& frameInfo) {
     m_csp = frameInfo.csp;
     if (RGY_CSP_CHROMA_FORMAT[m_csp] == RGY_CHROMAFMT_YUV444) {
+        //フレーム履歴から取得するので、ここでは確保しない
         for (int i = 0; i < (int)m_sourceArray.size(); i++) {
-            m_sourceArray[i].y = m_cl->createFrameBuffer(frameInfo);
+            m_sourceArray[i].y.reset();
         }
     } else if (RGY_CSP_CHROMA_FORMAT[m_csp] == RGY_CHROMAFMT_YUV420) {
         RGYFrameInfo frameY = getPlane(&frameInfo, RGY_PLANE_Y);
@@ -74,8 +77,11 @@ RGY_ERR afsSourceCache::alloc(const RGYFrameInfo& frameInfo) {
         frameV.csp = frameY.csp;
         frameU.height >>= 1; //フィールドを分離して保存するため
         frameV.height >>= 1; //フィールドを分離して保存するため
+        m_frameY = frameY;
         for (int i = 0; i < (int)m_sourceArray.size(); i++) {
-            m_sourceArray[i].y  = m_cl->createFrameBuffer(frameY);
+            //Yのコピー先は前段のフレームを共有できない場合のみ確保する
+            m_sourceArray[i].y.reset();
+            m_sourceArray[i].yBuf.reset();
             for (int j = 0; j < (int)m_sourceArray[i].cb.size(); j++) {
                 m_sourceArray[i].cb[j] = m_cl->createFrameBuffer(frameU);
                 m_sourceArray[i].cr[j] = m_cl->createFrameBuffer(frameV);
@@ -95,22 +101,42 @@ RGY_ERR afsSourceCache::build(const RGYFrameInfo& frameInfo) {
 RGY_ERR afsSourceCache::add(const RGYFrameInfo *pInputFrame, RGYOpenCLQueue &queue_main, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent &event) {
     const int iframe = m_nFramesInput++;
     auto pDstFrame = get(iframe);
-    pDstFrame->y->frame.flags        = pInputFrame->flags;
-    pDstFrame->y->frame.picstruct    = pInputFrame->picstruct;
-    pDstFrame->y->frame.timestamp    = pInputFrame->timestamp;
-    pDstFrame->y->frame.duration     = pInputFrame->duration;
-    pDstFrame->y->frame.inputFrameId = pInputFrame->inputFrameId;
+    auto history = m_cl->frameHistory();
 
     auto ret = RGY_ERR_NONE;
     if (RGY_CSP_CHROMA_FORMAT[m_csp] == RGY_CHROMAFMT_YUV444) {
-        ret = m_cl->copyFrame(&pDstFrame->y->frame, pInputFrame, nullptr, queue_main, wait_events, &event);
+        //前段のフィルタが履歴に登録したフレームならコピーせずに参照する
+        pDstFrame->y = history->add(m_stage, pInputFrame, queue_main, wait_events, &event, &ret);
+        if (ret == RGY_ERR_NONE
+            && (pDstFrame->y->frame.pitch[0] != pDstFrame->y->frame.pitch[1] || pDstFrame->y->frame.pitch[0] != pDstFrame->y->frame.pitch[2])) {
+            //synthesizeはY/U/Vのpitchが共通であることを前提とするので、異なる場合は自分用にコピーする
+            pDstFrame->y = history->add(this, pInputFrame, queue_main, wait_events, &event, &ret);
+        }
+        return ret;
     } else if (RGY_CSP_CHROMA_FORMAT[m_csp] == RGY_CHROMAFMT_YUV420) {
         RGYFrameInfo frameY = getPlane(pInputFrame, RGY_PLANE_Y);
         RGYFrameInfo frameU = getPlane(pInputFrame, RGY_PLANE_U);
         RGYFrameInfo frameV = getPlane(pInputFrame, RGY_PLANE_V);
 
-        ret = m_cl->copyPlane(&pDstFrame->y->frame, &frameY, nullptr, queue_main, &event);
-        if (ret != RGY_ERR_NONE) return ret;
+        //Yは前段のフィルタが履歴に登録したフレームならコピーせずに参照する
+        //色差はフィールドを分離して保持するので、常にコピーする
+        if (history->contains(m_stage, pInputFrame)) {
+            pDstFrame->y = history->add(m_stage, pInputFrame, queue_main, &ret);
+            if (ret != RGY_ERR_NONE) return ret;
+        } else {
+            if (!pDstFrame->yBuf) {
+                pDstFrame->yBuf = m_cl->createFrameBuffer(m_frameY);
+                if (!pDstFrame->yBuf) return RGY_ERR_MEMORY_ALLOC;
+            }
+            pDstFrame->y = pDstFrame->yBuf;
+            pDstFrame->y->frame.flags        = pInputFrame->flags;
+            pDstFrame->y->frame.picstruct    = pInputFrame->picstruct;
+            pDstFrame->y->frame.timestamp    = pInputFrame->timestamp;
+            pDstFrame->y->frame.duration     = pInputFrame->duration;
+            pDstFrame->y->frame.inputFrameId = pInputFrame->inputFrameId;
+            ret = m_cl->copyPlane(&pDstFrame->y->frame, &frameY, nullptr, queue_main, &event);
+            if (ret != RGY_ERR_NONE) return ret;
+        }
 
         auto copyProgram = m_cl->getCspCopyProgram(pDstFrame->cb[0]->frame, frameU);
         if (!copyProgram) {
@@ -143,7 +169,8 @@ RGY_ERR afsSourceCache::copyFrame(RGYCLFrame *pOut, int srcFrame, RGYOpenCLQueue
         RGYFrameInfo frameU = getPlane(&pOut->frame, RGY_PLANE_U);
         RGYFrameInfo frameV = getPlane(&pOut->frame, RGY_PLANE_V);
 
-        auto ret = m_cl->copyPlane(&frameY, &pSrc->y->frame, nullptr, queue, event);
+        const auto srcY = getPlane(&pSrc->y->frame, RGY_PLANE_Y);
+        auto ret = m_cl->copyPlane(&frameY, &srcY, nullptr, queue, event);
         if (ret != RGY_ERR_NONE) return ret;
 
         auto copyProgram = m_cl->getCspCopyProgram(pOut->frame, pSrc->cb[0]->frame);
@@ -173,12 +200,13 @@ RGY_ERR afsSourceCache::copyFrame(RGYCLFrame *pOut, int srcFrame, RGYOpenCLQueue
 
 void afsSourceCache::clear() {
     for (int i = 0; i < (int)m_sourceArray.size(); i++) {
-        m_sourceArray[i].y->clear();
+        m_sourceArray[i].y.reset();
+        m_sourceArray[i].yBuf.reset();
         for (const auto &cache : m_sourceArray[i].cb) {
-            cache->clear();
+            if (cache) cache->clear();
         }
         for (const auto &cache : m_sourceArray[i].cr) {
-            cache->clear();
+            if (cache) cache->clear();
         }
     }
     m_nFramesInput = 0;
@@ -633,8 +661,11 @@ RGY_ERR RGYFilterAfs::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog>
         AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
         return err;
     }
-    AddMessage(RGY_LOG_DEBUG, _T("allocated source buffer: %dx%d, pitch %d, %s.\n"),
-        m_source.get(0)->frameinfo().width, m_source.get(0)->frameinfo().height, m_source.get(0)->frameinfo().pitch[0], RGY_CSP_NAMES[m_source.get(0)->frameinfo().csp]);
+    //前段のフィルタの出力をフレーム履歴から共有する
+    m_source.setStage((pAfsParam->historyStage) ? pAfsParam->historyStage : (const void *)&m_source);
+    AddMessage(RGY_LOG_DEBUG, _T("allocated source buffer: %dx%d, %s%s.\n"),
+        pAfsParam->frameOut.width, pAfsParam->frameOut.height, RGY_CSP_NAMES[pAfsParam->frameOut.csp],
+        (pAfsParam->historyStage) ? _T(", shared with previous filter") : _T(""));
 
     if (RGY_ERR_NONE != (err = m_source.build(pAfsParam->frameOut))) {
         AddMessage(RGY_LOG_ERROR, _T("failed to build kernel for source cache: %s.\n"), get_err_mes(err));
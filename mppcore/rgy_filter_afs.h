@@ -84,7 +84,8 @@ public:
 };
 
 struct afsSourceCacheFrame {
-    unique_ptr<RGYCLFrame> y;                 //フレーム状態、YUV420時はYのみ、YUV444時はYUVすべて
+    shared_ptr<RGYCLFrame> y;                 //フレーム状態、YUV420時はYのみ(前段のフレームを共有する場合は全プレーン)、YUV444時はYUVすべて
+    shared_ptr<RGYCLFrame> yBuf;              //YUV420時に前段のフレームを共有できない場合のYのコピー先
     std::array<unique_ptr<RGYCLFrame>, 2> cb; //YUV420時のみ使用、フィールド分離状態
     std::array<unique_ptr<RGYCLFrame>, 2> cr; //YUV420時のみ使用、フィールド分離状態
     RGYFrameInfo frameinfo() const { return (y) ? y->frame : RGYFrameInfo(); };
@@ -107,11 +108,14 @@ public:
     }
     int inframe() const { return m_nFramesInput; }
     RGY_CSP csp() const { return m_csp; }
+    void setStage(const void *stage) { m_stage = stage; }
     void clear();
 protected:
     shared_ptr<RGYOpenCLContext> m_cl;
     std::array<afsSourceCacheFrame, AFS_SOURCE_CACHE_NUM> m_sourceArray;
     RGY_CSP m_csp;
+    RGYFrameInfo m_frameY; //YUV420時のYのコピー先の情報
+    const void *m_stage;   //フレーム履歴のキー
     int m_nFramesInput;
 };
 
@@ -28,6 +28,11 @@
 #include "rgy_filter_cl.h"
 
 RGY_ERR RGYFilterPerfCL::checkPerformace(void *event_start, void *event_fin) {
+    if (m_collector) {
+        m_collector->addSpan(shared_from_this(), *(RGYOpenCLEvent *)event_start, *(RGYOpenCLEvent *)event_fin);
+        return RGY_ERR_NONE;
+    }
+    ((RGYOpenCLEvent *)event_fin)->wait();
     uint64_t time_start = 0;
     auto sts = ((RGYOpenCLEvent *)event_start)->getProfilingTimeEnd(time_start);
     if (sts != RGY_ERR_NONE) return sts;
@@ -38,6 +43,21 @@ RGY_ERR RGYFilterPerfCL::checkPerformace(void *event_start, void *event_fin) {
     return RGY_ERR_NONE;
 }
 
+void RGYFilterPerfCL::addProfileTime(const std::string& kernel, double timeMs) {
+    if (kernel.length() == 0) {
+        setTime(timeMs);
+    } else {
+        setKernelTime(kernel, timeMs);
+    }
+}
+
+std::unique_ptr<RGYOpenCLProfileScope> RGYFilterPerfCL::profileScope() {
+    if (!m_collector) {
+        return std::unique_ptr<RGYOpenCLProfileScope>();
+    }
+    return std::make_unique<RGYOpenCLProfileScope>(m_collector, shared_from_this());
+}
+
 RGYFilter::RGYFilter(shared_ptr<RGYOpenCLContext> context) :
     RGYFilterBase(),
     m_cl(context),
@@ -106,10 +126,13 @@ RGY_ERR RGYFilter::filter(RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFram
         *pOutputFrameNum = 1;
     }
     RGYOpenCLEvent queueRunStart;
+    std::unique_ptr<RGYOpenCLProfileScope> profileScope;
     if (m_perfMonitor) {
         queue.getmarker(queueRunStart);
+        profileScope = std::dynamic_pointer_cast<RGYFilterPerfCL>(m_perfMonitor)->profileScope();
     }
     const auto ret = run_filter(pInputFrame, ppOutputFrames, pOutputFrameNum, queue, wait_events, event);
+    profileScope.reset();
     const int nOutFrame = *pOutputFrameNum;
     if (!m_param->bOutOverwrite && nOutFrame > 0) {
         if (m_pathThrough & FILTER_PATHTHROUGH_TIMESTAMP) {
@@ -131,14 +154,13 @@ RGY_ERR RGYFilter::filter(RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFram
     if (m_perfMonitor) {
         RGYOpenCLEvent queueRunEnd;
         queue.getmarker(queueRunEnd);
-        queueRunEnd.wait();
         m_perfMonitor->checkPerformace(&queueRunStart, &queueRunEnd);
     }
     return ret;
 }
 
 void RGYFilter::setCheckPerformance(const bool check) {
-    if (check) m_perfMonitor = std::make_unique<RGYFilterPerfCL>();
+    if (check) m_perfMonitor = std::make_shared<RGYFilterPerfCL>(m_cl->profileCollector());
     else       m_perfMonitor.reset();
 }
 
@@ -37,13 +37,18 @@
 #include "convert_csp.h"
 #include "rgy_prm.h"
 
-class RGYFilterPerfCL : public RGYFilterPerf {
+//collectorがある場合は、イベントを登録するだけで待機せず、結果はcollectorのスレッドで集計する
+class RGYFilterPerfCL : public RGYFilterPerf, public RGYOpenCLProfileTarget, public std::enable_shared_from_this<RGYFilterPerfCL> {
 public:
-    RGYFilterPerfCL() : RGYFilterPerf() {};
+    RGYFilterPerfCL(RGYOpenCLProfileCollector *collector) : RGYFilterPerf(), RGYOpenCLProfileTarget(), m_collector(collector) {};
     virtual ~RGYFilterPerfCL() { };
 
     virtual RGY_ERR checkPerformace(void *event_start, void *event_fin) override;
+    virtual void addProfileTime(const std::string& kernel, double timeMs) override;
+    //フィルタの実行中に起動したカーネルの時間を計測する
+    std::unique_ptr<RGYOpenCLProfileScope> profileScope();
 protected:
+    RGYOpenCLProfileCollector *m_collector;
 };
 
 class RGYFilter : public RGYFilterBase {
@@ -91,7 +91,7 @@ RGY_ERR RGYFilterConvolution3D::denoiseFrame(
     return RGY_ERR_NONE;
 }
 
-RGYFilterConvolution3D::RGYFilterConvolution3D(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_convolution3d(), m_prevFrames(), m_cacheIdx(0), m_frameOut(0) {
+RGYFilterConvolution3D::RGYFilterConvolution3D(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_convolution3d(), m_prevFrames(), m_outFrame(), m_stage(nullptr), m_cacheIdx(0), m_frameOut(0) {
     m_name = _T("convolution3d");
 }
 
@@ -149,26 +149,21 @@ RGY_ERR RGYFilterConvolution3D::init(shared_ptr<RGYFilterParam> pParam, shared_p
         m_convolution3d.set(m_cl->buildResourceAsync(_T("RGY_FILTER_CONVOLUTION3D_CL"), _T("EXE_DATA"), options.c_str()));
     }
 
-    if (!m_prevFrames.front() ||
-        cmpFrameInfoCspResolution(&m_prevFrames.front()->frame, &prm->frameOut)) {
-        for (auto& f : m_prevFrames) {
-            f = m_cl->createFrameBuffer(prm->frameOut);
-            if (!f) {
-                return RGY_ERR_NULL_PTR;
-            }
-        }
+    //過去フレームはフレーム履歴から取得するので、ここでは確保しない
+    if (!m_outFrame ||
+        cmpFrameInfoCspResolution(&m_outFrame->frame, &prm->frameOut)) {
+        m_prevFrames.fill(nullptr);
         m_cacheIdx = 0;
         m_frameOut = 0;
+        m_outFrame = m_cl->frameHistory()->alloc(prm->frameOut);
+        if (!m_outFrame) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+            return RGY_ERR_MEMORY_ALLOC;
+        }
     }
-
-
-    auto err = AllocFrameBuf(prm->frameOut, 1);
-    if (err != RGY_ERR_NONE) {
-        AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
-        return RGY_ERR_MEMORY_ALLOC;
-    }
-    for (int i = 0; i < RGY_CSP_PLANES[m_frameBuf[0]->frame.csp]; i++) {
-        prm->frameOut.pitch[i] = m_frameBuf[0]->frame.pitch[i];
+    m_stage = (prm->historyStage) ? prm->historyStage : &m_prevFrames;
+    for (int i = 0; i < RGY_CSP_PLANES[m_outFrame->frame.csp]; i++) {
+        prm->frameOut.pitch[i] = m_outFrame->frame.pitch[i];
     }
     m_pathThrough &= (~(FILTER_PATHTHROUGH_TIMESTAMP));
 
@@ -207,7 +202,15 @@ RGY_ERR RGYFilterConvolution3D::run_filter(const RGYFrameInfo *pInputFrame, RGYF
         RGYCLFrame *pOutFrame = nullptr;
         *pOutputFrameNum = 1;
         if (ppOutputFrames[0] == nullptr) {
-            pOutFrame = m_frameBuf[0].get();
+            //後段のフィルタが参照中なら、別のバッファに出力する
+            if (m_outFrame.use_count() > 1) {
+                m_outFrame = m_cl->frameHistory()->alloc(m_param->frameOut);
+                if (!m_outFrame) {
+                    AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+                    return RGY_ERR_MEMORY_ALLOC;
+                }
+            }
+            pOutFrame = m_outFrame.get();
             ppOutputFrames[0] = &pOutFrame->frame;
         }
         if (pInputFrame->ptr[0]) {
@@ -238,30 +241,32 @@ RGY_ERR RGYFilterConvolution3D::run_filter(const RGYFrameInfo *pInputFrame, RGYF
                        RGY_CSP_NAMES[pInputFrame->csp], get_err_mes(sts));
             return sts;
         }
+        //後段のフィルタがコピーせずに参照できるよう、出力をフレーム履歴に登録する
+        if (ppOutputFrames[0] == &m_outFrame->frame) {
+            m_cl->frameHistory()->publish(static_cast<const RGYFilter *>(this), m_outFrame);
+        }
         m_frameOut++;
     } else {
         //出力フレームなし
         *pOutputFrameNum = 0;
         ppOutputFrames[0] = nullptr;
     }
-    //sourceキャッシュにコピー
+    //sourceキャッシュに追加 (前段のフィルタが履歴に登録したフレームならコピーせずに参照する)
     if (pInputFrame->ptr[0]) {
-        auto cacheFrame = &m_prevFrames[m_cacheIdx++ % m_prevFrames.size()]->frame;
-        sts = m_cl->copyFrame(cacheFrame, frameNext, nullptr, queue);
+        auto cacheFrame = m_cl->frameHistory()->add(m_stage, frameNext, queue, &sts);
         if (sts != RGY_ERR_NONE) {
             AddMessage(RGY_LOG_ERROR, _T("failed to set frame to data cache: %s.\n"), get_err_mes(sts));
             return RGY_ERR_CUDA;
         }
-        copyFrameProp(cacheFrame, frameNext);
+        m_prevFrames[m_cacheIdx++ % m_prevFrames.size()] = cacheFrame;
     }
     return sts;
 }
 
 void RGYFilterConvolution3D::close() {
     m_frameBuf.clear();
-    for (auto& f : m_prevFrames) {
-        f.reset();
-    }
+    m_prevFrames.fill(nullptr);
+    m_outFrame.reset();
     m_convolution3d.clear();
     m_cl.reset();
     m_bInterlacedWarn = false;
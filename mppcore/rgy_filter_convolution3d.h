@@ -55,7 +55,9 @@ protected:
 
     bool m_bInterlacedWarn;
     RGYOpenCLProgramAsync m_convolution3d;
-    std::array<std::unique_ptr<RGYCLFrame>, 2> m_prevFrames;
+    std::array<std::shared_ptr<RGYCLFrame>, 2> m_prevFrames;
+    std::shared_ptr<RGYCLFrame> m_outFrame; //後段のフィルタと共有するため、フレーム履歴から確保する
+    const void *m_stage; //フレーム履歴のキー
     int m_cacheIdx;
     int m_frameOut;
 };
@@ -153,16 +153,16 @@ RGYFilterDecimateFrameData::~RGYFilterDecimateFrameData() {
     m_log.reset();
 }
 
-RGY_ERR RGYFilterDecimateFrameData::set(const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent& event) {
+RGY_ERR RGYFilterDecimateFrameData::set(const void *stage, const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent& event) {
     m_inFrameId = inputFrameId;
     m_blockX = blockSizeX;
     m_blockY = blockSizeY;
     m_diffMaxBlock = std::numeric_limits<int64_t>::max();
     m_diffTotal = std::numeric_limits<int64_t>::max();
-    if (!m_buf) {
-        m_buf = m_cl->createFrameBuffer(pInputFrame->width, pInputFrame->height, pInputFrame->csp, pInputFrame->bitdepth);
-    }
-    auto err = m_cl->copyFrame(&m_buf->frame, pInputFrame, nullptr, queue, wait_events, &event);
+    //前段のフィルタが履歴に登録したフレームならコピーせずに参照する
+    //setOutputFrameでtimestamp/durationを書き換えるが、このstageの履歴を参照するのは自身のみなので問題ない
+    auto err = RGY_ERR_NONE;
+    m_buf = m_cl->frameHistory()->add(stage, pInputFrame, queue, wait_events, &event, &err);
     if (err != RGY_ERR_NONE) {
         m_log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("failed to set frame to data cache: %s.\n"), get_err_mes(err));
         return RGY_ERR_CUDA;
@@ -244,7 +244,7 @@ void RGYFilterDecimateFrameData::calcDiffFromTmp() {
     m_tmp->unmapBuffer();
 }
 
-RGYFilterDecimateCache::RGYFilterDecimateCache(shared_ptr<RGYOpenCLContext> context) : m_cl(context), m_inputFrames(0), m_frames() {
+RGYFilterDecimateCache::RGYFilterDecimateCache(shared_ptr<RGYOpenCLContext> context) : m_cl(context), m_stage(nullptr), m_inputFrames(0), m_frames() {
 
 }
 
@@ -253,8 +253,9 @@ RGYFilterDecimateCache::~RGYFilterDecimateCache() {
     m_log.reset();
 }
 
-void RGYFilterDecimateCache::init(int bufCount, int blockX, int blockY, std::shared_ptr<RGYLog> log) {
+void RGYFilterDecimateCache::init(const void *stage, int bufCount, int blockX, int blockY, std::shared_ptr<RGYLog> log) {
     m_log = log;
+    m_stage = stage;
     m_blockX = blockX;
     m_blockY = blockY;
     m_frames.clear();
@@ -265,7 +266,7 @@ void RGYFilterDecimateCache::init(int bufCount, int blockX, int blockY, std::sha
 
 RGY_ERR RGYFilterDecimateCache::add(const RGYFrameInfo *pInputFrame, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent& event) {
     const int id = m_inputFrames++;
-    return frame(id)->set(pInputFrame, id, m_blockX, m_blockY, queue, wait_events, event);
+    return frame(id)->set(m_stage, pInputFrame, id, m_blockX, m_blockY, queue, wait_events, event);
 }
 
 RGYFilterDecimate::RGYFilterDecimate(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_flushed(false), m_frameLastDropped(-1), m_frameLastInputDuration(0), m_decimate(), m_cache(context), m_eventDiff(), m_streamDiff(), m_streamTransfer() {
@@ -359,7 +360,7 @@ RGY_ERR RGYFilterDecimate::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RG
             return cl->buildResource(_T("RGY_FILTER_DECIMATE_CL"), _T("EXE_DATA"), build_options.c_str());
         }));
 
-        m_cache.init(prm->decimate.cycle + 1, prm->decimate.blockX, prm->decimate.blockY, m_pLog);
+        m_cache.init((prm->historyStage) ? prm->historyStage : (const void *)&m_cache, prm->decimate.cycle + 1, prm->decimate.blockX, prm->decimate.blockY, m_pLog);
 
         pParam->baseFps *= rgy_rational<int>(prm->decimate.cycle - prm->decimate.drop, prm->decimate.cycle);
 
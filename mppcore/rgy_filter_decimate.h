@@ -80,7 +80,7 @@ public:
     RGYCLFrame *get() { return m_buf.get(); }
     const RGYCLFrame *get() const { return m_buf.get(); }
     std::unique_ptr<RGYCLBuf>& tmp() { return m_tmp; }
-    RGY_ERR set(const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent& event);
+    RGY_ERR set(const void *stage, const RGYFrameInfo *pInputFrame, int inputFrameId, int blockSizeX, int blockSizeY, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent& event);
     int id() const { return m_inFrameId; }
     void calcDiffFromTmp();
 
@@ -92,7 +92,7 @@ private:
     int m_inFrameId;
     int m_blockX;
     int m_blockY;
-    std::unique_ptr<RGYCLFrame> m_buf;
+    std::shared_ptr<RGYCLFrame> m_buf; //フレーム履歴から取得 (前段のフィルタの出力を共有する場合がある)
     std::unique_ptr<RGYCLBuf> m_tmp;
     int64_t m_diffMaxBlock;
     int64_t m_diffTotal;
@@ -103,7 +103,7 @@ class RGYFilterDecimateCache {
 public:
     RGYFilterDecimateCache(shared_ptr<RGYOpenCLContext> context);
     ~RGYFilterDecimateCache();
-    void init(int bufCount, int blockX, int blockY, std::shared_ptr<RGYLog> log);
+    void init(const void *stage, int bufCount, int blockX, int blockY, std::shared_ptr<RGYLog> log);
     RGY_ERR add(const RGYFrameInfo *pInputFrame, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent& event);
     RGYFilterDecimateFrameData *frame(int iframe) {
         iframe = clamp(iframe, 0, m_inputFrames - 1);
@@ -116,6 +116,7 @@ public:
 private:
     shared_ptr<RGYOpenCLContext> m_cl;
     std::shared_ptr<RGYLog> m_log;
+    const void *m_stage; //フレーム履歴のキー
     int m_blockX;
     int m_blockY;
     int m_inputFrames;
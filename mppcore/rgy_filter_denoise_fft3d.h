@@ -40,6 +40,9 @@ public:
     virtual tstring print() const;
 };
 
+// 直近のフレームのFFTの結果 (周波数領域のブロック) を保持するリングバッファ
+// ブロックの配置とサイズはfft3dのパラメータに依存し、他のフィルタとは共有できないので、
+// RGYCLFrameHistoryは使用せず、初期化時に確保したバッファを上書きして使いまわす
 class RGYFilterDenoiseFFT3DBuffer {
 public:
     RGYFilterDenoiseFFT3DBuffer(shared_ptr<RGYOpenCLContext> context) : m_cl(context), m_bufFFT() {};
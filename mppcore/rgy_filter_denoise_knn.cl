@@ -2,6 +2,8 @@
 // Type
 // bit_depth
 // knn_radius
+// KNN_BLOCK_X
+// KNN_BLOCK_Y
 
 #ifndef clamp
 #define clamp(x, low, high) (((x) <= (high)) ? (((x) >= (low)) ? (x) : (low)) : (high))
@@ -30,10 +32,10 @@ __kernel void kernel_denoise_knn(
 
         #pragma unroll
         for (int i = -knn_radius; i <= knn_radius; i++) {
-            const int loadix = clamp(ix, 0, dstWidth-1);
+            const int loadix = clamp(ix + i, 0, dstWidth-1);
             #pragma unroll
             for (int j = -knn_radius; j <= knn_radius; j++) {
-                const int loadiy = clamp(iy, 0, dstHeight-1);
+                const int loadiy = clamp(iy + j, 0, dstHeight-1);
                 float clrIJ = (float)read_imagef(src, sampler, (int2)(loadix, loadiy)).x;
                 float distanceIJ = (center - clrIJ) * (center - clrIJ);
 
@@ -52,3 +54,58 @@ __kernel void kernel_denoise_knn(
         ptr[0] = (Type)clamp(lerpf(sum * native_recip(sumWeights), center, lerpQ) * (float)((1<<bit_depth)-1), 0.0f, (1<<bit_depth) - 0.1f);
     }
 }
+
+// 近傍画素をブロック+周辺knn_radius分まとめて共有メモリにロードし、全offsetで使いまわす
+__kernel void kernel_denoise_knn_tiled(
+    __global uchar *restrict pDst,
+    const int dstPitch, const int dstWidth, const int dstHeight,
+    __read_only image2d_t src,
+    const float strength, const float lerpC, const float weight_threshold, const float lerp_threshold) {
+    const float knn_window_area = (float)((2 * knn_radius + 1) * (2 * knn_radius + 1));
+    const float inv_knn_window_area = 1.0f / knn_window_area;
+    const int thx = get_local_id(0);
+    const int thy = get_local_id(1);
+    const int bx = get_group_id(0) * KNN_BLOCK_X;
+    const int by = get_group_id(1) * KNN_BLOCK_Y;
+    const int ix = bx + thx;
+    const int iy = by + thy;
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+
+    __local float shared[KNN_BLOCK_Y + 2 * knn_radius][KNN_BLOCK_X + 2 * knn_radius];
+    for (int j = thy; j < KNN_BLOCK_Y + 2 * knn_radius; j += KNN_BLOCK_Y) {
+        const int loadiy = clamp(by + j - knn_radius, 0, dstHeight - 1);
+        for (int i = thx; i < KNN_BLOCK_X + 2 * knn_radius; i += KNN_BLOCK_X) {
+            const int loadix = clamp(bx + i - knn_radius, 0, dstWidth - 1);
+            shared[j][i] = (float)read_imagef(src, sampler, (int2)(loadix, loadiy)).x;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (ix < dstWidth && iy < dstHeight) {
+        float fCount = 0.0f;
+        float sumWeights = 0.0f;
+        float sum = 0.0f;
+        const float center = shared[thy + knn_radius][thx + knn_radius];
+
+        #pragma unroll
+        for (int i = -knn_radius; i <= knn_radius; i++) {
+            #pragma unroll
+            for (int j = -knn_radius; j <= knn_radius; j++) {
+                const float clrIJ = shared[thy + knn_radius + j][thx + knn_radius + i];
+                const float distanceIJ = (center - clrIJ) * (center - clrIJ);
+
+                const float weightIJ = native_exp(-(distanceIJ * strength + (i * i + j * j) * inv_knn_window_area));
+
+                sum += clrIJ * weightIJ;
+
+                sumWeights += weightIJ;
+
+                fCount += (weightIJ > weight_threshold) ? inv_knn_window_area : 0;
+            }
+        }
+        const float lerpQ = (fCount > lerp_threshold) ? lerpC : 1.0f - lerpC;
+
+        __global Type *ptr = (__global Type *)(pDst + iy * dstPitch + ix * sizeof(Type));
+        ptr[0] = (Type)clamp(lerpf(sum * native_recip(sumWeights), center, lerpQ) * (float)((1<<bit_depth) - 1), 0.0f, (1<<bit_depth) - 0.1f);
+    }
+}
@@ -33,6 +33,8 @@
 #include "rgy_filter_denoise_knn.h"
 
 static const int KNN_RADIUS_MAX = 5;
+static const int KNN_BLOCK_X = 32;
+static const int KNN_BLOCK_Y = 8;
 
 RGY_ERR RGYFilterDenoiseKnn::denoisePlane(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) {
     auto prm = std::dynamic_pointer_cast<RGYFilterParamDenoiseKnn>(m_param);
@@ -42,8 +44,8 @@ RGY_ERR RGYFilterDenoiseKnn::denoisePlane(RGYFrameInfo *pOutputPlane, const RGYF
     }
     {
         const float strength = 1.0f / (prm->knn.strength * prm->knn.strength);
-        const char *kernel_name = "kernel_denoise_knn";
-        RGYWorkSize local(32, 8);
+        const char *kernel_name = (m_tiled) ? "kernel_denoise_knn_tiled" : "kernel_denoise_knn";
+        RGYWorkSize local(KNN_BLOCK_X, KNN_BLOCK_Y);
         RGYWorkSize global(pOutputPlane->width, pOutputPlane->height);
         auto err = m_knn.get()->kernel(kernel_name).config(queue, local, global, wait_events, event).launch(
             (cl_mem)pOutputPlane->ptr[0], pOutputPlane->pitch[0], pOutputPlane->width, pOutputPlane->height,
@@ -79,7 +81,7 @@ RGY_ERR RGYFilterDenoiseKnn::denoiseFrame(RGYFrameInfo *pOutputFrame, const RGYF
     return RGY_ERR_NONE;
 }
 
-RGYFilterDenoiseKnn::RGYFilterDenoiseKnn(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_knn(), m_srcImagePool() {
+RGYFilterDenoiseKnn::RGYFilterDenoiseKnn(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_tiled(false), m_knn(), m_srcImagePool(), m_outFrame() {
     m_name = _T("knn");
 }
 
@@ -124,29 +126,37 @@ RGY_ERR RGYFilterDenoiseKnn::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<
         AddMessage(RGY_LOG_ERROR, _T("th_weight should be 0.0 - 1.0.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
+    // 共有メモリに収まる場合は、近傍画素を共有メモリにロードして使いまわす
+    const size_t localMemRequired = sizeof(float) * (KNN_BLOCK_X + 2 * pKnnParam->knn.radius) * (KNN_BLOCK_Y + 2 * pKnnParam->knn.radius);
+    m_tiled = pKnnParam->allowTiled && localMemRequired <= RGYOpenCLDevice(m_cl->queue().devid()).info().local_mem_size;
+    AddMessage(RGY_LOG_DEBUG, _T("use %s kernel (local mem required %d bytes).\n"), (m_tiled) ? _T("tiled") : _T("simple"), (int)localMemRequired);
+
     auto prmPrev = std::dynamic_pointer_cast<RGYFilterParamDenoiseKnn>(m_param);
     if (!m_knn.get()
         || !prmPrev
         || RGY_CSP_BIT_DEPTH[prmPrev->frameOut.csp] != RGY_CSP_BIT_DEPTH[pParam->frameOut.csp]
         || prmPrev->knn.radius != pKnnParam->knn.radius) {
-        const auto options = strsprintf("-D Type=%s -D bit_depth=%d -D knn_radius=%d",
+        const auto options = strsprintf("-D Type=%s -D bit_depth=%d -D knn_radius=%d -D KNN_BLOCK_X=%d -D KNN_BLOCK_Y=%d",
             RGY_CSP_BIT_DEPTH[pKnnParam->frameOut.csp] > 8 ? "ushort" : "uchar",
             RGY_CSP_BIT_DEPTH[pKnnParam->frameOut.csp],
-            pKnnParam->knn.radius);
+            pKnnParam->knn.radius, KNN_BLOCK_X, KNN_BLOCK_Y);
         m_knn.set(m_cl->buildResourceAsync(_T("RGY_FILTER_DENOISE_KNN_CL"), _T("EXE_DATA"), options.c_str()));
     }
 
-    auto err = AllocFrameBuf(pKnnParam->frameOut, 1);
-    if (err != RGY_ERR_NONE) {
-        AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
-        return RGY_ERR_MEMORY_ALLOC;
+    if (!m_outFrame ||
+        cmpFrameInfoCspResolution(&m_outFrame->frame, &pKnnParam->frameOut)) {
+        m_outFrame = m_cl->frameHistory()->alloc(pKnnParam->frameOut);
+        if (!m_outFrame) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+            return RGY_ERR_MEMORY_ALLOC;
+        }
     }
-    for (int i = 0; i < RGY_CSP_PLANES[m_frameBuf[0]->frame.csp]; i++) {
-        pKnnParam->frameOut.pitch[i] = m_frameBuf[0]->frame.pitch[i];
+    for (int i = 0; i < RGY_CSP_PLANES[m_outFrame->frame.csp]; i++) {
+        pKnnParam->frameOut.pitch[i] = m_outFrame->frame.pitch[i];
     }
 
     //コピーを保存
-    setFilterInfo(pKnnParam->print());
+    setFilterInfo(pKnnParam->print() + ((m_tiled) ? _T(", tiled") : _T("")));
     m_param = pKnnParam;
     return sts;
 }
@@ -159,8 +169,15 @@ RGY_ERR RGYFilterDenoiseKnn::run_filter(const RGYFrameInfo *pInputFrame, RGYFram
 
     *pOutputFrameNum = 1;
     if (ppOutputFrames[0] == nullptr) {
-        auto pOutFrame = m_frameBuf[0].get();
-        ppOutputFrames[0] = &pOutFrame->frame;
+        //後段のフィルタが参照中なら、別のバッファに出力する
+        if (m_outFrame.use_count() > 1) {
+            m_outFrame = m_cl->frameHistory()->alloc(m_param->frameOut);
+            if (!m_outFrame) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+                return RGY_ERR_MEMORY_ALLOC;
+            }
+        }
+        ppOutputFrames[0] = &m_outFrame->frame;
     }
     ppOutputFrames[0]->picstruct = pInputFrame->picstruct;
     //if (interlaced(*pInputFrame)) {
@@ -186,13 +203,18 @@ RGY_ERR RGYFilterDenoiseKnn::run_filter(const RGYFrameInfo *pInputFrame, RGYFram
             RGY_CSP_NAMES[pInputFrame->csp], get_err_mes(sts));
         return sts;
     }
-
+    //後段のフィルタがコピーせずに参照できるよう、出力をフレーム履歴に登録する
+    //履歴のキーとなるため、ここでフレーム情報を設定しておく
+    if (ppOutputFrames[0] == &m_outFrame->frame) {
+        copyFramePropWithoutRes(ppOutputFrames[0], pInputFrame);
+        m_cl->frameHistory()->publish(static_cast<const RGYFilter *>(this), m_outFrame);
+    }
     return sts;
 }
 
 void RGYFilterDenoiseKnn::close() {
     m_srcImagePool.clear();
-    m_frameBuf.clear();
+    m_outFrame.reset();
     m_knn.clear();
     m_cl.reset();
     m_bInterlacedWarn = false;
@@ -36,7 +36,8 @@
 class RGYFilterParamDenoiseKnn : public RGYFilterParam {
 public:
     VppKnn knn;
-    RGYFilterParamDenoiseKnn() : knn() {};
+    bool allowTiled; // 共有メモリを使うkernelを許可する (falseならkernel_denoise_knnを使用)
+    RGYFilterParamDenoiseKnn() : knn(), allowTiled(true) {};
     virtual ~RGYFilterParamDenoiseKnn() {};
     virtual tstring print() const override { return knn.print(); };
 };
@@ -54,8 +55,10 @@ protected:
     virtual RGY_ERR denoiseFrame(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
 
     bool m_bInterlacedWarn;
+    bool m_tiled; // 共有メモリを使うkernelを使用するか
     RGYOpenCLProgramAsync m_knn;
     RGYCLFramePool m_srcImagePool;
+    std::shared_ptr<RGYCLFrame> m_outFrame; //後段のフィルタと共有するため、フレーム履歴から確保する
 };
 
 #endif //__RGY_FILTER_DENOISE_KNN_H__
@@ -1,5 +1,6 @@
 ﻿
 // Type
+// TmpVType (NLEANS_TILEDのみ)
 // TmpVTypeFP16
 // TmpVType8
 // TmpWPTypeFP16
@@ -19,6 +20,8 @@
 // NLEANS_BLOCK_X
 // NLEANS_BLOCK_Y
 
+// NLEANS_TILED
+
 #if TmpVTypeFP16 || TmpWPTypeFP16
 #pragma OPENCL EXTENSION cl_khr_fp16 : enable
 #endif
@@ -373,3 +376,128 @@ __kernel void kernel_denoise_nlmeans(
         ptr[0] = (Type)clamp(sum * native_recip(sumWeights) * ((1<<bit_depth) - 1), 0.0f, (1<<bit_depth) - 0.1f);
     }
 }
+
+#if NLEANS_TILED
+// ブロック+周辺(search_radius+template_radius)の画素を一度だけ共有メモリにロードし、すべてのoffsetで使いまわす
+// パッチ内の差分二乗和は、共有メモリ上で横方向・縦方向の順に窓の和をとって求める
+// 計算するoffset、画面端の扱い、fp16の使い方は複数パスのkernel(calc_diff_square, calc_v, calc_weight, normalize)と同じ
+#define TILE_RADIUS (search_radius + template_radius)
+#define TILE_X (NLEANS_BLOCK_X + 2 * TILE_RADIUS)
+#define TILE_Y (NLEANS_BLOCK_Y + 2 * TILE_RADIUS)
+#define DIFF_X (NLEANS_BLOCK_X + 2 * template_radius)
+#define DIFF_Y (NLEANS_BLOCK_Y + 2 * template_radius)
+
+// 画素(x, y)の共有メモリ上の位置
+#define TILE_IDX_X(x) ((x) - bx + TILE_RADIUS)
+#define TILE_IDX_Y(y) ((y) - by + TILE_RADIUS)
+
+// 画素q=clamp(p+(ex,ey))とclamp(q+(nx,ny))の差分二乗を、pを中心にパッチ内で足した値を返す
+// (ex,ey)=(0,0)なら自分の画素の重み、(ex,ey)=(-nx,-ny)なら(-nx,-ny)だけ離れた画素から足しこまれる重みに使う
+TmpVType patch_dist_tiled(
+    __local const Type srcTile[TILE_Y][TILE_X],
+    __local TmpVType diffTile[DIFF_Y][DIFF_X],
+    __local TmpVType hsumTile[DIFF_Y][NLEANS_BLOCK_X],
+    const int bx, const int by, const int thx, const int thy,
+    const int width, const int height,
+    const int nx, const int ny, const int ex, const int ey) {
+    // ブロック+周辺template_radius分の差分二乗
+    for (int j = thy; j < DIFF_Y; j += NLEANS_BLOCK_Y) {
+        const int qy = clamp(by + j - template_radius + ey, 0, height - 1);
+        const int ry = clamp(qy + ny, 0, height - 1);
+        for (int i = thx; i < DIFF_X; i += NLEANS_BLOCK_X) {
+            const int qx = clamp(bx + i - template_radius + ex, 0, width - 1);
+            const int rx = clamp(qx + nx, 0, width - 1);
+            const int diff = (int)srcTile[TILE_IDX_Y(qy)][TILE_IDX_X(qx)] - (int)srcTile[TILE_IDX_Y(ry)][TILE_IDX_X(rx)];
+            const float fdiff = (float)diff * (1.0f / ((1<<bit_depth) - 1));
+            diffTile[j][i] = (TmpVType)(fdiff * fdiff);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    // 横方向の窓の和
+    for (int j = thy; j < DIFF_Y; j += NLEANS_BLOCK_Y) {
+        TmpVType hsum = (TmpVType)0.0f;
+        for (int i = 0; i <= 2 * template_radius; i++) {
+            hsum += diffTile[j][thx + i];
+        }
+        hsumTile[j][thx] = hsum;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    // 縦方向の窓の和 = パッチ内の差分二乗和
+    TmpVType dist = (TmpVType)0.0f;
+    for (int j = 0; j <= 2 * template_radius; j++) {
+        dist += hsumTile[thy + j][thx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE); // 次の呼び出しでdiffTile/hsumTileを上書きする前に同期
+    return dist;
+}
+
+TmpWPType tiled_weight(const TmpVType dist, const float sigma, const float inv_param_h_h) {
+    const TmpWPType v = (TmpWPType)dist; // expを使う前にfp32に変換
+    return tmpvtype_exp(-max(v - (TmpWPType)(2.0f * sigma), (TmpWPType)0.0f) * (TmpWPType)inv_param_h_h);
+}
+
+__kernel void kernel_denoise_nlmeans_tiled(
+    __global uchar *restrict pDst, const int dstPitch,
+    const __global uchar *restrict pSrc, const int srcPitch,
+    const int width, const int height,
+    const float sigma, const float inv_param_h_h) {
+    const int thx = get_local_id(0);
+    const int thy = get_local_id(1);
+    const int bx = get_group_id(0) * NLEANS_BLOCK_X;
+    const int by = get_group_id(1) * NLEANS_BLOCK_Y;
+    const int ix = bx + thx;
+    const int iy = by + thy;
+
+    __local Type srcTile[TILE_Y][TILE_X];
+    __local TmpVType diffTile[DIFF_Y][DIFF_X];
+    __local TmpVType hsumTile[DIFF_Y][NLEANS_BLOCK_X];
+
+    // srcTile[j][i] は 画素(clamp(bx + i - TILE_RADIUS), clamp(by + j - TILE_RADIUS))
+    for (int j = thy; j < TILE_Y; j += NLEANS_BLOCK_Y) {
+        const int srcy = clamp(by + j - TILE_RADIUS, 0, height - 1);
+        for (int i = thx; i < TILE_X; i += NLEANS_BLOCK_X) {
+            const int srcx = clamp(bx + i - TILE_RADIUS, 0, width - 1);
+            srcTile[j][i] = *(const __global Type *)(pSrc + srcy * srcPitch + srcx * sizeof(Type));
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // 画面外のスレッドは書き込まないが、同期のため計算には参加させる
+    const int cx = clamp(ix, 0, width - 1);
+    const int cy = clamp(iy, 0, height - 1);
+    TmpWPType sumWeights = (TmpWPType)0.0f;
+    TmpWPType sum = (TmpWPType)0.0f;
+    // nxnylist()と同じく、nx-nyの対称性を使って半分のoffsetのみ列挙する
+    for (int ny = -search_radius; ny <= 0; ny++) {
+        for (int nx = -search_radius; nx <= search_radius; nx++) {
+            if (ny * (2 * search_radius - 1) + nx >= 0) continue;
+            // 自分の画素: calc_weightで自分に足しこむ分
+            {
+                const TmpWPType weight = tiled_weight(patch_dist_tiled(srcTile, diffTile, hsumTile, bx, by, thx, thy, width, height, nx, ny, 0, 0), sigma, inv_param_h_h);
+                const int qx = clamp(cx + nx, 0, width - 1);
+                const int qy = clamp(cy + ny, 0, height - 1);
+                const TmpWPType pix = srcTile[TILE_IDX_Y(qy)][TILE_IDX_X(qx)] * (1.0f / ((1<<bit_depth) - 1));
+                sumWeights += weight;
+                sum += weight * pix;
+            }
+            // (-nx,-ny)だけ離れた画素: add_reverse_side_offsetで足しこまれる分
+            // 足しこみ元が画面外の場合は加算しない
+            {
+                const TmpWPType weight = tiled_weight(patch_dist_tiled(srcTile, diffTile, hsumTile, bx, by, thx, thy, width, height, nx, ny, -nx, -ny), sigma, inv_param_h_h);
+                const int px = cx - nx;
+                const int py = cy - ny;
+                if (0 <= px && px < width && 0 <= py && py < height) {
+                    const TmpWPType pix = srcTile[TILE_IDX_Y(py)][TILE_IDX_X(px)] * (1.0f / ((1<<bit_depth) - 1));
+                    sumWeights += weight;
+                    sum += weight * pix;
+                }
+            }
+        }
+    }
+    if (ix < width && iy < height) {
+        const float srcPixF = (float)srcTile[TILE_IDX_Y(iy)][TILE_IDX_X(ix)] * (float)(1.0f / ((1<<bit_depth) - 1));
+        __global Type *ptr = (__global Type *)(pDst + iy * dstPitch + ix * sizeof(Type));
+        ptr[0] = (Type)clamp(((float)sum + srcPixF) * native_recip((float)sumWeights + 1.0f) * ((1<<bit_depth) - 1), 0.0f, (1<<bit_depth) - 0.1f);
+    }
+}
+#endif //#if NLEANS_TILED
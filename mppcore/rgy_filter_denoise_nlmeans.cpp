@@ -190,10 +190,42 @@ RGY_ERR RGYFilterDenoiseNLMeans::denoisePlane(
     return RGY_ERR_NONE;
 }
 
+RGY_ERR RGYFilterDenoiseNLMeans::denoisePlaneTiled(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) {
+    auto prm = std::dynamic_pointer_cast<RGYFilterParamDenoiseNLMeans>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    const char *kernel_name = "kernel_denoise_nlmeans_tiled";
+    RGYWorkSize local(NLEANS_BLOCK_X, NLEANS_BLOCK_Y);
+    RGYWorkSize global(pOutputPlane->width, pOutputPlane->height);
+    auto err = m_nlmeansTiled->get()->kernel(kernel_name).config(queue, local, global, wait_events, event).launch(
+        (cl_mem)pOutputPlane->ptr[0], pOutputPlane->pitch[0],
+        (cl_mem)pInputPlane->ptr[0], pInputPlane->pitch[0],
+        pOutputPlane->width, pOutputPlane->height,
+        prm->nlmeans.sigma, 1.0f / (prm->nlmeans.h * prm->nlmeans.h));
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("error at %s (denoisePlaneTiled(%s)): %s.\n"),
+            char_to_tstring(kernel_name).c_str(), RGY_CSP_NAMES[pInputPlane->csp], get_err_mes(err));
+        return err;
+    }
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR RGYFilterDenoiseNLMeans::denoiseFrame(RGYFrameInfo *pOutputFrame, const RGYFrameInfo *pInputFrame, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) {
     for (int i = 0; i < RGY_CSP_PLANES[pOutputFrame->csp]; i++) {
         auto planeDst = getPlane(pOutputFrame, (RGY_PLANE)i);
         auto planeSrc = getPlane(pInputFrame, (RGY_PLANE)i);
+        if (m_nlmeansTiled) {
+            const std::vector<RGYOpenCLEvent> &plane_wait_event = (i == 0) ? wait_events : std::vector<RGYOpenCLEvent>();
+            RGYOpenCLEvent *plane_event = (i == RGY_CSP_PLANES[pOutputFrame->csp] - 1) ? event : nullptr;
+            auto err = denoisePlaneTiled(&planeDst, &planeSrc, queue, plane_wait_event, plane_event);
+            if (err != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("Failed to denoise(nlmeans) plane(%d): %s\n"), i, get_err_mes(err));
+                return err;
+            }
+            continue;
+        }
         auto planeTmpU = getPlane(&m_tmpBuf[TMP_U]->frame, (RGY_PLANE)i);
         auto planeTmpV = getPlane(&m_tmpBuf[TMP_V]->frame, (RGY_PLANE)i);
         std::array<RGYFrameInfo, RGY_NLMEANS_DXDY_STEP+1> pTmpIWPlane;
@@ -209,14 +241,14 @@ RGY_ERR RGYFilterDenoiseNLMeans::denoiseFrame(RGYFrameInfo *pOutputFrame, const
         auto err = denoisePlane(&planeDst, &planeTmpU, &planeTmpV, pTmpIWPlane.data(), &planeSrc,
             queue, plane_wait_event, plane_event);
         if (err != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("Failed to denoise(nlmeans) frame(%d) %s: %s\n"), i, cl_errmes(err));
-            return err_cl_to_rgy(err);
+            AddMessage(RGY_LOG_ERROR, _T("Failed to denoise(nlmeans) plane(%d): %s\n"), i, get_err_mes(err));
+            return err;
         }
     }
     return RGY_ERR_NONE;
 }
 
-RGYFilterDenoiseNLMeans::RGYFilterDenoiseNLMeans(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_nlmeans(), m_tmpBuf() {
+RGYFilterDenoiseNLMeans::RGYFilterDenoiseNLMeans(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_nlmeans(), m_nlmeansTiled(), m_tmpBuf(), m_outFrame() {
     m_name = _T("nlmeans");
 }
 
@@ -279,8 +311,49 @@ RGY_ERR RGYFilterDenoiseNLMeans::init(shared_ptr<RGYFilterParam> pParam, shared_
     if (prm->nlmeans.sharedMem && !shared_mem_opt_possible) {
         prm->nlmeans.sharedMem = false;
     }
+    // sharedメモリの使用が許可されていて、ブロック+周辺の画素と差分二乗の作業領域が共有メモリに収まる場合は、1パスのkernelを使用する
+    // 1パスのkernelもfp16の設定に従って差分二乗和・重みの型を切り替える
+    const int template_radius = prm->nlmeans.patchSize / 2;
+    const size_t tiledLocalMem =
+          (RGY_CSP_BIT_DEPTH[prm->frameOut.csp] > 8 ? 2 : 1)
+            * (NLEANS_BLOCK_X + 2 * (search_radius + template_radius)) * (NLEANS_BLOCK_Y + 2 * (search_radius + template_radius)) // srcTile
+        + (use_vtype_fp16 ? 2 : 4) * (
+              (NLEANS_BLOCK_X + 2 * template_radius) * (NLEANS_BLOCK_Y + 2 * template_radius) // diffTile
+            +  NLEANS_BLOCK_X                        * (NLEANS_BLOCK_Y + 2 * template_radius)); // hsumTile
+    const bool use_tiled = prm->nlmeans.sharedMem
+        && tiledLocalMem <= RGYOpenCLDevice(m_cl->queue().devid()).info().local_mem_size;
+    AddMessage(RGY_LOG_DEBUG, _T("use %s kernel (tiled kernel requires %d bytes of local mem, shared mem %s).\n"),
+        (use_tiled) ? _T("tiled") : _T("multi pass"), (int)tiledLocalMem, (prm->nlmeans.sharedMem) ? _T("on") : _T("off"));
+
     auto prmPrev = std::dynamic_pointer_cast<RGYFilterParamDenoiseNLMeans>(m_param);
-    if (m_nlmeans.size() == 0
+    if (use_tiled) {
+        m_nlmeans.clear();
+        if (!m_nlmeansTiled
+            || !prmPrev
+            || RGY_CSP_BIT_DEPTH[prmPrev->frameOut.csp] != RGY_CSP_BIT_DEPTH[pParam->frameOut.csp]
+            || prmPrev->nlmeans.patchSize != prm->nlmeans.patchSize
+            || prmPrev->nlmeans.searchSize != prm->nlmeans.searchSize
+            || prmPrev->nlmeans.fp16 != prm->nlmeans.fp16) {
+            const auto options = strsprintf("-D Type=%s -D bit_depth=%d"
+                " -D TmpVType=%s -D TmpVType8=%s -D TmpVTypeFP16=%d"
+                " -D TmpWPType=%s -D TmpWPType2=%s -D TmpWPType8=%s -D TmpWPTypeFP16=%d"
+                " -D search_radius=%d -D template_radius=%d -D shared_radius=%d -D SHARED_OPT=0"
+                " -D NLEANS_BLOCK_X=%d -D NLEANS_BLOCK_Y=%d -D offset_count=1 -D NLEANS_TILED=1",
+                RGY_CSP_BIT_DEPTH[prm->frameOut.csp] > 8 ? "ushort" : "uchar",
+                RGY_CSP_BIT_DEPTH[prm->frameOut.csp],
+                use_vtype_fp16 ? "half" : "float",
+                use_vtype_fp16 ? "half8" : "float8",
+                use_vtype_fp16 ? 1 : 0,
+                use_wptype_fp16 ? "half" : "float",
+                use_wptype_fp16 ? "half2" : "float2",
+                use_wptype_fp16 ? "half8" : "float8",
+                use_wptype_fp16 ? 1 : 0,
+                search_radius, template_radius, std::max(search_radius, template_radius),
+                NLEANS_BLOCK_X, NLEANS_BLOCK_Y);
+            m_nlmeansTiled = std::make_unique<RGYOpenCLProgramAsync>();
+            m_nlmeansTiled->set(m_cl->buildResourceAsync(_T("RGY_FILTER_DENOISE_NLMEANS_CL"), _T("EXE_DATA"), options.c_str()));
+        }
+    } else if (m_nlmeans.size() == 0
         || !prmPrev
         || RGY_CSP_BIT_DEPTH[prmPrev->frameOut.csp] != RGY_CSP_BIT_DEPTH[pParam->frameOut.csp]
         || prmPrev->nlmeans.patchSize != prm->nlmeans.patchSize
@@ -289,7 +362,6 @@ RGY_ERR RGYFilterDenoiseNLMeans::init(shared_ptr<RGYFilterParam> pParam, shared_
         || prmPrev->nlmeans.fp16 != prm->nlmeans.fp16) {
         std::vector<std::pair<int, int>> nxny = nxnylist(search_radius);
         auto add_program = [&](const int offset_count) {
-            const int template_radius = prm->nlmeans.patchSize / 2;
             const int shared_radius = std::max(search_radius, template_radius);
             const auto options = strsprintf("-D Type=%s -D bit_depth=%d"
                 " -D TmpVType8=%s -D TmpVTypeFP16=%d"
@@ -311,6 +383,7 @@ RGY_ERR RGYFilterDenoiseNLMeans::init(shared_ptr<RGYFilterParam> pParam, shared_
             m_nlmeans[offset_count]->set(m_cl->buildResourceAsync(_T("RGY_FILTER_DENOISE_NLMEANS_CL"), _T("EXE_DATA"), options.c_str()));
         };
         m_nlmeans.clear();
+        m_nlmeansTiled.reset();
         if (nxny.size() >= RGY_NLMEANS_DXDY_STEP) add_program(RGY_NLMEANS_DXDY_STEP);
         if (nxny.size() % RGY_NLMEANS_DXDY_STEP) add_program(nxny.size() % RGY_NLMEANS_DXDY_STEP);
     }
@@ -323,7 +396,8 @@ RGY_ERR RGYFilterDenoiseNLMeans::init(shared_ptr<RGYFilterParam> pParam, shared_
             tmpBufWidth = prm->frameOut.width * ((use_wptype_fp16) ? 4 /*half2*/ : 8 /*float2*/);
         }
         // sharedメモリを使う場合、TMP_U, TMP_VとTMP_IW0～TMP_IW3のみ使用する(TMP_IW4以降は不要)
-        if (prm->nlmeans.sharedMem && i >= 6) {
+        // 1パスのkernelを使う場合は、一時バッファは不要
+        if (use_tiled || (prm->nlmeans.sharedMem && i >= 6)) {
             m_tmpBuf[i].reset();
             continue;
         }
@@ -354,17 +428,20 @@ RGY_ERR RGYFilterDenoiseNLMeans::init(shared_ptr<RGYFilterParam> pParam, shared_
         }
     }
 
-    auto err = AllocFrameBuf(prm->frameOut, 1);
-    if (err != RGY_ERR_NONE) {
-        AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
-        return RGY_ERR_MEMORY_ALLOC;
+    if (!m_outFrame ||
+        cmpFrameInfoCspResolution(&m_outFrame->frame, &prm->frameOut)) {
+        m_outFrame = m_cl->frameHistory()->alloc(prm->frameOut);
+        if (!m_outFrame) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+            return RGY_ERR_MEMORY_ALLOC;
+        }
     }
-    for (int i = 0; i < RGY_CSP_PLANES[m_frameBuf[0]->frame.csp]; i++) {
-        prm->frameOut.pitch[i] = m_frameBuf[0]->frame.pitch[i];
+    for (int i = 0; i < RGY_CSP_PLANES[m_outFrame->frame.csp]; i++) {
+        prm->frameOut.pitch[i] = m_outFrame->frame.pitch[i];
     }
 
     //コピーを保存
-    setFilterInfo(prm->print());
+    setFilterInfo(prm->print() + ((use_tiled) ? _T(", tiled") : _T("")));
     m_param = prm;
     return sts;
 }
@@ -377,8 +454,15 @@ RGY_ERR RGYFilterDenoiseNLMeans::run_filter(const RGYFrameInfo *pInputFrame, RGY
 
     *pOutputFrameNum = 1;
     if (ppOutputFrames[0] == nullptr) {
-        auto pOutFrame = m_frameBuf[0].get();
-        ppOutputFrames[0] = &pOutFrame->frame;
+        //後段のフィルタが参照中なら、別のバッファに出力する
+        if (m_outFrame.use_count() > 1) {
+            m_outFrame = m_cl->frameHistory()->alloc(m_param->frameOut);
+            if (!m_outFrame) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+                return RGY_ERR_MEMORY_ALLOC;
+            }
+        }
+        ppOutputFrames[0] = &m_outFrame->frame;
     }
     ppOutputFrames[0]->picstruct = pInputFrame->picstruct;
     //if (interlaced(*pInputFrame)) {
@@ -390,6 +474,10 @@ RGY_ERR RGYFilterDenoiseNLMeans::run_filter(const RGYFrameInfo *pInputFrame, RGY
             return RGY_ERR_OPENCL_CRUSH;
         }
     }
+    if (m_nlmeansTiled && !m_nlmeansTiled->get()) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to load RGY_FILTER_DENOISE_NLMEANS_CL(m_nlmeansTiled)\n"));
+        return RGY_ERR_OPENCL_CRUSH;
+    }
     const auto memcpyKind = getMemcpyKind(pInputFrame->mem_type, ppOutputFrames[0]->mem_type);
     if (memcpyKind != RGYCLMemcpyD2D) {
         AddMessage(RGY_LOG_ERROR, _T("only supported on device memory.\n"));
@@ -406,13 +494,19 @@ RGY_ERR RGYFilterDenoiseNLMeans::run_filter(const RGYFrameInfo *pInputFrame, RGY
             RGY_CSP_NAMES[pInputFrame->csp], get_err_mes(sts));
         return sts;
     }
-
+    //後段のフィルタがコピーせずに参照できるよう、出力をフレーム履歴に登録する
+    //履歴のキーとなるため、ここでフレーム情報を設定しておく
+    if (ppOutputFrames[0] == &m_outFrame->frame) {
+        copyFramePropWithoutRes(ppOutputFrames[0], pInputFrame);
+        m_cl->frameHistory()->publish(static_cast<const RGYFilter *>(this), m_outFrame);
+    }
     return sts;
 }
 
 void RGYFilterDenoiseNLMeans::close() {
-    m_frameBuf.clear();
+    m_outFrame.reset();
     m_nlmeans.clear();
+    m_nlmeansTiled.reset();
     for (auto& f : m_tmpBuf) {
         f.reset();
     }
@@ -59,10 +59,13 @@ protected:
         RGYFrameInfo *pTmpIWPlane,
         const RGYFrameInfo *pInputPlane,
         RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
+    virtual RGY_ERR denoisePlaneTiled(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
     virtual RGY_ERR denoiseFrame(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
 
     std::unordered_map<int, std::unique_ptr<RGYOpenCLProgramAsync>> m_nlmeans;
+    std::unique_ptr<RGYOpenCLProgramAsync> m_nlmeansTiled; // 共有メモリに収まる場合に使用する1パスのkernel
     std::array<std::unique_ptr<RGYCLFrame>, 2 + 1 + RGY_NLMEANS_DXDY_STEP> m_tmpBuf;
+    std::shared_ptr<RGYCLFrame> m_outFrame; //後段のフィルタと共有するため、フレーム履歴から確保する
 };
 
 #endif //__RGY_FILTER_DENOISE_KNN_H__
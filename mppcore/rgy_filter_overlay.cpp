@@ -108,6 +108,11 @@ RGYFilterOverlay::RGYFilterOverlay(std::shared_ptr<RGYOpenCLContext> context) :
     m_frame(),
     m_alpha(),
     m_overlay(),
+    m_cache(),
+    m_cacheBytes(0),
+    m_cacheEnabled(false),
+    m_cacheComplete(false),
+    m_cacheIdx(0),
     m_bInterlacedWarn(false) {
     m_name = _T("overlay");
 }
@@ -143,6 +148,10 @@ RGY_ERR RGYFilterOverlay::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGY
         AddMessage(RGY_LOG_ERROR, _T("alpha should be 0.0 - 1.0.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
+    if (prm->overlay.cache < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("cache should be a positive value.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
     if (!m_param
         || std::dynamic_pointer_cast<RGYFilterParamOverlay>(m_param)->overlay != prm->overlay) {
         auto options = strsprintf("-D Type=%s -D bit_depth=%d",
@@ -151,6 +160,9 @@ RGY_ERR RGYFilterOverlay::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGY
         m_overlay.set(m_cl->buildResourceAsync(_T("RGY_FILTER_OVERLAY_CL"), _T("EXE_DATA"), options.c_str()));
     }
 
+    clearCache();
+    m_cacheEnabled = prm->overlay.cache > 0;
+
     sts = initInput(prm.get());
     if (sts != RGY_ERR_NONE) {
         return sts;
@@ -693,10 +705,86 @@ RGY_ERR RGYFilterOverlay::getFrame(RGYOpenCLQueue& queue) {
     if (sts != RGY_ERR_NONE) {
         return sts;
     }
+    sts = addCacheFrame(queue);
+    if (sts != RGY_ERR_NONE) {
+        return sts;
+    }
     m_inputFrames++;
     return RGY_ERR_NONE;
 }
 
+static size_t overlay_frame_bytes(const RGYFrameInfo *frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < RGY_CSP_PLANES[frame->csp]; i++) {
+        const auto plane = getPlane(frame, (RGY_PLANE)i);
+        bytes += (size_t)plane.pitch[0] * plane.height;
+    }
+    return bytes;
+}
+
+void RGYFilterOverlay::clearCache() {
+    m_cache.clear();
+    m_cacheBytes = 0;
+    m_cacheEnabled = false;
+    m_cacheComplete = false;
+    m_cacheIdx = 0;
+}
+
+RGY_ERR RGYFilterOverlay::addCacheFrame(RGYOpenCLQueue& queue) {
+    if (!m_cacheEnabled) {
+        return RGY_ERR_NONE;
+    }
+    auto prm = std::dynamic_pointer_cast<RGYFilterParamOverlay>(m_param);
+    if (!prm) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    //loopしない動画は再生が1回きりなので、キャッシュしても意味がない
+    //静止画かどうかは1フレーム目の時点ではわからないので、2フレーム目が来た時点で判定する
+    if (!prm->overlay.loop && m_inputFrames > 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("overlay is not a still image and loop is off, cache disabled.\n"));
+        clearCache();
+        return RGY_ERR_NONE;
+    }
+    const size_t frameBytes = overlay_frame_bytes(m_frame.inputPtr) + overlay_frame_bytes(m_alpha.inputPtr);
+    const size_t cacheLimit = (size_t)prm->overlay.cache << 20;
+    if (m_cacheBytes + frameBytes > cacheLimit) {
+        AddMessage(RGY_LOG_DEBUG, _T("overlay cache exceeds limit (%d MB) at frame %d, cache disabled.\n"), prm->overlay.cache, m_inputFrames);
+        clearCache();
+        return RGY_ERR_NONE;
+    }
+    RGYFilterOverlayCacheFrame cacheFrame;
+    cacheFrame.frame = m_cl->createFrameBuffer(*m_frame.inputPtr);
+    cacheFrame.alpha = m_cl->createFrameBuffer(*m_alpha.inputPtr);
+    if (!cacheFrame.frame || !cacheFrame.alpha) {
+        AddMessage(RGY_LOG_WARN, _T("failed to allocate overlay cache at frame %d, cache disabled.\n"), m_inputFrames);
+        clearCache();
+        return RGY_ERR_NONE;
+    }
+    auto err = m_cl->copyFrame(&cacheFrame.frame->frame, m_frame.inputPtr, nullptr, queue);
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to copy frame to cache: %s.\n"), get_err_mes(err));
+        return err;
+    }
+    err = m_cl->copyFrame(&cacheFrame.alpha->frame, m_alpha.inputPtr, nullptr, queue);
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to copy alpha to cache: %s.\n"), get_err_mes(err));
+        return err;
+    }
+    m_cache.push_back(std::move(cacheFrame));
+    m_cacheBytes += frameBytes;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYFilterOverlay::getCacheFrame() {
+    if (m_cacheIdx >= (int)m_cache.size()) {
+        return RGY_ERR_MORE_DATA;
+    }
+    m_frame.inputPtr = &m_cache[m_cacheIdx].frame->frame;
+    m_alpha.inputPtr = &m_cache[m_cacheIdx].alpha->frame;
+    m_cacheIdx++;
+    return RGY_ERR_NONE;
+}
 
 RGY_ERR RGYFilterOverlay::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, RGYOpenCLQueue& queue_main, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent *event) {
     RGY_ERR sts = RGY_ERR_NONE;
@@ -732,13 +820,26 @@ RGY_ERR RGYFilterOverlay::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameIn
         AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
-    sts = getFrame(queue_main);
+    sts = (m_cacheComplete) ? getCacheFrame() : getFrame(queue_main);
     if (sts == RGY_ERR_MORE_DATA) {
         if (m_inputFrames == 0) {
             AddMessage(RGY_LOG_ERROR, _T("Unknown error.\n"));
             return RGY_ERR_UNKNOWN;
-        } else if (m_inputFrames > 1) {
-            if (prm->overlay.loop) { // loopさせる場合はファイルを開きなおして再読み込み
+        }
+        if (m_cacheEnabled && !m_cacheComplete) {
+            //全フレームをキャッシュできたので、以降はデコーダを閉じてキャッシュから再生する
+            AddMessage(RGY_LOG_DEBUG, _T("cached all %d overlay frames (%.1f MB).\n"), (int)m_cache.size(), m_cacheBytes / (double)(1024 * 1024));
+            m_cacheComplete = true;
+            m_codecCtxDec.reset();
+            m_formatCtx.reset();
+        }
+        if (m_inputFrames > 1) {
+            if (prm->overlay.loop && m_cacheComplete) { // キャッシュ済みなら先頭から再生しなおす
+                m_cacheIdx = 0;
+                if ((sts = getCacheFrame()) != RGY_ERR_NONE) {
+                    return sts;
+                }
+            } else if (prm->overlay.loop) { // loopさせる場合はファイルを開きなおして再読み込み
                 m_codecCtxDec.reset();
                 m_formatCtx.reset();
                 if ((sts = initInput(prm.get())) != RGY_ERR_NONE) {
@@ -773,6 +874,7 @@ RGY_ERR RGYFilterOverlay::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameIn
 }
 
 void RGYFilterOverlay::close() {
+    clearCache();
     m_convert.reset();
     m_codecCtxDec.reset();
     m_formatCtx.reset();
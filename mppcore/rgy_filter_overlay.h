@@ -55,6 +55,12 @@ class RGYFilterOverlay : public RGYFilter {
         RGYFilterOverlayFrame() : crop(), resize(), dev(), inputPtr(nullptr) {};
         void close();
     };
+    struct RGYFilterOverlayCacheFrame {
+        std::unique_ptr<RGYCLFrame> frame;
+        std::unique_ptr<RGYCLFrame> alpha;
+
+        RGYFilterOverlayCacheFrame() : frame(), alpha() {};
+    };
 public:
     RGYFilterOverlay(std::shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterOverlay();
@@ -67,6 +73,9 @@ protected:
     std::tuple<RGY_ERR, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> getFramePkt();
     RGY_ERR getFrame(RGYOpenCLQueue& queue);
     RGY_ERR prepareFrameDev(RGYFilterOverlayFrame& target, RGYOpenCLQueue& queue);
+    RGY_ERR addCacheFrame(RGYOpenCLQueue& queue);
+    RGY_ERR getCacheFrame();
+    void clearCache();
     RGY_ERR overlayPlane(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, const RGYFrameInfo *pOverlay, const RGYFrameInfo *pAlpha, const int posX, const int posY,
         RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent *event);
     RGY_ERR overlayFrame(RGYFrameInfo *pOutputFrame, const RGYFrameInfo *pInputFrame, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent *event);
@@ -80,6 +89,11 @@ protected:
     RGYFilterOverlayFrame m_frame;
     RGYFilterOverlayFrame m_alpha;
     RGYOpenCLProgramAsync m_overlay;
+    std::vector<RGYFilterOverlayCacheFrame> m_cache; // crop/resize済みのフレームとalphaのキャッシュ
+    size_t m_cacheBytes;   // キャッシュの使用量
+    bool m_cacheEnabled;   // キャッシュへの追加を行うか
+    bool m_cacheComplete;  // 全フレームをキャッシュ済み (以降はデコードせずキャッシュから再生)
+    int m_cacheIdx;        // 次に再生するキャッシュのindex
 
     bool m_bInterlacedWarn;
 };
@@ -233,3 +233,49 @@ __kernel void kernel_resize(
         ptr[0] = (Type)clamp(clr, 0.0f, (1 << bit_depth) - 0.1f);
     }
 }
+
+// 分離型リサイズ (横方向)
+// 出力画素ごとの参照開始位置と正規化済みの重みはhost側で計算済み
+// 出力は縦方向の処理用に、floatの中間バッファに書き出す
+__kernel void kernel_resize_sep_h(
+    __global uchar *restrict pDst, const int dstPitch, const int dstWidth, const int dstHeight,
+    __global const uchar *restrict pSrc, const int srcPitch, const int srcWidth,
+    __global const int *restrict pSrcFirst, __global const float *restrict pWeight, const int taps
+) {
+    const int ix = get_global_id(0);
+    const int iy = get_global_id(1);
+
+    if (ix < dstWidth && iy < dstHeight) {
+        const int srcFirst = pSrcFirst[ix];
+        __global const float *weight = pWeight + ix * taps;
+        __global const Type *srcLine = (__global const Type *)(pSrc + iy * srcPitch);
+        float clr = 0.0f;
+        for (int i = 0; i < taps; i++) {
+            clr += (float)srcLine[min(srcFirst + i, srcWidth - 1)] * weight[i];
+        }
+        __global float *ptr = (__global float *)(pDst + iy * dstPitch + ix * sizeof(float));
+        ptr[0] = clr;
+    }
+}
+
+// 分離型リサイズ (縦方向)
+__kernel void kernel_resize_sep_v(
+    __global uchar *restrict pDst, const int dstPitch, const int dstWidth, const int dstHeight,
+    __global const uchar *restrict pSrc, const int srcPitch, const int srcHeight,
+    __global const int *restrict pSrcFirst, __global const float *restrict pWeight, const int taps
+) {
+    const int ix = get_global_id(0);
+    const int iy = get_global_id(1);
+
+    if (ix < dstWidth && iy < dstHeight) {
+        const int srcFirst = pSrcFirst[iy];
+        __global const float *weight = pWeight + iy * taps;
+        float clr = 0.0f;
+        for (int j = 0; j < taps; j++) {
+            __global const float *srcLine = (__global const float *)(pSrc + min(srcFirst + j, srcHeight - 1) * srcPitch);
+            clr += srcLine[ix] * weight[j];
+        }
+        __global Type* ptr = (__global Type*)(pDst + iy * dstPitch + ix * sizeof(Type));
+        ptr[0] = (Type)clamp(clr, 0.0f, (1 << bit_depth) - 0.1f);
+    }
+}
@@ -95,6 +95,67 @@ static inline RESIZE_WEIGHT_TYPE get_weight_type(const RGY_VPP_RESIZE_ALGO inter
     return type;
 }
 
+static const auto SPLINE16_WEIGHT = std::vector<float>{
+    1.0f,       -9.0f/5.0f,  -1.0f/5.0f, 1.0f,
+    -1.0f/3.0f,  9.0f/5.0f, -46.0f/15.0f, 8.0f/5.0f
+};
+static const auto SPLINE36_WEIGHT = std::vector<float>{
+    13.0f/11.0f, -453.0f/209.0f,    -3.0f/209.0f,  1.0f,
+    -6.0f/11.0f,  612.0f/209.0f, -1038.0f/209.0f,  540.0f/209.0f,
+    1.0f/11.0f, -159.0f/209.0f,   434.0f/209.0f, -384.0f/209.0f
+};
+static const auto SPLINE64_WEIGHT = std::vector<float>{
+    49.0f/41.0f, -6387.0f/2911.0f,     -3.0f/2911.0f,  1.0f,
+    -24.0f/41.0f,  9144.0f/2911.0f, -15504.0f/2911.0f,  8064.0f/2911.0f,
+    6.0f/41.0f, -3564.0f/2911.0f,   9726.0f/2911.0f, -8604.0f/2911.0f,
+    -1.0f/41.0f,   807.0f/2911.0f,  -3022.0f/2911.0f,  3720.0f/2911.0f
+};
+
+static const std::vector<float> *get_spline_weight(const RGY_VPP_RESIZE_ALGO interp) {
+    switch (interp) {
+    case RGY_VPP_RESIZE_SPLINE16: return &SPLINE16_WEIGHT;
+    case RGY_VPP_RESIZE_SPLINE36: return &SPLINE36_WEIGHT;
+    case RGY_VPP_RESIZE_SPLINE64: return &SPLINE64_WEIGHT;
+    default: return nullptr;
+    }
+}
+
+// rgy_filter_resize.clのcalc_weightと同じ重みをhost側で計算する
+static float calc_weight_host(const RESIZE_WEIGHT_TYPE algo, const int radius, const float delta, const std::vector<float> *splineWeight) {
+    const float x = std::abs(delta);
+    if (x >= (float)radius) return 0.0f;
+    switch (algo) {
+    case WEIGHT_LANCZOS: {
+        if (x == 0.0f) return 1.0f;
+        const double pi_x = M_PI * x;
+        return (float)((std::sin(pi_x) / pi_x) * (std::sin(pi_x / radius) / (pi_x / radius)));
+    }
+    case WEIGHT_SPLINE: {
+        const float *w = splineWeight->data() + std::min((int)x, radius - 1) * 4;
+        return w[3] + x * w[2] + x * x * w[1] + x * x * x * w[0];
+    }
+    case WEIGHT_BICUBIC: {
+        const float B = 0.0f, C = 0.6f;
+        const float x2 = x * x;
+        const float x3 = x2 * x;
+        if (x <= 1.0f) {
+            return ( 2.0f -  1.5f * B - 1.0f * C) * x3 +
+                   (-3.0f +  2.0f * B + 1.0f * C) * x2 +
+                   ( 1.0f -  (2.0f/6.0f) * B);
+        }
+        return (-(1.0f/6.0f) * B - 1.0f * C) * x3 +
+               (        1.0f * B + 5.0f * C) * x2 +
+               (       -2.0f * B - 8.0f * C) * x  +
+               ( (8.0f/6.0f) * B + 4.0f * C);
+    }
+    case WEIGHT_BILINEAR:
+        return 1.0f - x * (1.0f / radius);
+    default:
+        break;
+    }
+    return 0.0f;
+}
+
 static float getSrcWindow(const int radius, const int dst_size, const int src_size) {
     const float ratio = (float)(dst_size) / src_size;
     const float ratioClamped = std::min(ratio, 1.0f);
@@ -108,6 +169,122 @@ static bool useTextureBilinear(const RGYFilterParamResize *param) {
         && param->frameOut.height > param->frameIn.height;
 }
 
+// 重みの計算の重いbicubic/lanczos/splineは、横方向→縦方向の2パスで処理する
+// kernel_resize (2Dで重みを計算する版) は、bilinearと--vpp-resize-mode 2dの場合に使用する
+static bool useSeparable(const RGYFilterParamResize *param) {
+#if ENCODER_MPP
+    if (param->mode == RGY_VPP_RESIZE_MODE_CL_2D) {
+        return false;
+    }
+#endif
+    const auto algo = get_weight_type(param->interp);
+    return algo == WEIGHT_BICUBIC || algo == WEIGHT_LANCZOS || algo == WEIGHT_SPLINE;
+}
+
+static const int RESIZE_SEP_TMP_PITCH_ALIGN = 256;
+
+static int getSeparableTmpPitch(const int dstWidth) {
+    return ALIGN(dstWidth * (int)sizeof(float), RESIZE_SEP_TMP_PITCH_ALIGN);
+}
+
+// 出力画素ごとに参照する入力画素の開始位置と正規化済みの重みを計算し、GPUに転送しておく
+// 2Dの場合の sum(wx*wy) = sum(wx)*sum(wy) なので、軸ごとに正規化すれば同じ結果になる
+const RGYFilterResizeCoef *RGYFilterResize::getCoef(const RGY_VPP_RESIZE_ALGO interp, const int srcSize, const int dstSize) {
+    const auto key = std::make_tuple((int)interp, srcSize, dstSize);
+    if (auto it = m_coef.find(key); it != m_coef.end()) {
+        return &it->second;
+    }
+    const int radius = get_radius(interp);
+    const auto algo = get_weight_type(interp);
+    const auto splineWeight = get_spline_weight(interp);
+    if (algo == WEIGHT_SPLINE && splineWeight == nullptr) {
+        AddMessage(RGY_LOG_ERROR, _T("unknown interpolation type: %d.\n"), interp);
+        return nullptr;
+    }
+    const float ratio = (float)dstSize / srcSize;
+    const float ratioInv = 1.0f / ratio;
+    const float ratioClamped = std::min(ratio, 1.0f);
+    const float srcWindow = getSrcWindow(radius, dstSize, srcSize);
+
+    RGYFilterResizeCoef coef;
+    coef.taps = ((int)std::ceil(srcWindow) + 1) * 2;
+    std::vector<int> srcFirst(dstSize, 0);
+    std::vector<float> weight((size_t)dstSize * coef.taps, 0.0f);
+    for (int idst = 0; idst < dstSize; idst++) {
+        const float srcPos = ((float)idst + 0.5f) * ratioInv;
+        const int first = std::max(0, (int)std::floor(srcPos - srcWindow));
+        const int end = std::min(srcSize - 1, (int)std::ceil(srcPos + srcWindow));
+        float *w = weight.data() + (size_t)idst * coef.taps;
+        float sumWeight = 0.0f;
+        for (int i = first; i <= end && i - first < coef.taps; i++) {
+            w[i - first] = calc_weight_host(algo, radius, (((float)i + 0.5f) - srcPos) * ratioClamped, splineWeight);
+            sumWeight += w[i - first];
+        }
+        if (sumWeight != 0.0f) {
+            for (int i = 0; i < coef.taps; i++) {
+                w[i] /= sumWeight;
+            }
+        }
+        srcFirst[idst] = first;
+    }
+    coef.srcFirst = m_cl->copyDataToBuffer(srcFirst.data(), sizeof(srcFirst[0]) * srcFirst.size(), CL_MEM_READ_ONLY);
+    coef.weight = m_cl->copyDataToBuffer(weight.data(), sizeof(weight[0]) * weight.size(), CL_MEM_READ_ONLY);
+    if (!coef.srcFirst || !coef.weight) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to send resize coef to gpu memory.\n"));
+        return nullptr;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("created resize coef table %s: %d -> %d, %d taps.\n"),
+        get_chr_from_value(list_vpp_resize, interp), srcSize, dstSize, coef.taps);
+    auto ret = m_coef.emplace(key, std::move(coef));
+    return &ret.first->second;
+}
+
+RGY_ERR RGYFilterResize::resizePlaneSeparable(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) {
+    auto pResizeParam = std::dynamic_pointer_cast<RGYFilterParamResize>(m_param);
+    if (!pResizeParam) {
+        AddMessage(RGY_LOG_ERROR, _T("Invalid parameter type.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    const auto coefX = getCoef(pResizeParam->interp, pInputPlane->width, pOutputPlane->width);
+    const auto coefY = getCoef(pResizeParam->interp, pInputPlane->height, pOutputPlane->height);
+    if (!coefX || !coefY) {
+        return RGY_ERR_NULL_PTR;
+    }
+    const int tmpPitch = getSeparableTmpPitch(pOutputPlane->width);
+    if (!m_sepTmp || m_sepTmp->size() < (size_t)tmpPitch * pInputPlane->height) {
+        AddMessage(RGY_LOG_ERROR, _T("temporary buffer for resize not allocated.\n"));
+        return RGY_ERR_NULL_PTR;
+    }
+    RGYWorkSize local(RESIZE_BLOCK_X, RESIZE_BLOCK_Y);
+    {
+        const char *kernel_name = "kernel_resize_sep_h";
+        RGYWorkSize global(pOutputPlane->width, pInputPlane->height);
+        auto err = m_resize.get()->kernel(kernel_name).config(queue, local, global, wait_events, nullptr).launch(
+            (cl_mem)m_sepTmp->mem(), tmpPitch, pOutputPlane->width, pInputPlane->height,
+            (cl_mem)pInputPlane->ptr[0], pInputPlane->pitch[0], pInputPlane->width,
+            (cl_mem)coefX->srcFirst->mem(), (cl_mem)coefX->weight->mem(), coefX->taps);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("error at %s (resizePlaneSeparable(%s)): %s.\n"),
+                char_to_tstring(kernel_name).c_str(), RGY_CSP_NAMES[pInputPlane->csp], get_err_mes(err));
+            return err;
+        }
+    }
+    {
+        const char *kernel_name = "kernel_resize_sep_v";
+        RGYWorkSize global(pOutputPlane->width, pOutputPlane->height);
+        auto err = m_resize.get()->kernel(kernel_name).config(queue, local, global, {}, event).launch(
+            (cl_mem)pOutputPlane->ptr[0], pOutputPlane->pitch[0], pOutputPlane->width, pOutputPlane->height,
+            (cl_mem)m_sepTmp->mem(), tmpPitch, pInputPlane->height,
+            (cl_mem)coefY->srcFirst->mem(), (cl_mem)coefY->weight->mem(), coefY->taps);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("error at %s (resizePlaneSeparable(%s)): %s.\n"),
+                char_to_tstring(kernel_name).c_str(), RGY_CSP_NAMES[pInputPlane->csp], get_err_mes(err));
+            return err;
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR RGYFilterResize::resizePlane(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) {
     auto pResizeParam = std::dynamic_pointer_cast<RGYFilterParamResize>(m_param);
     if (!pResizeParam) {
@@ -115,6 +292,10 @@ RGY_ERR RGYFilterResize::resizePlane(RGYFrameInfo *pOutputPlane, const RGYFrameI
         return RGY_ERR_INVALID_PARAM;
     }
 
+    if (m_separable) {
+        return resizePlaneSeparable(pOutputPlane, pInputPlane, queue, wait_events, event);
+    }
+
     const float ratioX = (float)(pOutputPlane->width) / pInputPlane->width;
     const float ratioY = (float)(pOutputPlane->height) / pInputPlane->height;
 
@@ -177,7 +358,7 @@ RGY_ERR RGYFilterResize::resizeFrame(RGYFrameInfo *pOutputFrame, const RGYFrameI
     return RGY_ERR_NONE;
 }
 
-RGYFilterResize::RGYFilterResize(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_bInterlacedWarn(false), m_weightSpline(), m_libplaceboResample(), m_resize(), m_srcImagePool() {
+RGYFilterResize::RGYFilterResize(shared_ptr<RGYOpenCLContext> context) : RGYFilter(context), m_bInterlacedWarn(false), m_separable(false), m_coef(), m_sepTmp(), m_weightSpline(), m_libplaceboResample(), m_resize(), m_srcImagePool() {
     m_name = _T("resize");
 }
 
@@ -252,31 +433,11 @@ RGY_ERR RGYFilterResize::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYL
             m_resize.set(m_cl->buildResourceAsync(_T("RGY_FILTER_RESIZE_CL"), _T("EXE_DATA"), options.c_str()));
             if (!m_weightSpline
                 && algo == WEIGHT_SPLINE) {
-                static const auto SPLINE16_WEIGHT = std::vector<float>{
-                    1.0f,       -9.0f/5.0f,  -1.0f/5.0f, 1.0f,
-                    -1.0f/3.0f,  9.0f/5.0f, -46.0f/15.0f, 8.0f/5.0f
-                };
-                static const auto SPLINE36_WEIGHT = std::vector<float>{
-                    13.0f/11.0f, -453.0f/209.0f,    -3.0f/209.0f,  1.0f,
-                    -6.0f/11.0f,  612.0f/209.0f, -1038.0f/209.0f,  540.0f/209.0f,
-                    1.0f/11.0f, -159.0f/209.0f,   434.0f/209.0f, -384.0f/209.0f
-                };
-                static const auto SPLINE64_WEIGHT = std::vector<float>{
-                    49.0f/41.0f, -6387.0f/2911.0f,     -3.0f/2911.0f,  1.0f,
-                    -24.0f/41.0f,  9144.0f/2911.0f, -15504.0f/2911.0f,  8064.0f/2911.0f,
-                    6.0f/41.0f, -3564.0f/2911.0f,   9726.0f/2911.0f, -8604.0f/2911.0f,
-                    -1.0f/41.0f,   807.0f/2911.0f,  -3022.0f/2911.0f,  3720.0f/2911.0f
-                };
-                const std::vector<float> *weight = nullptr;
-                switch (pResizeParam->interp) {
-                case RGY_VPP_RESIZE_SPLINE16: weight = &SPLINE16_WEIGHT; break;
-                case RGY_VPP_RESIZE_SPLINE36: weight = &SPLINE36_WEIGHT; break;
-                case RGY_VPP_RESIZE_SPLINE64: weight = &SPLINE64_WEIGHT; break;
-                default: {
+                const std::vector<float> *weight = get_spline_weight(pResizeParam->interp);
+                if (weight == nullptr) {
                     AddMessage(RGY_LOG_ERROR, _T("unknown interpolation type: %d.\n"), pResizeParam->interp);
                     return RGY_ERR_INVALID_PARAM;
                 }
-                }
 
                 m_weightSpline = m_cl->copyDataToBuffer(weight->data(), sizeof((*weight)[0]) * weight->size(), CL_MEM_READ_ONLY);
                 if (!m_weightSpline) {
@@ -285,10 +446,33 @@ RGY_ERR RGYFilterResize::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYL
                 }
             }
         }
+        m_separable = useSeparable(pResizeParam.get());
+        if (m_separable) {
+            // 各planeの係数テーブルと中間バッファをあらかじめ用意しておく
+            size_t tmpSize = 0;
+            for (int i = 0; i < RGY_CSP_PLANES[pResizeParam->frameOut.csp]; i++) {
+                const auto planeIn  = getPlane(&pResizeParam->frameIn,  (RGY_PLANE)i);
+                const auto planeOut = getPlane(&pResizeParam->frameOut, (RGY_PLANE)i);
+                if (!getCoef(pResizeParam->interp, planeIn.width,  planeOut.width)
+                 || !getCoef(pResizeParam->interp, planeIn.height, planeOut.height)) {
+                    return RGY_ERR_NULL_PTR;
+                }
+                tmpSize = std::max(tmpSize, (size_t)getSeparableTmpPitch(planeOut.width) * planeIn.height);
+            }
+            if (!m_sepTmp || m_sepTmp->size() < tmpSize) {
+                m_sepTmp = m_cl->createBuffer(tmpSize, CL_MEM_READ_WRITE);
+                if (!m_sepTmp) {
+                    AddMessage(RGY_LOG_ERROR, _T("failed to allocate temporary buffer for resize.\n"));
+                    return RGY_ERR_MEMORY_ALLOC;
+                }
+            }
+        } else {
+            m_sepTmp.reset();
+        }
     }
 
-    auto str = strsprintf(_T("resize(%s): %dx%d -> %dx%d"),
-        get_chr_from_value(list_vpp_resize, pResizeParam->interp),
+    auto str = strsprintf(_T("resize(%s%s): %dx%d -> %dx%d"),
+        get_chr_from_value(list_vpp_resize, pResizeParam->interp), (m_separable) ? _T(", separable") : _T(""),
         pResizeParam->frameIn.width, pResizeParam->frameIn.height,
         pResizeParam->frameOut.width, pResizeParam->frameOut.height);
     if (m_libplaceboResample) {
@@ -370,6 +554,9 @@ void RGYFilterResize::close() {
     m_frameBuf.clear();
     m_resize.clear();
     m_weightSpline.reset();
+    m_sepTmp.reset();
+    m_coef.clear();
+    m_separable = false;
     m_cl.reset();
     m_bInterlacedWarn = false;
 }
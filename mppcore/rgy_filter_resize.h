@@ -29,6 +29,8 @@
 #ifndef __RGY_FILTER_RESIZE_H__
 #define __RGY_FILTER_RESIZE_H__
 
+#include <map>
+#include <tuple>
 #include "rgy_filter_cl.h"
 
 class RGYFilterParamLibplaceboResample;
@@ -36,13 +38,21 @@ class RGYFilterParamLibplaceboResample;
 class RGYFilterParamResize : public RGYFilterParam {
 public:
     RGY_VPP_RESIZE_ALGO interp;
+    RGY_VPP_RESIZE_MODE mode;
     std::shared_ptr<RGYFilterParamLibplaceboResample> libplaceboResample;
-    RGYFilterParamResize() : interp(RGY_VPP_RESIZE_AUTO), libplaceboResample() {};
+    RGYFilterParamResize() : interp(RGY_VPP_RESIZE_AUTO), mode(RGY_VPP_RESIZE_MODE_DEFAULT), libplaceboResample() {};
     virtual ~RGYFilterParamResize() {};
 };
 
 class RGYFilterLibplaceboResample;
 
+// 分離型リサイズ用の1軸分の係数テーブル
+struct RGYFilterResizeCoef {
+    int taps;                            // 出力1画素あたりの参照画素数
+    std::unique_ptr<RGYCLBuf> srcFirst;  // 出力画素ごとの参照開始位置 (int)
+    std::unique_ptr<RGYCLBuf> weight;    // 出力画素ごとの正規化済みの重み (float x taps)
+};
+
 class RGYFilterResize : public RGYFilter {
 public:
     RGYFilterResize(shared_ptr<RGYOpenCLContext> context);
@@ -54,8 +64,13 @@ protected:
 
     virtual RGY_ERR resizePlane(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
     virtual RGY_ERR resizeFrame(RGYFrameInfo *pOutputFrame, const RGYFrameInfo *pInputFrame, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
+    virtual RGY_ERR resizePlaneSeparable(RGYFrameInfo *pOutputPlane, const RGYFrameInfo *pInputPlane, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
+    const RGYFilterResizeCoef *getCoef(const RGY_VPP_RESIZE_ALGO interp, const int srcSize, const int dstSize);
 
     bool m_bInterlacedWarn;
+    bool m_separable; // 横方向→縦方向の2パスで処理する
+    std::map<std::tuple<int, int, int>, RGYFilterResizeCoef> m_coef; // (interp, srcSize, dstSize) ごとの係数テーブル
+    std::unique_ptr<RGYCLBuf> m_sepTmp; // 横方向リサイズ後の中間バッファ (float)
     std::unique_ptr<RGYCLBuf> m_weightSpline;
     std::unique_ptr<RGYFilterLibplaceboResample> m_libplaceboResample;
     RGYOpenCLProgramAsync m_resize;
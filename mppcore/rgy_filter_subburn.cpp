@@ -852,6 +852,7 @@ RGY_ERR RGYFilterSubburn::procFrame(RGYFrameInfo *pOutputFrame, RGYOpenCLQueue &
         int got_sub = 0;
         if (0 > avcodec_decode_subtitle2(m_outCodecDecodeCtx.get(), m_subData.get(), &got_sub, pkt)) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to decode subtitle.\n"));
+            m_poolPkt->returnFree(&pkt);
             return RGY_ERR_NONE;
         }
         if (got_sub) {
@@ -941,7 +942,14 @@ void RGYFilterSubburn::close() {
     m_assTrack.reset();
     m_assRenderer.reset();
     m_assLibrary.reset();
-    m_queueSubPackets.clear();
+    //未処理の字幕パケットはpoolに返却する
+    m_queueSubPackets.clear([this](AVPacket **pkt) {
+        if (m_poolPkt) {
+            m_poolPkt->returnFree(pkt);
+        } else {
+            av_packet_free(pkt);
+        }
+    });
     m_subData.reset();
     m_outCodecDecodeCtx.reset();
     m_formatCtx.reset();
@@ -31,7 +31,7 @@
 static const int YADIF_BLOCK_X = 32;
 static const int YADIF_BLOCK_Y = 8;
 
-RGYFilterYadifSource::RGYFilterYadifSource(std::shared_ptr<RGYOpenCLContext> cl) : m_cl(cl), m_nFramesInput(0), m_nFramesOutput(0), m_buf() {
+RGYFilterYadifSource::RGYFilterYadifSource(std::shared_ptr<RGYOpenCLContext> cl) : m_cl(cl), m_nFramesInput(0), m_nFramesOutput(0), m_stage(this), m_buf() {
 
 }
 
@@ -47,38 +47,15 @@ void RGYFilterYadifSource::clear() {
     m_nFramesOutput = 0;
 }
 
-RGY_ERR RGYFilterYadifSource::alloc(const RGYFrameInfo& frameInfo) {
-    if (m_buf.begin()->get() != nullptr
-        && !cmpFrameInfoCspResolution(&m_buf.begin()->get()->frame, &frameInfo)) {
-        //すべて確保されているか確認
-        bool allocated = true;
-        for (auto& buf : m_buf) {
-            if (buf->frame.ptr[0] == nullptr) {
-                allocated = false;
-                break;
-            }
-        }
-        if (allocated) {
-            return RGY_ERR_NONE;
-        }
-    }
-    for (auto& buf : m_buf) {
-        buf = m_cl->createFrameBuffer(frameInfo.width, frameInfo.height, frameInfo.csp, frameInfo.bitdepth);
-        if (!buf) {
-            return RGY_ERR_NULL_PTR;
-        }
-    }
-    return RGY_ERR_NONE;
-}
-
 RGY_ERR RGYFilterYadifSource::add(const RGYFrameInfo *pInputFrame, RGYOpenCLQueue &queue) {
-    const int iframe = m_nFramesInput++;
-    auto pDstFrame = get(iframe);
-    auto err = m_cl->copyFrame(&pDstFrame->frame, pInputFrame, nullptr, queue);
+    //前段のフィルタが履歴に登録したフレームならコピーせずに参照する
+    auto err = RGY_ERR_NONE;
+    auto frame = m_cl->frameHistory()->add(m_stage, pInputFrame, queue, &err);
     if (err != RGY_ERR_NONE) {
         return err;
     }
-    copyFrameProp(&pDstFrame->frame, pInputFrame);
+    const int iframe = m_nFramesInput++;
+    m_buf[iframe % m_buf.size()] = frame;
     return err;
 }
 
@@ -188,16 +165,19 @@ RGY_ERR RGYFilterYadif::init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLo
     }
     if (!prmPrev
         || cmpFrameInfoCspResolution(&prmPrev->frameOut, &pParam->frameOut)) {
-        m_source.alloc(pParam->frameOut);
-        auto err = AllocFrameBuf(prm->frameOut, 2);
-        if (err != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory: %s.\n"), get_err_mes(err));
-            return RGY_ERR_MEMORY_ALLOC;
+        m_source.clear();
+        for (auto& f : m_outFrame) {
+            f = m_cl->frameHistory()->alloc(prm->frameOut);
+            if (!f) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+                return RGY_ERR_MEMORY_ALLOC;
+            }
         }
-        for (int i = 0; i < RGY_CSP_PLANES[m_frameBuf[0]->frame.csp]; i++) {
-            prm->frameOut.pitch[i] = m_frameBuf[0]->frame.pitch[i];
+        for (int i = 0; i < RGY_CSP_PLANES[m_outFrame[0]->frame.csp]; i++) {
+            prm->frameOut.pitch[i] = m_outFrame[0]->frame.pitch[i];
         }
     }
+    m_source.setStage((prm->historyStage) ? prm->historyStage : &m_source);
 
 
     prm->frameOut.picstruct = RGY_PICSTRUCT_FRAME;
@@ -253,11 +233,21 @@ RGY_ERR RGYFilterYadif::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo
         RGYCLFrame *pOutFrame = nullptr;
         *pOutputFrameNum = 1;
         if (ppOutputFrames[0] == nullptr) {
-            pOutFrame = m_frameBuf[0].get();
+            //後段のフィルタが参照中なら、別のバッファに出力する
+            for (auto& f : m_outFrame) {
+                if (f.use_count() > 1) {
+                    f = m_cl->frameHistory()->alloc(prm->frameOut);
+                    if (!f) {
+                        AddMessage(RGY_LOG_ERROR, _T("failed to allocate memory.\n"));
+                        return RGY_ERR_MEMORY_ALLOC;
+                    }
+                }
+            }
+            pOutFrame = m_outFrame[0].get();
             ppOutputFrames[0] = &pOutFrame->frame;
             ppOutputFrames[0]->picstruct = pInputFrame->picstruct;
             if (prm->yadif.mode & VPP_YADIF_MODE_BOB) {
-                pOutFrame = m_frameBuf[1].get();
+                pOutFrame = m_outFrame[1].get();
                 ppOutputFrames[1] = &pOutFrame->frame;
                 ppOutputFrames[1]->picstruct = pInputFrame->picstruct;
                 *pOutputFrameNum = 2;
@@ -284,6 +274,7 @@ RGY_ERR RGYFilterYadif::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo
                     m_cl->copyFrame(ppOutputFrames[1], pSourceFrame, nullptr, queue);
                     setBobTimestamp(iframe, ppOutputFrames);
                 }
+                publishOutput(ppOutputFrames, *pOutputFrameNum);
                 m_nFrame++;
                 return RGY_ERR_NONE;
             } else if ((pSourceFrame->picstruct & RGY_PICSTRUCT_FRAME_TFF) == RGY_PICSTRUCT_FRAME_TFF) {
@@ -332,6 +323,7 @@ RGY_ERR RGYFilterYadif::run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo
             }
             setBobTimestamp(iframe, ppOutputFrames);
         }
+        publishOutput(ppOutputFrames, *pOutputFrameNum);
         m_nFrame++;
     } else {
         //出力フレームなし
@@ -362,8 +354,19 @@ void RGYFilterYadif::setBobTimestamp(const int iframe, RGYFrameInfo **ppOutputFr
     ppOutputFrames[1]->inputFrameId = m_source.get(m_nFrame + 0)->frame.inputFrameId;
 }
 
+void RGYFilterYadif::publishOutput(RGYFrameInfo **ppOutputFrames, const int outputNum) {
+    //後段のフィルタがコピーせずに参照できるよう、出力をフレーム履歴に登録する
+    for (int i = 0; i < outputNum && i < (int)m_outFrame.size(); i++) {
+        if (m_outFrame[i] && ppOutputFrames[i] == &m_outFrame[i]->frame) {
+            m_cl->frameHistory()->publish(static_cast<const RGYFilter *>(this), m_outFrame[i]);
+        }
+    }
+}
+
 void RGYFilterYadif::close() {
     m_frameBuf.clear();
+    m_outFrame.fill(nullptr);
+    m_source.clear();
     m_yadif.clear();
     m_cl.reset();
     m_nFrame = 0;
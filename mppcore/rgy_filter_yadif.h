@@ -50,7 +50,7 @@ public:
     RGYFilterYadifSource(std::shared_ptr<RGYOpenCLContext> cl);
     ~RGYFilterYadifSource();
     RGY_ERR add(const RGYFrameInfo *pInputFrame, RGYOpenCLQueue &queue);
-    RGY_ERR alloc(const RGYFrameInfo& frameInfo);
+    void setStage(const void *stage) { m_stage = stage; }
     void clear();
     RGYCLFrame *get(int iframe) {
         iframe = clamp(iframe, 0, m_nFramesInput - 1);
@@ -61,7 +61,8 @@ private:
     std::shared_ptr<RGYOpenCLContext> m_cl;
     int m_nFramesInput;
     int m_nFramesOutput;
-    std::array<std::unique_ptr<RGYCLFrame>, 4> m_buf;
+    const void *m_stage; //フレーム履歴のキー
+    std::array<std::shared_ptr<RGYCLFrame>, 4> m_buf;
 };
 
 class RGYFilterYadif : public RGYFilter {
@@ -73,6 +74,7 @@ protected:
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) override;
     virtual void close() override;
     void setBobTimestamp(const int iframe, RGYFrameInfo **ppOutputFrames);
+    void publishOutput(RGYFrameInfo **ppOutputFrames, const int outputNum);
 
     RGY_ERR checkParam(const std::shared_ptr<RGYFilterParamYadif> prm);
 
@@ -97,4 +99,5 @@ protected:
     int m_nFrame;
     int64_t m_pts;
     RGYFilterYadifSource m_source;
+    std::array<std::shared_ptr<RGYCLFrame>, 2> m_outFrame; //後段のフィルタと共有するため、フレーム履歴から確保する
 };
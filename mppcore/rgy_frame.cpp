@@ -146,10 +146,11 @@ RGYFrameDataHDR10plus::RGYFrameDataHDR10plus(const uint8_t *data, size_t size, i
 RGYFrameDataHDR10plus::~RGYFrameDataHDR10plus() {}
 
 
-std::vector<uint8_t> RGYFrameDataHDR10plus::gen_nal() const {
-    std::vector<uint8_t> header = { 0x00, 0x00, 0x00, 0x01 };
+void RGYFrameDataHDR10plus::gen_nal(std::vector<uint8_t>& buf) const {
+    static const uint8_t header[] = { 0x00, 0x00, 0x00, 0x01 };
+    buf.insert(buf.end(), header, header + sizeof(header));
 
-    std::vector<uint8_t> buf;
+    const auto nal_start = buf.size();
     uint16_t u16 = 0x00;
     u16 |= (NALU_HEVC_PREFIX_SEI << 9) | 1;
     add_u16(buf, u16);
@@ -159,26 +160,16 @@ std::vector<uint8_t> RGYFrameDataHDR10plus::gen_nal() const {
         buf.push_back((uint8_t)0xff);
     buf.push_back((uint8_t)datasize);
     vector_cat(buf, m_data);
-    to_nal(buf);
-
-    std::vector<uint8_t> nal_hdr10plus;
-    nal_hdr10plus.reserve(128);
-    vector_cat(nal_hdr10plus, header);
-    vector_cat(nal_hdr10plus, buf);
-    nal_hdr10plus.push_back(0x80);
-    return nal_hdr10plus;
+    to_nal(buf, nal_start);
+    buf.push_back(0x80);
 }
 
-std::vector<uint8_t> RGYFrameDataHDR10plus::gen_obu() const {
+void RGYFrameDataHDR10plus::gen_obu(std::vector<uint8_t>& buf) const {
     // https://aomediacodec.github.io/av1-hdr10plus/#hdr10-metadata
-    std::vector<uint8_t> buf;
-    if (m_data.size() > sizeof(av1_itut_t35_header_hdr10plus) && memcmp(m_data.data(), av1_itut_t35_header_hdr10plus, sizeof(av1_itut_t35_header_hdr10plus)) == 0) {
-        buf = m_data;
-    } else {
-        buf = make_vector<uint8_t>(av1_itut_t35_header_hdr10plus);
-        vector_cat(buf, m_data);
-    }
-    return gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, buf);
+    const bool has_t35_header = m_data.size() > sizeof(av1_itut_t35_header_hdr10plus) && memcmp(m_data.data(), av1_itut_t35_header_hdr10plus, sizeof(av1_itut_t35_header_hdr10plus)) == 0;
+    add_av1_obu_metadata(buf, AV1_METADATA_TYPE_ITUT_T35,
+        (has_t35_header) ? nullptr : av1_itut_t35_header_hdr10plus, (has_t35_header) ? 0 : sizeof(av1_itut_t35_header_hdr10plus),
+        m_data.data(), m_data.size());
 }
 
 RGYFrameDataDOVIRpu::RGYFrameDataDOVIRpu() : RGYFrameDataMetadata() { m_dataType = RGY_FRAME_DATA_DOVIRPU; };
@@ -225,8 +216,11 @@ RGY_ERR RGYFrameDataDOVIRpu::convert(const RGYFrameDataMetadataConvertParam *met
     return RGY_ERR_NONE;
 }
 
-std::vector<uint8_t> RGYFrameDataDOVIRpu::gen_nal() const {
-    std::vector<uint8_t> buf;
+void RGYFrameDataDOVIRpu::gen_nal(std::vector<uint8_t>& buf) const {
+    static const uint8_t header[] = { 0x00, 0x00, 0x00, 0x01 }; // ヘッダ
+    buf.insert(buf.end(), header, header + sizeof(header));
+
+    const auto nal_start = buf.size();
     uint16_t u16 = 0x00;
     u16 |= (NALU_HEVC_UNSPECIFIED << 9) | 1;
     add_u16(buf, u16);
@@ -234,21 +228,13 @@ std::vector<uint8_t> RGYFrameDataDOVIRpu::gen_nal() const {
     if (buf.back() == 0x00) { // 最後が0x00の場合
         buf.push_back(0x03);
     }
-    to_nal(buf);
-
-    std::vector<uint8_t> ret = { 0x00, 0x00, 0x00, 0x01 }; // ヘッダ
-    vector_cat(ret, buf);
-    return ret;
+    to_nal(buf, nal_start);
 }
-std::vector<uint8_t> RGYFrameDataDOVIRpu::gen_obu() const {
-    std::vector<uint8_t> buf;
-    if (m_data.size() > sizeof(av1_itut_t35_header_dovirpu) && memcmp(m_data.data(), av1_itut_t35_header_dovirpu, sizeof(av1_itut_t35_header_dovirpu)) == 0) {
-        buf = m_data;
-    } else {
-        buf = make_vector<uint8_t>(av1_itut_t35_header_dovirpu);
-        vector_cat(buf, m_data);
-    }
-    return gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, buf);
+void RGYFrameDataDOVIRpu::gen_obu(std::vector<uint8_t>& buf) const {
+    const bool has_t35_header = m_data.size() > sizeof(av1_itut_t35_header_dovirpu) && memcmp(m_data.data(), av1_itut_t35_header_dovirpu, sizeof(av1_itut_t35_header_dovirpu)) == 0;
+    add_av1_obu_metadata(buf, AV1_METADATA_TYPE_ITUT_T35,
+        (has_t35_header) ? nullptr : av1_itut_t35_header_dovirpu, (has_t35_header) ? 0 : sizeof(av1_itut_t35_header_dovirpu),
+        m_data.data(), m_data.size());
 }
 #endif
 
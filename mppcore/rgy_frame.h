@@ -102,8 +102,9 @@ public:
     virtual ~RGYFrameDataMetadata();
 
     virtual RGY_ERR convert([[maybe_unused]] const RGYFrameDataMetadataConvertParam *prm) { return RGY_ERR_NONE; }
-    virtual std::vector<uint8_t> gen_nal() const = 0;
-    virtual std::vector<uint8_t> gen_obu() const = 0;
+    // bufの末尾にNAL/OBUを追加する (フレームごとに確保しないよう、呼び出し側の領域を使いまわす)
+    virtual void gen_nal(std::vector<uint8_t>& buf) const = 0;
+    virtual void gen_obu(std::vector<uint8_t>& buf) const = 0;
     const std::vector<uint8_t>& getData() const { return m_data; }
     int64_t timestamp() const { return m_timestamp; }
 protected:
@@ -116,8 +117,8 @@ public:
     RGYFrameDataHDR10plus();
     RGYFrameDataHDR10plus(const uint8_t* data, size_t size, int64_t timestamp);
     virtual ~RGYFrameDataHDR10plus();
-    virtual std::vector<uint8_t> gen_nal() const override;
-    virtual std::vector<uint8_t> gen_obu() const override;
+    virtual void gen_nal(std::vector<uint8_t>& buf) const override;
+    virtual void gen_obu(std::vector<uint8_t>& buf) const override;
 };
 
 class RGYFrameDataDOVIRpuConvertParam : public RGYFrameDataMetadataConvertParam {
@@ -135,8 +136,8 @@ public:
     RGYFrameDataDOVIRpu(const uint8_t* data, size_t size, int64_t timestamp);
     virtual ~RGYFrameDataDOVIRpu();
     virtual RGY_ERR convert(const RGYFrameDataMetadataConvertParam *prm);
-    virtual std::vector<uint8_t> gen_nal() const override;
-    virtual std::vector<uint8_t> gen_obu() const override;
+    virtual void gen_nal(std::vector<uint8_t>& buf) const override;
+    virtual void gen_obu(std::vector<uint8_t>& buf) const override;
 };
 
 struct RGYFrame {
@@ -271,7 +271,8 @@ RGYInputAvcodec::RGYInputAvcodec() :
     m_Demux(),
     m_logFramePosList(),
     m_fpPacketList(),
-    m_hevcMp42AnnexbBuffer() {
+    m_hevcMp42AnnexbBuffer(),
+    m_poolBuf(std::make_unique<RGYPoolAVBuffer>()) {
     m_readerName = _T("av" DECODER_NAME "/avsw");
 }
 
@@ -334,6 +335,10 @@ void RGYInputAvcodec::Close() {
     m_Demux.qStreamPktL1.clear();
     m_Demux.qStreamPktL2.close([](AVPacket **pkt) { av_packet_free(pkt); });
     AddMessage(RGY_LOG_DEBUG, _T("Closed Stream Packet Buffer.\n"));
+    if (m_poolBuf) {
+        AddMessage(RGY_LOG_DEBUG, _T("packet buffer pool: allocated %llu, reused %llu.\n"),
+            (unsigned long long)m_poolBuf->allocatedCount(), (unsigned long long)m_poolBuf->reusedCount());
+    }
 
     CloseFormat(&m_Demux.format); AddMessage(RGY_LOG_DEBUG, _T("Closed format.\n"));
 
@@ -624,16 +629,33 @@ void RGYInputAvcodec::vc1FixHeader(int nLengthFix) {
 
 void RGYInputAvcodec::vc1AddFrameHeader(AVPacket *pkt) {
     uint32_t size = pkt->size;
+    uint8_t header[8] = { 0 };
+    int headerSize = 0;
     if (m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_WMV3) {
-        av_grow_packet(pkt, 8);
-        memmove(pkt->data + 8, pkt->data, size);
-        memcpy(pkt->data, &size, sizeof(size));
-        memset(pkt->data + 4, 0, 4);
+        memcpy(header, &size, sizeof(size));
+        headerSize = 8;
     } else if (!vc1StartCodeExists(pkt->data)) {
         uint32_t startCode = 0x0D010000;
-        av_grow_packet(pkt, sizeof(startCode));
-        memmove(pkt->data + sizeof(startCode), pkt->data, size);
-        memcpy(pkt->data, &startCode, sizeof(startCode));
+        memcpy(header, &startCode, sizeof(startCode));
+        headerSize = sizeof(startCode);
+    }
+    if (headerSize == 0) {
+        return;
+    }
+    // av_grow_packetで毎回再確保するかわりに、poolのバッファにコピーして差し替える
+    auto buf = m_poolBuf->get((size_t)size + headerSize + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (buf) {
+        memcpy(buf->data, header, headerSize);
+        memcpy(buf->data + headerSize, pkt->data, size);
+        memset(buf->data + headerSize + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        av_buffer_unref(&pkt->buf);
+        pkt->buf = buf;
+        pkt->data = buf->data;
+        pkt->size = (int)size + headerSize;
+    } else {
+        av_grow_packet(pkt, headerSize);
+        memmove(pkt->data + headerSize, pkt->data, size);
+        memcpy(pkt->data, header, headerSize);
     }
 }
 
@@ -710,7 +732,15 @@ void RGYInputAvcodec::hevcMp42Annexb(AVPacket *pkt) {
             m_hevcMp42AnnexbBuffer.insert(m_hevcMp42AnnexbBuffer.end(), ptr, ptr + size); ptr += size;
         }
         if (pkt->buf->size < m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE) {
-            av_grow_packet(pkt, (int)m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            // 中身はこの後上書きするので、poolのバッファに差し替えるだけでよい
+            auto buf = m_poolBuf->get(m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (buf) {
+                av_buffer_unref(&pkt->buf);
+                pkt->buf = buf;
+                pkt->data = buf->data;
+            } else {
+                av_grow_packet(pkt, (int)m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            }
         }
         memcpy(pkt->data, m_hevcMp42AnnexbBuffer.data(), m_hevcMp42AnnexbBuffer.size());
         memset(pkt->data + m_hevcMp42AnnexbBuffer.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
@@ -2671,6 +2701,8 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
             continue;
         }
+        // av_read_frameのpayloadはlibavformatが確保し、確保関数を差し替える手段がないので、そのまま使う
+        // (poolのバッファへのコピーはかえって負荷になる)
         if (m_fpPacketList) {
             fprintf(m_fpPacketList.get(), "stream %2d, %12s, %s, %s,%5lld,%2d, %12lld\n",
                 pkt->stream_index, avcodec_get_name(m_Demux.format.formatCtx->streams[pkt->stream_index]->codecpar->codec_id),
@@ -3348,6 +3380,9 @@ HANDLE RGYInputAvcodec::getThreadHandleInput() {
 RGY_ERR RGYInputAvcodec::ThreadFuncRead(RGYParamThread threadParam) {
     threadParam.apply(GetCurrentThread());
     AddMessage(RGY_LOG_DEBUG, _T("Set input thread param: %s.\n"), threadParam.desc().c_str());
+    if (m_Demux.thread.queueInfo) {
+        m_Demux.thread.queueInfo->tid_in = GetCurrentThreadId();
+    }
     while (!m_Demux.thread.bAbortInput) {
         auto [ret, pkt] = getSample();
         if (ret) {
@@ -895,6 +895,9 @@ public:
     //フレーム情報構造へのポインタを返す
     FramePosList *GetFramePosList();
 
+    //パケットのpayload用のpoolを返す (統計情報の表示用)
+    RGYPoolAVBuffer *GetPacketBufferPool() { return m_poolBuf.get(); }
+
     virtual rgy_rational<int> getInputTimebase() override;
 
     virtual RGYDOVIProfile getInputDOVIProfile() override;
@@ -1029,6 +1032,7 @@ protected:
     tstring          m_logFramePosList;           //FramePosListの内容を入力終了時に出力する (デバッグ用)
     std::unique_ptr<FILE, fp_deleter> m_fpPacketList; // 読み取ったパケット情報を出力するファイル
     vector<uint8_t>  m_hevcMp42AnnexbBuffer;       //HEVCのmp4->AnnexB簡易変換用バッファ
+    std::unique_ptr<RGYPoolAVBuffer> m_poolBuf;   //パケットのpayloadを作り直す場合に使用するpool
 };
 
 #endif //ENABLE_AVSW_READER
@@ -32,6 +32,7 @@
 #include <sstream>
 #include <map>
 #include <fstream>
+#include <mutex>
 
 
 RGYInputVpyPrm::RGYInputVpyPrm(RGYInputPrm base) :
@@ -50,6 +51,13 @@ RGYInputVpy::RGYInputVpy() :
     m_sVSscript(nullptr),
     m_sVSnode(nullptr),
     m_nAsyncFrames(0),
+    m_nAsyncFramesDone(0),
+    m_asyncDepth(1),
+    m_asyncDepthMin(1),
+    m_asyncDepthMax(1),
+    m_asyncAdjustFrames(0),
+    m_asyncStarvedFrames(0),
+    m_asyncMtx(),
     m_sVS() {
     memset(m_pAsyncBuffer, 0, sizeof(m_pAsyncBuffer));
     memset(m_hAsyncEventFrameSetFin,   0, sizeof(m_hAsyncEventFrameSetFin));
@@ -129,8 +137,13 @@ int RGYInputVpy::initAsyncEvents() {
 }
 
 void RGYInputVpy::closeAsyncEvents() {
-    m_bAbortAsync = true;
-    for (int i_frame = m_nCopyOfInputFrames; i_frame < m_nAsyncFrames; i_frame++) {
+    int asyncFrames = 0;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_asyncMtx);
+        m_bAbortAsync = true;
+        asyncFrames = m_nAsyncFrames;
+    }
+    for (int i_frame = m_nCopyOfInputFrames; i_frame < asyncFrames; i_frame++) {
         const VSFrameRef *src_frame = getFrameFromAsyncBuffer(i_frame);
         m_sVSapi->freeFrame(src_frame);
     }
@@ -156,13 +169,49 @@ void RGYInputVpy::setFrameToAsyncBuffer(int n, const VSFrameRef* f) {
     WaitForSingleObject(m_hAsyncEventFrameSetStart[n & (ASYNC_BUFFER_SIZE-1)], INFINITE);
     m_pAsyncBuffer[n & (ASYNC_BUFFER_SIZE-1)] = f;
     SetEvent(m_hAsyncEventFrameSetFin[n & (ASYNC_BUFFER_SIZE-1)]);
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_asyncMtx);
+        m_nAsyncFramesDone++;
+    }
+    requestFramesAsync();
+}
 
-    if (m_nAsyncFrames < m_inputVideoInfo.frames && !m_bAbortAsync) {
-        m_sVSapi->getFrameAsync(m_nAsyncFrames, m_sVSnode, frameDoneCallback, this);
-        m_nAsyncFrames++;
+//生成待ちのフレーム数がm_asyncDepthになるまで、次のフレームを要求する
+//バッファの空きを超えて要求すると、コールバック側で待機が発生するので、それも超えないようにする
+void RGYInputVpy::requestFramesAsync() {
+    std::lock_guard<std::recursive_mutex> lock(m_asyncMtx);
+    while (!m_bAbortAsync
+        && m_nAsyncFrames < m_inputVideoInfo.frames
+        && m_nAsyncFrames - m_nAsyncFramesDone < m_asyncDepth
+        && m_nAsyncFrames - (int)m_nCopyOfInputFrames < ASYNC_BUFFER_SIZE - 1) {
+        const int n = m_nAsyncFrames++;
+        m_sVSapi->getFrameAsync(n, m_sVSnode, frameDoneCallback, this);
     }
 }
 
+//フレームの取り出しが待たされているなら、VapourSynth側が律速なので同時に要求するフレーム数を増やす
+//一度も待たされていないなら、先読みが十分なので要求数を減らして、CPUをエンコード側に回す
+void RGYInputVpy::adjustAsyncDepth(bool starved) {
+    if (starved) {
+        m_asyncStarvedFrames++;
+    }
+    if (++m_asyncAdjustFrames < ASYNC_DEPTH_ADJUST_INTERVAL) {
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lock(m_asyncMtx);
+    const int prevDepth = m_asyncDepth;
+    if (m_asyncStarvedFrames > ASYNC_DEPTH_ADJUST_INTERVAL / 8) {
+        m_asyncDepth = std::min(m_asyncDepth + std::max(1, m_asyncDepthMin / 2), m_asyncDepthMax);
+    } else if (m_asyncStarvedFrames == 0) {
+        m_asyncDepth = std::max(m_asyncDepth - 1, m_asyncDepthMin);
+    }
+    if (m_asyncDepth != prevDepth) {
+        AddMessage(RGY_LOG_TRACE, _T("async depth %d -> %d (starved %d/%d).\n"), prevDepth, m_asyncDepth, m_asyncStarvedFrames, m_asyncAdjustFrames);
+    }
+    m_asyncAdjustFrames = 0;
+    m_asyncStarvedFrames = 0;
+}
+
 int RGYInputVpy::getRevInfo(const char *vsVersionString) {
     char *api_info = NULL;
     char buf[1024];
@@ -363,16 +412,21 @@ RGY_ERR RGYInputVpy::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
     }
 
-    m_nAsyncFrames = vsvideoinfo->numFrames;
-    m_nAsyncFrames = (std::min)(m_nAsyncFrames, vscoreinfo.numThreads);
-    m_nAsyncFrames = (std::min)(m_nAsyncFrames, ASYNC_BUFFER_SIZE-1);
+    //同時に要求するフレーム数はVapourSynthのスレッド数から開始し、
+    //フレームの取り出しが待たされるかどうかに応じて、min-maxの範囲で増減させる
+    m_asyncDepth = (std::min)(vsvideoinfo->numFrames, vscoreinfo.numThreads);
+    m_asyncDepth = (std::max)((std::min)(m_asyncDepth, ASYNC_BUFFER_SIZE-1), 1);
+    m_asyncDepthMin = (std::max)(m_asyncDepth / 2, 1);
+    m_asyncDepthMax = (std::min)((std::min)(m_asyncDepth * 2, vsvideoinfo->numFrames), ASYNC_BUFFER_SIZE-1);
     if (m_inputVideoInfo.type != RGY_INPUT_FMT_VPY_MT) {
-        m_nAsyncFrames = 1;
-    }
-
-    for (int i = 0; i < m_nAsyncFrames; i++) {
-        m_sVSapi->getFrameAsync(i, m_sVSnode, frameDoneCallback, this);
+        m_asyncDepth = 1;
+        m_asyncDepthMin = 1;
+        m_asyncDepthMax = 1;
     }
+    AddMessage(RGY_LOG_DEBUG, _T("async depth %d (%d - %d).\n"), m_asyncDepth, m_asyncDepthMin, m_asyncDepthMax);
+    m_nAsyncFrames = 0;
+    m_nAsyncFramesDone = 0;
+    requestFramesAsync();
 
     tstring vs_ver = _T("VapourSynth");
     if (m_inputVideoInfo.type == RGY_INPUT_FMT_VPY_MT) {
@@ -409,6 +463,10 @@ void RGYInputVpy::Close() {
     m_sVSscript = nullptr;
     m_sVSnode = nullptr;
     m_nAsyncFrames = 0;
+    m_nAsyncFramesDone = 0;
+    m_asyncDepth = 1;
+    m_asyncAdjustFrames = 0;
+    m_asyncStarvedFrames = 0;
     m_encSatusInfo.reset();
     AddMessage(RGY_LOG_DEBUG, _T("Closed.\n"));
 }
@@ -421,7 +479,8 @@ RGY_ERR RGYInputVpy::LoadNextFrameInternal(RGYFrame *pSurface) {
         return RGY_ERR_MORE_DATA;
     }
 
-    const VSFrameRef *src_frame = getFrameFromAsyncBuffer(m_encSatusInfo->m_sData.frameIn);
+    bool starved = false;
+    const VSFrameRef *src_frame = getFrameFromAsyncBuffer(m_encSatusInfo->m_sData.frameIn, &starved);
     if (src_frame == nullptr) {
         return RGY_ERR_MORE_DATA;
     }
@@ -438,6 +497,11 @@ RGY_ERR RGYInputVpy::LoadNextFrameInternal(RGYFrame *pSurface) {
 
     m_encSatusInfo->m_sData.frameIn++;
     m_nCopyOfInputFrames = m_encSatusInfo->m_sData.frameIn;
+    if (m_asyncDepthMax > m_asyncDepthMin) {
+        adjustAsyncDepth(starved);
+    }
+    //バッファに空きができたので、次のフレームを要求する
+    requestFramesAsync();
 
     return m_encSatusInfo->UpdateDisplay();
 }
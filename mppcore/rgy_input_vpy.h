@@ -31,6 +31,8 @@
 
 #include "rgy_version.h"
 #if ENABLE_VAPOURSYNTH_READER
+#include <atomic>
+#include <mutex>
 #include "rgy_osdep.h"
 #include "rgy_input.h"
 #include "VapourSynth.h"
@@ -38,6 +40,7 @@
 
 const int ASYNC_BUFFER_2N = 7;
 const int ASYNC_BUFFER_SIZE = 1<<ASYNC_BUFFER_2N;
+const int ASYNC_DEPTH_ADJUST_INTERVAL = 32; //同時に要求するフレーム数を見直す間隔(フレーム数)
 
 #if _M_IX86
 #define VPY_X64 0
@@ -95,8 +98,15 @@ protected:
     int load_vapoursynth(const tstring& vsdir);
     int initAsyncEvents();
     void closeAsyncEvents();
-    const VSFrameRef* getFrameFromAsyncBuffer(int n) {
-        WaitForSingleObject(m_hAsyncEventFrameSetFin[n & (ASYNC_BUFFER_SIZE-1)], INFINITE);
+    void requestFramesAsync();
+    void adjustAsyncDepth(bool starved);
+    const VSFrameRef* getFrameFromAsyncBuffer(int n, bool *starved = nullptr) {
+        HANDLE heFin = m_hAsyncEventFrameSetFin[n & (ASYNC_BUFFER_SIZE-1)];
+        if (WaitForSingleObject(heFin, 0) == WAIT_TIMEOUT) {
+            //フレームの生成が間に合っておらず、待たされた
+            if (starved) *starved = true;
+            WaitForSingleObject(heFin, INFINITE);
+        }
         const VSFrameRef *frame = m_pAsyncBuffer[n & (ASYNC_BUFFER_SIZE-1)];
         SetEvent(m_hAsyncEventFrameSetStart[n & (ASYNC_BUFFER_SIZE-1)]);
         return frame;
@@ -108,12 +118,19 @@ protected:
     int getRevInfo(const char *vs_version_string);
 
     bool m_bAbortAsync;
-    uint32_t m_nCopyOfInputFrames;
+    std::atomic<uint32_t> m_nCopyOfInputFrames;
 
     const VSAPI *m_sVSapi;
     VSScript *m_sVSscript;
     VSNodeRef *m_sVSnode;
-    int m_nAsyncFrames;
+    int m_nAsyncFrames;        //要求済みのフレーム数
+    int m_nAsyncFramesDone;    //生成済みのフレーム数
+    int m_asyncDepth;          //同時に要求するフレーム数 (生成待ちのフレーム数の上限)
+    int m_asyncDepthMin;
+    int m_asyncDepthMax;
+    int m_asyncAdjustFrames;   //前回の見直しからのフレーム数
+    int m_asyncStarvedFrames;  //前回の見直しから、フレームの生成を待たされた回数
+    std::recursive_mutex m_asyncMtx; //getFrameAsyncのコールバックが同じスレッドから呼ばれることもあるのでrecursive
 
     vsscript_t m_sVS;
 };
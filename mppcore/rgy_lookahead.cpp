@@ -0,0 +1,322 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <numeric>
+#include "rgy_lookahead.h"
+#include "rgy_util.h"
+#include "convert_csp.h"
+
+static const int   LOOKAHEAD_SMALL_WIDTH_MAX = 480;   // 縮小画像の最大幅
+static const int   LOOKAHEAD_SCENECUT_MIN_INTERVAL = 4; // シーンチェンジによるIDRの最小間隔
+static const float LOOKAHEAD_SCENECUT_SPIKE = 2.5f;  // 直前のフレーム群のinterCostの何倍以上でシーンチェンジとするか
+static const float LOOKAHEAD_FLASH_RATIO = 0.5f;     // 前後のフレームの差分がこれ以下ならフラッシュとみなす
+static const size_t LOOKAHEAD_HISTORY = 4;
+static const float LOOKAHEAD_STATIC_LOW = 0.05f;     // これ以下のinter/intraは完全に静止とみなす
+static const float LOOKAHEAD_STATIC_HIGH = 0.25f;    // これ以上のinter/intraは動きがあるとみなす
+
+RGYLookaheadParam::RGYLookaheadParam() :
+    depth(0),
+    scenecut(true),
+    scenecutThreshold(1.5f),
+    qpOffset(3) {
+
+}
+
+bool RGYLookaheadParam::operator==(const RGYLookaheadParam &x) const {
+    return depth == x.depth
+        && scenecut == x.scenecut
+        && scenecutThreshold == x.scenecutThreshold
+        && qpOffset == x.qpOffset;
+}
+bool RGYLookaheadParam::operator!=(const RGYLookaheadParam &x) const {
+    return !(*this == x);
+}
+
+tstring RGYLookaheadParam::print() const {
+    if (!enable()) {
+        return _T("off");
+    }
+    tstring str = strsprintf(_T("%d frames, scenecut "), depth);
+    str += (scenecut) ? strsprintf(_T("on (%.2f)"), scenecutThreshold) : _T("off");
+    str += strsprintf(_T(", qp offset %d"), qpOffset);
+    return str;
+}
+
+RGYLookahead::RGYLookahead() :
+    m_prm(),
+    m_smallWidth(0),
+    m_smallHeight(0),
+    m_blockSize(0),
+    m_window(),
+    m_lastAdded(),
+    m_popped(),
+    m_historyInter(),
+    m_addCount(0),
+    m_lastIDR(0),
+    m_sceneChangeCount(0) {
+
+}
+
+RGYLookahead::~RGYLookahead() {
+    reset();
+}
+
+void RGYLookahead::reset() {
+    m_window.clear();
+    m_lastAdded.clear();
+    m_popped.clear();
+    m_historyInter.clear();
+    m_smallWidth = 0;
+    m_smallHeight = 0;
+    m_blockSize = 0;
+    m_addCount = 0;
+    m_lastIDR = 0;
+    m_sceneChangeCount = 0;
+}
+
+RGY_ERR RGYLookahead::init(const RGYLookaheadParam &prm) {
+    if (prm.depth < 0 || prm.depth > LOOKAHEAD_DEPTH_MAX) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    if (prm.qpOffset < 0 || prm.qpOffset > LOOKAHEAD_QP_OFFSET_MAX) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    if (prm.scenecutThreshold <= 0.0f) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    reset();
+    m_prm = prm;
+    return RGY_ERR_NONE;
+}
+
+int RGYLookahead::blockSize(const int width) const {
+    int size = 4;
+    while (width / size > LOOKAHEAD_SMALL_WIDTH_MAX && size < 32) {
+        size *= 2;
+    }
+    return size;
+}
+
+void RGYLookahead::downscale(std::vector<uint8_t> &small, const RGYFrameInfo *luma) const {
+    const bool u16 = RGY_CSP_DATA_TYPE[luma->csp] == RGY_DATA_TYPE_U16;
+    // P010などは上位詰め、yv12(10bit)などは下位詰めなので、RGY_CSP_BIT_DEPTHから8bitへのシフト量を決める
+    const int shift = (u16) ? std::max(0, (int)RGY_CSP_BIT_DEPTH[luma->csp] - 8) : 0;
+    // メモリ帯域を抑えるため、ブロック内は1行おきに読む
+    const int rowStep = (m_blockSize >= 4) ? 2 : 1;
+    const int samples = m_blockSize * (m_blockSize / rowStep);
+    small.resize(m_smallWidth * m_smallHeight);
+    std::vector<uint32_t> sum(m_smallWidth);
+    for (int by = 0; by < m_smallHeight; by++) {
+        std::fill(sum.begin(), sum.end(), 0);
+        for (int iy = 0; iy < m_blockSize; iy += rowStep) {
+            const uint8_t *line = luma->ptr[0] + (size_t)(by * m_blockSize + iy) * luma->pitch[0];
+            if (u16) {
+                const uint16_t *line16 = (const uint16_t *)line;
+                for (int bx = 0; bx < m_smallWidth; bx++) {
+                    const uint16_t *ptr = line16 + bx * m_blockSize;
+                    uint32_t s = 0;
+                    for (int ix = 0; ix < m_blockSize; ix++) {
+                        s += ptr[ix] >> shift;
+                    }
+                    sum[bx] += s;
+                }
+            } else {
+                for (int bx = 0; bx < m_smallWidth; bx++) {
+                    const uint8_t *ptr = line + bx * m_blockSize;
+                    uint32_t s = 0;
+                    for (int ix = 0; ix < m_blockSize; ix++) {
+                        s += ptr[ix];
+                    }
+                    sum[bx] += s;
+                }
+            }
+        }
+        uint8_t *dst = small.data() + by * m_smallWidth;
+        for (int bx = 0; bx < m_smallWidth; bx++) {
+            dst[bx] = (uint8_t)std::min<uint32_t>(255, (sum[bx] + samples / 2) / samples);
+        }
+    }
+}
+
+float RGYLookahead::calcIntraCost(const std::vector<uint8_t> &small) const {
+    uint64_t sum = 0;
+    for (int y = 0; y < m_smallHeight - 1; y++) {
+        const uint8_t *line0 = small.data() + y * m_smallWidth;
+        const uint8_t *line1 = line0 + m_smallWidth;
+        for (int x = 0; x < m_smallWidth - 1; x++) {
+            sum += std::abs((int)line0[x] - (int)line0[x + 1]);
+            sum += std::abs((int)line0[x] - (int)line1[x]);
+        }
+    }
+    const int count = (m_smallWidth - 1) * (m_smallHeight - 1) * 2;
+    return (count > 0) ? (float)sum / count : 0.0f;
+}
+
+float RGYLookahead::calcSAD(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) const {
+    if (a.size() != b.size() || a.size() == 0) {
+        return 0.0f;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        sum += std::abs((int)a[i] - (int)b[i]);
+    }
+    return (float)sum / a.size();
+}
+
+RGY_ERR RGYLookahead::add(const RGYFrameInfo *frame) {
+    if (frame == nullptr || frame->ptr[0] == nullptr) {
+        return RGY_ERR_NULL_PTR;
+    }
+    switch (frame->csp) {
+    case RGY_CSP_YUY2:
+    case RGY_CSP_Y210:
+    case RGY_CSP_Y216:
+    case RGY_CSP_Y410:
+    case RGY_CSP_Y416:
+    case RGY_CSP_VUYA:
+    case RGY_CSP_VUYA_16:
+        return RGY_ERR_UNSUPPORTED;
+    default:
+        break;
+    }
+    if (RGY_CSP_CHROMA_FORMAT[frame->csp] == RGY_CHROMAFMT_RGB
+        || RGY_CSP_CHROMA_FORMAT[frame->csp] == RGY_CHROMAFMT_RGB_PACKED
+        || (RGY_CSP_DATA_TYPE[frame->csp] != RGY_DATA_TYPE_U8 && RGY_CSP_DATA_TYPE[frame->csp] != RGY_DATA_TYPE_U16)) {
+        return RGY_ERR_UNSUPPORTED;
+    }
+    const auto luma = getPlane(frame, RGY_PLANE_Y);
+    const int block = blockSize(luma.width);
+    if (block != m_blockSize || luma.width / block != m_smallWidth || luma.height / block != m_smallHeight) {
+        // 解像度が変わった場合は、比較対象をリセットする
+        m_blockSize = block;
+        m_smallWidth = luma.width / block;
+        m_smallHeight = luma.height / block;
+        m_lastAdded.clear();
+        m_popped.clear();
+        m_historyInter.clear();
+    }
+    if (m_smallWidth < 2 || m_smallHeight < 2) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    FrameStat stat;
+    stat.idx = m_addCount++;
+    downscale(stat.small, &luma);
+    stat.intra = calcIntraCost(stat.small);
+    stat.inter = calcSAD(m_lastAdded, stat.small);
+    m_lastAdded = stat.small;
+    m_window.push_back(std::move(stat));
+    return RGY_ERR_NONE;
+}
+
+bool RGYLookahead::ready(const bool flush) const {
+    return (flush) ? m_window.size() > 0 : (int)m_window.size() > m_prm.depth;
+}
+
+bool RGYLookahead::isSceneChange(const FrameStat &cur) const {
+    if (!m_prm.scenecut || cur.idx == 0) {
+        return false;
+    }
+    if (cur.idx - m_lastIDR < LOOKAHEAD_SCENECUT_MIN_INTERVAL) {
+        return false;
+    }
+    const float score = cur.inter / std::max(cur.intra, 1.0f);
+    if (score < m_prm.scenecutThreshold) {
+        return false;
+    }
+    // パンなど大きな動きが続いているだけの場合は除外する
+    if (m_historyInter.size() > 0) {
+        const float avg = std::accumulate(m_historyInter.begin(), m_historyInter.end(), 0.0f) / m_historyInter.size();
+        if (cur.inter < std::max(avg, 1.0f) * LOOKAHEAD_SCENECUT_SPIKE) {
+            return false;
+        }
+    }
+    // 前後のフレームが似ていれば、フラッシュなど1フレームだけの変化とみなす
+    if (m_window.size() >= 2 && m_popped.size() > 0 && m_popped.back().size() == cur.small.size()) {
+        const float sadSkip = calcSAD(m_popped.back(), m_window[1].small);
+        if (sadSkip < cur.inter * LOOKAHEAD_FLASH_RATIO) {
+            return false;
+        }
+    }
+    // 2フレーム前と似ていれば、フラッシュから元に戻ったフレームとみなす
+    if (m_popped.size() >= 2 && m_popped.front().size() == cur.small.size()) {
+        const float sadPrev2 = calcSAD(m_popped.front(), cur.small);
+        if (sadPrev2 < cur.inter * LOOKAHEAD_FLASH_RATIO) {
+            return false;
+        }
+    }
+    return true;
+}
+
+float RGYLookahead::staticLevel() const {
+    if (m_window.size() == 0) {
+        return 0.0f;
+    }
+    float ratio = 0.0f;
+    for (const auto &stat : m_window) {
+        ratio += stat.inter / std::max(stat.intra, 1.0f);
+    }
+    ratio /= m_window.size();
+    return clamp((LOOKAHEAD_STATIC_HIGH - ratio) / (LOOKAHEAD_STATIC_HIGH - LOOKAHEAD_STATIC_LOW), 0.0f, 1.0f);
+}
+
+RGYLookaheadResult RGYLookahead::pop() {
+    RGYLookaheadResult result;
+    if (m_window.size() == 0) {
+        return result;
+    }
+    auto &cur = m_window.front();
+    result.frameIdx = cur.idx;
+    result.intraCost = cur.intra;
+    result.interCost = cur.inter;
+    result.sceneScore = cur.inter / std::max(cur.intra, 1.0f);
+    result.forceIDR = isSceneChange(cur);
+    const bool idr = result.forceIDR || cur.idx == 0;
+    if (m_prm.qpOffset > 0) {
+        // 静止した区間ではPフレームのQPを上げ、その参照元となるIDRはQPを下げる
+        const float level = staticLevel();
+        result.qpOffset = (idr) ? -(int)(m_prm.qpOffset * level * 0.5f + 0.5f) : (int)(m_prm.qpOffset * level + 0.5f);
+    }
+    if (idr) {
+        m_lastIDR = cur.idx;
+        m_historyInter.clear();
+    } else {
+        m_historyInter.push_back(cur.inter);
+        if (m_historyInter.size() > LOOKAHEAD_HISTORY) {
+            m_historyInter.pop_front();
+        }
+    }
+    if (result.forceIDR) {
+        m_sceneChangeCount++;
+    }
+    m_popped.push_back(std::move(cur.small));
+    if (m_popped.size() > 2) {
+        m_popped.pop_front();
+    }
+    m_window.pop_front();
+    return result;
+}
@@ -0,0 +1,110 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_LOOKAHEAD_H__
+#define __RGY_LOOKAHEAD_H__
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+#include "rgy_frame_info.h"
+
+static const int LOOKAHEAD_DEPTH_MAX = 16;
+static const int LOOKAHEAD_QP_OFFSET_MAX = 10;
+
+struct RGYLookaheadParam {
+    int depth;               // 先読みするフレーム数 (0で無効)
+    bool scenecut;           // シーンチェンジでIDRを挿入する
+    float scenecutThreshold; // シーンチェンジ判定の閾値 (大きいほど検出しにくい)
+    int qpOffset;            // 静止した区間で加算するQPオフセットの最大値 (0で無効)
+
+    RGYLookaheadParam();
+    bool enable() const { return depth > 0; }
+    bool operator==(const RGYLookaheadParam &x) const;
+    bool operator!=(const RGYLookaheadParam &x) const;
+    tstring print() const;
+};
+
+struct RGYLookaheadResult {
+    int64_t frameIdx;   // 解析に投入された順番
+    bool forceIDR;      // IDRとすべきフレーム
+    int qpOffset;       // エンコーダに渡す相対QP
+    float intraCost;    // 縮小画像の隣接画素差分の平均
+    float interCost;    // 縮小画像の直前フレームとの差分絶対値の平均
+    float sceneScore;   // interCost / intraCost
+
+    RGYLookaheadResult() : frameIdx(-1), forceIDR(false), qpOffset(0), intraCost(0.0f), interCost(0.0f), sceneScore(0.0f) {};
+};
+
+// エンコーダの前段で輝度の縮小画像を解析し、シーンチェンジと複雑さの判定を行う
+// ハードウェアに依存しないので、CPUから読めるRGYFrameInfoを与えれば単体で動作する
+class RGYLookahead {
+public:
+    RGYLookahead();
+    ~RGYLookahead();
+
+    RGY_ERR init(const RGYLookaheadParam &prm);
+    // 輝度面を解析してウィンドウに追加する
+    RGY_ERR add(const RGYFrameInfo *frame);
+    // 先頭フレームの判定に必要な先読みがそろっているか (flush時は残りがあるか)
+    bool ready(const bool flush) const;
+    // 先頭フレームの判定を取り出す
+    RGYLookaheadResult pop();
+    size_t queued() const { return m_window.size(); }
+    int64_t sceneChangeCount() const { return m_sceneChangeCount; }
+    void reset();
+protected:
+    struct FrameStat {
+        int64_t idx;
+        std::vector<uint8_t> small; // 縮小した輝度
+        float intra;
+        float inter;
+    };
+    int blockSize(const int width) const;
+    void downscale(std::vector<uint8_t> &small, const RGYFrameInfo *luma) const;
+    float calcIntraCost(const std::vector<uint8_t> &small) const;
+    float calcSAD(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) const;
+    bool isSceneChange(const FrameStat &cur) const;
+    float staticLevel() const;
+
+    RGYLookaheadParam m_prm;
+    int m_smallWidth;
+    int m_smallHeight;
+    int m_blockSize;
+    std::deque<FrameStat> m_window;      // 判定待ちのフレーム
+    std::vector<uint8_t> m_lastAdded;    // 直前にaddしたフレームの縮小画像
+    std::deque<std::vector<uint8_t>> m_popped; // 直前にpopした2フレームの縮小画像 (フラッシュ判定用)
+    std::deque<float> m_historyInter;    // popしたフレームのinterCostの履歴
+    int64_t m_addCount;
+    int64_t m_lastIDR;
+    int64_t m_sceneChangeCount;
+};
+
+#endif //__RGY_LOOKAHEAD_H__
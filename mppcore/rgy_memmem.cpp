@@ -50,6 +50,8 @@ decltype(rgy_memmem_c)* get_memmem_func() {
     if ((simd & RGY_SIMD::AVX512BW) == RGY_SIMD::AVX512BW) return rgy_memmem_avx512bw;
 #endif
     if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) return rgy_memmem_avx2;
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    return rgy_memmem_neon; // aarch64ではNEONは常に使用可能
 #endif
     return rgy_memmem_c;
 }
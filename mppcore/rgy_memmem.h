@@ -37,6 +37,7 @@
 size_t rgy_memmem_c(const void *data_, const size_t data_size, const void *target_, const size_t target_size);
 size_t rgy_memmem_avx2(const void *data_, const size_t data_size, const void *target_, const size_t target_size);
 size_t rgy_memmem_avx512bw(const void *data_, const size_t data_size, const void *target_, const size_t target_size);
+size_t rgy_memmem_neon(const void *data_, const size_t data_size, const void *target_, const size_t target_size);
 
 static const auto RGY_MEMMEM_NOT_FOUND = std::numeric_limits<decltype(rgy_memmem_c(nullptr, 0, nullptr, 0))>::max();
 
@@ -218,6 +219,64 @@ static RGY_FORCEINLINE size_t rgy_memmem_avx512_imp(const void *data_, const siz
 
 #endif //#if defined(_M_X64) || defined(__x86_64)
 
+#elif defined(RGY_MEMMEM_NEON)
+
+#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+
+#include <arm_neon.h>
+
+#if defined(_MSC_VER)
+#define CTZ64(x) _CountTrailingZeros64(x)
+#else
+#define CTZ64(x) __builtin_ctzll(x)
+#endif
+
+// 比較結果(0x00/0xff)を1byteあたり4bitのマスクに変換する
+// 各byteの最上位bit(bit 4*k+3)のみを残すので、CTZ64(mask) >> 2 で位置が求まる
+static RGY_FORCEINLINE uint64_t rgy_neon_movemask_u8(const uint8x16_t cmp) {
+    const uint8x8_t res = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(res), 0) & 0x8888888888888888ull;
+}
+
+static RGY_FORCEINLINE size_t rgy_memmem_neon_imp(const void *data_, const size_t data_size, const void *target_, const size_t target_size) {
+    if (data_size < target_size) {
+        return RGY_MEMMEM_NOT_FOUND;
+    }
+    if (target_size < 2) {
+        return rgy_memmem_c(data_, data_size, target_, target_size);
+    }
+    const uint8_t *data = (const uint8_t *)data_;
+    const uint8_t *target = (const uint8_t *)target_;
+    const uint8x16_t target_first = vdupq_n_u8(target[0]);
+    const uint8x16_t target_last = vdupq_n_u8(target[target_size - 1]);
+    const int64_t fin64 = (int64_t)data_size - (int64_t)(target_size + 16 - 1); // r1の16byteロードが安全に行える限界
+    size_t i = 0;
+    if (fin64 > 0) {
+        const size_t fin = (size_t)fin64;
+        for (; i < fin; i += 16) {
+            const uint8x16_t r0 = vld1q_u8(data + i);
+            const uint8x16_t r1 = vld1q_u8(data + i + target_size - 1);
+            uint64_t mask = rgy_neon_movemask_u8(vandq_u8(vceqq_u8(r0, target_first), vceqq_u8(r1, target_last)));
+            while (mask != 0) {
+                const auto j = CTZ64(mask) >> 2;
+                if (memcmp(data + i + j + 1, target + 1, target_size - 2) == 0) {
+                    return i + j;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+    //残りは範囲外を読まないよう1byteずつ
+    for (; i + target_size <= data_size; i++) {
+        if (data[i] == target[0] && memcmp(data + i + 1, target + 1, target_size - 1) == 0) {
+            return i;
+        }
+    }
+    return RGY_MEMMEM_NOT_FOUND;
+}
+
+#endif //#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+
 #endif //#if defined(RGY_MEMMEM_AVX2)
 
 #endif //__RGY_MEMMEM_H__
\ No newline at end of file
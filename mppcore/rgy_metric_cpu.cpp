@@ -0,0 +1,1231 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdarg>
+#include <algorithm>
+#include <numeric>
+#include "rgy_simd.h"
+#include "rgy_metric_cpu.h"
+#include "cpu_info.h"
+#if ENCODER_MPP
+#include "mpp_util.h"
+#endif
+
+static const int METRIC_MAX_QUEUED_PACKETS = 8; // 比較待ちのビットストリームの上限
+static const int METRIC_STRIPE_MIN_HEIGHT = 16; // 1stripeの最小の高さ
+static const int METRIC_THREADS_MAX = 8;        // 自動設定時のスレッド数の上限
+static const int METRIC_ORG_THREADS_MAX = 4;    // オリジナルフレームのコピーに使用するスレッド数の上限 (メモリ帯域で律速されるため)
+static const int VIF_SCALES = 4;
+static const int VIF_FILTER_WIDTH[VIF_SCALES] = { 17, 9, 5, 3 };
+static const int VIF_FILTER_WIDTH_MAX = 17;
+static const float VIF_SIGMA_NSQ = 2.0f;
+static const float VIF_EPS = 1.0e-10f;
+static const float VIF_GAIN_LIMIT = 100.0f;
+static const float ADM_COS_1DEG_SQ = 0.99969541f; // cos(1°)^2
+
+uint64_t rgy_metric_ssd_c(const uint16_t *a, const uint16_t *b, int width) {
+    uint64_t ssd = 0;
+    for (int x = 0; x < width; x++) {
+        const int d = (int)a[x] - (int)b[x];
+        ssd += (uint64_t)(d * d);
+    }
+    return ssd;
+}
+
+uint64_t rgy_metric_sad_c(const uint16_t *a, const uint16_t *b, int width) {
+    uint64_t sad = 0;
+    for (int x = 0; x < width; x++) {
+        sad += (uint64_t)std::abs((int)a[x] - (int)b[x]);
+    }
+    return sad;
+}
+
+void rgy_metric_ssim4x4_c(const uint16_t *a, int pitchA, const uint16_t *b, int pitchB, int blocks, int32_t (*sums)[4]) {
+    for (int z = 0; z < blocks; z++) {
+        int32_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                const int va = a[y * pitchA + z * 4 + x];
+                const int vb = b[y * pitchB + z * 4 + x];
+                s1  += va;
+                s2  += vb;
+                ss  += va * va + vb * vb;
+                s12 += va * vb;
+            }
+        }
+        sums[z][0] = s1;
+        sums[z][1] = s2;
+        sums[z][2] = ss;
+        sums[z][3] = s12;
+    }
+}
+
+void rgy_metric_vif_vfilter_c(const float *const *ref, const float *const *dis, const float *filter, int taps, int width, float *const *out) {
+    for (int i = 0; i < 5; i++) {
+        std::fill(out[i], out[i] + width, 0.0f);
+    }
+    for (int k = 0; k < taps; k++) {
+        const float c = filter[k];
+        const float *pr = ref[k];
+        const float *pd = dis[k];
+        for (int x = 0; x < width; x++) {
+            const float vr = pr[x], vd = pd[x];
+            out[0][x] += c * vr;
+            out[1][x] += c * vd;
+            out[2][x] += c * vr * vr;
+            out[3][x] += c * vd * vd;
+            out[4][x] += c * vr * vd;
+        }
+    }
+}
+
+void rgy_metric_vif_hfilter_c(const float *src, const float *filter, int taps, int width, float *dst) {
+    std::fill(dst, dst + width, 0.0f);
+    for (int k = 0; k < taps; k++) {
+        const float c = filter[k];
+        const float *ptr = src + k;
+        for (int x = 0; x < width; x++) {
+            dst[x] += c * ptr[x];
+        }
+    }
+}
+
+RGYMetricCPUFuncs get_metric_cpu_funcs() {
+    RGYMetricCPUFuncs funcs = { rgy_metric_ssd_c, rgy_metric_sad_c, rgy_metric_ssim4x4_c, rgy_metric_vif_vfilter_c, rgy_metric_vif_hfilter_c, _T("c") };
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+    const auto simd = get_availableSIMD();
+    if ((simd & RGY_SIMD::AVX2) == RGY_SIMD::AVX2) {
+        funcs = { rgy_metric_ssd_avx2, rgy_metric_sad_avx2, rgy_metric_ssim4x4_avx2, rgy_metric_vif_vfilter_avx2, rgy_metric_vif_hfilter_avx2, _T("avx2") };
+    }
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+    // aarch64ではNEONは常に使用可能
+    funcs = { rgy_metric_ssd_neon, rgy_metric_sad_neon, rgy_metric_ssim4x4_neon, rgy_metric_vif_vfilter_neon, rgy_metric_vif_hfilter_neon, _T("neon") };
+#endif
+    return funcs;
+}
+
+static double ssim_db(double ssim, double weight) {
+    return 10.0 * log10(weight / (weight - ssim));
+}
+
+static double get_psnr(double mse, uint64_t nb_frames, int max) {
+    return 10.0 * log10((max * max) / (mse / nb_frames));
+}
+
+// 8x8の窓 (4x4ブロック x 4) の集計値からSSIMを求める (x264と同じ計算)
+static double ssim_end1(double s1, double s2, double ss, double s12, double c1, double c2) {
+    const double vars = ss * 64 - s1 * s1 - s2 * s2;
+    const double covar = s12 * 64 - s1 * s2;
+    return (2 * s1 * s2 + c1) * (2 * covar + c2) / ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+}
+
+static inline int mirror_idx(int i, int n) {
+    if (i < 0) i = -i;
+    if (i >= n) i = 2 * n - 2 - i;
+    return clamp(i, 0, n - 1);
+}
+
+template<typename T>
+static void copy_line_to_u16(uint16_t *dst, const uint8_t *src, int width, int stepBytes, int shiftIn, int shift) {
+    if (stepBytes == sizeof(T) && shiftIn == 0) {
+        // 連続したデータは自動ベクトル化されるよう、単純なループで処理する
+        const T *ptr = (const T *)src;
+        if (shift >= 0) {
+            for (int x = 0; x < width; x++) {
+                dst[x] = (uint16_t)(ptr[x] >> shift);
+            }
+        } else {
+            for (int x = 0; x < width; x++) {
+                dst[x] = (uint16_t)(ptr[x] << (-shift));
+            }
+        }
+        return;
+    }
+    if (shift >= 0) {
+        for (int x = 0; x < width; x++) {
+            dst[x] = (uint16_t)((*(const T *)(src + x * stepBytes) >> shiftIn) >> shift);
+        }
+    } else {
+        for (int x = 0; x < width; x++) {
+            dst[x] = (uint16_t)((*(const T *)(src + x * stepBytes) >> shiftIn) << (-shift));
+        }
+    }
+}
+
+// NV12/P010などのUVを1回の読み込みでU, Vに分離する
+template<typename T>
+static void split_line_to_u16(uint16_t *dstU, uint16_t *dstV, const uint8_t *src, int width, int shift) {
+    const T *ptr = (const T *)src;
+    if (shift >= 0) {
+        for (int x = 0; x < width; x++) {
+            dstU[x] = (uint16_t)(ptr[2 * x + 0] >> shift);
+            dstV[x] = (uint16_t)(ptr[2 * x + 1] >> shift);
+        }
+    } else {
+        for (int x = 0; x < width; x++) {
+            dstU[x] = (uint16_t)(ptr[2 * x + 0] << (-shift));
+            dstV[x] = (uint16_t)(ptr[2 * x + 1] << (-shift));
+        }
+    }
+}
+
+RGYVideoMetricCPUParam::RGYVideoMetricCPUParam() :
+    metric(),
+    vif(false),
+    adm(false),
+    motion(false),
+    threads(0),
+    logFile(),
+    codec(RGY_CODEC_UNKNOWN),
+    frameInfo(),
+    bitDepth(8),
+    threadParam() {
+}
+
+bool RGYVideoMetricCPUParam::enabled() const {
+    return metric.ssim || metric.psnr || vif || adm || motion;
+}
+
+tstring RGYVideoMetricCPUParam::print() const {
+    tstring str;
+    if (metric.ssim) str += _T("ssim ");
+    if (metric.psnr) str += _T("psnr ");
+    if (vif)         str += _T("vif ");
+    if (adm)         str += _T("adm ");
+    if (motion)      str += _T("motion ");
+    return str;
+}
+
+RGYMetricCPUWorkers::RGYMetricCPUWorkers() :
+    m_threads(),
+    m_mtx(),
+    m_condStart(),
+    m_condFin(),
+    m_func(nullptr),
+    m_jobs(0),
+    m_nextJob(0),
+    m_finJobs(0),
+    m_generation(0),
+    m_abort(false) {
+}
+
+RGYMetricCPUWorkers::~RGYMetricCPUWorkers() {
+    stop();
+}
+
+void RGYMetricCPUWorkers::start(int threads, const RGYParamThread& threadParam) {
+    stop();
+    m_abort = false;
+    // 呼び出し元のスレッドも処理に参加するので、1つ少なく起動する
+    for (int i = 1; i < threads; i++) {
+        m_threads.push_back(std::thread(&RGYMetricCPUWorkers::worker, this, threadParam));
+    }
+}
+
+void RGYMetricCPUWorkers::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_abort = true;
+    }
+    m_condStart.notify_all();
+    for (auto& th : m_threads) {
+        if (th.joinable()) {
+            th.join();
+        }
+    }
+    m_threads.clear();
+}
+
+// ロックを取った状態で呼ぶこと、ジョブを1つ実行したらtrueを返す
+bool RGYMetricCPUWorkers::runJob(std::unique_lock<std::mutex>& lock) {
+    if (m_func == nullptr || m_nextJob >= m_jobs) {
+        return false;
+    }
+    const int job = m_nextJob++;
+    const auto func = m_func;
+    lock.unlock();
+    (*func)(job);
+    lock.lock();
+    if (++m_finJobs == m_jobs) {
+        m_condFin.notify_all();
+    }
+    return true;
+}
+
+void RGYMetricCPUWorkers::worker(RGYParamThread threadParam) {
+    threadParam.apply(GetCurrentThread());
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (!m_abort) {
+        m_condStart.wait(lock, [&]() { return m_abort || m_generation != generation; });
+        generation = m_generation;
+        while (!m_abort && runJob(lock)) {
+            ;
+        }
+    }
+}
+
+void RGYMetricCPUWorkers::run(int jobs, const std::function<void(int)>& func) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_func = &func;
+    m_jobs = jobs;
+    m_nextJob = 0;
+    m_finJobs = 0;
+    m_generation++;
+    m_condStart.notify_all();
+    while (runJob(lock)) {
+        ;
+    }
+    m_condFin.wait(lock, [&]() { return m_finJobs >= m_jobs; });
+    m_func = nullptr;
+}
+
+RGYMetricCPUFrame::RGYMetricCPUFrame(const std::array<int, 3>& width_, const std::array<int, 3>& height_) :
+    buf(), width(width_), height(height_), pitch() {
+    for (size_t i = 0; i < buf.size(); i++) {
+        pitch[i] = ALIGN(width[i], 32);
+        buf[i].resize((size_t)pitch[i] * height[i], 0);
+    }
+}
+
+void RGYMetricCPUStripeResult::clear() {
+    ssim.fill(0.0);
+    ssd.fill(0);
+    sad = 0;
+    vifNum.fill(0.0);
+    vifDen.fill(0.0);
+    admNum = 0.0;
+    admDen = 0.0;
+}
+
+RGYVideoMetricCPU::RGYVideoMetricCPU() :
+    m_log(),
+    m_prm(),
+    m_func(),
+    m_workers(),
+    m_workersOrg(),
+    m_stripes(1),
+    m_planeWidth(),
+    m_planeHeight(),
+    m_planes(3),
+    m_planeCoef(),
+    m_stripeResult(),
+    m_stripeWork(),
+#if ENABLE_AVSW_READER
+    m_codecCtx(),
+    m_decAVFrame(),
+#endif //#if ENABLE_AVSW_READER
+    m_decFrame(),
+    m_thread(),
+    m_mtx(),
+    m_cond(),
+    m_abort(false),
+    m_flush(false),
+    m_err(RGY_ERR_NONE),
+    m_input(),
+    m_unused(),
+#if ENABLE_AVSW_READER
+    m_packets(),
+#endif //#if ENABLE_AVSW_READER
+    m_blur(),
+    m_blurIdx(0),
+    m_vifRef(),
+    m_vifDis(),
+    m_vifWidth(),
+    m_vifHeight(),
+    m_vifFilter(),
+    m_fpLog(),
+    m_ssimTotalPlane(),
+    m_ssimTotal(0.0),
+    m_psnrTotalPlane(),
+    m_psnrTotal(0.0),
+    m_vifTotal(),
+    m_admTotal(0.0),
+    m_motionTotal(0.0),
+    m_frames(0),
+    m_inputOriginal(0) {
+}
+
+RGYVideoMetricCPU::~RGYVideoMetricCPU() {
+    close();
+}
+
+void RGYVideoMetricCPU::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log.get() == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_VPP)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    std::vector<TCHAR> buffer(len, 0);
+    _vstprintf_s(buffer.data(), len, format, args);
+    va_end(args);
+
+    m_log->write(log_level, RGY_LOGT_VPP, (tstring(_T("metric: ")) + buffer.data()).c_str());
+}
+
+RGY_ERR RGYVideoMetricCPU::init(const RGYVideoMetricCPUParam& prm, std::shared_ptr<RGYLog> log) {
+    m_log = log;
+    m_prm = prm;
+#if !ENABLE_AVSW_READER
+    AddMessage(RGY_LOG_ERROR, _T("video quality metric calculation requires libavcodec.\n"));
+    return RGY_ERR_UNSUPPORTED;
+#else
+    const auto chromafmt = RGY_CSP_CHROMA_FORMAT[m_prm.frameInfo.csp];
+    if (chromafmt != RGY_CHROMAFMT_YUV420 && chromafmt != RGY_CHROMAFMT_YUV422 && chromafmt != RGY_CHROMAFMT_YUV444) {
+        AddMessage(RGY_LOG_ERROR, _T("unsupported csp %s.\n"), RGY_CSP_NAMES[m_prm.frameInfo.csp]);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    if (m_prm.bitDepth < 8 || 12 < m_prm.bitDepth) {
+        AddMessage(RGY_LOG_ERROR, _T("unsupported bit depth %d.\n"), m_prm.bitDepth);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    m_func = get_metric_cpu_funcs();
+
+    m_planeWidth[0]  = m_prm.frameInfo.width;
+    m_planeHeight[0] = m_prm.frameInfo.height;
+    for (int i = 1; i < m_planes; i++) {
+        m_planeWidth[i]  = (chromafmt == RGY_CHROMAFMT_YUV444) ? m_planeWidth[0]  : m_planeWidth[0] >> 1;
+        m_planeHeight[i] = (chromafmt == RGY_CHROMAFMT_YUV420) ? m_planeHeight[0] >> 1 : m_planeHeight[0];
+    }
+    {
+        int elemSum = 0;
+        for (int i = 0; i < m_planes; i++) {
+            elemSum += m_planeWidth[i] * m_planeHeight[i];
+        }
+        for (int i = 0; i < m_planes; i++) {
+            m_planeCoef[i] = (double)(m_planeWidth[i] * m_planeHeight[i]) / elemSum;
+            AddMessage(RGY_LOG_DEBUG, _T("Plane coef : %f\n"), m_planeCoef[i]);
+        }
+    }
+    m_ssimTotalPlane.fill(0.0);
+    m_ssimTotal = 0.0;
+    m_psnrTotalPlane.fill(0.0);
+    m_psnrTotal = 0.0;
+    m_vifTotal.fill(0.0);
+    m_admTotal = 0.0;
+    m_motionTotal = 0.0;
+    m_frames = 0;
+
+    int threads = m_prm.threads;
+    if (threads <= 0) {
+        // エンコードはハードウェアで行うので、論理コアの半分程度を使用する
+        cpu_info_t cpu_info;
+        threads = (get_cpu_info(&cpu_info)) ? clamp(cpu_info.logical_cores / 2, 1, METRIC_THREADS_MAX) : 1;
+    }
+    m_prm.threads = threads;
+    m_workers.start(threads, m_prm.threadParam);
+    m_workersOrg.start(std::min(threads, METRIC_ORG_THREADS_MAX), m_prm.threadParam);
+    initStripes();
+
+    m_decFrame = std::make_unique<RGYMetricCPUFrame>(m_planeWidth, m_planeHeight);
+    if (m_prm.motion) {
+        for (auto& blur : m_blur) {
+            blur.resize((size_t)m_planeWidth[0] * m_planeHeight[0], 0);
+        }
+        m_blurIdx = 0;
+    }
+    if (m_prm.vif) {
+        for (int s = 0; s < VIF_SCALES; s++) {
+            m_vifWidth[s]  = (s == 0) ? m_planeWidth[0]  : (m_vifWidth[s-1]  + 1) >> 1;
+            m_vifHeight[s] = (s == 0) ? m_planeHeight[0] : (m_vifHeight[s-1] + 1) >> 1;
+            m_vifRef[s].resize((size_t)m_vifWidth[s] * m_vifHeight[s], 0.0f);
+            m_vifDis[s].resize((size_t)m_vifWidth[s] * m_vifHeight[s], 0.0f);
+            // 幅N, sigma=N/5のガウシアン
+            const int taps = VIF_FILTER_WIDTH[s];
+            const double sigma = taps / 5.0;
+            m_vifFilter[s].resize(taps);
+            double sum = 0.0;
+            for (int k = 0; k < taps; k++) {
+                const double d = k - taps / 2;
+                m_vifFilter[s][k] = (float)std::exp(-(d * d) / (2.0 * sigma * sigma));
+                sum += m_vifFilter[s][k];
+            }
+            for (auto& c : m_vifFilter[s]) {
+                c = (float)(c / sum);
+            }
+        }
+    }
+
+    auto err = initLogFile();
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    err = initDecoder();
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    m_thread = std::thread(&RGYVideoMetricCPU::thread_func, this);
+    AddMessage(RGY_LOG_DEBUG, _T("initialized %s.\n"), GetInputMessage().c_str());
+    return RGY_ERR_NONE;
+#endif //#if !ENABLE_AVSW_READER
+}
+
+void RGYVideoMetricCPU::initStripes() {
+    // 各stripeの高さがある程度確保できる範囲で、スレッド数の4倍程度に分割する
+    m_stripes = clamp(m_prm.threads * 4, 1, std::max(1, m_planeHeight[0] / METRIC_STRIPE_MIN_HEIGHT));
+    m_stripeResult.resize(m_stripes);
+    m_stripeWork.resize(m_stripes);
+    const int blocks = std::max(1, m_planeWidth[0] >> 2);
+    const int vifPad = VIF_FILTER_WIDTH[0] / 2;
+    for (auto& work : m_stripeWork) {
+        for (auto& sums : work.ssimSums) {
+            sums.resize((size_t)blocks * 4, 0);
+        }
+        if (m_prm.motion) {
+            work.blurTmp.resize(m_planeWidth[0], 0);
+        }
+        if (m_prm.vif) {
+            for (auto& line : work.vifLine) {
+                line.resize(m_planeWidth[0] + vifPad * 2, 0.0f);
+            }
+            for (auto& line : work.vifOut) {
+                line.resize(m_planeWidth[0], 0.0f);
+            }
+        }
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("%d threads (%d for copy), %d stripes, simd: %s.\n"), m_prm.threads, m_workersOrg.threads(), m_stripes, m_func.name);
+}
+
+RGY_ERR RGYVideoMetricCPU::initLogFile() {
+    if (m_prm.logFile.length() == 0) {
+        return RGY_ERR_NONE;
+    }
+    FILE *fp = nullptr;
+    if (_tfopen_s(&fp, m_prm.logFile.c_str(), _T("w")) != 0 || fp == nullptr) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to open log file \"%s\".\n"), m_prm.logFile.c_str());
+        return RGY_ERR_FILE_OPEN;
+    }
+    m_fpLog.reset(fp);
+    tstring header = _T("frame");
+    if (m_prm.metric.ssim) header += _T(",ssim_y,ssim_u,ssim_v,ssim_all");
+    if (m_prm.metric.psnr) header += _T(",psnr_y,psnr_u,psnr_v,psnr_avg");
+    if (m_prm.vif)         header += _T(",vif_scale0,vif_scale1,vif_scale2,vif_scale3");
+    if (m_prm.adm)         header += _T(",adm");
+    if (m_prm.motion)      header += _T(",motion");
+    fprintf(m_fpLog.get(), "%s\n", tchar_to_string(header).c_str());
+    fflush(m_fpLog.get());
+    AddMessage(RGY_LOG_DEBUG, _T("opened log file \"%s\".\n"), m_prm.logFile.c_str());
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYVideoMetricCPU::initDecoder() {
+#if ENABLE_AVSW_READER
+    const auto avcodecID = getAVCodecId(m_prm.codec);
+    const auto codec = avcodec_find_decoder(avcodecID);
+    if (codec == nullptr) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to find decoder for codec %s.\n"), CodecToStr(m_prm.codec).c_str());
+        return RGY_ERR_NULL_PTR;
+    }
+    m_codecCtx = std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>>(avcodec_alloc_context3(codec), RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+    // ヘッダはビットストリームに含まれるので、extradataは不要
+    m_codecCtx->thread_count = std::min(m_prm.threads, 16);
+    int ret = 0;
+    if (0 > (ret = avcodec_open2(m_codecCtx.get(), codec, nullptr))) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to open codec %s: %s.\n"), char_to_tstring(avcodec_get_name(avcodecID)).c_str(), qsv_av_err2str(ret).c_str());
+        return RGY_ERR_NULL_PTR;
+    }
+    m_decAVFrame = std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+    AddMessage(RGY_LOG_DEBUG, _T("Opened decoder for codec %s\n"), char_to_tstring(avcodec_get_name(avcodecID)).c_str());
+#endif //#if ENABLE_AVSW_READER
+    return RGY_ERR_NONE;
+}
+
+std::pair<int, int> RGYVideoMetricCPU::stripeRange(int height, int istripe, int align) const {
+    const int y0 = (int)((int64_t)height * istripe / m_stripes) / align * align;
+    const int y1 = (istripe == m_stripes - 1) ? height : (int)((int64_t)height * (istripe + 1) / m_stripes) / align * align;
+    return { y0, y1 };
+}
+
+RGY_ERR RGYVideoMetricCPU::addFrame(const RGYFrameInfo *frame) {
+    if (frame->width != m_planeWidth[0] || frame->height != m_planeHeight[0]) {
+        AddMessage(RGY_LOG_ERROR, _T("frame size %dx%d does not match %dx%d.\n"), frame->width, frame->height, m_planeWidth[0], m_planeHeight[0]);
+        return RGY_ERR_INVALID_VIDEO_PARAM;
+    }
+    std::unique_ptr<RGYMetricCPUFrame> copyFrame;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_err != RGY_ERR_NONE) {
+            return m_err;
+        }
+        if (m_unused.size() > 0) {
+            copyFrame = std::move(m_unused.front());
+            m_unused.pop_front();
+        }
+    }
+    if (!copyFrame) {
+        //待機中のフレームバッファがなければ新たに作成する
+        copyFrame = std::make_unique<RGYMetricCPUFrame>(m_planeWidth, m_planeHeight);
+    }
+    // パイプラインのスレッドを長く止めないよう、stripeに分割して並列にコピーする
+    m_workersOrg.run(m_stripes, [&](int istripe) { convertOrg(copyFrame.get(), frame, istripe); });
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_input.push_back(std::move(copyFrame));
+        m_inputOriginal++;
+    }
+    m_cond.notify_all();
+    AddMessage(RGY_LOG_TRACE, _T("m_inputOriginal = %d.\n"), m_inputOriginal);
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYVideoMetricCPU::addBitstream(const RGYBitstream *bitstream) {
+#if ENABLE_AVSW_READER
+    std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pkt;
+    if (bitstream) {
+        pkt = std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(av_packet_alloc(), RGYAVDeleter<AVPacket>(av_packet_free));
+        if (av_new_packet(pkt.get(), (int)bitstream->size()) < 0) {
+            return RGY_ERR_NULL_PTR;
+        }
+        memcpy(pkt->data, bitstream->data(), bitstream->size());
+    }
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (!pkt) {
+        //flushを意味する
+        m_flush = true;
+    } else {
+        // 比較が追いつかない場合はここで待機し、パイプライン全体を比較の速度に合わせる
+        m_cond.wait(lock, [&]() { return m_abort || m_err != RGY_ERR_NONE || (int)m_packets.size() < METRIC_MAX_QUEUED_PACKETS; });
+        m_packets.push_back(std::move(pkt));
+    }
+    const auto err = m_err;
+    lock.unlock();
+    m_cond.notify_all();
+    return err;
+#else
+    UNREFERENCED_PARAMETER(bitstream);
+    return RGY_ERR_UNSUPPORTED;
+#endif //#if ENABLE_AVSW_READER
+}
+
+void RGYVideoMetricCPU::thread_func() {
+    m_prm.threadParam.apply(GetCurrentThread());
+    AddMessage(RGY_LOG_DEBUG, _T("Set metric calculation thread param: %s.\n"), m_prm.threadParam.desc().c_str());
+    auto err = RGY_ERR_NONE;
+#if ENABLE_AVSW_READER
+    while (err == RGY_ERR_NONE) {
+        std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pkt;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond.wait(lock, [&]() { return m_abort || m_flush || m_packets.size() > 0; });
+            if (m_abort) {
+                err = RGY_ERR_ABORTED;
+                break;
+            }
+            if (m_packets.size() > 0) {
+                pkt = std::move(m_packets.front());
+                m_packets.pop_front();
+            }
+        }
+        m_cond.notify_all(); // キューに空きができたことを通知
+        // pktがnullptrの場合はflush
+        err = decodeAndCompare(pkt.get());
+        if (!pkt) {
+            if (err == RGY_ERR_MORE_DATA) {
+                err = RGY_ERR_NONE;
+            }
+            break;
+        }
+    }
+#endif //#if ENABLE_AVSW_READER
+    if (err != RGY_ERR_NONE && err != RGY_ERR_ABORTED) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_err = err;
+    }
+    m_cond.notify_all();
+    AddMessage(RGY_LOG_DEBUG, _T("Finishing metric calculation thread: %s.\n"), get_err_mes(err));
+}
+
+#if ENABLE_AVSW_READER
+RGY_ERR RGYVideoMetricCPU::decodeAndCompare(AVPacket *pkt) {
+    bool sent = false;
+    while (!sent) {
+        int ret = avcodec_send_packet(m_codecCtx.get(), pkt);
+        //AVERROR(EAGAIN) -> パケットを送る前に受け取る必要がある
+        if (ret == AVERROR_EOF || ret >= 0) {
+            sent = true;
+        } else if (ret != AVERROR(EAGAIN)) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to send packet to video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        for (;;) {
+            ret = avcodec_receive_frame(m_codecCtx.get(), m_decAVFrame.get());
+            if (ret == AVERROR(EAGAIN)) { //もっとパケットを送る必要がある
+                break;
+            }
+            if (ret == AVERROR_EOF) { //最後まで読み込んだ
+                return RGY_ERR_MORE_DATA;
+            }
+            if (ret < 0) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to receive frame from video decoder: %s.\n"), qsv_av_err2str(ret).c_str());
+                return RGY_ERR_UNDEFINED_BEHAVIOR;
+            }
+            auto err = compareFrame(m_decAVFrame.get());
+            av_frame_unref(m_decAVFrame.get());
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYVideoMetricCPU::compareFrame(const AVFrame *decFrame) {
+    const auto desc = av_pix_fmt_desc_get((AVPixelFormat)decFrame->format);
+    if (decFrame->width != m_planeWidth[0] || decFrame->height != m_planeHeight[0]
+        || desc == nullptr || desc->nb_components < 3 || (desc->flags & AV_PIX_FMT_FLAG_RGB) != 0
+        || (m_planeWidth[0]  >> desc->log2_chroma_w) != m_planeWidth[1]
+        || (m_planeHeight[0] >> desc->log2_chroma_h) != m_planeHeight[1]) {
+        AddMessage(RGY_LOG_ERROR, _T("unexpected decoded frame %dx%d %s.\n"), decFrame->width, decFrame->height,
+            (desc) ? char_to_tstring(desc->name).c_str() : _T("unknown"));
+        return RGY_ERR_INVALID_VIDEO_PARAM;
+    }
+    //比較用のキューの先頭に積まれているものから順次比較していく
+    std::unique_ptr<RGYMetricCPUFrame> orgFrame;
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cond.wait(lock, [&]() { return m_abort || m_input.size() > 0; });
+        if (m_abort) {
+            return RGY_ERR_ABORTED;
+        }
+        orgFrame = std::move(m_input.front());
+        m_input.pop_front();
+    }
+    const RGYMetricCPUFrame *org = orgFrame.get();
+    for (auto& result : m_stripeResult) {
+        result.clear();
+    }
+    // stripeごとにデコード結果を変換し、各指標を計算する
+    m_workers.run(m_stripes, [&](int istripe) { convertDec(decFrame, istripe); });
+    if (m_prm.vif) {
+        const float scale = 1.0f / (float)(1 << (m_prm.bitDepth - 8));
+        m_workers.run(m_stripes, [&](int istripe) {
+            const auto [y0, y1] = stripeRange(m_planeHeight[0], istripe, 1);
+            for (int y = y0; y < y1; y++) {
+                const uint16_t *ref = org->line(0, y);
+                const uint16_t *dis = m_decFrame->line(0, y);
+                float *dstRef = m_vifRef[0].data() + (size_t)y * m_vifWidth[0];
+                float *dstDis = m_vifDis[0].data() + (size_t)y * m_vifWidth[0];
+                for (int x = 0; x < m_vifWidth[0]; x++) {
+                    dstRef[x] = ref[x] * scale;
+                    dstDis[x] = dis[x] * scale;
+                }
+            }
+        });
+    }
+    m_workers.run(m_stripes, [&](int istripe) { calcStripe(org, istripe); });
+    if (m_prm.vif) {
+        for (int s = 1; s < VIF_SCALES; s++) {
+            m_workers.run(m_stripes, [&](int istripe) { downsampleVif(s, istripe); });
+            m_workers.run(m_stripes, [&](int istripe) { calcVifScale(s, istripe); });
+        }
+    }
+
+    // stripeごとの結果を順に集計する (スレッドの処理順によらず結果が一定になるようにする)
+    RGYMetricCPUStripeResult total;
+    total.clear();
+    for (const auto& result : m_stripeResult) {
+        for (int i = 0; i < m_planes; i++) {
+            total.ssim[i] += result.ssim[i];
+            total.ssd[i] += result.ssd[i];
+        }
+        total.sad += result.sad;
+        for (int s = 0; s < VIF_SCALES; s++) {
+            total.vifNum[s] += result.vifNum[s];
+            total.vifDen[s] += result.vifDen[s];
+        }
+        total.admNum += result.admNum;
+        total.admDen += result.admDen;
+    }
+    std::array<double, 3> ssim = { 0.0 };
+    std::array<double, 3> mse = { 0.0 };
+    std::array<double, 4> vif = { 0.0 };
+    double adm = 0.0, motion = 0.0;
+    if (m_prm.metric.ssim) {
+        double ssimv = 0.0;
+        for (int i = 0; i < m_planes; i++) {
+            const int windows = std::max(1, ((m_planeWidth[i] >> 2) - 1) * ((m_planeHeight[i] >> 2) - 1));
+            ssim[i] = total.ssim[i] / windows;
+            m_ssimTotalPlane[i] += ssim[i];
+            ssimv += ssim[i] * m_planeCoef[i];
+        }
+        m_ssimTotal += ssimv;
+    }
+    if (m_prm.metric.psnr) {
+        double psnrv = 0.0;
+        for (int i = 0; i < m_planes; i++) {
+            mse[i] = total.ssd[i] / (double)(m_planeWidth[i] * m_planeHeight[i]);
+            m_psnrTotalPlane[i] += mse[i];
+            psnrv += mse[i] * m_planeCoef[i];
+        }
+        m_psnrTotal += psnrv;
+    }
+    if (m_prm.vif) {
+        for (int s = 0; s < VIF_SCALES; s++) {
+            vif[s] = (total.vifDen[s] > 0.0) ? total.vifNum[s] / total.vifDen[s] : 1.0;
+            m_vifTotal[s] += vif[s];
+        }
+    }
+    if (m_prm.adm) {
+        adm = (total.admDen > 0.0) ? std::cbrt(total.admNum / total.admDen) : 1.0;
+        m_admTotal += adm;
+    }
+    if (m_prm.motion) {
+        // 最初のフレームは0、8bit相当の値に換算する
+        motion = total.sad / (double)(m_planeWidth[0] * m_planeHeight[0]) / (double)(1 << (m_prm.bitDepth - 8));
+        m_motionTotal += motion;
+        m_blurIdx ^= 1;
+    }
+    writeLog(m_frames, ssim, mse, vif, adm, motion);
+    m_frames++;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_unused.push_back(std::move(orgFrame));
+    }
+    return RGY_ERR_NONE;
+}
+
+void RGYVideoMetricCPU::convertDec(const AVFrame *src, int istripe) {
+    const auto desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    for (int i = 0; i < m_planes; i++) {
+        const auto& comp = desc->comp[i];
+        const auto [y0, y1] = stripeRange(m_planeHeight[i], istripe, 1);
+        const int shift = comp.depth - m_prm.bitDepth;
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *line = src->data[comp.plane] + (size_t)y * src->linesize[comp.plane] + comp.offset;
+            if (comp.depth > 8) {
+                copy_line_to_u16<uint16_t>(m_decFrame->line(i, y), line, m_planeWidth[i], comp.step, comp.shift, shift);
+            } else {
+                copy_line_to_u16<uint8_t>(m_decFrame->line(i, y), line, m_planeWidth[i], comp.step, comp.shift, shift);
+            }
+        }
+    }
+}
+#endif //#if ENABLE_AVSW_READER
+
+void RGYVideoMetricCPU::convertOrg(RGYMetricCPUFrame *dst, const RGYFrameInfo *src, int istripe) {
+    // P010などは上位詰め、yv12(10bit)などは下位詰めなので、RGY_CSP_BIT_DEPTHから出力のbit深度へのシフト量を決める
+    const bool u16 = RGY_CSP_BIT_DEPTH[src->csp] > 8;
+    const int shift = RGY_CSP_BIT_DEPTH[src->csp] - m_prm.bitDepth;
+    const bool interleaved = src->csp == RGY_CSP_NV12 || src->csp == RGY_CSP_P010 || src->csp == RGY_CSP_NV16 || src->csp == RGY_CSP_P210;
+    const int pixBytes = (u16) ? 2 : 1;
+    for (int i = 0; i < m_planes; i++) {
+        if (interleaved && i == 2) {
+            continue; // i == 1 でU, Vともに処理済み
+        }
+        const auto plane = getPlane(src, (RGY_PLANE)i);
+        const auto [y0, y1] = stripeRange(m_planeHeight[i], istripe, 1);
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *line = plane.ptr[0] + (size_t)y * plane.pitch[0];
+            if (interleaved && i == 1) {
+                if (u16) {
+                    split_line_to_u16<uint16_t>(dst->line(1, y), dst->line(2, y), line, m_planeWidth[1], shift);
+                } else {
+                    split_line_to_u16<uint8_t>(dst->line(1, y), dst->line(2, y), line, m_planeWidth[1], shift);
+                }
+            } else if (u16) {
+                copy_line_to_u16<uint16_t>(dst->line(i, y), line, m_planeWidth[i], pixBytes, 0, shift);
+            } else {
+                copy_line_to_u16<uint8_t>(dst->line(i, y), line, m_planeWidth[i], pixBytes, 0, shift);
+            }
+        }
+    }
+}
+
+void RGYVideoMetricCPU::calcStripe(const RGYMetricCPUFrame *org, int istripe) {
+    auto& result = m_stripeResult[istripe];
+    if (m_prm.metric.ssim) {
+        for (int i = 0; i < m_planes; i++) {
+            calcSsimPlane(org, i, istripe);
+        }
+    }
+    if (m_prm.metric.psnr) {
+        for (int i = 0; i < m_planes; i++) {
+            const auto [y0, y1] = stripeRange(m_planeHeight[i], istripe, 1);
+            uint64_t ssd = 0;
+            for (int y = y0; y < y1; y++) {
+                ssd += m_func.ssd(org->line(i, y), m_decFrame->line(i, y), m_planeWidth[i]);
+            }
+            result.ssd[i] = ssd;
+        }
+    }
+    if (m_prm.motion) {
+        calcMotion(org, istripe);
+    }
+    if (m_prm.adm) {
+        calcAdm(org, istripe);
+    }
+    if (m_prm.vif) {
+        calcVifScale(0, istripe);
+    }
+}
+
+void RGYVideoMetricCPU::calcSsimPlane(const RGYMetricCPUFrame *org, int iplane, int istripe) {
+    const int blocksX = m_planeWidth[iplane] >> 2;
+    const int blocksY = m_planeHeight[iplane] >> 2;
+    if (blocksX < 2 || blocksY < 2) {
+        return;
+    }
+    // 担当する窓の行 [b0, b1) (窓の行byはブロックの行by, by+1を使用する)
+    const auto [y0, y1] = stripeRange(m_planeHeight[iplane], istripe, 4);
+    const int b0 = y0 >> 2;
+    const int b1 = std::min(y1 >> 2, blocksY - 1);
+    if (b0 >= b1) {
+        return;
+    }
+    const int maxval = (1 << m_prm.bitDepth) - 1;
+    const double c1 = .01 * .01 * maxval * maxval * 64;
+    const double c2 = .03 * .03 * maxval * maxval * 64 * 63;
+    auto& work = m_stripeWork[istripe];
+    int32_t (*sum0)[4] = (int32_t (*)[4])work.ssimSums[0].data();
+    int32_t (*sum1)[4] = (int32_t (*)[4])work.ssimSums[1].data();
+    m_func.ssim4x4(org->line(iplane, b0 * 4), org->pitch[iplane], m_decFrame->line(iplane, b0 * 4), m_decFrame->pitch[iplane], blocksX, sum0);
+    double ssim = 0.0;
+    for (int by = b0; by < b1; by++) {
+        m_func.ssim4x4(org->line(iplane, (by + 1) * 4), org->pitch[iplane], m_decFrame->line(iplane, (by + 1) * 4), m_decFrame->pitch[iplane], blocksX, sum1);
+        double ssimLine = 0.0;
+        for (int bx = 0; bx < blocksX - 1; bx++) {
+            ssimLine += ssim_end1(
+                (double)sum0[bx][0] + sum0[bx+1][0] + sum1[bx][0] + sum1[bx+1][0],
+                (double)sum0[bx][1] + sum0[bx+1][1] + sum1[bx][1] + sum1[bx+1][1],
+                (double)sum0[bx][2] + sum0[bx+1][2] + sum1[bx][2] + sum1[bx+1][2],
+                (double)sum0[bx][3] + sum0[bx+1][3] + sum1[bx][3] + sum1[bx+1][3],
+                c1, c2);
+        }
+        ssim += ssimLine;
+        std::swap(sum0, sum1);
+    }
+    m_stripeResult[istripe].ssim[iplane] = ssim;
+}
+
+void RGYVideoMetricCPU::calcMotion(const RGYMetricCPUFrame *org, int istripe) {
+    // 輝度を [1 4 6 4 1] でぼかし、直前のフレームとのSADを求める
+    const int width = m_planeWidth[0];
+    const int height = m_planeHeight[0];
+    const auto [y0, y1] = stripeRange(height, istripe, 1);
+    uint32_t *tmp = m_stripeWork[istripe].blurTmp.data();
+    uint16_t *blurCur = m_blur[m_blurIdx].data();
+    const uint16_t *blurPrev = m_blur[m_blurIdx ^ 1].data();
+    uint64_t sad = 0;
+    for (int y = y0; y < y1; y++) {
+        const uint16_t *r0 = org->line(0, clamp(y - 2, 0, height - 1));
+        const uint16_t *r1 = org->line(0, clamp(y - 1, 0, height - 1));
+        const uint16_t *r2 = org->line(0, y);
+        const uint16_t *r3 = org->line(0, clamp(y + 1, 0, height - 1));
+        const uint16_t *r4 = org->line(0, clamp(y + 2, 0, height - 1));
+        for (int x = 0; x < width; x++) {
+            tmp[x] = r0[x] + 4 * r1[x] + 6 * r2[x] + 4 * r3[x] + r4[x];
+        }
+        uint16_t *dst = blurCur + (size_t)y * width;
+        auto blurH = [tmp, width](int x) {
+            const uint32_t sum = tmp[clamp(x - 2, 0, width - 1)] + 4 * tmp[clamp(x - 1, 0, width - 1)] + 6 * tmp[x]
+                + 4 * tmp[clamp(x + 1, 0, width - 1)] + tmp[clamp(x + 2, 0, width - 1)];
+            return (uint16_t)((sum + 128) >> 8);
+        };
+        // 左右端のみ範囲外の参照を考慮する
+        const int xEdge = std::min(2, width);
+        for (int x = 0; x < xEdge; x++) {
+            dst[x] = blurH(x);
+        }
+        for (int x = xEdge; x < width - 2; x++) {
+            dst[x] = (uint16_t)((tmp[x - 2] + 4 * tmp[x - 1] + 6 * tmp[x] + 4 * tmp[x + 1] + tmp[x + 2] + 128) >> 8);
+        }
+        for (int x = std::max(xEdge, width - 2); x < width; x++) {
+            dst[x] = blurH(x);
+        }
+        if (m_frames > 0) {
+            sad += m_func.sad(dst, blurPrev + (size_t)y * width, width);
+        }
+    }
+    m_stripeResult[istripe].sad = sad;
+}
+
+void RGYVideoMetricCPU::calcAdm(const RGYMetricCPUFrame *org, int istripe) {
+    // 1段のHaar DWTの詳細成分について、オリジナルから復元可能な成分の割合を求める
+    // (VMAFのADMのdecoupleのみを行う簡易版で、CSFやコントラストマスキングは省略している)
+    const int width = m_planeWidth[0] & ~1;
+    const auto [y0, y1] = stripeRange(m_planeHeight[0] & ~1, istripe, 2);
+    const float scale = 1.0f / (float)(1 << (m_prm.bitDepth - 8));
+    auto restore = [](float o, float t) {
+        return (o == 0.0f) ? 0.0f : clamp(t / o, 0.0f, 1.0f) * o;
+    };
+    auto cube = [](float v) { v = std::abs(v); return v * v * v; };
+    double num = 0.0, den = 0.0;
+    for (int y = y0; y < y1; y += 2) {
+        const uint16_t *o0 = org->line(0, y);
+        const uint16_t *o1 = org->line(0, y + 1);
+        const uint16_t *t0 = m_decFrame->line(0, y);
+        const uint16_t *t1 = m_decFrame->line(0, y + 1);
+        float numLine = 0.0f, denLine = 0.0f;
+        for (int x = 0; x < width; x += 2) {
+            const float oa = o0[x] * scale, ob = o0[x+1] * scale, oc = o1[x] * scale, od = o1[x+1] * scale;
+            const float ta = t0[x] * scale, tb = t0[x+1] * scale, tc = t1[x] * scale, td = t1[x+1] * scale;
+            const float oh = (oa - ob + oc - od) * 0.5f, ov = (oa + ob - oc - od) * 0.5f, odg = (oa - ob - oc + od) * 0.5f;
+            const float th = (ta - tb + tc - td) * 0.5f, tv = (ta + tb - tc - td) * 0.5f, tdg = (ta - tb - tc + td) * 0.5f;
+            // 向きがほぼ同じ場合は、すべて復元可能とみなす
+            const float otDp = oh * th + ov * tv;
+            const bool angleFlag = otDp >= 0.0f && otDp * otDp >= ADM_COS_1DEG_SQ * (oh * oh + ov * ov) * (th * th + tv * tv);
+            const float rh = (angleFlag) ? th : restore(oh, th);
+            const float rv = (angleFlag) ? tv : restore(ov, tv);
+            const float rd = (angleFlag) ? tdg : restore(odg, tdg);
+            numLine += cube(rh) + cube(rv) + cube(rd);
+            denLine += cube(oh) + cube(ov) + cube(odg);
+        }
+        num += numLine;
+        den += denLine;
+    }
+    m_stripeResult[istripe].admNum = num;
+    m_stripeResult[istripe].admDen = den;
+}
+
+void RGYVideoMetricCPU::calcVifScale(int scale, int istripe) {
+    const int width = m_vifWidth[scale];
+    const int height = m_vifHeight[scale];
+    const float *ref = m_vifRef[scale].data();
+    const float *dis = m_vifDis[scale].data();
+    const auto& filter = m_vifFilter[scale];
+    const int taps = (int)filter.size();
+    const int r = taps / 2;
+    auto& work = m_stripeWork[istripe];
+    float *line[5], *out[5];
+    for (int i = 0; i < 5; i++) {
+        line[i] = work.vifLine[i].data() + r;
+        out[i] = work.vifOut[i].data();
+    }
+    const float *rowRef[VIF_FILTER_WIDTH_MAX], *rowDis[VIF_FILTER_WIDTH_MAX];
+    const auto [y0, y1] = stripeRange(height, istripe, 1);
+    double num = 0.0, den = 0.0;
+    for (int y = y0; y < y1; y++) {
+        // 縦方向: mu1, mu2, ref^2, dis^2, ref*dis
+        for (int k = 0; k < taps; k++) {
+            const int yy = mirror_idx(y - r + k, height);
+            rowRef[k] = ref + (size_t)yy * width;
+            rowDis[k] = dis + (size_t)yy * width;
+        }
+        m_func.vifVFilter(rowRef, rowDis, filter.data(), taps, width, line);
+        // 左右をミラーでパディングして横方向
+        for (int i = 0; i < 5; i++) {
+            for (int j = 1; j <= r; j++) {
+                line[i][-j] = line[i][mirror_idx(-j, width)];
+                line[i][width - 1 + j] = line[i][mirror_idx(width - 1 + j, width)];
+            }
+            m_func.vifHFilter(line[i] - r, filter.data(), taps, width, out[i]);
+        }
+        float numLine = 0.0f, denLine = 0.0f;
+        for (int x = 0; x < width; x++) {
+            const float mu1 = out[0][x], mu2 = out[1][x];
+            float sigma1_sq = std::max(out[2][x] - mu1 * mu1, 0.0f);
+            float sigma2_sq = std::max(out[3][x] - mu2 * mu2, 0.0f);
+            const float sigma12 = out[4][x] - mu1 * mu2;
+            float g = sigma12 / (sigma1_sq + VIF_EPS);
+            float sv_sq = sigma2_sq - g * sigma12;
+            if (sigma1_sq < VIF_EPS) {
+                g = 0.0f;
+                sv_sq = sigma2_sq;
+                sigma1_sq = 0.0f;
+            }
+            if (sigma2_sq < VIF_EPS) {
+                g = 0.0f;
+                sv_sq = 0.0f;
+            }
+            if (g < 0.0f) {
+                sv_sq = sigma2_sq;
+                g = 0.0f;
+            }
+            sv_sq = std::max(sv_sq, VIF_EPS);
+            g = std::min(g, VIF_GAIN_LIMIT);
+            numLine += std::log2(1.0f + (g * g * sigma1_sq) / (sv_sq + VIF_SIGMA_NSQ));
+            denLine += std::log2(1.0f + sigma1_sq / VIF_SIGMA_NSQ);
+        }
+        num += numLine;
+        den += denLine;
+    }
+    m_stripeResult[istripe].vifNum[scale] = num;
+    m_stripeResult[istripe].vifDen[scale] = den;
+}
+
+void RGYVideoMetricCPU::downsampleVif(int scale, int istripe) {
+    // scale-1の画像をscaleのフィルタでぼかして1/2に間引く
+    const int srcWidth = m_vifWidth[scale - 1];
+    const int srcHeight = m_vifHeight[scale - 1];
+    const int dstWidth = m_vifWidth[scale];
+    const auto& filter = m_vifFilter[scale];
+    const int taps = (int)filter.size();
+    const int r = taps / 2;
+    auto& work = m_stripeWork[istripe];
+    const auto [y0, y1] = stripeRange(m_vifHeight[scale], istripe, 1);
+    for (int iimg = 0; iimg < 2; iimg++) {
+        const float *src = (iimg == 0) ? m_vifRef[scale - 1].data() : m_vifDis[scale - 1].data();
+        float *dst = (iimg == 0) ? m_vifRef[scale].data() : m_vifDis[scale].data();
+        float *line = work.vifLine[iimg].data() + r;
+        for (int y = y0; y < y1; y++) {
+            std::fill(line, line + srcWidth, 0.0f);
+            for (int k = 0; k < taps; k++) {
+                const float c = filter[k];
+                const float *ptr = src + (size_t)mirror_idx(y * 2 - r + k, srcHeight) * srcWidth;
+                for (int x = 0; x < srcWidth; x++) {
+                    line[x] += c * ptr[x];
+                }
+            }
+            for (int j = 1; j <= r; j++) {
+                line[-j] = line[mirror_idx(-j, srcWidth)];
+                line[srcWidth - 1 + j] = line[mirror_idx(srcWidth - 1 + j, srcWidth)];
+            }
+            float *dstLine = dst + (size_t)y * dstWidth;
+            for (int x = 0; x < dstWidth; x++) {
+                float sum = 0.0f;
+                for (int k = 0; k < taps; k++) {
+                    sum += filter[k] * line[x * 2 - r + k];
+                }
+                dstLine[x] = sum;
+            }
+        }
+    }
+}
+
+void RGYVideoMetricCPU::writeLog(int frame, const std::array<double, 3>& ssim, const std::array<double, 3>& mse, const std::array<double, 4>& vif, double adm, double motion) {
+    if (!m_fpLog) {
+        return;
+    }
+    const int maxval = (1 << m_prm.bitDepth) - 1;
+    auto psnr = [maxval](double mse) {
+        return (mse > 0.0) ? std::min(10.0 * log10((double)maxval * maxval / mse), 100.0) : 100.0;
+    };
+    tstring str = strsprintf(_T("%d"), frame);
+    if (m_prm.metric.ssim) {
+        double ssimv = 0.0;
+        for (int i = 0; i < m_planes; i++) {
+            str += strsprintf(_T(",%.6f"), ssim[i]);
+            ssimv += ssim[i] * m_planeCoef[i];
+        }
+        str += strsprintf(_T(",%.6f"), ssimv);
+    }
+    if (m_prm.metric.psnr) {
+        double msev = 0.0;
+        for (int i = 0; i < m_planes; i++) {
+            str += strsprintf(_T(",%.4f"), psnr(mse[i]));
+            msev += mse[i] * m_planeCoef[i];
+        }
+        str += strsprintf(_T(",%.4f"), psnr(msev));
+    }
+    if (m_prm.vif) {
+        for (int s = 0; s < VIF_SCALES; s++) {
+            str += strsprintf(_T(",%.6f"), vif[s]);
+        }
+    }
+    if (m_prm.adm) {
+        str += strsprintf(_T(",%.6f"), adm);
+    }
+    if (m_prm.motion) {
+        str += strsprintf(_T(",%.4f"), motion);
+    }
+    // 途中経過を外部から確認できるよう、フレームごとにflushする
+    fprintf(m_fpLog.get(), "%s\n", tchar_to_string(str).c_str());
+    fflush(m_fpLog.get());
+}
+
+void RGYVideoMetricCPU::showResult() {
+    // 以降ビットストリームは来ないので、残りを処理して比較スレッドの終了を待つ
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_flush = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable()) {
+        AddMessage(RGY_LOG_DEBUG, _T("Waiting for metric calculation thread to finish.\n"));
+        m_thread.join();
+    }
+    if (m_frames == 0) {
+        AddMessage(RGY_LOG_WARN, _T("no frames were compared.\n"));
+        return;
+    }
+    if (m_prm.metric.ssim) {
+        auto str = strsprintf(_T("\nSSIM YUV:"));
+        for (int i = 0; i < m_planes; i++) {
+            str += strsprintf(_T(" %f (%f),"), m_ssimTotalPlane[i] / m_frames, ssim_db(m_ssimTotalPlane[i], (double)m_frames));
+        }
+        str += strsprintf(_T(" All: %f (%f), (Frames: %d)\n"), m_ssimTotal / m_frames, ssim_db(m_ssimTotal, (double)m_frames), m_frames);
+        AddMessage(RGY_LOG_INFO, _T("%s\n"), str.c_str());
+    }
+    if (m_prm.metric.psnr) {
+        auto str = strsprintf(_T("\nPSNR YUV:"));
+        for (int i = 0; i < m_planes; i++) {
+            str += strsprintf(_T(" %f,"), get_psnr(m_psnrTotalPlane[i], m_frames, (1 << m_prm.bitDepth) - 1));
+        }
+        str += strsprintf(_T(" Avg: %f, (Frames: %d)\n"), get_psnr(m_psnrTotal, m_frames, (1 << m_prm.bitDepth) - 1), m_frames);
+        AddMessage(RGY_LOG_INFO, _T("%s\n"), str.c_str());
+    }
+    if (m_prm.vif || m_prm.adm || m_prm.motion) {
+        auto str = strsprintf(_T("\nVMAF features:"));
+        if (m_prm.vif) {
+            str += _T(" VIF");
+            for (int s = 0; s < VIF_SCALES; s++) {
+                str += strsprintf(_T(" %f"), m_vifTotal[s] / m_frames);
+            }
+            str += _T(",");
+        }
+        if (m_prm.adm) {
+            str += strsprintf(_T(" ADM %f,"), m_admTotal / m_frames);
+        }
+        if (m_prm.motion) {
+            str += strsprintf(_T(" Motion %f,"), m_motionTotal / m_frames);
+        }
+        str += strsprintf(_T(" (Frames: %d)\n"), m_frames);
+        AddMessage(RGY_LOG_INFO, _T("%s\n"), str.c_str());
+    }
+}
+
+tstring RGYVideoMetricCPU::GetInputMessage() const {
+    return strsprintf(_T("metric: %s(cpu %s, %d threads)"), m_prm.print().c_str(), m_func.name, m_prm.threads);
+}
+
+void RGYVideoMetricCPU::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_abort = true;
+    }
+    m_cond.notify_all();
+    if (m_thread.joinable()) {
+        AddMessage(RGY_LOG_DEBUG, _T("Waiting for metric calculation thread to finish.\n"));
+        m_thread.join();
+    }
+    m_workers.stop();
+    m_workersOrg.stop();
+    m_input.clear();
+    m_unused.clear();
+#if ENABLE_AVSW_READER
+    m_packets.clear();
+    m_decAVFrame.reset();
+    m_codecCtx.reset();
+#endif //#if ENABLE_AVSW_READER
+    m_fpLog.reset();
+}
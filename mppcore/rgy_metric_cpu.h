@@ -0,0 +1,255 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_METRIC_CPU_H__
+#define __RGY_METRIC_CPU_H__
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "rgy_osdep.h"
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_prm.h"
+#include "rgy_frame_info.h"
+#include "rgy_thread_affinity.h"
+#include "rgy_util.h"
+#include "rgy_avutil.h"
+
+struct RGYBitstream;
+
+// CPUでのSSIM/PSNR/VMAF系の指標の計算
+// 画素はすべてplanarのuint16_t (bit深度 <= 12) で扱う
+// pitchは要素数単位
+
+// 1行分の差の二乗和
+uint64_t rgy_metric_ssd_c(const uint16_t *a, const uint16_t *b, int width);
+uint64_t rgy_metric_ssd_avx2(const uint16_t *a, const uint16_t *b, int width);
+uint64_t rgy_metric_ssd_neon(const uint16_t *a, const uint16_t *b, int width);
+// 1行分の差の絶対値の和
+uint64_t rgy_metric_sad_c(const uint16_t *a, const uint16_t *b, int width);
+uint64_t rgy_metric_sad_avx2(const uint16_t *a, const uint16_t *b, int width);
+uint64_t rgy_metric_sad_neon(const uint16_t *a, const uint16_t *b, int width);
+// 4x4ブロックごとの s1(=Σa), s2(=Σb), ss(=Σa^2+Σb^2), s12(=Σab) を横にblocks個分計算する
+void rgy_metric_ssim4x4_c(const uint16_t *a, int pitchA, const uint16_t *b, int pitchB, int blocks, int32_t (*sums)[4]);
+void rgy_metric_ssim4x4_avx2(const uint16_t *a, int pitchA, const uint16_t *b, int pitchB, int blocks, int32_t (*sums)[4]);
+void rgy_metric_ssim4x4_neon(const uint16_t *a, int pitchA, const uint16_t *b, int pitchB, int blocks, int32_t (*sums)[4]);
+// VIFの縦方向のフィルタ、ref[k], dis[k] (k < taps) の行から mu1, mu2, ref^2, dis^2, ref*dis の5つを1行分計算してout[0-4]に出力する
+void rgy_metric_vif_vfilter_c(const float *const *ref, const float *const *dis, const float *filter, int taps, int width, float *const *out);
+void rgy_metric_vif_vfilter_avx2(const float *const *ref, const float *const *dis, const float *filter, int taps, int width, float *const *out);
+void rgy_metric_vif_vfilter_neon(const float *const *ref, const float *const *dis, const float *filter, int taps, int width, float *const *out);
+// VIFの横方向のフィルタ、dst[x] = Σ filter[k] * src[x+k] (srcは左端のパディングの先頭を指す)
+void rgy_metric_vif_hfilter_c(const float *src, const float *filter, int taps, int width, float *dst);
+void rgy_metric_vif_hfilter_avx2(const float *src, const float *filter, int taps, int width, float *dst);
+void rgy_metric_vif_hfilter_neon(const float *src, const float *filter, int taps, int width, float *dst);
+
+struct RGYMetricCPUFuncs {
+    decltype(rgy_metric_ssd_c) *ssd;
+    decltype(rgy_metric_sad_c) *sad;
+    decltype(rgy_metric_ssim4x4_c) *ssim4x4;
+    decltype(rgy_metric_vif_vfilter_c) *vifVFilter;
+    decltype(rgy_metric_vif_hfilter_c) *vifHFilter;
+    const TCHAR *name;
+};
+
+RGYMetricCPUFuncs get_metric_cpu_funcs();
+
+struct RGYVideoMetricCPUParam {
+    RGYVideoQualityMetric metric; // ssim, psnr
+    bool vif;              // VMAFのVIF (4 scale)
+    bool adm;              // VMAFのADMの簡易版
+    bool motion;           // VMAFのmotion
+    int threads;           // 計算スレッド数 (0で自動)
+    tstring logFile;       // フレームごとの結果の出力先
+    RGY_CODEC codec;       // 出力のコーデック (比較用のデコードに使用)
+    RGYFrameInfo frameInfo; // 比較するフレームの情報 (解像度, 色空間)
+    int bitDepth;          // 出力のbit深度
+    RGYParamThread threadParam;
+
+    RGYVideoMetricCPUParam();
+    bool enabled() const;
+    tstring print() const;
+};
+
+// 1フレームを横の帯(stripe)に分割して並列処理するためのスレッドプール
+class RGYMetricCPUWorkers {
+public:
+    RGYMetricCPUWorkers();
+    ~RGYMetricCPUWorkers();
+    void start(int threads, const RGYParamThread& threadParam);
+    void stop();
+    // func(0) ... func(jobs-1) を実行し、すべて終了するまで待機する (呼び出し元のスレッドも処理に参加する)
+    void run(int jobs, const std::function<void(int)>& func);
+    int threads() const { return (int)m_threads.size() + 1; }
+protected:
+    void worker(RGYParamThread threadParam);
+    bool runJob(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mtx;
+    std::condition_variable m_condStart;
+    std::condition_variable m_condFin;
+    const std::function<void(int)> *m_func;
+    int m_jobs;
+    int m_nextJob;
+    int m_finJobs;
+    uint64_t m_generation;
+    bool m_abort;
+};
+
+// planar uint16_tのフレーム
+struct RGYMetricCPUFrame {
+    std::array<std::vector<uint16_t>, 3> buf;
+    std::array<int, 3> width;
+    std::array<int, 3> height;
+    std::array<int, 3> pitch;
+
+    RGYMetricCPUFrame(const std::array<int, 3>& width, const std::array<int, 3>& height);
+    uint16_t *line(int iplane, int y) { return buf[iplane].data() + (size_t)y * pitch[iplane]; }
+    const uint16_t *line(int iplane, int y) const { return buf[iplane].data() + (size_t)y * pitch[iplane]; }
+};
+
+// stripeごとの途中結果
+struct RGYMetricCPUStripeResult {
+    std::array<double, 3> ssim;
+    std::array<uint64_t, 3> ssd;
+    uint64_t sad;
+    std::array<double, 4> vifNum;
+    std::array<double, 4> vifDen;
+    double admNum;
+    double admDen;
+
+    void clear();
+};
+
+// stripeごとの作業領域
+struct RGYMetricCPUStripeWork {
+    std::array<std::vector<int32_t>, 2> ssimSums; // 4x4ブロックの集計 (2行分)
+    std::vector<uint32_t> blurTmp;                // motion用の縦方向のぼかし結果
+    std::array<std::vector<float>, 5> vifLine;    // VIF用の縦方向のフィルタ結果 (左右にパディング付き)
+    std::array<std::vector<float>, 5> vifOut;     // VIF用の横方向のフィルタ結果
+};
+
+class RGYVideoMetricCPU {
+public:
+    RGYVideoMetricCPU();
+    virtual ~RGYVideoMetricCPU();
+    RGY_ERR init(const RGYVideoMetricCPUParam& prm, std::shared_ptr<RGYLog> log);
+    // エンコーダに渡すフレームを比較元として登録する (CPUからアクセス可能なフレームであること)
+    RGY_ERR addFrame(const RGYFrameInfo *frame);
+    // エンコード結果を登録する、nullptrでflush
+    RGY_ERR addBitstream(const RGYBitstream *bitstream);
+    void showResult();
+    tstring GetInputMessage() const;
+    void close();
+protected:
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+    RGY_ERR initDecoder();
+    RGY_ERR initLogFile();
+    void initStripes();
+    void thread_func();
+#if ENABLE_AVSW_READER
+    RGY_ERR decodeAndCompare(AVPacket *pkt);
+    RGY_ERR compareFrame(const AVFrame *decFrame);
+    void convertDec(const AVFrame *src, int istripe);
+#endif //#if ENABLE_AVSW_READER
+    void convertOrg(RGYMetricCPUFrame *dst, const RGYFrameInfo *src, int istripe);
+    void calcStripe(const RGYMetricCPUFrame *org, int istripe);
+    void calcSsimPlane(const RGYMetricCPUFrame *org, int iplane, int istripe);
+    void calcMotion(const RGYMetricCPUFrame *org, int istripe);
+    void calcAdm(const RGYMetricCPUFrame *org, int istripe);
+    void calcVifScale(int scale, int istripe);
+    void downsampleVif(int scale, int istripe);
+    void writeLog(int frame, const std::array<double, 3>& ssim, const std::array<double, 3>& mse, const std::array<double, 4>& vif, double adm, double motion);
+    std::pair<int, int> stripeRange(int height, int istripe, int align) const;
+
+    std::shared_ptr<RGYLog> m_log;
+    RGYVideoMetricCPUParam m_prm;
+    RGYMetricCPUFuncs m_func;
+    RGYMetricCPUWorkers m_workers;    // 比較用 (比較スレッドから使用)
+    RGYMetricCPUWorkers m_workersOrg; // addFrameでのオリジナルフレームのコピー用 (パイプラインのスレッドから使用)
+    int m_stripes;
+    std::array<int, 3> m_planeWidth;
+    std::array<int, 3> m_planeHeight;
+    int m_planes;
+    std::array<double, 3> m_planeCoef; // 評価結果に関する YUVの重み
+    std::vector<RGYMetricCPUStripeResult> m_stripeResult;
+    std::vector<RGYMetricCPUStripeWork> m_stripeWork;
+
+    // デコーダ関連
+#if ENABLE_AVSW_READER
+    std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>> m_codecCtx;
+    std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>> m_decAVFrame;
+#endif //#if ENABLE_AVSW_READER
+    std::unique_ptr<RGYMetricCPUFrame> m_decFrame; // デコード後のフレーム
+
+    // スレッド関連
+    std::thread m_thread;            // デコードと比較を行うスレッド
+    std::mutex m_mtx;                // m_input, m_unused, m_packets操作用のロック
+    std::condition_variable m_cond;  // 入力の追加/消費の通知
+    bool m_abort;
+    bool m_flush;
+    RGY_ERR m_err;                   // 比較スレッドのエラー
+    std::deque<std::unique_ptr<RGYMetricCPUFrame>> m_input;  // 比較待ちのオリジナルフレーム
+    std::deque<std::unique_ptr<RGYMetricCPUFrame>> m_unused; // 使っていないフレームバッファ
+#if ENABLE_AVSW_READER
+    std::deque<std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> m_packets; // デコード待ちのビットストリーム
+#endif //#if ENABLE_AVSW_READER
+
+    // motion用 (ぼかした輝度の現在と直前のフレーム)
+    std::array<std::vector<uint16_t>, 2> m_blur;
+    int m_blurIdx;
+    // VIF用 (scaleごとのfloat画像)
+    std::array<std::vector<float>, 4> m_vifRef;
+    std::array<std::vector<float>, 4> m_vifDis;
+    std::array<int, 4> m_vifWidth;
+    std::array<int, 4> m_vifHeight;
+    std::array<std::vector<float>, 4> m_vifFilter;
+
+    std::unique_ptr<FILE, fp_deleter> m_fpLog;
+
+    // 評価結果の累積値
+    std::array<double, 3> m_ssimTotalPlane;
+    double m_ssimTotal;
+    std::array<double, 3> m_psnrTotalPlane; // mseの累積値
+    double m_psnrTotal;
+    std::array<double, 4> m_vifTotal;
+    double m_admTotal;
+    double m_motionTotal;
+    int m_frames;
+    int m_inputOriginal;
+};
+
+#endif //__RGY_METRIC_CPU_H__
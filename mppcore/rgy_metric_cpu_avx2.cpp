@@ -0,0 +1,191 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+
+#include <cstdlib>
+#include "rgy_metric_cpu.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+#include <immintrin.h>
+
+#if _MSC_VER >= 1800 && !defined(__AVX__) && !defined(_DEBUG)
+static_assert(false, "do not forget to set /arch:AVX or /arch:AVX2 for this file.");
+#endif
+
+static RGY_FORCEINLINE uint64_t hsum_epi64(__m256i v) {
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+    return (uint64_t)_mm_cvtsi128_si64(s);
+}
+
+static RGY_FORCEINLINE __m256i cvt_epu32_epi64_add(__m256i acc64, __m256i v32) {
+    acc64 = _mm256_add_epi64(acc64, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v32)));
+    return _mm256_add_epi64(acc64, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v32, 1)));
+}
+
+uint64_t rgy_metric_ssd_avx2(const uint16_t *a, const uint16_t *b, int width) {
+    // 12bitまでなら差はint16に収まり、madd後の32bitの累積は32回まではあふれない
+    __m256i acc64 = _mm256_setzero_si256();
+    int x = 0;
+    while (x + 16 <= width) {
+        __m256i acc32 = _mm256_setzero_si256();
+        for (int i = 0; i < 32 && x + 16 <= width; i++, x += 16) {
+            const __m256i d = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i *)(a + x)), _mm256_loadu_si256((const __m256i *)(b + x)));
+            acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(d, d));
+        }
+        acc64 = cvt_epu32_epi64_add(acc64, acc32);
+    }
+    uint64_t ssd = hsum_epi64(acc64);
+    for (; x < width; x++) {
+        const int d = (int)a[x] - (int)b[x];
+        ssd += (uint64_t)(d * d);
+    }
+    return ssd;
+}
+
+uint64_t rgy_metric_sad_avx2(const uint16_t *a, const uint16_t *b, int width) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc64 = _mm256_setzero_si256();
+    int x = 0;
+    while (x + 16 <= width) {
+        __m256i acc32 = _mm256_setzero_si256();
+        for (int i = 0; i < 1024 && x + 16 <= width; i++, x += 16) {
+            const __m256i d = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_loadu_si256((const __m256i *)(a + x)), _mm256_loadu_si256((const __m256i *)(b + x))));
+            acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(d, ones));
+        }
+        acc64 = cvt_epu32_epi64_add(acc64, acc32);
+    }
+    uint64_t sad = hsum_epi64(acc64);
+    for (; x < width; x++) {
+        sad += (uint64_t)std::abs((int)a[x] - (int)b[x]);
+    }
+    return sad;
+}
+
+void rgy_metric_ssim4x4_avx2(const uint16_t *a, int pitchA, const uint16_t *b, int pitchB, int blocks, int32_t (*sums)[4]) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    int z = 0;
+    // 4ブロック(16画素)ずつ処理する
+    for (; z + 4 <= blocks; z += 4) {
+        __m256i s1 = _mm256_setzero_si256(); // 16bitのまま累積 (4095*4 < 32768)
+        __m256i s2 = _mm256_setzero_si256();
+        __m256i ss = _mm256_setzero_si256();
+        __m256i s12 = _mm256_setzero_si256();
+        for (int y = 0; y < 4; y++) {
+            const __m256i va = _mm256_loadu_si256((const __m256i *)(a + y * pitchA + z * 4));
+            const __m256i vb = _mm256_loadu_si256((const __m256i *)(b + y * pitchB + z * 4));
+            s1 = _mm256_add_epi16(s1, va);
+            s2 = _mm256_add_epi16(s2, vb);
+            ss = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(va, va), _mm256_madd_epi16(vb, vb)));
+            s12 = _mm256_add_epi32(s12, _mm256_madd_epi16(va, vb));
+        }
+        // 隣接する2要素の和 → 4画素ごと(=ブロックごと)の和
+        // hadd後の並び: [x0 x1 y0 y1 | x2 x3 y2 y3]
+        const __m256i s12sum = _mm256_hadd_epi32(_mm256_madd_epi16(s1, ones), _mm256_madd_epi16(s2, ones));
+        const __m256i sssum = _mm256_hadd_epi32(ss, s12);
+        alignas(32) int32_t t0[8], t1[8];
+        _mm256_store_si256((__m256i *)t0, s12sum);
+        _mm256_store_si256((__m256i *)t1, sssum);
+        for (int i = 0; i < 4; i++) {
+            const int idx = (i >> 1) * 4 + (i & 1);
+            sums[z + i][0] = t0[idx];
+            sums[z + i][1] = t0[idx + 2];
+            sums[z + i][2] = t1[idx];
+            sums[z + i][3] = t1[idx + 2];
+        }
+    }
+    if (z < blocks) {
+        rgy_metric_ssim4x4_c(a + z * 4, pitchA, b + z * 4, pitchB, blocks - z, sums + z);
+    }
+}
+
+void rgy_metric_vif_vfilter_avx2(const float *const *ref, const float *const *dis, const float *filter, int taps, int width, float *const *out) {
+    // 8画素ずつ、tapsの累積をレジスタ上で行う (C版と同じ順序で乗算・加算する)
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256 mu1 = _mm256_setzero_ps(), mu2 = _mm256_setzero_ps();
+        __m256 rr = _mm256_setzero_ps(), dd = _mm256_setzero_ps(), rd = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++) {
+            const __m256 c = _mm256_set1_ps(filter[k]);
+            const __m256 vr = _mm256_loadu_ps(ref[k] + x);
+            const __m256 vd = _mm256_loadu_ps(dis[k] + x);
+            const __m256 cr = _mm256_mul_ps(c, vr);
+            const __m256 cd = _mm256_mul_ps(c, vd);
+            mu1 = _mm256_add_ps(mu1, cr);
+            mu2 = _mm256_add_ps(mu2, cd);
+            rr = _mm256_add_ps(rr, _mm256_mul_ps(cr, vr));
+            dd = _mm256_add_ps(dd, _mm256_mul_ps(cd, vd));
+            rd = _mm256_add_ps(rd, _mm256_mul_ps(cr, vd));
+        }
+        _mm256_storeu_ps(out[0] + x, mu1);
+        _mm256_storeu_ps(out[1] + x, mu2);
+        _mm256_storeu_ps(out[2] + x, rr);
+        _mm256_storeu_ps(out[3] + x, dd);
+        _mm256_storeu_ps(out[4] + x, rd);
+    }
+    for (; x < width; x++) {
+        float mu1 = 0.0f, mu2 = 0.0f, rr = 0.0f, dd = 0.0f, rd = 0.0f;
+        for (int k = 0; k < taps; k++) {
+            const float c = filter[k];
+            const float vr = ref[k][x], vd = dis[k][x];
+            mu1 += c * vr;
+            mu2 += c * vd;
+            rr += c * vr * vr;
+            dd += c * vd * vd;
+            rd += c * vr * vd;
+        }
+        out[0][x] = mu1;
+        out[1][x] = mu2;
+        out[2][x] = rr;
+        out[3][x] = dd;
+        out[4][x] = rd;
+    }
+}
+
+void rgy_metric_vif_hfilter_avx2(const float *src, const float *filter, int taps, int width, float *dst) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++) {
+            const __m256 c = _mm256_set1_ps(filter[k]);
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(c, _mm256_loadu_ps(src + x + k + 0)));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(c, _mm256_loadu_ps(src + x + k + 8)));
+        }
+        _mm256_storeu_ps(dst + x + 0, acc0);
+        _mm256_storeu_ps(dst + x + 8, acc1);
+    }
+    for (; x < width; x++) {
+        float sum = 0.0f;
+        for (int k = 0; k < taps; k++) {
+            sum += filter[k] * src[x + k];
+        }
+        dst[x] = sum;
+    }
+}
+
+#endif //#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
@@ -0,0 +1,170 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+
+
+#include <cstdlib>
+#include "rgy_metric_cpu.h"
+
+#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+#include <arm_neon.h>
+
+uint64_t rgy_metric_ssd_neon(const uint16_t *a, const uint16_t *b, int width) {
+    // 12bitまでなら差の二乗は24bitに収まり、1レーンあたり2回/ループの累積は64回までは32bitであふれない
+    uint64x2_t acc64 = vdupq_n_u64(0);
+    int x = 0;
+    while (x + 8 <= width) {
+        uint32x4_t acc32 = vdupq_n_u32(0);
+        for (int i = 0; i < 64 && x + 8 <= width; i++, x += 8) {
+            const uint16x8_t d = vabdq_u16(vld1q_u16(a + x), vld1q_u16(b + x));
+            acc32 = vmlal_u16(acc32, vget_low_u16(d), vget_low_u16(d));
+            acc32 = vmlal_high_u16(acc32, d, d);
+        }
+        acc64 = vpadalq_u32(acc64, acc32);
+    }
+    uint64_t ssd = vaddvq_u64(acc64);
+    for (; x < width; x++) {
+        const int d = (int)a[x] - (int)b[x];
+        ssd += (uint64_t)(d * d);
+    }
+    return ssd;
+}
+
+uint64_t rgy_metric_sad_neon(const uint16_t *a, const uint16_t *b, int width) {
+    uint64x2_t acc64 = vdupq_n_u64(0);
+    int x = 0;
+    while (x + 8 <= width) {
+        uint32x4_t acc32 = vdupq_n_u32(0);
+        for (int i = 0; i < 4096 && x + 8 <= width; i++, x += 8) {
+            acc32 = vpadalq_u16(acc32, vabdq_u16(vld1q_u16(a + x), vld1q_u16(b + x)));
+        }
+        acc64 = vpadalq_u32(acc64, acc32);
+    }
+    uint64_t sad = vaddvq_u64(acc64);
+    for (; x < width; x++) {
+        sad += (uint64_t)std::abs((int)a[x] - (int)b[x]);
+    }
+    return sad;
+}
+
+void rgy_metric_ssim4x4_neon(const uint16_t *a, int pitchA, const uint16_t *b, int pitchB, int blocks, int32_t (*sums)[4]) {
+    int z = 0;
+    // 2ブロック(8画素)ずつ処理する、下位4レーンがブロックz、上位4レーンがブロックz+1
+    for (; z + 2 <= blocks; z += 2) {
+        uint16x8_t s1 = vdupq_n_u16(0); // 16bitのまま累積 (4095*4 < 65536)
+        uint16x8_t s2 = vdupq_n_u16(0);
+        uint32x4_t ssLo = vdupq_n_u32(0), ssHi = vdupq_n_u32(0);
+        uint32x4_t s12Lo = vdupq_n_u32(0), s12Hi = vdupq_n_u32(0);
+        for (int y = 0; y < 4; y++) {
+            const uint16x8_t va = vld1q_u16(a + y * pitchA + z * 4);
+            const uint16x8_t vb = vld1q_u16(b + y * pitchB + z * 4);
+            s1 = vaddq_u16(s1, va);
+            s2 = vaddq_u16(s2, vb);
+            ssLo = vmlal_u16(ssLo, vget_low_u16(va), vget_low_u16(va));
+            ssLo = vmlal_u16(ssLo, vget_low_u16(vb), vget_low_u16(vb));
+            ssHi = vmlal_high_u16(ssHi, va, va);
+            ssHi = vmlal_high_u16(ssHi, vb, vb);
+            s12Lo = vmlal_u16(s12Lo, vget_low_u16(va), vget_low_u16(vb));
+            s12Hi = vmlal_high_u16(s12Hi, va, vb);
+        }
+        sums[z + 0][0] = (int32_t)vaddlv_u16(vget_low_u16(s1));
+        sums[z + 1][0] = (int32_t)vaddlv_u16(vget_high_u16(s1));
+        sums[z + 0][1] = (int32_t)vaddlv_u16(vget_low_u16(s2));
+        sums[z + 1][1] = (int32_t)vaddlv_u16(vget_high_u16(s2));
+        sums[z + 0][2] = (int32_t)vaddvq_u32(ssLo);
+        sums[z + 1][2] = (int32_t)vaddvq_u32(ssHi);
+        sums[z + 0][3] = (int32_t)vaddvq_u32(s12Lo);
+        sums[z + 1][3] = (int32_t)vaddvq_u32(s12Hi);
+    }
+    if (z < blocks) {
+        rgy_metric_ssim4x4_c(a + z * 4, pitchA, b + z * 4, pitchB, blocks - z, sums + z);
+    }
+}
+
+void rgy_metric_vif_vfilter_neon(const float *const *ref, const float *const *dis, const float *filter, int taps, int width, float *const *out) {
+    // 4画素ずつ、tapsの累積をレジスタ上で行う (C版と同じ順序で乗算・加算する)
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        float32x4_t mu1 = vdupq_n_f32(0.0f), mu2 = vdupq_n_f32(0.0f);
+        float32x4_t rr = vdupq_n_f32(0.0f), dd = vdupq_n_f32(0.0f), rd = vdupq_n_f32(0.0f);
+        for (int k = 0; k < taps; k++) {
+            const float32x4_t vr = vld1q_f32(ref[k] + x);
+            const float32x4_t vd = vld1q_f32(dis[k] + x);
+            const float32x4_t cr = vmulq_n_f32(vr, filter[k]);
+            const float32x4_t cd = vmulq_n_f32(vd, filter[k]);
+            mu1 = vaddq_f32(mu1, cr);
+            mu2 = vaddq_f32(mu2, cd);
+            rr = vaddq_f32(rr, vmulq_f32(cr, vr));
+            dd = vaddq_f32(dd, vmulq_f32(cd, vd));
+            rd = vaddq_f32(rd, vmulq_f32(cr, vd));
+        }
+        vst1q_f32(out[0] + x, mu1);
+        vst1q_f32(out[1] + x, mu2);
+        vst1q_f32(out[2] + x, rr);
+        vst1q_f32(out[3] + x, dd);
+        vst1q_f32(out[4] + x, rd);
+    }
+    for (; x < width; x++) {
+        float mu1 = 0.0f, mu2 = 0.0f, rr = 0.0f, dd = 0.0f, rd = 0.0f;
+        for (int k = 0; k < taps; k++) {
+            const float c = filter[k];
+            const float vr = ref[k][x], vd = dis[k][x];
+            mu1 += c * vr;
+            mu2 += c * vd;
+            rr += c * vr * vr;
+            dd += c * vd * vd;
+            rd += c * vr * vd;
+        }
+        out[0][x] = mu1;
+        out[1][x] = mu2;
+        out[2][x] = rr;
+        out[3][x] = dd;
+        out[4][x] = rd;
+    }
+}
+
+void rgy_metric_vif_hfilter_neon(const float *src, const float *filter, int taps, int width, float *dst) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+        for (int k = 0; k < taps; k++) {
+            acc0 = vaddq_f32(acc0, vmulq_n_f32(vld1q_f32(src + x + k + 0), filter[k]));
+            acc1 = vaddq_f32(acc1, vmulq_n_f32(vld1q_f32(src + x + k + 4), filter[k]));
+        }
+        vst1q_f32(dst + x + 0, acc0);
+        vst1q_f32(dst + x + 4, acc1);
+    }
+    for (; x < width; x++) {
+        float sum = 0.0f;
+        for (int k = 0; k < taps; k++) {
+            sum += filter[k] * src[x + k];
+        }
+        dst[x] = sum;
+    }
+}
+
+#endif //#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
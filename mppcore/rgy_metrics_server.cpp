@@ -0,0 +1,447 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include "rgy_metrics_server.h"
+#include "rgy_osdep.h"
+#include "rgy_util.h"
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+
+RGYMetricsSnapshot::RGYMetricsSnapshot() :
+    uptimeSec(0.0),
+    encStarted(false),
+    framesIn(0),
+    framesOut(0),
+    framesDrop(0),
+    outBytes(0),
+    fps(0.0),
+    fpsAvg(0.0),
+    bitrateKbps(0.0),
+    bitrateKbpsAvg(0.0),
+    frameTypes(),
+    queueVidIn(0),
+    queueAudIn(0),
+    queueVidOut(0),
+    queueAudOut(0),
+    queueAudProc(0),
+    queueAudEnc(0),
+    cpuPercent(0.0),
+    cpuKernelPercent(0.0),
+    threads(),
+    memPrivate(0),
+    memVirtual(0),
+    ioTotalRead(0),
+    ioTotalWrite(0),
+    gpuInfoValid(false),
+    gpuLoad(0.0),
+    gpuClock(0.0),
+    veeLoad(0.0),
+    vedLoad(0.0),
+    veClock(0.0),
+    rgaLoad(0.0),
+    filters(),
+    kernels() {
+}
+
+//ラベル値のエスケープ (\, ", 改行)
+static std::string metrics_label_escape(const std::string& str) {
+    std::string ret;
+    ret.reserve(str.length());
+    for (const auto c : str) {
+        switch (c) {
+        case '\\': ret += "\\\\"; break;
+        case '"':  ret += "\\\""; break;
+        case '\n': ret += "\\n"; break;
+        default:   ret += c; break;
+        }
+    }
+    return ret;
+}
+
+static void metrics_family(std::string& str, const char *name, const char *type, const char *help, const char *unit = nullptr) {
+    str += strsprintf("# TYPE %s %s\n", name, type);
+    if (unit) {
+        str += strsprintf("# UNIT %s %s\n", name, unit);
+    }
+    str += strsprintf("# HELP %s %s\n", name, help);
+}
+
+static void metrics_sample(std::string& str, const char *name, const char *suffix, const std::string& labels, double value) {
+    str += name;
+    str += suffix;
+    if (labels.length() > 0) {
+        str += "{" + labels + "}";
+    }
+    str += strsprintf(" %.15g\n", value);
+}
+
+static std::string metrics_label(const char *key, const std::string& value) {
+    return strsprintf("%s=\"%s\"", key, metrics_label_escape(value).c_str());
+}
+
+std::string rgy_metrics_openmetrics(const RGYMetricsSnapshot& s) {
+    std::string str;
+    str.reserve(8192);
+
+    metrics_family(str, "rgy_uptime_seconds", "gauge", "Time since the encoder started.", "seconds");
+    metrics_sample(str, "rgy_uptime_seconds", "", "", s.uptimeSec);
+    metrics_family(str, "rgy_encode_started", "gauge", "1 if encoding has started.");
+    metrics_sample(str, "rgy_encode_started", "", "", s.encStarted ? 1.0 : 0.0);
+
+    metrics_family(str, "rgy_frames_in", "counter", "Frames sent to the encoder.");
+    metrics_sample(str, "rgy_frames_in", "_total", "", (double)s.framesIn);
+    metrics_family(str, "rgy_frames_out", "counter", "Frames output by the encoder.");
+    metrics_sample(str, "rgy_frames_out", "_total", "", (double)s.framesOut);
+    metrics_family(str, "rgy_frames_dropped", "counter", "Dropped frames.");
+    metrics_sample(str, "rgy_frames_dropped", "_total", "", (double)s.framesDrop);
+    metrics_family(str, "rgy_output_bytes", "counter", "Bytes of encoded bitstream.", "bytes");
+    metrics_sample(str, "rgy_output_bytes", "_total", "", (double)s.outBytes);
+
+    metrics_family(str, "rgy_encode_fps", "gauge", "Encode speed in the last interval.");
+    metrics_sample(str, "rgy_encode_fps", "", "", s.fps);
+    metrics_family(str, "rgy_encode_fps_avg", "gauge", "Average encode speed.");
+    metrics_sample(str, "rgy_encode_fps_avg", "", "", s.fpsAvg);
+    metrics_family(str, "rgy_bitrate_kbps", "gauge", "Output bitrate in the last interval.");
+    metrics_sample(str, "rgy_bitrate_kbps", "", "", s.bitrateKbps);
+    metrics_family(str, "rgy_bitrate_avg_kbps", "gauge", "Average output bitrate.");
+    metrics_sample(str, "rgy_bitrate_avg_kbps", "", "", s.bitrateKbpsAvg);
+
+    metrics_family(str, "rgy_frame_type_frames", "counter", "Output frames per frame type (I includes IDR).");
+    for (const auto& ft : s.frameTypes) {
+        metrics_sample(str, "rgy_frame_type_frames", "_total", metrics_label("type", ft.type), (double)ft.frames);
+    }
+    metrics_family(str, "rgy_frame_type_bytes", "counter", "Output bytes per frame type.", "bytes");
+    for (const auto& ft : s.frameTypes) {
+        if (ft.hasSize) {
+            metrics_sample(str, "rgy_frame_type_bytes", "_total", metrics_label("type", ft.type), (double)ft.bytes);
+        }
+    }
+    metrics_family(str, "rgy_frame_type_qp_avg", "gauge", "Average QP per frame type.");
+    for (const auto& ft : s.frameTypes) {
+        if (ft.hasSize && ft.frames > 0) {
+            metrics_sample(str, "rgy_frame_type_qp_avg", "", metrics_label("type", ft.type), ft.qpSum / (double)ft.frames);
+        }
+    }
+
+    metrics_family(str, "rgy_queue_depth", "gauge", "Number of items in the internal queues.");
+    metrics_sample(str, "rgy_queue_depth", "", metrics_label("queue", "vid_in"),   (double)s.queueVidIn);
+    metrics_sample(str, "rgy_queue_depth", "", metrics_label("queue", "aud_in"),   (double)s.queueAudIn);
+    metrics_sample(str, "rgy_queue_depth", "", metrics_label("queue", "vid_out"),  (double)s.queueVidOut);
+    metrics_sample(str, "rgy_queue_depth", "", metrics_label("queue", "aud_out"),  (double)s.queueAudOut);
+    metrics_sample(str, "rgy_queue_depth", "", metrics_label("queue", "aud_proc"), (double)s.queueAudProc);
+    metrics_sample(str, "rgy_queue_depth", "", metrics_label("queue", "aud_enc"),  (double)s.queueAudEnc);
+
+    metrics_family(str, "rgy_cpu_usage_percent", "gauge", "Process cpu usage.");
+    metrics_sample(str, "rgy_cpu_usage_percent", "", metrics_label("mode", "total"),  s.cpuPercent);
+    metrics_sample(str, "rgy_cpu_usage_percent", "", metrics_label("mode", "kernel"), s.cpuKernelPercent);
+    metrics_family(str, "rgy_thread_cpu_usage_percent", "gauge", "Cpu usage per thread.");
+    for (const auto& th : s.threads) {
+        metrics_sample(str, "rgy_thread_cpu_usage_percent", "", metrics_label("thread", th.name), th.percent);
+    }
+    metrics_family(str, "rgy_thread_cpu_seconds", "counter", "Cpu time per thread.", "seconds");
+    for (const auto& th : s.threads) {
+        metrics_sample(str, "rgy_thread_cpu_seconds", "_total", metrics_label("thread", th.name), th.totalSec);
+    }
+
+    metrics_family(str, "rgy_memory_bytes", "gauge", "Process memory usage.", "bytes");
+    metrics_sample(str, "rgy_memory_bytes", "", metrics_label("type", "private"), (double)s.memPrivate);
+    metrics_sample(str, "rgy_memory_bytes", "", metrics_label("type", "virtual"), (double)s.memVirtual);
+    metrics_family(str, "rgy_io_bytes", "counter", "Process io.", "bytes");
+    metrics_sample(str, "rgy_io_bytes", "_total", metrics_label("direction", "read"),  (double)s.ioTotalRead);
+    metrics_sample(str, "rgy_io_bytes", "_total", metrics_label("direction", "write"), (double)s.ioTotalWrite);
+
+    if (s.gpuInfoValid) {
+        metrics_family(str, "rgy_engine_load_percent", "gauge", "Load of the gpu / video engines.");
+        metrics_sample(str, "rgy_engine_load_percent", "", metrics_label("engine", "gpu"), s.gpuLoad);
+        metrics_sample(str, "rgy_engine_load_percent", "", metrics_label("engine", "vee"), s.veeLoad);
+        metrics_sample(str, "rgy_engine_load_percent", "", metrics_label("engine", "ved"), s.vedLoad);
+        metrics_sample(str, "rgy_engine_load_percent", "", metrics_label("engine", "rga"), s.rgaLoad);
+        metrics_family(str, "rgy_engine_clock_mhz", "gauge", "Clock of the gpu / video engines.");
+        metrics_sample(str, "rgy_engine_clock_mhz", "", metrics_label("engine", "gpu"), s.gpuClock);
+        metrics_sample(str, "rgy_engine_clock_mhz", "", metrics_label("engine", "ve"),  s.veClock);
+    }
+
+    if (s.filters.size() > 0) {
+        metrics_family(str, "rgy_filter_gpu_time_avg_ms", "gauge", "Average gpu time per frame of each filter.");
+        for (const auto& f : s.filters) {
+            metrics_sample(str, "rgy_filter_gpu_time_avg_ms", "", metrics_label("filter", f.name), f.avgMs);
+        }
+        metrics_family(str, "rgy_filter_gpu_time_seconds", "counter", "Total gpu time of each filter.", "seconds");
+        for (const auto& f : s.filters) {
+            metrics_sample(str, "rgy_filter_gpu_time_seconds", "_total", metrics_label("filter", f.name), f.totalMs * 1e-3);
+        }
+        metrics_family(str, "rgy_filter_runs", "counter", "Number of runs of each filter.");
+        for (const auto& f : s.filters) {
+            metrics_sample(str, "rgy_filter_runs", "_total", metrics_label("filter", f.name), (double)f.runCount);
+        }
+        metrics_family(str, "rgy_filter_gpu_duration_seconds", "histogram", "Distribution of gpu time per run of each filter.", "seconds");
+        for (const auto& f : s.filters) {
+            const auto label = metrics_label("filter", f.name);
+            for (const auto& [upperMs, count] : f.buckets) {
+                metrics_sample(str, "rgy_filter_gpu_duration_seconds", "_bucket", label + "," + metrics_label("le", strsprintf("%.15g", upperMs * 1e-3)), (double)count);
+            }
+            metrics_sample(str, "rgy_filter_gpu_duration_seconds", "_bucket", label + "," + metrics_label("le", "+Inf"), (double)f.runCount);
+            metrics_sample(str, "rgy_filter_gpu_duration_seconds", "_count", label, (double)f.runCount);
+            metrics_sample(str, "rgy_filter_gpu_duration_seconds", "_sum", label, f.totalMs * 1e-3);
+        }
+    }
+    if (s.kernels.size() > 0) {
+        metrics_family(str, "rgy_kernel_gpu_time_seconds", "counter", "Total gpu time of each kernel.", "seconds");
+        for (const auto& k : s.kernels) {
+            metrics_sample(str, "rgy_kernel_gpu_time_seconds", "_total", metrics_label("filter", k.filter) + "," + metrics_label("kernel", k.kernel), k.totalMs * 1e-3);
+        }
+        metrics_family(str, "rgy_kernel_runs", "counter", "Number of runs of each kernel.");
+        for (const auto& k : s.kernels) {
+            metrics_sample(str, "rgy_kernel_runs", "_total", metrics_label("filter", k.filter) + "," + metrics_label("kernel", k.kernel), (double)k.runCount);
+        }
+    }
+    str += "# EOF\n";
+    return str;
+}
+
+RGYMetricsServer::RGYMetricsServer() :
+    m_log(),
+    m_snapshot(),
+    m_thread(),
+    m_abort(false),
+    m_fd(-1),
+    m_unixPath() {
+}
+
+RGYMetricsServer::~RGYMetricsServer() {
+    stop();
+}
+
+void RGYMetricsServer::publish(std::shared_ptr<const RGYMetricsSnapshot> snapshot) {
+    std::atomic_store_explicit(&m_snapshot, snapshot, std::memory_order_release);
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+//unix socketのファイルを削除する
+//ユーザー指定のパスなので、socket以外のファイルは削除しない
+//戻り値: 0 ... 削除した/存在しない, -1 ... socket以外のファイルが存在する/削除に失敗
+static int unlinkUnixSocket(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = EEXIST;
+        return -1;
+    }
+    return (unlink(path.c_str()) == 0 || errno == ENOENT) ? 0 : -1;
+}
+
+RGY_ERR RGYMetricsServer::start(const tstring& listen, std::shared_ptr<RGYLog> log) {
+    m_log = log;
+    const std::string target = tchar_to_string(listen);
+    if (target.substr(0, 5) == "unix:") {
+        m_unixPath = target.substr(5);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (m_unixPath.length() == 0 || m_unixPath.length() >= sizeof(addr.sun_path)) {
+            AddMessage(RGY_LOG_ERROR, _T("invalid unix socket path: %s.\n"), char_to_tstring(m_unixPath).c_str());
+            return RGY_ERR_INVALID_PARAM;
+        }
+        strcpy(addr.sun_path, m_unixPath.c_str());
+        //前回の実行で残ったsocketのみ削除する
+        if (unlinkUnixSocket(m_unixPath) != 0) {
+            AddMessage(RGY_LOG_ERROR, _T("%s already exists and is not a unix socket (or could not be removed): %s.\n"),
+                char_to_tstring(m_unixPath).c_str(), char_to_tstring(strerror(errno)).c_str());
+            m_unixPath.clear();
+            return RGY_ERR_INVALID_PARAM;
+        }
+        if ((m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+            || bind(m_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to bind %s: %s.\n"), listen.c_str(), char_to_tstring(strerror(errno)).c_str());
+            m_unixPath.clear(); //作成していないファイルは削除しない
+            stop();
+            return RGY_ERR_UNKNOWN;
+        }
+    } else {
+        //"<port>" または "<host>:<port>"
+        std::string host = "127.0.0.1";
+        std::string port = target;
+        if (const auto pos = target.rfind(':'); pos != std::string::npos) {
+            host = target.substr(0, pos);
+            port = target.substr(pos + 1);
+            if (host.length() >= 2 && host.front() == '[' && host.back() == ']') {
+                host = host.substr(1, host.length() - 2);
+            }
+        }
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        struct addrinfo *res = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) {
+            AddMessage(RGY_LOG_ERROR, _T("invalid listen address: %s.\n"), listen.c_str());
+            return RGY_ERR_INVALID_PARAM;
+        }
+        for (auto ai = res; ai != nullptr; ai = ai->ai_next) {
+            if ((m_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0) {
+                continue;
+            }
+            int on = 1;
+            setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(m_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            close(m_fd);
+            m_fd = -1;
+        }
+        freeaddrinfo(res);
+        if (m_fd < 0) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to bind %s: %s.\n"), listen.c_str(), char_to_tstring(strerror(errno)).c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+    }
+    if (::listen(m_fd, 8) < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to listen %s: %s.\n"), listen.c_str(), char_to_tstring(strerror(errno)).c_str());
+        stop();
+        return RGY_ERR_UNKNOWN;
+    }
+    m_abort = false;
+    m_thread = std::thread(&RGYMetricsServer::run, this);
+    AddMessage(RGY_LOG_INFO, _T("serving OpenMetrics on %s.\n"), listen.c_str());
+    return RGY_ERR_NONE;
+}
+
+void RGYMetricsServer::stop() {
+    m_abort = true;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (m_unixPath.length() > 0) {
+        unlinkUnixSocket(m_unixPath);
+        m_unixPath.clear();
+    }
+}
+
+void RGYMetricsServer::run() {
+    while (!m_abort) {
+        struct pollfd pfd = { m_fd, POLLIN, 0 };
+        //終了を検知できるよう、一定時間ごとに戻る
+        const int ret = poll(&pfd, 1, 200);
+        if (ret <= 0 || !(pfd.revents & POLLIN)) {
+            continue;
+        }
+        const int fd = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        serve(fd);
+        close(fd);
+    }
+}
+
+void RGYMetricsServer::serve(int fd) {
+    //リクエストヘッダの終端まで読む (長く待たない)
+    std::string request;
+    char buf[1024];
+    const auto timeout = std::chrono::system_clock::now() + std::chrono::seconds(2);
+    while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos && request.length() < 8192) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (m_abort || std::chrono::system_clock::now() > timeout || poll(&pfd, 1, 100) < 0) {
+            return;
+        }
+        if (!(pfd.revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+        const auto size = recv(fd, buf, sizeof(buf), 0);
+        if (size <= 0) {
+            return;
+        }
+        request.append(buf, size);
+    }
+    std::string status = "200 OK";
+    std::string contentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+    std::string body;
+    //"GET <path> HTTP/1.x"
+    char method[16] = { 0 }, path[256] = { 0 };
+    if (2 != sscanf(request.c_str(), "%15s %255s", method, path)) {
+        status = "400 Bad Request";
+    } else if (strcmp(method, "GET") != 0) {
+        status = "405 Method Not Allowed";
+    } else if (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0) {
+        status = "404 Not Found";
+    } else {
+        //公開済みのスナップショットを参照するだけで、パイプラインのスレッドとは同期しない
+        auto snapshot = std::atomic_load_explicit(&m_snapshot, std::memory_order_acquire);
+        body = rgy_metrics_openmetrics((snapshot) ? *snapshot : RGYMetricsSnapshot());
+    }
+    if (body.length() == 0) {
+        contentType = "text/plain; charset=utf-8";
+        body = status + "\n";
+    }
+    const std::string response = strsprintf("HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+        status.c_str(), contentType.c_str(), (int)body.length()) + body;
+    for (size_t sent = 0; sent < response.length() && !m_abort; ) {
+        const auto ret = send(fd, response.data() + sent, response.length() - sent, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            break;
+        }
+        sent += ret;
+    }
+}
+#else
+RGY_ERR RGYMetricsServer::start(const tstring& listen, std::shared_ptr<RGYLog> log) {
+    m_log = log;
+    AddMessage(RGY_LOG_ERROR, _T("metrics server is not supported on this platform (%s).\n"), listen.c_str());
+    return RGY_ERR_UNSUPPORTED;
+}
+
+void RGYMetricsServer::stop() {
+    m_abort = true;
+}
+
+void RGYMetricsServer::run() {
+}
+
+void RGYMetricsServer::serve(int fd) {
+    UNREFERENCED_PARAMETER(fd);
+}
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
@@ -0,0 +1,151 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_METRICS_SERVER_H__
+#define __RGY_METRICS_SERVER_H__
+
+#include <cstdint>
+#include <cstdarg>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rgy_osdep.h"
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+#include "rgy_log.h"
+
+struct RGYMetricsThreadCPU {
+    const char *name;
+    double percent;
+    double totalSec;
+};
+
+struct RGYMetricsFilterTime {
+    std::string name;
+    double avgMs;
+    double totalMs;
+    int64_t runCount;
+    std::vector<std::pair<double, int64_t>> buckets; //(上限[ms], 累積数)、上限なしのバケットは含めない
+};
+
+struct RGYMetricsKernelTime {
+    std::string filter;
+    std::string kernel;
+    double totalMs;
+    int64_t runCount;
+};
+
+struct RGYMetricsFrameType {
+    const char *type;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t qpSum;
+    bool hasSize; //IDRはIに含まれるので、サイズ/QPは持たない
+};
+
+//perf monitorのスレッドで作成し、RGYMetricsServerに公開するスナップショット
+struct RGYMetricsSnapshot {
+    double uptimeSec;
+    bool encStarted;
+    uint64_t framesIn;
+    uint64_t framesOut;
+    uint64_t framesDrop;
+    uint64_t outBytes;
+    double fps;
+    double fpsAvg;
+    double bitrateKbps;
+    double bitrateKbpsAvg;
+    std::vector<RGYMetricsFrameType> frameTypes;
+    size_t queueVidIn;
+    size_t queueAudIn;
+    size_t queueVidOut;
+    size_t queueAudOut;
+    size_t queueAudProc;
+    size_t queueAudEnc;
+    double cpuPercent;
+    double cpuKernelPercent;
+    std::vector<RGYMetricsThreadCPU> threads;
+    int64_t memPrivate;
+    int64_t memVirtual;
+    int64_t ioTotalRead;
+    int64_t ioTotalWrite;
+    bool gpuInfoValid;
+    double gpuLoad;
+    double gpuClock;
+    double veeLoad;
+    double vedLoad;
+    double veClock;
+    double rgaLoad;
+    std::vector<RGYMetricsFilterTime> filters;
+    std::vector<RGYMetricsKernelTime> kernels;
+
+    RGYMetricsSnapshot();
+};
+
+//OpenMetricsのテキスト形式に変換する
+std::string rgy_metrics_openmetrics(const RGYMetricsSnapshot& snapshot);
+
+//OpenMetricsを返す簡易HTTPサーバ
+//  listen: "[<host>:]<port>" (hostの既定は127.0.0.1) または "unix:<path>"
+//  スナップショットはatomicに差し替えるだけなので、scrapeがエンコードを待たせることはない
+class RGYMetricsServer {
+public:
+    RGYMetricsServer();
+    ~RGYMetricsServer();
+
+    RGY_ERR start(const tstring& listen, std::shared_ptr<RGYLog> log);
+    void stop();
+    void publish(std::shared_ptr<const RGYMetricsSnapshot> snapshot);
+protected:
+    void run();
+    void serve(int fd);
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+        if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_PERF_MONITOR)) {
+            return;
+        }
+        va_list args;
+        va_start(args, format);
+        int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+        tstring buffer;
+        buffer.resize(len, _T('\0'));
+        _vstprintf_s(&buffer[0], len, format, args);
+        va_end(args);
+        m_log->write(log_level, RGY_LOGT_PERF_MONITOR, (_T("metrics: ") + buffer).c_str());
+    }
+
+    std::shared_ptr<RGYLog> m_log;
+    std::shared_ptr<const RGYMetricsSnapshot> m_snapshot;
+    std::thread m_thread;
+    std::atomic<bool> m_abort;
+    int m_fd;
+    std::string m_unixPath;
+};
+
+#endif //__RGY_METRICS_SERVER_H__
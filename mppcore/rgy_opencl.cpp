@@ -28,6 +28,7 @@
 
 #include "rgy_tchar.h"
 #include <vector>
+#include <algorithm>
 #include <atomic>
 #include <fstream>
 #include "rgy_osdep.h"
@@ -318,6 +319,7 @@ int initOpenCLGlobal() {
     LOAD(clReleaseProgram);
 
     LOAD(clCreateBuffer);
+    LOAD_NO_CHECK(clCreateSubBuffer);
     LOAD(clCreateImage);
     LOAD_NO_CHECK(clCreateImageWithProperties);
     LOAD(clReleaseMemObject);
@@ -1178,6 +1180,11 @@ RGY_ERR RGYOpenCLPlatform::loadSubGroupKHR() {
     return RGY_ERR_NONE;
 }
 
+RGY_ERR RGYOpenCLPlatform::loadImportMemoryARM() {
+    LOAD_KHR(clImportMemoryARM);
+    return RGY_ERR_NONE;
+}
+
 RGYOpenCLSubGroupSupport RGYOpenCLPlatform::checkSubGroupSupport(const cl_device_id devid) {
     if (RGYOpenCL::openCLCrush) {
         return RGYOpenCLSubGroupSupport::NONE;
@@ -1298,14 +1305,32 @@ RGYOpenCLContext::RGYOpenCLContext(shared_ptr<RGYOpenCLPlatform> platform, share
     m_context(nullptr, clReleaseContext),
     m_queue(),
     m_log(pLog),
+    m_copyMtx(),
     m_copy(),
+    m_profile(),
+    m_programCacheEnabled(false),
+    m_programCacheMtx(),
+    m_programCache(),
+    m_programCacheOrder(),
+    m_frameCacheEnabled(false),
+    m_frameCacheMtx(),
+    m_frameCache(),
+    m_frameHistory(),
     m_hmodule(NULL) {
-
+    m_frameHistory = std::make_unique<RGYCLFrameHistory>(this, m_log);
 }
 
 RGYOpenCLContext::~RGYOpenCLContext() {
     CL_LOG(RGY_LOG_DEBUG, _T("Closing CL Context...\n"));
-    m_copy.clear();     CL_LOG(RGY_LOG_DEBUG, _T("Closed CL m_copy program.\n"));
+    m_profile.reset();
+    m_frameHistory.reset();
+    m_frameCache.clear();
+    m_copy.clear();
+    for (auto& [key, program] : m_programCache) {
+        clReleaseProgram(program);
+    }
+    m_programCache.clear();
+    m_programCacheOrder.clear(); CL_LOG(RGY_LOG_DEBUG, _T("Closed CL m_copy program.\n"));
     m_queue.clear();    CL_LOG(RGY_LOG_DEBUG, _T("Closed CL Queue.\n"));
     m_context.reset();  CL_LOG(RGY_LOG_DEBUG, _T("Closed CL Context.\n"));
     m_platform.reset(); CL_LOG(RGY_LOG_DEBUG, _T("Closed CL Platform.\n"));
@@ -1371,6 +1396,10 @@ RGY_ERR RGYOpenCLContext::createContext(const cl_command_queue_properties queue_
     for (int idev = 0; idev < (int)m_platform->devs().size(); idev++) {
         m_queue.push_back(createQueue(m_platform->dev(idev).id(), queue_properties));
     }
+    if (queue_properties & CL_QUEUE_PROFILING_ENABLE) {
+        m_profile = std::make_unique<RGYOpenCLProfileCollector>();
+        CL_LOG(RGY_LOG_DEBUG, _T("Created profile collector.\n"));
+    }
     return RGY_ERR_NONE;
 }
 
@@ -1390,6 +1419,348 @@ RGYOpenCLQueue RGYOpenCLContext::createQueue(const cl_device_id devid, const cl_
     return queue;
 }
 
+RGYOpenCLProfileCollector::RGYOpenCLProfileCollector() :
+    m_mtx(),
+    m_cvAdd(),
+    m_cvDone(),
+    m_pending(),
+    m_inflight(0),
+    m_abort(false),
+    m_cancel(false),
+    m_dropped(0),
+    m_thread() {
+    m_thread = std::thread(&RGYOpenCLProfileCollector::run, this);
+}
+
+RGYOpenCLProfileCollector::~RGYOpenCLProfileCollector() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_abort = true;
+        //終了時は回収していないものは捨てる (必要ならflush()しておくこと)
+        m_dropped += (int64_t)m_pending.size();
+        m_pending.clear();
+    }
+    m_cancel = true;
+    m_cvAdd.notify_all();
+    m_cvDone.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void RGYOpenCLProfileCollector::addSpan(std::shared_ptr<RGYOpenCLProfileTarget> target, const RGYOpenCLEvent& start, const RGYOpenCLEvent& end) {
+    add({ target, std::string(), start, end });
+}
+
+void RGYOpenCLProfileCollector::addKernel(std::shared_ptr<RGYOpenCLProfileTarget> target, const std::string& kernel, const RGYOpenCLEvent& event) {
+    add({ target, kernel, event, event });
+}
+
+void RGYOpenCLProfileCollector::add(Entry&& entry) {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        //回収が追いつかない場合は、呼び出し側を待たせずに捨てる
+        if (m_pending.size() >= MAX_PENDING) {
+            m_dropped++;
+            return;
+        }
+        m_pending.push_back(std::move(entry));
+    }
+    m_cvAdd.notify_one();
+}
+
+bool RGYOpenCLProfileCollector::flush(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    const bool done = m_cvDone.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() { return m_abort || (m_pending.size() == 0 && m_inflight == 0); });
+    if (!done) {
+        //完了しないイベントがある (GPUのハングなど) ので、残りは捨てる
+        m_dropped += (int64_t)m_pending.size();
+        m_pending.clear();
+        m_cancel = true;
+        m_cvDone.wait(lock, [&]() { return m_inflight == 0; });
+        m_cancel = false;
+    }
+    return done;
+}
+
+bool RGYOpenCLProfileCollector::waitEvent(const RGYOpenCLEvent& event) {
+    //clWaitForEventsは中断できないので、状態を確認しながら待機する
+    for (int i = 0; !m_cancel; i++) {
+        cl_int status = CL_QUEUED;
+        if (clGetEventInfo(event(), CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr) != CL_SUCCESS || status < 0) {
+            return false;
+        }
+        if (status == CL_COMPLETE) {
+            return true;
+        }
+        //完了直前のことが多いので、最初は短い間隔で確認する
+        if (i < 16) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+    return false;
+}
+
+void RGYOpenCLProfileCollector::collect(Entry& entry) {
+    //待機するのはこのスレッドのみ
+    if (!waitEvent(entry.end)) {
+        m_dropped++;
+        return;
+    }
+    uint64_t time_start = 0, time_end = 0;
+    const bool isKernel = entry.kernel.length() > 0;
+    auto err = (isKernel) ? entry.start.getProfilingTimeStart(time_start) : entry.start.getProfilingTimeEnd(time_start);
+    if (err == RGY_ERR_NONE) {
+        err = (isKernel) ? entry.end.getProfilingTimeEnd(time_end) : entry.end.getProfilingTimeStart(time_end);
+    }
+    if (err != RGY_ERR_NONE || time_end < time_start) {
+        m_dropped++;
+        return;
+    }
+    entry.target->addProfileTime(entry.kernel, (time_end - time_start) * 1e-6 /*ns -> ms*/);
+}
+
+void RGYOpenCLProfileCollector::run() {
+    for (;;) {
+        Entry entry;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cvAdd.wait(lock, [&]() { return m_abort || m_pending.size() > 0; });
+            if (m_abort) {
+                break;
+            }
+            entry = std::move(m_pending.front());
+            m_pending.pop_front();
+            m_inflight++;
+        }
+        collect(entry);
+        entry = Entry();
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_inflight--;
+        }
+        m_cvDone.notify_all();
+    }
+}
+
+static thread_local RGYOpenCLProfileScope *g_currentProfileScope = nullptr;
+
+RGYOpenCLProfileScope::RGYOpenCLProfileScope(RGYOpenCLProfileCollector *collector, std::shared_ptr<RGYOpenCLProfileTarget> target) :
+    m_collector(collector),
+    m_target(target),
+    m_prev(g_currentProfileScope) {
+    g_currentProfileScope = this;
+}
+
+RGYOpenCLProfileScope::~RGYOpenCLProfileScope() {
+    g_currentProfileScope = m_prev;
+}
+
+RGYOpenCLProfileScope *RGYOpenCLProfileScope::current() {
+    return g_currentProfileScope;
+}
+
+void RGYOpenCLProfileScope::addKernel(const std::string& kernel, const RGYOpenCLEvent& event) {
+    if (m_collector && m_target) {
+        m_collector->addKernel(m_target, kernel, event);
+    }
+}
+
+RGYCLFrameHistory::RGYCLFrameHistory(RGYOpenCLContext *cl, std::shared_ptr<RGYLog> log) :
+    m_cl(cl),
+    m_log(log),
+    m_pool(std::make_shared<Pool>()),
+    m_mtx(),
+    m_entries(),
+    m_shared(0),
+    m_copied(0),
+    m_private(0) {
+}
+
+RGYCLFrameHistory::~RGYCLFrameHistory() {
+    if (m_shared + m_copied + m_private > 0) {
+        CL_LOG(RGY_LOG_DEBUG, _T("frame history: %lld frames shared, %lld frames copied, %lld private frames over limit, peak %.1f MB.\n"),
+            (long long)m_shared, (long long)m_copied, (long long)m_private, m_pool->peak / (double)(1024 * 1024));
+    }
+    m_entries.clear();
+    std::lock_guard<std::mutex> lock(m_pool->mtx);
+    m_pool->frames.clear();
+    m_pool->pooled = 0;
+}
+
+size_t RGYCLFrameHistory::frameBytes(const RGYFrameInfo& frame) {
+    size_t size = 0;
+    for (int i = 0; i < RGY_CSP_PLANES[frame.csp]; i++) {
+        const auto plane = getPlane(&frame, (RGY_PLANE)i);
+        size += (size_t)plane.pitch[0] * plane.height;
+    }
+    return size;
+}
+
+void RGYCLFrameHistory::Pool::trim(const size_t required) {
+    //古いものから解放する
+    while (limit > 0 && frames.size() > 0 && used + pooled + required > limit) {
+        pooled -= frameBytes(frames.front()->frame);
+        frames.erase(frames.begin());
+    }
+}
+
+void RGYCLFrameHistory::setLimit(const size_t limitBytes) {
+    std::lock_guard<std::mutex> lock(m_pool->mtx);
+    m_pool->limit = limitBytes;
+    m_pool->overLimitWarned = false;
+    m_pool->trim(0);
+}
+
+std::shared_ptr<RGYCLFrame> RGYCLFrameHistory::wrap(std::unique_ptr<RGYCLFrame> frame) {
+    //参照がなくなったらプールに戻す
+    std::weak_ptr<Pool> weakPool = m_pool;
+    return std::shared_ptr<RGYCLFrame>(frame.release(), [weakPool](RGYCLFrame *ptr) {
+        std::unique_ptr<RGYCLFrame> released(ptr);
+        auto pool = weakPool.lock();
+        if (!pool) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(pool->mtx);
+        const auto size = frameBytes(released->frame);
+        pool->used -= size;
+        if (pool->limit == 0 || pool->used + pool->pooled + size <= pool->limit) {
+            pool->pooled += size;
+            pool->frames.push_back(std::move(released));
+        }
+    });
+}
+
+std::shared_ptr<RGYCLFrame> RGYCLFrameHistory::alloc(const RGYFrameInfo& frameInfo) {
+    std::unique_ptr<RGYCLFrame> frame;
+    {
+        std::lock_guard<std::mutex> lock(m_pool->mtx);
+        auto it = std::find_if(m_pool->frames.begin(), m_pool->frames.end(), [&frameInfo](const std::unique_ptr<RGYCLFrame>& f) {
+            return !cmpFrameInfoCspResolution(&f->frame, &frameInfo);
+        });
+        if (it != m_pool->frames.end()) {
+            frame = std::move(*it);
+            m_pool->frames.erase(it);
+            const auto size = frameBytes(frame->frame);
+            m_pool->pooled -= size;
+            m_pool->used += size;
+            return wrap(std::move(frame));
+        }
+    }
+    frame = m_cl->createFrameBuffer(frameInfo.width, frameInfo.height, frameInfo.csp, frameInfo.bitdepth);
+    if (!frame) {
+        return nullptr;
+    }
+    const auto size = frameBytes(frame->frame);
+    {
+        std::lock_guard<std::mutex> lock(m_pool->mtx);
+        m_pool->trim(size);
+        if (m_pool->limit > 0 && m_pool->used + size > m_pool->limit) {
+            //参照中のフレームは解放できないので、limitを超える分は履歴の外に確保し、共有しない
+            if (!m_pool->overLimitWarned) {
+                CL_LOG(RGY_LOG_WARN, _T("frame history reached the limit %.1f MB, further frames are not shared.\n"),
+                    m_pool->limit / (double)(1024 * 1024));
+                m_pool->overLimitWarned = true;
+            }
+            m_private++;
+            return std::shared_ptr<RGYCLFrame>(frame.release(), PrivateFrameDeleter());
+        }
+        m_pool->used += size;
+        m_pool->peak = std::max(m_pool->peak, m_pool->used + m_pool->pooled);
+    }
+    return wrap(std::move(frame));
+}
+
+void RGYCLFrameHistory::removeExpired() {
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->second.expired()) {
+            it = m_entries.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void RGYCLFrameHistory::publish(const void *stage, const std::shared_ptr<RGYCLFrame>& frame) {
+    if (std::get_deleter<PrivateFrameDeleter>(frame) != nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    removeExpired();
+    //バッファを再利用した場合、以前のキーの登録は無効
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->second.lock() == frame) {
+            it = m_entries.erase(it);
+        } else {
+            it++;
+        }
+    }
+    m_entries[Key(stage, frame->frame.timestamp, frame->frame.inputFrameId)] = frame;
+}
+
+std::shared_ptr<RGYCLFrame> RGYCLFrameHistory::get(const void *stage, const int64_t timestamp, const int inputFrameId) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_entries.find(Key(stage, timestamp, inputFrameId));
+    if (it == m_entries.end()) {
+        return nullptr;
+    }
+    auto frame = it->second.lock();
+    if (!frame
+        || frame->frame.timestamp != timestamp
+        || frame->frame.inputFrameId != inputFrameId) {
+        return nullptr;
+    }
+    return frame;
+}
+
+bool RGYCLFrameHistory::contains(const void *stage, const RGYFrameInfo *frame) {
+    auto cached = get(stage, frame->timestamp, frame->inputFrameId);
+    return cached && !cmpFrameInfoCspResolution(&cached->frame, frame);
+}
+
+std::shared_ptr<RGYCLFrame> RGYCLFrameHistory::add(const void *stage, const RGYFrameInfo *frame, RGYOpenCLQueue& queue, RGY_ERR *err) {
+    return add(stage, frame, queue, {}, nullptr, err);
+}
+
+std::shared_ptr<RGYCLFrame> RGYCLFrameHistory::add(const void *stage, const RGYFrameInfo *frame, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent *event, RGY_ERR *err) {
+    *err = RGY_ERR_NONE;
+    auto cached = get(stage, frame->timestamp, frame->inputFrameId);
+    if (cached && !cmpFrameInfoCspResolution(&cached->frame, frame)) {
+        //前段の処理はqueueに投入済みなので、wait_eventsの後のmarkerをeventとする
+        if (event) {
+            const auto wait_list = toVec(wait_events);
+            if (wait_list.size() > 0) {
+                *err = err_cl_to_rgy(clEnqueueWaitForEvents(queue.get(), (cl_uint)wait_list.size(), wait_list.data()));
+            }
+            if (*err == RGY_ERR_NONE) {
+                *err = queue.getmarker(*event);
+            }
+            if (*err != RGY_ERR_NONE) {
+                return nullptr;
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_shared++;
+        return cached;
+    }
+    auto dst = alloc(*frame);
+    if (!dst) {
+        *err = RGY_ERR_MEMORY_ALLOC;
+        return nullptr;
+    }
+    *err = m_cl->copyFrame(&dst->frame, frame, nullptr, queue, wait_events, event);
+    if (*err != RGY_ERR_NONE) {
+        return nullptr;
+    }
+    copyFrameProp(&dst->frame, frame);
+    publish(stage, dst);
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_copied++;
+    return dst;
+}
+
 RGYOpenCLKernelLauncher::RGYOpenCLKernelLauncher(cl_kernel kernel, std::string kernelName, RGYOpenCLQueue &queue, const RGYWorkSize &local, const RGYWorkSize &global, shared_ptr<RGYLog> pLog, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent *event) :
     m_kernel(kernel), m_kernelName(kernelName), m_queue(queue), m_local(local), m_global(global), m_log(pLog), m_wait_events(toVec(wait_events)), m_event(event) {
 }
@@ -1439,15 +1810,22 @@ RGY_ERR RGYOpenCLKernelLauncher::launch(std::vector<void *> arg_ptrs, std::vecto
             }
         }
     }
+    //プロファイル中は、イベントが不要な場合もカーネルごとの時間計測用にイベントを取得する
+    auto profileScope = RGYOpenCLProfileScope::current();
+    RGYOpenCLEvent profileEvent;
+    RGYOpenCLEvent *event = (m_event == nullptr && profileScope) ? &profileEvent : m_event;
     auto globalCeiled = m_global.ceilGlobal(m_local);
     auto err = err_cl_to_rgy(clEnqueueNDRangeKernel(m_queue.get(), m_kernel, 3, NULL, globalCeiled(), m_local(),
         (int)m_wait_events.size(),
         (m_wait_events.size() > 0) ? m_wait_events.data() : nullptr,
-        (m_event) ? m_event->reset_ptr() : nullptr));
+        (event) ? event->reset_ptr() : nullptr));
     if (err != RGY_ERR_NONE) {
         CL_LOG(RGY_LOG_ERROR, _T("Error: Failed to run kernel \"%s\": %s\n"), char_to_tstring(m_kernelName).c_str(), get_err_mes(err));
         return err;
     }
+    if (profileScope) {
+        profileScope->addKernel(m_kernelName, *event);
+    }
     return err;
 }
 
@@ -2120,6 +2498,7 @@ std::string RGYOpenCLContext::cspCopyOptions(const RGYFrameInfo& dst, const RGYF
 
 void RGYOpenCLContext::requestCSPCopy(const RGYFrameInfo& dst, const RGYFrameInfo& src) {
     const auto options = cspCopyOptions(dst, src);
+    std::lock_guard<std::mutex> lock(m_copyMtx);
     if (m_copy.count(options) == 0) {
         m_copy[options].set(buildResourceAsync(_T("RGY_FILTER_CL"), _T("EXE_DATA"), options.c_str()));
     }
@@ -2127,10 +2506,13 @@ void RGYOpenCLContext::requestCSPCopy(const RGYFrameInfo& dst, const RGYFrameInf
 
 RGYOpenCLProgram *RGYOpenCLContext::getCspCopyProgram(const RGYFrameInfo& dst, const RGYFrameInfo& src) {
     const auto options = cspCopyOptions(dst, src);
+    //RGYOpenCLProgramAsync::get()は複数のスレッドから同時に呼べないので、ロックしたまま取得する
+    //(ビルドは別スレッドで行われるので、ここでm_copyMtxを待つことはない)
+    std::lock_guard<std::mutex> lock(m_copyMtx);
     if (m_copy.count(options) == 0) {
-        requestCSPCopy(dst, src);
+        m_copy[options].set(buildResourceAsync(_T("RGY_FILTER_CL"), _T("EXE_DATA"), options.c_str()));
     }
-    return (m_copy.count(options) != 0) ? m_copy[options].get() : nullptr;
+    return m_copy[options].get();
 }
 
 RGY_ERR RGYOpenCLContext::copyPlane(RGYFrameInfo *dst, const RGYFrameInfo *src) {
@@ -2395,10 +2777,13 @@ RGY_ERR RGYOpenCLContext::setPlane(int value, RGYFrameInfo *planeDst, const sInp
     const auto optDstMemType = strsprintf("-D MEM_TYPE_DST=%d", planeDst->mem_type);
     const auto optDstBitdepth = strsprintf("-D out_bit_depth=%d", RGY_CSP_BIT_DEPTH[planeDst->csp]);
     RGYOpenCLProgram *setProgram = nullptr;
-    for (auto& [opt, progam] : m_copy) {
-        if (opt.find(optDstMemType) != std::string::npos && opt.find(optDstBitdepth) != std::string::npos) {
-            setProgram = progam.get();
-            break;
+    {
+        std::lock_guard<std::mutex> lock(m_copyMtx);
+        for (auto& [opt, progam] : m_copy) {
+            if (opt.find(optDstMemType) != std::string::npos && opt.find(optDstBitdepth) != std::string::npos) {
+                setProgram = progam.get();
+                break;
+            }
         }
     }
     if (!setProgram) {
@@ -2477,6 +2862,26 @@ RGY_ERR RGYOpenCLContext::setBuf(const void *pattern, size_t pattern_size, size_
     return RGY_ERR_NONE;
 }
 
+std::string RGYOpenCLContext::programCacheKey(const char *data, const size_t datalen, const std::string& options) {
+    return strsprintf("%016llx:%llu:", (unsigned long long)std::hash<std::string>()(std::string(data, datalen)), (unsigned long long)datalen) + options;
+}
+
+size_t RGYOpenCLContext::programCacheCount() {
+    std::lock_guard<std::mutex> lock(m_programCacheMtx);
+    return m_programCache.size();
+}
+
+bool RGYOpenCLContext::programCached(const std::string& source, const std::string& options) {
+    const char *data = source.data();
+    size_t datalen = source.length();
+    if (datalen >= 3 && (uint8_t)data[0] == 0xEF && (uint8_t)data[1] == 0xBB && (uint8_t)data[2] == 0xBF) { //skip UTF-8 BOM
+        data += 3;
+        datalen -= 3;
+    }
+    std::lock_guard<std::mutex> lock(m_programCacheMtx);
+    return m_programCache.count(programCacheKey(data, datalen, options)) > 0;
+}
+
 std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::string datacopy, const std::string options) {
     auto datalen = datacopy.length();
     if (datacopy.size() == 0) {
@@ -2490,6 +2895,17 @@ std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::stri
             datalen -= 3;
         }
     }
+    const auto cacheKey = programCacheKey(data, datalen, options);
+    if (m_programCacheEnabled) {
+        std::lock_guard<std::mutex> lock(m_programCacheMtx);
+        if (auto it = m_programCache.find(cacheKey); it != m_programCache.end()) {
+            m_programCacheOrder.erase(std::find(m_programCacheOrder.begin(), m_programCacheOrder.end(), cacheKey));
+            m_programCacheOrder.push_back(cacheKey);
+            clRetainProgram(it->second);
+            CL_LOG(RGY_LOG_DEBUG, _T("reuse OpenCL program: size %u.\n"), datalen);
+            return std::make_unique<RGYOpenCLProgram>(it->second, m_log);
+        }
+    }
     CL_LOG(RGY_LOG_DEBUG, _T("building OpenCL source: size %u.\n"), datalen);
 
     bool buildCrush = false;
@@ -2536,6 +2952,22 @@ std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::stri
         }
     }
     CL_LOG(RGY_LOG_DEBUG, _T("clBuildProgram success!\n"));
+    if (m_programCacheEnabled) {
+        std::lock_guard<std::mutex> lock(m_programCacheMtx);
+        if (m_programCache.emplace(cacheKey, program).second) {
+            clRetainProgram(program);
+            m_programCacheOrder.push_back(cacheKey);
+            //上限を超えたら、最も長く使われていないものを破棄する (使用中のものはRGYOpenCLProgram側で保持されている)
+            while (m_programCacheOrder.size() > PROGRAM_CACHE_MAX) {
+                auto it = m_programCache.find(m_programCacheOrder.front());
+                if (it != m_programCache.end()) {
+                    clReleaseProgram(it->second);
+                    m_programCache.erase(it);
+                }
+                m_programCacheOrder.pop_front();
+            }
+        }
+    }
     return std::make_unique<RGYOpenCLProgram>(program, m_log);
 }
 
@@ -2704,7 +3136,56 @@ std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const int width,
     return createFrameBuffer(info, flags);
 }
 
+void RGYOpenCLContext::setFrameCache(const bool enable) {
+    std::lock_guard<std::mutex> lock(m_frameCacheMtx);
+    m_frameCacheEnabled = enable;
+    if (!enable) {
+        m_frameCache.clear();
+    }
+}
+
+void RGYOpenCLContext::returnFrameBuffer(std::unique_ptr<RGYCLFrame> frame) {
+    if (!frame || frame->isempty() || frame->isMapped()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_frameCacheMtx);
+    if (!m_frameCacheEnabled) {
+        return;
+    }
+    frame->frame.dataList.clear();
+    m_frameCache.push_back(std::move(frame));
+    while (m_frameCache.size() > FRAME_CACHE_MAX) {
+        m_frameCache.pop_front();
+    }
+}
+
+size_t RGYOpenCLContext::frameCacheCount() {
+    std::lock_guard<std::mutex> lock(m_frameCacheMtx);
+    return m_frameCache.size();
+}
+
 std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameInfo& frame, cl_mem_flags flags) {
+    {
+        std::lock_guard<std::mutex> lock(m_frameCacheMtx);
+        //新しく返却されたものから探す
+        for (auto it = m_frameCache.rbegin(); m_frameCacheEnabled && it != m_frameCache.rend(); it++) {
+            auto& cached = (*it)->frame;
+            if ((*it)->clflags == flags
+                && cached.csp == frame.csp && cached.width == frame.width && cached.height == frame.height && cached.bitdepth == frame.bitdepth) {
+                auto reused = std::move(*it);
+                m_frameCache.erase(std::next(it).base());
+                //バッファ以外のフレームの情報は新しく確保した場合と同じにする
+                RGYFrameInfo clframe = frame;
+                clframe.mem_type = RGY_MEM_TYPE_GPU;
+                for (int i = 0; i < _countof(clframe.ptr); i++) {
+                    clframe.ptr[i] = reused->frame.ptr[i];
+                    clframe.pitch[i] = reused->frame.pitch[i];
+                }
+                reused->frame = clframe;
+                return reused;
+            }
+        }
+    }
     cl_int err = CL_SUCCESS;
     int pixsize = (RGY_CSP_BIT_DEPTH[frame.csp] + 7) / 8;
     switch (frame.csp) {
@@ -2775,6 +3256,100 @@ std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameIn
     return std::make_unique<RGYCLFrame>(clframe, flags);
 }
 
+// 外部で確保済みのhostメモリ(frame.ptr/pitchのレイアウト)をそのままOpenCLのバッファとして使用する
+// ARM等のunified memoryの環境では、コピーなしでGPUから直接読み書きできる
+std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameFromHostPtr(const RGYFrameInfo& frame, cl_mem_flags flags) {
+    cl_int err = CL_SUCCESS;
+    flags &= ~(CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR);
+    flags |= CL_MEM_USE_HOST_PTR;
+
+    RGYFrameInfo clframe = frame;
+    clframe.mem_type = RGY_MEM_TYPE_GPU;
+    for (int i = 0; i < _countof(clframe.ptr); i++) {
+        clframe.ptr[i] = nullptr;
+        clframe.pitch[i] = 0;
+    }
+    for (int i = 0; i < RGY_CSP_PLANES[frame.csp]; i++) {
+        const auto plane = getPlane(&frame, (RGY_PLANE)i);
+        const int size = plane.pitch[0] * plane.height;
+        cl_mem mem = (plane.ptr[0]) ? clCreateBuffer(m_context.get(), flags, size, plane.ptr[0], &err) : nullptr;
+        if (mem == nullptr || err != CL_SUCCESS) {
+            CL_LOG(RGY_LOG_ERROR, _T("Failed to create buffer from host ptr: %s\n"), (plane.ptr[0]) ? cl_errmes(err) : _T("null ptr"));
+            for (int j = i-1; j >= 0; j--) {
+                if (clframe.ptr[j] != nullptr) {
+                    clReleaseMemObject((cl_mem)clframe.ptr[j]);
+                    clframe.ptr[j] = nullptr;
+                }
+            }
+            return std::unique_ptr<RGYCLFrame>();
+        }
+        clframe.pitch[i] = plane.pitch[0];
+        clframe.ptr[i] = (uint8_t *)mem;
+    }
+    return std::make_unique<RGYCLFrame>(clframe, flags);
+}
+
+// dma-bufのfdをcl_arm_import_memoryでOpenCLのバッファとしてimportする
+// frame.ptrはfdをmapしたアドレスで、各planeの先頭からのoffsetの計算にのみ使用する
+std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameFromDmaBuf(const RGYFrameInfo& frame, int fd, size_t size, cl_mem_flags flags) {
+    if (fd < 0 || frame.ptr[0] == nullptr || clCreateSubBuffer == nullptr) {
+        return std::unique_ptr<RGYCLFrame>();
+    }
+    if (!m_platform->dev(0).checkExtension("cl_arm_import_memory")
+        || !m_platform->dev(0).checkExtension("cl_arm_import_memory_dma_buf")
+        || m_platform->loadImportMemoryARM() != RGY_ERR_NONE) {
+        return std::unique_ptr<RGYCLFrame>();
+    }
+    flags &= ~(CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR);
+
+    const intptr_t importProps[] = { CL_IMPORT_TYPE_ARM, CL_IMPORT_TYPE_DMA_BUF_ARM, 0 };
+    cl_int err = CL_SUCCESS;
+    cl_mem memAll = clImportMemoryARM(m_context.get(), flags, importProps, &fd, size, &err);
+    if (memAll == nullptr || err != CL_SUCCESS) {
+        CL_LOG(RGY_LOG_DEBUG, _T("Failed to import dma-buf: %s\n"), cl_errmes(err));
+        return std::unique_ptr<RGYCLFrame>();
+    }
+    // 各planeはsub-bufferとして切り出す (originはCL_DEVICE_MEM_BASE_ADDR_ALIGNにそろっている必要がある)
+    const size_t baseAlign = std::max<size_t>(m_platform->dev(0).info().mem_base_addr_align / 8, 1);
+    RGYFrameInfo clframe = frame;
+    clframe.mem_type = RGY_MEM_TYPE_GPU;
+    for (int i = 0; i < _countof(clframe.ptr); i++) {
+        clframe.ptr[i] = nullptr;
+        clframe.pitch[i] = 0;
+    }
+    auto releaseFrame = [&clframe, memAll]() {
+        for (int j = 0; j < _countof(clframe.ptr); j++) {
+            if (clframe.ptr[j] != nullptr) {
+                clReleaseMemObject((cl_mem)clframe.ptr[j]);
+                clframe.ptr[j] = nullptr;
+            }
+        }
+        clReleaseMemObject(memAll);
+    };
+    for (int i = 0; i < RGY_CSP_PLANES[frame.csp]; i++) {
+        const auto plane = getPlane(&frame, (RGY_PLANE)i);
+        cl_buffer_region region;
+        region.origin = (size_t)(plane.ptr[0] - frame.ptr[0]);
+        region.size = (size_t)plane.pitch[0] * plane.height;
+        if (region.origin % baseAlign != 0 || region.origin + region.size > size) {
+            CL_LOG(RGY_LOG_DEBUG, _T("Failed to import dma-buf: plane %d offset %zu is not aligned to %zu.\n"), i, region.origin, baseAlign);
+            releaseFrame();
+            return std::unique_ptr<RGYCLFrame>();
+        }
+        cl_mem mem = clCreateSubBuffer(memAll, flags, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+        if (mem == nullptr || err != CL_SUCCESS) {
+            CL_LOG(RGY_LOG_DEBUG, _T("Failed to create sub buffer from dma-buf: %s\n"), cl_errmes(err));
+            releaseFrame();
+            return std::unique_ptr<RGYCLFrame>();
+        }
+        clframe.pitch[i] = plane.pitch[0];
+        clframe.ptr[i] = (uint8_t *)mem;
+    }
+    // sub-bufferが親のバッファへの参照を保持するので、ここでは解放してよい
+    clReleaseMemObject(memAll);
+    return std::make_unique<RGYCLFrame>(clframe, flags);
+}
+
 std::unique_ptr<RGYCLFrameInterop> RGYOpenCLContext::createFrameFromD3D9Surface(void *surf, HANDLE shared_handle, const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags) {
 #if !ENABLE_RGY_OPENCL_D3D9
     CL_LOG(RGY_LOG_ERROR, _T("OpenCL d3d9 interop not supported in this build.\n"));
@@ -64,11 +64,17 @@
 #include <va/va.h>
 #endif //ENABLE_RGY_OPENCL_VA
 #include <unordered_map>
+#include <map>
+#include <tuple>
 #include <vector>
 #include <array>
 #include <deque>
 #include <memory>
 #include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <typeindex>
 #include "rgy_err.h"
 #include "rgy_def.h"
@@ -202,6 +208,7 @@ CL_EXTERN cl_int (CL_API_CALL* f_clGetProgramInfo)(cl_program program, cl_progra
 CL_EXTERN cl_int (CL_API_CALL* f_clReleaseProgram) (cl_program program);
 
 CL_EXTERN cl_mem (CL_API_CALL* f_clCreateBuffer) (cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret);
+CL_EXTERN cl_mem (CL_API_CALL* f_clCreateSubBuffer) (cl_mem buffer, cl_mem_flags flags, cl_buffer_create_type buffer_create_type, const void *buffer_create_info, cl_int *errcode_ret);
 CL_EXTERN cl_mem (CL_API_CALL* f_clCreateImage)(cl_context context, cl_mem_flags flags, const cl_image_format *image_format, const cl_image_desc *image_desc, void *host_ptr, cl_int *errcode_ret);
 CL_EXTERN cl_mem (CL_API_CALL* f_clCreateImageWithProperties)(cl_context context, const cl_mem_properties *properties, cl_mem_flags flags, const cl_image_format *image_format, const cl_image_desc *image_desc, void *host_ptr, cl_int *errcode_ret);
 CL_EXTERN cl_int (CL_API_CALL* f_clReleaseMemObject) (cl_mem memobj);
@@ -252,6 +259,15 @@ CL_EXTERN cl_int(CL_API_CALL *f_clFinish)(cl_command_queue command_queue);
 CL_EXTERN cl_int(CL_API_CALL *f_clGetKernelSubGroupInfo)(cl_kernel kernel, cl_device_id device, cl_kernel_sub_group_info param_name, size_t input_value_size, const void *input_value, size_t param_value_size, void *param_value, size_t *param_value_size_ret);
 CL_EXTERN cl_int(CL_API_CALL *f_clGetKernelSubGroupInfoKHR)(cl_kernel kernel, cl_device_id device, cl_kernel_sub_group_info param_name, size_t input_value_size, const void *input_value, size_t param_value_size, void *param_value, size_t *param_value_size_ret);
 
+// cl_arm_import_memory (古いヘッダでは定義されていないので、ここで定義する)
+#ifndef CL_IMPORT_TYPE_ARM
+#define CL_IMPORT_TYPE_ARM 0x40B2
+#endif
+#ifndef CL_IMPORT_TYPE_DMA_BUF_ARM
+#define CL_IMPORT_TYPE_DMA_BUF_ARM 0x40B4
+#endif
+CL_EXTERN cl_mem(CL_API_CALL *f_clImportMemoryARM)(cl_context context, cl_mem_flags flags, const intptr_t *properties, void *memory, size_t size, cl_int *errcode_ret);
+
 #if ENABLE_RGY_OPENCL_D3D9
 CL_EXTERN cl_int (CL_API_CALL *f_clGetDeviceIDsFromDX9MediaAdapterKHR)(cl_platform_id platform, cl_uint num_media_adapters, cl_dx9_media_adapter_type_khr *media_adapter_type, void *media_adapters, cl_dx9_media_adapter_set_khr media_adapter_set, cl_uint num_entries, cl_device_id *devices, cl_uint *num_devices);
 CL_EXTERN cl_mem(CL_API_CALL *f_clCreateFromDX9MediaSurfaceKHR)(cl_context context, cl_mem_flags flags, cl_dx9_media_adapter_type_khr adapter_type, void *surface_info, cl_uint plane, cl_int *errcode_ret);
@@ -301,6 +317,7 @@ CL_EXTERN cl_int(CL_API_CALL* f_clEnqueueReleaseVA_APIMediaSurfacesINTEL)(cl_com
 #define clReleaseProgram f_clReleaseProgram
 
 #define clCreateBuffer f_clCreateBuffer
+#define clCreateSubBuffer f_clCreateSubBuffer
 #define clCreateImage f_clCreateImage
 #define clCreateImageWithProperties f_clCreateImageWithProperties
 #define clReleaseMemObject f_clReleaseMemObject
@@ -351,6 +368,8 @@ CL_EXTERN cl_int(CL_API_CALL* f_clEnqueueReleaseVA_APIMediaSurfacesINTEL)(cl_com
 #define clGetKernelSubGroupInfo f_clGetKernelSubGroupInfo
 #define clGetKernelSubGroupInfoKHR f_clGetKernelSubGroupInfoKHR
 
+#define clImportMemoryARM f_clImportMemoryARM
+
 #if ENABLE_RGY_OPENCL_D3D9
 #define clGetDeviceIDsFromDX9MediaAdapterKHR f_clGetDeviceIDsFromDX9MediaAdapterKHR
 #define clCreateFromDX9MediaSurfaceKHR f_clCreateFromDX9MediaSurfaceKHR
@@ -865,6 +884,7 @@ public:
     RGY_ERR createDeviceListD3D11(cl_device_type device_type, void *d3d11dev, const bool tryMode = false);
     RGY_ERR createDeviceListVA(cl_device_type device_type, void *devVA, const bool tryMode = false);
     RGY_ERR loadSubGroupKHR();
+    RGY_ERR loadImportMemoryARM();
     RGYOpenCLSubGroupSupport checkSubGroupSupport(const cl_device_id devid);
     cl_platform_id get() const { return m_platform; };
     const void *d3d9dev() const { return m_d3d9dev; };
@@ -957,6 +977,130 @@ public:
     size_t size() const { return size_; }
 };
 
+//プロファイル結果の通知先
+class RGYOpenCLProfileTarget {
+public:
+    virtual ~RGYOpenCLProfileTarget() {};
+    //kernelが空の場合は、マーカー間の時間 (フィルタ全体の時間)
+    virtual void addProfileTime(const std::string& kernel, double timeMs) = 0;
+};
+
+//プロファイル用のイベントをバックグラウンドで回収する
+//  呼び出し側はイベントを登録するだけで待機しないので、キューの実行を止めない
+//  完了したイベントから順に時間を取得し、RGYOpenCLProfileTargetに通知する
+//  回収が追いつかずMAX_PENDINGを超えた分は捨てる (dropped()に計上)
+class RGYOpenCLProfileCollector {
+public:
+    static const size_t MAX_PENDING = 4096;
+    static const int FLUSH_TIMEOUT_MS = 5000;
+
+    RGYOpenCLProfileCollector();
+    ~RGYOpenCLProfileCollector();
+
+    //startのCOMMAND_END ～ endのCOMMAND_STARTの時間
+    void addSpan(std::shared_ptr<RGYOpenCLProfileTarget> target, const RGYOpenCLEvent& start, const RGYOpenCLEvent& end);
+    //eventのCOMMAND_START ～ COMMAND_ENDの時間
+    void addKernel(std::shared_ptr<RGYOpenCLProfileTarget> target, const std::string& kernel, const RGYOpenCLEvent& event);
+    //登録済みのイベントをすべて回収するまで待つ
+    //timeoutMs以内に回収できなければ、未回収のものは捨ててfalseを返す
+    bool flush(int timeoutMs = FLUSH_TIMEOUT_MS);
+    //プロファイル情報が取得できず捨てたイベントの数
+    int64_t dropped() const { return m_dropped; }
+protected:
+    struct Entry {
+        std::shared_ptr<RGYOpenCLProfileTarget> target;
+        std::string kernel;
+        RGYOpenCLEvent start;
+        RGYOpenCLEvent end;
+    };
+    void run();
+    void add(Entry&& entry);
+    void collect(Entry& entry);
+    //イベントの完了を待つ (m_abort/m_cancelで中断)
+    bool waitEvent(const RGYOpenCLEvent& event);
+
+    std::mutex m_mtx;
+    std::condition_variable m_cvAdd;
+    std::condition_variable m_cvDone;
+    std::deque<Entry> m_pending;
+    int m_inflight;
+    bool m_abort;
+    std::atomic<bool> m_cancel; //flushがタイムアウトした場合に、回収中のイベントの待機を打ち切る
+    std::atomic<int64_t> m_dropped;
+    std::thread m_thread;
+};
+
+//このスコープの間に同じスレッドから起動したカーネルのイベントをcollectorに登録する
+//  (入れ子の場合は内側のスコープが優先)
+class RGYOpenCLProfileScope {
+public:
+    RGYOpenCLProfileScope(RGYOpenCLProfileCollector *collector, std::shared_ptr<RGYOpenCLProfileTarget> target);
+    ~RGYOpenCLProfileScope();
+    static RGYOpenCLProfileScope *current();
+    void addKernel(const std::string& kernel, const RGYOpenCLEvent& event);
+protected:
+    RGYOpenCLProfileCollector *m_collector;
+    std::shared_ptr<RGYOpenCLProfileTarget> m_target;
+    RGYOpenCLProfileScope *m_prev;
+};
+
+class RGYOpenCLContext;
+
+//時間方向のフィルタが参照する過去フレームの履歴
+//  (stage, timestamp, inputFrameId)をキーにフレームを参照カウント付きで共有し、同じフレームのコピーを一つにまとめる
+//  stageはフレームを出力したフィルタを表し、直後のフィルタはその出力をコピーせずに参照できる
+//  参照されなくなったバッファはプールに戻して再利用し、プールを含めた合計をlimit以内に抑える
+//  limitを超える場合は履歴の外に確保したフレーム(共有しない各フィルタ専用のコピー)を返す
+class RGYCLFrameHistory {
+public:
+    RGYCLFrameHistory(RGYOpenCLContext *cl, std::shared_ptr<RGYLog> log);
+    ~RGYCLFrameHistory();
+    //履歴とプールの合計の上限 (0で無制限)
+    void setLimit(const size_t limitBytes);
+    //frameInfoと同じ解像度・色空間のバッファを取得 (stageには未登録)
+    std::shared_ptr<RGYCLFrame> alloc(const RGYFrameInfo& frameInfo);
+    //出力したフレームをstageのフレームとして登録する (履歴の外に確保したフレームは登録しない)
+    void publish(const void *stage, const std::shared_ptr<RGYCLFrame>& frame);
+    //stageのframeを取得、未登録ならコピーして登録する
+    std::shared_ptr<RGYCLFrame> add(const void *stage, const RGYFrameInfo *frame, RGYOpenCLQueue& queue, RGY_ERR *err);
+    //eventはコピーしなかった場合もframeが使用可能になった時点で完了する
+    std::shared_ptr<RGYCLFrame> add(const void *stage, const RGYFrameInfo *frame, RGYOpenCLQueue& queue, const std::vector<RGYOpenCLEvent>& wait_events, RGYOpenCLEvent *event, RGY_ERR *err);
+    //frameのtimestamp等をキーに、stageのフレームが登録済みか
+    bool contains(const void *stage, const RGYFrameInfo *frame);
+    //stageのフレームを取得 (未登録ならnullptr)
+    std::shared_ptr<RGYCLFrame> get(const void *stage, const int64_t timestamp, const int inputFrameId);
+protected:
+    using Key = std::tuple<const void *, int64_t, int>;
+    struct Pool {
+        std::mutex mtx;
+        std::vector<std::unique_ptr<RGYCLFrame>> frames; //参照されなくなったバッファ
+        size_t limit;
+        size_t used;     //参照中のバッファのサイズ
+        size_t pooled;   //プール中のバッファのサイズ
+        size_t peak;
+        bool overLimitWarned;
+
+        Pool() : mtx(), frames(), limit(0), used(0), pooled(0), peak(0), overLimitWarned(false) {};
+        void trim(const size_t required);
+    };
+    //履歴の外に確保したフレームの解放 (publishで判別するため、型を分ける)
+    struct PrivateFrameDeleter {
+        void operator()(RGYCLFrame *frame) const { delete frame; }
+    };
+    static size_t frameBytes(const RGYFrameInfo& frame);
+    std::shared_ptr<RGYCLFrame> wrap(std::unique_ptr<RGYCLFrame> frame);
+    void removeExpired();
+
+    RGYOpenCLContext *m_cl;
+    std::shared_ptr<RGYLog> m_log;
+    std::shared_ptr<Pool> m_pool;
+    std::mutex m_mtx;
+    std::map<Key, std::weak_ptr<RGYCLFrame>> m_entries;
+    int64_t m_shared; //コピーせずに共有したフレーム数
+    int64_t m_copied; //コピーしたフレーム数
+    std::atomic<int64_t> m_private; //limitを超えたため履歴の外に確保したフレーム数
+};
+
 class RGYOpenCLKernelLauncher {
 public:
     RGYOpenCLKernelLauncher(cl_kernel kernel, std::string kernelName, RGYOpenCLQueue &queue, const RGYWorkSize &local, const RGYWorkSize &global, shared_ptr<RGYLog> pLog, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
@@ -1167,6 +1311,8 @@ public:
     std::unique_ptr<RGYCLFrame, RGYCLImageFromBufferDeleter> createImageFromFrameBuffer(const RGYFrameInfo &frame, const bool normalized, const cl_mem_flags flags, RGYCLFramePool *imgpool);
     std::unique_ptr<RGYCLFrame> createFrameBuffer(const int width, const int height, const RGY_CSP csp, const int bitdepth, const cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrame> createFrameBuffer(const RGYFrameInfo &frame, cl_mem_flags flags = CL_MEM_READ_WRITE);
+    std::unique_ptr<RGYCLFrame> createFrameFromHostPtr(const RGYFrameInfo &frame, cl_mem_flags flags = CL_MEM_READ_WRITE);
+    std::unique_ptr<RGYCLFrame> createFrameFromDmaBuf(const RGYFrameInfo &frame, int fd, size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrameInterop> createFrameFromD3D9Surface(void *surf, HANDLE shared_handle, const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrameInterop> createFrameFromD3D11Surface(void *surf, const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrameInterop> createFrameFromD3D11SurfacePlanar(const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags = CL_MEM_READ_WRITE);
@@ -1201,14 +1347,43 @@ public:
 
     std::vector<cl_image_format> getSupportedImageFormats(const cl_mem_object_type image_type = CL_MEM_OBJECT_IMAGE2D) const;
     tstring getSupportedImageFormatsStr(const cl_mem_object_type image_type = CL_MEM_OBJECT_IMAGE2D) const;
+    //CL_QUEUE_PROFILING_ENABLEでcontextを作成した場合のみ有効
+    RGYOpenCLProfileCollector *profileCollector() { return m_profile.get(); }
+    //同じソース・オプションのビルド結果を使いまわす (contextを複数のジョブで共有する場合用)
+    //  PROGRAM_CACHE_MAXを超えた場合は、最も長く使われていないものから破棄する
+    static const size_t PROGRAM_CACHE_MAX = 256;
+    void setProgramCache(const bool enable) { m_programCacheEnabled = enable; }
+    size_t programCacheCount();
+    bool programCached(const std::string& source, const std::string& options);
+    //ジョブの終了時に返却されたフレームを、次のジョブのcreateFrameBufferで使いまわす (contextを複数のジョブで共有する場合用)
+    //  returnFrameBufferにはcreateFrameBufferで確保したフレームのみ渡すこと
+    //  FRAME_CACHE_MAXを超えた場合は、古いものから破棄する
+    static const size_t FRAME_CACHE_MAX = 32;
+    void setFrameCache(const bool enable);
+    void returnFrameBuffer(std::unique_ptr<RGYCLFrame> frame);
+    size_t frameCacheCount();
+    //時間方向のフィルタで共有する過去フレームの履歴
+    RGYCLFrameHistory *frameHistory() { return m_frameHistory.get(); }
 protected:
     std::unique_ptr<RGYOpenCLProgram> buildProgram(std::string datacopy, const std::string options);
+    static std::string programCacheKey(const char *data, const size_t datalen, const std::string& options);
 
     shared_ptr<RGYOpenCLPlatform> m_platform;
     unique_context m_context;
     std::vector<RGYOpenCLQueue> m_queue;
     std::shared_ptr<RGYLog> m_log;
+    std::mutex m_copyMtx; //複数のジョブのスレッドから参照される場合があるので、m_copyはこのmutexで保護する
     std::unordered_map<std::string, RGYOpenCLProgramAsync> m_copy;
+    std::unique_ptr<RGYOpenCLProfileCollector> m_profile;
+    bool m_programCacheEnabled;
+    std::mutex m_programCacheMtx;
+    std::unordered_map<std::string, cl_program> m_programCache;
+    std::deque<std::string> m_programCacheOrder; //m_programCacheのkeyを使用された順に格納
+    bool m_frameCacheEnabled;
+    std::mutex m_frameCacheMtx;
+    std::deque<std::unique_ptr<RGYCLFrame>> m_frameCache; //返却された順に格納
+
+    std::unique_ptr<RGYCLFrameHistory> m_frameHistory;
     HMODULE m_hmodule;
 };
 
@@ -93,6 +93,7 @@ static int getStdInKey() {
 #include <cstring>
 #include <cwchar>
 #include <pthread.h>
+#include <sys/syscall.h>
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
@@ -239,6 +240,10 @@ static pthread_t GetCurrentThread() {
     return pthread_self();
 }
 
+static uint32_t GetCurrentThreadId() {
+    return (uint32_t)syscall(SYS_gettid);
+}
+
 static size_t SetProcessAffinityMask(pid_t process, size_t mask) {
     cpu_set_t cpuset_org;
     CPU_ZERO(&cpuset_org);
@@ -93,7 +93,11 @@ RGYOutput::RGYOutput() :
     m_readBuffer(),
     m_UVBuffer(),
     m_bsf(),
-    m_parse_nal_hevc(get_parse_nal_unit_hevc_func()) {
+    m_parse_nal_hevc(get_parse_nal_unit_hevc_func()),
+    m_memmem(get_memmem_func()),
+    m_metadataList(),
+    m_metadataHDR10plus(),
+    m_metadataDoviRpu() {
 }
 
 RGYOutput::~RGYOutput() {
@@ -334,186 +338,226 @@ RGY_ERR RGYOutput::InitVideoBsf(const VideoInfo *videoOutputInfo) {
     return RGY_ERR_NONE;
 }
 
+// metadataは呼び出し側の作業領域に書き込む (確保済みの領域を使いまわす)
 template<typename T>
-std::pair<RGY_ERR, std::vector<uint8_t>> RGYOutput::getMetadata(const RGYFrameDataType metadataType, const RGYTimestampMapVal& bs_framedata, const RGYFrameDataMetadataConvertParam *convPrm) {
+RGY_ERR RGYOutput::getMetadata(std::vector<uint8_t>& metadata, const RGYFrameDataType metadataType, const RGYTimestampMapVal& bs_framedata, const RGYFrameDataMetadataConvertParam *convPrm) {
+    metadata.clear();
     const auto frameDataMetadata = std::find_if(bs_framedata.dataList.begin(), bs_framedata.dataList.end(), [metadataType](const std::shared_ptr<RGYFrameData>& data) {
         return data->dataType() == metadataType;
         });
-    std::vector<uint8_t> metadata;
     if (frameDataMetadata != bs_framedata.dataList.end()) {
         auto frameDataPtr = dynamic_cast<T *>((*frameDataMetadata).get());
         if (!frameDataPtr) {
             AddMessage(RGY_LOG_ERROR, _T("Invalid cast to %s metadata.\n"));
-            return { RGY_ERR_UNSUPPORTED, metadata };
+            return RGY_ERR_UNSUPPORTED;
         }
         if (auto sts = frameDataPtr->convert(convPrm); sts != RGY_ERR_NONE) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to convert metadata: %s.\n"), get_err_mes(sts));
-            return { sts, metadata };
+            return sts;
         }
         if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
-            metadata = frameDataPtr->gen_nal();
+            frameDataPtr->gen_nal(metadata);
         } else if (m_VideoOutputInfo.codec == RGY_CODEC_AV1) {
-            metadata = frameDataPtr->gen_obu();
+            frameDataPtr->gen_obu(metadata);
         } else {
             AddMessage(RGY_LOG_ERROR, _T("Setting %s metadata not supported in %s encoding.\n"), RGYFrameDataTypeToStr(metadataType), CodecToStr(m_VideoOutputInfo.codec).c_str());
-            return { RGY_ERR_UNSUPPORTED, metadata };
+            return RGY_ERR_UNSUPPORTED;
         }
     }
-    return { RGY_ERR_NONE, metadata };
+    return RGY_ERR_NONE;
 }
 
 
+// bitstreamをコピーせず、その場でalpha_channel_informationのprefix SEIを上書きする
+// 該当するSEIを含まないパケットはstart codeの走査のみで抜ける
 RGY_ERR RGYOutput::OverwriteHEVCAlphaChannelInfoSEI(RGYBitstream *bitstream) {
     if (m_VideoOutputInfo.codec != RGY_CODEC_HEVC || !m_enableHEVCAlphaChannelInfoSEIOverwrite) {
         return RGY_ERR_NONE;
     }
-    RGYBitstream bsCopy = RGYBitstreamInit();
-    bsCopy.copy(bitstream);
-    const auto nal_list = m_parse_nal_hevc(bsCopy.data(), bsCopy.size());
-    const bool has_prefix_sei = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.nuh_layer_id == 0 && info.type == NALU_HEVC_PREFIX_SEI; }) != nal_list.end();
-    if (!has_prefix_sei) {
-        return RGY_ERR_NONE;
-    }
-
-    bitstream->setSize(0);
-    bitstream->setOffset(0);
-    for (const auto& nal : nal_list) {
-        if (nal.nuh_layer_id == 0 && nal.type == NALU_HEVC_PREFIX_SEI) {
-            auto ptr = nal.ptr;
-            int nal_header_size = 0;
-            static const uint8_t nal_header[4] = { 0x00, 0x00, 0x00, 0x01 };
-            if (memcmp(ptr, nal_header, 4) == 0) {
-                nal_header_size += 4;
-            } else if (memcmp(ptr, nal_header + 1, 3) == 0) {
-                nal_header_size += 3;
-            }
-            nal_header_size += 2;
-            ptr += nal_header_size;
-            const auto sei_data = unnal(ptr, nal.size - nal_header_size);
-            const auto sei_type = sei_data[0];
-            if (sei_type == ALPHA_CHANNEL_INFO) { // alpha_channel_information
-                const auto nalbuf = gen_hevc_alpha_channel_info_sei(m_HEVCAlphaChannelMode);
-                bitstream->append(nalbuf.data(), nalbuf.size());
-            } else {
-                bitstream->append(nal.ptr, nal.size);
+    static const uint8_t start_code[3] = { 0, 0, 1 };
+    std::vector<uint8_t> nalbuf; // 置き換えるSEI (見つかった場合のみ生成する)
+    for (size_t i = 0;;) {
+        uint8_t *data = bitstream->data();
+        const size_t size = bitstream->size();
+        if (i + 5 > size) break;
+        const auto next = m_memmem(data + i, size - i, start_code, sizeof(start_code));
+        if (next == RGY_MEMMEM_NOT_FOUND || i + next + 5 > size) break;
+        i += next;
+        const uint8_t nal_type = (data[i + 3] & 0x7f) >> 1;
+        const uint8_t nuh_layer_id = ((data[i + 3] & 1) << 5) | ((data[i + 4] & 0xf8) >> 3);
+        // sei_typeは先頭の1byteなので、emulation prevention byteの影響を受けない
+        if (nal_type != NALU_HEVC_PREFIX_SEI || nuh_layer_id != 0 || i + 5 >= size || data[i + 5] != ALPHA_CHANNEL_INFO) {
+            i += 3;
+            continue;
+        }
+        // NALの範囲は、0x00 0x00 0x00 0x01の場合は先頭の0x00から、次のNALの直前まで (parse_nal_unit_hevcと同じ)
+        const size_t nalStart = i - (i > 0 && data[i - 1] == 0);
+        size_t nalEnd = size;
+        if (const auto nextNal = m_memmem(data + i + 3, size - i - 3, start_code, sizeof(start_code)); nextNal != RGY_MEMMEM_NOT_FOUND) {
+            const size_t j = i + 3 + nextNal;
+            nalEnd = j - (data[j - 1] == 0);
+        }
+        if (nalbuf.size() == 0) {
+            nalbuf = gen_hevc_alpha_channel_info_sei(m_HEVCAlphaChannelMode);
+        }
+        const size_t nalSize = nalEnd - nalStart;
+        if (nalbuf.size() != nalSize) {
+            const size_t newSize = size - nalSize + nalbuf.size();
+            if (bitstream->bufsize() < newSize) {
+                auto sts = bitstream->changeSize(newSize + (std::max<size_t>)(newSize / 4, 4096));
+                if (sts != RGY_ERR_NONE) {
+                    AddMessage(RGY_LOG_ERROR, _T("Failed to allocate buffer to overwrite alpha channel info SEI.\n"));
+                    return sts;
+                }
+            } else if (bitstream->bufsize() < bitstream->offset() + newSize) {
+                bitstream->trim();
             }
-        } else {
-            bitstream->append(nal.ptr, nal.size);
+            data = bitstream->data();
+            memmove(data + nalStart + nalbuf.size(), data + nalEnd, size - nalEnd);
+            bitstream->setSize(newSize);
         }
+        memcpy(data + nalStart, nalbuf.data(), nalbuf.size());
+        i = nalStart + nalbuf.size();
     }
     return RGY_ERR_NONE;
 }
 
-RGY_ERR RGYOutput::InsertMetadata(RGYBitstream *bitstream, std::vector<std::unique_ptr<RGYOutputInsertMetadata>>& metadataList) {
+// bitstreamをコピーせず、その場でmetadataを挿入する
+// 挿入位置は
+//  - onSequenceHeader/appendix以外: ヘッダ(VPS/SPS/PPS, AV1ではTD/SequenceHeader)の直後、ヘッダがなければ先頭
+//  - appendix: 末尾
+// の2か所のみなので、必要なサイズを先に確保して後ろ側のデータを1回だけmemmoveする
+RGY_ERR RGYOutput::InsertMetadata(RGYBitstream *bitstream, std::vector<RGYOutputInsertMetadata>& metadataList) {
     if (metadataList.size() == 0) {
         return RGY_ERR_NONE;
     }
+    const uint8_t *data = bitstream->data();
+    const size_t size = bitstream->size();
+    static const size_t INSERT_POS_NOT_FOUND = std::numeric_limits<size_t>::max();
+    size_t insertPos = INSERT_POS_NOT_FOUND; // appendix以外のmetadataの挿入位置
+    bool header_check = false;
     if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
-        RGYBitstream bsCopy = RGYBitstreamInit();
-        bsCopy.copy(bitstream);
-        const auto nal_list = m_parse_nal_hevc(bsCopy.data(), bsCopy.size());
-        const auto hevc_vps_nal = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.type == NALU_HEVC_VPS; });
-        const auto hevc_sps_nal = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.type == NALU_HEVC_SPS; });
-        const auto hevc_pps_nal = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.type == NALU_HEVC_PPS; });
-        const bool header_check = (nal_list.end() != hevc_vps_nal) || (nal_list.end() != hevc_sps_nal) || (nal_list.end() != hevc_pps_nal);
-
-        // onSequenceHeader = trueの場合、ヘッダーがない場合は、written=trueにして書き込まないようにする
-        for (auto& metadata : metadataList) {
-            if (metadata->onSequenceHeader && !header_check) {
-                metadata->written = true;
+        static const uint8_t start_code[3] = { 0, 0, 1 };
+        bool prevIsHeader = false;
+        for (size_t i = 0; i + 5 <= size;) {
+            const auto next = m_memmem(data + i, size - i, start_code, sizeof(start_code));
+            if (next == RGY_MEMMEM_NOT_FOUND || i + next + 5 > size) break;
+            i += next;
+            const uint8_t nal_type = (data[i + 3] & 0x7f) >> 1;
+            const bool isHeader = nal_type == NALU_HEVC_VPS || nal_type == NALU_HEVC_SPS || nal_type == NALU_HEVC_PPS;
+            header_check |= isHeader;
+            if (prevIsHeader && !isHeader) {
+                insertPos = i - (i > 0 && data[i - 1] == 0); // 0x00 0x00 0x00 0x01の場合は先頭の0x00から
+                break;
             }
+            prevIsHeader = isHeader;
+            i += 3;
         }
-
-        bitstream->setSize(0);
-        bitstream->setOffset(0);
-        if (!header_check) {
-            for (auto& metadata : metadataList) {
-                if (!metadata->written && !metadata->appendix) {
-                    bitstream->append(metadata->mdata.data(), metadata->mdata.size());
-                    metadata->written = true;
-                }
+    } else if (m_VideoOutputInfo.codec == RGY_CODEC_AV1) {
+        bool has_seq_header = false, has_td = false, prevIsHeader = false;
+        for (size_t i = 0; i < size;) {
+            const uint8_t firstbyte = data[i];
+            const uint8_t obu_type = (firstbyte & 0x78) >> 3;
+            const size_t extension_flag = (firstbyte & 0x04) >> 2;
+            const bool has_size_flag = (firstbyte & 0x02) != 0;
+            const bool isHeader = obu_type == OBU_TEMPORAL_DELIMITER || obu_type == OBU_SEQUENCE_HEADER;
+            has_seq_header |= obu_type == OBU_SEQUENCE_HEADER;
+            has_td |= obu_type == OBU_TEMPORAL_DELIMITER;
+            if (prevIsHeader && !isHeader && insertPos == INSERT_POS_NOT_FOUND) {
+                insertPos = i; // SequenceHeaderの有無の確認のため、最後まで走査する
             }
-        }
-        for (int i = 0; i < (int)nal_list.size(); i++) {
-            bitstream->append(nal_list[i].ptr, nal_list[i].size);
-            if (nal_list[i].type == NALU_HEVC_VPS || nal_list[i].type == NALU_HEVC_SPS || nal_list[i].type == NALU_HEVC_PPS) {
-                if (i + 1 < (int)nal_list.size()
-                    && (nal_list[i + 1].type != NALU_HEVC_VPS && nal_list[i + 1].type != NALU_HEVC_SPS && nal_list[i + 1].type != NALU_HEVC_PPS)) {
-                    for (auto& metadata : metadataList) {
-                        if (!metadata->written && !metadata->appendix) {
-                            bitstream->append(metadata->mdata.data(), metadata->mdata.size());
-                            metadata->written = true;
-                        }
-                    }
+            prevIsHeader = isHeader;
+            size_t unit_size = size - i;
+            if (has_size_flag) {
+                size_t pos = i + 1 + extension_flag;
+                size_t obu_size = 0;
+                for (int j = 0; j < 8 && pos < size; j++) {
+                    const uint8_t byte = data[pos++];
+                    obu_size |= (size_t)(byte & 0x7f) << (j * 7);
+                    if (!(byte & 0x80))
+                        break;
                 }
+                unit_size = obu_size + (pos - i);
             }
+            if (unit_size == 0) break;
+            i += unit_size;
         }
-        for (auto& metadata : metadataList) {
-            if (!metadata->written && metadata->appendix) {
-                bitstream->append(metadata->mdata.data(), metadata->mdata.size());
-                metadata->written = true;
-            }
-        }
-        bsCopy.clear();
-        for (auto& metadata : metadataList) {
-            if (!metadata->written) {
-                AddMessage(RGY_LOG_ERROR, _T("metadata not written, unexpected HEVC header.\n"));
-                return RGY_ERR_UNDEFINED_BEHAVIOR;
+        // AV1ではTDがあればヘッダありとして扱う
+        header_check = has_seq_header || has_td;
+        if (!has_seq_header) {
+            // onSequenceHeader = trueの場合、ヘッダーがない場合は、written=trueにして書き込まないようにする
+            for (auto& metadata : metadataList) {
+                if (metadata.onSequenceHeader) {
+                    metadata.written = true;
+                }
             }
         }
-    } else if (m_VideoOutputInfo.codec == RGY_CODEC_AV1) {
-        const auto av1_units = parse_unit_av1(bitstream->data(), bitstream->size());
-        bitstream->setSize(0);
-        bitstream->setOffset(0);
-
-        const auto has_seq_header = std::find_if(av1_units.begin(), av1_units.end(), [](const std::unique_ptr<unit_info>& info) { return info->type == OBU_SEQUENCE_HEADER; }) != av1_units.end();
-        const auto has_td = std::find_if(av1_units.begin(), av1_units.end(), [](const std::unique_ptr<unit_info>& info) { return info->type == OBU_TEMPORAL_DELIMITER; }) != av1_units.end();
-
+    } else {
+        AddMessage(RGY_LOG_ERROR, _T("Setting metadata not supported in %s encoding.\n"), CodecToStr(m_VideoOutputInfo.codec).c_str());
+        return RGY_ERR_UNSUPPORTED;
+    }
+    if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC && !header_check) {
         // onSequenceHeader = trueの場合、ヘッダーがない場合は、written=trueにして書き込まないようにする
         for (auto& metadata : metadataList) {
-            if (metadata->onSequenceHeader && !has_seq_header) {
-                metadata->written = true;
+            if (metadata.onSequenceHeader) {
+                metadata.written = true;
             }
         }
+    }
+    if (!header_check) {
+        insertPos = 0;
+    }
 
-        if (!has_seq_header && !has_td) {
-            for (auto& metadata : metadataList) {
-                if (!metadata->written && !metadata->appendix) {
-                    bitstream->append(metadata->mdata.data(), metadata->mdata.size());
-                    metadata->written = true;
-                }
+    size_t insertSize = 0;   // insertPosに挿入するサイズ
+    size_t appendixSize = 0; // 末尾に追加するサイズ
+    for (const auto& metadata : metadataList) {
+        if (metadata.written) continue;
+        if (metadata.appendix) {
+            appendixSize += metadata.size;
+        } else if (insertPos != INSERT_POS_NOT_FOUND) {
+            insertSize += metadata.size;
+        }
+    }
+    const size_t newSize = size + insertSize + appendixSize;
+    if (newSize > size) {
+        if (bitstream->bufsize() < newSize) {
+            // 次のフレーム以降で再確保しなくて済むよう、余裕をもって確保する
+            auto sts = bitstream->changeSize(newSize + (std::max<size_t>)(newSize / 4, 4096));
+            if (sts != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("Failed to allocate buffer to insert metadata.\n"));
+                return sts;
             }
+        } else if (bitstream->bufsize() < bitstream->offset() + newSize) {
+            bitstream->trim();
         }
-
-        for (size_t i = 0; i < av1_units.size(); i++) {
-            bitstream->append(av1_units[i]->unit_data.data(), av1_units[i]->unit_data.size());
-            if (av1_units[i]->type == OBU_TEMPORAL_DELIMITER || av1_units[i]->type == OBU_SEQUENCE_HEADER) {
-                if (i + 1 < av1_units.size()
-                    && (av1_units[i + 1]->type != OBU_TEMPORAL_DELIMITER && av1_units[i + 1]->type != OBU_SEQUENCE_HEADER)) {
-                    for (auto& metadata : metadataList) {
-                        if (!metadata->written && !metadata->appendix) {
-                            bitstream->append(metadata->mdata.data(), metadata->mdata.size());
-                            metadata->written = true;
-                        }
-                    }
+        uint8_t *dst = bitstream->data();
+        if (insertSize > 0) {
+            memmove(dst + insertPos + insertSize, dst + insertPos, size - insertPos);
+            uint8_t *ptr = dst + insertPos;
+            for (auto& metadata : metadataList) {
+                if (!metadata.written && !metadata.appendix) {
+                    memcpy(ptr, metadata.ptr, metadata.size);
+                    ptr += metadata.size;
+                    metadata.written = true;
                 }
             }
         }
+        uint8_t *ptr = dst + size + insertSize;
         for (auto& metadata : metadataList) {
-            if (!metadata->written && metadata->appendix) {
-                bitstream->append(metadata->mdata.data(), metadata->mdata.size());
-                metadata->written = true;
+            if (!metadata.written && metadata.appendix) {
+                memcpy(ptr, metadata.ptr, metadata.size);
+                ptr += metadata.size;
+                metadata.written = true;
             }
         }
-        for (auto& metadata : metadataList) {
-            if (!metadata->written) {
-                AddMessage(RGY_LOG_ERROR, _T("metadata not written, unexpected AV1 frame.\n"));
-                return RGY_ERR_UNDEFINED_BEHAVIOR;
-            }
+        bitstream->setSize(newSize);
+    }
+    for (auto& metadata : metadataList) {
+        if (!metadata.written) {
+            AddMessage(RGY_LOG_ERROR, _T("metadata not written, unexpected %s %s.\n"), CodecToStr(m_VideoOutputInfo.codec).c_str(),
+                (m_VideoOutputInfo.codec == RGY_CODEC_AV1) ? _T("frame") : _T("header"));
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
         }
-    } else {
-        AddMessage(RGY_LOG_ERROR, _T("Setting metadata not supported in %s encoding.\n"), CodecToStr(m_VideoOutputInfo.codec).c_str());
-        return RGY_ERR_UNSUPPORTED;
     }
     return RGY_ERR_NONE;
 }
@@ -791,6 +835,12 @@ RGY_ERR RGYOutputRaw::WriteNextFrame(RGYBitstream *pBitstream) {
 RGY_ERR RGYOutputRaw::WriteNextOneFrame(RGYBitstream *pBitstream) {
     size_t nBytesWritten = 0;
     if (m_noOutput) {
+        // 出力はしないが、タイムスタンプの回収と統計情報の更新は行う
+        if (m_timestamp) {
+            m_timestamp->get(pBitstream->pts());
+        }
+        m_encSatusInfo->SetOutputData(pBitstream->frametype(), pBitstream->size(), 0);
+        pBitstream->setSize(0);
         return RGY_ERR_NONE;
     }
 
@@ -814,36 +864,36 @@ RGY_ERR RGYOutputRaw::WriteNextOneFrame(RGYBitstream *pBitstream) {
         return RGY_ERR_UNDEFINED_BEHAVIOR;
     }
 
-    std::vector<std::unique_ptr<RGYOutputInsertMetadata>> metadataList;
+    // metadataList, metadataの作業領域は使いまわし、フレームごとの確保を避ける
+    auto& metadataList = m_metadataList;
+    metadataList.clear();
     if (m_hdrBitstream.size() > 0) {
-        std::vector<uint8_t> data(m_hdrBitstream.data(), m_hdrBitstream.data() + m_hdrBitstream.size());
-        metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(data, true, false));
+        metadataList.emplace_back(m_hdrBitstream.data(), m_hdrBitstream.size(), true, false);
     }
     if (m_hdr10plusMetadataCopy) {
-        auto [err_hdr10plus, metadata_hdr10plus] = getMetadata<RGYFrameDataHDR10plus>(RGY_FRAME_DATA_HDR10PLUS, bs_framedata, nullptr);
+        auto err_hdr10plus = getMetadata<RGYFrameDataHDR10plus>(m_metadataHDR10plus, RGY_FRAME_DATA_HDR10PLUS, bs_framedata, nullptr);
         if (err_hdr10plus != RGY_ERR_NONE) {
             return err_hdr10plus;
         }
-        if (metadata_hdr10plus.size() > 0) {
-            metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(metadata_hdr10plus, false, false));
+        if (m_metadataHDR10plus.size() > 0) {
+            metadataList.emplace_back(m_metadataHDR10plus.data(), m_metadataHDR10plus.size(), false, false);
         }
     }
     if (m_doviRpu) {
-        std::vector<uint8_t> dovi_nal;
-        if (m_doviRpu->get_next_rpu(dovi_nal, bs_framedata.inputFrameId, m_VideoOutputInfo.codec) != 0) {
+        if (m_doviRpu->get_next_rpu(m_metadataDoviRpu, bs_framedata.inputFrameId, m_VideoOutputInfo.codec) != 0) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to get dovi rpu for %lld.\n"), bs_framedata.inputFrameId);
         }
-        if (dovi_nal.size() > 0) {
-            metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(dovi_nal, false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false));
+        if (m_metadataDoviRpu.size() > 0) {
+            metadataList.emplace_back(m_metadataDoviRpu.data(), m_metadataDoviRpu.size(), false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false);
         }
     } else if (m_doviRpuMetadataCopy) {
         auto doviRpuConvPrm = (m_doviProfileDst == RGY_DOVI_PROFILE_COPY) ? std::make_unique<RGYFrameDataDOVIRpuConvertParam>(m_doviProfileDst) : nullptr;
-        auto [err_dovirpu, metadata_dovi_rpu] = getMetadata<RGYFrameDataDOVIRpu>(RGY_FRAME_DATA_DOVIRPU, bs_framedata, doviRpuConvPrm.get());
+        auto err_dovirpu = getMetadata<RGYFrameDataDOVIRpu>(m_metadataDoviRpu, RGY_FRAME_DATA_DOVIRPU, bs_framedata, doviRpuConvPrm.get());
         if (err_dovirpu != RGY_ERR_NONE) {
             return err_dovirpu;
         }
-        if (metadata_dovi_rpu.size() > 0) {
-            metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(metadata_dovi_rpu, false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false));
+        if (m_metadataDoviRpu.size() > 0) {
+            metadataList.emplace_back(m_metadataDoviRpu.data(), m_metadataDoviRpu.size(), false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false);
         }
     }
 
@@ -1164,6 +1214,7 @@ RGY_ERR initWriters(
     const bool benchmark,
     const bool HEVCAlphaChannel,
     const int HEVCAlphaChannelMode,
+    const bool videoParamSetsInBand,
     RGYPoolAVPacket *poolPkt,
     RGYPoolAVFrame *poolFrame,
     shared_ptr<EncodeStatus> pStatus,
@@ -1238,7 +1289,9 @@ RGY_ERR initWriters(
         writerPrm.debugDirectAV1Out       = common->debugDirectAV1Out;
         writerPrm.HEVCAlphaChannel        = HEVCAlphaChannel;
         writerPrm.HEVCAlphaChannelMode    = HEVCAlphaChannelMode;
+        writerPrm.videoParamSetsInBand    = videoParamSetsInBand;
         writerPrm.muxOpt                  = common->muxOpt;
+        writerPrm.segment                 = common->segment;
         writerPrm.poolPkt                 = poolPkt;
         writerPrm.poolFrame               = poolFrame;
         auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(pFileReader);
@@ -39,6 +39,7 @@
 #include "rgy_status.h"
 #include "rgy_avutil.h"
 #include "rgy_bitstream.h"
+#include "rgy_memmem.h"
 #include "rgy_input.h"
 #if ENCODER_NVENC
 #include "NVEncUtil.h"
@@ -65,97 +66,222 @@ struct RGYTimestampMapVal {
     std::vector<std::shared_ptr<RGYFrameData>> dataList;
 
     RGYTimestampMapVal() : timestamp(-1), inputFrameId(-1), encodeFrameId(-1), duration(-1), dataList() {};
-    RGYTimestampMapVal(int64_t timestamp_, int64_t inputFrameId_, int64_t encodeFrameId_, int64_t duration_, std::vector<std::shared_ptr<RGYFrameData>>& datalist)
-        : timestamp(timestamp_), inputFrameId(inputFrameId_), encodeFrameId(encodeFrameId_), duration(duration_), dataList(datalist) {};
+    RGYTimestampMapVal(int64_t timestamp_, int64_t inputFrameId_, int64_t encodeFrameId_, int64_t duration_, std::vector<std::shared_ptr<RGYFrameData>> datalist)
+        : timestamp(timestamp_), inputFrameId(inputFrameId_), encodeFrameId(encodeFrameId_), duration(duration_), dataList(std::move(datalist)) {};
     void addMetadata(std::shared_ptr<RGYFrameData>& data) { dataList.push_back(data); }
     void addMetadata(std::vector<std::shared_ptr<RGYFrameData>>& list) { dataList.insert(dataList.end(), list.begin(), list.end()); }
 };
 
+// 出力スレッドの映像キューの上限 (RGYOutputAvcodec)
+static inline int rgy_output_video_queue_max(const rgy_rational<int>& outputFps) {
+    return (std::max)(256, (outputFps.d()) ? outputFps.n() * 4 / outputFps.d() : 0);
+}
+
+// 登録順の通し番号(seq)をindexとするリングバッファでフレームの時刻情報を管理する
+// 取り出し済み(あるいはwriterが読み飛ばした)フレームはリングが一周した時点で上書きされるので、明示的な削除は不要
+// まだ取り出されていないフレームを上書きしようとした場合は、add()がエラーを返す
 class RGYTimestamp {
 private:
-    std::unordered_map<int64_t, RGYTimestampMapVal> m_frame;
+    static const int64_t RING_SIZE_MIN = 1024;
+    struct RGYTimestampIdx {
+        int64_t id, seq;
+    };
+    int64_t m_ringSize;                         // 2の累乗
+    std::vector<RGYTimestampMapVal> m_frame;    // seq -> フレーム情報
+    std::vector<uint8_t> m_taken;               // seq -> 取り出し済みか
+    std::vector<RGYTimestampIdx> m_encodeIdIdx; // encodeFrameId -> seq
+    std::vector<RGYTimestampIdx> m_ptsIdx;      // pts -> seq (open addressing, 線形探索, サイズはリングの2倍)
     std::mutex mtx;
-    int64_t last_add_pts;
-    int64_t last_check_pts;
+    int64_t add_seq;
+    int64_t last_add_seq;
+    int64_t last_check_seq;
+    int64_t last_take_seq; // 取り出されたフレームの最大のseq
     int64_t last_input_frame_id;
     int64_t offset;
-    int64_t last_clean_id;
     bool timestampPassThrough;
+
+    static int64_t ringSize(const int queueDepth) {
+        // 出力キューに加え、エンコーダ内で処理中のフレームが入るよう、2倍の余裕を持たせる
+        int64_t size = RING_SIZE_MIN;
+        while (size < (int64_t)queueDepth * 2) {
+            size <<= 1;
+        }
+        return size;
+    }
+    RGYTimestampMapVal *slot(const int64_t seq) { return &m_frame[(size_t)(seq & (m_ringSize - 1))]; }
+    bool valid(const int64_t seq) const { return seq >= 0 && seq < add_seq && seq >= add_seq - m_ringSize; }
+    size_t ptsHash(const int64_t pts) const {
+        uint64_t h = (uint64_t)pts * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+        return (size_t)(h & (uint64_t)(m_ptsIdx.size() - 1));
+    }
+    size_t ptsIdxPos(const int64_t pts) const { // ptsの位置、なければ空きの位置を返す
+        const size_t mask = m_ptsIdx.size() - 1;
+        size_t i = ptsHash(pts);
+        while (m_ptsIdx[i].seq >= 0 && m_ptsIdx[i].id != pts) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    void ptsIdxErase(const int64_t pts, const int64_t seq) {
+        const size_t mask = m_ptsIdx.size() - 1;
+        size_t i = ptsIdxPos(pts);
+        if (m_ptsIdx[i].seq != seq) {
+            return; // 後から同じptsで登録されたフレームの索引は残す
+        }
+        // 削除した位置より後ろの要素を詰める (backward shift deletion)
+        for (size_t j = (i + 1) & mask; m_ptsIdx[j].seq >= 0; j = (j + 1) & mask) {
+            const size_t home = ptsHash(m_ptsIdx[j].id);
+            const bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+            if (movable) {
+                m_ptsIdx[i] = m_ptsIdx[j];
+                i = j;
+            }
+        }
+        m_ptsIdx[i] = RGYTimestampIdx{ -1, -1 };
+    }
+    int64_t findPts(const int64_t pts) const {
+        const auto& idx = m_ptsIdx[ptsIdxPos(pts)];
+        return (idx.seq >= 0 && valid(idx.seq)) ? idx.seq : -1;
+    }
+    int64_t findEncodeFrameID(const int64_t id) const {
+        if (id < 0) return -1;
+        const auto& idx = m_encodeIdIdx[(size_t)(id & (m_ringSize - 1))];
+        return (idx.id == id && valid(idx.seq)) ? idx.seq : -1;
+    }
+    // 登録したseqを返す、まだ取り出されていないフレームを上書きすることになる場合は-1を返す
+    int64_t push(RGYTimestampMapVal&& val) {
+        const int64_t seq = add_seq;
+        auto target = slot(seq);
+        const auto targetIdx = (size_t)(seq & (m_ringSize - 1));
+        if (seq >= m_ringSize) {
+            const int64_t overwriteSeq = seq - m_ringSize;
+            // writerがすでに先のフレームを取り出していれば、読み飛ばされたフレームなので上書きしてよい
+            if (!m_taken[targetIdx] && overwriteSeq > last_take_seq) {
+                return -1;
+            }
+            ptsIdxErase(target->timestamp, overwriteSeq); // 上書きされるフレームの索引を削除
+        }
+        add_seq++;
+        *target = std::move(val);
+        m_taken[targetIdx] = 0;
+        auto& ptsIdx = m_ptsIdx[ptsIdxPos(target->timestamp)];
+        ptsIdx.id = target->timestamp;
+        ptsIdx.seq = seq;
+        if (target->encodeFrameId >= 0) {
+            auto& idx = m_encodeIdIdx[(size_t)(target->encodeFrameId & (m_ringSize - 1))];
+            if (idx.id != target->encodeFrameId || !valid(idx.seq)) { // 同じencodeFrameIdなら、先に登録されたほうを優先
+                idx.id = target->encodeFrameId;
+                idx.seq = seq;
+            }
+        }
+        return seq;
+    }
+    // 時刻情報をコピーし、metadataは移動して返す (取り出し後は参照されない)
+    RGYTimestampMapVal take(const int64_t seq) {
+        auto target = slot(seq);
+        m_taken[(size_t)(seq & (m_ringSize - 1))] = 1;
+        last_take_seq = (std::max)(last_take_seq, seq);
+        RGYTimestampMapVal ret(target->timestamp, target->inputFrameId, target->encodeFrameId, target->duration, std::move(target->dataList));
+        target->dataList.clear();
+        return ret;
+    }
+    // metadataを除いた時刻情報を返す
+    RGYTimestampMapVal timeInfo(const int64_t seq) {
+        auto pos = slot(seq);
+        return RGYTimestampMapVal(pos->timestamp, pos->inputFrameId, pos->encodeFrameId, pos->duration, {});
+    }
+    void reset() {
+        m_frame.assign((size_t)m_ringSize, RGYTimestampMapVal());
+        m_taken.assign((size_t)m_ringSize, 0);
+        m_encodeIdIdx.assign((size_t)m_ringSize, RGYTimestampIdx{ -1, -1 });
+        m_ptsIdx.assign((size_t)m_ringSize * 2, RGYTimestampIdx{ -1, -1 });
+        add_seq = 0;
+        last_add_seq = -1;
+        last_check_seq = -1;
+        last_take_seq = -1;
+    }
 public:
-    RGYTimestamp(bool timestampPassThrough_) : m_frame(), mtx(), last_add_pts(-1), last_check_pts(-1), offset(0), last_clean_id(-1), timestampPassThrough(timestampPassThrough_) {};
+    // queueDepth: 登録から取り出しまでの間に滞留しうるフレーム数 (出力キューの上限)
+    RGYTimestamp(bool timestampPassThrough_, int queueDepth = 0) : m_ringSize(ringSize(queueDepth)), m_frame(), m_taken(), m_encodeIdIdx(), m_ptsIdx(), mtx(),
+        add_seq(0), last_add_seq(-1), last_check_seq(-1), last_take_seq(-1), last_input_frame_id(-1), offset(0), timestampPassThrough(timestampPassThrough_) {
+        reset();
+    };
     ~RGYTimestamp() {};
+    int64_t size() const { return m_ringSize; }
     void clear() {
         std::lock_guard<std::mutex> lock(mtx);
-        m_frame.clear();
-        last_check_pts = -1;
+        reset();
         offset = 0;
     }
-    void add(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration, std::vector<std::shared_ptr<RGYFrameData>> metadatalist) {
+    RGY_ERR add(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration, std::vector<std::shared_ptr<RGYFrameData>> metadatalist) {
         std::lock_guard<std::mutex> lock(mtx);
-        if (last_add_pts >= 0) { // 前のフレームのdurationの更新
-            auto& last_add_pos = m_frame.find(last_add_pts)->second;
-            last_add_pos.duration = pts - last_add_pos.timestamp;
-            if (duration == 0) duration = last_add_pos.duration;
+        int64_t last_duration = -1;
+        if (valid(last_add_seq)) { // 前のフレームのdurationの更新
+            auto last_add_pos = slot(last_add_seq);
+            last_duration = last_add_pos->duration;
+            last_add_pos->duration = pts - last_add_pos->timestamp;
+            if (duration == 0) duration = last_add_pos->duration;
         }
-        m_frame[pts] = RGYTimestampMapVal(pts, inputFrameId, encodeFrameId, duration, metadatalist);
-        last_add_pts = pts;
+        const auto seq = push(RGYTimestampMapVal(pts, inputFrameId, encodeFrameId, duration, std::move(metadatalist)));
+        if (seq < 0) {
+            if (valid(last_add_seq)) {
+                slot(last_add_seq)->duration = last_duration;
+            }
+            return RGY_ERR_NOT_ENOUGH_BUFFER;
+        }
+        last_add_seq = seq;
+        return RGY_ERR_NONE;
     }
+    // metadataは取り出さずに、時刻情報のみ返す
     RGYTimestampMapVal check(int64_t pts) {
-        if (last_check_pts < 0 && pts > 0 && !timestampPassThrough) {
+        if (last_check_seq < 0 && pts > 0 && !timestampPassThrough) {
             offset = -pts;
         }
         std::lock_guard<std::mutex> lock(mtx);
         pts += offset;
-        auto pos = m_frame.find(pts);
-        if (pos == m_frame.end()) {
-            auto& last_check_pos = m_frame.find(last_check_pts)->second;
-            pts = last_check_pos.timestamp + last_check_pos.duration / 2;
-            auto next_pts = last_check_pos.timestamp + last_check_pos.duration;
-            last_check_pos.duration = pts - last_check_pos.timestamp;
-            m_frame[pts] = RGYTimestampMapVal(pts, last_input_frame_id, last_check_pos.encodeFrameId, next_pts - pts, last_check_pos.dataList);
-            pos = m_frame.find(pts);
-        }
-        last_input_frame_id = pos->second.inputFrameId;
-        last_check_pts = pos->second.timestamp;
-        return pos->second;
-    }
-    void clean(const int64_t current_id) {
-        if (current_id >= last_clean_id + 64) {
-            for (auto it = m_frame.begin(); it != m_frame.end();) {
-                if (it->second.inputFrameId < current_id - 64) {
-                    it = m_frame.erase(it);
-                } else {
-                    it++;
-                }
+        auto seq = findPts(pts);
+        if (seq < 0) {
+            if (!valid(last_check_seq)) {
+                return RGYTimestampMapVal();
+            }
+            auto last_check_pos = slot(last_check_seq);
+            const auto half_pts = last_check_pos->timestamp + last_check_pos->duration / 2;
+            const auto next_pts = last_check_pos->timestamp + last_check_pos->duration;
+            seq = push(RGYTimestampMapVal(half_pts, last_input_frame_id, last_check_pos->encodeFrameId, next_pts - half_pts, last_check_pos->dataList));
+            if (seq < 0) {
+                return RGYTimestampMapVal();
             }
-            last_clean_id = current_id;
+            last_check_pos->duration = half_pts - last_check_pos->timestamp;
         }
+        last_input_frame_id = slot(seq)->inputFrameId;
+        last_check_seq = seq;
+        return timeInfo(seq);
     }
     RGYTimestampMapVal getByEncodeFrameID(const int64_t id) {
         std::lock_guard<std::mutex> lock(mtx);
-        auto pos = m_frame.end();
-        for (auto it = m_frame.begin(); it != m_frame.end(); it++) {
-            if (it->second.encodeFrameId == id) {
-                pos = it;
-                break;
-            }
-        }
-        if (pos == m_frame.end()) {
+        const auto seq = findEncodeFrameID(id);
+        if (seq < 0) {
             return RGYTimestampMapVal();
         }
-        auto& ret = pos->second;
-        clean(ret.inputFrameId);
-        return ret;
+        return take(seq);
     }
     RGYTimestampMapVal get(int64_t pts) {
         std::lock_guard<std::mutex> lock(mtx);
-        auto pos = m_frame.find(pts);
-        if (pos == m_frame.end()) {
+        const auto seq = findPts(pts);
+        if (seq < 0) {
             return RGYTimestampMapVal();
         }
-        auto& ret = pos->second;
-        clean(ret.inputFrameId);
-        return ret;
+        return take(seq);
+    }
+    // metadataは取り出さずに、時刻情報のみ取得する
+    RGYTimestampMapVal peek(int64_t pts) {
+        std::lock_guard<std::mutex> lock(mtx);
+        const auto seq = findPts(pts);
+        if (seq < 0) {
+            return RGYTimestampMapVal();
+        }
+        return timeInfo(seq);
     }
 };
 
@@ -200,13 +326,15 @@ protected:
     decltype(parse_nal_unit_hevc_c) *m_parse_nal_hevc; // HEVC用のnal unit分解関数へのポインタ
 };
 
+// 挿入するmetadataへの参照 (データは所有せず、InsertMetadataの呼び出し中のみ有効であればよい)
 struct RGYOutputInsertMetadata {
-    std::vector<uint8_t> mdata;
+    const uint8_t *ptr;
+    size_t size;
     bool onSequenceHeader;
     bool appendix;
     bool written;
 
-    RGYOutputInsertMetadata(std::vector<uint8_t>& data, bool onSeqHeader, bool appendix_) : mdata(data), onSequenceHeader(onSeqHeader), appendix(appendix_), written(false) {};
+    RGYOutputInsertMetadata(const uint8_t *data, size_t dataSize, bool onSeqHeader, bool appendix_) : ptr(data), size(dataSize), onSequenceHeader(onSeqHeader), appendix(appendix_), written(false) {};
 };
  
 class RGYOutput {
@@ -227,12 +355,12 @@ public:
 
     RGY_ERR InitVideoBsf(const VideoInfo *videoOutputInfo);
 
-    RGY_ERR InsertMetadata(RGYBitstream *bitstream, std::vector<std::unique_ptr<RGYOutputInsertMetadata>>& metadataList);
+    RGY_ERR InsertMetadata(RGYBitstream *bitstream, std::vector<RGYOutputInsertMetadata>& metadataList);
 
     RGY_ERR OverwriteHEVCAlphaChannelInfoSEI(RGYBitstream *bitstream);
 
     template<typename T>
-    std::pair<RGY_ERR, std::vector<uint8_t>> getMetadata(const RGYFrameDataType metadataType, const RGYTimestampMapVal& bs_framedata, const RGYFrameDataMetadataConvertParam *convPrm);
+    RGY_ERR getMetadata(std::vector<uint8_t>& metadata, const RGYFrameDataType metadataType, const RGYTimestampMapVal& bs_framedata, const RGYFrameDataMetadataConvertParam *convPrm);
 
     virtual RGY_ERR WriteNextFrame(RGYBitstream *pBitstream) = 0;
     virtual RGY_ERR WriteNextFrame(RGYFrame *pSurface) = 0;
@@ -308,6 +436,10 @@ protected:
     std::unique_ptr<uint8_t, aligned_malloc_deleter> m_UVBuffer;
     std::unique_ptr<RGYOutputBSF> m_bsf;
     decltype(parse_nal_unit_hevc_c) *m_parse_nal_hevc; // HEVC用のnal unit分解関数へのポインタ
+    decltype(rgy_memmem_c) *m_memmem;                  // start code検索用
+    std::vector<RGYOutputInsertMetadata> m_metadataList; // 挿入するmetadataのリスト (毎フレーム使いまわす)
+    std::vector<uint8_t> m_metadataHDR10plus;            // hdr10plusのmetadata用の作業領域
+    std::vector<uint8_t> m_metadataDoviRpu;              // dovi rpu用の作業領域
 };
 
 struct RGYOutputRawPrm {
@@ -375,6 +507,7 @@ RGY_ERR initWriters(
     const bool benchmark,
     const bool HEVCAlphaChannel,
     const int HEVCAlphaChannelMode,
+    const bool videoParamSetsInBand,
     RGYPoolAVPacket *poolPkt,
     RGYPoolAVFrame *poolFrame,
     shared_ptr<EncodeStatus> pStatus,
@@ -29,6 +29,7 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <climits>
 #include <memory>
 #include <fstream>
 #include <iostream>
@@ -118,7 +119,8 @@ AVMuxFormat::AVMuxFormat() :
     disableMp4Opt(false),
     lowlatency(false),
     allowOtherNegativePts(false),
-    timestampPassThrough(false) {
+    timestampPassThrough(false),
+    segment(false) {
 }
 
 AVMuxVideo::AVMuxVideo() :
@@ -145,6 +147,7 @@ AVMuxVideo::AVMuxVideo() :
     timestamp(nullptr),
     pktOut(nullptr),
     pktParse(nullptr),
+    poolBuf(),
     prevEncodeFrameId(-1),
     prevInputFrameId(-1),
     parserCtx(nullptr),
@@ -229,7 +232,9 @@ AVMuxThreadWorker::AVMuxThreadWorker() :
     sentEOS(false),
     heEventPktAdded(nullptr),
     heEventClosing(nullptr),
-    qPackets() {}
+    qPackets(),
+    running(false),
+    batch() {}
 
 AVMuxThreadWorker::~AVMuxThreadWorker() {
     if (heEventPktAdded) {
@@ -288,6 +293,26 @@ bool AVMuxThreadAudio::threadActiveProcess() {
     return process.thread.joinable();
 }
 
+AVMuxThreadAudioPool::AVMuxThreadAudioPool() :
+    threads(),
+    workers(),
+    thAbort(false),
+    heEventPktAdded(nullptr) {}
+
+AVMuxThreadAudioPool::~AVMuxThreadAudioPool() {
+    thAbort = true;
+    for (auto& th : threads) {
+        if (th.joinable()) {
+            th.join();
+        }
+    }
+    threads.clear();
+    if (heEventPktAdded) {
+        CloseEvent(heEventPktAdded);
+        heEventPktAdded = nullptr;
+    }
+}
+
 #if ENABLE_AVCODEC_OUT_THREAD
 AVMuxThread::AVMuxThread() :
     enableOutputThread(false),
@@ -298,6 +323,7 @@ AVMuxThread::AVMuxThread() :
     qVideobitstreamFreePB(),
     qVideobitstream(),
     thAud(),
+    audPool(),
     streamOutMaxDts(0),
     queueInfo(nullptr) {
 }
@@ -416,6 +442,11 @@ void RGYOutputAvcodec::CloseVideo(AVMuxVideo *muxVideo) {
         av_packet_unref(m_Mux.video.pktParse);
         av_packet_free(&m_Mux.video.pktParse);
     }
+    if (m_Mux.video.poolBuf) {
+        AddMessage(RGY_LOG_DEBUG, _T("video packet buffer pool: allocated %llu, reused %llu.\n"),
+            (unsigned long long)m_Mux.video.poolBuf->allocatedCount(), (unsigned long long)m_Mux.video.poolBuf->reusedCount());
+        m_Mux.video.poolBuf.reset();
+    }
     if (m_Mux.video.bsfcBuffer) {
         free(m_Mux.video.bsfcBuffer);
         m_Mux.video.bsfcBuffer = nullptr;
@@ -477,6 +508,10 @@ void RGYOutputAvcodec::CloseQueues() {
 void RGYOutputAvcodec::CloseThread() {
 #if ENABLE_AVCODEC_OUT_THREAD
     // process -> encode -> output の順に終了させる
+    if (m_Mux.thread.audPool) {
+        CloseAudioThreadPool();
+        AddMessage(RGY_LOG_DEBUG, _T("closed audio thread pool.\n"));
+    }
     for (auto& [mux, thread] : m_Mux.thread.thAud) {
         if (thread->process.thread.joinable()) {
             thread->closeProcess();
@@ -838,6 +873,18 @@ RGY_ERR RGYOutputAvcodec::InitVideo(const VideoInfo *videoOutputInfo, const Avco
     if (prm->videoCodecTag.length() > 0) {
         m_Mux.video.codecCtx->codec_tag           = tagFromStr(prm->videoCodecTag);
         AddMessage(RGY_LOG_DEBUG, _T("Set Video Codec Tag: %s\n"), char_to_tstring(tagToStr(m_Mux.video.codecCtx->codec_tag)).c_str());
+        //"hvc1"/"avc1"ではすべてのパラメータセットをsample entryに持つ必要があり、ストリーム中で切り替えられない
+        if (prm->videoParamSetsInBand && format_is_mp4(m_Mux.format.formatCtx)
+            && (m_Mux.video.codecCtx->codec_tag == tagFromStr("hvc1") || m_Mux.video.codecCtx->codec_tag == tagFromStr("avc1"))) {
+            AddMessage(RGY_LOG_ERROR, _T("video tag \"%s\" cannot be used when the parameter sets change within the stream (--fast-remux smart-trim), use \"%s\" instead.\n"),
+                char_to_tstring(prm->videoCodecTag).c_str(), (videoOutputInfo->codec == RGY_CODEC_HEVC) ? _T("hev1") : _T("avc3"));
+            return RGY_ERR_INVALID_PARAM;
+        }
+    } else if (prm->videoParamSetsInBand && format_is_mp4(m_Mux.format.formatCtx)
+        && (videoOutputInfo->codec == RGY_CODEC_HEVC || videoOutputInfo->codec == RGY_CODEC_H264)) {
+        // パラメータセットがストリーム中で切り替わるので、ストリーム中にパラメータセットを持てる"hev1"/"avc3"とする
+        m_Mux.video.codecCtx->codec_tag = tagFromStr((videoOutputInfo->codec == RGY_CODEC_HEVC) ? "hev1" : "avc3");
+        AddMessage(RGY_LOG_DEBUG, _T("Set Video Codec Tag: %s (parameter sets in band)\n"), char_to_tstring(tagToStr(m_Mux.video.codecCtx->codec_tag)).c_str());
     } else if (videoOutputInfo->codec == RGY_CODEC_HEVC) {
         // 特に指定の場合、HEVCでは再生互換性改善のため、 "hvc1"をデフォルトとする (libavformatのデフォルトは"hev1")
         m_Mux.video.codecCtx->codec_tag = tagFromStr("hvc1");
@@ -889,6 +936,7 @@ RGY_ERR RGYOutputAvcodec::InitVideo(const VideoInfo *videoOutputInfo, const Avco
     m_Mux.video.prevInputFrameId  = -1;
     m_Mux.video.pktOut            = av_packet_alloc();
     m_Mux.video.pktParse          = av_packet_alloc();
+    m_Mux.video.poolBuf           = std::make_unique<RGYPoolAVBuffer>();
     m_Mux.video.afs               = prm->afs;
     m_Mux.video.debugDirectAV1Out = prm->debugDirectAV1Out;
     m_Mux.video.doviRpu           = prm->doviRpu;
@@ -2027,6 +2075,62 @@ RGY_ERR RGYOutputAvcodec::SetChapters(const vector<const AVChapter *>& chapterLi
     return RGY_ERR_NONE;
 }
 
+static RGYSegmentFormat segmentFormat(const RGYParamSegment& segment, const tstring& filename) {
+    if (segment.format != RGYSegmentFormat::AUTO) {
+        return segment.format;
+    }
+    return check_ext(filename, { ".mpd" }) ? RGYSegmentFormat::DASH : RGYSegmentFormat::HLS;
+}
+
+RGY_ERR RGYOutputAvcodec::InitSegment(const RGYParamSegment& segment, const std::string& filename) {
+    const auto format = segmentFormat(segment, m_Mux.format.filename);
+    const auto type = (segment.type != RGYSegmentType::AUTO) ? segment.type
+        : ((format == RGYSegmentFormat::DASH) ? RGYSegmentType::FMP4 : RGYSegmentType::TS);
+    if (format == RGYSegmentFormat::DASH && type == RGYSegmentType::TS) {
+        AddMessage(RGY_LOG_ERROR, _T("--segment: type=ts is not supported with dash.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    // セグメントはプレイリストと同じフォルダに、プレイリストのファイル名をもとに出力する
+    // 分割やファイルの切り替え、プレイリストの更新はhls/dash muxerが出力スレッド上で行う
+    const auto basePath = PathRemoveExtensionS(filename);
+    const auto baseName = PathGetFilename(basePath);
+    const auto duration = strsprintf("%.3f", segment.duration);
+    std::vector<std::pair<std::string, std::string>> opts;
+    if (format == RGYSegmentFormat::HLS) {
+        const bool fmp4 = type == RGYSegmentType::FMP4;
+        opts.push_back({ "hls_time", duration });
+        opts.push_back({ "hls_list_size", strsprintf("%d", segment.listSize) });
+        opts.push_back({ "hls_segment_type", (fmp4) ? "fmp4" : "mpegts" });
+        opts.push_back({ "hls_segment_filename", basePath + ((fmp4) ? "_%05d.m4s" : "_%05d.ts") });
+        if (fmp4) {
+            opts.push_back({ "hls_fmp4_init_filename", baseName + "_init.mp4" });
+        }
+        // temp_file: 書き込み中のセグメント・プレイリストを読まれないよう、完成してからrenameする
+        opts.push_back({ "hls_flags", (segment.listSize > 0) ? "independent_segments+temp_file+delete_segments" : "independent_segments+temp_file" });
+        if (segment.listSize == 0) {
+            opts.push_back({ "hls_playlist_type", "event" }); // セグメントを追記していく
+        }
+    } else {
+        opts.push_back({ "seg_duration", duration });
+        opts.push_back({ "window_size", strsprintf("%d", segment.listSize) });
+        opts.push_back({ "dash_segment_type", "mp4" });
+        opts.push_back({ "use_template", "1" });
+        opts.push_back({ "use_timeline", "1" });
+        opts.push_back({ "init_seg_name", baseName + "_init_$RepresentationID$.$ext$" });
+        opts.push_back({ "media_seg_name", baseName + "_$RepresentationID$_$Number%05d$.$ext$" });
+    }
+    for (const auto& [name, value] : opts) {
+        int err = 0;
+        if (0 > (err = av_dict_set(&m_Mux.format.headerOptions, name.c_str(), value.c_str(), 0))) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to set mux opt: %s = %s.\n"), char_to_tstring(name).c_str(), char_to_tstring(value, CP_UTF8).c_str());
+            return RGY_ERR_INVALID_PARAM;
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("set segment opt: %s = %s.\n"), char_to_tstring(name).c_str(), char_to_tstring(value, CP_UTF8).c_str());
+    }
+    CreateDirectoryRecursive(PathRemoveFileSpecFixed(m_Mux.format.filename).second.c_str());
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoOutputInfo, const void *option) {
     m_Mux.format.streamError = true;
     AvcodecWriterPrm *prm = (AvcodecWriterPrm *)option;
@@ -2050,7 +2154,19 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
     }
     AddMessage(RGY_LOG_DEBUG, _T("output filename: \"%s\"\n"), strFileName);
     m_Mux.format.filename = strFileName;
-    if (NULL == (m_Mux.format.outputFmt = av_guess_format((prm->outputFormat.length() > 0) ? tchar_to_string(prm->outputFormat).c_str() : NULL, filename.c_str(), NULL))) {
+    tstring outputFormat = prm->outputFormat;
+    if (prm->segment.enable) {
+        if (0 == strcmp(filename.c_str(), "-")) {
+            AddMessage(RGY_LOG_ERROR, _T("--segment cannot be used with output to stdout.\n"));
+            return RGY_ERR_UNSUPPORTED;
+        }
+        outputFormat = (segmentFormat(prm->segment, strFileName) == RGYSegmentFormat::DASH) ? _T("dash") : _T("hls");
+        if (prm->outputFormat.length() > 0 && prm->outputFormat != outputFormat) {
+            AddMessage(RGY_LOG_WARN, _T("--format %s is ignored, %s is used for --segment.\n"), prm->outputFormat.c_str(), outputFormat.c_str());
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("segment output: %s.\n"), outputFormat.c_str());
+    }
+    if (NULL == (m_Mux.format.outputFmt = av_guess_format((outputFormat.length() > 0) ? tchar_to_string(outputFormat).c_str() : NULL, filename.c_str(), NULL))) {
         AddMessage(RGY_LOG_ERROR,
             _T("failed to assume format from output filename.\n")
             _T("please set proper extension for output file, or specify format using option %s.\n"), (videoOutputInfo) ? _T("--format") : _T("--audio-file <format>:<filename>"));
@@ -2078,6 +2194,7 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
     m_Mux.format.lowlatency = prm->lowlatency;
     m_Mux.format.allowOtherNegativePts = prm->allowOtherNegativePts;
     m_Mux.format.timestampPassThrough = prm->timestampPassThrough;
+    m_Mux.format.segment = prm->segment.enable;
 
 #if USE_CUSTOM_IO
     if (m_Mux.format.isPipe || usingAVProtocols(filename, 1) || (m_Mux.format.formatCtx->oformat->flags & (AVFMT_NEEDNUMBER | AVFMT_NOFILE))) {
@@ -2153,6 +2270,7 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
 #endif //#if USE_CUSTOM_IO
 
     m_Mux.trim = prm->trimList;
+    m_Mux.trimCutPrefix = trim_cut_frames_prefix(m_Mux.trim);
     m_Mux.poolPkt = prm->poolPkt;
     m_Mux.poolFrame = prm->poolFrame;
 
@@ -2238,6 +2356,14 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
         return ret;
     }
 
+    //-mで指定されたものを優先するので、先に設定する
+    if (prm->segment.enable) {
+        auto sts = InitSegment(prm->segment, filename);
+        if (sts != RGY_ERR_NONE) {
+            return sts;
+        }
+    }
+
     for (const auto& muxOpt : prm->muxOpt) {
         std::string optName = tchar_to_string(muxOpt.first);
         std::string optValue = tchar_to_string(muxOpt.second);
@@ -2271,7 +2397,7 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
     if (m_Mux.thread.enableOutputThread) {
         AddMessage(RGY_LOG_DEBUG, _T("starting output thread...\n"));
         const int audioQueueCapacity = 4096;
-        m_Mux.thread.qVideobitstream.init(4096, (std::max)(256, (m_Mux.video.outputFps.den) ? m_Mux.video.outputFps.num * 4 / m_Mux.video.outputFps.den : 0));
+        m_Mux.thread.qVideobitstream.init(4096, rgy_output_video_queue_max(rgy_rational<int>(m_Mux.video.outputFps.num, m_Mux.video.outputFps.den)));
         m_Mux.thread.qVideobitstreamFreeI.init(256);
         m_Mux.thread.qVideobitstreamFreePB.init(3840);
         m_Mux.thread.thOutput = std::make_unique<AVMuxThreadWorker>();
@@ -2290,24 +2416,43 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
                 }
             }
             const auto audioQueueMultiplizer = (prm->threadAudio > 2) ? 2 : std::max(2, (int)m_Mux.audio.size());
+            //トラックごとに処理する場合は、専用スレッドを立てずにスレッドプールで共有して処理する
+            const bool useThreadPool = prm->threadAudio > 2;
+            if (useThreadPool) {
+                m_Mux.thread.audPool = std::make_unique<AVMuxThreadAudioPool>();
+            }
             for (auto mux : muxAudioPtr) {
                 const auto target = (mux) ? strsprintf(_T("%d.%d"), trackID(mux->inTrackId), mux->inSubStream) : tstring(_T("default"));
-                AddMessage(RGY_LOG_DEBUG, _T("starting audio process thread %s...\n"), target.c_str());
+                AddMessage(RGY_LOG_DEBUG, _T("starting audio process %s %s...\n"), (useThreadPool) ? _T("worker") : _T("thread"), target.c_str());
                 m_Mux.thread.thAud[mux] = std::make_unique<AVMuxThreadAudio>();
                 m_Mux.thread.thAud[mux]->process.thAbort = false;
                 m_Mux.thread.thAud[mux]->process.qPackets.init(16384, audioQueueCapacity * audioQueueMultiplizer, 4);
                 m_Mux.thread.thAud[mux]->process.heEventPktAdded = CreateEvent(NULL, TRUE, FALSE, NULL);
                 m_Mux.thread.thAud[mux]->process.heEventClosing = CreateEvent(NULL, TRUE, FALSE, NULL);
-                m_Mux.thread.thAud[mux]->process.thread = std::thread(&RGYOutputAvcodec::ThreadFuncAudThread, this, mux, prm->threadParamAudio);
-                AddMessage(RGY_LOG_DEBUG, _T("Set audio process thread param %s: %s.\n"), target.c_str(), prm->threadParamAudio.desc().c_str());
+                if (useThreadPool) {
+                    m_Mux.thread.audPool->workers.push_back(std::make_pair(&m_Mux.thread.thAud[mux]->process, (int)AUD_QUEUE_PROCESS));
+                } else {
+                    m_Mux.thread.thAud[mux]->process.thread = std::thread(&RGYOutputAvcodec::ThreadFuncAudThread, this, mux, prm->threadParamAudio);
+                    AddMessage(RGY_LOG_DEBUG, _T("Set audio process thread param %s: %s.\n"), target.c_str(), prm->threadParamAudio.desc().c_str());
+                }
                 if (m_Mux.thread.enableAudEncodeThread) {
-                    AddMessage(RGY_LOG_DEBUG, _T("starting audio encode thread %s...\n"), target.c_str());
+                    AddMessage(RGY_LOG_DEBUG, _T("starting audio encode %s %s...\n"), (useThreadPool) ? _T("worker") : _T("thread"), target.c_str());
                     m_Mux.thread.thAud[mux]->encode.thAbort = false;
                     m_Mux.thread.thAud[mux]->encode.qPackets.init(16384, audioQueueCapacity * audioQueueMultiplizer, 4);
                     m_Mux.thread.thAud[mux]->encode.heEventPktAdded = CreateEvent(NULL, TRUE, FALSE, NULL);
                     m_Mux.thread.thAud[mux]->encode.heEventClosing = CreateEvent(NULL, TRUE, FALSE, NULL);
-                    m_Mux.thread.thAud[mux]->encode.thread = std::thread(&RGYOutputAvcodec::ThreadFuncAudEncodeThread, this, mux, prm->threadParamAudio);
-                    AddMessage(RGY_LOG_DEBUG, _T("Set audio encode thread param %s: %s.\n"), target.c_str(), prm->threadParamAudio.desc().c_str());
+                    if (useThreadPool) {
+                        m_Mux.thread.audPool->workers.push_back(std::make_pair(&m_Mux.thread.thAud[mux]->encode, (int)AUD_QUEUE_ENCODE));
+                    } else {
+                        m_Mux.thread.thAud[mux]->encode.thread = std::thread(&RGYOutputAvcodec::ThreadFuncAudEncodeThread, this, mux, prm->threadParamAudio);
+                        AddMessage(RGY_LOG_DEBUG, _T("Set audio encode thread param %s: %s.\n"), target.c_str(), prm->threadParamAudio.desc().c_str());
+                    }
+                }
+            }
+            if (useThreadPool) {
+                auto sts = StartAudioThreadPool(prm->threadParamAudio);
+                if (sts != RGY_ERR_NONE) {
+                    return sts;
                 }
             }
         }
@@ -2335,9 +2480,12 @@ RGY_ERR RGYOutputAvcodec::applyBsfToHeader(std::vector<uint8_t>& result, const u
         return RGY_ERR_NONE;
     }
     AVPacket *pkt = m_Mux.video.pktOut;
-    av_new_packet(pkt, (int)target_size);
-    memcpy(pkt->data, target, target_size);
     int ret = 0;
+    if (0 > (ret = m_Mux.video.poolBuf->newPacket(pkt, (int)target_size))) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to allocate packet for header (%d bytes): %s.\n"), (int)target_size, qsv_av_err2str(ret).c_str());
+        return RGY_ERR_MEMORY_ALLOC;
+    }
+    memcpy(pkt->data, target, target_size);
     if (0 > (ret = av_bsf_send_packet(m_Mux.video.bsfc, pkt))) {
         av_packet_unref(pkt);
         AddMessage(RGY_LOG_ERROR, _T("failed to send packet to %s bitstream filter: %s.\n"),
@@ -2538,26 +2686,18 @@ RGY_ERR RGYOutputAvcodec::WriteFileHeader(const RGYBitstream *bitstream) {
 int64_t RGYOutputAvcodec::AdjustTimestampTrimmed(int64_t nTimeIn, AVRational timescaleIn, AVRational timescaleOut, bool lastValidFrame) {
     AVRational timescaleFps = av_inv_q(m_Mux.video.outputFps);
     const int vidFrameIdx = (int)av_rescale_q(nTimeIn, timescaleIn, timescaleFps);
-    int cutFrames = 0;
+    int64_t cutFrames = 0;
     if (m_Mux.trim.size() > 0) {
-        int nLastFinFrame = 0;
-        for (const auto& trim : m_Mux.trim) {
-            if (vidFrameIdx < trim.start) {
-                if (lastValidFrame) {
-                    cutFrames += (vidFrameIdx - nLastFinFrame);
-                    nLastFinFrame = vidFrameIdx;
-                    break;
-                }
-                return AV_NOPTS_VALUE;
-            }
-            cutFrames += trim.start - nLastFinFrame;
-            if (vidFrameIdx <= trim.fin) {
-                nLastFinFrame = vidFrameIdx;
-                break;
-            }
-            nLastFinFrame = trim.fin;
+        // 該当するtrimのブロックを二分探索し、それより前で削除されたフレーム数は累積値から求める
+        const auto [inside, index] = frame_inside_range(vidFrameIdx, m_Mux.trim);
+        if (inside) {
+            cutFrames = m_Mux.trimCutPrefix[index + 1];
+        } else if (index < (int)m_Mux.trim.size() && !lastValidFrame) {
+            return AV_NOPTS_VALUE;
+        } else {
+            const int nLastFinFrame = (index > 0) ? m_Mux.trim[index - 1].fin : 0;
+            cutFrames = m_Mux.trimCutPrefix[index] + vidFrameIdx - nLastFinFrame;
         }
-        cutFrames += vidFrameIdx - nLastFinFrame;
     }
     int64_t tsTimeOut = av_rescale_q(nTimeIn,   timescaleIn,  timescaleOut);
     int64_t tsTrim    = av_rescale_q(cutFrames, timescaleFps, timescaleOut);
@@ -2714,7 +2854,11 @@ RGY_ERR RGYOutputAvcodec::VidCheckStreamAVParser(RGYBitstream *pBitstream) {
     RGY_ERR err = RGY_ERR_NONE;
     m_Mux.video.parserStreamPos += pBitstream->size();
     AVPacket *pkt = m_Mux.video.pktParse;
-    av_new_packet(pkt, (int)pBitstream->size());
+    int ret = 0;
+    if (0 > (ret = m_Mux.video.poolBuf->newPacket(pkt, (int)pBitstream->size()))) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to allocate packet for parser (%d bytes): %s.\n"), (int)pBitstream->size(), qsv_av_err2str(ret).c_str());
+        return RGY_ERR_MEMORY_ALLOC;
+    }
     memcpy(pkt->data, pBitstream->data(), pBitstream->size());
     pkt->size = (int)pBitstream->size();
     pkt->pts = pBitstream->pts();
@@ -2793,44 +2937,54 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternalOneFrame(RGYBitstream *bitstream
             const auto nal_list = m_Mux.video.parse_nal_h264(bitstream->data(), bitstream->size());
             //インタレ保持の際、IDRかどうかのフラグが正しく設定されていないことがある
             //どちらかのフィールドがIDRならIDRのフラグを立てる
-            isIDR = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.type == NALU_H264_IDR; }) != nal_list.end();
+            isIDR = nal_list_has_idr(nal_list, RGY_CODEC_H264);
             isKey |= isIDR;
         } else if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
             AddMessage(RGY_LOG_ERROR, _T("Interlaced HEVC encoding not supported!\n"));
             return RGY_ERR_UNSUPPORTED;
         }
     }
+    if (m_Mux.format.segment) {
+        //セグメントはIDRでのみ分割する (open GOPのIフレームで分割すると、セグメント単体でデコードできない)
+        //AVParserはIフレームすべてにIDRのフラグを立てるので、H.264/HEVCではNALの種類から判定する
+        if (m_VideoOutputInfo.codec == RGY_CODEC_H264) {
+            isIDR = nal_list_has_idr(m_Mux.video.parse_nal_h264(bitstream->data(), bitstream->size()), RGY_CODEC_H264);
+        } else if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
+            isIDR = nal_list_has_idr(m_Mux.video.parse_nal_hevc(bitstream->data(), bitstream->size()), RGY_CODEC_HEVC);
+        }
+        isKey = isIDR;
+    }
 
-    std::vector<std::unique_ptr<RGYOutputInsertMetadata>> metadataList;
+    // metadataList, metadataの作業領域は使いまわし、フレームごとの確保を避ける
+    auto& metadataList = m_metadataList;
+    metadataList.clear();
     if (m_Mux.video.hdrBitstream.size() > 0) {
-        std::vector<uint8_t> data(m_Mux.video.hdrBitstream.data(), m_Mux.video.hdrBitstream.data() + m_Mux.video.hdrBitstream.size());
-        metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(data, true, false));
+        metadataList.emplace_back(m_Mux.video.hdrBitstream.data(), m_Mux.video.hdrBitstream.size(), true, false);
     }
     if (m_Mux.video.hdr10plusMetadataCopy) {
-        auto [err_hdr10plus, metadata_hdr10plus] = getMetadata<RGYFrameDataHDR10plus>(RGY_FRAME_DATA_HDR10PLUS, bs_framedata, nullptr);
+        auto err_hdr10plus = getMetadata<RGYFrameDataHDR10plus>(m_metadataHDR10plus, RGY_FRAME_DATA_HDR10PLUS, bs_framedata, nullptr);
         if (err_hdr10plus != RGY_ERR_NONE) {
             return err_hdr10plus;
         }
-        if (metadata_hdr10plus.size() > 0) {
-            metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(metadata_hdr10plus, false, false));
+        if (m_metadataHDR10plus.size() > 0) {
+            metadataList.emplace_back(m_metadataHDR10plus.data(), m_metadataHDR10plus.size(), false, false);
         }
     }
     if (m_Mux.video.doviRpu) {
-        std::vector<uint8_t> dovi_nal;
-        if (m_Mux.video.doviRpu->get_next_rpu(dovi_nal, bs_framedata.inputFrameId, m_VideoOutputInfo.codec) != 0) {
+        if (m_Mux.video.doviRpu->get_next_rpu(m_metadataDoviRpu, bs_framedata.inputFrameId, m_VideoOutputInfo.codec) != 0) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to get dovi rpu for %lld.\n"), bs_framedata.inputFrameId);
         }
-        if (dovi_nal.size() > 0) {
-            metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(dovi_nal, false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false));
+        if (m_metadataDoviRpu.size() > 0) {
+            metadataList.emplace_back(m_metadataDoviRpu.data(), m_metadataDoviRpu.size(), false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false);
         }
     } else if (m_Mux.video.doviRpuMetadataCopy) {
         auto doviRpuConvPrm = (m_Mux.video.doviProfileSrc != m_Mux.video.doviProfileDst) ? std::make_unique<RGYFrameDataDOVIRpuConvertParam>(m_Mux.video.doviProfileDst) : nullptr;
-        auto [err_dovirpu, metadata_dovi_rpu] = getMetadata<RGYFrameDataDOVIRpu>(RGY_FRAME_DATA_DOVIRPU, bs_framedata, doviRpuConvPrm.get());
+        auto err_dovirpu = getMetadata<RGYFrameDataDOVIRpu>(m_metadataDoviRpu, RGY_FRAME_DATA_DOVIRPU, bs_framedata, doviRpuConvPrm.get());
         if (err_dovirpu != RGY_ERR_NONE) {
             return err_dovirpu;
         }
-        if (metadata_dovi_rpu.size() > 0) {
-            metadataList.push_back(std::make_unique<RGYOutputInsertMetadata>(metadata_dovi_rpu, false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false));
+        if (m_metadataDoviRpu.size() > 0) {
+            metadataList.emplace_back(m_metadataDoviRpu.data(), m_metadataDoviRpu.size(), false, m_VideoOutputInfo.codec == RGY_CODEC_HEVC ? true : false);
         }
     }
 
@@ -2840,7 +2994,10 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternalOneFrame(RGYBitstream *bitstream
     }
 
     AVPacket *pkt = m_Mux.video.pktOut;
-    av_new_packet(pkt, (int)bitstream->size());
+    if (int ret = m_Mux.video.poolBuf->newPacket(pkt, (int)bitstream->size()); ret < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to allocate packet for video frame (%d bytes): %s.\n"), (int)bitstream->size(), qsv_av_err2str(ret).c_str());
+        return RGY_ERR_MEMORY_ALLOC;
+    }
     memcpy(pkt->data, bitstream->data(), bitstream->size());
     pkt->size = (int)bitstream->size();
 
@@ -3715,6 +3872,9 @@ RGY_ERR RGYOutputAvcodec::WriteNextPacket(AVPacket *pkt) {
                 m_Mux.format.streamError = true;
             }
             SetEvent(heEventPktAdd);
+            if (m_Mux.thread.audPool) {
+                SetEvent(m_Mux.thread.audPool->heEventPktAdded);
+            }
         }
         return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
     }
@@ -3748,6 +3908,39 @@ RGY_ERR RGYOutputAvcodec::AddAudQueue(AVPktMuxData *pktData, int type) {
             m_Mux.format.streamError = true;
         }
         SetEvent(heEventAdded);
+        if (type != AUD_QUEUE_OUT && m_Mux.thread.audPool) {
+            SetEvent(m_Mux.thread.audPool->heEventPktAdded);
+        }
+        return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
+    } else
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+}
+
+RGY_ERR RGYOutputAvcodec::AddAudQueue(vector<AVPktMuxData>& pktDatas, int type) {
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    if (m_Mux.thread.threadActiveAudioProcess()) {
+        //通常は同じworkerに続けて追加されるので、通知はworkerが変わったときと最後にだけ行う
+        AVMuxThreadWorker *lastWorker = nullptr;
+        for (auto& pktData : pktDatas) {
+            AVMuxThreadWorker *worker = getPacketWorker(pktData.muxAudio, type);
+            if (lastWorker && lastWorker != worker) {
+                SetEvent(lastWorker->heEventPktAdded);
+            }
+            lastWorker = worker;
+            if (!worker->qPackets.push(pktData)) {
+                AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for audio queue.\n"));
+                m_Mux.format.streamError = true;
+            }
+        }
+        if (lastWorker) {
+            SetEvent(lastWorker->heEventPktAdded);
+            if (type != AUD_QUEUE_OUT && m_Mux.thread.audPool) {
+                SetEvent(m_Mux.thread.audPool->heEventPktAdded);
+            }
+        }
         return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
     } else
 #endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
@@ -3817,7 +4010,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextPacketInternal(AVPktMuxData *pktData, int64_t
 //音声処理スレッドが存在する場合、この関数は音声処理スレッドによって処理される
 //音声処理スレッドがなく、出力スレッドがあれば、出力スレッドにより処理される
 //出力スレッドがなければメインエンコードスレッドが処理する
-RGY_ERR RGYOutputAvcodec::WriteNextPacketAudio(AVPktMuxData *pktData) {
+RGY_ERR RGYOutputAvcodec::WriteNextPacketAudio(AVPktMuxData *pktData, vector<AVPktMuxData> *decodedFrames) {
     pktData->samples = 0;
     AVMuxAudio *muxAudio = pktData->muxAudio;
     if (muxAudio == nullptr) {
@@ -3973,7 +4166,12 @@ RGY_ERR RGYOutputAvcodec::WriteNextPacketAudio(AVPktMuxData *pktData) {
                 audioFrames.push_back(audPkt);
             }
         }
-        WriteNextPacketToAudioSubtracks(std::move(audioFrames));
+        if (decodedFrames) {
+            //呼び出し元でまとめてフィルタに渡す
+            decodedFrames->insert(decodedFrames->end(), audioFrames.begin(), audioFrames.end());
+        } else {
+            WriteNextPacketToAudioSubtracks(std::move(audioFrames));
+        }
     }
     return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
@@ -4019,7 +4217,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextPacketAudioFrame(vector<AVPktMuxData> audioFr
 //音声エンコードスレッドが存在せず、音声処理スレッドが存在する場合、この関数は音声処理スレッドによって処理される
 //音声処理スレッドが存在しない場合、この関数は出力スレッドによって処理される
 //出力スレッドがなければメインエンコードスレッドが処理する
-RGY_ERR RGYOutputAvcodec::WriteNextAudioFrame(AVPktMuxData *pktData) {
+RGY_ERR RGYOutputAvcodec::WriteNextAudioFrame(AVPktMuxData *pktData, vector<AVPktMuxData> *encodedPkts) {
     if (pktData->type != MUX_DATA_TYPE_FRAME) {
         if (pktData->muxAudio) {
             //音声エンコードスレッドがこの関数を処理
@@ -4071,7 +4269,10 @@ RGY_ERR RGYOutputAvcodec::WriteNextAudioFrame(AVPktMuxData *pktData) {
     auto encPktDatas = AudioEncodeFrame(pktData->muxAudio, pktData->frame);
     m_Mux.poolFrame->returnFree(&pktData->frame);
 #if ENABLE_AVCODEC_AUDPROCESS_THREAD
-    if (m_Mux.thread.threadActiveAudioProcess()) {
+    if (encodedPkts) {
+        //呼び出し元でまとめて出力キューに渡す
+        encodedPkts->insert(encodedPkts->end(), encPktDatas.begin(), encPktDatas.end());
+    } else if (m_Mux.thread.threadActiveAudioProcess()) {
         for (auto& pktMux : encPktDatas) {
             AddAudQueue(&pktMux, AUD_QUEUE_OUT);
         }
@@ -4089,6 +4290,9 @@ RGY_ERR RGYOutputAvcodec::WriteNextAudioFrame(AVPktMuxData *pktData) {
 RGY_ERR RGYOutputAvcodec::ThreadFuncAudEncodeThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam) {
 #if ENABLE_AVCODEC_AUDPROCESS_THREAD
     threadParam.apply(GetCurrentThread());
+    if (m_Mux.thread.queueInfo) {
+        m_Mux.thread.queueInfo->tid_aud_enc = GetCurrentThreadId();
+    }
     auto worker = getPacketWorker(muxAudio, AUD_QUEUE_ENCODE);
     WaitForSingleObject(worker->heEventPktAdded, INFINITE);
     while (!worker->thAbort) {
@@ -4122,6 +4326,9 @@ RGY_ERR RGYOutputAvcodec::ThreadFuncAudEncodeThread(const AVMuxAudio *const muxA
 RGY_ERR RGYOutputAvcodec::ThreadFuncAudThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam) {
 #if ENABLE_AVCODEC_AUDPROCESS_THREAD
     threadParam.apply(GetCurrentThread());
+    if (m_Mux.thread.queueInfo) {
+        m_Mux.thread.queueInfo->tid_aud_proc = GetCurrentThreadId();
+    }
     auto worker = getPacketWorker(muxAudio, AUD_QUEUE_PROCESS);
     WaitForSingleObject(worker->heEventPktAdded, INFINITE);
     while (!worker->thAbort) {
@@ -4153,9 +4360,178 @@ RGY_ERR RGYOutputAvcodec::ThreadFuncAudThread(const AVMuxAudio *const muxAudio,
     return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
+RGY_ERR RGYOutputAvcodec::StartAudioThreadPool(RGYParamThread threadParam) {
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    auto pool = m_Mux.thread.audPool.get();
+    if (pool->workers.empty()) {
+        return RGY_ERR_NONE;
+    }
+    //各workerは大半の時間キュー待ちなので、worker数ではなくCPUのコア数からスレッド数を決める
+    const int threadCount = std::max(1, std::min((int)pool->workers.size(), std::max(2, (int)std::thread::hardware_concurrency() / 2)));
+    pool->thAbort = false;
+    pool->heEventPktAdded = CreateEvent(NULL, TRUE, FALSE, NULL);
+    for (int i = 0; i < threadCount; i++) {
+        pool->threads.push_back(std::thread(&RGYOutputAvcodec::ThreadFuncAudPool, this, i, threadParam));
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("started audio thread pool: %d threads for %d workers.\n"), threadCount, (int)pool->workers.size());
+    AddMessage(RGY_LOG_DEBUG, _T("Set audio thread pool param: %s.\n"), threadParam.desc().c_str());
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    return RGY_ERR_NONE;
+}
+
+int RGYOutputAvcodec::RunAudioWorker(AVMuxThreadWorker *worker, const int type, const int maxPackets) {
+    int processed = 0;
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    bool expected = false;
+    if (worker->qPackets.size() == 0 || !worker->running.compare_exchange_strong(expected, true)) {
+        return 0;
+    }
+    auto queueUsage = (m_Mux.thread.queueInfo) ? ((type == AUD_QUEUE_PROCESS) ? &m_Mux.thread.queueInfo->usage_aud_proc : &m_Mux.thread.queueInfo->usage_aud_enc) : nullptr;
+    //キューにたまっているデータをまとめて取り出す
+    auto& batch = worker->batch;
+    batch.clear();
+    AVPktMuxData pktData = { 0 };
+    while ((int)batch.size() < maxPackets && worker->qPackets.front_copy_and_pop_no_lock(&pktData, queueUsage)) {
+        batch.push_back(pktData);
+    }
+    processed = (int)batch.size();
+    if (type == AUD_QUEUE_PROCESS) {
+        //デコードしたフレームはまとめてフィルタに渡す
+        //flushや字幕などデコードしないデータが来たら、順序を保つため先にたまっている分を処理する
+        vector<AVPktMuxData> decodedFrames;
+        for (auto& pkt : batch) {
+            if (pkt.pkt && pkt.pkt->data && pkt.muxAudio && pkt.muxAudio->outCodecDecodeCtx
+                && trackMediaType(pktFlagGetTrackID(pkt.pkt)) == AVMEDIA_TYPE_AUDIO) {
+                WriteNextPacketAudio(&pkt, &decodedFrames);
+                continue;
+            }
+            if (decodedFrames.size() > 0) {
+                WriteNextPacketToAudioSubtracks(std::move(decodedFrames));
+                decodedFrames.clear();
+            }
+            //音声処理を実行、後段のキューに追加する
+            WriteNextPacketInternal(&pkt, INT64_MAX);
+        }
+        if (decodedFrames.size() > 0) {
+            WriteNextPacketToAudioSubtracks(std::move(decodedFrames));
+        }
+    } else {
+        //エンコード結果はまとめて出力キューに渡す
+        vector<AVPktMuxData> encodedPkts;
+        for (auto& frame : batch) {
+            if (frame.type == MUX_DATA_TYPE_FRAME) {
+                WriteNextAudioFrame(&frame, &encodedPkts);
+                continue;
+            }
+            if (encodedPkts.size() > 0) {
+                AddAudQueue(encodedPkts, AUD_QUEUE_OUT);
+                encodedPkts.clear();
+            }
+            //flushや音声コピーのパケットはそのまま処理する
+            WriteNextAudioFrame(&frame);
+        }
+        if (encodedPkts.size() > 0) {
+            AddAudQueue(encodedPkts, AUD_QUEUE_OUT);
+        }
+    }
+    batch.clear();
+    worker->running = false;
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    return processed;
+}
+
+RGY_ERR RGYOutputAvcodec::ThreadFuncAudPool(const int threadIdx, RGYParamThread threadParam) {
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    threadParam.apply(GetCurrentThread());
+    //偶数番目のスレッドはprocess、奇数番目のスレッドはencodeのworkerを優先して処理する
+    //先頭の2スレッドをそれぞれの代表として計測する
+    const int preferType = (threadIdx & 1) ? AUD_QUEUE_ENCODE : AUD_QUEUE_PROCESS;
+    if (m_Mux.thread.queueInfo && threadIdx < 2) {
+        ((threadIdx == 0) ? m_Mux.thread.queueInfo->tid_aud_proc : m_Mux.thread.queueInfo->tid_aud_enc) = GetCurrentThreadId();
+    }
+    auto pool = m_Mux.thread.audPool.get();
+    const int workerCount = (int)pool->workers.size();
+    //スレッドごとに探索の開始位置をずらし、空いているworkerを順に処理する
+    int startIdx = threadIdx;
+    while (!pool->thAbort) {
+        int processed = 0;
+        if (m_Mux.format.fileHeaderWritten) {
+            //エンコードキューが詰まっているときは、processを止めてpushでスレッドがブロックされないようにする
+            bool encodeQueueCongested = false;
+            for (const auto& [worker, type] : pool->workers) {
+                if (type == AUD_QUEUE_ENCODE && worker->qPackets.size() * 2 >= worker->qPackets.capacity()) {
+                    encodeQueueCongested = true;
+                    break;
+                }
+            }
+            for (int pass = 0; pass < 2; pass++) {
+                for (int i = 0; i < workerCount; i++) {
+                    const auto& [worker, type] = pool->workers[(startIdx + i) % workerCount];
+                    if ((type == preferType) != (pass == 0)
+                        || (type == AUD_QUEUE_PROCESS && encodeQueueCongested)) {
+                        continue;
+                    }
+                    processed += RunAudioWorker(worker, type, AUD_POOL_BATCH_PACKETS);
+                }
+            }
+            startIdx = (startIdx + 1) % workerCount;
+        }
+        if (processed > 0) {
+            continue;
+        }
+        if (!m_Mux.format.fileHeaderWritten || m_Mux.format.lowlatency) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } else {
+            ResetEvent(pool->heEventPktAdded);
+            WaitForSingleObject(pool->heEventPktAdded, 16);
+        }
+    }
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
+}
+
+void RGYOutputAvcodec::CloseAudioThreadPool() {
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    auto pool = m_Mux.thread.audPool.get();
+    // process -> encode の順にキューが空になるのを待つ
+    for (const int queueType : { (int)AUD_QUEUE_PROCESS, (int)AUD_QUEUE_ENCODE }) {
+        for (const auto& [worker, type] : pool->workers) {
+            if (type != queueType) continue;
+            while (!pool->threads.empty() && m_Mux.format.fileHeaderWritten && !m_Mux.format.streamError
+                && (worker->qPackets.size() > 0 || worker->running)) {
+                SetEvent(pool->heEventPktAdded);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+    pool->thAbort = true;
+    for (auto& th : pool->threads) {
+        if (th.joinable()) {
+            SetEvent(pool->heEventPktAdded);
+            th.join();
+        }
+    }
+    pool->threads.clear();
+    //残っているデータがあればすべて書き出す
+    for (const int queueType : { (int)AUD_QUEUE_PROCESS, (int)AUD_QUEUE_ENCODE }) {
+        for (const auto& [worker, type] : pool->workers) {
+            if (type == queueType) {
+                RunAudioWorker(worker, type, INT_MAX);
+            }
+        }
+    }
+    for (const auto& [worker, type] : pool->workers) {
+        worker->qPackets.close();
+    }
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+}
+
 RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
 #if ENABLE_AVCODEC_OUT_THREAD
     threadParam.apply(GetCurrentThread());
+    if (m_Mux.thread.queueInfo) {
+        m_Mux.thread.queueInfo->tid_out = GetCurrentThreadId();
+    }
     //映像と音声の同期をとる際に、それをあきらめるまでの閾値
     const int nWaitThreshold = 32;
     //キューにデータが存在するか
@@ -4366,6 +4742,10 @@ HANDLE RGYOutputAvcodec::getThreadHandleOutput() {
 
 HANDLE RGYOutputAvcodec::getThreadHandleAudProcess() {
 #if ENABLE_AVCODEC_OUT_THREAD && ENABLE_AVCODEC_AUDPROCESS_THREAD
+    if (m_Mux.thread.audPool) {
+        //スレッドプールでは、先頭のスレッドがprocessを優先して処理する
+        return (m_Mux.thread.audPool->threads.size() > 0) ? (HANDLE)m_Mux.thread.audPool->threads[0].native_handle() : nullptr;
+    }
     return (m_Mux.thread.threadActiveAudioProcess()) ? (HANDLE)m_Mux.thread.thAud[nullptr]->process.thread.native_handle() : nullptr;
 #else
     return NULL;
@@ -4374,6 +4754,10 @@ HANDLE RGYOutputAvcodec::getThreadHandleAudProcess() {
 
 HANDLE RGYOutputAvcodec::getThreadHandleAudEncode() {
 #if ENABLE_AVCODEC_OUT_THREAD && ENABLE_AVCODEC_AUDPROCESS_THREAD
+    if (m_Mux.thread.audPool) {
+        //スレッドプールでは、2番目のスレッドがencodeを優先して処理する
+        return (m_Mux.thread.audPool->threads.size() > 1) ? (HANDLE)m_Mux.thread.audPool->threads[1].native_handle() : nullptr;
+    }
     return (m_Mux.thread.threadActiveAudioEncode()) ? (HANDLE)m_Mux.thread.thAud[nullptr]->encode.thread.native_handle() : nullptr;
 #else
     return NULL;
@@ -127,6 +127,7 @@ struct AVMuxFormat {
     bool                  lowlatency;           //低遅延モード
     bool                  allowOtherNegativePts; //音声・字幕の負のptsを許可するかどうか
     bool                  timestampPassThrough;  //タイムスタンプをそのまま出力するかどうか
+    bool                  segment;              //セグメント出力 (IDRのみをキーフレームとして扱う)
 
     AVMuxFormat();
 };
@@ -155,6 +156,7 @@ struct AVMuxVideo {
     RGYTimestamp         *timestamp;            //timestampの情報
     AVPacket             *pktOut;               //出力用のAVPacket
     AVPacket             *pktParse;             //parser用のAVPacket
+    std::unique_ptr<RGYPoolAVBuffer> poolBuf;   //pktOut/pktParseのpayload用のpool
     int64_t               prevEncodeFrameId;    //前回のエンコードフレームID
     int64_t               prevInputFrameId;     //前回の入力フレームID
     AVCodecParserContext *parserCtx;            //動画ストリームのParser (VCEのみ)
@@ -273,6 +275,8 @@ enum {
     AUD_QUEUE_OUT     = 2,
 };
 
+static const int AUD_POOL_BATCH_PACKETS = 16; //スレッドプールで1つのworkerを連続して処理する最大パケット数
+
 struct AVMuxThreadWorker {
     std::thread                    thread;          //音声処理スレッド(デコード/thAudEncodeがなければエンコードも担当)
     std::atomic<bool>              thAbort;         //音声処理スレッドに停止を通知する
@@ -280,6 +284,8 @@ struct AVMuxThreadWorker {
     HANDLE                         heEventPktAdded; //キューのいずれかにデータが追加されたことを通知する
     HANDLE                         heEventClosing;  //音声処理スレッドが停止処理を開始したことを通知する
     RGYQueueMPMP<AVPktMuxData, 64> qPackets;        //音声パケットをスレッドに渡すためのキュー
+    std::atomic<bool>              running;         //スレッドプールのいずれかのスレッドがこのworkerを処理中
+    std::vector<AVPktMuxData>      batch;           //スレッドプールでまとめて取り出したデータ (runningを取得したスレッドのみが使用)
 
     AVMuxThreadWorker();
     ~AVMuxThreadWorker();
@@ -299,6 +305,18 @@ struct AVMuxThreadAudio {
     void closeProcess();
 };
 
+//トラックごとのworker(process/encode)を共有のスレッドで処理するスレッドプール
+//各workerは同時に1スレッドのみが処理するので、トラック内の順序は保持される
+struct AVMuxThreadAudioPool {
+    std::vector<std::thread>       threads;         //プールのスレッド
+    std::vector<std::pair<AVMuxThreadWorker *, int>> workers; //処理対象のworkerと種類 (AUD_QUEUE_PROCESS/AUD_QUEUE_ENCODE)
+    std::atomic<bool>              thAbort;         //プールのスレッドに停止を通知する
+    HANDLE                         heEventPktAdded; //いずれかのworkerにデータが追加されたことを通知する
+
+    AVMuxThreadAudioPool();
+    ~AVMuxThreadAudioPool();
+};
+
 #if ENABLE_AVCODEC_OUT_THREAD
 struct AVMuxThread {
     bool                           enableOutputThread;        //出力スレッドを使用する
@@ -309,6 +327,7 @@ struct AVMuxThread {
     RGYQueueMPMP<RGYBitstream, 64> qVideobitstreamFreePB;     //映像 P/Bフレーム用に空いているデータ領域を格納する
     RGYQueueMPMP<RGYBitstream, 64> qVideobitstream;           //映像パケットを出力スレッドに渡すためのキュー
     std::unordered_map<const AVMuxAudio *, std::unique_ptr<AVMuxThreadAudio>> thAud; //音声スレッド
+    std::unique_ptr<AVMuxThreadAudioPool> audPool;            //トラックごとの音声処理を共有して行うスレッドプール
     std::atomic<int64_t>           streamOutMaxDts;           //音声・字幕キューの最後のdts (timebase = QUEUE_DTS_TIMEBASE) (キューの同期に使用)
     PerfQueueInfo                 *queueInfo;                 //キューの情報を格納する構造体
 
@@ -326,6 +345,7 @@ struct AVMux {
     vector<AVMuxAudio>  audio;
     vector<AVMuxOther>  other;
     vector<sTrim>       trim;
+    vector<int64_t>     trimCutPrefix; // trim_cut_frames_prefix(trim)
 #if ENABLE_AVCODEC_OUT_THREAD
     AVMuxThread         thread;
 #endif
@@ -393,6 +413,7 @@ struct AvcodecWriterPrm {
     RGYParamThread               threadParamOutput;       //出力スレッドのパラメータ
     RGYParamThread               threadParamAudio;        //音声処理スレッドのパラメータ
     RGYOptList                   muxOpt;                  //mux時に使用するオプション
+    RGYParamSegment              segment;                 //セグメント出力の設定
     PerfQueueInfo               *queueInfo;               //キューの情報を格納する構造体
     tstring                      muxVidTsLogFile;         //mux timestampログファイル
     const RGYHDRMetadata        *hdrMetadataIn;           //HDR関連のmetadata
@@ -409,6 +430,7 @@ struct AvcodecWriterPrm {
     bool                         debugDirectAV1Out;       //AV1出力のデバッグ用
     bool                         HEVCAlphaChannel;        //HEVCのalphaチェンネルを使用するか
     int                          HEVCAlphaChannelMode;    //HEVCのalphaチェンネルのモード
+    bool                         videoParamSetsInBand;    //パラメータセットがストリーム中で切り替わる
     RGYPoolAVPacket             *poolPkt;                 //読み込み側からわたってきたパケットの返却先
     RGYPoolAVFrame              *poolFrame;               //読み込み側からわたってきたパケットの返却先
 
@@ -435,6 +457,7 @@ struct AvcodecWriterPrm {
         threadParamOutput(),
         threadParamAudio(),
         muxOpt(),
+        segment(),
         queueInfo(nullptr),
         muxVidTsLogFile(),
         hdrMetadataIn(nullptr),
@@ -451,6 +474,7 @@ struct AvcodecWriterPrm {
         debugDirectAV1Out(false),
         HEVCAlphaChannel(false),
         HEVCAlphaChannelMode(0),
+        videoParamSetsInBand(false),
         poolPkt(nullptr),
         poolFrame(nullptr) {
     }
@@ -479,6 +503,9 @@ public:
     int writePacket(const uint8_t *buf, int buf_size);
     int64_t seek(int64_t offset, int whence);
 #endif //USE_CUSTOM_IO
+    //映像パケットのpayload用のpoolを返す (統計情報の表示用)
+    RGYPoolAVBuffer *GetVideoPacketBufferPool() { return m_Mux.video.poolBuf.get(); }
+
     //出力スレッドのハンドルを取得する
     HANDLE getThreadHandleOutput();
     HANDLE getThreadHandleAudProcess();
@@ -495,12 +522,28 @@ protected:
     //別のスレッドで実行する場合のスレッド関数 (音声エンコード処理)
     RGY_ERR ThreadFuncAudEncodeThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam);
 
+    //スレッドプールで実行する場合のスレッド関数 (音声処理/音声エンコード処理)
+    RGY_ERR ThreadFuncAudPool(const int threadIdx, RGYParamThread threadParam);
+
+    //workerのキューから最大maxPackets個のデータをまとめて取り出して処理する (他のスレッドが処理中なら何もしない)
+    //processではデコードしたフレームをまとめてフィルタに、encodeではエンコード結果をまとめて出力キューに渡す
+    int RunAudioWorker(AVMuxThreadWorker *worker, const int type, const int maxPackets);
+
+    //音声スレッドプールを開始する
+    RGY_ERR StartAudioThreadPool(RGYParamThread threadParam);
+
+    //音声スレッドプールのキューを処理しきってから終了する
+    void CloseAudioThreadPool();
+
     //対象パケットの担当スレッドを探す
     AVMuxThreadWorker *getPacketWorker(const AVMuxAudio *muxAudio, const int type);
 
     //音声出力キューに追加 (音声処理スレッドが有効な場合のみ有効)
     RGY_ERR AddAudQueue(AVPktMuxData *pktData, int type);
 
+    //音声出力キューにまとめて追加し、追加先への通知は1回にする (音声処理スレッドが有効な場合のみ有効)
+    RGY_ERR AddAudQueue(vector<AVPktMuxData>& pktDatas, int type);
+
     //AVPktMuxDataを初期化する
     AVPktMuxData pktMuxData(AVPacket *pkt);
 
@@ -516,7 +559,8 @@ protected:
     RGY_ERR WriteNextPacketInternal(AVPktMuxData *pktData, int64_t maxDtsToWrite);
 
     //WriteNextPacketの音声処理部分(デコード/thAudEncodeがなければエンコードも担当)
-    RGY_ERR WriteNextPacketAudio(AVPktMuxData *pktData);
+    //decodedFramesを指定した場合、デコードしたフレームはフィルタに渡さずdecodedFramesに追加する
+    RGY_ERR WriteNextPacketAudio(AVPktMuxData *pktData, vector<AVPktMuxData> *decodedFrames = nullptr);
 
     //WriteNextPacketの音声処理部分(エンコード)
     RGY_ERR WriteNextPacketAudioFrame(vector<AVPktMuxData> audioFrames);
@@ -525,7 +569,8 @@ protected:
     RGY_ERR WriteNextPacketToAudioSubtracks(vector<AVPktMuxData> audioFrames);
 
     //音声フレームをエンコード
-    RGY_ERR WriteNextAudioFrame(AVPktMuxData *pktData);
+    //encodedPktsを指定した場合、エンコード結果は出力キューに渡さずencodedPktsに追加する
+    RGY_ERR WriteNextAudioFrame(AVPktMuxData *pktData, vector<AVPktMuxData> *encodedPkts = nullptr);
 
     //音声のフィルタリングを実行
     vector<AVPktMuxData> AudioFilterFrame(vector<AVPktMuxData> audioFrames);
@@ -578,6 +623,9 @@ protected:
     //Attachmentの初期化
     RGY_ERR InitAttachment(AVMuxOther *pMuxAttach, const AttachmentSource& attachment);
 
+    //セグメント出力(hls/dash)のmuxerのオプションを設定
+    RGY_ERR InitSegment(const RGYParamSegment& segment, const std::string& filename);
+
     //チャプターをコピー
     RGY_ERR SetChapters(const vector<const AVChapter *>& chapterList, bool chapterNoTrim);
 
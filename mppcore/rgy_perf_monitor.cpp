@@ -36,6 +36,7 @@
 #include <string>
 #include "rgy_status.h"
 #include "rgy_perf_monitor.h"
+#include "rgy_filter.h"
 #include "rgy_resource.h"
 #include "cpu_info.h"
 #include "rgy_osdep.h"
@@ -47,6 +48,9 @@
 #include <psapi.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -440,6 +444,254 @@ tstring CPerfMonitor::SelectedCounters(int select) {
     return str;
 }
 
+#if !(defined(_WIN32) || defined(_WIN64))
+RGYProcFile::RGYProcFile() : m_fd(-1), m_buf() {}
+
+RGYProcFile::~RGYProcFile() {
+    close();
+}
+
+bool RGYProcFile::open(const std::string& path) {
+    close();
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return m_fd >= 0;
+}
+
+void RGYProcFile::close() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+const char *RGYProcFile::read() {
+    if (m_fd < 0) {
+        return nullptr;
+    }
+    if (m_buf.size() == 0) {
+        m_buf.resize(4096);
+    }
+    size_t filled = 0;
+    for (;;) {
+        const auto ret = pread(m_fd, m_buf.data() + filled, m_buf.size() - 1 - filled, (off_t)filled);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return nullptr;
+        }
+        filled += ret;
+        //procfs/sysfsは一度のreadでバッファを埋められるだけ返すので、埋まらなければ終端
+        if (filled < m_buf.size() - 1) {
+            break;
+        }
+        m_buf.resize(m_buf.size() * 2);
+    }
+    m_buf[filled] = '\0';
+    return m_buf.data();
+}
+
+RGYPerfSamplerLinux::RGYPerfSamplerLinux(const std::string& procRoot, const std::string& sysRoot) :
+    m_procRoot(procRoot),
+    m_sysRoot(sysRoot),
+    m_clockTick(100),
+    m_stat(),
+    m_status(),
+    m_io(),
+    m_task(),
+    m_devfreq(),
+    m_rgaLoad(),
+    m_hasGPU(false),
+    m_hasVEE(false),
+    m_hasVED(false) {
+}
+
+RGYPerfSamplerLinux::~RGYPerfSamplerLinux() {
+    m_task.clear();
+    m_devfreq.clear();
+}
+
+int64_t RGYPerfSamplerLinux::monotonicTimeUs() {
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int RGYPerfSamplerLinux::init() {
+    const auto clockTick = sysconf(_SC_CLK_TCK);
+    if (clockTick > 0) {
+        m_clockTick = clockTick;
+    }
+    if (!m_stat.open(m_procRoot + "/stat")) {
+        return 1;
+    }
+    m_status.open(m_procRoot + "/status");
+    m_io.open(m_procRoot + "/io");
+
+    //devfreqからGPU(Mali)/VPUの使用率とクロックを取得する
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(m_sysRoot) / "class" / "devfreq", ec)) {
+        const auto name = tolowercase(entry.path().filename().string());
+        DevfreqType type = DevfreqType::GPU;
+        if (name.find("gpu") != std::string::npos || name.find("mali") != std::string::npos) {
+            type = DevfreqType::GPU;
+        } else if (name.find("venc") != std::string::npos || name.find("vepu") != std::string::npos) {
+            type = DevfreqType::VEE;
+        } else if (name.find("vdec") != std::string::npos || name.find("vdpu") != std::string::npos) {
+            type = DevfreqType::VED;
+        } else {
+            continue;
+        }
+        auto dev = std::make_unique<DevfreqEntry>();
+        dev->type = type;
+        dev->load.open((entry.path() / "load").string());
+        dev->curFreq.open((entry.path() / "cur_freq").string());
+        if (!dev->load.isOpen() && !dev->curFreq.isOpen()) {
+            continue;
+        }
+        switch (type) {
+        case DevfreqType::GPU: m_hasGPU = true; break;
+        case DevfreqType::VEE: m_hasVEE = true; break;
+        case DevfreqType::VED: m_hasVED = true; break;
+        default: break;
+        }
+        m_devfreq.push_back(std::move(dev));
+    }
+    //RGAの使用率はdebugfsから取得する (root権限が必要)
+    m_rgaLoad.open(m_sysRoot + "/kernel/debug/rkrga/load");
+    return 0;
+}
+
+bool RGYPerfSamplerLinux::parseStatCPUTime(const char *stat, int64_t *utime_tick, int64_t *stime_tick) {
+    //comm(2番目の項目)には空白や')'が含まれうるので、最後の')'以降を解析する
+    const char *ptr = (stat) ? strrchr(stat, ')') : nullptr;
+    if (ptr == nullptr) {
+        return false;
+    }
+    //state(3) ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime(14) stime(15)
+    unsigned long long utime = 0, stime = 0;
+    if (2 != sscanf(ptr + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime)) {
+        return false;
+    }
+    *utime_tick = (int64_t)utime;
+    *stime_tick = (int64_t)stime;
+    return true;
+}
+
+bool RGYPerfSamplerLinux::readProcess(RGYPerfSampleProcess *sample) {
+    //読めなかった項目はsampleの値をそのまま残す
+    int64_t utime = 0, stime = 0;
+    const bool ret = parseStatCPUTime(m_stat.read(), &utime, &stime);
+    if (ret) {
+        sample->cpu_user_us   = utime * 1000000 / m_clockTick;
+        sample->cpu_kernel_us = stime * 1000000 / m_clockTick;
+    }
+    //メモリ情報
+    if (const char *status = m_status.read(); status != nullptr) {
+        long long i = 0;
+        const char *ptr = nullptr;
+        if ((ptr = strstr(status, "VmSize:")) != nullptr && 1 == sscanf(ptr, "VmSize: %lld kB", &i)) {
+            sample->mem_virtual = i << 10;
+        }
+        if ((ptr = strstr(status, "VmRSS:")) != nullptr && 1 == sscanf(ptr, "VmRSS: %lld kB", &i)) {
+            sample->mem_private = i << 10;
+        }
+    }
+    //IO情報
+    if (const char *io = m_io.read(); io != nullptr) {
+        long long i = 0;
+        const char *ptr = nullptr;
+        if ((ptr = strstr(io, "rchar:")) != nullptr && 1 == sscanf(ptr, "rchar: %lld", &i)) {
+            sample->io_total_read = i;
+        }
+        if ((ptr = strstr(io, "wchar:")) != nullptr && 1 == sscanf(ptr, "wchar: %lld", &i)) {
+            sample->io_total_write = i;
+        }
+    }
+    return ret;
+}
+
+int64_t RGYPerfSamplerLinux::readThread(uint32_t tid) {
+    if (tid == 0) {
+        return -1;
+    }
+    auto it = m_task.find(tid);
+    if (it == m_task.end()) {
+        auto file = std::make_unique<RGYProcFile>();
+        if (!file->open(m_procRoot + strsprintf("/task/%u/stat", tid))) {
+            return -1;
+        }
+        it = m_task.emplace(tid, std::move(file)).first;
+    }
+    int64_t utime = 0, stime = 0;
+    if (!parseStatCPUTime(it->second->read(), &utime, &stime)) {
+        //スレッドが終了している
+        m_task.erase(it);
+        return -1;
+    }
+    return (utime + stime) * 1000000 / m_clockTick;
+}
+
+bool RGYPerfSamplerLinux::readEngine(RGYPerfSampleEngine *sample) {
+    memset(sample, 0, sizeof(sample[0]));
+    for (auto& dev : m_devfreq) {
+        double load = -1.0, freqMHz = -1.0;
+        //"<load>@<freq>Hz"
+        if (const char *str = dev->load.read(); str != nullptr) {
+            int l = 0;
+            long long f = 0;
+            const int n = sscanf(str, "%d@%lldHz", &l, &f);
+            if (n >= 1) load = (double)l;
+            if (n >= 2) freqMHz = f * 1e-6;
+        }
+        if (const char *str = dev->curFreq.read(); str != nullptr) {
+            long long f = 0;
+            if (1 == sscanf(str, "%lld", &f)) freqMHz = f * 1e-6;
+        }
+        switch (dev->type) {
+        case DevfreqType::GPU:
+            if (load >= 0.0) {
+                sample->gpu_valid = true;
+                sample->gpu_load_percent = std::max(sample->gpu_load_percent, load);
+            }
+            if (freqMHz >= 0.0) {
+                sample->gpu_valid = true;
+                sample->gpu_clock = std::max(sample->gpu_clock, freqMHz);
+            }
+            break;
+        case DevfreqType::VEE:
+            if (load >= 0.0) {
+                sample->vee_valid = true;
+                sample->vee_load_percent = std::max(sample->vee_load_percent, load);
+            }
+            if (freqMHz >= 0.0) sample->ve_clock = std::max(sample->ve_clock, freqMHz);
+            break;
+        case DevfreqType::VED:
+            if (load >= 0.0) {
+                sample->ved_valid = true;
+                sample->ved_load_percent = std::max(sample->ved_load_percent, load);
+            }
+            if (freqMHz >= 0.0) sample->ve_clock = std::max(sample->ve_clock, freqMHz);
+            break;
+        default:
+            break;
+        }
+    }
+    //RGAはコアごとに "load = <n>%" が出力されるので、最大値をとる
+    if (const char *str = m_rgaLoad.read(); str != nullptr) {
+        for (const char *ptr = str; (ptr = strstr(ptr, "load")) != nullptr; ) {
+            ptr += strlen("load");
+            int l = 0;
+            if (1 == sscanf(ptr, " = %d%%", &l)) {
+                sample->rga_valid = true;
+                sample->rga_load_percent = std::max(sample->rga_load_percent, (double)l);
+            }
+        }
+    }
+    return sample->gpu_valid || sample->vee_valid || sample->ved_valid || sample->rga_valid;
+}
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+
 CPerfMonitor::CPerfMonitor() :
     m_nStep(0),
     m_luid({ 0, 0 }),
@@ -471,6 +723,12 @@ CPerfMonitor::CPerfMonitor() :
     m_nSelectOutputPlot(0),
     m_QueueInfo(),
     m_pRGYLog(),
+#if !(defined(_WIN32) || defined(_WIN64))
+    m_sampler(),
+    m_tidMain(0),
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    m_metricsServer(),
+    m_filterPerf(),
 #if ENABLE_METRIC_FRAMEWORK
     m_pLoader(nullptr),
     m_pManager(),
@@ -518,6 +776,11 @@ void CPerfMonitor::clear() {
 #endif //#if ENABLE_PERF_COUNTER
     memset(m_info, 0, sizeof(m_info));
     memset(&m_QueueInfo, 0, sizeof(m_QueueInfo));
+#if !(defined(_WIN32) || defined(_WIN64))
+    m_sampler.reset();
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    m_metricsServer.reset();
+    std::atomic_store(&m_filterPerf, std::shared_ptr<const std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>>>());
 #if ENABLE_METRIC_FRAMEWORK
     if (m_pManager) {
         const auto metricsUsed = m_Consumer.getMetricUsed();
@@ -629,6 +892,9 @@ std::string CPerfMonitor::write_header(int nSelect) {
     if (nSelect & PERF_MONITOR_VE_CLOCK) {
         str += ",video engine clock (MHz)";
     }
+    if (nSelect & PERF_MONITOR_RGA_LOAD) {
+        str += ",rga load (%)";
+    }
     if (nSelect & PERF_MONITOR_PCIE_LOAD) {
         str += ",pcie link,pcie tx, pci rx";
     }
@@ -700,16 +966,37 @@ int CPerfMonitor::init(tstring filename, const TCHAR *pPythonPath,
     m_luid = prm->luid;
     m_pid = GetCurrentProcessId();
 
+#if defined(_WIN32) || defined(_WIN64)
     m_nCreateTime100ns = (int64_t)(clock() * (1e7 / CLOCKS_PER_SEC) + 0.5);
+#else
+    m_nCreateTime100ns = RGYPerfSamplerLinux::monotonicTimeUs() * 10;
+    m_tidMain = GetCurrentThreadId();
+    m_sampler = std::make_unique<RGYPerfSamplerLinux>();
+    if (m_sampler->init()) {
+        AddMessage(RGY_LOG_WARN, _T("Failed to open /proc/self/stat, cpu usage monitoring disabled.\n"));
+        m_sampler.reset();
+    }
+#endif
     m_sMonitorFilename = filename;
     m_nInterval = interval;
     m_nSelectOutputPlot = nSelectOutputPlot;
     m_nSelectOutputLog = nSelectOutputLog;
     m_nSelectCheck = m_nSelectOutputLog | m_nSelectOutputPlot;
+    if (prm->metricsListen.length() > 0) {
+        m_nSelectCheck = (int)PERF_MONITOR_ALL; //metricsには取得可能なものをすべて出力する
+    }
     m_thMainThread = std::move(thMainThread);
     m_threadParam = threadParam;
     m_refreshedTime = std::chrono::system_clock::now() - std::chrono::milliseconds(m_nInterval);
 
+    if (prm->metricsListen.length() > 0) {
+        m_metricsServer = std::make_unique<RGYMetricsServer>();
+        if (m_metricsServer->start(prm->metricsListen, pRGYLog) != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_WARN, _T("Failed to start metrics server on %s, disabled.\n"), prm->metricsListen.c_str());
+            m_metricsServer.reset();
+        }
+    }
+
     if (!m_fpLog && m_sMonitorFilename.length() > 0) {
         m_fpLog = std::unique_ptr<FILE, fp_deleter>(_tfopen(m_sMonitorFilename.c_str(), _T("a")));
         if (!m_fpLog) {
@@ -853,15 +1140,35 @@ int CPerfMonitor::init(tstring filename, const TCHAR *pPythonPath,
 
     //未実装
 #if !(defined(_WIN32) || defined(_WIN64))
-    m_nSelectCheck &= (~PERF_MONITOR_THREAD_MAIN);
+    //Linuxではエンコードスレッドのハンドルを受け取らない
     m_nSelectCheck &= (~PERF_MONITOR_THREAD_ENC);
-    m_nSelectCheck &= (~PERF_MONITOR_THREAD_AUDP);
-    m_nSelectCheck &= (~PERF_MONITOR_THREAD_AUDE);
-    m_nSelectCheck &= (~PERF_MONITOR_THREAD_OUT);
-    m_nSelectCheck &= (~PERF_MONITOR_THREAD_IN);
-    m_nSelectCheck &= (~PERF_MONITOR_GPU_CLOCK);
-    m_nSelectCheck &= (~PERF_MONITOR_GPU_LOAD);
     m_nSelectCheck &= (~PERF_MONITOR_MFX_LOAD);
+    if (!m_sampler) {
+        m_nSelectCheck &= (~PERF_MONITOR_THREAD_MAIN);
+        m_nSelectCheck &= (~PERF_MONITOR_THREAD_AUDP);
+        m_nSelectCheck &= (~PERF_MONITOR_THREAD_AUDE);
+        m_nSelectCheck &= (~PERF_MONITOR_THREAD_OUT);
+        m_nSelectCheck &= (~PERF_MONITOR_THREAD_IN);
+    }
+    //SoCのエンジンはdevfreq/debugfsが見つかったもののみ
+    if (!m_sampler || !m_sampler->hasGPU()) {
+        m_nSelectCheck &= (~PERF_MONITOR_GPU_CLOCK);
+        m_nSelectCheck &= (~PERF_MONITOR_GPU_LOAD);
+    }
+    if (!m_sampler || !m_sampler->hasVEE()) {
+        m_nSelectCheck &= (~PERF_MONITOR_VEE_LOAD);
+    }
+    if (!m_sampler || !m_sampler->hasVED()) {
+        m_nSelectCheck &= (~PERF_MONITOR_VED_LOAD);
+    }
+    if (!m_sampler || !(m_sampler->hasVEE() || m_sampler->hasVED())) {
+        m_nSelectCheck &= (~PERF_MONITOR_VE_CLOCK);
+    }
+    if (!m_sampler || !m_sampler->hasRGA()) {
+        m_nSelectCheck &= (~PERF_MONITOR_RGA_LOAD);
+    }
+#else
+    m_nSelectCheck &= (~PERF_MONITOR_RGA_LOAD);
 #endif //#if defined(_WIN32) || defined(_WIN64)
 
 #if ENCODER_QSV
@@ -905,6 +1212,93 @@ void CPerfMonitor::SetThreadHandles(HANDLE thEncThread, HANDLE thInThread, HANDL
     m_thAudEncThread = thAudEncThread;
 }
 
+void CPerfMonitor::SetFilterPerf(const std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>>& filterPerf) {
+    //perf monitorのスレッドから参照されるので、差し替えはatomicに行う
+    std::atomic_store(&m_filterPerf, std::shared_ptr<const std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>>>(
+        std::make_shared<std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>>>(filterPerf)));
+}
+
+void CPerfMonitor::publishMetrics() {
+    if (!m_metricsServer) {
+        return;
+    }
+    const PerfInfo *pInfo = &m_info[m_nStep & 1];
+    auto snapshot = std::make_shared<RGYMetricsSnapshot>();
+    snapshot->uptimeSec = pInfo->time_us * 1e-6;
+    snapshot->encStarted = m_bEncStarted;
+    if (m_bEncStarted && m_pEncStatus) {
+        const EncodeStatusData data = m_pEncStatus->GetEncodeData();
+        snapshot->framesIn   = data.frameIn;
+        snapshot->framesOut  = data.frameOut;
+        snapshot->framesDrop = data.frameDrop;
+        snapshot->outBytes   = data.outFileSize;
+        snapshot->frameTypes = {
+            { "IDR", data.frameOutIDR, 0,                  0,                   false },
+            { "I",   data.frameOutI,   data.frameOutISize, data.frameOutIQPSum, true },
+            { "P",   data.frameOutP,   data.frameOutPSize, data.frameOutPQPSum, true },
+            { "B",   data.frameOutB,   data.frameOutBSize, data.frameOutBQPSum, true },
+        };
+    }
+    snapshot->fps            = pInfo->fps;
+    snapshot->fpsAvg         = pInfo->fps_avg;
+    snapshot->bitrateKbps    = pInfo->bitrate_kbps;
+    snapshot->bitrateKbpsAvg = pInfo->bitrate_kbps_avg;
+    snapshot->queueVidIn     = m_QueueInfo.usage_vid_in;
+    snapshot->queueAudIn     = m_QueueInfo.usage_aud_in;
+    snapshot->queueVidOut    = m_QueueInfo.usage_vid_out;
+    snapshot->queueAudOut    = m_QueueInfo.usage_aud_out;
+    snapshot->queueAudProc   = m_QueueInfo.usage_aud_proc;
+    snapshot->queueAudEnc    = m_QueueInfo.usage_aud_enc;
+    snapshot->cpuPercent       = pInfo->cpu_percent;
+    snapshot->cpuKernelPercent = pInfo->cpu_kernel_percent;
+    const std::pair<int, RGYMetricsThreadCPU> threads[] = {
+        { PERF_MONITOR_THREAD_MAIN, { "main",     pInfo->main_thread_percent,     pInfo->main_thread_total_active_us * 1e-6 } },
+        { PERF_MONITOR_THREAD_ENC,  { "enc",      pInfo->enc_thread_percent,      pInfo->enc_thread_total_active_us * 1e-6 } },
+        { PERF_MONITOR_THREAD_IN,   { "in",       pInfo->in_thread_percent,       pInfo->in_thread_total_active_us * 1e-6 } },
+        { PERF_MONITOR_THREAD_OUT,  { "out",      pInfo->out_thread_percent,      pInfo->out_thread_total_active_us * 1e-6 } },
+        { PERF_MONITOR_THREAD_AUDP, { "aud_proc", pInfo->aud_proc_thread_percent, pInfo->aud_proc_thread_total_active_us * 1e-6 } },
+        { PERF_MONITOR_THREAD_AUDE, { "aud_enc",  pInfo->aud_enc_thread_percent,  pInfo->aud_enc_thread_total_active_us * 1e-6 } },
+    };
+    for (const auto& th : threads) {
+        if (m_nSelectCheck & th.first) {
+            snapshot->threads.push_back(th.second);
+        }
+    }
+    snapshot->memPrivate   = pInfo->mem_private;
+    snapshot->memVirtual   = pInfo->mem_virtual;
+    snapshot->ioTotalRead  = pInfo->io_total_read;
+    snapshot->ioTotalWrite = pInfo->io_total_write;
+    snapshot->gpuInfoValid = pInfo->gpu_info_valid != FALSE;
+    snapshot->gpuLoad      = pInfo->gpu_load_percent;
+    snapshot->gpuClock     = pInfo->gpu_clock;
+    snapshot->veeLoad      = pInfo->vee_load_percent;
+    snapshot->vedLoad      = pInfo->ved_load_percent;
+    snapshot->veClock      = pInfo->ve_clock;
+    snapshot->rgaLoad      = pInfo->rga_load_percent;
+    if (auto filterPerf = std::atomic_load(&m_filterPerf); filterPerf) {
+        for (const auto& [name, perf] : *filterPerf) {
+            if (perf) {
+                //histogramの_count/_sumとbucketが矛盾しないよう、同じ集計結果から作成する
+                const auto stat = perf->GetStat();
+                RGYMetricsFilterTime filter = { tchar_to_string(name), stat.avgMs(), stat.totalMs, stat.count };
+                int64_t cumulative = 0;
+                for (int i = 0; i < RGYFilterPerfStat::BUCKETS; i++) {
+                    cumulative += stat.hist[i];
+                    //出力するbucketは2倍刻みのみとする
+                    if (RGYFilterPerfStat::isOctaveBoundary(i)) {
+                        filter.buckets.push_back({ RGYFilterPerfStat::bucketUpperMs(i), cumulative });
+                    }
+                }
+                snapshot->filters.push_back(filter);
+                for (const auto& [kernel, kstat] : perf->GetKernelStat()) {
+                    snapshot->kernels.push_back({ filter.name, kernel, kstat.totalMs, kstat.count });
+                }
+            }
+        }
+    }
+    m_metricsServer->publish(snapshot);
+}
+
 void CPerfMonitor::check() {
     PerfInfo *pInfoNew = &m_info[(m_nStep + 1) & 1];
     PerfInfo *pInfoOld = &m_info[ m_nStep      & 1];
@@ -1033,50 +1427,42 @@ void CPerfMonitor::check() {
 #endif //#if ENABLE_PERF_COUNTER
 
 #if !(defined(_WIN32) || defined(_WIN64))
-    struct rusage usage = { 0 };
-    getrusage(RUSAGE_SELF, &usage);
-
-    //現在時間
-    uint64_t current_time = clock() * (1e7 / CLOCKS_PER_SEC);
-
-    std::string proc_dir = strsprintf("/proc/%d/", (int)getpid());
-    //メモリ情報
-    FILE *fp_mem = popen((std::string("cat ") + proc_dir + std::string("status")).c_str(), "r");
-    if (fp_mem) {
-        char buffer[2048] = { 0 };
-        while (NULL != fgets(buffer, _countof(buffer), fp_mem)) {
-            if (nullptr != strstr(buffer, "VmSize")) {
-                long long i = 0;
-                if (1 == sscanf(buffer, "VmSize: %lld kB", &i)) {
-                    pInfoNew->mem_virtual = i << 10;
-                }
-            } else if (nullptr != strstr(buffer, "VmRSS")) {
-                long long i = 0;
-                if (1 == sscanf(buffer, "VmRSS: %lld kB", &i)) {
-                    pInfoNew->mem_private = i << 10;
-                }
-            }
+    //現在時間 (CLOCK_MONOTONIC)
+    const uint64_t current_time = RGYPerfSamplerLinux::monotonicTimeUs() * 10;
+
+    //CPU/メモリ/IO情報 (読めなかった項目は前回の値のまま)
+    RGYPerfSampleProcess proc = { 0 };
+    proc.cpu_user_us    = pInfoNew->cpu_total_us - pInfoNew->cpu_total_kernel_us;
+    proc.cpu_kernel_us  = pInfoNew->cpu_total_kernel_us;
+    proc.mem_private    = pInfoNew->mem_private;
+    proc.mem_virtual    = pInfoNew->mem_virtual;
+    proc.io_total_read  = pInfoNew->io_total_read;
+    proc.io_total_write = pInfoNew->io_total_write;
+    if (m_sampler) {
+        m_sampler->readProcess(&proc);
+    }
+    pInfoNew->mem_private    = proc.mem_private;
+    pInfoNew->mem_virtual    = proc.mem_virtual;
+    pInfoNew->io_total_read  = proc.io_total_read;
+    pInfoNew->io_total_write = proc.io_total_write;
+
+    //SoCのエンジン(GPU/VPU/RGA)の使用率
+    pInfoNew->rga_load_percent = 0.0;
+    RGYPerfSampleEngine engine = { 0 };
+    if (m_sampler && m_sampler->readEngine(&engine)) {
+        pInfoNew->gpu_info_valid = TRUE;
+        if (engine.gpu_valid) {
+            pInfoNew->gpu_load_percent = engine.gpu_load_percent;
+            pInfoNew->gpu_clock        = engine.gpu_clock;
         }
-        pclose(fp_mem);
-    }
-    //IO情報
-    FILE *fp_io = popen((std::string("cat ") + proc_dir + std::string("io")).c_str(), "r");
-    if (fp_io) {
-        char buffer[2048] = { 0 };
-        while (NULL != fgets(buffer, _countof(buffer), fp_io)) {
-            if (nullptr != strstr(buffer, "rchar:")) {
-                long long i = 0;
-                if (1 == sscanf(buffer, "rchar: %lld", &i)) {
-                    pInfoNew->io_total_read = i;
-                }
-            } else if (nullptr != strstr(buffer, "wchar")) {
-                long long i = 0;
-                if (1 == sscanf(buffer, "wchar: %lld", &i)) {
-                    pInfoNew->io_total_write = i;
-                }
-            }
+        if (engine.vee_valid) {
+            pInfoNew->vee_load_percent = engine.vee_load_percent;
+        }
+        if (engine.ved_valid) {
+            pInfoNew->ved_load_percent = engine.ved_load_percent;
         }
-        pclose(fp_io);
+        pInfoNew->ve_clock = engine.ve_clock;
+        pInfoNew->rga_load_percent = engine.rga_load_percent;
     }
 
     //CPU情報
@@ -1089,10 +1475,8 @@ void CPerfMonitor::check() {
         pInfoNew->cpu_total_us = (pt.user + pt.kernel) / 10;
         pInfoNew->cpu_total_kernel_us = pt.kernel / 10;
 #else
-        int64_t cpu_user_us = usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec;
-        int64_t cpu_kernel_us = usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
-        pInfoNew->cpu_total_us = cpu_user_us + cpu_kernel_us;
-        pInfoNew->cpu_total_kernel_us = cpu_kernel_us;
+        pInfoNew->cpu_total_us = proc.cpu_user_us + proc.cpu_kernel_us;
+        pInfoNew->cpu_total_kernel_us = proc.cpu_kernel_us;
 #endif //#if defined(_WIN32) || defined(_WIN64)
 
         //CPU使用率
@@ -1166,6 +1550,25 @@ void CPerfMonitor::check() {
                 pInfoNew->out_thread_percent = 0.0;
             }
         }
+#else
+        //スレッドCPU使用率 (/proc/self/task/<tid>/stat)
+        if (m_sampler) {
+            auto getThreadUsage = [&](const uint32_t tid, int64_t *total_active_us, double *percent, const int64_t old_total_active_us) {
+                const int64_t thread_us = m_sampler->readThread(tid);
+                if (thread_us < 0) {
+                    *percent = 0.0;
+                    return;
+                }
+                *total_active_us = thread_us;
+                //初回は差分がとれないので0とする
+                *percent = (old_total_active_us > 0) ? (thread_us - old_total_active_us) * 100.0 * logical_cpu_inv * time_diff_inv : 0.0;
+            };
+            getThreadUsage(m_tidMain,                 &pInfoNew->main_thread_total_active_us,     &pInfoNew->main_thread_percent,     pInfoOld->main_thread_total_active_us);
+            getThreadUsage(m_QueueInfo.tid_aud_proc,  &pInfoNew->aud_proc_thread_total_active_us, &pInfoNew->aud_proc_thread_percent, pInfoOld->aud_proc_thread_total_active_us);
+            getThreadUsage(m_QueueInfo.tid_aud_enc,   &pInfoNew->aud_enc_thread_total_active_us,  &pInfoNew->aud_enc_thread_percent,  pInfoOld->aud_enc_thread_total_active_us);
+            getThreadUsage(m_QueueInfo.tid_in,        &pInfoNew->in_thread_total_active_us,       &pInfoNew->in_thread_percent,       pInfoOld->in_thread_total_active_us);
+            getThreadUsage(m_QueueInfo.tid_out,       &pInfoNew->out_thread_total_active_us,      &pInfoNew->out_thread_percent,      pInfoOld->out_thread_total_active_us);
+        }
 #endif //defined(_WIN32) || defined(_WIN64)
     }
 
@@ -1250,6 +1653,9 @@ std::string CPerfMonitor::write(int nSelect) {
     if (nSelect & PERF_MONITOR_VE_CLOCK) {
         str += strsprintf(",%lf", pInfo->ve_clock);
     }
+    if (nSelect & PERF_MONITOR_RGA_LOAD) {
+        str += strsprintf(",%lf", pInfo->rga_load_percent);
+    }
     if (nSelect & PERF_MONITOR_PCIE_LOAD) {
         str += strsprintf(",PCIe %dx%d", pInfo->pcie_gen, pInfo->pcie_link);
         str += strsprintf(",%lf", pInfo->pcie_throughput_tx_per_sec);
@@ -1312,6 +1718,7 @@ void CPerfMonitor::run() {
         auto timenow = std::chrono::system_clock::now();
         if (m_nInterval <= 100 || timenow - m_refreshedTime > std::chrono::milliseconds(m_nInterval)) {
             check();
+            publishMetrics();
             if (m_pProcess && !m_pProcess->processAlive()) {
                 m_pProcess->stdInFpClose();
                 if (m_nSelectOutputPlot) {
@@ -1330,6 +1737,7 @@ void CPerfMonitor::run() {
         std::this_thread::sleep_for(std::chrono::milliseconds((m_nInterval <= 100) ? m_nInterval : 50));
     }
     check();
+    publishMetrics();
     if (m_fpLog)  fprintf(m_fpLog.get(), "%s", write(m_nSelectOutputLog).c_str());
     if (m_pProcess) {
         const auto str = write(m_nSelectOutputPlot);
@@ -42,6 +42,7 @@
 #include "gpuz_info.h"
 #include "rgy_util.h"
 #include "rgy_thread_affinity.h"
+#include "rgy_metrics_server.h"
 
 #if ENABLE_PERF_COUNTER
 #include "rgy_perf_counter.h"
@@ -70,6 +71,7 @@ typedef void * HANDLE;
 #endif
 
 class EncodeStatus;
+class RGYFilterPerf;
 
 enum : int {
     PERF_MONITOR_CPU           = 0x00000001,
@@ -101,6 +103,7 @@ enum : int {
     PERF_MONITOR_VEE_LOAD      = 0x04000000,
     PERF_MONITOR_VED_LOAD      = 0x08000000,
     PERF_MONITOR_PCIE_LOAD     = 0x10000000,
+    PERF_MONITOR_RGA_LOAD      = 0x20000000,
     PERF_MONITOR_ALL         = (int)UINT_MAX,
 };
 
@@ -127,16 +130,17 @@ static const CX_DESC list_pref_monitor[] = {
     { _T("bitrate"),     PERF_MONITOR_BITRATE },
     { _T("bitrate_avg"), PERF_MONITOR_BITRATE_AVG },
     { _T("frame_out"),   PERF_MONITOR_FRAME_OUT },
-    { _T("gpu"),         PERF_MONITOR_GPU_LOAD | PERF_MONITOR_VEE_LOAD | PERF_MONITOR_VED_LOAD | PERF_MONITOR_GPU_CLOCK | PERF_MONITOR_VE_CLOCK | PERF_MONITOR_PCIE_LOAD },
+    { _T("gpu"),         PERF_MONITOR_GPU_LOAD | PERF_MONITOR_VEE_LOAD | PERF_MONITOR_VED_LOAD | PERF_MONITOR_GPU_CLOCK | PERF_MONITOR_VE_CLOCK | PERF_MONITOR_PCIE_LOAD | PERF_MONITOR_RGA_LOAD },
     { _T("gpu_load"),    PERF_MONITOR_GPU_LOAD },
     { _T("gpu_clock"),   PERF_MONITOR_GPU_CLOCK },
 #if ENABLE_METRIC_FRAMEWORK
     { _T("mfx"),         PERF_MONITOR_MFX_LOAD },
 #endif
     { _T("vee_load"),    PERF_MONITOR_VEE_LOAD },
-    { _T("ved_load"),    PERF_MONITOR_VEE_LOAD },
+    { _T("ved_load"),    PERF_MONITOR_VED_LOAD },
     { _T("pcie_load"),   PERF_MONITOR_PCIE_LOAD },
     { _T("ve_clock"),    PERF_MONITOR_VE_CLOCK },
+    { _T("rga_load"),    PERF_MONITOR_RGA_LOAD },
     { _T("queue"),       PERF_MONITOR_QUEUE_VID_IN | PERF_MONITOR_QUEUE_VID_OUT | PERF_MONITOR_QUEUE_AUD_IN | PERF_MONITOR_QUEUE_AUD_OUT },
     { nullptr, 0 }
 };
@@ -192,6 +196,8 @@ struct PerfInfo {
     double  ved_load_percent;
     double  ve_clock;
 
+    double  rga_load_percent;
+
     int pcie_gen;
     int pcie_link;
     int pcie_throughput_tx_per_sec;
@@ -211,7 +217,98 @@ struct PerfQueueInfo {
     size_t usage_aud_out;
     size_t usage_aud_enc;
     size_t usage_aud_proc;
+    //各スレッドのthread id (Linuxでのスレッド別CPU使用率の取得用)
+    uint32_t tid_in;
+    uint32_t tid_out;
+    uint32_t tid_aud_proc;
+    uint32_t tid_aud_enc;
+};
+
+#if !(defined(_WIN32) || defined(_WIN64))
+//procfs/sysfsのファイルを開いたままにしておき、毎回preadで先頭から読み直す
+class RGYProcFile {
+public:
+    RGYProcFile();
+    ~RGYProcFile();
+    RGYProcFile(const RGYProcFile&) = delete;
+    RGYProcFile& operator=(const RGYProcFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return m_fd >= 0; }
+    //ファイル全体を読み直し、'\0'終端した文字列を返す (失敗時はnullptr)
+    const char *read();
+protected:
+    int m_fd;
+    std::vector<char> m_buf;
+};
+
+struct RGYPerfSampleProcess {
+    int64_t cpu_user_us;
+    int64_t cpu_kernel_us;
+    int64_t mem_private;
+    int64_t mem_virtual;
+    int64_t io_total_read;
+    int64_t io_total_write;
+};
+
+struct RGYPerfSampleEngine {
+    bool   gpu_valid;
+    double gpu_load_percent;
+    double gpu_clock;        //MHz
+    bool   vee_valid;
+    double vee_load_percent;
+    bool   ved_valid;
+    double ved_load_percent;
+    double ve_clock;         //MHz
+    bool   rga_valid;
+    double rga_load_percent;
+};
+
+//Linux用のサンプラー
+//procRoot(/proc/self)、sysRoot(/sys)を差し替えることで、偽のprocfs/sysfsを使ったテストが可能
+class RGYPerfSamplerLinux {
+public:
+    RGYPerfSamplerLinux(const std::string& procRoot = "/proc/self", const std::string& sysRoot = "/sys");
+    ~RGYPerfSamplerLinux();
+
+    //ファイルを開き、利用可能なSoCのエンジン(GPU/VPU/RGA)を探索する
+    int init();
+    //CLOCK_MONOTONICでの現在時刻 (us)
+    static int64_t monotonicTimeUs();
+
+    bool readProcess(RGYPerfSampleProcess *sample);
+    //スレッドのCPU時間 (us)、スレッドが存在しなければ-1
+    int64_t readThread(uint32_t tid);
+    bool readEngine(RGYPerfSampleEngine *sample);
+
+    bool hasGPU() const { return m_hasGPU; }
+    bool hasVEE() const { return m_hasVEE; }
+    bool hasVED() const { return m_hasVED; }
+    bool hasRGA() const { return m_rgaLoad.isOpen(); }
+protected:
+    enum class DevfreqType { GPU, VEE, VED };
+    struct DevfreqEntry {
+        DevfreqType type;
+        RGYProcFile load;    // "<load>@<freq>Hz"
+        RGYProcFile curFreq; // Hz
+    };
+    static bool parseStatCPUTime(const char *stat, int64_t *utime_tick, int64_t *stime_tick);
+
+    std::string m_procRoot;
+    std::string m_sysRoot;
+    int64_t m_clockTick;
+    RGYProcFile m_stat;
+    RGYProcFile m_status;
+    RGYProcFile m_io;
+    std::map<uint32_t, std::unique_ptr<RGYProcFile>> m_task;
+    std::vector<std::unique_ptr<DevfreqEntry>> m_devfreq;
+    RGYProcFile m_rgaLoad;
+    bool m_hasGPU;
+    bool m_hasVEE;
+    bool m_hasVED;
 };
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
 
 #if ENABLE_METRIC_FRAMEWORK
 
@@ -368,13 +465,14 @@ struct CPerfMonitorPrm {
     std::string pciBusId;
 #endif
     LUID luid;
+    tstring metricsListen; //OpenMetricsを提供するアドレス (空なら無効)
     char reserved[256];
 
     CPerfMonitorPrm() :
 #if ENABLE_NVML
         pciBusId(),
 #endif
-        luid({ 0 }), reserved() {};
+        luid({ 0 }), metricsListen(), reserved() {};
 };
 
 class CPerfMonitor {
@@ -389,6 +487,8 @@ public:
 
     void SetEncStatus(std::shared_ptr<EncodeStatus> encStatus);
     void SetThreadHandles(HANDLE thEncThread, HANDLE thInThread, HANDLE thOutThread, HANDLE thAudProcThread, HANDLE thAudEncThread);
+    //フィルタの処理時間をmetricsに出力する
+    void SetFilterPerf(const std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>>& filterPerf);
     PerfQueueInfo *GetQueueInfoPtr() {
         return &m_QueueInfo;
     }
@@ -443,6 +543,7 @@ protected:
     void run();
     std::string write_header(int nSelect);
     std::string write(int nSelect);
+    void publishMetrics();
 
     void AddMessage(RGYLogLevel log_level, const tstring &str) {
         if (m_pRGYLog == nullptr || log_level < m_pRGYLog->getLogLevel(RGY_LOGT_PERF_MONITOR)) {
@@ -505,6 +606,12 @@ protected:
     PerfQueueInfo m_QueueInfo;
     std::shared_ptr<RGYLog> m_pRGYLog;
     RGYParamThread m_threadParam;
+#if !(defined(_WIN32) || defined(_WIN64))
+    std::unique_ptr<RGYPerfSamplerLinux> m_sampler;
+    uint32_t m_tidMain;
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    std::unique_ptr<RGYMetricsServer> m_metricsServer;
+    std::shared_ptr<const std::vector<std::pair<tstring, std::shared_ptr<RGYFilterPerf>>>> m_filterPerf;
 
 #if ENABLE_METRIC_FRAMEWORK
     IExtensionLoader *m_pLoader;
@@ -1904,7 +1904,8 @@ VppOverlay::VppOverlay() :
     alpha(0.0f),
     alphaMode(VppOverlayAlphaMode::Override),
     lumaKey(),
-    loop(false) {
+    loop(false),
+    cache(FILTER_DEFAULT_OVERLAY_CACHE) {
 
 }
 
@@ -1918,7 +1919,8 @@ bool VppOverlay::operator==(const VppOverlay &x) const {
         && alpha == x.alpha
         && alphaMode == x.alphaMode
         && lumaKey == x.lumaKey
-        && loop == x.loop;
+        && loop == x.loop
+        && cache == x.cache;
 }
 bool VppOverlay::operator!=(const VppOverlay &x) const {
     return !(*this == x);
@@ -1944,12 +1946,13 @@ tstring VppOverlay::print() const {
         }
     }
     return strsprintf(_T("overlay: %s\n")
-        _T("                        pos (%d,%d), size %dx%d, loop %s\n")
+        _T("                        pos (%d,%d), size %dx%d, loop %s, cache %dMB\n")
         _T("                        alpha %s"),
         inputFile.c_str(),
         posX, posY,
         width, height,
         (loop) ? _T("on") : _T("off"),
+        cache,
         alphaStr.c_str());
 }
 
@@ -2224,6 +2227,25 @@ bool GPUAutoSelectMul::operator!=(const GPUAutoSelectMul &x) const {
     return !(*this == x);
 }
 
+RGYParamSegment::RGYParamSegment() :
+    enable(false),
+    format(RGYSegmentFormat::AUTO),
+    type(RGYSegmentType::AUTO),
+    duration(6.0),
+    listSize(0) {
+}
+
+bool RGYParamSegment::operator==(const RGYParamSegment &x) const {
+    return enable == x.enable
+        && format == x.format
+        && type == x.type
+        && duration == x.duration
+        && listSize == x.listSize;
+}
+bool RGYParamSegment::operator!=(const RGYParamSegment &x) const {
+    return !(*this == x);
+}
+
 RGYDebugLogFile::RGYDebugLogFile() : enable(false), filename() {}
 
 bool RGYDebugLogFile::operator==(const RGYDebugLogFile &x) const {
@@ -2295,6 +2317,7 @@ RGYParamCommon::RGYParamCommon() :
     audioIgnoreDecodeError(DEFAULT_IGNORE_DECODE_ERROR),
     videoIgnoreTimestampError(DEFAULT_VIDEO_IGNORE_TIMESTAMP_ERROR),
     muxOpt(),
+    segment(),
     allowOtherNegativePts(false),
     disableMp4Opt(false),
     debugDirectAV1Out(false),
@@ -2347,6 +2370,8 @@ RGYParamControl::RGYParamControl() :
     perfMonitorSelect(0),
     perfMonitorSelectMatplot(0),
     perfMonitorInterval(RGY_DEFAULT_PERF_MONITOR_INTERVAL),
+    metricsListen(),
+    inputList(),
     parentProcessID(0),
     lowLatency(false),
     gpuSelect(),
@@ -2355,6 +2380,7 @@ RGYParamControl::RGYParamControl() :
     avsdll(),
     vsdir(),
     enableOpenCL(true),
+    clFrameHistoryMB(0),
     enableVulkan(true),
     avoidIdleClock(),
     outputBufSizeMB(RGY_OUTPUT_BUF_MB_DEFAULT) {
@@ -2387,15 +2413,23 @@ std::pair<bool, int> frame_inside_range(int frame, const std::vector<sTrim> &tri
     if (frame < 0) {
         return std::make_pair(false, index);
     }
-    for (; index < (int)trimList.size(); index++) {
-        if (frame < trimList[index].start) {
-            return std::make_pair(false, index);
-        }
-        if (frame <= trimList[index].fin) {
-            return std::make_pair(true, index);
-        }
+    // trimListはソート済みで重複がないので、frame <= finとなる最初のブロックを二分探索する
+    const auto it = std::lower_bound(trimList.begin(), trimList.end(), frame, [](const sTrim& trim, const int f) { return trim.fin < f; });
+    index = (int)(it - trimList.begin());
+    if (it == trimList.end()) {
+        return std::make_pair(false, index);
+    }
+    return std::make_pair(frame >= it->start, index);
+}
+
+std::vector<int64_t> trim_cut_frames_prefix(const std::vector<sTrim> &trimList) {
+    std::vector<int64_t> prefix(trimList.size() + 1, 0);
+    int lastFin = 0;
+    for (size_t i = 0; i < trimList.size(); i++) {
+        prefix[i + 1] = prefix[i] + (trimList[i].start - lastFin);
+        lastFin = trimList[i].fin;
     }
-    return std::make_pair(false, index);
+    return prefix;
 }
 
 bool rearrange_trim_list(int frame, int offset, std::vector<sTrim> &trimList) {
@@ -2473,6 +2507,7 @@ bool invalid_with_raw_out(const RGYParamCommon &prm, shared_ptr<RGYLog> log) {
     INVALID_WITH_RAW_OUT(prm.formatMetadata.size() > 0, "--metadata");
     INVALID_WITH_RAW_OUT(prm.videoMetadata.size() > 0, "--video-metadata");
     INVALID_WITH_RAW_OUT(prm.muxOpt.size() > 0, "-m");
+    INVALID_WITH_RAW_OUT(prm.segment.enable, "--segment");
     INVALID_WITH_RAW_OUT(prm.keyFile.length() > 0, "--keyfile");
     INVALID_WITH_RAW_OUT(prm.timecodeFile.length() > 0, "--timecode");
     INVALID_WITH_RAW_OUT(prm.metric.ssim, "--ssim");
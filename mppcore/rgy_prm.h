@@ -411,6 +411,8 @@ static const int   FILTER_DEFAULT_DEBAND_SEED = 1234;
 static const bool  FILTER_DEFAULT_DEBAND_BLUR_FIRST = false;
 static const bool  FILTER_DEFAULT_DEBAND_RAND_EACH_FRAME = false;
 
+static const int   FILTER_DEFAULT_OVERLAY_CACHE = 256; // MB
+
 struct RGYQPSet {
     bool enable;
     int qpI, qpP, qpB;
@@ -437,6 +439,32 @@ const CX_DESC list_hevc_bsf_mode[] = {
     { NULL, 0 }
 };
 
+enum class RGYSegmentFormat {
+    AUTO,
+    HLS,
+    DASH
+};
+
+const CX_DESC list_segment_format[] = {
+    { _T("auto"), (int)RGYSegmentFormat::AUTO },
+    { _T("hls"),  (int)RGYSegmentFormat::HLS  },
+    { _T("dash"), (int)RGYSegmentFormat::DASH },
+    { NULL, 0 }
+};
+
+enum class RGYSegmentType {
+    AUTO,
+    TS,
+    FMP4
+};
+
+const CX_DESC list_segment_type[] = {
+    { _T("auto"), (int)RGYSegmentType::AUTO },
+    { _T("ts"),   (int)RGYSegmentType::TS   },
+    { _T("fmp4"), (int)RGYSegmentType::FMP4 },
+    { NULL, 0 }
+};
+
 const CX_DESC list_vpp_denoise[] = {
     { _T("none"),    0 },
 #if ENCODER_QSV
@@ -499,6 +527,9 @@ enum RGY_VPP_RESIZE_MODE {
 #if ENCODER_QSV
     RGY_VPP_RESIZE_MODE_MFX_LOWPOWER,
     RGY_VPP_RESIZE_MODE_MFX_QUALITY,
+#endif
+#if ENCODER_MPP
+    RGY_VPP_RESIZE_MODE_CL_2D,
 #endif
     RGY_VPP_RESIZE_MODE_UNKNOWN,
 };
@@ -661,6 +692,9 @@ const CX_DESC list_vpp_resize_mode[] = {
 #if ENCODER_QSV
     { _T("lowpower"), RGY_VPP_RESIZE_MODE_MFX_LOWPOWER },
     { _T("quality"),  RGY_VPP_RESIZE_MODE_MFX_QUALITY },
+#endif
+#if ENCODER_MPP
+    { _T("2d"),       RGY_VPP_RESIZE_MODE_CL_2D },
 #endif
     { NULL, 0 }
 };
@@ -2185,6 +2219,7 @@ struct VppOverlay {
     VppOverlayAlphaMode alphaMode;
     VppOverlayAlphaKey lumaKey;
     bool loop;
+    int cache; // デバイス側にキャッシュするフレームの上限 (MB, 0で無効)
 
     VppOverlay();
     bool operator==(const VppOverlay &x) const;
@@ -2394,6 +2429,19 @@ struct RGYDebugLogFile {
     tstring getFilename(const tstring& outputFilename, const tstring& defaultAppendix) const;
 };
 
+// --segment
+struct RGYParamSegment {
+    bool enable;
+    RGYSegmentFormat format; // autoなら出力ファイルの拡張子から決定
+    RGYSegmentType type;     // autoならhlsはts、dashはfmp4
+    double duration;         // セグメントの長さ (秒)
+    int listSize;            // プレイリストに残すセグメント数 (0ですべて)
+
+    RGYParamSegment();
+    bool operator==(const RGYParamSegment &x) const;
+    bool operator!=(const RGYParamSegment &x) const;
+};
+
 struct RGYParamInput {
     RGYResizeResMode resizeResMode;
     bool ignoreSAR;
@@ -2448,6 +2496,7 @@ struct RGYParamCommon {
     int audioIgnoreDecodeError;
     int videoIgnoreTimestampError;
     RGYOptList muxOpt;
+    RGYParamSegment segment;
     bool allowOtherNegativePts;
     bool disableMp4Opt;
     bool debugDirectAV1Out;
@@ -2511,6 +2560,8 @@ struct RGYParamControl {
     int64_t perfMonitorSelect;
     int64_t perfMonitorSelectMatplot;
     int     perfMonitorInterval;
+    tstring metricsListen;   //OpenMetricsを提供するアドレス
+    tstring inputList;       //バッチ処理するジョブの一覧
     uint32_t parentProcessID;
     bool lowLatency;
     GPUAutoSelectMul gpuSelect;
@@ -2519,6 +2570,7 @@ struct RGYParamControl {
     tstring avsdll;
     tstring vsdir;
     bool enableOpenCL;
+    int clFrameHistoryMB;        //OpenCLフィルタが保持する過去フレームの上限 (MB, 0で無制限)
     bool enableVulkan;
     RGYParamAvoidIdleClock avoidIdleClock;
 
@@ -2530,6 +2582,8 @@ struct RGYParamControl {
 
 bool trim_active(const sTrimParam *pTrim);
 std::pair<bool, int> frame_inside_range(int frame, const std::vector<sTrim> &trimList);
+// prefix[i] = trimList[i].startより前にtrimで削除されるフレーム数
+std::vector<int64_t> trim_cut_frames_prefix(const std::vector<sTrim> &trimList);
 bool rearrange_trim_list(int frame, int offset, std::vector<sTrim> &trimList);
 tstring print_metadata(const std::vector<tstring>& metadata);
 bool metadata_copy(const std::vector<tstring> &metadata);
@@ -48,6 +48,9 @@ EncodeStatus::EncodeStatus() {
 
     m_sStartTime = std::unique_ptr<PROCESS_TIME>(new PROCESS_TIME());
     m_tmLastUpdate = std::chrono::system_clock::now();
+#if !(defined(_WIN32) || defined(_WIN64))
+    m_tmStartMonotonicUs = 0;
+#endif
     m_pause = false;
     m_bStdErrWriteToConsole = false;
 }
@@ -82,6 +85,9 @@ void EncodeStatus::Init(uint32_t outputFPSRate, uint32_t outputFPSScale,
 
 void EncodeStatus::SetStart() {
     m_tmStart = std::chrono::system_clock::now();
+#if !(defined(_WIN32) || defined(_WIN64))
+    m_tmStartMonotonicUs = RGYPerfSamplerLinux::monotonicTimeUs();
+#endif
     m_bEncStarted = true;
     GetProcessTime(m_sStartTime.get());
 }
@@ -407,7 +413,8 @@ int64_t EncodeStatus::getStartTimeMicroSec() {
 #if defined(_WIN32) || defined(_WIN64)
     return m_sStartTime->creation / 10;
 #else
-    return (int)(m_sStartTime->creation * (double)(1e6 / CLOCKS_PER_SEC) + 0.5);
+    //perf monitorと基準をそろえるため、CLOCK_MONOTONICでの開始時刻を返す
+    return m_tmStartMonotonicUs;
 #endif
 }
 bool EncodeStatus::getEncStarted() {
@@ -120,6 +120,9 @@ protected:
     std::unique_ptr<PROCESS_TIME> m_sStartTime;
     std::chrono::system_clock::time_point m_tmStart;          //エンコード開始時刻
     std::chrono::system_clock::time_point m_tmLastUpdate;     //最終更新時刻
+#if !(defined(_WIN32) || defined(_WIN64))
+    int64_t m_tmStartMonotonicUs;                             //エンコード開始時刻 (CLOCK_MONOTONIC, us)
+#endif
     bool m_bStdErrWriteToConsole;
     bool m_bEncStarted;
 };
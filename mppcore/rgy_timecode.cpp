@@ -63,6 +63,8 @@ RGY_ERR RGYTimecodeReader::init(const tstring &filename, rgy_rational<int> timeB
         return RGY_ERR_FILE_OPEN;
     }
     m_fp = std::unique_ptr<FILE, fp_deleter>(fp, fp_deleter());
+    // 1行ずつ読むので、読み込みバッファを大きめにしておく
+    setvbuf(m_fp.get(), nullptr, _IOFBF, 1024 * 1024);
     m_filename = filename;
     if (timeBaseTimecode.is_valid()) {
         m_timeBaseTimecode = timeBaseTimecode;
@@ -78,7 +80,9 @@ std::tuple<RGY_ERR, double> RGYTimecodeReader::getValue() {
     while (fgets(buffer, _countof(buffer) - 1, m_fp.get()) != nullptr) {
         if (buffer[0] == '#') continue; // コメント
 
-        if (sscanf_s(buffer, "%lf", &value) != 1) {
+        char *end = nullptr;
+        value = strtod(buffer, &end);
+        if (end == buffer) {
             return { RGY_ERR_INVALID_DATA_TYPE, 0.0 };
         }
         return { RGY_ERR_NONE, value };
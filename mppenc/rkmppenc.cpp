@@ -329,6 +329,109 @@ int mpp_run(MPPParam *pParams) {
     return 0;
 }
 
+//--input-list: リストのジョブを順に実行する
+//  前のジョブが入力を読み終えてflushしている間に、次のジョブの初期化(入力のオープン、ヘッダの解析等)を行う
+//  OpenCLのcontextはジョブ間で共有し、ビルド済みのプログラムを使いまわす
+//  contextを使用する初期化(フィルタ、エンコーダ等)は、前のジョブの終了を待ってから行う
+int mpp_run_batch(const tstring& inputList, const std::vector<const TCHAR *>& argvBase) {
+    const auto jobArgs = cmd_from_input_list(inputList);
+    if (jobArgs.size() == 0) {
+        _ftprintf(stderr, _T("No jobs found in input list \"%s\".\n"), inputList.c_str());
+        return 1;
+    }
+    //先にすべてのジョブのパラメータを確認しておく
+    std::vector<std::unique_ptr<MPPParam>> prms;
+    for (size_t ijob = 0; ijob < jobArgs.size(); ijob++) {
+        std::vector<const TCHAR *> argvJob = argvBase;
+        for (const auto& arg : jobArgs[ijob]) {
+            argvJob.push_back(arg.c_str());
+        }
+        argvJob.push_back(_T(""));
+        auto prm = std::make_unique<MPPParam>();
+        if (parse_cmd(prm.get(), (int)argvJob.size()-1, argvJob.data())) {
+            _ftprintf(stderr, _T("Invalid options in job #%d of input list.\n"), (int)ijob + 1);
+            return 1;
+        }
+        if (prm->common.inputFilename != _T("-")
+            && prm->common.outputFilename != _T("-")
+            && rgy_path_is_same(prm->common.inputFilename, prm->common.outputFilename)) {
+            _ftprintf(stderr, _T("destination file is equal to source file in job #%d!\n"), (int)ijob + 1);
+            return 1;
+        }
+        prms.push_back(std::move(prm));
+    }
+
+    typedef std::pair<std::unique_ptr<MPPCore>, RGY_ERR> MPPBatchJob;
+    auto prepare = [&prms](size_t ijob, std::shared_ptr<RGYOpenCLContext> cl, std::shared_future<void> prevJobDone) {
+        return std::async(std::launch::async, [prm = prms[ijob].get(), cl, prevJobDone]() {
+            auto mpp = std::make_unique<MPPCore>();
+            mpp->SetSharedCL(cl);
+            if (prevJobDone.valid()) {
+                mpp->SetDeviceInitWait([prevJobDone]() { prevJobDone.wait(); });
+            }
+            const auto err = mpp->init(prm);
+            return MPPBatchJob(std::move(mpp), err);
+        });
+    };
+
+    set_signal_handler();
+    int failed = 0, finished = 0;
+    std::shared_ptr<RGYOpenCLContext> cl;
+    std::future<MPPBatchJob> next = prepare(0, cl, std::shared_future<void>());
+    for (size_t ijob = 0; ijob < prms.size() && !g_signal_abort; ijob++) {
+        _ftprintf(stderr, _T("\n[%d/%d] %s -> %s\n"), (int)ijob + 1, (int)prms.size(),
+            prms[ijob]->common.inputFilename.c_str(), prms[ijob]->common.outputFilename.c_str());
+        auto [mpp, err] = next.get();
+        next = std::future<MPPBatchJob>();
+        if (mpp && mpp->GetCL()) {
+            cl = mpp->GetCL();
+        }
+        //このジョブの終了 (MPPCoreの破棄) を次のジョブに通知する
+        std::promise<void> jobDone;
+        std::shared_future<void> jobDoneFuture = jobDone.get_future().share();
+        //次のジョブの準備を開始する (一度のみ)
+        //  --metrics-listenはポートが重複するので、前のジョブの終了後に準備する
+        auto startNext = [&, ijob]() {
+            if (!next.valid() && ijob + 1 < prms.size() && !g_signal_abort) {
+                next = prepare(ijob + 1, cl, jobDoneFuture);
+            }
+        };
+        const bool overlap = ijob + 1 < prms.size() && prms[ijob + 1]->ctrl.metricsListen.length() == 0;
+        if (err != RGY_ERR_NONE) {
+            _ftprintf(stderr, _T("Failed to initialize job #%d.\n"), (int)ijob + 1);
+            failed++;
+            mpp.reset();
+            jobDone.set_value();
+            startNext();
+            continue;
+        }
+        mpp->PrintEncoderParam();
+        mpp->SetAbortFlagPointer(&g_signal_abort);
+        if (overlap) {
+            mpp->SetDrainCallback(startNext);
+        }
+        try {
+            if (mpp->run2() != RGY_ERR_NONE) {
+                failed++;
+            } else {
+                finished++;
+            }
+        } catch (...) {
+            _ftprintf(stderr, _T("fatal error in encoding pipeline.\n"));
+            failed++;
+        }
+        mpp.reset();
+        jobDone.set_value();
+        startNext(); //flushに到達しなかった場合
+    }
+    if (next.valid()) {
+        next.get(); //中断時は準備中のジョブの初期化を待って破棄する
+    }
+    _ftprintf(stderr, _T("\nbatch: %d/%d jobs finished%s.\n"), finished, (int)prms.size(),
+        (g_signal_abort) ? _T(" (aborted)") : ((failed > 0) ? strsprintf(_T(", %d failed"), failed).c_str() : _T("")));
+    return (failed > 0 || g_signal_abort) ? 1 : 0;
+}
+
 int _tmain(int argc, TCHAR **argv) {
 #if defined(_WIN32) || defined(_WIN64)
     if (check_locale_is_ja()) {
@@ -427,6 +530,14 @@ int _tmain(int argc, TCHAR **argv) {
     if (parse_cmd(&prm, (int)argvCopy.size()-1, argvCopy.data())) {
         return 1;
     }
+    if (prm.ctrl.inputList.length() > 0) {
+        argvCopy.pop_back();
+        if (mpp_run_batch(prm.ctrl.inputList, argvCopy)) {
+            fprintf(stderr, "Finished with error in rkmppenc.\n");
+            return 1;
+        }
+        return 0;
+    }
 
     if (prm.common.inputFilename != _T("-")
         && prm.common.outputFilename != _T("-")
@@ -0,0 +1,67 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_TEST_H__
+#define __RGY_TEST_H__
+
+#include <cstdio>
+#include <cstdlib>
+
+// make checkから実行される単体テストの共通処理
+// 終了コード77はスキップ (テストに必要なデバイスがない場合など)
+static const int RGY_TEST_EXIT_SKIP = 77;
+
+static int g_rgyTestFailed = 0;
+
+#define RGY_TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        g_rgyTestFailed++; \
+    } \
+} while (0)
+
+#define RGY_TEST_CHECK_MSG(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        g_rgyTestFailed++; \
+    } \
+} while (0)
+
+#define RGY_TEST_RUN(func) do { \
+    const int failedBefore = g_rgyTestFailed; \
+    func(); \
+    fprintf(stderr, "%s: %s\n", #func, (g_rgyTestFailed == failedBefore) ? "ok" : "FAILED"); \
+} while (0)
+
+static int rgy_test_result() {
+    return (g_rgyTestFailed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif //__RGY_TEST_H__
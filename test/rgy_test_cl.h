@@ -0,0 +1,134 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_TEST_CL_H__
+#define __RGY_TEST_CL_H__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include "rgy_opencl.h"
+#include "rgy_log.h"
+
+// テストに使用するOpenCLのコンテキストを作成する (GPUがなければpoclなどCPUのデバイスも使用する)
+// 使用できるデバイスがなければnullptrを返す
+static std::shared_ptr<RGYOpenCLContext> rgy_test_create_cl(std::shared_ptr<RGYLog> log) {
+    RGYOpenCL cl(log);
+    if (!RGYOpenCL::openCLloaded()) {
+        return nullptr;
+    }
+    for (auto& platform : cl.getPlatforms()) {
+        if (platform->createDeviceList(CL_DEVICE_TYPE_ALL) != RGY_ERR_NONE || platform->devs().size() == 0) {
+            continue;
+        }
+        platform->setDev(platform->devs()[0]);
+        auto context = std::make_shared<RGYOpenCLContext>(platform, log);
+        if (context->createContext(0) != RGY_ERR_NONE) {
+            continue;
+        }
+        return context;
+    }
+    return nullptr;
+}
+
+// CPU側のフレーム (planeごとに確保する)
+class RGYTestHostFrame {
+public:
+    RGYTestHostFrame(const int width, const int height, const RGY_CSP csp) : m_buf(), m_info(width, height, csp, RGY_CSP_BIT_DEPTH[csp]) {
+        const int pixSize = (RGY_CSP_DATA_TYPE[csp] == RGY_DATA_TYPE_U16) ? 2 : 1;
+        m_buf.resize(RGY_CSP_PLANES[csp]);
+        for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+            // getPlaneで各planeのサイズを求めるため、仮のpitchを設定しておく
+            m_info.pitch[i] = width * pixSize;
+        }
+        for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+            const auto plane = getPlane(&m_info, (RGY_PLANE)i);
+            m_info.pitch[i] = plane.width * pixSize;
+            m_buf[i].resize((size_t)m_info.pitch[i] * plane.height);
+            m_info.ptr[i] = m_buf[i].data();
+        }
+    }
+    RGYFrameInfo *info() { return &m_info; }
+    const RGYFrameInfo *info() const { return &m_info; }
+    // 画素値を取得する (x, yはplane内の座標)
+    int pix(const int iplane, const int x, const int y) const {
+        const uint8_t *line = m_info.ptr[iplane] + (size_t)y * m_info.pitch[iplane];
+        return (RGY_CSP_DATA_TYPE[m_info.csp] == RGY_DATA_TYPE_U16) ? ((const uint16_t *)line)[x] : line[x];
+    }
+    void setPix(const int iplane, const int x, const int y, const int value) {
+        uint8_t *line = m_info.ptr[iplane] + (size_t)y * m_info.pitch[iplane];
+        if (RGY_CSP_DATA_TYPE[m_info.csp] == RGY_DATA_TYPE_U16) {
+            ((uint16_t *)line)[x] = (uint16_t)value;
+        } else {
+            line[x] = (uint8_t)value;
+        }
+    }
+    // 滑らかな模様にノイズを加えたものを書き込む
+    void fillPattern(const uint32_t seed) {
+        uint32_t rnd = seed * 2654435761u + 1;
+        const int maxVal = (1 << RGY_CSP_BIT_DEPTH[m_info.csp]) - 1;
+        for (int i = 0; i < RGY_CSP_PLANES[m_info.csp]; i++) {
+            const auto plane = getPlane(&m_info, (RGY_PLANE)i);
+            for (int y = 0; y < plane.height; y++) {
+                for (int x = 0; x < plane.width; x++) {
+                    rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+                    const int base = ((x * 7 + y * 3 + i * 50) % 256) - 128;
+                    const int checker = (((x / 8) + (y / 8)) & 1) ? 48 : -48;
+                    const int noise = (int)(rnd % 33) - 16;
+                    const int v8 = std::min(255, std::max(0, 128 + base / 2 + checker + noise));
+                    setPix(i, x, y, std::min(maxVal, v8 << (RGY_CSP_BIT_DEPTH[m_info.csp] - 8)));
+                }
+            }
+        }
+    }
+protected:
+    std::vector<std::vector<uint8_t>> m_buf;
+    RGYFrameInfo m_info;
+};
+
+// CPU側のフレームをGPUのフレームに転送する
+static RGY_ERR rgy_test_upload(RGYOpenCLContext *cl, RGYCLFrame *dst, const RGYTestHostFrame& src) {
+    auto err = cl->copyFrame(&dst->frame, src.info());
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    return cl->queue().finish();
+}
+
+// GPUのフレームをCPU側のフレームに転送する
+static RGY_ERR rgy_test_download(RGYOpenCLContext *cl, RGYTestHostFrame& dst, const RGYFrameInfo *src) {
+    auto err = cl->copyFrame(dst.info(), src);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    return cl->queue().finish();
+}
+
+#endif //__RGY_TEST_CL_H__
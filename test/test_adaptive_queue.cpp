@@ -0,0 +1,285 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include "rgy_test.h"
+#include "mpp_adaptive_queue.h"
+
+// 待ち時間とフレームプールを外から与えるtask
+class TestAdaptiveTask : public PipelineTask {
+public:
+    TestAdaptiveTask(PipelineTaskType type, int depth, int pool, bool resizable) :
+        PipelineTask(type, depth, nullptr), m_pool(pool), m_used(0), m_resizable(resizable), m_growFail(false) {};
+    virtual ~TestAdaptiveTask() {};
+
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
+    virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override { return RGY_ERR_NONE; };
+
+    virtual size_t workSurfacesCount() const override { return m_pool; }
+    virtual bool workSurfacesResizable() const override { return m_resizable; }
+    virtual RGY_ERR workSurfacesGrowCL(const int numFrames) override {
+        if (!m_resizable || m_growFail) return RGY_ERR_MEMORY_ALLOC;
+        m_pool += numFrames;
+        return RGY_ERR_NONE;
+    }
+    virtual int workSurfacesShrinkCL(const int numFrames, const size_t minCount) override {
+        int released = 0;
+        while (released < numFrames && m_pool > minCount && m_pool - m_used > 0) {
+            m_pool--;
+            released++;
+        }
+        return released;
+    }
+    virtual size_t workSurfacesFreeCount() const override { return m_pool - m_used; }
+
+    // 次の判定で使う1フレームあたりの待ち時間
+    void setWait(double syncMs, double surfMs, int64_t frames = 30) {
+        m_waitStat.frames = frames;
+        m_waitStat.syncWaitMs = syncMs * frames;
+        m_waitStat.surfWaitMs = surfMs * frames;
+    }
+    size_t m_pool;
+    size_t m_used;
+    bool m_resizable;
+    bool m_growFail;
+};
+
+static const double WAIT_BUSY = 1.0;  // ADAPTIVE_QUEUE_WAIT_GROW_MS より大きい
+static const double WAIT_IDLE = 0.01; // ADAPTIVE_QUEUE_WAIT_IDLE_MS より小さい
+static const double WAIT_MID  = 0.2;  // どちらでもない
+
+class TestAdaptiveQueue {
+public:
+    TestAdaptiveQueue(const MPPParamAdaptiveQueue& prm) : m_queue(prm, nullptr), m_tasks(), m_frames(0), m_interval(prm.interval) {};
+    TestAdaptiveTask *add(PipelineTaskType type, int depth, int pool, bool resizable) {
+        m_tasks.push_back(std::make_unique<TestAdaptiveTask>(type, depth, pool, resizable));
+        return dynamic_cast<TestAdaptiveTask *>(m_tasks.back().get());
+    }
+    void init() { m_queue.init(m_tasks); }
+    // 判定を1回進める
+    void step() {
+        m_frames += m_interval;
+        m_queue.check(m_frames);
+    }
+private:
+    MPPAdaptiveQueue m_queue;
+    std::vector<std::unique_ptr<PipelineTask>> m_tasks;
+    int64_t m_frames;
+    int m_interval;
+};
+
+static MPPParamAdaptiveQueue test_param() {
+    MPPParamAdaptiveQueue prm;
+    prm.enable = true;
+    prm.minDepth = 2;
+    prm.maxDepth = 6;
+    prm.poolMax = 5;
+    prm.interval = 30;
+    return prm;
+}
+
+// 出力の完了待ちが多いとキューを1ずつ深くし、上限で止まること
+static void test_adaptive_depth_grow() {
+    TestAdaptiveQueue q(test_param());
+    auto task = q.add(PipelineTaskType::OPENCL, 3, 0, false);
+    q.init();
+    for (int i = 0; i < 10; i++) {
+        task->setWait(WAIT_BUSY, 0.0);
+        q.step();
+        RGY_TEST_CHECK_MSG(task->outputMaxQueueSize() == std::min(3 + i + 1, 6), "step %d: depth %d", i, task->outputMaxQueueSize());
+    }
+}
+
+// 待ちのない判定が4回続いたら1浅くし、minDepthより浅くしないこと
+static void test_adaptive_depth_shrink() {
+    TestAdaptiveQueue q(test_param());
+    auto task = q.add(PipelineTaskType::OPENCL, 4, 0, false);
+    q.init();
+    for (int i = 0; i < 3; i++) {
+        task->setWait(WAIT_IDLE, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK(task->outputMaxQueueSize() == 4);
+    // 待ちのある判定を挟むと、連続回数はリセットされる
+    task->setWait(WAIT_MID, 0.0);
+    q.step();
+    for (int i = 0; i < 3; i++) {
+        task->setWait(WAIT_IDLE, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK(task->outputMaxQueueSize() == 4);
+    task->setWait(WAIT_IDLE, WAIT_IDLE);
+    q.step();
+    RGY_TEST_CHECK(task->outputMaxQueueSize() == 3);
+    for (int i = 0; i < 20; i++) {
+        task->setWait(WAIT_IDLE, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK_MSG(task->outputMaxQueueSize() == 2, "depth %d", task->outputMaxQueueSize());
+}
+
+// フレームを出力していない区間では何も変更しないこと
+static void test_adaptive_no_frames() {
+    TestAdaptiveQueue q(test_param());
+    auto task = q.add(PipelineTaskType::OPENCL, 3, 4, true);
+    q.init();
+    for (int i = 0; i < 8; i++) {
+        task->setWait(WAIT_BUSY, WAIT_BUSY, 0);
+        q.step();
+    }
+    RGY_TEST_CHECK(task->outputMaxQueueSize() == 3);
+    RGY_TEST_CHECK(task->workSurfacesCount() == 4);
+}
+
+// taskの種類・プールに応じたキューの深さの上限
+static void test_adaptive_depth_cap() {
+    auto prm = test_param();
+    prm.maxDepth = 12;
+    TestAdaptiveQueue q(prm);
+    auto input = q.add(PipelineTaskType::INPUT, 0, 0, false);          // 出力キューなし
+    auto enc = q.add(PipelineTaskType::MPPENC, 2, 0, false);           // エンコーダの入力バッファの半分まで
+    auto fixedPool = q.add(PipelineTaskType::OPENCL, 3, 4, false);     // プールを増やせない
+    q.init();
+    for (int i = 0; i < 12; i++) {
+        input->setWait(WAIT_BUSY, 0.0);
+        enc->setWait(WAIT_BUSY, 0.0);
+        fixedPool->setWait(WAIT_BUSY, 0.0);
+        q.step();
+    }
+    RGY_TEST_CHECK(input->outputMaxQueueSize() == 0);
+    RGY_TEST_CHECK_MSG(enc->outputMaxQueueSize() == 8, "enc depth %d", enc->outputMaxQueueSize());
+    RGY_TEST_CHECK(fixedPool->outputMaxQueueSize() == 3);
+    RGY_TEST_CHECK(fixedPool->workSurfacesCount() == 4);
+}
+
+// 空きフレームの待ちが多いとプールを2枚ずつ増やし、poolMaxで止まること
+// 待ちがなくなると1枚ずつ解放し、初期のサイズより小さくしないこと
+static void test_adaptive_pool() {
+    TestAdaptiveQueue q(test_param());
+    auto task = q.add(PipelineTaskType::OPENCL, 0, 4, true);
+    q.init();
+    const int expected[] = { 6, 8, 9, 9 };
+    for (const auto pool : expected) {
+        task->setWait(0.0, WAIT_BUSY);
+        q.step();
+        RGY_TEST_CHECK_MSG(task->workSurfacesCount() == (size_t)pool, "pool %d, expected %d", (int)task->workSurfacesCount(), pool);
+    }
+    // 待ちのない判定が4回続くまでは解放しない
+    for (int i = 0; i < 3; i++) {
+        task->setWait(0.0, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK(task->workSurfacesCount() == 9);
+    // 空きが1枚しかない場合は解放しない
+    task->m_used = 8;
+    for (int i = 0; i < 4; i++) {
+        task->setWait(0.0, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK(task->workSurfacesCount() == 9);
+    // 空きができたら解放する
+    task->m_used = 0;
+    task->setWait(0.0, WAIT_IDLE);
+    q.step();
+    RGY_TEST_CHECK(task->workSurfacesCount() == 8);
+    for (int i = 0; i < 40; i++) {
+        task->setWait(0.0, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK_MSG(task->workSurfacesCount() == 4, "pool %d", (int)task->workSurfacesCount());
+    // 解放した分は再び増やせる
+    task->setWait(0.0, WAIT_BUSY);
+    q.step();
+    RGY_TEST_CHECK(task->workSurfacesCount() == 6);
+}
+
+// プールを増やせる場合、キューを深くする前にプールを1枚増やし、poolMaxに達したら深くしないこと
+// 空きフレームの待ちがなくても、深くした分のフレームは解放しないこと
+static void test_adaptive_depth_with_pool() {
+    TestAdaptiveQueue q(test_param());
+    auto task = q.add(PipelineTaskType::OPENCL, 2, 3, true);
+    q.init();
+    for (int i = 0; i < 10; i++) {
+        task->setWait(WAIT_BUSY, 0.0);
+        q.step();
+    }
+    // poolMax = 5 なので、深さは 2 -> 6 (上限) まで4回、プールは4枚追加
+    RGY_TEST_CHECK_MSG(task->outputMaxQueueSize() == 6, "depth %d", task->outputMaxQueueSize());
+    RGY_TEST_CHECK_MSG(task->workSurfacesCount() == 7, "pool %d", (int)task->workSurfacesCount());
+
+    auto prm = test_param();
+    prm.poolMax = 2;
+    TestAdaptiveQueue q2(prm);
+    auto task2 = q2.add(PipelineTaskType::OPENCL, 2, 3, true);
+    q2.init();
+    for (int i = 0; i < 10; i++) {
+        task2->setWait(WAIT_BUSY, 0.0);
+        q2.step();
+    }
+    RGY_TEST_CHECK_MSG(task2->outputMaxQueueSize() == 4, "depth %d", task2->outputMaxQueueSize());
+    RGY_TEST_CHECK(task2->workSurfacesCount() == 5);
+
+    // キューを浅くすると、その分のフレームは解放できる
+    for (int i = 0; i < 40; i++) {
+        task->setWait(WAIT_IDLE, WAIT_IDLE);
+        q.step();
+    }
+    RGY_TEST_CHECK_MSG(task->outputMaxQueueSize() == 2, "depth %d", task->outputMaxQueueSize());
+    RGY_TEST_CHECK_MSG(task->workSurfacesCount() == 3, "pool %d", (int)task->workSurfacesCount());
+}
+
+// フレームを確保できなかった場合は、以降プールを増やさないこと
+static void test_adaptive_pool_alloc_fail() {
+    TestAdaptiveQueue q(test_param());
+    auto task = q.add(PipelineTaskType::OPENCL, 0, 4, true);
+    q.init();
+    task->m_growFail = true;
+    task->setWait(0.0, WAIT_BUSY);
+    q.step();
+    RGY_TEST_CHECK(task->workSurfacesCount() == 4);
+    task->m_growFail = false;
+    for (int i = 0; i < 4; i++) {
+        task->setWait(0.0, WAIT_BUSY);
+        q.step();
+    }
+    RGY_TEST_CHECK(task->workSurfacesCount() == 4);
+}
+
+int main() {
+    RGY_TEST_RUN(test_adaptive_depth_grow);
+    RGY_TEST_RUN(test_adaptive_depth_shrink);
+    RGY_TEST_RUN(test_adaptive_no_frames);
+    RGY_TEST_RUN(test_adaptive_depth_cap);
+    RGY_TEST_RUN(test_adaptive_pool);
+    RGY_TEST_RUN(test_adaptive_depth_with_pool);
+    RGY_TEST_RUN(test_adaptive_pool_alloc_fail);
+    return rgy_test_result();
+}
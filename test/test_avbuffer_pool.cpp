@@ -0,0 +1,177 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include "rgy_test.h"
+#include "rgy_avutil.h"
+
+#if ENABLE_AVSW_READER
+// 返却したバッファが同じサイズの要求で再利用されること
+static void test_pool_reuse() {
+    RGYPoolAVBuffer pool;
+    auto buf0 = pool.get(1000);
+    RGY_TEST_CHECK(buf0 != nullptr && buf0->size >= 1000);
+    const uint8_t *ptr0 = (buf0) ? buf0->data : nullptr;
+    av_buffer_unref(&buf0);
+    auto buf1 = pool.get(4000); // 同じ4KBのpool
+    RGY_TEST_CHECK(buf1 != nullptr && buf1->data == ptr0);
+    RGY_TEST_CHECK(pool.allocatedCount() == 1 && pool.reusedCount() == 1);
+    // 使用中なら新たに確保する
+    auto buf2 = pool.get(4000);
+    RGY_TEST_CHECK(buf2 != nullptr && buf2->data != ptr0);
+    RGY_TEST_CHECK(pool.allocatedCount() == 2 && pool.reusedCount() == 1);
+    // 別のサイズのpool
+    auto buf3 = pool.get(5000);
+    RGY_TEST_CHECK(buf3 != nullptr && buf3->size >= 8192);
+    RGY_TEST_CHECK(pool.allocatedCount() == 3 && pool.activePoolCount() == 2);
+    av_buffer_unref(&buf1);
+    av_buffer_unref(&buf2);
+    av_buffer_unref(&buf3);
+    RGY_TEST_CHECK(pool.requestedCount() == 4);
+}
+
+// 上限より大きいものはpoolせず、毎回確保する
+static void test_pool_large() {
+    RGYPoolAVBuffer pool;
+    const size_t size = ((size_t)1 << RGYPoolAVBuffer::SIZE_MAX_LOG2) + 1;
+    for (int i = 0; i < 2; i++) {
+        auto buf = pool.get(size);
+        RGY_TEST_CHECK(buf != nullptr && (size_t)buf->size >= size);
+        av_buffer_unref(&buf);
+    }
+    RGY_TEST_CHECK(pool.allocatedCount() == 2 && pool.reusedCount() == 0);
+    RGY_TEST_CHECK(pool.activePoolCount() == 0);
+}
+
+// 使われなくなったサイズのpoolは破棄され、使用中のバッファは返却時に解放される
+static void test_pool_trim() {
+    RGYPoolAVBuffer pool;
+    auto bufSmall = pool.get(100);
+    auto bufIdle = pool.get(100 * 1024);
+    av_buffer_unref(&bufIdle);
+    RGY_TEST_CHECK(pool.activePoolCount() == 2);
+    // 直近で使われたpoolは破棄しない
+    RGY_TEST_CHECK(pool.trim(RGYPoolAVBuffer::TRIM_IDLE_REQUESTS) == 0);
+    RGY_TEST_CHECK(pool.trim(0) == 2);
+    RGY_TEST_CHECK(pool.activePoolCount() == 0 && pool.trimmedCount() == 2);
+    memset(bufSmall->data, 0, bufSmall->size); // 破棄後も使用中のバッファは有効
+    av_buffer_unref(&bufSmall);
+    // 破棄後は新たに確保する
+    const auto allocated = pool.allocatedCount();
+    auto buf = pool.get(100);
+    RGY_TEST_CHECK(buf != nullptr && pool.allocatedCount() == allocated + 1);
+    av_buffer_unref(&buf);
+}
+
+// 要求の途中で、しばらく使われていないpoolが自動的に破棄されること
+static void test_pool_auto_trim() {
+    RGYPoolAVBuffer pool;
+    auto buf = pool.get(1024 * 1024);
+    av_buffer_unref(&buf);
+    const uint64_t loop = RGYPoolAVBuffer::TRIM_IDLE_REQUESTS + RGYPoolAVBuffer::TRIM_CHECK_INTERVAL;
+    for (uint64_t i = 0; i < loop; i++) {
+        buf = pool.get(1000);
+        av_buffer_unref(&buf);
+    }
+    RGY_TEST_CHECK(pool.activePoolCount() == 1);
+    RGY_TEST_CHECK(pool.trimmedCount() == 1);
+    RGY_TEST_CHECK(pool.allocatedCount() == 2); // 1MBと4KBを1回ずつ
+}
+
+static void test_new_packet() {
+    RGYPoolAVBuffer pool;
+    auto pkt = av_packet_alloc();
+    for (int i = 0; i < 2; i++) {
+        RGY_TEST_CHECK(pool.newPacket(pkt, 3000) == 0);
+        RGY_TEST_CHECK(pkt->size == 3000 && pkt->buf != nullptr && pkt->data == pkt->buf->data);
+        bool paddingZero = true;
+        for (int j = 0; j < AV_INPUT_BUFFER_PADDING_SIZE; j++) {
+            paddingZero &= pkt->data[pkt->size + j] == 0;
+        }
+        RGY_TEST_CHECK(paddingZero);
+        memset(pkt->data, 0xff, pkt->size + AV_INPUT_BUFFER_PADDING_SIZE);
+        av_packet_unref(pkt);
+    }
+    RGY_TEST_CHECK(pool.allocatedCount() == 1 && pool.reusedCount() == 1);
+    RGY_TEST_CHECK(pool.newPacket(pkt, -1) == AVERROR(EINVAL));
+    av_packet_free(&pkt);
+}
+
+// 複数スレッドからの取得/返却とtrimが競合しても壊れないこと
+static void test_pool_threads() {
+    RGYPoolAVBuffer pool;
+    const int threadCount = 4;
+    const int loop = 20000;
+    std::vector<std::thread> threads;
+    for (int ith = 0; ith < threadCount; ith++) {
+        threads.push_back(std::thread([&pool, ith]() {
+            std::vector<AVBufferRef *> held;
+            for (int i = 0; i < loop; i++) {
+                const size_t size = (size_t)1 << (10 + ((i * 7 + ith) % 10));
+                auto buf = pool.get(size);
+                if (buf == nullptr) continue;
+                buf->data[0] = (uint8_t)i;
+                held.push_back(buf);
+                if (held.size() > 8) {
+                    av_buffer_unref(&held.front());
+                    held.erase(held.begin());
+                }
+                if (ith == 0 && i % 997 == 0) {
+                    pool.trim(0);
+                }
+            }
+            for (auto& buf : held) {
+                av_buffer_unref(&buf);
+            }
+        }));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    RGY_TEST_CHECK(pool.requestedCount() == (uint64_t)threadCount * loop);
+    RGY_TEST_CHECK(pool.allocatedCount() + pool.reusedCount() == pool.requestedCount());
+    RGY_TEST_CHECK(pool.reusedCount() > 0);
+}
+#endif //#if ENABLE_AVSW_READER
+
+int main() {
+#if ENABLE_AVSW_READER
+    RGY_TEST_RUN(test_pool_reuse);
+    RGY_TEST_RUN(test_pool_large);
+    RGY_TEST_RUN(test_pool_trim);
+    RGY_TEST_RUN(test_pool_auto_trim);
+    RGY_TEST_RUN(test_new_packet);
+    RGY_TEST_RUN(test_pool_threads);
+    return rgy_test_result();
+#else
+    fprintf(stderr, "avcodec reader disabled, skip.\n");
+    return RGY_TEST_EXIT_SKIP;
+#endif
+}
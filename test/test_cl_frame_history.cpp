@@ -0,0 +1,240 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include "rgy_test.h"
+#include "rgy_test_cl.h"
+
+static std::shared_ptr<RGYLog> g_log;
+static std::shared_ptr<RGYOpenCLContext> g_cl;
+
+static const int HIST_WIDTH = 64;
+static const int HIST_HEIGHT = 32;
+
+// 登録数とフレームのサイズを確認するため、protectedのメンバを公開する
+class TestFrameHistory : public RGYCLFrameHistory {
+public:
+    TestFrameHistory() : RGYCLFrameHistory(g_cl.get(), g_log) {};
+    size_t entries() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_entries.size();
+    }
+    size_t pooledFrames() {
+        std::lock_guard<std::mutex> lock(m_pool->mtx);
+        return m_pool->frames.size();
+    }
+    int64_t privateFrames() const { return m_private; }
+    int64_t sharedFrames() const { return m_shared; }
+    int64_t copiedFrames() const { return m_copied; }
+    static size_t bytes(const RGYFrameInfo& frame) { return frameBytes(frame); }
+};
+
+static RGYFrameInfo hist_info(const int64_t timestamp = 0, const int inputFrameId = 0) {
+    RGYFrameInfo info(HIST_WIDTH, HIST_HEIGHT, RGY_CSP_NV12, 8);
+    info.mem_type = RGY_MEM_TYPE_GPU; // フィルタのframeOutと同じく、GPUのフレームとして要求する
+    info.timestamp = timestamp;
+    info.inputFrameId = inputFrameId;
+    return info;
+}
+
+static std::shared_ptr<RGYCLFrame> hist_alloc(TestFrameHistory& hist, const int64_t timestamp, const int inputFrameId) {
+    auto frame = hist.alloc(hist_info());
+    if (frame) {
+        frame->frame.timestamp = timestamp;
+        frame->frame.inputFrameId = inputFrameId;
+    }
+    return frame;
+}
+
+// publishしたフレームは(stage, timestamp, inputFrameId)で取得でき、参照がなくなると取得できないこと
+static void test_history_publish_get() {
+    TestFrameHistory hist;
+    int stageA = 0, stageB = 0;
+    auto frame = hist_alloc(hist, 100, 5);
+    RGY_TEST_CHECK(frame && !frame->isempty());
+    if (!frame) return;
+    // allocしただけでは登録されない
+    RGY_TEST_CHECK(hist.get(&stageA, 100, 5) == nullptr);
+    hist.publish(&stageA, frame);
+    RGY_TEST_CHECK(hist.get(&stageA, 100, 5) == frame);
+    RGY_TEST_CHECK(hist.get(&stageB, 100, 5) == nullptr);
+    RGY_TEST_CHECK(hist.get(&stageA, 101, 5) == nullptr);
+    RGY_TEST_CHECK(hist.get(&stageA, 100, 6) == nullptr);
+    auto info = hist_info(100, 5);
+    RGY_TEST_CHECK(hist.contains(&stageA, &info));
+    // 解像度の異なるフレームとは一致しない
+    info.width = HIST_WIDTH / 2;
+    RGY_TEST_CHECK(!hist.contains(&stageA, &info));
+
+    // 参照がなくなればプールに戻り、登録は無効になる
+    const auto mem = frame->mem(0);
+    frame.reset();
+    RGY_TEST_CHECK(hist.get(&stageA, 100, 5) == nullptr);
+    RGY_TEST_CHECK(hist.pooledFrames() == 1);
+    // 同じ解像度・色空間ならプールのバッファを再利用する
+    auto reused = hist_alloc(hist, 200, 6);
+    RGY_TEST_CHECK(reused && reused->mem(0) == mem);
+    RGY_TEST_CHECK(hist.pooledFrames() == 0);
+    RGY_TEST_CHECK(hist.get(&stageA, 100, 5) == nullptr);
+}
+
+// バッファを再利用してpublishした場合、以前のキーの登録は削除されること
+static void test_history_publish_stale_key() {
+    TestFrameHistory hist;
+    int stageA = 0, stageB = 0;
+    auto frame = hist_alloc(hist, 1, 1);
+    if (!frame) {
+        RGY_TEST_CHECK(false);
+        return;
+    }
+    hist.publish(&stageA, frame);
+    RGY_TEST_CHECK(hist.entries() == 1);
+    // 同じバッファに次のフレームを出力して登録しなおす
+    frame->frame.timestamp = 2;
+    frame->frame.inputFrameId = 2;
+    hist.publish(&stageA, frame);
+    RGY_TEST_CHECK_MSG(hist.entries() == 1, "entries %d", (int)hist.entries());
+    RGY_TEST_CHECK(hist.get(&stageA, 1, 1) == nullptr);
+    RGY_TEST_CHECK(hist.get(&stageA, 2, 2) == frame);
+    // 別のstageとして登録した場合も、前のstageの登録は削除される
+    hist.publish(&stageB, frame);
+    RGY_TEST_CHECK(hist.entries() == 1);
+    RGY_TEST_CHECK(hist.get(&stageA, 2, 2) == nullptr);
+    RGY_TEST_CHECK(hist.get(&stageB, 2, 2) == frame);
+
+    // 参照のなくなった登録は、次のpublishで削除される
+    auto other = hist_alloc(hist, 3, 3);
+    hist.publish(&stageA, other);
+    RGY_TEST_CHECK(hist.entries() == 2);
+    frame.reset();
+    auto third = hist_alloc(hist, 4, 4);
+    hist.publish(&stageA, third);
+    RGY_TEST_CHECK_MSG(hist.entries() == 2, "entries %d", (int)hist.entries());
+}
+
+// limitを超える場合は履歴の外に確保し、登録もプールへの返却もしないこと
+static void test_history_limit() {
+    TestFrameHistory hist;
+    int stage = 0;
+    const auto frameSize = TestFrameHistory::bytes(hist.alloc(hist_info())->frame);
+    RGY_TEST_CHECK(frameSize > 0);
+    hist.setLimit(frameSize * 2);
+    RGY_TEST_CHECK(hist.pooledFrames() == 1); // 上のallocで確保したフレーム
+
+    auto f0 = hist_alloc(hist, 0, 0); // プールから取得
+    auto f1 = hist_alloc(hist, 1, 1);
+    RGY_TEST_CHECK(hist.pooledFrames() == 0);
+    RGY_TEST_CHECK(hist.privateFrames() == 0);
+    auto f2 = hist_alloc(hist, 2, 2); // limitを超える
+    RGY_TEST_CHECK(f0 && f1 && f2);
+    if (!f0 || !f1 || !f2) return;
+    RGY_TEST_CHECK(hist.privateFrames() == 1);
+    hist.publish(&stage, f2);
+    RGY_TEST_CHECK(hist.get(&stage, 2, 2) == nullptr);
+    RGY_TEST_CHECK(hist.entries() == 0);
+    // 履歴の外のフレームはプールに戻らない
+    f2.reset();
+    RGY_TEST_CHECK(hist.pooledFrames() == 0);
+    // 履歴のフレームはプールに戻り、limit以内で再利用される
+    const auto mem1 = f1->mem(0);
+    f1.reset();
+    RGY_TEST_CHECK(hist.pooledFrames() == 1);
+    auto f3 = hist_alloc(hist, 3, 3);
+    RGY_TEST_CHECK(f3 && f3->mem(0) == mem1);
+    RGY_TEST_CHECK(hist.privateFrames() == 1);
+
+    // limitを下げると、プールのバッファを解放する
+    f3.reset();
+    RGY_TEST_CHECK(hist.pooledFrames() == 1);
+    hist.setLimit(frameSize);
+    RGY_TEST_CHECK(hist.pooledFrames() == 0);
+    // 無制限なら履歴の外には確保しない
+    hist.setLimit(0);
+    std::vector<std::shared_ptr<RGYCLFrame>> frames;
+    for (int i = 0; i < 4; i++) {
+        frames.push_back(hist_alloc(hist, 10 + i, 10 + i));
+    }
+    RGY_TEST_CHECK(hist.privateFrames() == 1);
+}
+
+// addは未登録ならコピーして登録し、登録済みならコピーせずに同じフレームを返すこと
+static void test_history_add() {
+    TestFrameHistory hist;
+    int stage = 0;
+    RGYTestHostFrame host(HIST_WIDTH, HIST_HEIGHT, RGY_CSP_NV12);
+    host.fillPattern(7);
+    auto src = g_cl->createFrameBuffer(hist_info());
+    if (!src || rgy_test_upload(g_cl.get(), src.get(), host) != RGY_ERR_NONE) {
+        RGY_TEST_CHECK(false);
+        return;
+    }
+    src->frame.timestamp = 42;
+    src->frame.inputFrameId = 3;
+
+    RGY_ERR err = RGY_ERR_NONE;
+    auto added = hist.add(&stage, &src->frame, g_cl->queue(), &err);
+    RGY_TEST_CHECK(err == RGY_ERR_NONE && added);
+    if (!added) return;
+    RGY_TEST_CHECK(added->mem(0) != src->mem(0));
+    RGY_TEST_CHECK(added->frame.timestamp == 42 && added->frame.inputFrameId == 3);
+    RGY_TEST_CHECK(hist.copiedFrames() == 1);
+
+    auto again = hist.add(&stage, &src->frame, g_cl->queue(), &err);
+    RGY_TEST_CHECK(err == RGY_ERR_NONE && again == added);
+    RGY_TEST_CHECK(hist.copiedFrames() == 1 && hist.sharedFrames() == 1);
+
+    RGYTestHostFrame result(HIST_WIDTH, HIST_HEIGHT, RGY_CSP_NV12);
+    RGY_TEST_CHECK(rgy_test_download(g_cl.get(), result, &added->frame) == RGY_ERR_NONE);
+    int diff = 0;
+    for (int i = 0; i < RGY_CSP_PLANES[RGY_CSP_NV12]; i++) {
+        const auto plane = getPlane(host.info(), (RGY_PLANE)i);
+        for (int y = 0; y < plane.height; y++) {
+            for (int x = 0; x < plane.width; x++) {
+                diff += (result.pix(i, x, y) != host.pix(i, x, y)) ? 1 : 0;
+            }
+        }
+    }
+    RGY_TEST_CHECK_MSG(diff == 0, "%d pixels differ", diff);
+}
+
+int main(int argc, char **argv) {
+    g_log = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    g_cl = rgy_test_create_cl(g_log);
+    if (!g_cl) {
+        fprintf(stderr, "OpenCL device not found, skip.\n");
+        return RGY_TEST_EXIT_SKIP;
+    }
+    RGY_TEST_RUN(test_history_publish_get);
+    RGY_TEST_RUN(test_history_publish_stale_key);
+    RGY_TEST_RUN(test_history_limit);
+    RGY_TEST_RUN(test_history_add);
+    g_cl.reset();
+    return rgy_test_result();
+}
@@ -0,0 +1,184 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "rgy_test.h"
+#include "rgy_simd.h"
+#include "convert_csp.h"
+
+// vpy等の入力(YV12/YV12_xx)からエンコーダ入力(NV12/P010)への変換を、素朴な参照実装と比較する
+// 出力先はMPPのDRMバッファと同じく幅を64byte境界に揃えたpitchとする
+// (x86のSIMD版はpitchの余白まで書き込むので、比較は有効な画素の範囲のみ)
+static const int FUZZ_LOOP = 60;
+static std::mt19937 g_rnd(1234);
+
+static int rnd_range(int min, int max) {
+    return std::uniform_int_distribution<int>(min, max)(g_rnd);
+}
+
+static int align64(int x) {
+    return (x + 63) & ~63;
+}
+
+static const uint8_t DST_FILL = 0xCD;
+
+struct ConvTestFrame {
+    int width, height;
+    int crop[4];
+    int pixsize; // 1 or 2 (byte)
+    int src_y_pitch, src_uv_pitch; // byte
+    int dst_pitch; // byte
+    std::vector<uint8_t> srcY, srcU, srcV;
+};
+
+static ConvTestFrame gen_frame(int bitdepth) {
+    ConvTestFrame f;
+    f.width  = rnd_range(1, 200) * 2;
+    f.height = rnd_range(1, 60) * 2;
+    f.crop[0] = (rnd_range(0, 3) == 0) ? rnd_range(0, std::min(8, f.width / 2  - 1)) * 2 : 0;
+    f.crop[1] = (rnd_range(0, 3) == 0) ? rnd_range(0, std::min(4, f.height / 2 - 1)) * 2 : 0;
+    f.crop[2] = (rnd_range(0, 3) == 0) ? rnd_range(0, std::min(8, (f.width  - f.crop[0]) / 2 - 1)) * 2 : 0;
+    f.crop[3] = (rnd_range(0, 3) == 0) ? rnd_range(0, std::min(4, (f.height - f.crop[1]) / 2 - 1)) * 2 : 0;
+    f.pixsize = (bitdepth > 8) ? 2 : 1;
+    f.src_y_pitch  = (f.width + rnd_range(0, 40)) * f.pixsize;
+    f.src_uv_pitch = (f.width / 2 + rnd_range(0, 40)) * f.pixsize;
+    f.dst_pitch = align64((f.width - f.crop[0] - f.crop[2]) * f.pixsize);
+    f.srcY.resize((size_t)f.src_y_pitch * f.height);
+    f.srcU.resize((size_t)f.src_uv_pitch * f.height / 2);
+    f.srcV.resize((size_t)f.src_uv_pitch * f.height / 2);
+    const int maxval = (1 << bitdepth) - 1;
+    for (auto plane : { &f.srcY, &f.srcU, &f.srcV }) {
+        if (f.pixsize == 1) {
+            for (auto& v : *plane) v = (uint8_t)rnd_range(0, maxval);
+        } else {
+            uint16_t *ptr = (uint16_t *)plane->data();
+            for (size_t i = 0; i < plane->size() / 2; i++) ptr[i] = (uint16_t)rnd_range(0, maxval);
+        }
+    }
+    return f;
+}
+
+static int out_width(const ConvTestFrame& f)  { return f.width  - f.crop[0] - f.crop[2]; }
+static int out_height(const ConvTestFrame& f) { return f.height - f.crop[1] - f.crop[3]; }
+
+static std::vector<uint8_t> alloc_dst(const ConvTestFrame& f) {
+    // Y + UV (NV12/P010のUVは高さ半分)
+    return std::vector<uint8_t>((size_t)f.dst_pitch * (out_height(f) + out_height(f) / 2), DST_FILL);
+}
+
+// 参照実装
+static std::vector<uint8_t> convert_ref(const ConvTestFrame& f, int bitdepth) {
+    auto dst = alloc_dst(f);
+    const int ow = out_width(f), oh = out_height(f);
+    const int lsft = (bitdepth > 8) ? 16 - bitdepth : 0;
+    auto rd = [&](const std::vector<uint8_t>& plane, int pitch, int x, int y) -> int {
+        return (f.pixsize == 1) ? plane[(size_t)y * pitch + x] : ((const uint16_t *)(plane.data() + (size_t)y * pitch))[x];
+    };
+    auto wr = [&](int offset, int x, int y, int val) {
+        uint8_t *line = dst.data() + offset + (size_t)y * f.dst_pitch;
+        if (f.pixsize == 1) line[x] = (uint8_t)val;
+        else ((uint16_t *)line)[x] = (uint16_t)(val << lsft);
+    };
+    for (int y = 0; y < oh; y++) {
+        for (int x = 0; x < ow; x++) {
+            wr(0, x, y, rd(f.srcY, f.src_y_pitch, x + f.crop[0], y + f.crop[1]));
+        }
+    }
+    const int uvOffset = f.dst_pitch * oh;
+    for (int y = 0; y < oh / 2; y++) {
+        for (int x = 0; x < ow / 2; x++) {
+            wr(uvOffset, 2 * x + 0, y, rd(f.srcU, f.src_uv_pitch, x + f.crop[0] / 2, y + f.crop[1] / 2));
+            wr(uvOffset, 2 * x + 1, y, rd(f.srcV, f.src_uv_pitch, x + f.crop[0] / 2, y + f.crop[1] / 2));
+        }
+    }
+    return dst;
+}
+
+static bool compare_frame(const ConvTestFrame& f, const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    const int rowBytes = out_width(f) * f.pixsize;
+    const int rows = out_height(f) + out_height(f) / 2;
+    for (int y = 0; y < rows; y++) {
+        if (memcmp(a.data() + (size_t)y * f.dst_pitch, b.data() + (size_t)y * f.dst_pitch, rowBytes) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<uint8_t> convert_run(const ConvertCSP *conv, const ConvTestFrame& f, int thread_n) {
+    auto dst = alloc_dst(f);
+    void *dstPtr[3] = { dst.data(), dst.data() + (size_t)f.dst_pitch * out_height(f), nullptr };
+    const void *srcPtr[3] = { f.srcY.data(), f.srcU.data(), f.srcV.data() };
+    int crop[4] = { f.crop[0], f.crop[1], f.crop[2], f.crop[3] };
+    for (int ith = 0; ith < thread_n; ith++) {
+        conv->func[0](dstPtr, srcPtr, f.width, f.src_y_pitch, f.src_uv_pitch, f.dst_pitch, f.height, out_height(f), ith, thread_n, crop);
+    }
+    return dst;
+}
+
+static void test_convert(RGY_CSP csp_from, RGY_CSP csp_to, int bitdepth) {
+    const ConvertCSP *convC   = get_convert_csp_func(csp_from, csp_to, false, RGY_SIMD::NONE);
+    const ConvertCSP *convSel = get_convert_csp_func(csp_from, csp_to, false, RGY_SIMD::SIMD_ALL);
+    RGY_TEST_CHECK_MSG(convC != nullptr, "%s -> %s", RGY_CSP_NAMES[csp_from], RGY_CSP_NAMES[csp_to]);
+    RGY_TEST_CHECK_MSG(convSel != nullptr, "%s -> %s", RGY_CSP_NAMES[csp_from], RGY_CSP_NAMES[csp_to]);
+    if (convC == nullptr || convSel == nullptr) return;
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const auto f = gen_frame(bitdepth);
+        const auto ref = convert_ref(f, bitdepth);
+        const int thread_n = rnd_range(1, 4);
+        for (auto conv : { convC, convSel }) {
+            RGY_TEST_CHECK_MSG(compare_frame(f, convert_run(conv, f, 1), ref), "%s -> %s (%s): %dx%d crop %d,%d,%d,%d",
+                RGY_CSP_NAMES[csp_from], RGY_CSP_NAMES[csp_to], (conv == convC) ? "c" : "selected",
+                f.width, f.height, f.crop[0], f.crop[1], f.crop[2], f.crop[3]);
+            RGY_TEST_CHECK_MSG(compare_frame(f, convert_run(conv, f, thread_n), ref), "%s -> %s (%s): %dx%d, %d threads",
+                RGY_CSP_NAMES[csp_from], RGY_CSP_NAMES[csp_to], (conv == convC) ? "c" : "selected",
+                f.width, f.height, thread_n);
+        }
+    }
+}
+
+static void test_yv12_to_nv12()    { test_convert(RGY_CSP_YV12,    RGY_CSP_NV12,  8); }
+static void test_yv12_16_to_p010() { test_convert(RGY_CSP_YV12_16, RGY_CSP_P010, 16); }
+static void test_yv12_14_to_p010() { test_convert(RGY_CSP_YV12_14, RGY_CSP_P010, 14); }
+static void test_yv12_12_to_p010() { test_convert(RGY_CSP_YV12_12, RGY_CSP_P010, 12); }
+static void test_yv12_10_to_p010() { test_convert(RGY_CSP_YV12_10, RGY_CSP_P010, 10); }
+static void test_yv12_09_to_p010() { test_convert(RGY_CSP_YV12_09, RGY_CSP_P010,  9); }
+
+int main() {
+    RGY_TEST_RUN(test_yv12_to_nv12);
+    RGY_TEST_RUN(test_yv12_16_to_p010);
+    RGY_TEST_RUN(test_yv12_14_to_p010);
+    RGY_TEST_RUN(test_yv12_12_to_p010);
+    RGY_TEST_RUN(test_yv12_10_to_p010);
+    RGY_TEST_RUN(test_yv12_09_to_p010);
+    return rgy_test_result();
+}
@@ -0,0 +1,114 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include "rgy_test.h"
+#include "rgy_cmd.h"
+
+static std::filesystem::path write_input_list(const char *name, const std::string& content) {
+    const auto path = std::filesystem::temp_directory_path() / (std::string("rgy_test_input_list_") + name + ".txt");
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << content;
+    return path;
+}
+
+static bool check_args(const std::vector<tstring>& args, const std::vector<tstring>& expected) {
+    if (args != expected) {
+        for (const auto& arg : args) {
+            fprintf(stderr, "  [%s]\n", tchar_to_string(arg).c_str());
+        }
+        return false;
+    }
+    return true;
+}
+
+// 空白区切り、""で囲んだ部分は空白を含めてひとつの引数とすること
+static void test_input_list_quote() {
+    const auto path = write_input_list("quote",
+        "-i \"input 1.mp4\" -o out1.mp4\n"
+        "-i\tin\"put 2\".mp4   -o  \"\"  --vbr 6000\n");
+    const auto jobs = cmd_from_input_list(path.string());
+    RGY_TEST_CHECK_MSG(jobs.size() == 2, "jobs %d", (int)jobs.size());
+    if (jobs.size() == 2) {
+        RGY_TEST_CHECK(check_args(jobs[0], { _T("-i"), _T("input 1.mp4"), _T("-o"), _T("out1.mp4") }));
+        // 引数の途中の""は取り除いて連結し、空の""は空の引数とする
+        RGY_TEST_CHECK(check_args(jobs[1], { _T("-i"), _T("input 2.mp4"), _T("-o"), _T(""), _T("--vbr"), _T("6000") }));
+    }
+    std::filesystem::remove(path);
+}
+
+// 空行、空白のみの行、"#"で始まる行は読み飛ばすこと
+static void test_input_list_comment() {
+    const auto path = write_input_list("comment",
+        "# jobs\n"
+        "\n"
+        "   \t\n"
+        "  # indented comment\n"
+        "-i a.mp4 -o a.mkv # not a comment\r\n"
+        "\r\n"
+        "-i b.mp4 -o b.mkv");
+    const auto jobs = cmd_from_input_list(path.string());
+    RGY_TEST_CHECK_MSG(jobs.size() == 2, "jobs %d", (int)jobs.size());
+    if (jobs.size() == 2) {
+        // 行の途中の"#"はコメントとしない
+        RGY_TEST_CHECK(check_args(jobs[0], { _T("-i"), _T("a.mp4"), _T("-o"), _T("a.mkv"), _T("#"), _T("not"), _T("a"), _T("comment") }));
+        RGY_TEST_CHECK(check_args(jobs[1], { _T("-i"), _T("b.mp4"), _T("-o"), _T("b.mkv") }));
+    }
+    std::filesystem::remove(path);
+}
+
+// 先頭のBOMを除くこと
+static void test_input_list_bom() {
+    const auto path = write_input_list("bom", "\xEF\xBB\xBF-i c.mp4 -o c.mkv\n");
+    const auto jobs = cmd_from_input_list(path.string());
+    RGY_TEST_CHECK_MSG(jobs.size() == 1, "jobs %d", (int)jobs.size());
+    if (jobs.size() == 1) {
+        RGY_TEST_CHECK(check_args(jobs[0], { _T("-i"), _T("c.mp4"), _T("-o"), _T("c.mkv") }));
+    }
+    std::filesystem::remove(path);
+}
+
+// ジョブのないファイル、存在しないファイルでは空を返すこと
+static void test_input_list_empty() {
+    const auto path = write_input_list("empty", "\n# nothing\n\n");
+    RGY_TEST_CHECK(cmd_from_input_list(path.string()).size() == 0);
+    std::filesystem::remove(path);
+    RGY_TEST_CHECK(cmd_from_input_list(path.string()).size() == 0);
+}
+
+int main() {
+    RGY_TEST_RUN(test_input_list_quote);
+    RGY_TEST_RUN(test_input_list_comment);
+    RGY_TEST_RUN(test_input_list_bom);
+    RGY_TEST_RUN(test_input_list_empty);
+    return rgy_test_result();
+}
@@ -0,0 +1,152 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "rgy_test.h"
+#include "rgy_test_cl.h"
+#include "rgy_filter_denoise_knn.h"
+
+static std::shared_ptr<RGYLog> g_log;
+static std::shared_ptr<RGYOpenCLContext> g_cl;
+static std::mt19937 g_rnd(1234);
+
+static RGY_ERR runKnn(const VppKnn& knn, const bool allowTiled, const RGYTestHostFrame& input, RGYTestHostFrame& output, bool& tiled) {
+    auto cl = g_cl;
+    auto inFrame = cl->createFrameBuffer(input.info()->width, input.info()->height, input.info()->csp, RGY_CSP_BIT_DEPTH[input.info()->csp]);
+    if (!inFrame) {
+        return RGY_ERR_MEMORY_ALLOC;
+    }
+    auto err = rgy_test_upload(cl.get(), inFrame.get(), input);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    auto param = std::make_shared<RGYFilterParamDenoiseKnn>();
+    param->knn = knn;
+    param->allowTiled = allowTiled;
+    param->frameIn = inFrame->frame;
+    param->frameOut = inFrame->frame;
+    param->baseFps = rgy_rational<int>(30, 1);
+    param->bOutOverwrite = false;
+    RGYFilterDenoiseKnn filter(cl);
+    err = filter.init(param, g_log);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    tiled = filter.GetInputMessage().find(_T("tiled")) != tstring::npos;
+    RGYFrameInfo *outFrames[1] = { nullptr };
+    int outNum = 0;
+    err = filter.filter(&inFrame->frame, outFrames, &outNum);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    if (outNum != 1 || outFrames[0] == nullptr) {
+        return RGY_ERR_UNKNOWN;
+    }
+    return rgy_test_download(cl.get(), output, outFrames[0]);
+}
+
+// 一様乱数で埋める (近傍との差が大きく、重みの閾値判定の両側を通る)
+static void fillRandom(RGYTestHostFrame& frame) {
+    const int maxVal = (1 << RGY_CSP_BIT_DEPTH[frame.info()->csp]) - 1;
+    for (int i = 0; i < RGY_CSP_PLANES[frame.info()->csp]; i++) {
+        const auto plane = getPlane(frame.info(), (RGY_PLANE)i);
+        for (int y = 0; y < plane.height; y++) {
+            for (int x = 0; x < plane.width; x++) {
+                frame.setPix(i, x, y, std::uniform_int_distribution<int>(0, maxVal)(g_rnd));
+            }
+        }
+    }
+}
+
+// 共有メモリを使うkernel_denoise_knn_tiledと、kernel_denoise_knnの結果を比較する
+// 読み込む画素と演算順は同じなので、FMA縮約などによる差(1)のみを許容する
+static void test_knn_tiled() {
+    struct KnnSize {
+        int width, height;
+    };
+    const KnnSize sizeList[] = {
+        { 320, 176 },
+        { 123,  77 }, // ブロックサイズ(32x8)で割り切れない
+        {  33,   9 },
+        {  16,   4 }, // 1ブロックより小さい
+    };
+    int tiledCount = 0;
+    for (const auto csp : { RGY_CSP_YV12, RGY_CSP_YV12_16 }) {
+        for (int radius = 1; radius <= 5; radius += 2) {
+            for (const auto& size : sizeList) {
+                for (const bool random : { false, true }) {
+                    RGYTestHostFrame input(size.width, size.height, csp);
+                    if (random) {
+                        fillRandom(input);
+                    } else {
+                        input.fillPattern(size.width * 7 + radius);
+                    }
+                    VppKnn knn;
+                    knn.enable = true;
+                    knn.radius = radius;
+                    RGYTestHostFrame outSimple(size.width, size.height, csp);
+                    RGYTestHostFrame outTiled(size.width, size.height, csp);
+                    bool tiledSimple = true, tiled = false;
+                    RGY_TEST_CHECK(runKnn(knn, false, input, outSimple, tiledSimple) == RGY_ERR_NONE);
+                    RGY_TEST_CHECK(runKnn(knn, true, input, outTiled, tiled) == RGY_ERR_NONE);
+                    RGY_TEST_CHECK(!tiledSimple);
+                    tiledCount += (tiled) ? 1 : 0;
+                    for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+                        const auto plane = getPlane(outSimple.info(), (RGY_PLANE)i);
+                        int maxDiff = 0;
+                        for (int y = 0; y < plane.height; y++) {
+                            for (int x = 0; x < plane.width; x++) {
+                                maxDiff = std::max(maxDiff, std::abs(outSimple.pix(i, x, y) - outTiled.pix(i, x, y)));
+                            }
+                        }
+                        RGY_TEST_CHECK_MSG(maxDiff <= 1, "%s radius %d %dx%d %s (%s) plane %d: max diff %d",
+                            tchar_to_string(RGY_CSP_NAMES[csp]).c_str(), radius, size.width, size.height,
+                            (random) ? "random" : "pattern", (tiled) ? "tiled" : "simple", i, maxDiff);
+                    }
+                }
+            }
+        }
+    }
+    if (tiledCount == 0) {
+        fprintf(stderr, "tiled kernel not selected on this device (local memory too small).\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    g_log = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    g_cl = rgy_test_create_cl(g_log);
+    if (!g_cl) {
+        fprintf(stderr, "OpenCL device not found, skip.\n");
+        return RGY_TEST_EXIT_SKIP;
+    }
+    RGY_TEST_RUN(test_knn_tiled);
+    g_cl.reset();
+    return rgy_test_result();
+}
@@ -0,0 +1,243 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "rgy_test.h"
+#include "rgy_lookahead.h"
+
+static const int TEST_WIDTH  = 256;
+static const int TEST_HEIGHT = 128;
+static const int TEST_PATTERN_BLOCK = 16;
+
+// 16x16のブロック単位の乱数パターンを横にshiftだけずらした輝度を作る
+// 縮小後も平坦な領域が残るので、パターンが変わった時のみinterCostが大きくなる
+static void genPattern(std::vector<uint8_t>& luma, const uint32_t seed, const int shift) {
+    const int blocksX = TEST_WIDTH / TEST_PATTERN_BLOCK + 2;
+    const int blocksY = TEST_HEIGHT / TEST_PATTERN_BLOCK;
+    std::vector<uint8_t> blocks(blocksX * blocksY);
+    uint32_t x = seed * 2654435761u + 1;
+    for (auto& b : blocks) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        b = (uint8_t)(32 + (x % 192));
+    }
+    luma.resize(TEST_WIDTH * TEST_HEIGHT);
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        for (int ix = 0; ix < TEST_WIDTH; ix++) {
+            const int px = ix + shift;
+            luma[y * TEST_WIDTH + ix] = blocks[(y / TEST_PATTERN_BLOCK) * blocksX + (px / TEST_PATTERN_BLOCK) % blocksX];
+        }
+    }
+}
+
+// 8bitの輝度を指定の色空間のフレームに格納する (色差は使用しないので確保のみ)
+class TestFrame {
+public:
+    TestFrame(const RGY_CSP csp) : m_buf(), m_info(TEST_WIDTH, TEST_HEIGHT, csp, RGY_CSP_BIT_DEPTH[csp]) {
+        const int pixSize = (RGY_CSP_DATA_TYPE[csp] == RGY_DATA_TYPE_U16) ? 2 : 1;
+        m_info.pitch[0] = TEST_WIDTH * pixSize;
+        m_buf.resize(m_info.pitch[0] * TEST_HEIGHT * 3);
+        m_info.ptr[0] = m_buf.data();
+        m_info.pitch[1] = m_info.pitch[0];
+        m_info.ptr[1] = m_buf.data() + m_info.pitch[0] * TEST_HEIGHT;
+        m_info.pitch[2] = m_info.pitch[0];
+        m_info.ptr[2] = m_info.ptr[1] + m_info.pitch[0] * TEST_HEIGHT;
+    }
+    const RGYFrameInfo *set(const std::vector<uint8_t>& luma) {
+        const auto csp = m_info.csp;
+        for (int y = 0; y < TEST_HEIGHT; y++) {
+            uint8_t *line = m_info.ptr[0] + y * m_info.pitch[0];
+            for (int x = 0; x < TEST_WIDTH; x++) {
+                const uint8_t v = luma[y * TEST_WIDTH + x];
+                if (RGY_CSP_DATA_TYPE[csp] == RGY_DATA_TYPE_U16) {
+                    ((uint16_t *)line)[x] = (uint16_t)(v << (RGY_CSP_BIT_DEPTH[csp] - 8));
+                } else {
+                    line[x] = v;
+                }
+            }
+        }
+        return &m_info;
+    }
+private:
+    std::vector<uint8_t> m_buf;
+    RGYFrameInfo m_info;
+};
+
+// frameSeed[i]のパターンをframeShift[i]だけずらしたフレームを順に投入し、判定結果を返す
+static std::vector<RGYLookaheadResult> runLookahead(const RGYLookaheadParam& prm, const std::vector<uint32_t>& frameSeed, const std::vector<int>& frameShift, const RGY_CSP csp = RGY_CSP_NV12) {
+    std::vector<RGYLookaheadResult> results;
+    RGYLookahead lookahead;
+    RGY_TEST_CHECK(lookahead.init(prm) == RGY_ERR_NONE);
+    TestFrame frame(csp);
+    std::vector<uint8_t> luma;
+    for (size_t i = 0; i < frameSeed.size(); i++) {
+        genPattern(luma, frameSeed[i], frameShift[i]);
+        RGY_TEST_CHECK(lookahead.add(frame.set(luma)) == RGY_ERR_NONE);
+        while (lookahead.ready(false)) {
+            results.push_back(lookahead.pop());
+        }
+    }
+    while (lookahead.ready(true)) {
+        results.push_back(lookahead.pop());
+    }
+    RGY_TEST_CHECK(results.size() == frameSeed.size());
+    for (size_t i = 0; i < results.size(); i++) {
+        RGY_TEST_CHECK(results[i].frameIdx == (int64_t)i);
+    }
+    return results;
+}
+
+static RGYLookaheadParam testParam(const int qpOffset) {
+    RGYLookaheadParam prm;
+    prm.depth = 4;
+    prm.qpOffset = qpOffset;
+    return prm;
+}
+
+// ゆっくりパンしている途中でシーンが切り替わると、そのフレームのみIDRになる
+static void test_scenecut() {
+    std::vector<uint32_t> seed;
+    std::vector<int> shift;
+    for (int i = 0; i < 40; i++) {
+        seed.push_back((i < 20) ? 1 : 2);
+        shift.push_back(i);
+    }
+    const auto results = runLookahead(testParam(0), seed, shift);
+    for (size_t i = 0; i < results.size(); i++) {
+        RGY_TEST_CHECK_MSG(results[i].forceIDR == (i == 20), "frame %d: forceIDR %d, score %.3f", (int)i, results[i].forceIDR, results[i].sceneScore);
+        RGY_TEST_CHECK(results[i].qpOffset == 0);
+    }
+}
+
+// 1フレームだけ別の画像になる場合 (フラッシュ) は、その前後ともIDRにしない
+static void test_flash() {
+    std::vector<uint32_t> seed;
+    std::vector<int> shift;
+    for (int i = 0; i < 30; i++) {
+        seed.push_back((i == 15) ? 3 : 1);
+        shift.push_back(i);
+    }
+    const auto results = runLookahead(testParam(0), seed, shift);
+    for (size_t i = 0; i < results.size(); i++) {
+        RGY_TEST_CHECK_MSG(!results[i].forceIDR, "frame %d: forceIDR %d, score %.3f", (int)i, results[i].forceIDR, results[i].sceneScore);
+    }
+    // 閾値を越える変化自体は検出されていること
+    RGY_TEST_CHECK(results[15].sceneScore >= testParam(0).scenecutThreshold);
+}
+
+// 2フレームごとにシーンが切り替わっても、IDRの間隔は最小間隔(4)以上あける
+static void test_min_interval() {
+    std::vector<uint32_t> seed;
+    std::vector<int> shift;
+    for (int i = 0; i < 40; i++) {
+        seed.push_back(((i / 2) % 2) ? 5 : 4);
+        shift.push_back(0);
+    }
+    const auto results = runLookahead(testParam(0), seed, shift);
+    int64_t lastIDR = 0;
+    int idrCount = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].forceIDR) {
+            RGY_TEST_CHECK_MSG((int64_t)i - lastIDR >= 4, "frame %d: IDR %d frames after the previous IDR", (int)i, (int)((int64_t)i - lastIDR));
+            lastIDR = i;
+            idrCount++;
+        }
+    }
+    RGY_TEST_CHECK(idrCount > 0);
+}
+
+// 静止した区間ではPフレームのQPを上げ、先頭のIDRはQPを下げる
+static void test_static_qp_offset() {
+    const int qpOffset = 4;
+    std::vector<uint32_t> seed(20, 6);
+    std::vector<int> shift(20, 0);
+    const auto results = runLookahead(testParam(qpOffset), seed, shift);
+    RGY_TEST_CHECK_MSG(results[0].qpOffset == -qpOffset / 2, "frame 0: qpOffset %d", results[0].qpOffset);
+    for (size_t i = 1; i < results.size(); i++) {
+        RGY_TEST_CHECK_MSG(!results[i].forceIDR, "frame %d: forceIDR", (int)i);
+        RGY_TEST_CHECK_MSG(results[i].qpOffset == qpOffset, "frame %d: qpOffset %d", (int)i, results[i].qpOffset);
+    }
+    // 動きのある区間ではQPオフセットをかけない
+    for (size_t i = 0; i < shift.size(); i++) {
+        shift[i] = (int)i * TEST_PATTERN_BLOCK;
+    }
+    const auto resultsMove = runLookahead(testParam(qpOffset), seed, shift);
+    for (size_t i = 1; i < resultsMove.size(); i++) {
+        RGY_TEST_CHECK_MSG(resultsMove[i].qpOffset == 0, "frame %d: qpOffset %d", (int)i, resultsMove[i].qpOffset);
+    }
+}
+
+// 高ビット深度の入力 (上位詰め/下位詰め) でも8bitと同じ判定になる
+static void test_high_bitdepth() {
+    std::vector<uint32_t> seed;
+    std::vector<int> shift;
+    for (int i = 0; i < 30; i++) {
+        seed.push_back((i < 12) ? 7 : 8);
+        shift.push_back(i * 2);
+    }
+    const auto results8 = runLookahead(testParam(3), seed, shift, RGY_CSP_NV12);
+    for (const auto csp : { RGY_CSP_P010, RGY_CSP_YV12_10, RGY_CSP_YV12_16 }) {
+        const auto results = runLookahead(testParam(3), seed, shift, csp);
+        RGY_TEST_CHECK(results.size() == results8.size());
+        for (size_t i = 0; i < std::min(results.size(), results8.size()); i++) {
+            RGY_TEST_CHECK_MSG(results[i].forceIDR == results8[i].forceIDR
+                && results[i].qpOffset == results8[i].qpOffset
+                && results[i].intraCost == results8[i].intraCost
+                && results[i].interCost == results8[i].interCost,
+                "csp %d, frame %d", (int)csp, (int)i);
+        }
+    }
+}
+
+// 範囲外のパラメータや対応しない入力はエラーを返す
+static void test_invalid() {
+    RGYLookahead lookahead;
+    RGYLookaheadParam prm = testParam(0);
+    prm.depth = LOOKAHEAD_DEPTH_MAX + 1;
+    RGY_TEST_CHECK(lookahead.init(prm) == RGY_ERR_INVALID_PARAM);
+    prm = testParam(LOOKAHEAD_QP_OFFSET_MAX + 1);
+    RGY_TEST_CHECK(lookahead.init(prm) == RGY_ERR_INVALID_PARAM);
+    prm = testParam(0);
+    prm.scenecutThreshold = 0.0f;
+    RGY_TEST_CHECK(lookahead.init(prm) == RGY_ERR_INVALID_PARAM);
+    RGY_TEST_CHECK(lookahead.init(testParam(0)) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(lookahead.add(nullptr) == RGY_ERR_NULL_PTR);
+    TestFrame yuy2(RGY_CSP_YUY2);
+    std::vector<uint8_t> luma(TEST_WIDTH * TEST_HEIGHT, 0);
+    RGY_TEST_CHECK(lookahead.add(yuy2.set(luma)) == RGY_ERR_UNSUPPORTED);
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_scenecut);
+    RGY_TEST_RUN(test_flash);
+    RGY_TEST_RUN(test_min_interval);
+    RGY_TEST_RUN(test_static_qp_offset);
+    RGY_TEST_RUN(test_high_bitdepth);
+    RGY_TEST_RUN(test_invalid);
+    return rgy_test_result();
+}
@@ -0,0 +1,163 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <random>
+#include "rgy_test.h"
+
+#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+#include "rgy_metric_cpu.h"
+
+// 画質評価 (--ssim/--psnr/--quality-metric) のNEON版とC版の出力を比較する
+static const int FUZZ_LOOP = 500;
+static std::mt19937 g_rnd(1234);
+
+static int rnd_range(int min, int max) {
+    return std::uniform_int_distribution<int>(min, max)(g_rnd);
+}
+
+static float rnd_float(float min, float max) {
+    return std::uniform_real_distribution<float>(min, max)(g_rnd);
+}
+
+static void fill_random(uint16_t *ptr, size_t size, int bitdepth) {
+    for (size_t i = 0; i < size; i++) {
+        ptr[i] = (uint16_t)rnd_range(0, (1 << bitdepth) - 1);
+    }
+}
+
+// 加算順が同じでも積和の融合の有無で差が出るので、相対誤差で比較する
+static bool float_near(float a, float b) {
+    return std::fabs(a - b) <= 1e-5f * std::max(1.0f, std::max(std::fabs(a), std::fabs(b)));
+}
+
+static void test_dispatch() {
+    const auto funcs = get_metric_cpu_funcs();
+    RGY_TEST_CHECK(funcs.ssd == rgy_metric_ssd_neon);
+    RGY_TEST_CHECK(funcs.sad == rgy_metric_sad_neon);
+    RGY_TEST_CHECK(funcs.ssim4x4 == rgy_metric_ssim4x4_neon);
+    RGY_TEST_CHECK(funcs.vifVFilter == rgy_metric_vif_vfilter_neon);
+    RGY_TEST_CHECK(funcs.vifHFilter == rgy_metric_vif_hfilter_neon);
+}
+
+static void test_ssd_sad() {
+    std::vector<uint16_t> a(4096 + 16), b(4096 + 16);
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int width = rnd_range(0, 4096);
+        const int offset = rnd_range(0, 15); // 非アラインの先頭
+        const int bitdepth = rnd_range(0, 1) ? 10 : 8;
+        fill_random(a.data() + offset, width, bitdepth);
+        fill_random(b.data() + offset, width, bitdepth);
+        const auto ssd_c    = rgy_metric_ssd_c(a.data() + offset, b.data() + offset, width);
+        const auto ssd_neon = rgy_metric_ssd_neon(a.data() + offset, b.data() + offset, width);
+        RGY_TEST_CHECK_MSG(ssd_c == ssd_neon, "ssd: width %d, offset %d, c %llu, neon %llu",
+            width, offset, (unsigned long long)ssd_c, (unsigned long long)ssd_neon);
+        const auto sad_c    = rgy_metric_sad_c(a.data() + offset, b.data() + offset, width);
+        const auto sad_neon = rgy_metric_sad_neon(a.data() + offset, b.data() + offset, width);
+        RGY_TEST_CHECK_MSG(sad_c == sad_neon, "sad: width %d, offset %d, c %llu, neon %llu",
+            width, offset, (unsigned long long)sad_c, (unsigned long long)sad_neon);
+    }
+}
+
+static void test_ssim4x4() {
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int blocks = rnd_range(1, 130);
+        const int pitch = blocks * 4 + rnd_range(0, 16);
+        const int bitdepth = rnd_range(0, 1) ? 10 : 8;
+        std::vector<uint16_t> a(pitch * 4), b(pitch * 4);
+        fill_random(a.data(), a.size(), bitdepth);
+        fill_random(b.data(), b.size(), bitdepth);
+        std::vector<int32_t> sums_c(blocks * 4, -1), sums_neon(blocks * 4, -2);
+        rgy_metric_ssim4x4_c(a.data(), pitch, b.data(), pitch, blocks, (int32_t(*)[4])sums_c.data());
+        rgy_metric_ssim4x4_neon(a.data(), pitch, b.data(), pitch, blocks, (int32_t(*)[4])sums_neon.data());
+        RGY_TEST_CHECK_MSG(sums_c == sums_neon, "ssim4x4: blocks %d, pitch %d", blocks, pitch);
+    }
+}
+
+static void test_vif_filter() {
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int width = rnd_range(1, 600);
+        const int taps = rnd_range(1, 17) | 1;
+        std::vector<float> filter(taps);
+        for (auto& f : filter) f = rnd_float(0.0f, 0.2f);
+
+        // 垂直方向: ref/disの各行から mu1, mu2, ref^2, dis^2, ref*dis を求める
+        std::vector<std::vector<float>> ref(taps, std::vector<float>(width)), dis(taps, std::vector<float>(width));
+        std::vector<const float *> rowRef(taps), rowDis(taps);
+        for (int k = 0; k < taps; k++) {
+            for (int x = 0; x < width; x++) {
+                ref[k][x] = rnd_float(0.0f, 1023.0f);
+                dis[k][x] = rnd_float(0.0f, 1023.0f);
+            }
+            rowRef[k] = ref[k].data();
+            rowDis[k] = dis[k].data();
+        }
+        std::vector<std::vector<float>> out_c(5, std::vector<float>(width)), out_neon(5, std::vector<float>(width));
+        float *ptr_c[5], *ptr_neon[5];
+        for (int j = 0; j < 5; j++) {
+            ptr_c[j] = out_c[j].data();
+            ptr_neon[j] = out_neon[j].data();
+        }
+        rgy_metric_vif_vfilter_c(rowRef.data(), rowDis.data(), filter.data(), taps, width, ptr_c);
+        rgy_metric_vif_vfilter_neon(rowRef.data(), rowDis.data(), filter.data(), taps, width, ptr_neon);
+        for (int j = 0; j < 5; j++) {
+            for (int x = 0; x < width; x++) {
+                RGY_TEST_CHECK_MSG(float_near(out_c[j][x], out_neon[j][x]), "vif_vfilter: width %d, taps %d, out %d, x %d, c %f, neon %f",
+                    width, taps, j, x, out_c[j][x], out_neon[j][x]);
+            }
+        }
+
+        // 水平方向: srcは左右にtaps/2ずつ余白を持つ
+        std::vector<float> src(width + taps - 1);
+        for (auto& s : src) s = rnd_float(0.0f, 1023.0f * 1023.0f);
+        std::vector<float> dst_c(width), dst_neon(width);
+        rgy_metric_vif_hfilter_c(src.data(), filter.data(), taps, width, dst_c.data());
+        rgy_metric_vif_hfilter_neon(src.data(), filter.data(), taps, width, dst_neon.data());
+        for (int x = 0; x < width; x++) {
+            RGY_TEST_CHECK_MSG(float_near(dst_c[x], dst_neon[x]), "vif_hfilter: width %d, taps %d, x %d, c %f, neon %f",
+                width, taps, x, dst_c[x], dst_neon[x]);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_dispatch);
+    RGY_TEST_RUN(test_ssd_sad);
+    RGY_TEST_RUN(test_ssim4x4);
+    RGY_TEST_RUN(test_vif_filter);
+    return rgy_test_result();
+}
+#else
+int main(int argc, char **argv) {
+    fprintf(stderr, "NEON kernels are built only for aarch64, skipped.\n");
+    return RGY_TEST_EXIT_SKIP;
+}
+#endif
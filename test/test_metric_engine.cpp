@@ -0,0 +1,440 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include "rgy_test.h"
+#include "rgy_metric_cpu.h"
+#include "mpp_util.h"
+
+// 画質評価 (--ssim/--psnr/--quality-metric, --metric-log) のCPU版をエンジン全体として確認する
+// SIMDの有無によらず同じ結果になるようC版の関数で計算し、
+//  - スレッド数 (=stripeの分割) によらず結果が一致すること
+//  - --metric-logの出力
+//  - SSIM/PSNRが素朴な実装と一致すること
+// を確認する
+
+#if ENABLE_AVSW_READER
+static const int TEST_WIDTH = 192;
+static const int TEST_HEIGHT = 352; // 高さ/16 = 22 stripeまで分割可能
+static const int TEST_FRAMES = 8;
+static const int TEST_THREADS[] = { 1, 2, 3, 5, 8 }; // stripe数 4, 8, 12, 20, 22
+static const char *TEST_LOG_HEADER = "frame,ssim_y,ssim_u,ssim_v,ssim_all,psnr_y,psnr_u,psnr_v,psnr_avg,vif_scale0,vif_scale1,vif_scale2,vif_scale3,adm,motion";
+
+// C版の関数を使用し、累積値を参照できるようにしたもの
+class TestMetricCPU : public RGYVideoMetricCPU {
+public:
+    void useCFuncs() {
+        m_func = { rgy_metric_ssd_c, rgy_metric_sad_c, rgy_metric_ssim4x4_c, rgy_metric_vif_vfilter_c, rgy_metric_vif_hfilter_c, _T("c") };
+    }
+    int frames() const { return m_frames; }
+    int stripes() const { return m_stripes; }
+    const std::array<double, 3>& ssimTotalPlane() const { return m_ssimTotalPlane; }
+    const std::array<double, 3>& mseTotalPlane() const { return m_psnrTotalPlane; }
+    const std::array<double, 4>& vifTotal() const { return m_vifTotal; }
+    double admTotal() const { return m_admTotal; }
+    double motionTotal() const { return m_motionTotal; }
+};
+
+struct TestPlanes {
+    std::array<std::vector<uint8_t>, 3> plane;
+};
+
+struct TestMetricResult {
+    int frames;
+    int stripes;
+    std::array<double, 3> ssim;
+    std::array<double, 3> mse;
+    std::array<double, 4> vif;
+    double adm;
+    double motion;
+    std::vector<std::vector<std::string>> log; // ヘッダを除いた各行の列
+    std::string header;
+};
+
+static int plane_width(int iplane) { return (iplane == 0) ? TEST_WIDTH : TEST_WIDTH >> 1; }
+static int plane_height(int iplane) { return (iplane == 0) ? TEST_HEIGHT : TEST_HEIGHT >> 1; }
+
+// 動きのあるなめらかな模様にノイズを加えたフレーム
+static std::vector<TestPlanes> gen_frames() {
+    std::mt19937 rnd(1234);
+    std::vector<TestPlanes> frames(TEST_FRAMES);
+    for (int f = 0; f < TEST_FRAMES; f++) {
+        for (int i = 0; i < 3; i++) {
+            const int width = plane_width(i), height = plane_height(i);
+            auto& plane = frames[f].plane[i];
+            plane.resize((size_t)width * height);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    const double base = (i == 0) ? 128.0 + 80.0 * std::sin(x * 0.07 + f * 0.4) * std::cos(y * 0.05 - f * 0.2)
+                                                 : 128.0 + 40.0 * std::sin((x + y) * 0.1 + f * 0.3 + i);
+                    const int val = (int)base + (int)(rnd() % 12) - 6;
+                    plane[(size_t)y * width + x] = (uint8_t)std::min(std::max(val, 0), 255);
+                }
+            }
+        }
+    }
+    return frames;
+}
+
+// libavcodecのmpeg2videoで低めのビットレートでエンコードし、歪みのあるストリームを作る
+static bool encode_mpeg2(std::vector<std::vector<uint8_t>>& packets, const std::vector<TestPlanes>& frames) {
+    auto codec = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
+    if (!codec) {
+        return false;
+    }
+    auto ctx = std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>>(avcodec_alloc_context3(codec), RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+    ctx->width = TEST_WIDTH;
+    ctx->height = TEST_HEIGHT;
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->time_base = av_make_q(1, 25);
+    ctx->framerate = av_make_q(25, 1);
+    ctx->gop_size = 4;
+    ctx->max_b_frames = 0;
+    ctx->bit_rate = 400000;
+    if (avcodec_open2(ctx.get(), codec, nullptr) < 0) {
+        return false;
+    }
+    auto frame = std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+    auto pkt = std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(av_packet_alloc(), RGYAVDeleter<AVPacket>(av_packet_free));
+    frame->width = TEST_WIDTH;
+    frame->height = TEST_HEIGHT;
+    frame->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(frame.get(), 0) < 0) {
+        return false;
+    }
+    for (int f = 0; f <= (int)frames.size(); f++) {
+        int ret = 0;
+        if (f < (int)frames.size()) {
+            av_frame_make_writable(frame.get());
+            for (int i = 0; i < 3; i++) {
+                for (int y = 0; y < plane_height(i); y++) {
+                    memcpy(frame->data[i] + y * frame->linesize[i], frames[f].plane[i].data() + (size_t)y * plane_width(i), plane_width(i));
+                }
+            }
+            frame->pts = f;
+            ret = avcodec_send_frame(ctx.get(), frame.get());
+        } else {
+            ret = avcodec_send_frame(ctx.get(), nullptr);
+        }
+        if (ret < 0) {
+            return false;
+        }
+        while (avcodec_receive_packet(ctx.get(), pkt.get()) == 0) {
+            packets.push_back(std::vector<uint8_t>(pkt->data, pkt->data + pkt->size));
+            av_packet_unref(pkt.get());
+        }
+    }
+    return true;
+}
+
+// 素朴な実装との比較用に、テスト側でもデコードする
+static bool decode_mpeg2(std::vector<TestPlanes>& frames, const std::vector<std::vector<uint8_t>>& packets) {
+    auto codec = avcodec_find_decoder(AV_CODEC_ID_MPEG2VIDEO);
+    if (!codec) {
+        return false;
+    }
+    auto ctx = std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>>(avcodec_alloc_context3(codec), RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+    if (avcodec_open2(ctx.get(), codec, nullptr) < 0) {
+        return false;
+    }
+    auto frame = std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+    auto pkt = std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(av_packet_alloc(), RGYAVDeleter<AVPacket>(av_packet_free));
+    for (size_t ipkt = 0; ipkt <= packets.size(); ipkt++) {
+        int ret = 0;
+        if (ipkt < packets.size()) {
+            if (av_new_packet(pkt.get(), (int)packets[ipkt].size()) < 0) {
+                return false;
+            }
+            memcpy(pkt->data, packets[ipkt].data(), packets[ipkt].size());
+            ret = avcodec_send_packet(ctx.get(), pkt.get());
+            av_packet_unref(pkt.get());
+        } else {
+            ret = avcodec_send_packet(ctx.get(), nullptr);
+        }
+        if (ret < 0) {
+            return false;
+        }
+        while (avcodec_receive_frame(ctx.get(), frame.get()) == 0) {
+            if (frame->format != AV_PIX_FMT_YUV420P || frame->width != TEST_WIDTH || frame->height != TEST_HEIGHT) {
+                return false;
+            }
+            TestPlanes planes;
+            for (int i = 0; i < 3; i++) {
+                planes.plane[i].resize((size_t)plane_width(i) * plane_height(i));
+                for (int y = 0; y < plane_height(i); y++) {
+                    memcpy(planes.plane[i].data() + (size_t)y * plane_width(i), frame->data[i] + y * frame->linesize[i], plane_width(i));
+                }
+            }
+            frames.push_back(std::move(planes));
+            av_frame_unref(frame.get());
+        }
+    }
+    return true;
+}
+
+static std::vector<std::string> split_csv(const std::string& line) {
+    std::vector<std::string> cols;
+    std::stringstream ss(line);
+    std::string col;
+    while (std::getline(ss, col, ',')) {
+        cols.push_back(col);
+    }
+    return cols;
+}
+
+static bool run_metric(TestMetricResult& result, int threads, const std::vector<TestPlanes>& org, const std::vector<std::vector<uint8_t>>& packets, const std::filesystem::path& logFile) {
+    RGYVideoMetricCPUParam prm;
+    prm.metric.ssim = true;
+    prm.metric.psnr = true;
+    prm.vif = true;
+    prm.adm = true;
+    prm.motion = true;
+    prm.threads = threads;
+    prm.logFile = logFile.string();
+    prm.codec = RGY_CODEC_MPEG2;
+    prm.frameInfo.width = TEST_WIDTH;
+    prm.frameInfo.height = TEST_HEIGHT;
+    prm.frameInfo.csp = RGY_CSP_YV12;
+    prm.bitDepth = 8;
+
+    auto log = std::make_shared<RGYLog>(nullptr, RGY_LOG_QUIET);
+    TestMetricCPU metric;
+    if (metric.init(prm, log) != RGY_ERR_NONE) {
+        return false;
+    }
+    // 比較はビットストリームが来てから行われるので、ここで切り替えれば全フレームでC版が使われる
+    metric.useCFuncs();
+    for (const auto& frame : org) {
+        RGYFrameInfo info;
+        info.width = TEST_WIDTH;
+        info.height = TEST_HEIGHT;
+        info.csp = RGY_CSP_YV12;
+        for (int i = 0; i < 3; i++) {
+            info.ptr[i] = (uint8_t *)frame.plane[i].data();
+            info.pitch[i] = plane_width(i);
+        }
+        RGY_TEST_CHECK(metric.addFrame(&info) == RGY_ERR_NONE);
+    }
+    RGYBitstream bitstream = RGYBitstreamInit();
+    for (const auto& packet : packets) {
+        bitstream.copy(packet.data(), packet.size());
+        RGY_TEST_CHECK(metric.addBitstream(&bitstream) == RGY_ERR_NONE);
+    }
+    bitstream.clear();
+    RGY_TEST_CHECK(metric.addBitstream(nullptr) == RGY_ERR_NONE);
+    metric.showResult();
+
+    result.frames = metric.frames();
+    result.stripes = metric.stripes();
+    result.ssim = metric.ssimTotalPlane();
+    result.mse = metric.mseTotalPlane();
+    result.vif = metric.vifTotal();
+    result.adm = metric.admTotal();
+    result.motion = metric.motionTotal();
+    metric.close();
+
+    std::ifstream ifs(logFile);
+    std::string line;
+    std::getline(ifs, result.header);
+    result.log.clear();
+    while (std::getline(ifs, line)) {
+        result.log.push_back(split_csv(line));
+    }
+    return true;
+}
+
+// x264と同じ、4x4ブロックの格子上の8x8の窓の平均
+static double ref_ssim(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int width, int height) {
+    const double c1 = .01 * .01 * 255 * 255 * 64;
+    const double c2 = .03 * .03 * 255 * 255 * 64 * 63;
+    double sum = 0.0;
+    int windows = 0;
+    for (int by = 0; by + 1 < height / 4; by++) {
+        for (int bx = 0; bx + 1 < width / 4; bx++) {
+            double s1 = 0.0, s2 = 0.0, ss = 0.0, s12 = 0.0;
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    const double va = a[(size_t)(by * 4 + y) * width + bx * 4 + x];
+                    const double vb = b[(size_t)(by * 4 + y) * width + bx * 4 + x];
+                    s1 += va;
+                    s2 += vb;
+                    ss += va * va + vb * vb;
+                    s12 += va * vb;
+                }
+            }
+            const double vars = ss * 64 - s1 * s1 - s2 * s2;
+            const double covar = s12 * 64 - s1 * s2;
+            sum += (2 * s1 * s2 + c1) * (2 * covar + c2) / ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+            windows++;
+        }
+    }
+    return sum / windows;
+}
+
+static double ref_mse(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    uint64_t ssd = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        const int d = (int)a[i] - (int)b[i];
+        ssd += (uint64_t)(d * d);
+    }
+    return ssd / (double)a.size();
+}
+
+static double ref_psnr(double mse) {
+    return (mse > 0.0) ? std::min(10.0 * std::log10(255.0 * 255.0 / mse), 100.0) : 100.0;
+}
+
+static bool near_rel(double a, double b, double eps) {
+    return std::fabs(a - b) <= eps * std::max(1.0, std::max(std::fabs(a), std::fabs(b)));
+}
+
+static void test_metric_engine() {
+    const auto org = gen_frames();
+    std::vector<std::vector<uint8_t>> packets;
+    std::vector<TestPlanes> dec;
+    if (!encode_mpeg2(packets, org) || !decode_mpeg2(dec, packets)) {
+        fprintf(stderr, "mpeg2video encoder/decoder not available, skip.\n");
+        return;
+    }
+    RGY_TEST_CHECK(dec.size() == org.size());
+    if (dec.size() != org.size()) {
+        return;
+    }
+    const auto logFile = std::filesystem::temp_directory_path() / "rgy_test_metric_engine.csv";
+
+    std::vector<TestMetricResult> results;
+    for (const auto threads : TEST_THREADS) {
+        TestMetricResult result;
+        RGY_TEST_CHECK_MSG(run_metric(result, threads, org, packets, logFile), "init failed: threads %d", threads);
+        results.push_back(result);
+    }
+    std::filesystem::remove(logFile);
+    if (results.size() != _countof(TEST_THREADS)) {
+        return;
+    }
+
+    // 素朴な実装によるフレームごとのSSIM/PSNR
+    std::vector<std::array<double, 3>> refSsim(TEST_FRAMES), refMse(TEST_FRAMES);
+    std::array<double, 3> refSsimTotal = { 0.0 }, refMseTotal = { 0.0 };
+    for (int f = 0; f < TEST_FRAMES; f++) {
+        for (int i = 0; i < 3; i++) {
+            refSsim[f][i] = ref_ssim(org[f].plane[i], dec[f].plane[i], plane_width(i), plane_height(i));
+            refMse[f][i] = ref_mse(org[f].plane[i], dec[f].plane[i]);
+            refSsimTotal[i] += refSsim[f][i];
+            refMseTotal[i] += refMse[f][i];
+        }
+    }
+    const double planeCoef[3] = { 4.0 / 6.0, 1.0 / 6.0, 1.0 / 6.0 };
+    // エンコードで歪みが生じていること (一致してしまうとSSIM/PSNRの検証にならない)
+    RGY_TEST_CHECK(refMseTotal[0] > 0.0);
+
+    const auto& base = results[0];
+    for (size_t ir = 0; ir < results.size(); ir++) {
+        const auto& result = results[ir];
+        const int threads = TEST_THREADS[ir];
+        RGY_TEST_CHECK_MSG(result.frames == TEST_FRAMES, "threads %d: frames %d", threads, result.frames);
+        if (ir > 0) {
+            RGY_TEST_CHECK_MSG(result.stripes != results[ir - 1].stripes, "threads %d: stripes %d", threads, result.stripes);
+        }
+
+        // 整数で集計するPSNR(MSE)とmotionは分割によらず完全に一致し、
+        // 浮動小数で集計するSSIM/VIF/ADMは加算順の違いのみ許容する
+        for (int i = 0; i < 3; i++) {
+            RGY_TEST_CHECK_MSG(result.mse[i] == base.mse[i], "threads %d: mse[%d] %.17g != %.17g", threads, i, result.mse[i], base.mse[i]);
+            RGY_TEST_CHECK_MSG(near_rel(result.ssim[i], base.ssim[i], 1e-12), "threads %d: ssim[%d] %.17g != %.17g", threads, i, result.ssim[i], base.ssim[i]);
+        }
+        for (int s = 0; s < 4; s++) {
+            RGY_TEST_CHECK_MSG(near_rel(result.vif[s], base.vif[s], 1e-9), "threads %d: vif[%d] %.17g != %.17g", threads, s, result.vif[s], base.vif[s]);
+        }
+        RGY_TEST_CHECK_MSG(near_rel(result.adm, base.adm, 1e-9), "threads %d: adm %.17g != %.17g", threads, result.adm, base.adm);
+        RGY_TEST_CHECK_MSG(result.motion == base.motion, "threads %d: motion %.17g != %.17g", threads, result.motion, base.motion);
+        RGY_TEST_CHECK_MSG(result.motion > 0.0, "threads %d: motion %f", threads, result.motion);
+
+        // 素朴な実装との比較
+        for (int i = 0; i < 3; i++) {
+            RGY_TEST_CHECK_MSG(near_rel(result.ssim[i], refSsimTotal[i], 1e-9), "threads %d: ssim[%d] %.12f, ref %.12f", threads, i, result.ssim[i], refSsimTotal[i]);
+            RGY_TEST_CHECK_MSG(near_rel(result.mse[i], refMseTotal[i], 1e-12), "threads %d: mse[%d] %.12f, ref %.12f", threads, i, result.mse[i], refMseTotal[i]);
+        }
+
+        // --metric-log: ヘッダ、フレームごとに1行、各列の値
+        RGY_TEST_CHECK_MSG(result.header == TEST_LOG_HEADER, "threads %d: header \"%s\"", threads, result.header.c_str());
+        RGY_TEST_CHECK_MSG((int)result.log.size() == TEST_FRAMES, "threads %d: log rows %d", threads, (int)result.log.size());
+        for (int f = 0; f < std::min((int)result.log.size(), TEST_FRAMES); f++) {
+            const auto& cols = result.log[f];
+            RGY_TEST_CHECK_MSG(cols.size() == 15, "threads %d: frame %d: %d columns", threads, f, (int)cols.size());
+            if (cols.size() != 15) {
+                continue;
+            }
+            RGY_TEST_CHECK(std::stoi(cols[0]) == f);
+            double ssimAll = 0.0, mseAvg = 0.0;
+            for (int i = 0; i < 3; i++) {
+                // 出力は小数点以下6桁(SSIM), 4桁(PSNR)
+                RGY_TEST_CHECK_MSG(std::fabs(std::stod(cols[1 + i]) - refSsim[f][i]) <= 1e-6, "threads %d: frame %d: ssim[%d] %s, ref %.8f", threads, f, i, cols[1 + i].c_str(), refSsim[f][i]);
+                RGY_TEST_CHECK_MSG(std::fabs(std::stod(cols[5 + i]) - ref_psnr(refMse[f][i])) <= 1e-4, "threads %d: frame %d: psnr[%d] %s, ref %.6f", threads, f, i, cols[5 + i].c_str(), ref_psnr(refMse[f][i]));
+                ssimAll += refSsim[f][i] * planeCoef[i];
+                mseAvg += refMse[f][i] * planeCoef[i];
+            }
+            RGY_TEST_CHECK_MSG(std::fabs(std::stod(cols[4]) - ssimAll) <= 1e-6, "threads %d: frame %d: ssim_all %s, ref %.8f", threads, f, cols[4].c_str(), ssimAll);
+            RGY_TEST_CHECK_MSG(std::fabs(std::stod(cols[8]) - ref_psnr(mseAvg)) <= 1e-4, "threads %d: frame %d: psnr_avg %s, ref %.6f", threads, f, cols[8].c_str(), ref_psnr(mseAvg));
+            // 最初のフレームのmotionは0
+            if (f == 0) {
+                RGY_TEST_CHECK(std::stod(cols[14]) == 0.0);
+            }
+            // 分割の異なる結果とも、表示桁の範囲で一致すること (PSNRとmotionは文字列として一致)
+            if (ir > 0 && f < (int)base.log.size() && base.log[f].size() == cols.size()) {
+                for (size_t c = 1; c < cols.size(); c++) {
+                    if ((5 <= c && c <= 8) || c == 14) {
+                        RGY_TEST_CHECK_MSG(cols[c] == base.log[f][c], "threads %d: frame %d: column %d %s != %s", threads, f, (int)c, cols[c].c_str(), base.log[f][c].c_str());
+                    } else {
+                        RGY_TEST_CHECK_MSG(std::fabs(std::stod(cols[c]) - std::stod(base.log[f][c])) <= 1e-6, "threads %d: frame %d: column %d %s != %s", threads, f, (int)c, cols[c].c_str(), base.log[f][c].c_str());
+                    }
+                }
+            }
+        }
+    }
+}
+#endif //#if ENABLE_AVSW_READER
+
+int main() {
+#if ENABLE_AVSW_READER
+    RGY_TEST_RUN(test_metric_engine);
+    return rgy_test_result();
+#else
+    fprintf(stderr, "metric calculation requires libavcodec, skipped.\n");
+    return RGY_TEST_EXIT_SKIP;
+#endif //#if ENABLE_AVSW_READER
+}
@@ -0,0 +1,324 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include "rgy_test.h"
+#include "rgy_metrics_server.h"
+
+struct TestMetricSample {
+    std::string name;   //suffixを含む
+    std::string labels; //{}の中身
+    double value;
+};
+
+struct TestMetricFamily {
+    std::string type;
+    std::string unit;
+    bool hasHelp;
+};
+
+struct TestOpenMetrics {
+    std::map<std::string, TestMetricFamily> families;
+    std::vector<std::string> familyOrder;
+    std::vector<TestMetricSample> samples;
+    std::vector<std::string> errors;
+
+    const TestMetricSample *find(const std::string& name, const std::string& labels = "") const {
+        for (const auto& s : samples) {
+            if (s.name == name && s.labels == labels) return &s;
+        }
+        return nullptr;
+    }
+    int count(const std::string& name) const {
+        int n = 0;
+        for (const auto& s : samples) {
+            if (s.name == name) n++;
+        }
+        return n;
+    }
+};
+
+static bool ends_with(const std::string& str, const std::string& suffix) {
+    return str.length() >= suffix.length() && str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+// サンプル名からfamily名を求める (typeごとに許されるsuffixのみ)
+static std::string family_of_sample(const TestOpenMetrics& om, const std::string& name) {
+    if (om.families.count(name) && om.families.at(name).type == "gauge") return name;
+    static const std::vector<std::pair<const char *, const char *>> suffixes = {
+        { "counter", "_total" }, { "histogram", "_bucket" }, { "histogram", "_count" }, { "histogram", "_sum" }
+    };
+    for (const auto& [type, suffix] : suffixes) {
+        if (ends_with(name, suffix)) {
+            const auto family = name.substr(0, name.length() - strlen(suffix));
+            if (om.families.count(family) && om.families.at(family).type == type) return family;
+        }
+    }
+    return "";
+}
+
+// 出力をOpenMetricsのテキスト形式として解析し、形式の誤りをerrorsに記録する
+static TestOpenMetrics parse_openmetrics(const std::string& text) {
+    TestOpenMetrics om;
+    if (!ends_with(text, "# EOF\n")) {
+        om.errors.push_back("not terminated by # EOF");
+    }
+    std::istringstream iss(text);
+    std::string line;
+    std::string current; //サンプルを追加中のfamily
+    bool eof = false;
+    while (std::getline(iss, line)) {
+        if (eof) {
+            om.errors.push_back("line after # EOF: " + line);
+            continue;
+        }
+        if (line == "# EOF") {
+            eof = true;
+            continue;
+        }
+        if (line.compare(0, 2, "# ") == 0) {
+            std::istringstream ls(line.substr(2));
+            std::string keyword, name, rest;
+            ls >> keyword >> name;
+            std::getline(ls, rest);
+            rest = (rest.length() > 0 && rest[0] == ' ') ? rest.substr(1) : rest;
+            if (keyword == "TYPE") {
+                if (om.families.count(name)) {
+                    om.errors.push_back("family declared twice: " + name);
+                }
+                om.families[name] = TestMetricFamily{ rest, "", false };
+                om.familyOrder.push_back(name);
+                current = name;
+            } else if (keyword == "UNIT" || keyword == "HELP") {
+                if (name != current) {
+                    om.errors.push_back(keyword + " outside of its family: " + name);
+                } else if (keyword == "UNIT") {
+                    om.families[name].unit = rest;
+                    //familyの名前はunitで終わること
+                    if (!ends_with(name, "_" + rest)) {
+                        om.errors.push_back("family name does not end with its unit: " + name);
+                    }
+                } else {
+                    om.families[name].hasHelp = rest.length() > 0;
+                }
+            } else {
+                om.errors.push_back("unknown descriptor: " + line);
+            }
+            continue;
+        }
+        TestMetricSample sample;
+        const auto brace = line.find('{');
+        const auto space = line.rfind(' ');
+        if (space == std::string::npos) {
+            om.errors.push_back("invalid sample: " + line);
+            continue;
+        }
+        if (brace != std::string::npos && brace < space) {
+            const auto close = line.rfind('}');
+            sample.name = line.substr(0, brace);
+            sample.labels = line.substr(brace + 1, close - brace - 1);
+        } else {
+            sample.name = line.substr(0, space);
+        }
+        char *end = nullptr;
+        const auto valueStr = line.substr(space + 1);
+        sample.value = strtod(valueStr.c_str(), &end);
+        if (end == valueStr.c_str() || *end != '\0') {
+            om.errors.push_back("invalid value: " + line);
+        }
+        const auto family = family_of_sample(om, sample.name);
+        if (family.length() == 0) {
+            om.errors.push_back("sample without matching family/suffix: " + line);
+        } else if (family != current) {
+            om.errors.push_back("sample not grouped with its family: " + line);
+        }
+        om.samples.push_back(sample);
+    }
+    if (!eof) {
+        om.errors.push_back("# EOF not found");
+    }
+    return om;
+}
+
+static bool check_format(const TestOpenMetrics& om) {
+    for (const auto& e : om.errors) {
+        fprintf(stderr, "  %s\n", e.c_str());
+    }
+    return om.errors.size() == 0;
+}
+
+static bool check_value(const TestOpenMetrics& om, const std::string& name, const std::string& labels, const double expected) {
+    const auto s = om.find(name, labels);
+    if (!s) {
+        fprintf(stderr, "  %s{%s} not found\n", name.c_str(), labels.c_str());
+        return false;
+    }
+    if (std::abs(s->value - expected) > 1e-9 * std::max(1.0, std::abs(expected))) {
+        fprintf(stderr, "  %s{%s} = %.15g, expected %.15g\n", name.c_str(), labels.c_str(), s->value, expected);
+        return false;
+    }
+    return true;
+}
+
+// 既定値のスナップショット (scrapeがエンコード開始前の場合) でも正しい形式であること
+static void test_openmetrics_default() {
+    const auto text = rgy_metrics_openmetrics(RGYMetricsSnapshot());
+    const auto om = parse_openmetrics(text);
+    RGY_TEST_CHECK(check_format(om));
+    RGY_TEST_CHECK(check_value(om, "rgy_encode_started", "", 0.0));
+    RGY_TEST_CHECK(check_value(om, "rgy_frames_in_total", "", 0.0));
+    // 取得できていない/存在しない情報のfamilyは出力しない
+    RGY_TEST_CHECK(om.families.count("rgy_engine_load_percent") == 0);
+    RGY_TEST_CHECK(om.families.count("rgy_filter_gpu_duration_seconds") == 0);
+    RGY_TEST_CHECK(om.families.count("rgy_kernel_runs") == 0);
+    for (const auto& [name, family] : om.families) {
+        RGY_TEST_CHECK_MSG(family.hasHelp, "%s has no HELP", name.c_str());
+        if (family.type == "counter") {
+            RGY_TEST_CHECK_MSG(!ends_with(name, "_total"), "counter family %s must not have _total", name.c_str());
+        }
+    }
+}
+
+static RGYMetricsSnapshot test_snapshot() {
+    RGYMetricsSnapshot s;
+    s.uptimeSec = 12.5;
+    s.encStarted = true;
+    s.framesIn = 360;
+    s.framesOut = 350;
+    s.framesDrop = 2;
+    s.outBytes = 1234567;
+    s.fps = 29.97;
+    s.fpsAvg = 28.5;
+    s.bitrateKbps = 4000.25;
+    s.bitrateKbpsAvg = 3900;
+    s.frameTypes = {
+        { "IDR", 3,   0,      0,    false },
+        { "I",   12,  300000, 240,  true },
+        { "P",   338, 900000, 9464, true },
+        { "B",   0,   0,      0,    true },
+    };
+    s.queueVidIn = 4;
+    s.queueVidOut = 7;
+    s.cpuPercent = 180.5;
+    s.cpuKernelPercent = 12.25;
+    s.threads = { { "main", 50.0, 6.25 }, { "output", 20.0, 2.5 } };
+    s.memPrivate = 256 * 1024 * 1024;
+    s.memVirtual = 1024LL * 1024 * 1024;
+    s.ioTotalRead = 100000;
+    s.ioTotalWrite = 200000;
+    s.gpuInfoValid = true;
+    s.gpuLoad = 35.0;
+    s.gpuClock = 800;
+    s.veeLoad = 60.0;
+    s.vedLoad = 40.0;
+    s.veClock = 600;
+    s.rgaLoad = 10.0;
+    RGYMetricsFilterTime f;
+    f.name = "resize(\"spline36\")\\n\nx"; //エスケープが必要な文字を含む
+    f.avgMs = 1.5;
+    f.totalMs = 540.0;
+    f.runCount = 360;
+    f.buckets = { { 0.5, 10 }, { 1.0, 100 }, { 2.0, 350 } };
+    s.filters = { f };
+    s.kernels = { { "resize", "kernel_resize", 500.0, 360 } };
+    return s;
+}
+
+// 値、ラベルのエスケープ、histogramの形式が正しいこと
+static void test_openmetrics_values() {
+    const auto text = rgy_metrics_openmetrics(test_snapshot());
+    const auto om = parse_openmetrics(text);
+    RGY_TEST_CHECK(check_format(om));
+
+    RGY_TEST_CHECK(check_value(om, "rgy_uptime_seconds", "", 12.5));
+    RGY_TEST_CHECK(check_value(om, "rgy_encode_started", "", 1.0));
+    RGY_TEST_CHECK(check_value(om, "rgy_frames_in_total", "", 360));
+    RGY_TEST_CHECK(check_value(om, "rgy_frames_out_total", "", 350));
+    RGY_TEST_CHECK(check_value(om, "rgy_frames_dropped_total", "", 2));
+    RGY_TEST_CHECK(check_value(om, "rgy_output_bytes_total", "", 1234567));
+    RGY_TEST_CHECK(check_value(om, "rgy_encode_fps", "", 29.97));
+    RGY_TEST_CHECK(check_value(om, "rgy_bitrate_kbps", "", 4000.25));
+    // 大きな値も指数表記で丸められないこと
+    RGY_TEST_CHECK(text.find("rgy_memory_bytes{type=\"virtual\"} 1073741824\n") != std::string::npos);
+
+    // IDRはフレーム数のみ、サイズ/QPはフレームのあるタイプのみ
+    RGY_TEST_CHECK(check_value(om, "rgy_frame_type_frames_total", "type=\"IDR\"", 3));
+    RGY_TEST_CHECK(om.find("rgy_frame_type_bytes_total", "type=\"IDR\"") == nullptr);
+    RGY_TEST_CHECK(check_value(om, "rgy_frame_type_bytes_total", "type=\"P\"", 900000));
+    RGY_TEST_CHECK(check_value(om, "rgy_frame_type_qp_avg", "type=\"I\"", 20.0));
+    RGY_TEST_CHECK(check_value(om, "rgy_frame_type_qp_avg", "type=\"P\"", 28.0));
+    RGY_TEST_CHECK(om.find("rgy_frame_type_qp_avg", "type=\"B\"") == nullptr);
+
+    RGY_TEST_CHECK(check_value(om, "rgy_queue_depth", "queue=\"vid_out\"", 7));
+    RGY_TEST_CHECK(om.count("rgy_queue_depth") == 6);
+    RGY_TEST_CHECK(check_value(om, "rgy_thread_cpu_seconds_total", "thread=\"output\"", 2.5));
+    RGY_TEST_CHECK(check_value(om, "rgy_engine_load_percent", "engine=\"vee\"", 60.0));
+    RGY_TEST_CHECK(check_value(om, "rgy_engine_clock_mhz", "engine=\"ve\"", 600));
+
+    // ラベル値の \, ", 改行 はエスケープされる
+    const std::string filterLabel = "filter=\"resize(\\\"spline36\\\")\\\\n\\nx\"";
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_time_avg_ms", filterLabel, 1.5));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_time_seconds_total", filterLabel, 0.54));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_runs_total", filterLabel, 360));
+
+    // histogram: leは秒単位で昇順、累積数は単調増加、+Infは_countと一致する
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_duration_seconds_bucket", filterLabel + ",le=\"0.0005\"", 10));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_duration_seconds_bucket", filterLabel + ",le=\"0.001\"", 100));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_duration_seconds_bucket", filterLabel + ",le=\"0.002\"", 350));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_duration_seconds_bucket", filterLabel + ",le=\"+Inf\"", 360));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_duration_seconds_count", filterLabel, 360));
+    RGY_TEST_CHECK(check_value(om, "rgy_filter_gpu_duration_seconds_sum", filterLabel, 0.54));
+    double prevCount = -1.0;
+    int buckets = 0;
+    for (const auto& s : om.samples) {
+        if (s.name == "rgy_filter_gpu_duration_seconds_bucket") {
+            RGY_TEST_CHECK_MSG(s.value >= prevCount, "bucket %s not cumulative", s.labels.c_str());
+            prevCount = s.value;
+            buckets++;
+        }
+    }
+    RGY_TEST_CHECK(buckets == 4);
+
+    RGY_TEST_CHECK(check_value(om, "rgy_kernel_gpu_time_seconds_total", "filter=\"resize\",kernel=\"kernel_resize\"", 0.5));
+    RGY_TEST_CHECK(check_value(om, "rgy_kernel_runs_total", "filter=\"resize\",kernel=\"kernel_resize\"", 360));
+}
+
+int main() {
+    RGY_TEST_RUN(test_openmetrics_default);
+    RGY_TEST_RUN(test_openmetrics_values);
+    return rgy_test_result();
+}
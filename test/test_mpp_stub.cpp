@@ -0,0 +1,378 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "rgy_test.h"
+#include "mpp_stub.h"
+
+// --mpp-stub: スタブのエンコーダ/デコーダがMppApiとして正しく振る舞うことを確認する
+
+static std::shared_ptr<RGYLog> g_log;
+
+static MPPParamStub stub_prm() {
+    MPPParamStub prm;
+    prm.enable = true;
+    prm.latency = 0;
+    prm.fps = 0.0;
+    prm.size = 64;
+    return prm;
+}
+
+static MppFrame gen_enc_frame(MppBufferGroup grp, const int width, const int height, const int64_t pts) {
+    const int hor_stride = ALIGN(width, 16);
+    const int ver_stride = ALIGN(height, 16);
+    const size_t bufSize = (size_t)hor_stride * ver_stride * 3 / 2;
+    MppBuffer buf = nullptr;
+    if (mpp_buffer_get(grp, &buf, bufSize) != MPP_OK) {
+        return nullptr;
+    }
+    memset(mpp_buffer_get_ptr(buf), 128, bufSize);
+    MppFrame frame = nullptr;
+    mpp_frame_init(&frame);
+    mpp_frame_set_width(frame, width);
+    mpp_frame_set_height(frame, height);
+    mpp_frame_set_hor_stride(frame, hor_stride);
+    mpp_frame_set_ver_stride(frame, ver_stride);
+    mpp_frame_set_fmt(frame, MPP_FMT_YUV420SP);
+    mpp_frame_set_pts(frame, pts);
+    mpp_frame_set_buffer(frame, buf);
+    mpp_buffer_put(buf);
+    return frame;
+}
+
+// 出力パケットを解放する (入力フレームはパケットのmetaに付いて返ってくる)
+static void release_enc_packet(MppPacket *packet) {
+    MppFrame frame = nullptr;
+    if (mpp_meta_get_frame(mpp_packet_get_meta(*packet), KEY_INPUT_FRAME, &frame) == MPP_OK && frame) {
+        mpp_frame_deinit(&frame);
+    }
+    mpp_packet_deinit(packet);
+}
+
+// エンコーダ: 最初のフレームとIDR要求のあったフレームはIDRとなり、EOSでEOSのパケットを返す
+static void test_enc_packets(const MppCodingType codec) {
+    MPPStub stub(stub_prm(), g_log);
+    RGY_TEST_CHECK(stub.init(MPP_CTX_ENC, codec) == RGY_ERR_NONE);
+    auto mpi = stub.api();
+    MppBufferGroup grp = nullptr;
+    RGY_TEST_CHECK(mpp_buffer_group_get_internal(&grp, MPP_BUFFER_TYPE_NORMAL) == MPP_OK);
+
+    const int frames = 8;
+    const int idrRequest = 5;
+    for (int i = 0; i < frames; i++) {
+        auto frame = gen_enc_frame(grp, 64, 48, i * 100);
+        RGY_TEST_CHECK(frame != nullptr);
+        if (i == idrRequest) {
+            mpp_meta_set_s32(mpp_frame_get_meta(frame), KEY_INPUT_IDR_REQ, 1);
+        }
+        RGY_TEST_CHECK(mpi->encode_put_frame(&stub, frame) == MPP_OK);
+        MppPacket packet = nullptr;
+        RGY_TEST_CHECK(mpi->encode_get_packet(&stub, &packet) == MPP_OK);
+        RGY_TEST_CHECK_MSG(packet != nullptr, "frame %d", i);
+        if (!packet) continue;
+        const auto ptr = (const uint8_t *)mpp_packet_get_pos(packet);
+        const auto size = mpp_packet_get_length(packet);
+        const bool idr = i == 0 || i == idrRequest;
+        RGY_TEST_CHECK(mpp_packet_get_pts(packet) == i * 100);
+        RK_S32 qp = 0;
+        RGY_TEST_CHECK(mpp_meta_get_s32(mpp_packet_get_meta(packet), KEY_ENC_AVERAGE_QP, &qp) == MPP_OK && qp > 0);
+        if (codec == MPP_VIDEO_CodingAVC) {
+            RGY_TEST_CHECK(size > 5 && memcmp(ptr, "\x00\x00\x00\x01", 4) == 0);
+            RGY_TEST_CHECK_MSG((ptr[4] & 0x1f) == (idr ? 5 : 1), "frame %d, nal 0x%02x", i, ptr[4]);
+        } else if (codec == MPP_VIDEO_CodingHEVC) {
+            RGY_TEST_CHECK(size > 6 && memcmp(ptr, "\x00\x00\x00\x01", 4) == 0);
+            RGY_TEST_CHECK_MSG(((ptr[4] >> 1) & 0x3f) == (idr ? 19 : 1), "frame %d, nal %d", i, (ptr[4] >> 1) & 0x3f);
+        }
+        release_enc_packet(&packet);
+    }
+
+    // キューの深さを超えて入力するとMPP_ERR_BUFFER_FULLを返す
+    int queued = 0;
+    for (;;) {
+        auto frame = gen_enc_frame(grp, 64, 48, 0);
+        const auto ret = mpi->encode_put_frame(&stub, frame);
+        if (ret != MPP_OK) {
+            RGY_TEST_CHECK(ret == MPP_ERR_BUFFER_FULL);
+            mpp_frame_deinit(&frame);
+            break;
+        }
+        queued++;
+    }
+    RGY_TEST_CHECK(queued > 0);
+
+    MppFrame eos = nullptr;
+    mpp_frame_init(&eos);
+    mpp_frame_set_eos(eos, 1);
+    RGY_TEST_CHECK(mpi->encode_put_frame(&stub, eos) == MPP_OK);
+    int drained = 0;
+    bool eosOut = false;
+    for (int i = 0; i < queued + 2 && !eosOut; i++) {
+        MppPacket packet = nullptr;
+        RGY_TEST_CHECK(mpi->encode_get_packet(&stub, &packet) == MPP_OK);
+        if (!packet) break;
+        if (mpp_packet_get_eos(packet)) {
+            eosOut = true;
+            RGY_TEST_CHECK(mpp_packet_get_length(packet) == 0);
+            mpp_packet_deinit(&packet);
+        } else {
+            drained++;
+            release_enc_packet(&packet);
+        }
+    }
+    RGY_TEST_CHECK(drained == queued);
+    RGY_TEST_CHECK(eosOut);
+    stub.api()->reset(&stub);
+    mpp_buffer_group_put(grp);
+}
+
+static void test_enc_packets_h264() { test_enc_packets(MPP_VIDEO_CodingAVC); }
+static void test_enc_packets_hevc() { test_enc_packets(MPP_VIDEO_CodingHEVC); }
+
+#if ENABLE_AVSW_READER
+struct TestDecPicture {
+    int width;
+    int height;
+    AVPixelFormat pixfmt;
+    int frames;
+    uint8_t luma;
+};
+
+// libavcodecのmpeg2videoで、スタブのデコーダに入力するストリームを作る
+static bool encode_mpeg2(std::vector<std::vector<uint8_t>>& packets, const TestDecPicture& pic) {
+    auto codec = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
+    if (!codec) {
+        return false;
+    }
+    auto ctx = std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>>(avcodec_alloc_context3(codec), RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+    ctx->width = pic.width;
+    ctx->height = pic.height;
+    ctx->pix_fmt = pic.pixfmt;
+    ctx->time_base = av_make_q(1, 25);
+    ctx->framerate = av_make_q(25, 1);
+    ctx->gop_size = 1;
+    ctx->max_b_frames = 0;
+    ctx->bit_rate = 2000000;
+    if (avcodec_open2(ctx.get(), codec, nullptr) < 0) {
+        return false;
+    }
+    auto frame = std::unique_ptr<AVFrame, RGYAVDeleter<AVFrame>>(av_frame_alloc(), RGYAVDeleter<AVFrame>(av_frame_free));
+    auto pkt = std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(av_packet_alloc(), RGYAVDeleter<AVPacket>(av_packet_free));
+    frame->width = pic.width;
+    frame->height = pic.height;
+    frame->format = pic.pixfmt;
+    if (av_frame_get_buffer(frame.get(), 0) < 0) {
+        return false;
+    }
+    const auto desc = av_pix_fmt_desc_get(pic.pixfmt);
+    for (int i = 0; i <= pic.frames; i++) {
+        int ret = 0;
+        if (i < pic.frames) {
+            av_frame_make_writable(frame.get());
+            for (int y = 0; y < pic.height; y++) {
+                memset(frame->data[0] + y * frame->linesize[0], pic.luma, pic.width);
+            }
+            for (int iplane = 1; iplane < 3; iplane++) {
+                for (int y = 0; y < (pic.height >> desc->log2_chroma_h); y++) {
+                    memset(frame->data[iplane] + y * frame->linesize[iplane], 128, pic.width >> desc->log2_chroma_w);
+                }
+            }
+            frame->pts = i;
+            ret = avcodec_send_frame(ctx.get(), frame.get());
+        } else {
+            ret = avcodec_send_frame(ctx.get(), nullptr);
+        }
+        if (ret < 0) {
+            return false;
+        }
+        while (avcodec_receive_packet(ctx.get(), pkt.get()) == 0) {
+            packets.push_back(std::vector<uint8_t>(pkt->data, pkt->data + pkt->size));
+            av_packet_unref(pkt.get());
+        }
+    }
+    return true;
+}
+
+struct TestDecEvent {
+    bool infoChange;
+    int width;
+    int height;
+};
+
+// パケットを入力し、出力されたフレームを取り出す
+// info_changeを受け取ったら、パイプラインと同じくbuffer groupを設定してMPP_DEC_SET_INFO_CHANGE_READYを返す
+static MPP_RET decode_stub(MPPStub& stub, const std::vector<std::vector<uint8_t>>& packets, std::vector<TestDecEvent>& events, std::vector<uint8_t>& lumas) {
+    auto mpi = stub.api();
+    MppBufferGroup extGrp = nullptr;
+    bool eosOut = false;
+    MPP_RET err = MPP_OK;
+    auto drain = [&]() {
+        for (;;) {
+            MppFrame frame = nullptr;
+            RGY_TEST_CHECK(mpi->decode_get_frame(&stub, &frame) == MPP_OK);
+            if (!frame) {
+                break;
+            }
+            const int width = mpp_frame_get_width(frame);
+            const int height = mpp_frame_get_height(frame);
+            if (mpp_frame_get_info_change(frame)) {
+                events.push_back({ true, width, height });
+                RGY_TEST_CHECK(mpp_frame_get_buffer(frame) == nullptr);
+                RGY_TEST_CHECK(mpp_frame_get_hor_stride(frame) >= width && mpp_frame_get_ver_stride(frame) >= height);
+                // MPP_DEC_SET_INFO_CHANGE_READYまでは、次のフレームは出力されない
+                MppFrame next = nullptr;
+                RGY_TEST_CHECK(mpi->decode_get_frame(&stub, &next) == MPP_OK);
+                RGY_TEST_CHECK(next == nullptr);
+                if (extGrp == nullptr) {
+                    RGY_TEST_CHECK(mpp_buffer_group_get_internal(&extGrp, MPP_BUFFER_TYPE_NORMAL) == MPP_OK);
+                    RGY_TEST_CHECK(mpi->control(&stub, MPP_DEC_SET_EXT_BUF_GROUP, extGrp) == MPP_OK);
+                } else {
+                    mpp_buffer_group_clear(extGrp);
+                }
+                mpp_buffer_group_limit_config(extGrp, mpp_frame_get_buf_size(frame), 8);
+                RGY_TEST_CHECK(mpi->control(&stub, MPP_DEC_SET_INFO_CHANGE_READY, nullptr) == MPP_OK);
+            } else if (mpp_frame_get_eos(frame) && !mpp_frame_get_buffer(frame)) {
+                eosOut = true;
+            } else {
+                events.push_back({ false, width, height });
+                auto buf = mpp_frame_get_buffer(frame);
+                RGY_TEST_CHECK(buf != nullptr);
+                if (buf) {
+                    RGY_TEST_CHECK(mpp_frame_get_fmt(frame) == MPP_FMT_YUV420SP);
+                    const auto ptr = (const uint8_t *)mpp_buffer_get_ptr(buf);
+                    lumas.push_back(ptr[(height / 2) * mpp_frame_get_hor_stride(frame) + width / 2]);
+                }
+            }
+            mpp_frame_deinit(&frame);
+        }
+    };
+    for (size_t i = 0; i <= packets.size() && err == MPP_OK; i++) {
+        MppPacket packet = nullptr;
+        if (i < packets.size()) {
+            mpp_packet_init(&packet, (void *)packets[i].data(), packets[i].size());
+            mpp_packet_set_pts(packet, (int64_t)i);
+        } else {
+            mpp_packet_init(&packet, nullptr, 0);
+            mpp_packet_set_eos(packet);
+        }
+        for (;;) {
+            err = mpi->decode_put_packet(&stub, packet);
+            if (err != MPP_ERR_BUFFER_FULL) break;
+            drain();
+            err = MPP_OK;
+        }
+        mpp_packet_deinit(&packet);
+        drain();
+    }
+    if (err == MPP_OK) {
+        RGY_TEST_CHECK(eosOut);
+    }
+    stub.api()->reset(&stub);
+    if (extGrp) {
+        mpp_buffer_group_put(extGrp);
+    }
+    return err;
+}
+
+// デコーダ: 最初のフレームと解像度の変更時にinfo_changeを返し、以降のフレームは新しい解像度で出力する
+static void test_dec_info_change() {
+    const TestDecPicture pics[] = {
+        { 64, 48, AV_PIX_FMT_YUV420P, 3, 80 },
+        { 96, 64, AV_PIX_FMT_YUV420P, 3, 160 },
+    };
+    std::vector<std::vector<uint8_t>> packets;
+    for (const auto& pic : pics) {
+        if (!encode_mpeg2(packets, pic)) {
+            fprintf(stderr, "mpeg2video encoder not available, skip.\n");
+            return;
+        }
+    }
+    MPPStub stub(stub_prm(), g_log);
+    RGY_TEST_CHECK(stub.init(MPP_CTX_DEC, MPP_VIDEO_CodingMPEG2) == RGY_ERR_NONE);
+    std::vector<TestDecEvent> events;
+    std::vector<uint8_t> lumas;
+    RGY_TEST_CHECK(decode_stub(stub, packets, events, lumas) == MPP_OK);
+
+    std::vector<TestDecEvent> expected;
+    std::vector<uint8_t> expectedLumas;
+    for (const auto& pic : pics) {
+        expected.push_back({ true, pic.width, pic.height });
+        for (int i = 0; i < pic.frames; i++) {
+            expected.push_back({ false, pic.width, pic.height });
+            expectedLumas.push_back(pic.luma);
+        }
+    }
+    RGY_TEST_CHECK_MSG(events.size() == expected.size(), "events %d, expected %d", (int)events.size(), (int)expected.size());
+    for (size_t i = 0; i < std::min(events.size(), expected.size()); i++) {
+        RGY_TEST_CHECK_MSG(events[i].infoChange == expected[i].infoChange && events[i].width == expected[i].width && events[i].height == expected[i].height,
+            "event %d: %s %dx%d, expected %s %dx%d", (int)i,
+            events[i].infoChange ? "info_change" : "frame", events[i].width, events[i].height,
+            expected[i].infoChange ? "info_change" : "frame", expected[i].width, expected[i].height);
+    }
+    RGY_TEST_CHECK(lumas.size() == expectedLumas.size());
+    for (size_t i = 0; i < std::min(lumas.size(), expectedLumas.size()); i++) {
+        RGY_TEST_CHECK_MSG(std::abs((int)lumas[i] - (int)expectedLumas[i]) <= 4, "frame %d: luma %d, expected %d", (int)i, lumas[i], expectedLumas[i]);
+    }
+}
+
+// デコーダ: 8bit 4:2:0以外はエラーとする
+static void test_dec_reject_format() {
+    std::vector<std::vector<uint8_t>> packets;
+    if (!encode_mpeg2(packets, { 64, 48, AV_PIX_FMT_YUV422P, 2, 128 })) {
+        fprintf(stderr, "mpeg2video encoder not available, skip.\n");
+        return;
+    }
+    RGY_TEST_CHECK(MPPStub::decFormatSupported(AV_PIX_FMT_YUV420P));
+    RGY_TEST_CHECK(MPPStub::decFormatSupported(AV_PIX_FMT_NV12));
+    RGY_TEST_CHECK(!MPPStub::decFormatSupported(AV_PIX_FMT_YUV422P));
+    RGY_TEST_CHECK(!MPPStub::decFormatSupported(AV_PIX_FMT_YUV420P10LE));
+
+    MPPStub stub(stub_prm(), g_log);
+    RGY_TEST_CHECK(stub.init(MPP_CTX_DEC, MPP_VIDEO_CodingMPEG2) == RGY_ERR_NONE);
+    std::vector<TestDecEvent> events;
+    std::vector<uint8_t> lumas;
+    RGY_TEST_CHECK(decode_stub(stub, packets, events, lumas) == MPP_ERR_VALUE);
+    RGY_TEST_CHECK(events.empty());
+}
+#endif //#if ENABLE_AVSW_READER
+
+int main() {
+    g_log = std::make_shared<RGYLog>(nullptr, RGY_LOG_QUIET);
+    mppStubSetEnabled(true);
+    RGY_TEST_RUN(test_enc_packets_h264);
+    RGY_TEST_RUN(test_enc_packets_hevc);
+#if ENABLE_AVSW_READER
+    RGY_TEST_RUN(test_dec_info_change);
+    RGY_TEST_RUN(test_dec_reject_format);
+#endif //#if ENABLE_AVSW_READER
+    return rgy_test_result();
+}
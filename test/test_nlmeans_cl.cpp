@@ -0,0 +1,135 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "rgy_test.h"
+#include "rgy_test_cl.h"
+#include "rgy_filter_denoise_nlmeans.h"
+
+static std::shared_ptr<RGYLog> g_log;
+static std::shared_ptr<RGYOpenCLContext> g_cl;
+
+static RGY_ERR runNLMeans(const VppNLMeans& nlmeans, const RGYTestHostFrame& input, RGYTestHostFrame& output, bool& tiled) {
+    auto cl = g_cl;
+    auto inFrame = cl->createFrameBuffer(input.info()->width, input.info()->height, input.info()->csp, RGY_CSP_BIT_DEPTH[input.info()->csp]);
+    if (!inFrame) {
+        return RGY_ERR_MEMORY_ALLOC;
+    }
+    auto err = rgy_test_upload(cl.get(), inFrame.get(), input);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    auto param = std::make_shared<RGYFilterParamDenoiseNLMeans>();
+    param->nlmeans = nlmeans;
+    param->frameIn = inFrame->frame;
+    param->frameOut = inFrame->frame;
+    param->baseFps = rgy_rational<int>(30, 1);
+    param->bOutOverwrite = false;
+    RGYFilterDenoiseNLMeans filter(cl);
+    err = filter.init(param, g_log);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    tiled = filter.GetInputMessage().find(_T("tiled")) != tstring::npos;
+    RGYFrameInfo *outFrames[1] = { nullptr };
+    int outNum = 0;
+    err = filter.filter(&inFrame->frame, outFrames, &outNum);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    if (outNum != 1 || outFrames[0] == nullptr) {
+        return RGY_ERR_UNKNOWN;
+    }
+    return rgy_test_download(cl.get(), output, outFrames[0]);
+}
+
+// 共有メモリを使う1パスのkernelと、複数パスのkernelの結果を比較する
+// 画面端も含め、丸めの差のみを許容する
+static void test_nlmeans_tiled() {
+    struct NLMeansSize {
+        int width, height, patch, search;
+    };
+    const NLMeansSize sizeList[] = {
+        { 320, 180,  5, 11 },
+        { 123,  77,  5, 11 }, // ブロックサイズで割り切れない
+        { 200, 100,  3,  5 },
+        {  40,  20,  7,  7 },
+    };
+    int tiledCount = 0;
+    for (const auto csp : { RGY_CSP_YV12, RGY_CSP_YV12_16 }) {
+        for (const auto fp16 : { VppNLMeansFP16Opt::NoOpt, VppNLMeansFP16Opt::BlockDiff, VppNLMeansFP16Opt::All }) {
+            const int tolerance = ((fp16 == VppNLMeansFP16Opt::All) ? 2 : 1) << (RGY_CSP_BIT_DEPTH[csp] - 8);
+            for (const auto& size : sizeList) {
+                RGYTestHostFrame input(size.width, size.height, csp);
+                input.fillPattern(size.width * 5 + size.search);
+                VppNLMeans nlmeans;
+                nlmeans.enable = true;
+                nlmeans.patchSize = size.patch;
+                nlmeans.searchSize = size.search;
+                nlmeans.fp16 = fp16;
+                RGYTestHostFrame outMulti(size.width, size.height, csp);
+                RGYTestHostFrame outTiled(size.width, size.height, csp);
+                bool tiledMulti = true, tiled = false;
+                nlmeans.sharedMem = false;
+                RGY_TEST_CHECK(runNLMeans(nlmeans, input, outMulti, tiledMulti) == RGY_ERR_NONE);
+                nlmeans.sharedMem = true;
+                RGY_TEST_CHECK(runNLMeans(nlmeans, input, outTiled, tiled) == RGY_ERR_NONE);
+                RGY_TEST_CHECK(!tiledMulti); // shared_mem=falseでは1パスのkernelを使わない
+                tiledCount += (tiled) ? 1 : 0;
+                for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+                    const auto plane = getPlane(outMulti.info(), (RGY_PLANE)i);
+                    int maxDiff = 0;
+                    for (int y = 0; y < plane.height; y++) {
+                        for (int x = 0; x < plane.width; x++) {
+                            maxDiff = std::max(maxDiff, std::abs(outMulti.pix(i, x, y) - outTiled.pix(i, x, y)));
+                        }
+                    }
+                    RGY_TEST_CHECK_MSG(maxDiff <= tolerance, "%s fp16 %d %dx%d patch %d search %d (%s) plane %d: max diff %d",
+                        tchar_to_string(RGY_CSP_NAMES[csp]).c_str(), (int)fp16, size.width, size.height, size.patch, size.search,
+                        (tiled) ? "tiled" : "multi pass", i, maxDiff);
+                }
+            }
+        }
+    }
+    if (tiledCount == 0) {
+        fprintf(stderr, "tiled kernel not selected on this device (local memory too small).\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    g_log = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    g_cl = rgy_test_create_cl(g_log);
+    if (!g_cl) {
+        fprintf(stderr, "OpenCL device not found, skip.\n");
+        return RGY_TEST_EXIT_SKIP;
+    }
+    RGY_TEST_RUN(test_nlmeans_tiled);
+    g_cl.reset();
+    return rgy_test_result();
+}
@@ -0,0 +1,143 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include "rgy_test.h"
+#include "rgy_test_cl.h"
+
+static std::shared_ptr<RGYLog> g_log;
+static std::shared_ptr<RGYOpenCLContext> g_cl;
+
+static const char *TEST_PROGRAM_SOURCE = "__kernel void kernel_test_cache(__global int *ptr) { ptr[0] = TEST_VALUE; }\n";
+
+static std::string test_program_options(const int i) {
+    return strsprintf("-D TEST_VALUE=%d", i);
+}
+
+// プログラムのキャッシュはPROGRAM_CACHE_MAXを上限とし、最も長く使われていないものから破棄すること
+static void test_program_cache_lru() {
+    const int cacheMax = (int)RGYOpenCLContext::PROGRAM_CACHE_MAX;
+    g_cl->setProgramCache(true);
+    for (int i = 0; i < cacheMax; i++) {
+        if (!g_cl->build(TEST_PROGRAM_SOURCE, test_program_options(i).c_str())) {
+            RGY_TEST_CHECK_MSG(false, "failed to build program %d", i);
+            return;
+        }
+    }
+    RGY_TEST_CHECK_MSG(g_cl->programCacheCount() == (size_t)cacheMax, "cached %d", (int)g_cl->programCacheCount());
+
+    // 0番目を使用して最新にしておく (キャッシュから取得されるので数は変わらない)
+    RGY_TEST_CHECK(g_cl->build(TEST_PROGRAM_SOURCE, test_program_options(0).c_str()) != nullptr);
+    RGY_TEST_CHECK(g_cl->programCacheCount() == (size_t)cacheMax);
+
+    // 上限を超えると、最も長く使われていない1番目が破棄される
+    RGY_TEST_CHECK(g_cl->build(TEST_PROGRAM_SOURCE, test_program_options(cacheMax).c_str()) != nullptr);
+    RGY_TEST_CHECK_MSG(g_cl->programCacheCount() == (size_t)cacheMax, "cached %d", (int)g_cl->programCacheCount());
+    RGY_TEST_CHECK(g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(0)));
+    RGY_TEST_CHECK(!g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(1)));
+    RGY_TEST_CHECK(g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(2)));
+    RGY_TEST_CHECK(g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(cacheMax)));
+
+    // 破棄されたものは再ビルドしてキャッシュに戻り、次に古い2番目が破棄される
+    RGY_TEST_CHECK(g_cl->build(TEST_PROGRAM_SOURCE, test_program_options(1).c_str()) != nullptr);
+    RGY_TEST_CHECK(g_cl->programCacheCount() == (size_t)cacheMax);
+    RGY_TEST_CHECK(g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(1)));
+    RGY_TEST_CHECK(!g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(2)));
+
+    // 無効にした場合は追加されない
+    g_cl->setProgramCache(false);
+    RGY_TEST_CHECK(g_cl->build(TEST_PROGRAM_SOURCE, test_program_options(cacheMax + 1).c_str()) != nullptr);
+    RGY_TEST_CHECK(!g_cl->programCached(TEST_PROGRAM_SOURCE, test_program_options(cacheMax + 1)));
+}
+
+// 返却したフレームは、解像度・色空間・フラグが一致する場合のみ再利用されること
+static void test_frame_cache_reuse() {
+    const cl_mem_flags flags = CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+    const RGYFrameInfo info(128, 64, RGY_CSP_NV12, 8);
+    g_cl->setFrameCache(true);
+
+    auto frame = g_cl->createFrameBuffer(info, flags);
+    RGY_TEST_CHECK(frame && !frame->isempty());
+    if (!frame) return;
+    const auto mem = frame->mem(0);
+    frame->frame.timestamp = 1234;
+    g_cl->returnFrameBuffer(std::move(frame));
+    RGY_TEST_CHECK(g_cl->frameCacheCount() == 1);
+
+    // 解像度、フラグが異なる場合は新たに確保する
+    auto other = g_cl->createFrameBuffer(RGYFrameInfo(64, 64, RGY_CSP_NV12, 8), flags);
+    RGY_TEST_CHECK(other && other->mem(0) != mem);
+    auto otherFlags = g_cl->createFrameBuffer(info, CL_MEM_READ_WRITE);
+    RGY_TEST_CHECK(otherFlags && otherFlags->mem(0) != mem);
+    RGY_TEST_CHECK(g_cl->frameCacheCount() == 1);
+
+    // 一致する場合は返却したバッファを使い、フレームの情報は新しく確保した場合と同じにする
+    auto reused = g_cl->createFrameBuffer(info, flags);
+    RGY_TEST_CHECK(reused && reused->mem(0) == mem);
+    RGY_TEST_CHECK(g_cl->frameCacheCount() == 0);
+    if (reused) {
+        RGY_TEST_CHECK(reused->frame.timestamp == info.timestamp);
+        RGY_TEST_CHECK(reused->frame.mem_type == RGY_MEM_TYPE_GPU);
+        RGY_TEST_CHECK(reused->frame.pitch[0] >= info.width);
+    }
+}
+
+// 返却したフレームはFRAME_CACHE_MAXを上限とし、無効にすると解放されること
+static void test_frame_cache_limit() {
+    const RGYFrameInfo info(64, 32, RGY_CSP_NV12, 8);
+    g_cl->setFrameCache(true);
+    for (size_t i = 0; i < RGYOpenCLContext::FRAME_CACHE_MAX + 4; i++) {
+        g_cl->returnFrameBuffer(g_cl->createFrameBuffer(RGYFrameInfo(64, 32 + 2 * (int)i, RGY_CSP_NV12, 8)));
+    }
+    RGY_TEST_CHECK_MSG(g_cl->frameCacheCount() == RGYOpenCLContext::FRAME_CACHE_MAX, "cached %d", (int)g_cl->frameCacheCount());
+    // 古いものから破棄されている
+    auto oldest = g_cl->createFrameBuffer(info);
+    RGY_TEST_CHECK(g_cl->frameCacheCount() == RGYOpenCLContext::FRAME_CACHE_MAX);
+
+    g_cl->setFrameCache(false);
+    RGY_TEST_CHECK(g_cl->frameCacheCount() == 0);
+    g_cl->returnFrameBuffer(std::move(oldest));
+    RGY_TEST_CHECK(g_cl->frameCacheCount() == 0);
+}
+
+int main(int argc, char **argv) {
+    g_log = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    g_cl = rgy_test_create_cl(g_log);
+    if (!g_cl) {
+        fprintf(stderr, "OpenCL device not found, skip.\n");
+        return RGY_TEST_EXIT_SKIP;
+    }
+    RGY_TEST_RUN(test_program_cache_lru);
+    RGY_TEST_RUN(test_frame_cache_reuse);
+    RGY_TEST_RUN(test_frame_cache_limit);
+    g_cl.reset();
+    return rgy_test_result();
+}
@@ -0,0 +1,326 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include "rgy_test.h"
+#include "rgy_output.h"
+#include "rgy_bitstream.h"
+
+// RGYOutput::OverwriteHEVCAlphaChannelInfoSEI / InsertMetadataのその場での書き換えが、
+// 以前のbitstreamをコピーして組みなおす実装とバイト単位で一致することを確認する
+static const int FUZZ_LOOP = 2000;
+static std::mt19937 g_rnd(1234);
+
+static int rnd_range(int min, int max) {
+    return std::uniform_int_distribution<int>(min, max)(g_rnd);
+}
+
+class TestOutput : public RGYOutput {
+public:
+    TestOutput(RGY_CODEC codec, bool alphaOverwrite, int alphaMode) : RGYOutput() {
+        m_VideoOutputInfo.codec = codec;
+        m_enableHEVCAlphaChannelInfoSEIOverwrite = alphaOverwrite;
+        m_HEVCAlphaChannelMode = alphaMode;
+    }
+    virtual ~TestOutput() {};
+    virtual RGY_ERR WriteNextFrame(RGYBitstream *pBitstream) override { return RGY_ERR_NONE; }
+    virtual RGY_ERR WriteNextFrame(RGYFrame *pSurface) override { return RGY_ERR_NONE; }
+protected:
+    virtual RGY_ERR Init(const TCHAR *strFileName, const VideoInfo *pOutputInfo, const void *prm) override { return RGY_ERR_NONE; }
+};
+
+static void append_random(std::vector<uint8_t>& buf, int size) {
+    for (int i = 0; i < size; i++) {
+        // 0x00を多めにして、emulation prevention byteが入るようにする
+        buf.push_back((rnd_range(0, 3) == 0) ? 0x00 : (uint8_t)rnd_range(0, 255));
+    }
+}
+
+static void append_hevc_nal(std::vector<uint8_t>& bs, const uint8_t type, const int layer, const std::vector<uint8_t>& rbsp) {
+    std::vector<uint8_t> nal;
+    nal.push_back((uint8_t)((type << 1) | (layer >> 5)));
+    nal.push_back((uint8_t)(((layer & 0x1f) << 3) | 1));
+    nal.insert(nal.end(), rbsp.begin(), rbsp.end());
+    to_nal(nal, 2);
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    const int startCodeSize = rnd_range(3, 4);
+    bs.insert(bs.end(), start_code + 4 - startCodeSize, start_code + 4);
+    bs.insert(bs.end(), nal.begin(), nal.end());
+}
+
+static std::vector<uint8_t> gen_sei_rbsp(const uint8_t seiType, const int payloadSize) {
+    std::vector<uint8_t> rbsp = { seiType, (uint8_t)payloadSize };
+    append_random(rbsp, payloadSize);
+    rbsp.push_back(0x80);
+    return rbsp;
+}
+
+static std::vector<uint8_t> gen_random_rbsp(const int size) {
+    std::vector<uint8_t> rbsp;
+    append_random(rbsp, size);
+    rbsp.push_back(0x80);
+    return rbsp;
+}
+
+// alpha_channel_infoのSEIを含む/含まないHEVCのパケットを生成する
+static std::vector<uint8_t> gen_hevc_packet(bool withHeader, int alphaSEI) {
+    std::vector<uint8_t> bs;
+    if (rnd_range(0, 1)) {
+        append_hevc_nal(bs, NALU_HEVC_AUD, 0, { 0x50 });
+    }
+    if (withHeader) {
+        append_hevc_nal(bs, NALU_HEVC_VPS, 0, gen_random_rbsp(rnd_range(8, 30)));
+        append_hevc_nal(bs, NALU_HEVC_SPS, 0, gen_random_rbsp(rnd_range(8, 60)));
+        append_hevc_nal(bs, NALU_HEVC_PPS, 0, gen_random_rbsp(rnd_range(4, 20)));
+    }
+    for (int i = 0; i < alphaSEI; i++) {
+        switch (rnd_range(0, 4)) {
+        case 0: append_hevc_nal(bs, NALU_HEVC_PREFIX_SEI, 0, gen_sei_rbsp(USER_DATA_UNREGISTERED, rnd_range(16, 40))); break;
+        case 1: append_hevc_nal(bs, NALU_HEVC_PREFIX_SEI, 1, gen_sei_rbsp(ALPHA_CHANNEL_INFO, 4)); break; // layer 1は対象外
+        default: append_hevc_nal(bs, NALU_HEVC_PREFIX_SEI, 0, gen_sei_rbsp(ALPHA_CHANNEL_INFO, rnd_range(1, 12))); break;
+        }
+    }
+    const int slices = rnd_range(1, 3);
+    for (int i = 0; i < slices; i++) {
+        append_hevc_nal(bs, (uint8_t)rnd_range(0, 21), rnd_range(0, 1), gen_random_rbsp(rnd_range(1, 300)));
+    }
+    if (rnd_range(0, 3) == 0) {
+        append_hevc_nal(bs, NALU_HEVC_SUFFIX_SEI, 0, gen_sei_rbsp(ALPHA_CHANNEL_INFO, 4)); // suffixは対象外
+    }
+    return bs;
+}
+
+// 以前の実装: bitstreamをコピーし、nal単位に分解して組みなおす
+static std::vector<uint8_t> overwrite_alpha_sei_ref(const std::vector<uint8_t>& bs, const int mode) {
+    const auto nal_list = parse_nal_unit_hevc_c(bs.data(), bs.size());
+    const bool has_prefix_sei = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.nuh_layer_id == 0 && info.type == NALU_HEVC_PREFIX_SEI; }) != nal_list.end();
+    if (!has_prefix_sei) {
+        return bs;
+    }
+    std::vector<uint8_t> out;
+    for (const auto& nal : nal_list) {
+        if (nal.nuh_layer_id == 0 && nal.type == NALU_HEVC_PREFIX_SEI) {
+            auto ptr = nal.ptr;
+            int nal_header_size = 0;
+            static const uint8_t nal_header[4] = { 0x00, 0x00, 0x00, 0x01 };
+            if (memcmp(ptr, nal_header, 4) == 0) {
+                nal_header_size += 4;
+            } else if (memcmp(ptr, nal_header + 1, 3) == 0) {
+                nal_header_size += 3;
+            }
+            nal_header_size += 2;
+            ptr += nal_header_size;
+            const auto sei_data = unnal(ptr, nal.size - nal_header_size);
+            if (sei_data.size() > 0 && sei_data[0] == ALPHA_CHANNEL_INFO) {
+                const auto nalbuf = gen_hevc_alpha_channel_info_sei(mode);
+                out.insert(out.end(), nalbuf.begin(), nalbuf.end());
+                continue;
+            }
+        }
+        out.insert(out.end(), nal.ptr, nal.ptr + nal.size);
+    }
+    return out;
+}
+
+// bufferの先頭にoffsetを付け、必要に応じてbufferを余らせた状態のbitstreamを作る
+static RGYBitstream make_bitstream(const std::vector<uint8_t>& data, size_t offset, size_t extra) {
+    RGYBitstream bitstream = RGYBitstreamInit();
+    bitstream.init(offset + data.size() + extra);
+    memcpy(bitstream.bufptr() + offset, data.data(), data.size());
+    bitstream.setOffset(offset);
+    bitstream.setSize(data.size());
+    return bitstream;
+}
+
+static bool bitstream_equal(const RGYBitstream& bitstream, const std::vector<uint8_t>& expected) {
+    return bitstream.size() == expected.size() && memcmp(bitstream.data(), expected.data(), expected.size()) == 0;
+}
+
+static void test_alpha_sei_overwrite() {
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int mode = rnd_range(0, 7);
+        const auto packet = gen_hevc_packet(rnd_range(0, 1) != 0, rnd_range(0, 3));
+        const auto expected = overwrite_alpha_sei_ref(packet, mode);
+        const size_t offset = (size_t)rnd_range(0, 1) * rnd_range(1, 64);
+        const size_t extra = (size_t)rnd_range(0, 1) * rnd_range(1, 64);
+        auto bitstream = make_bitstream(packet, offset, extra);
+        const uint8_t *bufBefore = bitstream.bufptr();
+        TestOutput output(RGY_CODEC_HEVC, true, mode);
+        RGY_TEST_CHECK(output.OverwriteHEVCAlphaChannelInfoSEI(&bitstream) == RGY_ERR_NONE);
+        RGY_TEST_CHECK_MSG(bitstream_equal(bitstream, expected), "loop %d: size %d, expected %d", i, (int)bitstream.size(), (int)expected.size());
+        if (expected == packet) {
+            // 書き換えのないパケットではbufferを再確保しない
+            RGY_TEST_CHECK(bitstream.bufptr() == bufBefore && bitstream.offset() == offset);
+        }
+        bitstream.clear();
+    }
+}
+
+// 無効時やHEVC以外では何もしない
+static void test_alpha_sei_disabled() {
+    const auto packet = gen_hevc_packet(true, 2);
+    for (const auto& prm : { std::make_pair(RGY_CODEC_HEVC, false), std::make_pair(RGY_CODEC_AV1, true) }) {
+        auto bitstream = make_bitstream(packet, 0, 0);
+        TestOutput output(prm.first, prm.second, 1);
+        RGY_TEST_CHECK(output.OverwriteHEVCAlphaChannelInfoSEI(&bitstream) == RGY_ERR_NONE);
+        RGY_TEST_CHECK(bitstream_equal(bitstream, packet));
+        bitstream.clear();
+    }
+}
+
+struct TestMetadata {
+    std::vector<uint8_t> data;
+    bool onSequenceHeader;
+    bool appendix;
+};
+
+static std::vector<TestMetadata> gen_metadata_list(RGY_CODEC codec) {
+    std::vector<TestMetadata> list;
+    const int count = rnd_range(1, 3);
+    for (int i = 0; i < count; i++) {
+        TestMetadata metadata;
+        if (codec == RGY_CODEC_HEVC) {
+            append_hevc_nal(metadata.data, NALU_HEVC_PREFIX_SEI, 0, gen_sei_rbsp(USER_DATA_REGISTERED_ITU_T_T35, rnd_range(8, 64)));
+        } else {
+            std::vector<uint8_t> payload;
+            append_random(payload, rnd_range(8, 64));
+            metadata.data = gen_av1_obu_metadata(AV1_METADATA_TYPE_ITUT_T35, payload);
+        }
+        metadata.appendix = rnd_range(0, 3) == 0;
+        metadata.onSequenceHeader = !metadata.appendix && rnd_range(0, 2) == 0;
+        list.push_back(metadata);
+    }
+    return list;
+}
+
+static void append_av1_obu(std::vector<uint8_t>& bs, const uint8_t type, const int payloadSize) {
+    bs.push_back(gen_obu_header(type));
+    const auto size = get_av1_uleb_size_data(payloadSize);
+    bs.insert(bs.end(), size.begin(), size.end());
+    append_random(bs, payloadSize);
+}
+
+static std::vector<uint8_t> gen_av1_packet(bool withTD, bool withSeqHeader) {
+    std::vector<uint8_t> bs;
+    if (withTD) {
+        append_av1_obu(bs, OBU_TEMPORAL_DELIMITER, 0);
+    }
+    if (withSeqHeader) {
+        append_av1_obu(bs, OBU_SEQUENCE_HEADER, rnd_range(8, 20));
+    }
+    const int frames = rnd_range(1, 2);
+    for (int i = 0; i < frames; i++) {
+        append_av1_obu(bs, OBU_FRAME, rnd_range(1, 400));
+    }
+    return bs;
+}
+
+// 以前の実装: bitstreamを分解して組みなおす
+static std::vector<uint8_t> insert_metadata_ref(RGY_CODEC codec, const std::vector<uint8_t>& bs, std::vector<TestMetadata> metadataList) {
+    std::vector<bool> written(metadataList.size(), false);
+    std::vector<uint8_t> out;
+    auto write_metadata = [&](bool appendix) {
+        for (size_t i = 0; i < metadataList.size(); i++) {
+            if (!written[i] && metadataList[i].appendix == appendix) {
+                out.insert(out.end(), metadataList[i].data.begin(), metadataList[i].data.end());
+                written[i] = true;
+            }
+        }
+    };
+    if (codec == RGY_CODEC_HEVC) {
+        const auto nal_list = parse_nal_unit_hevc_c(bs.data(), bs.size());
+        auto isHeader = [](const nal_info& nal) { return nal.type == NALU_HEVC_VPS || nal.type == NALU_HEVC_SPS || nal.type == NALU_HEVC_PPS; };
+        const bool header_check = std::find_if(nal_list.begin(), nal_list.end(), isHeader) != nal_list.end();
+        for (size_t i = 0; i < metadataList.size(); i++) {
+            if (metadataList[i].onSequenceHeader && !header_check) written[i] = true;
+        }
+        if (!header_check) {
+            write_metadata(false);
+        }
+        for (size_t i = 0; i < nal_list.size(); i++) {
+            out.insert(out.end(), nal_list[i].ptr, nal_list[i].ptr + nal_list[i].size);
+            if (isHeader(nal_list[i]) && i + 1 < nal_list.size() && !isHeader(nal_list[i + 1])) {
+                write_metadata(false);
+            }
+        }
+    } else {
+        const auto units = parse_unit_av1(bs.data(), bs.size());
+        auto isHeader = [](const std::unique_ptr<unit_info>& unit) { return unit->type == OBU_TEMPORAL_DELIMITER || unit->type == OBU_SEQUENCE_HEADER; };
+        const bool has_seq_header = std::find_if(units.begin(), units.end(), [](const std::unique_ptr<unit_info>& unit) { return unit->type == OBU_SEQUENCE_HEADER; }) != units.end();
+        const bool has_header = std::find_if(units.begin(), units.end(), isHeader) != units.end();
+        for (size_t i = 0; i < metadataList.size(); i++) {
+            if (metadataList[i].onSequenceHeader && !has_seq_header) written[i] = true;
+        }
+        if (!has_header) {
+            write_metadata(false);
+        }
+        for (size_t i = 0; i < units.size(); i++) {
+            out.insert(out.end(), units[i]->unit_data.begin(), units[i]->unit_data.end());
+            if (isHeader(units[i]) && i + 1 < units.size() && !isHeader(units[i + 1])) {
+                write_metadata(false);
+            }
+        }
+    }
+    write_metadata(true);
+    return out;
+}
+
+static void test_insert_metadata() {
+    for (const auto codec : { RGY_CODEC_HEVC, RGY_CODEC_AV1 }) {
+        for (int i = 0; i < FUZZ_LOOP; i++) {
+            const auto packet = (codec == RGY_CODEC_HEVC)
+                ? gen_hevc_packet(rnd_range(0, 1) != 0, rnd_range(0, 1))
+                : gen_av1_packet(rnd_range(0, 3) != 0, rnd_range(0, 1) != 0);
+            const auto metadata = gen_metadata_list(codec);
+            const auto expected = insert_metadata_ref(codec, packet, metadata);
+            std::vector<RGYOutputInsertMetadata> metadataList;
+            for (const auto& m : metadata) {
+                metadataList.push_back(RGYOutputInsertMetadata(m.data.data(), m.data.size(), m.onSequenceHeader, m.appendix));
+            }
+            const size_t offset = (size_t)rnd_range(0, 1) * rnd_range(1, 64);
+            const size_t extra = (size_t)rnd_range(0, 2) * rnd_range(1, 256);
+            auto bitstream = make_bitstream(packet, offset, extra);
+            TestOutput output(codec, false, 0);
+            RGY_TEST_CHECK(output.InsertMetadata(&bitstream, metadataList) == RGY_ERR_NONE);
+            RGY_TEST_CHECK_MSG(bitstream_equal(bitstream, expected), "%s loop %d: size %d, expected %d",
+                tchar_to_string(CodecToStr(codec)).c_str(), i, (int)bitstream.size(), (int)expected.size());
+            bitstream.clear();
+        }
+    }
+}
+
+int main() {
+    RGY_TEST_RUN(test_alpha_sei_overwrite);
+    RGY_TEST_RUN(test_alpha_sei_disabled);
+    RGY_TEST_RUN(test_insert_metadata);
+    return rgy_test_result();
+}
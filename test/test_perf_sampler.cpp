@@ -0,0 +1,211 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+#include "rgy_test.h"
+#include "rgy_perf_monitor.h"
+
+#if !(defined(_WIN32) || defined(_WIN64))
+
+// 偽のprocfs/sysfsを一時ディレクトリに作成する
+class FakeProcRoot {
+public:
+    FakeProcRoot() : m_root() {
+        char path[] = "/tmp/rkmppenc_test_procfsXXXXXX";
+        if (mkdtemp(path) != nullptr) {
+            m_root = path;
+        }
+    }
+    ~FakeProcRoot() {
+        if (!m_root.empty()) {
+            std::error_code ec;
+            std::filesystem::remove_all(m_root, ec);
+        }
+    }
+    bool valid() const { return !m_root.empty(); }
+    std::string proc() const { return m_root + "/proc/self"; }
+    std::string sys() const { return m_root + "/sys"; }
+    // 同じinodeのまま中身を書き換える (開いたままのfdから新しい内容が読めること)
+    void write(const std::string& relpath, const std::string& data) {
+        const auto path = std::filesystem::path(m_root) / relpath;
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        ofs << data;
+    }
+protected:
+    std::string m_root;
+};
+
+static std::string statLine(const char *comm, long long utime, long long stime) {
+    // pid (comm) state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime ...
+    return strsprintf("1234 (%s) R 1 1234 1234 0 -1 4194304 100 0 0 0 %lld %lld 0 0 20 0 4 0 100 0 0\n", comm, utime, stime);
+}
+
+static int64_t ticksToUs(long long ticks) {
+    const auto clockTick = sysconf(_SC_CLK_TCK);
+    return ticks * 1000000 / ((clockTick > 0) ? clockTick : 100);
+}
+
+// procfsがなければinitは失敗すること
+static void test_missing_root() {
+    FakeProcRoot root;
+    RGY_TEST_CHECK(root.valid());
+    RGYPerfSamplerLinux sampler(root.proc(), root.sys());
+    RGY_TEST_CHECK(sampler.init() != 0);
+    RGY_TEST_CHECK(!sampler.hasGPU() && !sampler.hasVEE() && !sampler.hasVED() && !sampler.hasRGA());
+}
+
+// stat/status/ioを解析し、ファイルを開き直さずに更新後の値を読めること
+static void test_process() {
+    FakeProcRoot root;
+    root.write("proc/self/stat", statLine("rkmppenc", 250, 50));
+    // 4096byteを超えるstatusも最後まで読めること
+    root.write("proc/self/status", "Name:\trkmppenc\n" + std::string(8000, '#') + "\nVmSize:\t  204800 kB\nVmRSS:\t   51200 kB\n");
+    root.write("proc/self/io", "rchar: 1000\nwchar: 2000\nsyscr: 10\nsyscw: 20\n");
+    RGYPerfSamplerLinux sampler(root.proc(), root.sys());
+    RGY_TEST_CHECK(sampler.init() == 0);
+
+    RGYPerfSampleProcess sample = { 0 };
+    RGY_TEST_CHECK(sampler.readProcess(&sample));
+    RGY_TEST_CHECK(sample.cpu_user_us == ticksToUs(250));
+    RGY_TEST_CHECK(sample.cpu_kernel_us == ticksToUs(50));
+    RGY_TEST_CHECK(sample.mem_virtual == 204800LL << 10);
+    RGY_TEST_CHECK(sample.mem_private == 51200LL << 10);
+    RGY_TEST_CHECK(sample.io_total_read == 1000);
+    RGY_TEST_CHECK(sample.io_total_write == 2000);
+
+    // commに空白や')'が含まれていても正しく解析できること
+    root.write("proc/self/stat", statLine("a) b (c", 300, 75));
+    root.write("proc/self/io", "rchar: 5000\nwchar: 6000\n");
+    RGY_TEST_CHECK(sampler.readProcess(&sample));
+    RGY_TEST_CHECK(sample.cpu_user_us == ticksToUs(300));
+    RGY_TEST_CHECK(sample.cpu_kernel_us == ticksToUs(75));
+    RGY_TEST_CHECK(sample.io_total_read == 5000);
+    RGY_TEST_CHECK(sample.io_total_write == 6000);
+
+    // 読めない項目は前回の値を残すこと
+    root.write("proc/self/stat", "garbage");
+    RGY_TEST_CHECK(!sampler.readProcess(&sample));
+    RGY_TEST_CHECK(sample.cpu_user_us == ticksToUs(300));
+}
+
+// スレッドのCPU時間を取得し、存在しないスレッド/終了したスレッドは-1を返すこと
+static void test_thread() {
+    FakeProcRoot root;
+    root.write("proc/self/stat", statLine("rkmppenc", 0, 0));
+    root.write("proc/self/task/101/stat", statLine("input", 30, 10));
+    RGYPerfSamplerLinux sampler(root.proc(), root.sys());
+    RGY_TEST_CHECK(sampler.init() == 0);
+
+    RGY_TEST_CHECK(sampler.readThread(101) == ticksToUs(40));
+    RGY_TEST_CHECK(sampler.readThread(0) == -1);
+    RGY_TEST_CHECK(sampler.readThread(102) == -1);
+
+    root.write("proc/self/task/101/stat", statLine("input", 60, 20));
+    RGY_TEST_CHECK(sampler.readThread(101) == ticksToUs(80));
+
+    // スレッドが終了すると中身が読めなくなる
+    root.write("proc/self/task/101/stat", "");
+    RGY_TEST_CHECK(sampler.readThread(101) == -1);
+    // 同じtidのスレッドが作られた場合は開き直して読めること
+    root.write("proc/self/task/101/stat", statLine("input", 5, 5));
+    RGY_TEST_CHECK(sampler.readThread(101) == ticksToUs(10));
+}
+
+// devfreq/debugfsからGPU/VPU/RGAの使用率とクロックを取得すること
+static void test_engine() {
+    FakeProcRoot root;
+    root.write("proc/self/stat", statLine("rkmppenc", 0, 0));
+    root.write("sys/class/devfreq/fb000000.gpu/load", "45@800000000Hz\n");
+    root.write("sys/class/devfreq/fb000000.gpu/cur_freq", "800000000\n");
+    root.write("sys/class/devfreq/fdb50000.vepu/load", "70@600000000Hz\n");
+    root.write("sys/class/devfreq/fdc38100.rkvdec/load", "20@400000000Hz\n");
+    root.write("sys/class/devfreq/dmc/load", "99@2112000000Hz\n"); // 対象外
+    root.write("sys/kernel/debug/rkrga/load", "num of scheduler = 2\n"
+        "scheduler[0]: rga3_core0\n\t load = 34%\n"
+        "scheduler[1]: rga2\n\t load = 12%\n");
+    RGYPerfSamplerLinux sampler(root.proc(), root.sys());
+    RGY_TEST_CHECK(sampler.init() == 0);
+    RGY_TEST_CHECK(sampler.hasGPU() && sampler.hasVEE() && sampler.hasVED() && sampler.hasRGA());
+
+    RGYPerfSampleEngine sample;
+    RGY_TEST_CHECK(sampler.readEngine(&sample));
+    RGY_TEST_CHECK(sample.gpu_valid && sample.gpu_load_percent == 45.0 && sample.gpu_clock == 800.0);
+    RGY_TEST_CHECK(sample.vee_valid && sample.vee_load_percent == 70.0);
+    RGY_TEST_CHECK(sample.ved_valid && sample.ved_load_percent == 20.0);
+    RGY_TEST_CHECK(sample.ve_clock == 600.0);
+    RGY_TEST_CHECK(sample.rga_valid && sample.rga_load_percent == 34.0);
+
+    root.write("sys/class/devfreq/fb000000.gpu/load", "90@1000000000Hz\n");
+    root.write("sys/class/devfreq/fb000000.gpu/cur_freq", "1000000000\n");
+    root.write("sys/kernel/debug/rkrga/load", "scheduler[0]: rga3_core0\n\t load = 5%\n");
+    RGY_TEST_CHECK(sampler.readEngine(&sample));
+    RGY_TEST_CHECK(sample.gpu_load_percent == 90.0 && sample.gpu_clock == 1000.0);
+    RGY_TEST_CHECK(sample.rga_load_percent == 5.0);
+}
+
+// エンジンの情報がなければ、無効として扱うこと
+static void test_engine_absent() {
+    FakeProcRoot root;
+    root.write("proc/self/stat", statLine("rkmppenc", 0, 0));
+    RGYPerfSamplerLinux sampler(root.proc(), root.sys());
+    RGY_TEST_CHECK(sampler.init() == 0);
+    RGY_TEST_CHECK(!sampler.hasGPU() && !sampler.hasVEE() && !sampler.hasVED() && !sampler.hasRGA());
+    RGYPerfSampleEngine sample;
+    sampler.readEngine(&sample);
+    RGY_TEST_CHECK(!sample.gpu_valid && !sample.vee_valid && !sample.ved_valid && !sample.rga_valid);
+}
+
+static void test_monotonic() {
+    const auto t0 = RGYPerfSamplerLinux::monotonicTimeUs();
+    usleep(20 * 1000);
+    const auto t1 = RGYPerfSamplerLinux::monotonicTimeUs();
+    RGY_TEST_CHECK(t1 - t0 >= 20 * 1000);
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_missing_root);
+    RGY_TEST_RUN(test_process);
+    RGY_TEST_RUN(test_thread);
+    RGY_TEST_RUN(test_engine);
+    RGY_TEST_RUN(test_engine_absent);
+    RGY_TEST_RUN(test_monotonic);
+    return rgy_test_result();
+}
+
+#else
+int main(int argc, char **argv) {
+    fprintf(stderr, "procfs sampler is only available on Linux.\n");
+    return RGY_TEST_EXIT_SKIP;
+}
+#endif
@@ -0,0 +1,132 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "rgy_test.h"
+#include "rgy_test_cl.h"
+#include "rgy_filter_resize.h"
+
+static std::shared_ptr<RGYLog> g_log;
+static std::shared_ptr<RGYOpenCLContext> g_cl;
+
+static RGY_ERR runResize(const RGY_VPP_RESIZE_ALGO algo, const RGY_VPP_RESIZE_MODE mode, const RGYTestHostFrame& input, RGYTestHostFrame& output, bool& separable) {
+    auto cl = g_cl;
+    auto inFrame = cl->createFrameBuffer(input.info()->width, input.info()->height, input.info()->csp, RGY_CSP_BIT_DEPTH[input.info()->csp]);
+    if (!inFrame) {
+        return RGY_ERR_MEMORY_ALLOC;
+    }
+    auto err = rgy_test_upload(cl.get(), inFrame.get(), input);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    auto param = std::make_shared<RGYFilterParamResize>();
+    param->interp = algo;
+    param->mode = mode;
+    param->frameIn = inFrame->frame;
+    param->frameOut = inFrame->frame;
+    param->frameOut.width = output.info()->width;
+    param->frameOut.height = output.info()->height;
+    param->baseFps = rgy_rational<int>(30, 1);
+    param->bOutOverwrite = false;
+    RGYFilterResize resize(cl);
+    err = resize.init(param, g_log);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    separable = resize.GetInputMessage().find(_T("separable")) != tstring::npos;
+    RGYFrameInfo *outFrames[1] = { nullptr };
+    int outNum = 0;
+    err = resize.filter(&inFrame->frame, outFrames, &outNum);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    if (outNum != 1 || outFrames[0] == nullptr) {
+        return RGY_ERR_UNKNOWN;
+    }
+    return rgy_test_download(cl.get(), output, outFrames[0]);
+}
+
+// 分離型(2パス)のリサイズと、従来の2Dで重みを計算するkernel_resizeの結果を比較する
+static void test_resize_separable() {
+    const RGY_VPP_RESIZE_ALGO algoList[] = {
+        RGY_VPP_RESIZE_BICUBIC,
+        RGY_VPP_RESIZE_SPLINE16, RGY_VPP_RESIZE_SPLINE36, RGY_VPP_RESIZE_SPLINE64,
+        RGY_VPP_RESIZE_LANCZOS2, RGY_VPP_RESIZE_LANCZOS3, RGY_VPP_RESIZE_LANCZOS4
+    };
+    struct ResizeSize {
+        int srcWidth, srcHeight, dstWidth, dstHeight;
+    };
+    const ResizeSize sizeList[] = {
+        { 320, 180, 640, 360 }, // 拡大
+        { 640, 360, 320, 180 }, // 縮小
+        { 500, 300, 334, 212 }, // 縮小 (半端な比率)
+        { 256, 144, 400, 320 }, // 縦横で異なる比率
+    };
+    for (const auto csp : { RGY_CSP_YV12, RGY_CSP_YV12_16 }) {
+        // 丸めの差のみを許容する
+        const int tolerance = (RGY_CSP_DATA_TYPE[csp] == RGY_DATA_TYPE_U16) ? 2 : 1;
+        for (const auto& size : sizeList) {
+            RGYTestHostFrame input(size.srcWidth, size.srcHeight, csp);
+            input.fillPattern(size.srcWidth * 3 + size.dstWidth);
+            for (const auto algo : algoList) {
+                RGYTestHostFrame out2d(size.dstWidth, size.dstHeight, csp);
+                RGYTestHostFrame outSep(size.dstWidth, size.dstHeight, csp);
+                bool separable2d = true, separable = false;
+                RGY_TEST_CHECK(runResize(algo, RGY_VPP_RESIZE_MODE_CL_2D, input, out2d, separable2d) == RGY_ERR_NONE);
+                RGY_TEST_CHECK(runResize(algo, RGY_VPP_RESIZE_MODE_DEFAULT, input, outSep, separable) == RGY_ERR_NONE);
+                RGY_TEST_CHECK(!separable2d);
+                RGY_TEST_CHECK(separable);
+                for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+                    const auto plane = getPlane(out2d.info(), (RGY_PLANE)i);
+                    int maxDiff = 0;
+                    for (int y = 0; y < plane.height; y++) {
+                        for (int x = 0; x < plane.width; x++) {
+                            maxDiff = std::max(maxDiff, std::abs(out2d.pix(i, x, y) - outSep.pix(i, x, y)));
+                        }
+                    }
+                    RGY_TEST_CHECK_MSG(maxDiff <= tolerance, "%s %s %dx%d -> %dx%d plane %d: max diff %d",
+                        tchar_to_string(RGY_CSP_NAMES[csp]).c_str(), tchar_to_string(get_chr_from_value(list_vpp_resize, algo)).c_str(),
+                        size.srcWidth, size.srcHeight, size.dstWidth, size.dstHeight, i, maxDiff);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    g_log = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    g_cl = rgy_test_create_cl(g_log);
+    if (!g_cl) {
+        fprintf(stderr, "OpenCL device not found, skip.\n");
+        return RGY_TEST_EXIT_SKIP;
+    }
+    RGY_TEST_RUN(test_resize_separable);
+    g_cl.reset();
+    return rgy_test_result();
+}
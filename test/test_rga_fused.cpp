@@ -0,0 +1,323 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include "rgy_test.h"
+#include "mpp_filter.h"
+#include "rgy_filter_cl.h"
+#include "rgy_filter_resize.h"
+
+// RGAを使用せず、投入された処理を記録するモック
+// NV12同士の場合は、最近傍補間でcrop + resizeを実際に行う
+class RGABackendMock : public RGABackend {
+public:
+    struct Call {
+        rga_buffer_t src, dst;
+        im_rect srect, drect;
+        int acquireFence;
+        int interp;
+        int usage;
+    };
+    std::vector<Call> calls;
+    int checks;
+    int nextFence;
+
+    RGABackendMock() : calls(), checks(0), nextFence(100) {};
+    virtual ~RGABackendMock() {};
+
+    virtual IM_STATUS check(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect) override {
+        checks++;
+        if (srect.x < 0 || srect.y < 0 || srect.width <= 0 || srect.height <= 0
+            || srect.x + srect.width > src.width || srect.y + srect.height > src.height
+            || drect.x < 0 || drect.y < 0 || drect.width <= 0 || drect.height <= 0
+            || drect.x + drect.width > dst.width || drect.y + drect.height > dst.height) {
+            return IM_STATUS_INVALID_PARAM;
+        }
+        return IM_STATUS_NOERROR;
+    }
+    virtual IM_STATUS process(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect,
+        int acquire_fence_fd, int *release_fence_fd, im_opt_t *opt, int usage) override {
+        calls.push_back(Call{ src, dst, srect, drect, acquire_fence_fd, (opt) ? opt->interp : -1, usage });
+        if (src.format == RK_FORMAT_YCbCr_420_SP && dst.format == RK_FORMAT_YCbCr_420_SP && src.vir_addr && dst.vir_addr) {
+            run_nv12(src, dst, srect, drect);
+        }
+        if (usage & IM_ASYNC) {
+            *release_fence_fd = nextFence++;
+        }
+        return IM_STATUS_SUCCESS;
+    }
+private:
+    static void run_plane(const uint8_t *srcPtr, const int srcPitch, uint8_t *dstPtr, const int dstPitch, const int bytesPerPix,
+        const int sx, const int sy, const int sw, const int sh, const int dx, const int dy, const int dw, const int dh) {
+        for (int y = 0; y < dh; y++) {
+            const int iy = sy + (int)((int64_t)y * sh / dh);
+            for (int x = 0; x < dw; x++) {
+                const int ix = sx + (int)((int64_t)x * sw / dw);
+                memcpy(dstPtr + (dy + y) * dstPitch + (dx + x) * bytesPerPix, srcPtr + iy * srcPitch + ix * bytesPerPix, bytesPerPix);
+            }
+        }
+    }
+    static void run_nv12(const rga_buffer_t& src, const rga_buffer_t& dst, const im_rect& srect, const im_rect& drect) {
+        const uint8_t *srcY = (const uint8_t *)src.vir_addr;
+        uint8_t *dstY = (uint8_t *)dst.vir_addr;
+        run_plane(srcY, src.wstride, dstY, dst.wstride, 1,
+            srect.x, srect.y, srect.width, srect.height, drect.x, drect.y, drect.width, drect.height);
+        run_plane(srcY + src.wstride * src.hstride, src.wstride, dstY + dst.wstride * dst.hstride, dst.wstride, 2,
+            srect.x / 2, srect.y / 2, srect.width / 2, srect.height / 2, drect.x / 2, drect.y / 2, drect.width / 2, drect.height / 2);
+    }
+};
+
+static RGYFrameInfo testFrameInfo(const int width, const int height, const RGY_CSP csp) {
+    return RGYFrameInfo(width, height, csp, 8, RGY_PICSTRUCT_FRAME, RGY_MEM_TYPE_MPP);
+}
+
+static std::shared_ptr<RGYFilterParamCrop> testCrop(const RGYFrameInfo& in, const int left, const int up, const int right, const int bottom) {
+    auto prm = std::make_shared<RGYFilterParamCrop>();
+    prm->frameIn = in;
+    prm->frameOut = testFrameInfo(in.width - left - right, in.height - up - bottom, in.csp);
+    prm->crop.e.left = left;
+    prm->crop.e.up = up;
+    prm->crop.e.right = right;
+    prm->crop.e.bottom = bottom;
+    return prm;
+}
+
+static std::shared_ptr<RGYFilterParamCrop> testCspConv(const RGYFrameInfo& in, const RGY_CSP cspOut, const CspMatrix matrix) {
+    auto prm = std::make_shared<RGYFilterParamCrop>();
+    prm->frameIn = in;
+    prm->frameOut = testFrameInfo(in.width, in.height, cspOut);
+    prm->matrix = matrix;
+    return prm;
+}
+
+static std::shared_ptr<RGYFilterParamResize> testResize(const RGYFrameInfo& in, const int width, const int height, const RGY_VPP_RESIZE_ALGO interp) {
+    auto prm = std::make_shared<RGYFilterParamResize>();
+    prm->frameIn = in;
+    prm->frameOut = testFrameInfo(width, height, in.csp);
+    prm->interp = interp;
+    return prm;
+}
+
+// ホストメモリ上のNV12フレーム
+struct TestNV12 {
+    int width, height, pitch, vstride;
+    std::vector<uint8_t> buf;
+
+    TestNV12(int w, int h) : width(w), height(h), pitch((w + 15) & ~15), vstride((h + 15) & ~15), buf(pitch * vstride * 3 / 2, 0) {};
+    rga_buffer_t rga() {
+        rga_buffer_t b;
+        memset(&b, 0, sizeof(b));
+        b.vir_addr = buf.data();
+        b.width = width;
+        b.height = height;
+        b.wstride = pitch;
+        b.hstride = vstride;
+        b.format = RK_FORMAT_YCbCr_420_SP;
+        return b;
+    }
+    void fill(uint32_t seed) {
+        for (auto& v : buf) {
+            seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+            v = (uint8_t)seed;
+        }
+    }
+    bool equal(const TestNV12& other) const {
+        for (int y = 0; y < height * 3 / 2; y++) {
+            const int offset = (y < height) ? y * pitch : (vstride + y - height) * pitch;
+            if (memcmp(buf.data() + offset, other.buf.data() + offset, width) != 0) return false;
+        }
+        return true;
+    }
+};
+
+// crop -> cspconv -> resize が1回の処理にまとめられること
+static void test_plan_fuse() {
+    const auto in = testFrameInfo(1920, 1080, RGY_CSP_NV12);
+    auto crop = testCrop(in, 8, 4, 8, 4);
+    auto csp = testCspConv(crop->frameOut, RGY_CSP_RGB24, RGY_MATRIX_ST170_M);
+    auto resize = testResize(csp->frameOut, 1280, 720, RGY_VPP_RESIZE_AUTO);
+    RGAFusedJob job;
+    tstring reason;
+    RGY_TEST_CHECK(rga_fused_plan(job, { crop, csp, resize }, reason) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(job.stageCount == 3);
+    RGY_TEST_CHECK(job.frameIn.width == 1920 && job.frameIn.csp == RGY_CSP_NV12);
+    RGY_TEST_CHECK(job.frameOut.width == 1280 && job.frameOut.height == 720 && job.frameOut.csp == RGY_CSP_RGB24);
+    RGY_TEST_CHECK(job.crop.e.left == 8 && job.crop.e.up == 4 && job.crop.e.right == 8 && job.crop.e.bottom == 4);
+    RGY_TEST_CHECK(job.cvtMode == IM_YUV_TO_RGB_BT601_LIMIT);
+    RGY_TEST_CHECK(job.resize && job.interp == RGY_VPP_RESIZE_RGA_BICUBIC);
+
+    // cspconvのみ + resize
+    auto csp709 = testCspConv(in, RGY_CSP_RGB24, RGY_MATRIX_BT709);
+    auto resize2 = testResize(csp709->frameOut, 960, 540, RGY_VPP_RESIZE_RGA_NEAREST);
+    RGY_TEST_CHECK(rga_fused_plan(job, { csp709, resize2 }, reason) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(!cropEnabled(job.crop) && job.cvtMode == IM_YUV_TO_RGB_BT709_LIMIT && job.interp == RGY_VPP_RESIZE_RGA_NEAREST);
+}
+
+// まとめられない組み合わせは、個別のフィルタのまま処理されること
+static void test_plan_reject() {
+    const auto in = testFrameInfo(1920, 1080, RGY_CSP_NV12);
+    RGAFusedJob job;
+    tstring reason;
+    auto crop = testCrop(in, 8, 4, 8, 4);
+    RGY_TEST_CHECK(rga_fused_plan(job, { crop }, reason) != RGY_ERR_NONE);
+
+    auto resize1 = testResize(in, 1280, 720, RGY_VPP_RESIZE_AUTO);
+    auto resize2 = testResize(resize1->frameOut, 640, 360, RGY_VPP_RESIZE_AUTO);
+    RGY_TEST_CHECK(rga_fused_plan(job, { resize1, resize2 }, reason) != RGY_ERR_NONE);
+
+    auto cropAfter = testCrop(resize1->frameOut, 16, 16, 16, 16);
+    RGY_TEST_CHECK(rga_fused_plan(job, { resize1, cropAfter }, reason) != RGY_ERR_NONE);
+
+    auto crop2 = testCrop(crop->frameOut, 2, 2, 2, 2);
+    RGY_TEST_CHECK(rga_fused_plan(job, { crop, crop2 }, reason) != RGY_ERR_NONE);
+
+    auto cropOdd = testCrop(in, 1, 0, 1, 0);
+    auto resizeOdd = testResize(cropOdd->frameOut, 1280, 720, RGY_VPP_RESIZE_AUTO);
+    RGY_TEST_CHECK(rga_fused_plan(job, { cropOdd, resizeOdd }, reason) != RGY_ERR_NONE);
+
+    auto resizeSmall = testResize(crop->frameOut, 128, 72, RGY_VPP_RESIZE_AUTO); // 1/8より小さい
+    RGY_TEST_CHECK(rga_fused_plan(job, { crop, resizeSmall }, reason) != RGY_ERR_NONE);
+
+    auto cpuIn = in;
+    cpuIn.mem_type = RGY_MEM_TYPE_CPU;
+    auto cropCpu = testCrop(cpuIn, 8, 4, 8, 4);
+    auto resizeCpu = testResize(cropCpu->frameOut, 1280, 720, RGY_VPP_RESIZE_AUTO);
+    RGY_TEST_CHECK(rga_fused_plan(job, { cropCpu, resizeCpu }, reason) != RGY_ERR_NONE);
+}
+
+// まとめた処理は1回だけ非同期で投入され、fenceが前後に受け渡されること
+static void test_submit_async() {
+    const auto in = testFrameInfo(1920, 1080, RGY_CSP_NV12);
+    auto crop = testCrop(in, 8, 4, 8, 4);
+    auto csp = testCspConv(crop->frameOut, RGY_CSP_RGB24, RGY_MATRIX_BT709);
+    auto resize = testResize(csp->frameOut, 1280, 720, RGY_VPP_RESIZE_RGA_BILINEAR);
+    RGAFusedJob job;
+    tstring reason;
+    RGY_TEST_CHECK(rga_fused_plan(job, { crop, csp, resize }, reason) == RGY_ERR_NONE);
+
+    rga_buffer_t src, dst;
+    memset(&src, 0, sizeof(src));
+    memset(&dst, 0, sizeof(dst));
+    src.width = 1920; src.height = 1080; src.format = RK_FORMAT_YCbCr_420_SP;
+    dst.width = 1280; dst.height = 720;  dst.format = RK_FORMAT_RGB_888;
+
+    RGABackendMock mock;
+    int sync = 42; // 前段のrelease fence
+    RGY_TEST_CHECK(rga_fused_submit(&mock, job, src, dst, &sync) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(mock.checks == 1);
+    RGY_TEST_CHECK(mock.calls.size() == 1);
+    if (mock.calls.size() == 1) {
+        const auto& call = mock.calls[0];
+        RGY_TEST_CHECK(call.usage & IM_ASYNC);
+        RGY_TEST_CHECK(call.acquireFence == 42);
+        RGY_TEST_CHECK(call.srect.x == 8 && call.srect.y == 4 && call.srect.width == 1904 && call.srect.height == 1072);
+        RGY_TEST_CHECK(call.drect.x == 0 && call.drect.y == 0 && call.drect.width == 1280 && call.drect.height == 720);
+        RGY_TEST_CHECK(call.dst.color_space_mode == IM_YUV_TO_RGB_BT709_LIMIT);
+        RGY_TEST_CHECK(call.interp == interp_rgy_to_rga(RGY_VPP_RESIZE_RGA_BILINEAR));
+    }
+    RGY_TEST_CHECK(sync == 100); // 後段にはこの処理のrelease fenceが渡る
+
+    // fenceがない場合は-1を渡す
+    sync = 0;
+    RGY_TEST_CHECK(rga_fused_submit(&mock, job, src, dst, &sync) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(mock.calls.size() == 2 && mock.calls.back().acquireFence == -1);
+
+    // checkで失敗した場合は投入しない
+    src.width = 10;
+    sync = 0;
+    RGY_TEST_CHECK(rga_fused_submit(&mock, job, src, dst, &sync) != RGY_ERR_NONE);
+    RGY_TEST_CHECK(mock.calls.size() == 2);
+}
+
+// まとめた処理の結果が、個別に処理した場合と一致すること
+static void test_fused_equals_staged() {
+    const int cases[][8] = {
+        // width, height, crop left, up, right, bottom, out width, out height
+        { 640, 360,  8,  4,  8,  4,  320, 176 },
+        { 640, 360,  0, 40,  0, 40,  640, 280 },
+        { 320, 240, 16,  8, 32, 24,  544, 416 },
+        { 320, 240,  2,  2,  2,  2,  316, 236 },
+    };
+    for (const auto& c : cases) {
+        const auto in = testFrameInfo(c[0], c[1], RGY_CSP_NV12);
+        auto crop = testCrop(in, c[2], c[3], c[4], c[5]);
+        auto resize = testResize(crop->frameOut, c[6], c[7], RGY_VPP_RESIZE_RGA_NEAREST);
+        RGAFusedJob job;
+        tstring reason;
+        RGY_TEST_CHECK(rga_fused_plan(job, { crop, resize }, reason) == RGY_ERR_NONE);
+
+        TestNV12 src(c[0], c[1]);
+        src.fill(c[0] * 31 + c[2]);
+        TestNV12 tmp(crop->frameOut.width, crop->frameOut.height);
+        TestNV12 staged(c[6], c[7]);
+        TestNV12 fused(c[6], c[7]);
+
+        RGABackendMock mock;
+        // 個別に処理 (crop -> resize)
+        int sync = -1;
+        RGY_TEST_CHECK(mock.process(src.rga(), tmp.rga(),
+            im_rect{ c[2], c[3], tmp.width, tmp.height }, im_rect{ 0, 0, tmp.width, tmp.height }, -1, &sync, nullptr, IM_ASYNC) == IM_STATUS_SUCCESS);
+        RGY_TEST_CHECK(mock.process(tmp.rga(), staged.rga(),
+            im_rect{ 0, 0, tmp.width, tmp.height }, im_rect{ 0, 0, staged.width, staged.height }, sync, &sync, nullptr, IM_ASYNC) == IM_STATUS_SUCCESS);
+        // まとめて処理
+        sync = -1;
+        RGY_TEST_CHECK(rga_fused_submit(&mock, job, src.rga(), fused.rga(), &sync) == RGY_ERR_NONE);
+        RGY_TEST_CHECK_MSG(fused.equal(staged), "%dx%d crop %d,%d,%d,%d -> %dx%d", c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7]);
+        RGY_TEST_CHECK(mock.calls.size() == 3);
+    }
+}
+
+// モックを使ってRGAFilterFusedを初期化できること (初期化ではRGAを使用しない)
+static void test_filter_init() {
+    const auto in = testFrameInfo(1920, 1080, RGY_CSP_NV12);
+    auto prm = std::make_shared<RGYFilterParamRGAFused>();
+    auto crop = testCrop(in, 0, 4, 0, 4);
+    prm->stages.push_back(crop);
+    prm->stages.push_back(testResize(crop->frameOut, 1280, 720, RGY_VPP_RESIZE_AUTO));
+    RGAFilterFused filter(std::make_shared<RGABackendMock>());
+    RGY_TEST_CHECK(filter.init(prm, nullptr) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(prm->frameIn.width == 1920 && prm->frameOut.width == 1280 && prm->frameOut.height == 720);
+    RGY_TEST_CHECK(filter.GetInputMessage().find(_T("fused 2 filters")) != tstring::npos);
+
+    auto prmNg = std::make_shared<RGYFilterParamRGAFused>();
+    prmNg->stages.push_back(testResize(in, 1280, 720, RGY_VPP_RESIZE_AUTO));
+    prmNg->stages.push_back(testResize(testFrameInfo(1280, 720, RGY_CSP_NV12), 640, 360, RGY_VPP_RESIZE_AUTO));
+    RGAFilterFused filterNg(std::make_shared<RGABackendMock>());
+    RGY_TEST_CHECK(filterNg.init(prmNg, nullptr) != RGY_ERR_NONE);
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_plan_fuse);
+    RGY_TEST_RUN(test_plan_reject);
+    RGY_TEST_RUN(test_submit_async);
+    RGY_TEST_RUN(test_fused_equals_staged);
+    RGY_TEST_RUN(test_filter_init);
+    return rgy_test_result();
+}
@@ -0,0 +1,343 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include "rgy_test.h"
+#include "rgy_bitstream.h"
+#include "rgy_output_avcodec.h"
+#include "rgy_status.h"
+
+// --segment: IDRでのみセグメントを分割すること、セグメントのローテーションとプレイリストの出力を確認する
+
+class TestBitWriter {
+public:
+    TestBitWriter() : m_buf(), m_bits(0) {};
+    void put(uint32_t value, int n) {
+        for (int i = n - 1; i >= 0; i--) {
+            if ((m_bits & 7) == 0) m_buf.push_back(0);
+            if ((value >> i) & 1) m_buf.back() |= (uint8_t)(0x80 >> (m_bits & 7));
+            m_bits++;
+        }
+    }
+    void ue(uint32_t value) {
+        value++;
+        int len = 0;
+        for (auto t = value; t > 1; t >>= 1) len++;
+        put(0, len);
+        put(value, len + 1);
+    }
+    void trailing() {
+        put(1, 1);
+        while (m_bits & 7) put(0, 1);
+    }
+    const std::vector<uint8_t>& data() const { return m_buf; }
+private:
+    std::vector<uint8_t> m_buf;
+    int m_bits;
+};
+
+static void append_nal(std::vector<uint8_t>& bs, const std::vector<uint8_t>& header, const std::vector<uint8_t>& rbsp) {
+    std::vector<uint8_t> nal = header;
+    nal.insert(nal.end(), rbsp.begin(), rbsp.end());
+    to_nal(nal, header.size());
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    bs.insert(bs.end(), start_code, start_code + 4);
+    bs.insert(bs.end(), nal.begin(), nal.end());
+}
+
+enum class TestPicType { IDR, I, P };
+
+// 64x64, baseline, poc type 2 のH.264のアクセスユニットを生成する
+// スライスデータの中身はダミーだが、AVParserがスライスヘッダからpict_typeを取得できるようにする
+static std::vector<uint8_t> gen_h264_au(const TestPicType type, const int frameNum) {
+    std::vector<uint8_t> au;
+    if (type == TestPicType::IDR) {
+        TestBitWriter sps;
+        sps.put(66, 8); sps.put(0xC0, 8); sps.put(30, 8);
+        sps.ue(0); // sps_id
+        sps.ue(0); // log2_max_frame_num_minus4
+        sps.ue(2); // pic_order_cnt_type
+        sps.ue(1); // max_num_ref_frames
+        sps.put(0, 1);
+        sps.ue(3); sps.ue(3); // 64x64
+        sps.put(1, 1); sps.put(1, 1); sps.put(0, 1); sps.put(0, 1);
+        sps.trailing();
+        append_nal(au, { 0x67 }, sps.data());
+
+        TestBitWriter pps;
+        pps.ue(0); pps.ue(0);
+        pps.put(0, 1); pps.put(0, 1);
+        pps.ue(0); pps.ue(0); pps.ue(0);
+        pps.put(0, 1); pps.put(0, 2);
+        pps.ue(0); pps.ue(0); pps.ue(0); // pic_init_qp/qs, chroma_qp_index_offset (se(0) == ue(0))
+        pps.put(1, 1); pps.put(0, 1); pps.put(0, 1);
+        pps.trailing();
+        append_nal(au, { 0x68 }, pps.data());
+    }
+    TestBitWriter slice;
+    slice.ue(0); // first_mb_in_slice
+    slice.ue((type == TestPicType::P) ? 5 : 7);
+    slice.ue(0); // pps_id
+    slice.put(frameNum & 15, 4);
+    if (type == TestPicType::IDR) {
+        slice.ue(0); // idr_pic_id
+    }
+    if (type == TestPicType::P) {
+        slice.put(0, 1); // num_ref_idx_active_override_flag
+        slice.put(0, 1); // ref_pic_list_modification_flag_l0
+    }
+    if (type == TestPicType::IDR) {
+        slice.put(0, 2); // no_output_of_prior_pics_flag, long_term_reference_flag
+    } else {
+        slice.put(0, 1); // adaptive_ref_pic_marking_mode_flag
+    }
+    slice.ue(0); // slice_qp_delta
+    slice.ue(1); // disable_deblocking_filter_idc
+    for (int i = 0; i < 32; i++) {
+        slice.put(0x5a, 8);
+    }
+    slice.trailing();
+    append_nal(au, { (uint8_t)((type == TestPicType::IDR) ? 0x65 : 0x61) }, slice.data());
+    return au;
+}
+
+static std::vector<nal_info> parse_h264(const std::vector<uint8_t>& data) {
+    return parse_nal_unit_h264_c(data.data(), data.size());
+}
+
+// IDRかどうかの判定は、NALの種類によって行い、IフレームをIDRとしないこと
+static void test_nal_list_has_idr() {
+    RGY_TEST_CHECK(nal_list_has_idr(parse_h264(gen_h264_au(TestPicType::IDR, 0)), RGY_CODEC_H264));
+    RGY_TEST_CHECK(!nal_list_has_idr(parse_h264(gen_h264_au(TestPicType::I, 3)), RGY_CODEC_H264));
+    RGY_TEST_CHECK(!nal_list_has_idr(parse_h264(gen_h264_au(TestPicType::P, 4)), RGY_CODEC_H264));
+    const auto parse_h264_simd = get_parse_nal_unit_h264_func();
+    const auto idr = gen_h264_au(TestPicType::IDR, 0);
+    RGY_TEST_CHECK(nal_list_has_idr(parse_h264_simd(idr.data(), idr.size()), RGY_CODEC_H264));
+
+    struct {
+        uint8_t type;
+        int layer;
+        bool idr;
+    } hevc_cases[] = {
+        { NALU_HEVC_IDR_W_RADL, 0, true },
+        { NALU_HEVC_IDR_N_LP,   0, true },
+        { 21 /*CRA*/,           0, false },
+        { 1 /*TRAIL_R*/,        0, false },
+        { NALU_HEVC_IDR_W_RADL, 1, false }, // alphaなどのlayer 1のIDRは対象外
+    };
+    for (const auto& c : hevc_cases) {
+        std::vector<uint8_t> au;
+        append_nal(au, { (uint8_t)(NALU_HEVC_AUD << 1), 0x01 }, { 0x50 });
+        append_nal(au, { (uint8_t)((c.type << 1) | (c.layer >> 5)), (uint8_t)(((c.layer & 0x1f) << 3) | 1) }, std::vector<uint8_t>(16, 0x5a));
+        RGY_TEST_CHECK_MSG(nal_list_has_idr(parse_nal_unit_hevc_c(au.data(), au.size()), RGY_CODEC_HEVC) == c.idr,
+            "hevc nal type %d, layer %d", c.type, c.layer);
+    }
+    // AV1などは対象外
+    RGY_TEST_CHECK(!nal_list_has_idr(parse_h264(idr), RGY_CODEC_AV1));
+}
+
+#if ENABLE_AVSW_READER
+static const int SEG_FPS = 30;
+static const int SEG_IDR_INTERVAL = 60; // 2秒ごとにIDR
+static const int SEG_I_INTERVAL = 15;   // 0.5秒ごとにIDRでないI (open GOP相当)
+
+struct TestPlaylist {
+    std::vector<double> durations;
+    std::vector<std::string> segments;
+    int mediaSequence;
+    bool endList;
+    bool event;
+};
+
+static TestPlaylist read_playlist(const std::filesystem::path& path) {
+    TestPlaylist playlist = { {}, {}, 0, false, false };
+    std::ifstream ifs(path);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, 8, "#EXTINF:") == 0) {
+            playlist.durations.push_back(std::atof(line.c_str() + 8));
+        } else if (line.compare(0, 22, "#EXT-X-MEDIA-SEQUENCE:") == 0) {
+            playlist.mediaSequence = std::atoi(line.c_str() + 22);
+        } else if (line == "#EXT-X-ENDLIST") {
+            playlist.endList = true;
+        } else if (line == "#EXT-X-PLAYLIST-TYPE:EVENT") {
+            playlist.event = true;
+        } else if (line.length() > 0 && line[0] != '#') {
+            playlist.segments.push_back(line);
+        }
+    }
+    return playlist;
+}
+
+static RGY_ERR write_segments(const std::filesystem::path& playlist, const RGYParamSegment& segment, const int frames) {
+    auto log = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    auto status = std::make_shared<EncodeStatus>();
+    sTrimParam trim = { {}, 0 };
+    status->Init(SEG_FPS, 1, frames, frames / (double)SEG_FPS, trim, log, nullptr);
+
+    VideoInfo info;
+    info.codec = RGY_CODEC_H264;
+    info.dstWidth = 64;
+    info.dstHeight = 64;
+    info.fpsN = SEG_FPS;
+    info.fpsD = 1;
+    info.sar[0] = 1;
+    info.sar[1] = 1;
+    info.csp = RGY_CSP_NV12;
+    info.picstruct = RGY_PICSTRUCT_FRAME;
+
+    AvcodecWriterPrm prm;
+    prm.bitstreamTimebase = av_make_q(1, SEG_FPS);
+    prm.threadOutput = 0;
+    prm.threadAudio = 0;
+    prm.segment = segment;
+
+    std::unique_ptr<RGYOutput> writer = std::make_unique<RGYOutputAvcodec>();
+    auto err = writer->Init(playlist.string().c_str(), &info, &prm, log, status);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    RGYBitstream bs = RGYBitstreamInit();
+    int frameNum = 0;
+    for (int i = 0; i < frames; i++) {
+        const auto type = (i % SEG_IDR_INTERVAL == 0) ? TestPicType::IDR : ((i % SEG_I_INTERVAL == 0) ? TestPicType::I : TestPicType::P);
+        frameNum = (type == TestPicType::IDR) ? 0 : frameNum + 1;
+        const auto au = gen_h264_au(type, frameNum);
+        bs.copy(au.data(), au.size());
+        bs.setPts(i);
+        bs.setDts(i);
+        bs.setDuration(1);
+        // エンコーダはIDRでないIフレームもIとして返す
+        bs.setFrametype((type == TestPicType::P) ? RGY_FRAMETYPE_P : ((type == TestPicType::IDR) ? (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I) : RGY_FRAMETYPE_I));
+        if ((err = writer->WriteNextFrame(&bs)) != RGY_ERR_NONE) {
+            break;
+        }
+    }
+    writer->Close();
+    bs.clear();
+    return err;
+}
+
+static std::filesystem::path test_segment_dir(const char *name) {
+    auto dir = std::filesystem::temp_directory_path() / (std::string("rgy_test_segment_") + name);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir;
+}
+
+// セグメントはIDRでのみ分割され、IDRでないIフレームでは分割されないこと
+static void test_segment_idr_only() {
+    const auto dir = test_segment_dir("event");
+    RGYParamSegment segment;
+    segment.enable = true;
+    segment.duration = 1.0; // IフレームごとではなくIDRごと (2秒) に分割されるはず
+    segment.listSize = 0;
+    const int frames = SEG_IDR_INTERVAL * 4;
+    RGY_TEST_CHECK(write_segments(dir / "out.m3u8", segment, frames) == RGY_ERR_NONE);
+
+    const auto playlist = read_playlist(dir / "out.m3u8");
+    RGY_TEST_CHECK(playlist.event);
+    RGY_TEST_CHECK(playlist.endList);
+    RGY_TEST_CHECK_MSG(playlist.durations.size() == 4, "segments %d", (int)playlist.durations.size());
+    for (const auto duration : playlist.durations) {
+        RGY_TEST_CHECK_MSG(std::abs(duration - SEG_IDR_INTERVAL / (double)SEG_FPS) < 0.05, "duration %.3f", duration);
+    }
+    for (size_t i = 0; i < playlist.segments.size(); i++) {
+        RGY_TEST_CHECK(playlist.segments[i] == strsprintf("out_%05d.ts", (int)i));
+        RGY_TEST_CHECK(std::filesystem::file_size(dir / playlist.segments[i]) > 0);
+    }
+    // temp_fileの一時ファイルが残っていないこと
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        RGY_TEST_CHECK_MSG(entry.path().extension() != ".tmp", "%s", entry.path().string().c_str());
+    }
+    std::filesystem::remove_all(dir);
+}
+
+// list_size指定時は、古いセグメントがプレイリストから外れ、削除されること
+static void test_segment_rotation() {
+    const auto dir = test_segment_dir("rotation");
+    RGYParamSegment segment;
+    segment.enable = true;
+    segment.duration = 2.0;
+    segment.listSize = 3;
+    const int segments = 8;
+    RGY_TEST_CHECK(write_segments(dir / "live.m3u8", segment, SEG_IDR_INTERVAL * segments) == RGY_ERR_NONE);
+
+    const auto playlist = read_playlist(dir / "live.m3u8");
+    RGY_TEST_CHECK(!playlist.event);
+    RGY_TEST_CHECK_MSG(playlist.segments.size() == (size_t)segment.listSize, "segments %d", (int)playlist.segments.size());
+    RGY_TEST_CHECK_MSG(playlist.mediaSequence == segments - segment.listSize, "media sequence %d", playlist.mediaSequence);
+    for (size_t i = 0; i < playlist.segments.size(); i++) {
+        RGY_TEST_CHECK(playlist.segments[i] == strsprintf("live_%05d.ts", playlist.mediaSequence + (int)i));
+        RGY_TEST_CHECK(std::filesystem::exists(dir / playlist.segments[i]));
+    }
+    RGY_TEST_CHECK(!std::filesystem::exists(dir / "live_00000.ts"));
+    RGY_TEST_CHECK(!std::filesystem::exists(dir / "live_00001.ts"));
+    std::filesystem::remove_all(dir);
+}
+
+// fmp4では初期化セグメントを出力し、プレイリストから参照すること
+static void test_segment_fmp4() {
+    const auto dir = test_segment_dir("fmp4");
+    RGYParamSegment segment;
+    segment.enable = true;
+    segment.type = RGYSegmentType::FMP4;
+    segment.duration = 2.0;
+    RGY_TEST_CHECK(write_segments(dir / "out.m3u8", segment, SEG_IDR_INTERVAL * 3) == RGY_ERR_NONE);
+
+    RGY_TEST_CHECK(std::filesystem::exists(dir / "out_init.mp4"));
+    const auto playlist = read_playlist(dir / "out.m3u8");
+    RGY_TEST_CHECK_MSG(playlist.segments.size() == 3, "segments %d", (int)playlist.segments.size());
+    for (size_t i = 0; i < playlist.segments.size(); i++) {
+        RGY_TEST_CHECK(playlist.segments[i] == strsprintf("out_%05d.m4s", (int)i));
+    }
+    std::ifstream ifs(dir / "out.m3u8");
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    RGY_TEST_CHECK(ss.str().find("#EXT-X-MAP:URI=\"out_init.mp4\"") != std::string::npos);
+    std::filesystem::remove_all(dir);
+}
+#endif //#if ENABLE_AVSW_READER
+
+int main() {
+    RGY_TEST_RUN(test_nal_list_has_idr);
+#if ENABLE_AVSW_READER
+    RGY_TEST_RUN(test_segment_idr_only);
+    RGY_TEST_RUN(test_segment_rotation);
+    RGY_TEST_RUN(test_segment_fmp4);
+#endif //#if ENABLE_AVSW_READER
+    return rgy_test_result();
+}
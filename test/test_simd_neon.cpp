@@ -0,0 +1,237 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <random>
+#include "rgy_test.h"
+
+#if defined(_M_ARM64) || defined(__aarch64__) || defined(__arm64__)
+#include "rgy_memmem.h"
+#include "rgy_faw.h"
+#include "rgy_bitstream.h"
+
+// NEON版とC版の出力が一致することをランダム入力で確認する
+static const int FUZZ_LOOP = 2000;
+static std::mt19937 g_rnd(1234);
+
+static int rnd_range(int min, int max) {
+    return std::uniform_int_distribution<int>(min, max)(g_rnd);
+}
+
+// 部分一致が多く出るよう、少ない種類の値でデータを埋める
+static void fill_random(uint8_t *ptr, size_t size, int alphabet) {
+    for (size_t i = 0; i < size; i++) {
+        ptr[i] = (uint8_t)rnd_range(0, alphabet - 1);
+    }
+}
+
+static void plant(uint8_t *ptr, size_t size, const uint8_t *pattern, size_t psize) {
+    if (psize > size) return;
+    memcpy(ptr + rnd_range(0, (int)(size - psize)), pattern, psize);
+}
+
+static void test_dispatch() {
+    RGY_TEST_CHECK(get_memmem_func() == rgy_memmem_neon);
+    RGY_TEST_CHECK(get_memmem_fawstart1_func() == rgy_memmem_fawstart1_neon);
+    RGY_TEST_CHECK(get_convert_audio_16to8_func() == rgy_convert_audio_16to8_neon);
+    RGY_TEST_CHECK(get_split_audio_16to8x2_func() == rgy_split_audio_16to8x2_neon);
+    RGY_TEST_CHECK(get_parse_nal_unit_h264_func() == parse_nal_unit_h264_neon);
+    RGY_TEST_CHECK(get_parse_nal_unit_hevc_func() == parse_nal_unit_hevc_neon);
+    RGY_TEST_CHECK(get_find_header_func() == find_header_neon);
+}
+
+static void test_memmem() {
+    std::vector<uint8_t> buf(512 + 64);
+    std::vector<uint8_t> target(48);
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int offset = rnd_range(0, 63); // 非アラインの先頭
+        const size_t size = rnd_range(0, 512);
+        const size_t tsize = rnd_range(1, 40);
+        const int alphabet = rnd_range(2, 256);
+        uint8_t *data = buf.data() + offset;
+        fill_random(data, size, alphabet);
+        fill_random(target.data(), tsize, alphabet);
+        const int planted = rnd_range(0, 3);
+        for (int j = 0; j < planted; j++) {
+            plant(data, size, target.data(), tsize);
+        }
+        if (size >= tsize && rnd_range(0, 7) == 0) {
+            memcpy(data + size - tsize, target.data(), tsize); // 末尾ちょうど
+        }
+        const auto ret_c = rgy_memmem_c(data, size, target.data(), tsize);
+        const auto ret_neon = rgy_memmem_neon(data, size, target.data(), tsize);
+        RGY_TEST_CHECK_MSG(ret_c == ret_neon, "memmem: size %d, tsize %d, offset %d, c %d, neon %d",
+            (int)size, (int)tsize, offset, (int)ret_c, (int)ret_neon);
+    }
+}
+
+static void test_memmem_fawstart1() {
+    std::vector<uint8_t> buf(1024 + 64);
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int offset = rnd_range(0, 63);
+        const size_t size = rnd_range(0, 1024);
+        uint8_t *data = buf.data() + offset;
+        fill_random(data, size, rnd_range(0, 1) ? 256 : 8);
+        const int planted = rnd_range(0, 2);
+        for (int j = 0; j < planted; j++) {
+            // 途中で途切れたパターンも混ぜる
+            plant(data, size, fawstart1.data(), rnd_range(1, (int)fawstart1.size()));
+        }
+        const auto ret_c = rgy_memmem_fawstart1_c(data, size);
+        const auto ret_neon = rgy_memmem_fawstart1_neon(data, size);
+        RGY_TEST_CHECK_MSG(ret_c == ret_neon, "fawstart1: size %d, offset %d, c %d, neon %d",
+            (int)size, offset, (int)ret_c, (int)ret_neon);
+    }
+}
+
+static void test_audio_16to8() {
+    const uint8_t canary = 0xA5;
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const size_t n = rnd_range(0, 300);
+        const int offset = rnd_range(0, 15);
+        std::vector<short> src(n + 16);
+        for (auto& s : src) s = (short)rnd_range(-32768, 32767);
+        std::vector<uint8_t> dst_c(n + 32, canary), dst_neon(n + 32, canary);
+        rgy_convert_audio_16to8(dst_c.data() + offset, src.data() + (offset & 7), n);
+        rgy_convert_audio_16to8_neon(dst_neon.data() + offset, src.data() + (offset & 7), n);
+        RGY_TEST_CHECK_MSG(dst_c == dst_neon, "16to8: n %d, offset %d", (int)n, offset);
+    }
+}
+
+static void test_split_audio_16to8x2() {
+    const uint8_t canary = 0xA5;
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const size_t n = rnd_range(0, 300) & ~1; // L/Rの組
+        const int offset = rnd_range(0, 15);
+        std::vector<short> src(n + 16);
+        for (auto& s : src) s = (short)rnd_range(-32768, 32767);
+        std::vector<uint8_t> dst0_c(n + 32, canary), dst1_c(n + 32, canary);
+        std::vector<uint8_t> dst0_neon(n + 32, canary), dst1_neon(n + 32, canary);
+        rgy_split_audio_16to8x2(dst0_c.data() + offset, dst1_c.data() + offset, src.data() + (offset & 7), n);
+        rgy_split_audio_16to8x2_neon(dst0_neon.data() + offset, dst1_neon.data() + offset, src.data() + (offset & 7), n);
+        RGY_TEST_CHECK_MSG(dst0_c == dst0_neon && dst1_c == dst1_neon, "split16to8x2: n %d, offset %d", (int)n, offset);
+    }
+}
+
+static void test_find_header() {
+    static const uint8_t header[4] = { 0, 0, 0, 1 };
+    std::vector<uint8_t> buf(2048 + 64);
+    for (int i = 0; i < FUZZ_LOOP; i++) {
+        const int offset = rnd_range(0, 63);
+        const size_t size = rnd_range(0, 2048);
+        uint8_t *data = buf.data() + offset;
+        fill_random(data, size, rnd_range(0, 1) ? 256 : 2);
+        const int planted = rnd_range(0, 2);
+        for (int j = 0; j < planted; j++) {
+            plant(data, size, header, rnd_range(3, 4));
+        }
+        const auto ret_c = find_header_c(data, size);
+        const auto ret_neon = find_header_neon(data, size);
+        RGY_TEST_CHECK_MSG(ret_c == ret_neon, "find_header: size %d, offset %d, c %d, neon %d",
+            (int)size, offset, (int)ret_c, (int)ret_neon);
+    }
+}
+
+// start code + NAL headerを並べたストリームを作る
+static std::vector<uint8_t> make_nal_stream(bool hevc) {
+    std::vector<uint8_t> stream;
+    const int nal_count = rnd_range(0, 12);
+    for (int i = 0; i < nal_count; i++) {
+        if (rnd_range(0, 1)) stream.push_back(0);
+        stream.push_back(0);
+        stream.push_back(0);
+        stream.push_back(1);
+        if (hevc) {
+            stream.push_back((uint8_t)(rnd_range(0, 63) << 1) | (uint8_t)rnd_range(0, 1));
+            stream.push_back((uint8_t)rnd_range(1, 7));
+        } else {
+            stream.push_back((uint8_t)rnd_range(1, 255) & 0x7f);
+        }
+        const int payload = rnd_range(0, 200);
+        for (int j = 0; j < payload; j++) {
+            // emulation preventionされていない0x000001も時々混ぜる
+            stream.push_back((uint8_t)(rnd_range(0, 3) ? rnd_range(0, 255) : rnd_range(0, 1)));
+        }
+    }
+    // parse_nal_unit_*はstart codeの後ろにNAL headerがあることを前提にしているので、
+    // 末尾でstart codeが途切れないようにしておく
+    if (!stream.empty()) {
+        stream.push_back(0xff);
+        stream.push_back(0xff);
+    }
+    return stream;
+}
+
+static bool nal_equal(const std::vector<nal_info>& a, const std::vector<nal_info>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].ptr != b[i].ptr
+            || a[i].type != b[i].type
+            || a[i].size != b[i].size
+            || a[i].nuh_layer_id != b[i].nuh_layer_id
+            || a[i].temporal_id != b[i].temporal_id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_parse_nal_unit() {
+    for (int hevc = 0; hevc < 2; hevc++) {
+        for (int i = 0; i < FUZZ_LOOP; i++) {
+            const auto stream = make_nal_stream(hevc != 0);
+            const int offset = rnd_range(0, 15);
+            std::vector<uint8_t> buf(stream.size() + offset);
+            if (!stream.empty()) memcpy(buf.data() + offset, stream.data(), stream.size());
+            const uint8_t *data = buf.data() + offset;
+            const auto nal_c    = (hevc) ? parse_nal_unit_hevc_c(data, stream.size())    : parse_nal_unit_h264_c(data, stream.size());
+            const auto nal_neon = (hevc) ? parse_nal_unit_hevc_neon(data, stream.size()) : parse_nal_unit_h264_neon(data, stream.size());
+            RGY_TEST_CHECK_MSG(nal_equal(nal_c, nal_neon), "parse_nal_unit_%s: size %d, offset %d, c %d nal, neon %d nal",
+                (hevc) ? "hevc" : "h264", (int)stream.size(), offset, (int)nal_c.size(), (int)nal_neon.size());
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_dispatch);
+    RGY_TEST_RUN(test_memmem);
+    RGY_TEST_RUN(test_memmem_fawstart1);
+    RGY_TEST_RUN(test_audio_16to8);
+    RGY_TEST_RUN(test_split_audio_16to8x2);
+    RGY_TEST_RUN(test_find_header);
+    RGY_TEST_RUN(test_parse_nal_unit);
+    return rgy_test_result();
+}
+#else
+int main(int argc, char **argv) {
+    fprintf(stderr, "NEON kernels are built only for aarch64, skipped.\n");
+    return RGY_TEST_EXIT_SKIP;
+}
+#endif
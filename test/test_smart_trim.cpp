@@ -0,0 +1,297 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <random>
+#include "rgy_test.h"
+#include "mpp_smart_trim.h"
+
+// smart-trimのつなぎ合わせを、参照関係を持たせた模擬ストリームをソフトウェアでデコードして確認する
+//  - 入力をGOPごとにMPPSmartTrim::planに渡し、PipelineTaskSmartTrimと同じ順で出力を組み立てる
+//    (再エンコードするフレームをIDRから始まる区間として出力し、その後にそのまま出力するパケットを続ける)
+//  - 出力をデコードし、そのまま出力したフレームの参照先が、入力と同じ内容でDPBにあるかを確認する
+//  - 表示順に並べた出力のフレームが、trimの範囲内のフレームと一致するかを確認する
+struct TestPacket {
+    int poc;
+    bool key;
+    bool idr;              // DPBをクリアするキーフレーム (closed GOP)
+    std::vector<int> refs; // 参照するフレーム番号
+};
+
+// closed GOP: I P B B P B B ... (デコード順: I0 P3 B1 B2 P6 B4 B5 ...)
+// open GOP  : 2つ目以降のキーフレームはCRAとし、直前のGOPの最後のPとCRAを参照するleadingのBフレームを持つ
+static std::vector<TestPacket> makeStream(int gops, int gopLen, int bframes, bool openGop) {
+    std::vector<TestPacket> stream;
+    int poc = 0;
+    int prevRef = -1;
+    for (int g = 0; g < gops; g++) {
+        const bool cra = openGop && g > 0 && bframes > 0;
+        const int key = (cra) ? poc + bframes : poc;
+        stream.push_back({ key, true, !cra, {} });
+        if (cra) {
+            for (int b = 0; b < bframes; b++) {
+                stream.push_back({ poc + b, false, false, { prevRef, key } });
+            }
+        }
+        int ref = key;
+        int next = key + 1;
+        const int gopEnd = poc + gopLen;
+        while (next < gopEnd) {
+            const int p = std::min(next + bframes, gopEnd - 1);
+            stream.push_back({ p, false, false, { ref } });
+            for (int b = next; b < p; b++) {
+                stream.push_back({ b, false, false, { ref, p } });
+            }
+            ref = p;
+            next = p + 1;
+        }
+        prevRef = ref;
+        poc = gopEnd;
+    }
+    return stream;
+}
+
+struct SpliceResult {
+    std::vector<int> outputPoc;   // 出力したフレーム (出力順)
+    std::vector<bool> copied;     // そのまま出力したか
+    int copiedFrames = 0;
+    int encodedFrames = 0;
+    int brokenFrames = 0;         // 参照先が正しくないため、正しくデコードできないフレーム
+    int undecodable = 0;          // 再エンコード用にデコードできなかったフレーム
+};
+
+// パケットを順にデコードし、正しくデコードできたフレームを返す
+static std::map<int, bool> decodePackets(const std::vector<const TestPacket *>& packets) {
+    std::map<int, bool> dpb;
+    for (const auto pkt : packets) {
+        if (pkt->idr) {
+            dpb.clear();
+        }
+        bool ok = true;
+        for (const auto ref : pkt->refs) {
+            auto it = dpb.find(ref);
+            ok &= (it != dpb.end() && it->second);
+        }
+        dpb[pkt->poc] = ok;
+    }
+    return dpb;
+}
+
+static SpliceResult splice(const std::vector<TestPacket>& stream, const std::vector<sTrim>& trimList) {
+    SpliceResult result;
+    MPPSmartTrim splicer(trimList);
+    std::vector<const TestPacket *> gopPrev;
+    int gopPrevKey = 0;
+    // デコーダのDPB: フレーム番号 -> 入力と同じ内容か (再エンコードしたフレームはfalse)
+    std::map<int, bool> dpb;
+    for (size_t start = 0; start < stream.size(); ) {
+        size_t end = start + 1;
+        while (end < stream.size() && !stream[end].key) {
+            end++;
+        }
+        std::vector<const TestPacket *> gop;
+        MPPSmartTrimGop range(stream[start].poc, stream[start].poc, stream[start].poc);
+        for (size_t i = start; i < end; i++) {
+            gop.push_back(&stream[i]);
+            range.firstFrame = std::min(range.firstFrame, stream[i].poc);
+            range.lastFrame = std::max(range.lastFrame, stream[i].poc);
+        }
+        const auto plan = splicer.plan(range);
+        const int copiedBefore = result.copiedFrames;
+        const int encodedBefore = result.encodedFrames;
+
+        // 再エンコード: open GOPでは直前のGOPのキーフレーム以降もデコーダに入力する
+        std::vector<int> encodeList;
+        for (const auto pkt : gop) {
+            if (splicer.encode(plan, pkt->poc)) {
+                encodeList.push_back(pkt->poc);
+            }
+        }
+        if (encodeList.size() > 0) {
+            std::vector<const TestPacket *> feed;
+            if (range.openGop()) {
+                for (const auto pkt : gopPrev) {
+                    if (pkt->poc >= gopPrevKey) {
+                        feed.push_back(pkt);
+                    }
+                }
+            }
+            for (const auto pkt : gop) {
+                feed.push_back(pkt);
+            }
+            auto decoded = decodePackets(feed);
+            std::sort(encodeList.begin(), encodeList.end());
+            dpb.clear(); // IDRから始める
+            for (const auto poc : encodeList) {
+                if (!decoded[poc]) {
+                    result.undecodable++;
+                }
+                dpb[poc] = false;
+                result.outputPoc.push_back(poc);
+                result.copied.push_back(false);
+                result.encodedFrames++;
+            }
+        }
+        // そのまま出力
+        for (const auto pkt : gop) {
+            if (!plan.copy(pkt->poc)) {
+                continue;
+            }
+            if (pkt->idr) {
+                dpb.clear();
+            }
+            bool ok = true;
+            for (const auto ref : pkt->refs) {
+                auto it = dpb.find(ref);
+                ok &= (it != dpb.end() && it->second);
+            }
+            if (!ok) {
+                result.brokenFrames++;
+            }
+            dpb[pkt->poc] = ok;
+            result.outputPoc.push_back(pkt->poc);
+            result.copied.push_back(true);
+            result.copiedFrames++;
+        }
+        splicer.addResult(plan.action, result.copiedFrames - copiedBefore, result.encodedFrames - encodedBefore);
+        gopPrev = gop;
+        gopPrevKey = range.keyFrame;
+        start = end;
+    }
+    return result;
+}
+
+// 出力が正しくデコードでき、trimの範囲内のフレームがちょうど1回ずつ出力されていること
+static void checkSplice(const std::vector<TestPacket>& stream, const std::vector<sTrim>& trimList, const char *name) {
+    const auto result = splice(stream, trimList);
+    MPPSmartTrim splicer(trimList);
+    RGY_TEST_CHECK_MSG(result.brokenFrames == 0, "%s: %d copied frames reference missing or re-encoded frames", name, result.brokenFrames);
+    RGY_TEST_CHECK_MSG(result.undecodable == 0, "%s: %d frames could not be decoded for re-encode", name, result.undecodable);
+
+    std::vector<int> expected;
+    for (const auto& pkt : stream) {
+        if (splicer.inside(pkt.poc)) {
+            expected.push_back(pkt.poc);
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+    auto displayed = result.outputPoc;
+    std::sort(displayed.begin(), displayed.end());
+    RGY_TEST_CHECK_MSG(displayed == expected, "%s: output %d frames, expected %d frames", name, (int)displayed.size(), (int)expected.size());
+    // 出力時のフレーム番号は表示順に連番
+    for (int i = 0; i < (int)expected.size(); i++) {
+        RGY_TEST_CHECK_MSG(splicer.outputFrame(expected[i]) == i, "%s: frame %d -> %d, expected %d", name, expected[i], splicer.outputFrame(expected[i]), i);
+    }
+}
+
+static int countEncoded(const std::vector<TestPacket>& stream, const std::vector<sTrim>& trimList) {
+    return splice(stream, trimList).encodedFrames;
+}
+
+// trimがない/GOPの境界のみなら、再エンコードしない
+static void test_no_reencode() {
+    const auto closed = makeStream(6, 12, 2, false);
+    RGY_TEST_CHECK(countEncoded(closed, { { 0, TRIM_MAX } }) == 0);
+    RGY_TEST_CHECK(countEncoded(closed, { { 12, 35 }, { 48, 59 } }) == 0);
+    checkSplice(closed, { { 12, 35 }, { 48, 59 } }, "closed gop boundary");
+    const auto open = makeStream(6, 12, 2, true);
+    RGY_TEST_CHECK(countEncoded(open, { { 0, TRIM_MAX } }) == 0);
+    checkSplice(open, { { 0, TRIM_MAX } }, "open gop all");
+}
+
+// GOPの途中で切る場合は、そのGOPの範囲内のフレームのみ再エンコードする
+static void test_mid_gop() {
+    const auto closed = makeStream(6, 12, 2, false);
+    RGY_TEST_CHECK(countEncoded(closed, { { 5, 40 } }) == (12 - 5) + (41 - 36));
+    checkSplice(closed, { { 5, 40 } }, "closed mid gop");
+    const auto noB = makeStream(4, 10, 0, false);
+    RGY_TEST_CHECK(countEncoded(noB, { { 3, 25 } }) == (10 - 3) + (26 - 20));
+    checkSplice(noB, { { 3, 25 } }, "ip mid gop");
+}
+
+// open GOPのキーフレームで切る場合は、leadingフレームを捨てるだけで再エンコードしない
+// 直前のGOPを切った場合は、参照先を失うleadingフレームのみ再エンコードする
+static void test_open_gop() {
+    const auto open = makeStream(6, 12, 2, true);
+    // CRAは 14, 26, 38, ... (leadingは12,13 / 24,25 / ...)
+    RGY_TEST_CHECK(countEncoded(open, { { 14, TRIM_MAX } }) == 0);
+    checkSplice(open, { { 14, TRIM_MAX } }, "open gop cut at cra");
+    // 12から: 直前のGOPは捨てるので、leading 12,13を再エンコード
+    RGY_TEST_CHECK(countEncoded(open, { { 12, TRIM_MAX } }) == 2);
+    checkSplice(open, { { 12, TRIM_MAX } }, "open gop cut at leading");
+    // 直前のGOPの途中で切ると、そのGOPの後半と次のGOPのleadingを再エンコード
+    RGY_TEST_CHECK(countEncoded(open, { { 6, TRIM_MAX } }) == (14 - 6));
+    checkSplice(open, { { 6, TRIM_MAX } }, "open gop cut before leading");
+    // 終端側: GOPの途中で終わる
+    checkSplice(open, { { 0, 30 } }, "open gop end mid gop");
+    checkSplice(open, { { 0, 25 } }, "open gop end before cra");
+    checkSplice(open, { { 3, 20 }, { 30, 50 } }, "open gop two ranges");
+}
+
+// ランダムなtrimで、つなぎ合わせた出力が正しくデコードできること
+static void test_random() {
+    std::mt19937 mt(12345);
+    const std::vector<std::vector<TestPacket>> streams = {
+        makeStream(8, 12, 2, false),
+        makeStream(8, 12, 2, true),
+        makeStream(8, 15, 3, true),
+        makeStream(8, 10, 0, false),
+        makeStream(8, 1, 0, false),
+    };
+    for (size_t s = 0; s < streams.size(); s++) {
+        const int frames = (int)streams[s].size();
+        for (int iter = 0; iter < 300; iter++) {
+            std::vector<int> points;
+            const int n = 1 + (int)(mt() % 3);
+            for (int i = 0; i < n * 2; i++) {
+                points.push_back((int)(mt() % frames));
+            }
+            std::sort(points.begin(), points.end());
+            std::vector<sTrim> trimList;
+            for (int i = 0; i < n; i++) {
+                if (trimList.size() > 0 && points[i * 2] <= trimList.back().fin) {
+                    continue;
+                }
+                trimList.push_back({ points[i * 2], points[i * 2 + 1] });
+            }
+            char name[64];
+            sprintf(name, "stream %d iter %d", (int)s, iter);
+            checkSplice(streams[s], trimList, name);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_no_reencode);
+    RGY_TEST_RUN(test_mid_gop);
+    RGY_TEST_RUN(test_open_gop);
+    RGY_TEST_RUN(test_random);
+    return rgy_test_result();
+}
@@ -0,0 +1,165 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "rgy_test.h"
+#include "rgy_output.h"
+
+// 取り出したmetadataの識別用
+class TestFrameData : public RGYFrameData {
+public:
+    TestFrameData(int id) : RGYFrameData(), m_id(id) {};
+    int id() const { return m_id; }
+private:
+    int m_id;
+};
+
+static std::vector<std::shared_ptr<RGYFrameData>> testMetadata(int id) {
+    return { std::make_shared<TestFrameData>(id) };
+}
+
+static int metadataId(const RGYTimestampMapVal& val) {
+    if (val.dataList.size() != 1) return -1;
+    return dynamic_cast<TestFrameData *>(val.dataList[0].get())->id();
+}
+
+static void test_ring_size() {
+    RGY_TEST_CHECK(RGYTimestamp(false).size() == 1024);
+    RGY_TEST_CHECK(RGYTimestamp(false, 256).size() == 1024);
+    // 240fps -> キュー960フレーム
+    RGY_TEST_CHECK(RGYTimestamp(false, rgy_output_video_queue_max(rgy_rational<int>(240, 1))).size() == 2048);
+    RGY_TEST_CHECK(RGYTimestamp(false, 3000).size() == 8192);
+}
+
+// Bフレームの並べ替え順に取り出しても、時刻とmetadataが正しく得られること
+static void test_reorder() {
+    RGYTimestamp ts(false);
+    const int frames = 5000; // リングを何周かさせる
+    const int gop[4] = { 0, 3, 1, 2 };
+    for (int i = 0; i < frames; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            RGY_TEST_CHECK(ts.add((i + j) * 1001, i + j, i + j, 1001, testMetadata(i + j)) == RGY_ERR_NONE);
+        }
+        for (int j = 0; j < 4; j++) {
+            const int id = i + gop[j];
+            const auto peek = ts.peek(id * 1001);
+            RGY_TEST_CHECK(peek.inputFrameId == id && peek.dataList.size() == 0);
+            const auto val = ts.get(id * 1001);
+            RGY_TEST_CHECK_MSG(val.timestamp == id * 1001 && val.inputFrameId == id && val.duration == 1001,
+                "frame %d: %lld %lld %lld", id, (long long)val.timestamp, (long long)val.inputFrameId, (long long)val.duration);
+            RGY_TEST_CHECK(metadataId(val) == id);
+        }
+    }
+    RGY_TEST_CHECK(ts.get(frames * 1001).inputFrameId < 0);
+}
+
+// 取り出されないまま一周した場合は、上書きせずにエラーを返すこと
+static void test_overflow() {
+    RGYTimestamp ts(false);
+    const int size = (int)ts.size();
+    for (int i = 0; i < size; i++) {
+        RGY_TEST_CHECK(ts.add(i, i, i, 1, testMetadata(i)) == RGY_ERR_NONE);
+    }
+    RGY_TEST_CHECK(ts.add(size, size, size, 1, testMetadata(size)) != RGY_ERR_NONE);
+    // 失敗した登録で既存のフレームが壊れていないこと
+    const auto first = ts.get(0);
+    RGY_TEST_CHECK(first.timestamp == 0 && metadataId(first) == 0);
+    const auto last = ts.peek(size - 1);
+    RGY_TEST_CHECK(last.timestamp == size - 1 && last.duration == 1);
+    // 先頭が取り出されれば、次は登録できる
+    RGY_TEST_CHECK(ts.add(size, size, size, 1, testMetadata(size)) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(ts.add(size + 1, size + 1, size + 1, 1, testMetadata(size + 1)) != RGY_ERR_NONE);
+}
+
+// writerが読み飛ばしたフレームは上書きしてよい
+static void test_skipped() {
+    RGYTimestamp ts(false);
+    const int size = (int)ts.size();
+    for (int i = 0; i < size * 4; i++) {
+        RGY_TEST_CHECK_MSG(ts.add(i, i, i, 1, testMetadata(i)) == RGY_ERR_NONE, "frame %d", i);
+        if (i % 3 == 0) {
+            RGY_TEST_CHECK(metadataId(ts.get(i)) == i);
+        }
+    }
+}
+
+// 衝突しやすいpts (大きな2の累乗の倍数や負の値) でも索引が壊れないこと
+static void test_pts_collision() {
+    RGYTimestamp ts(true);
+    const int size = (int)ts.size();
+    const int64_t step = (int64_t)1 << 32;
+    const int lag = size / 2;
+    for (int i = 0; i < size * 8; i++) {
+        const int64_t pts = (int64_t)(i - size) * step + ((i & 1) ? 0 : -(int64_t)i);
+        RGY_TEST_CHECK(ts.add(pts, i, i, 1, testMetadata(i)) == RGY_ERR_NONE);
+        if (i >= lag) {
+            const int id = i - lag;
+            const int64_t ptsOut = (int64_t)(id - size) * step + ((id & 1) ? 0 : -(int64_t)id);
+            const auto val = ts.get(ptsOut);
+            RGY_TEST_CHECK_MSG(val.inputFrameId == id && metadataId(val) == id, "frame %d: %lld", id, (long long)val.inputFrameId);
+        }
+    }
+}
+
+static void test_encode_frame_id() {
+    RGYTimestamp ts(false);
+    for (int i = 0; i < 3000; i++) {
+        RGY_TEST_CHECK(ts.add(i * 10, i, i, 10, testMetadata(i)) == RGY_ERR_NONE);
+        const auto val = ts.getByEncodeFrameID(i);
+        RGY_TEST_CHECK(val.timestamp == i * 10 && metadataId(val) == i);
+    }
+    RGY_TEST_CHECK(ts.getByEncodeFrameID(3000).inputFrameId < 0);
+}
+
+// check()はmetadataを返さず、後からget()で取り出せること
+// 登録されていないptsは直前のフレームを分割して補う
+static void test_check() {
+    RGYTimestamp ts(true);
+    RGY_TEST_CHECK(ts.add(0, 0, 0, 100, testMetadata(0)) == RGY_ERR_NONE);
+    RGY_TEST_CHECK(ts.add(100, 1, 1, 100, testMetadata(1)) == RGY_ERR_NONE);
+    const auto c0 = ts.check(0);
+    RGY_TEST_CHECK(c0.inputFrameId == 0 && c0.duration == 100 && c0.dataList.size() == 0);
+    const auto c1 = ts.check(50);
+    RGY_TEST_CHECK(c1.timestamp == 50 && c1.inputFrameId == 0 && c1.duration == 50 && c1.dataList.size() == 0);
+    RGY_TEST_CHECK(ts.peek(0).duration == 50);
+    RGY_TEST_CHECK(metadataId(ts.get(0)) == 0);
+    RGY_TEST_CHECK(metadataId(ts.get(50)) == 0);
+    RGY_TEST_CHECK(metadataId(ts.get(100)) == 1);
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_ring_size);
+    RGY_TEST_RUN(test_reorder);
+    RGY_TEST_RUN(test_overflow);
+    RGY_TEST_RUN(test_skipped);
+    RGY_TEST_RUN(test_pts_collision);
+    RGY_TEST_RUN(test_encode_frame_id);
+    RGY_TEST_RUN(test_check);
+    return rgy_test_result();
+}
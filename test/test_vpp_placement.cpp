@@ -0,0 +1,143 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2024 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <unistd.h>
+#include "rgy_test.h"
+#include "mpp_vpp_placement.h"
+
+static VppPlacementCost testCost() {
+    VppPlacementCost cost;
+    cost.transfer = 2.0;
+    cost.set(VppType::RGA_CROP, 0.4);
+    cost.set(VppType::RGA_CSPCONV, 0.6);
+    cost.set(VppType::RGA_RESIZE, 0.8);
+    cost.set(VppType::CL_CROP, 0.5);
+    cost.set(VppType::CL_RESIZE, 1.5);
+    return cost;
+}
+
+static std::vector<VppPlacementCandidate> testCandidates() {
+    std::vector<VppPlacementCandidate> candidates;
+    candidates.push_back(VppPlacementCandidate({ VppType::RGA_CROP, VppType::RGA_RESIZE, VppType::CL_UNSHARP }));
+    candidates.push_back(VppPlacementCandidate({ VppType::CL_CROP, VppType::CL_RESIZE, VppType::CL_UNSHARP }));
+    candidates.push_back(VppPlacementCandidate({ VppType::RGA_CROP, VppType::CL_RESIZE, VppType::CL_UNSHARP }));
+    return candidates;
+}
+
+// 未計測の処理があれば、配置を変更しないこと
+static void test_select_unmeasured() {
+    tstring log;
+    auto candidates = testCandidates();
+    VppPlacementCost empty;
+    RGY_TEST_CHECK(vppPlacementSelect(candidates, empty, 1920 * 1080, 1280 * 720, log) < 0);
+
+    auto cost = testCost();
+    cost.set(VppType::CL_RESIZE, -1.0);
+    RGY_TEST_CHECK(vppPlacementSelect(candidates, cost, 1920 * 1080, 1280 * 720, log) < 0);
+    RGY_TEST_CHECK(log.find(_T("no measurement")) != tstring::npos);
+
+    cost = testCost();
+    cost.transfer = -1.0;
+    RGY_TEST_CHECK(vppPlacementSelect(candidates, cost, 1920 * 1080, 1280 * 720, log) < 0);
+}
+
+// 計測結果に応じて、推定処理時間が最小の候補を選ぶこと
+static void test_select_measured() {
+    tstring log;
+    auto candidates = testCandidates();
+    auto cost = testCost();
+    // RGAのほうが速く、縮小後の解像度で受け渡せる候補が最小
+    RGY_TEST_CHECK(vppPlacementSelect(candidates, cost, 1920 * 1080, 1280 * 720, log) == 0);
+    // OpenCLのほうが速く、受け渡しのコストが小さければOpenCLで行う
+    cost.set(VppType::CL_CROP, 0.1);
+    cost.set(VppType::CL_RESIZE, 0.1);
+    cost.transfer = 0.01;
+    RGY_TEST_CHECK(vppPlacementSelect(candidates, cost, 1920 * 1080, 1280 * 720, log) == 1);
+    // 受け渡しのコストが大きければ、入力解像度での受け渡しを避ける
+    cost.transfer = 10.0;
+    RGY_TEST_CHECK(vppPlacementSelect(candidates, cost, 1920 * 1080, 1280 * 720, log) == 0);
+    for (const auto& cand : candidates) {
+        RGY_TEST_CHECK(cand.transitions == 2);
+    }
+}
+
+// キャッシュはkeyごとに保存され、他のkeyの行は保持されること
+static void test_cache_key() {
+    char path[] = "/tmp/rkmppenc_test_placementXXXXXX";
+    const int fd = mkstemp(path);
+    RGY_TEST_CHECK(fd >= 0);
+    if (fd < 0) return;
+    close(fd);
+
+    const auto key1 = vppPlacementCostKey("Mali-G610 r0p0", RGY_CSP_NV12, 1920, 1080, 1280, 720);
+    const auto key2 = vppPlacementCostKey("Mali-G610 r0p0", RGY_CSP_NV12, 3840, 2160, 1920, 1080);
+    RGY_TEST_CHECK(key1 != key2);
+    RGY_TEST_CHECK(key1.find(' ') == std::string::npos);
+
+    auto cost1 = testCost();
+    auto cost2 = testCost();
+    cost2.transfer = 3.0;
+    cost2.set(VppType::CL_RESIZE, 0.25);
+    RGY_TEST_CHECK(cost1.save(path, key1));
+    RGY_TEST_CHECK(cost2.save(path, key2));
+    cost1.set(VppType::RGA_RESIZE, 0.9);
+    RGY_TEST_CHECK(cost1.save(path, key1)); // 上書き
+
+    VppPlacementCost loaded;
+    RGY_TEST_CHECK(loaded.load(path, key1));
+    RGY_TEST_CHECK(loaded.transfer == 2.0 && loaded.get(VppType::RGA_RESIZE) == 0.9 && loaded.get(VppType::CL_RESIZE) == 1.5);
+    RGY_TEST_CHECK(loaded.load(path, key2));
+    RGY_TEST_CHECK(loaded.transfer == 3.0 && loaded.get(VppType::CL_RESIZE) == 0.25);
+    RGY_TEST_CHECK(!loaded.load(path, vppPlacementCostKey("other", RGY_CSP_NV12, 1920, 1080, 1280, 720)));
+
+    int lines = 0;
+    std::ifstream ifs(path);
+    std::string line;
+    while (std::getline(ifs, line)) lines++;
+    RGY_TEST_CHECK(lines == 2);
+    remove(path);
+}
+
+static void test_measure() {
+    int count = 0;
+    const double value = vppPlacementMeasure(1000, [&]() { count++; return RGY_ERR_NONE; });
+    RGY_TEST_CHECK(value > 0.0 && count > 1);
+    RGY_TEST_CHECK(vppPlacementMeasure(1000, []() { return RGY_ERR_UNSUPPORTED; }) < 0.0);
+    RGY_TEST_CHECK(vppPlacementMeasure(0, []() { return RGY_ERR_NONE; }) < 0.0);
+}
+
+int main(int argc, char **argv) {
+    RGY_TEST_RUN(test_select_unmeasured);
+    RGY_TEST_RUN(test_select_measured);
+    RGY_TEST_RUN(test_cache_key);
+    RGY_TEST_RUN(test_measure);
+    return rgy_test_result();
+}